@@ -1,42 +1,247 @@
+#pragma once
 #include <iostream>
 #include <memory>
+#include <stdexcept>
+#include <deque>
 #include <vector>
+#include <algorithm>
+#include <functional>
+#include <thread>
 #include "packet.h"
 #include "io.h"
+#include "frame_pool.h"
+#include "stats_line.h"
 #include <chrono>
 
+// input arbiter modes of ualink_turbo64, see configure_arbiter()
+enum class ArbMode : uint8_t {
+    ROUND_ROBIN = 0,
+    STRICT      = 1,   // highest traffic class first
+    WEIGHTED    = 2    // weighted round robin, weight frames per turn
+};
+
+// UALink atomics of ualink_turbo64, the IPv4 TOS of the request, see remote_atomic()
+enum class AtomicOp : uint8_t {
+    FETCH_ADD = 0x05,
+    SWAP      = 0x06,
+    CAS       = 0x07   // swap if the word equals the compare value
+};
+
+// TOS bit of a sized UALink READ (0x09) / WRITE (0x0A), see sized_request_frame()
+static constexpr uint8_t UA_SIZED = 0x08;
+
+// TOS of a COUNTERS read, see read_counters(): DSCP 3 with ECN 0, an experimental / local use code
+// point (RFC 2474 pool 2) that ordinary traffic does not carry
+static constexpr uint8_t UA_COUNTERS = 0x0C;
+
+// TOS of a GEMM op on the FMA engine, see post_gemm(), and on the systolic array (TOS bit 3 set), see
+// post_gemm_systolic()
+static constexpr uint8_t UA_GEMM = 0x03;
+static constexpr uint8_t UA_GEMM_SYSTOLIC = 0x0B;
+
+// Performance counters of ualink_turbo64, free running from reset.  frames[] is indexed by the TOS op
+// of the port 0 frames: 1 READ, 2 WRITE, 3 GEMM, 4 ARB_CFG, 5 FADD, 6 SWAP, 7 CAS, 0 anything else
+// (memcached, plain traffic, the COUNTERS reads themselves).
+struct UalinkCounters {
+    static constexpr int words = 14;          // words 4-17 of the COUNTERS frame
+    uint64_t cycles = 0;
+    uint64_t frames[8] = {};
+    uint64_t tx_stall_cycles = 0;             // m_axis_tvalid waiting on m_axis_tready
+    uint64_t bram_conflict_cycles = 0;        // FMA engine waiting on DPMEM port B, used by the memcached path
+    uint64_t fma_busy_cycles = 0;
+    uint16_t queue_hwm[5] = {};               // input FIFO high water marks in beats, since reset
+    uint64_t in_stall_cycles = 0;             // a port 0 beat waiting on s_axis_tready_0, the MAC drops then
+
+    // counts since an earlier sample, the high water marks stay as they are
+    UalinkCounters operator- (const UalinkCounters& before) const {
+        UalinkCounters d = *this;
+        d.cycles -= before.cycles;
+        for (int i = 0; i < 8; i++) d.frames[i] -= before.frames[i];
+        d.tx_stall_cycles -= before.tx_stall_cycles;
+        d.bram_conflict_cycles -= before.bram_conflict_cycles;
+        d.fma_busy_cycles -= before.fma_busy_cycles;
+        d.in_stall_cycles -= before.in_stall_cycles;
+        return d;
+    }
+
+    void print (std::ostream& out) const {
+        static const char* const ops[8] = {"other", "read", "write", "gemm", "arb_cfg", "fadd", "swap", "cas"};
+        StatsLine line(out);
+        line("cycles", cycles);
+        for (int i = 0; i < 8; i++) line(ops[i], frames[i]);
+        line("tx_stall", tx_stall_cycles)("bram_conflict", bram_conflict_cycles)("fma_busy", fma_busy_cycles)
+            .list("queue_hwm", queue_hwm, 5)("in_stall", in_stall_cycles);
+    }
+};
+
+// Host side of the credit flow control, see FPGAInterface::flow_control.  Counts since the
+// FPGAInterface was made.
+struct FlowStats {
+    uint64_t frames_sent = 0;        // frames that spent credits
+    uint64_t credit_waits = 0;       // sends that waited for credits
+    uint64_t credit_wait_us = 0;     // and how long in all
+    uint64_t responses_queued = 0;   // responses that came in while a send waited, kept for the waits
+    uint64_t credit_updates = 0;     // responses with the FPGA's credit bytes
+    uint64_t lost = 0;               // frames never answered, given up on after a timeout
+
+    void print (std::ostream& out) const {
+        StatsLine{out}("frames_sent", frames_sent)("credit_waits", credit_waits)("credit_wait_us", credit_wait_us)
+            ("responses_queued", responses_queued)("credit_updates", credit_updates)("lost", lost);
+    }
+};
+
 class FPGAInterface {
 public:
     FPGAInterface(const std::string& dev, const std::string& s_mac, const std::string& d_mac) : 
     sock_interface(dev), src_mac(s_mac), dst_mac(d_mac) {}
+    // the same requests into a model of the FPGA instead, e.g. UalinkSim (ualink_sim.h)
+    FPGAInterface(FrameLink& link, const std::string& s_mac, const std::string& d_mac) :
+    sock_interface(link), src_mac(s_mac), dst_mac(d_mac) {}
     RawEth sock_interface;
     std::string src_mac;
     std::string dst_mac;
     int ack_timeout_ms = 200;
     int read_timeout_ms = 200;
+    int atomic_timeout_ms = 200;
+    int gemm_timeout_ms = 200;
+    // traffic class of the requests, sent as the PCP of an 802.1Q tag; -1 sends them untagged
+    int traffic_class = -1;
+    // Credit flow control of the FPGA's port 0 FIFO.  Every frame that comes back on port 0 spends the
+    // beats it takes in the FIFO and gets them back when its response comes in (port 0 answers in
+    // order), or earlier when a UALink op or COUNTERS response says the FPGA has freed them (bytes
+    // 26-29, see ualink_turbo64).  A send that would go past the FPGA's window waits for responses and
+    // keeps them for the waits after it, so the FIFO never backs up into the MAC, which drops frames.
+    // The beat size and window are asked for with a COUNTERS read before the first send.
+    bool flow_control = true;
+    FlowStats flow;
+    // pool of the frames of send_frame/recv_frame and of the responses kept while a send waits for
+    // credits, FramePool::shared() if not set
+    FramePool* frame_pool = nullptr;
+
+    void set_traffic_class (int tc) {
+        traffic_class = tc;
+    }
+
+    // the ether header of the UALink frames: both MACs, and the 802.1Q tag of traffic_class if set
+    ether eth_header () const {
+        ether e_header;
+        e_header.set_src_ether(src_mac);
+        e_header.set_dst_ether(dst_mac);
+        if (traffic_class >= 0) e_header.set_traffic_class(traffic_class);
+        return e_header;
+    }
+
+    // The Ethernet and IPv4 headers of a UALink op frame of len bytes, zeroed first: e_header's MACs
+    // and 802.1Q tag (eth_header()), then IPv4 with the op in the TOS byte, ID id, TTL 64 and UDP.
+    // The total length is len less the Ethernet header unless ip_len is given (the sized ops carry
+    // their tag and req_len there).  A tag only moves the IPv4 header, by 4 bytes: the op's own fields
+    // stay at their frame offsets (credits 26-29, word address 31, data from 32).  Returns the offset
+    // of the IPv4 header.
+    static int ipv4_request_frame (const ether& e_header, uint8_t tos, int len, uint8_t* frame,
+                                   uint16_t id = 0, int ip_len = -1) {
+        memset(frame, 0, len);
+        memcpy(frame, e_header.dst.data(), 6);
+        memcpy(frame + 6, e_header.src.data(), 6);
+        int eth_len = 14;
+        if (e_header.vlan) {
+            uint16_t tci = e_header.tci();
+            frame[12] = 0x81;
+            frame[13] = 0x00;
+            frame[14] = tci >> 8;
+            frame[15] = tci & 0xFF;
+            eth_len = 18;
+        }
+        frame[eth_len - 2] = 0x08;
+        frame[eth_len - 1] = 0x00;
+
+        uint8_t* ip = frame + eth_len;
+        if (ip_len < 0) ip_len = len - eth_len;
+        ip[0] = 0x45;
+        ip[1] = tos;
+        ip[2] = ip_len >> 8;
+        ip[3] = ip_len & 0xFF;
+        ip[4] = id >> 8;
+        ip[5] = id & 0xFF;
+        ip[8] = 64;
+        ip[9] = 17;
+        uint16_t ip_words[10];
+        for (int i = 0; i < 10; i++) ip_words[i] = (ip[2*i] << 8) | ip[2*i + 1];
+        uint16_t csum = ipv4_checksum(ip_words);
+        ip[10] = csum >> 8;
+        ip[11] = csum & 0xFF;
+        return eth_len;
+    }
+
+    // offset of the IPv4 header of a UALink op frame, as sent or as it comes back.  A tagged response
+    // is read with its tag, so the NIC must not strip it (ethtool -K <if> rxvlan off).
+    static int ip_offset (const uint8_t* frame) {
+        return frame[12] == 0x81 && frame[13] == 0x00 ? 18 : 14;
+    }
+
+    FramePool& frames () {
+        return frame_pool ? *frame_pool : FramePool::shared();
+    }
+
+    // The data path in pool frames, nothing allocated per frame: a request is built in place in a
+    // frame of frames() (sized_request_frame, atomic_request_frame, ...) with set_len, send_frame sends
+    // it with its credits spent like every op here, and recv_frame hands back the next response in a
+    // frame of the same pool.  The caller keeps the request's FrameRef until the response that
+    // completes it is matched (sized_response_of, atomic_response_of), then both go back.
+    bool send_frame (const FrameRef& frame) {
+        spend_credits(frame.len());
+        return sock_interface.send_on_wire(frame.data(), frame.len());
+    }
+
+    // the next response, a null FrameRef if none came in timeout_ms or the pool is out of frames;
+    // frames that are not responses (is_response) are dropped
+    FrameRef recv_frame (int timeout_ms) {
+        if (!rx_backlog.empty()) {
+            FrameRef r = std::move(rx_backlog.front());
+            rx_backlog.pop_front();
+            return r;
+        }
+        FrameRef r = frames().alloc();
+        if (!r) return r;
+        auto start = std::chrono::steady_clock::now();
+        while (true) {
+            int n = 0;
+            if (sock_interface.recv_inbound(r.data(), FramePool::FRAME_BYTES, &n) && take_credits(r.data(), n)) {
+                r.set_len(n);
+                return r;
+            }
+            int elapsed = (int)std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start).count();
+            if (elapsed >= timeout_ms) {
+                lose_credits(1);
+                return FrameRef();
+            }
+        }
+    }
 
     bool send_batch_wait_ack (std::vector<std::array<uint8_t,226>>& payload_vec, uint64_t mem_addr, uint8_t op, uint8_t tag) {
-        for (int i = 0; i < payload_vec.size(); i++) {
-            Packet p_send;
-            ether e_header;
+        return send_batch_wait_ack(payload_vec.data(), payload_vec.size(), mem_addr, op, tag);
+    }
+
+    // the same for count payloads wherever they are, no vector to build
+    bool send_batch_wait_ack (const std::array<uint8_t,226>* payloads, size_t count, uint64_t mem_addr, uint8_t op,
+                              uint8_t tag) {
+        ether e_header = eth_header();
+        for (size_t i = 0; i < count; i++) {
             ualink ua_header;
             // we are limited to 226 bytes on the payload 
-            // 14 + 16 bytes for the ether + ualink headers 
-            uint8_t frame [14 + 16 + 226];
-            e_header.set_src_ether(src_mac);
-            e_header.set_dst_ether(dst_mac);
-            ua_header.set_attributes(mem_addr, payload_vec[i].size(), op, tag);
-            p_send = e_header / ua_header;
-            int bytes_to_send;
-            p_send.prepare_send(payload_vec[i].data(), frame, bytes_to_send);
+            // 14 + 16 bytes for the ether + ualink headers, 4 more for a VLAN tag
+            uint8_t frame [18 + 16 + 226];
+            ua_header.set_attributes(mem_addr, payloads[i].size(), op, tag);
+            int bytes_to_send = Packet::ualink_frame(e_header, ua_header, payloads[i].data(), frame);
+            spend_credits(bytes_to_send);
             sock_interface.send_on_wire(frame, bytes_to_send);
         }
 
+        // every frame comes back, the ones that came in while the batch waited for credits are queued
         if (op == 2) {
-            return wait_ack(ack_timeout_ms);
+            return wait_responses(ack_timeout_ms, count, nullptr);
         } else if (op == 1) {
-            std::vector<std::array<uint8_t,226>> response_vec;
-            return wait_read(read_timeout_ms, payload_vec.size(), response_vec);
+            return wait_responses(read_timeout_ms, count, nullptr);
         }
 
         return false;
@@ -44,15 +249,16 @@ public:
 
     bool wait_ack (int timeout_ms) {
         auto start = std::chrono::steady_clock::now();
-        std::vector<uint8_t> buf(256);
+        std::array<uint8_t,256> buf;
         while (true) {
-            bool receive_ok = sock_interface.recv_on_wire(buf.data(), 256);
+            bool receive_ok = recv_response(buf.data(), 256);
             if (receive_ok) {
                 return true;
             }
             int elapsed = (int)std::chrono::duration_cast<std::chrono::milliseconds>(
                 std::chrono::steady_clock::now() - start).count();
             if (elapsed >= timeout_ms) { 
+                lose_credits(1);
                 return false;
             }
         }
@@ -60,21 +266,29 @@ public:
     }
 
     bool wait_read (int timeout_ms, int num_expected_read_frames, std::vector<std::array<uint8_t,226>>& response_vec) {
+        return wait_responses(timeout_ms, num_expected_read_frames, &response_vec);
+    }
+
+    // wait_read that only counts the responses with response_vec null
+    bool wait_responses (int timeout_ms, size_t num_expected_read_frames, std::vector<std::array<uint8_t,226>>* response_vec) {
         auto start = std::chrono::steady_clock::now();
         std::array<uint8_t,256> buf;
-        int num_actual_read_frames;
+        size_t num_actual_read_frames = 0;
         while (true) {
-            bool receive_ok = sock_interface.recv_on_wire(buf.data(), 256);
+            bool receive_ok = recv_response(buf.data(), 256);
             if (receive_ok) {
                 num_actual_read_frames++;
-                std::array<uint8_t,226> arr;
-                std::copy(buf.begin(), buf.begin() + arr.size(), arr.begin());
-                response_vec.push_back(arr);
+                if (response_vec) {
+                    std::array<uint8_t,226> arr;
+                    std::copy(buf.begin(), buf.begin() + arr.size(), arr.begin());
+                    response_vec->push_back(arr);
+                }
                 if (num_actual_read_frames == num_expected_read_frames) return true;
             }
             int elapsed = (int)std::chrono::duration_cast<std::chrono::milliseconds>(
                 std::chrono::steady_clock::now() - start).count();
             if (elapsed >= timeout_ms) { 
+                lose_credits(num_expected_read_frames - num_actual_read_frames);
                 return false;
             }
         }
@@ -83,20 +297,485 @@ public:
 
     void send_ack (uint64_t mem_addr, uint8_t tag) {
         std::array<uint8_t,226> payload_ack = {0xFF};
-        Packet p_send;
-        ether e_header;
+        ether e_header = eth_header();
         ualink ua_header;
         // we are limited to 226 bytes on the payload 
-        // 14 + 16 bytes for the ether + ualink headers 
-        uint8_t frame [14 + 16 + 226];
-        e_header.set_src_ether(src_mac);
-        e_header.set_dst_ether(dst_mac);
+        // 14 + 16 bytes for the ether + ualink headers, 4 more for a VLAN tag
+        uint8_t frame [18 + 16 + 226];
         // assuming that operation type here is 3 for ACK
         // TODO discuss and change if needed 
         ua_header.set_attributes(mem_addr, payload_ack.size(), 3, tag);
-        p_send = e_header / ua_header;
-        int bytes_to_send;
-        p_send.prepare_send(payload_ack.data(), frame, bytes_to_send);
+        int bytes_to_send = Packet::ualink_frame(e_header, ua_header, payload_ack.data(), frame);
         sock_interface.send_on_wire(frame, bytes_to_send);
     }
-};
\ No newline at end of file
+
+    // Set the input arbiter of the FPGA.  It is configured in band like the UALink ops, with an
+    // IPv4 frame whose TOS is 0x04 (ARB_CFG), and forwarded as usual afterwards.  Byte 48 (UDP
+    // payload byte 6 untagged) is the mode, byte 49+q is {weight, 1'b0, class} of input queue q:
+    // weight 1..15 frames per turn, class 0..7 for frames without a VLAN tag.
+    bool configure_arbiter (ArbMode mode, const std::array<uint8_t,5>& weights, const std::array<uint8_t,5>& classes) {
+        uint8_t frame[60];
+        int ip = ipv4_request_frame(eth_header(), 0x04, sizeof(frame), frame, 0, 20 + 8 + 12);   // ARB_CFG
+
+        uint8_t* udp_hdr = frame + ip + 20;
+        uint16_t udp_len = 8 + 12;
+        udp_hdr[0] = 12345 >> 8; udp_hdr[1] = 12345 & 0xFF;
+        udp_hdr[2] = 12345 >> 8; udp_hdr[3] = 12345 & 0xFF;
+        udp_hdr[4] = udp_len >> 8;
+        udp_hdr[5] = udp_len & 0xFF;
+
+        uint8_t* cfg = frame + 14 + 20 + 8;     // at its untagged offset, a tag moves only the headers
+        cfg[6] = static_cast<uint8_t>(mode);
+        for (int q = 0; q < 5; q++) {
+            uint8_t w = weights[q] == 0 ? 1 : (weights[q] > 15 ? 15 : weights[q]);
+            cfg[7 + q] = static_cast<uint8_t>(w << 4 | (classes[q] & 0x7));
+        }
+        return sock_interface.send_on_wire(frame, sizeof(frame));
+    }
+    // One atomic on the 64-bit DPMEM word at word_addr, done by the FPGA as a single read-modify-write
+    // while the frame streams through, so there is one round trip and nothing can get in between.
+    // The request is a min-size IPv4 frame with the op in the TOS byte, the word address in byte 31,
+    // the operand (addend, new value) in bytes 32-39 and the CAS compare value in bytes 40-47, both
+    // little endian like the words of the datapath.  It comes back with the old value in bytes 40-47.
+    bool remote_atomic (AtomicOp op, uint8_t word_addr, uint64_t operand, uint64_t compare, uint64_t& old_value) {
+        uint8_t frame[60];
+        atomic_request_frame(eth_header(), op, word_addr, operand, compare, frame);
+
+        spend_credits(sizeof(frame));
+        if (!sock_interface.send_on_wire(frame, sizeof(frame))) return false;
+
+        // the response is the request with word 5 replaced, match it on op, address and operand
+        auto start = std::chrono::steady_clock::now();
+        std::array<uint8_t,256> buf;
+        while (true) {
+            buf.fill(0);
+            if (recv_response(buf.data(), buf.size()) && atomic_response_of(frame, buf.data())) {
+                old_value = atomic_old_value(buf.data());
+                return true;
+            }
+            int elapsed = (int)std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start).count();
+            if (elapsed >= atomic_timeout_ms) {
+                lose_credits(1);
+                return false;
+            }
+        }
+    }
+
+    // The 60 byte frame of remote_atomic
+    static void atomic_request_frame (const ether& e_header, AtomicOp op, uint8_t word_addr, uint64_t operand,
+                                      uint64_t compare, uint8_t* frame) {
+        ipv4_request_frame(e_header, static_cast<uint8_t>(op), 60, frame);
+        frame[31] = word_addr;
+        for (int i = 0; i < 8; i++) {
+            frame[32 + i] = static_cast<uint8_t>(operand >> (8 * i));
+            frame[40 + i] = static_cast<uint8_t>(compare >> (8 * i));
+        }
+    }
+
+    // buf answers the atomic request frame: same op, address and operand
+    static bool atomic_response_of (const uint8_t* frame, const uint8_t* buf) {
+        return buf[ip_offset(buf) + 1] == frame[ip_offset(frame) + 1] && buf[31] == frame[31] &&
+               memcmp(buf + 32, frame + 32, 8) == 0;
+    }
+
+    static uint64_t atomic_old_value (const uint8_t* buf) {
+        uint64_t v = 0;
+        for (int i = 0; i < 8; i++) v |= static_cast<uint64_t>(buf[40 + i]) << (8 * i);
+        return v;
+    }
+
+    // Frame of a sized UALink READ (op 1) or WRITE (op 2) of num_bytes at byte address user_addr, returns
+    // its length.  The IPv4 TOS is the op | UA_SIZED, IPv4 bytes 2-5 (frame bytes 16-19 untagged) are
+    // tag, req_len and req_attr (last mask, first mask) from ualink::calc_req_addr_attr at their UALink
+    // header offsets, byte 31 the DPMEM
+    // word address and the req_len+1 words from byte 32 the data, byte user_addr % 8 of byte 32 on.  The
+    // FPGA only writes (returns) the bytes the masks enable.  frame must have room for 32 + 8 * 33 bytes.
+    static int sized_request_frame (const ether& e_header, uint8_t op, uint64_t user_addr, const uint8_t* payload,
+                                    uint8_t num_bytes, uint8_t tag, uint8_t* frame) {
+        ualink ua_header;
+        ua_header.set_attributes(user_addr, num_bytes, op, tag);
+        ua_header.calc_req_addr_attr();
+        int words = ua_header.ua_hdr.req_len + 1;
+        int len = std::max(32 + 8 * words, 60);
+        // req_attr is {last word mask, first word mask}
+        ipv4_request_frame(e_header, UA_SIZED | op, len, frame, ua_header.ua_hdr.req_attr,
+                           tag << 8 | ua_header.ua_hdr.req_len);
+        frame[31] = static_cast<uint8_t>(ua_header.ua_hdr.base_addr / 8);
+        if (op == 2) memcpy(frame + 32 + (user_addr & 0x7), payload, num_bytes);
+        return len;
+    }
+
+    // Sized WRITE/READ of num_bytes (1-255) at byte address user_addr, one round trip each.  The
+    // request comes back as the response, a read with the data in place.
+    bool remote_write_bytes (uint64_t user_addr, const uint8_t* data, uint8_t num_bytes, uint8_t tag) {
+        return sized_round_trip(2, user_addr, data, num_bytes, tag, nullptr, ack_timeout_ms);
+    }
+
+    bool remote_read_bytes (uint64_t user_addr, uint8_t* data, uint8_t num_bytes, uint8_t tag) {
+        return sized_round_trip(1, user_addr, nullptr, num_bytes, tag, data, read_timeout_ms);
+    }
+
+    // Sized WRITE/READ sent without waiting for the response, so requests can be in flight back to back.
+    // key is what the response is matched on (TOS, tag, req_len and word address), wait_sized takes it.
+    // Port 0 answers in order, so the responses are waited for in the order the requests went out:
+    // wait_sized drops any frame that is not the one it waits for.
+    bool post_sized (uint8_t op, uint64_t user_addr, const uint8_t* payload, uint8_t num_bytes, uint8_t tag,
+                     std::array<uint8_t,4>& key) {
+        uint8_t frame[32 + 8 * 33];
+        int len = sized_request_frame(eth_header(), op, user_addr, payload, num_bytes, tag, frame);
+        key = sized_key(frame);
+        spend_credits(len);
+        return sock_interface.send_on_wire(frame, len);
+    }
+
+    bool wait_sized (const std::array<uint8_t,4>& key, uint64_t user_addr, uint8_t num_bytes, uint8_t* data_out,
+                     int timeout_ms) {
+        auto start = std::chrono::steady_clock::now();
+        std::array<uint8_t,32 + 8 * 33> buf;
+        while (true) {
+            buf.fill(0);
+            if (recv_response(buf.data(), buf.size()) && sized_response_of(key, buf.data())) {
+                if (data_out) memcpy(data_out, buf.data() + 32 + (user_addr & 0x7), num_bytes);
+                return true;
+            }
+            int elapsed = (int)std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start).count();
+            if (elapsed >= timeout_ms) {
+                lose_credits(1);
+                return false;
+            }
+        }
+    }
+
+    // what the response to a sized request frame is matched on: TOS, tag, req_len and word address
+    static std::array<uint8_t,4> sized_key (const uint8_t* frame) {
+        const uint8_t* ip = frame + ip_offset(frame);
+        return {ip[1], ip[2], ip[3], frame[31]};
+    }
+
+    // buf answers the sized request with this key (post_sized)
+    static bool sized_response_of (const std::array<uint8_t,4>& key, const uint8_t* buf) {
+        return sized_key(buf) == key;
+    }
+
+    // GEMM tile on the FPGA's FMA engine: C = A x B, or C += A x B with accumulate, on signed int8 8x8
+    // tiles in DPMEM.  A and B are 8 words from a_word and b_word, row r in word r and element c in its
+    // byte c, C is 32 words of int32 from c_word, row major and little endian (24-bit accumulators, sign
+    // extended).  The request is a min-size IPv4 frame with TOS 0x03 (UA_GEMM), byte 31 the C address,
+    // bytes 32/33 the A/B addresses, byte 34 bit 0 accumulate and the IPv4 ID the tag.  The FPGA queues
+    // the job as the frame comes in and sends the frame back when C is written: wait_gemm returns 1
+    // then, 0 if the FPGA had no room for the job (it comes back at once, C untouched) and -1 without
+    // an answer.  Jobs run in order, so the tiles of the next job can go up while one runs.
+    bool post_gemm (uint8_t a_word, uint8_t b_word, uint8_t c_word, bool accumulate, uint16_t tag) {
+        uint8_t frame[60];
+        ipv4_request_frame(eth_header(), UA_GEMM, sizeof(frame), frame, tag);
+        frame[31] = c_word;
+        frame[32] = a_word;
+        frame[33] = b_word;
+        frame[34] = accumulate ? 1 : 0;
+        spend_credits(sizeof(frame));
+        return sock_interface.send_on_wire(frame, sizeof(frame));
+    }
+
+    // The same job on the systolic array (TOS 0x0B, UA_GEMM_SYSTOLIC): C = A x B over a K-deep panel, K
+    // up to 255, panel from panel_word with 2 words per step, the column of A (element r in byte r)
+    // then the row of B.  keep_acc carries the accumulators over from the job before instead of
+    // clearing them, hold_c leaves C unwritten, so a long K goes up as a chain of jobs that writes C
+    // once at the end.  Both engines take jobs from one queue, in order; wait_gemm answers either.
+    bool post_gemm_systolic (uint8_t panel_word, uint8_t k, uint8_t c_word, bool keep_acc, bool hold_c,
+                             uint16_t tag) {
+        uint8_t frame[60];
+        ipv4_request_frame(eth_header(), UA_GEMM_SYSTOLIC, sizeof(frame), frame, tag);
+        frame[31] = c_word;
+        frame[32] = panel_word;
+        frame[33] = k;
+        frame[34] = (keep_acc ? 1 : 0) | (hold_c ? 2 : 0);
+        spend_credits(sizeof(frame));
+        return sock_interface.send_on_wire(frame, sizeof(frame));
+    }
+
+    int wait_gemm (uint16_t tag, int timeout_ms) {
+        auto start = std::chrono::steady_clock::now();
+        std::array<uint8_t,256> buf;
+        while (true) {
+            buf.fill(0);
+            if (recv_response(buf.data(), buf.size()) && gemm_response_of(tag, buf.data())) {
+                return buf[35] == 1 ? 1 : 0;
+            }
+            int elapsed = (int)std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start).count();
+            if (elapsed >= timeout_ms) {
+                lose_credits(1);
+                return -1;
+            }
+        }
+    }
+
+    // buf answers the GEMM request with this tag: same IPv4 ID
+    static bool gemm_response_of (uint16_t tag, const uint8_t* buf) {
+        const uint8_t* ip = buf + ip_offset(buf);
+        return (ip[1] == UA_GEMM || ip[1] == UA_GEMM_SYSTOLIC) && ip[4] == (tag >> 8) && ip[5] == (tag & 0xFF);
+    }
+
+    // Read the performance counters.  The request is an IPv4 frame with TOS 0x0C (UA_COUNTERS) and
+    // room for the counters in words 4-16, the FPGA fills them in as the frame streams through and
+    // sends it back, like a READ.  The IPv4 ID tells the responses apart.
+    bool read_counters (UalinkCounters& c) {
+        uint8_t frame[COUNTERS_FRAME_LEN];
+        counters_request_frame(eth_header(), ++counters_id, frame);
+
+        spend_credits(sizeof(frame));
+        if (!sock_interface.send_on_wire(frame, sizeof(frame))) return false;
+
+        auto start = std::chrono::steady_clock::now();
+        std::array<uint8_t,256> buf;
+        while (true) {
+            buf.fill(0);
+            if (recv_response(buf.data(), buf.size()) && counters_response_of(frame, buf.data())) {
+                parse_counters(buf.data(), c);
+                return true;
+            }
+            int elapsed = (int)std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start).count();
+            if (elapsed >= read_timeout_ms) {
+                lose_credits(1);
+                return false;
+            }
+        }
+    }
+
+    static constexpr int COUNTERS_FRAME_LEN = 32 + 8 * UalinkCounters::words;
+
+    // The COUNTERS_FRAME_LEN byte frame of read_counters, IPv4 ID id
+    static void counters_request_frame (const ether& e_header, uint16_t id, uint8_t* frame) {
+        ipv4_request_frame(e_header, UA_COUNTERS, COUNTERS_FRAME_LEN, frame, id);
+    }
+
+    // buf answers the COUNTERS request frame: same IPv4 ID
+    static bool counters_response_of (const uint8_t* frame, const uint8_t* buf) {
+        const uint8_t* ip = buf + ip_offset(buf);
+        return ip[1] == UA_COUNTERS && memcmp(ip + 4, frame + ip_offset(frame) + 4, 2) == 0;
+    }
+
+    static void parse_counters (const uint8_t* buf, UalinkCounters& c) {
+        uint64_t w[UalinkCounters::words];
+        for (int k = 0; k < UalinkCounters::words; k++) {
+            w[k] = 0;
+            for (int i = 0; i < 8; i++) w[k] |= static_cast<uint64_t>(buf[32 + 8 * k + i]) << (8 * i);
+        }
+        c.cycles = w[0];
+        for (int i = 0; i < 8; i++) c.frames[i] = w[1 + i];
+        c.tx_stall_cycles = w[9];
+        c.bram_conflict_cycles = w[10];
+        c.fma_busy_cycles = w[11];
+        for (int q = 0; q < 5; q++) c.queue_hwm[q] = (w[12] >> (12 * q)) & 0xFFF;
+        c.in_stall_cycles = w[13];
+    }
+
+    // Read the counters every interval, on a fixed schedule (a slow read does not push the later ones
+    // back), and hand each sample with its difference to the one before to sink, the host metrics
+    // stream.  Stops after samples reads, or with samples 0 when sink returns false.  Returns the reads
+    // that got no answer, they are skipped.
+    int poll_counters (std::chrono::milliseconds interval, int samples,
+                       const std::function<bool(const UalinkCounters& now, const UalinkCounters& delta)>& sink) {
+        UalinkCounters prev, now;
+        bool have_prev = false;
+        int missed = 0;
+        auto next = std::chrono::steady_clock::now();
+        for (int n = 0; samples == 0 || n < samples; n++) {
+            if (!read_counters(now)) {
+                missed++;
+            } else {
+                if (!sink(now, have_prev ? now - prev : now) && samples == 0) break;
+                prev = now;
+                have_prev = true;
+            }
+            next += interval;
+            std::this_thread::sleep_until(next);
+        }
+        return missed;
+    }
+
+    // Ask for the FPGA's beat size and window with a COUNTERS read, false if it did not say
+    bool sync_credits () {
+        cr_asked = true;
+        UalinkCounters c;
+        return read_counters(c) && cr_known;
+    }
+
+    // The flow control without the waits, for a caller that runs its own loop and takes the responses
+    // itself with sock_interface.recv_ready (FpgaDevice, reactor.h).  It sends a COUNTERS read first,
+    // since credit_room goes by the 64-bit build's window until take_credits has seen the FPGA's.
+    bool credits_known () const {
+        return cr_known;
+    }
+
+    // frames sent and neither answered nor lost yet
+    size_t frames_in_flight () const {
+        return cr_marks.size();
+    }
+
+    // a frame of len bytes fits the window now
+    bool credit_room (int len) const {
+        return !flow_control || cr_marks.empty() || cr_in_flight() + cr_beats(len) <= cr_window;
+    }
+
+    // a frame of len bytes that comes back on port 0 went out
+    void credits_sent (int len) {
+        if (!flow_control) return;
+        cr_sent += cr_beats(len);
+        cr_marks.push_back(cr_sent);
+        flow.frames_sent++;
+    }
+
+    // buf, n bytes, came back from the FPGA's port 0 for a frame of ours: both MACs as we send them,
+    // and a UALink op (IPv4 with an op TOS, tagged or not) or a UALink frame (0x88B5).  Anything else
+    // the interface sees is not a response, it answers nothing and spends no credits.
+    bool is_response (const uint8_t* buf, int n) const {
+        if (n < 30) return false;
+        std::array<uint8_t,6> mac;
+        ether::parse_mac(dst_mac, mac);
+        if (memcmp(buf, mac.data(), 6) != 0) return false;
+        ether::parse_mac(src_mac, mac);
+        if (memcmp(buf + 6, mac.data(), 6) != 0) return false;
+        const uint8_t* ip = buf + ip_offset(buf);
+        if (ip[-2] == 0x88 && ip[-1] == 0xB5) return true;
+        return ip[-2] == 0x08 && ip[-1] == 0x00 && ip[0] == 0x45 && is_op(ip[1]);
+    }
+
+    // the TOS of an op that comes back on port 0 and spends credits: READ/WRITE sized or not, GEMM on
+    // either engine, the atomics and COUNTERS; ARB_CFG (0x04) does not
+    static bool is_op (uint8_t tos) {
+        return tos == UA_COUNTERS || tos == UA_GEMM_SYSTOLIC || (tos < 0x0B && tos != 0x00 && tos != 0x04 && tos != 0x08);
+    }
+
+    // A frame came in, false if it is not a response (is_response).  A response means the frame it
+    // answers has left the FIFO, and so have the beats the FPGA says it freed, if it says.  When
+    // nothing is in flight any more its count is taken over as is, so the later ones compare; with
+    // other traffic on port 0 they run ahead of cr_sent and are ignored.
+    bool take_credits (const uint8_t* buf, int n) {
+        if (!is_response(buf, n)) return false;
+        uint16_t own = 0;
+        bool answered = !cr_marks.empty();
+        if (answered) {
+            own = static_cast<uint16_t>(cr_marks.front() - cr_last);
+            pop_credit_mark();
+        }
+        const uint8_t* ip = buf + ip_offset(buf);
+        if (ip[-2] != 0x08 || ip[-1] != 0x00) return true;         // a UALink frame, no credit bytes
+        if ((buf[28] != 1 && buf[28] != 4 && buf[28] != 8) || buf[29] < 2 || buf[29] > 15) return true;
+        flow.credit_updates++;
+        if (!cr_known) {
+            cr_known = true;
+            cr_beat_bytes = 8 * buf[28];
+            cr_window = (1 << buf[29]) - 2;
+        }
+        uint16_t freed = static_cast<uint16_t>(buf[26] << 8 | buf[27]);
+        if (answered && cr_marks.empty()) {
+            cr_sent = cr_freed = cr_last = static_cast<uint16_t>(freed + own);
+            cr_synced = true;
+        } else if (cr_synced && cr_later(freed, cr_freed)) {
+            cr_freed = freed;
+        }
+        return true;
+    }
+
+    // the oldest frames in flight will not be answered, their credits come back
+    void lose_credits (size_t frames) {
+        for (; frames > 0 && !cr_marks.empty(); frames--) {
+            pop_credit_mark();
+            flow.lost++;
+        }
+    }
+
+private:
+    uint16_t counters_id = 0;
+
+    // credit state, in beats of the port 0 FIFO, mod 2^16, see flow_control
+    int cr_beat_bytes = 8;                      // the 64-bit build's until the FPGA says
+    int cr_window = 254;
+    bool cr_asked = false, cr_known = false;
+    bool cr_synced = false;                     // cr_sent counts like the FPGA's freed beats
+    uint16_t cr_sent = 0, cr_freed = 0;
+    uint16_t cr_last = 0;                       // cr_sent after the last frame answered
+    RingQueue<uint16_t> cr_marks;               // cr_sent after each frame not answered yet
+    RingQueue<FrameRef> rx_backlog;             // responses that came in while a send waited
+
+    uint16_t cr_in_flight () const {
+        return static_cast<uint16_t>(cr_sent - cr_freed);
+    }
+
+    int cr_beats (int len) const {
+        return (std::max(len, 60) + cr_beat_bytes - 1) / cr_beat_bytes;
+    }
+
+    // the oldest frame in flight is done with, answered or not
+    void pop_credit_mark () {
+        uint16_t m = cr_marks.front();
+        cr_marks.pop_front();
+        cr_last = m;
+        if (cr_later(m, cr_freed)) cr_freed = m;
+    }
+
+    // a is later than b, both from cr_freed to cr_sent
+    bool cr_later (uint16_t a, uint16_t b) const {
+        return static_cast<uint16_t>(cr_sent - a) < static_cast<uint16_t>(cr_sent - b);
+    }
+
+    // A frame of len bytes that comes back on port 0 goes out: wait until the window has room for its
+    // beats and spend them.  The responses taken while it waits go to rx_backlog, one per frame in
+    // flight at most; other frames are dropped in the frame they came in.  ack_timeout_ms without a
+    // response loses the oldest frame in flight.  With nothing in flight it always goes, a frame
+    // bigger than the window too.
+    void spend_credits (int len) {
+        if (!flow_control) return;
+        if (!cr_asked) sync_credits();
+        if (!credit_room(len)) {
+            flow.credit_waits++;
+            auto start = std::chrono::steady_clock::now();
+            auto last = start;
+            FrameRef buf;
+            while (!credit_room(len)) {
+                if (!buf) buf = frames().alloc();
+                if (!buf) throw std::runtime_error("FPGAInterface: frame pool empty");
+                int n = 0;
+                auto now = std::chrono::steady_clock::now();
+                if (sock_interface.recv_inbound(buf.data(), FramePool::FRAME_BYTES, &n) && take_credits(buf.data(), n)) {
+                    buf.set_len(n);
+                    rx_backlog.push_back(std::move(buf));
+                    flow.responses_queued++;
+                    last = now;
+                } else if (now - last >= std::chrono::milliseconds(ack_timeout_ms)) {
+                    lose_credits(1);
+                    last = now;
+                }
+            }
+            flow.credit_wait_us += std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start).count();
+        }
+        credits_sent(len);
+    }
+
+    // the next response, one queued while a send waited for credits first; false for a frame that is
+    // not one (is_response)
+    bool recv_response (uint8_t* buf, uint16_t cap) {
+        if (!rx_backlog.empty()) {
+            int n = std::min<int>(cap, rx_backlog.front().len());
+            memcpy(buf, rx_backlog.front().data(), n);
+            memset(buf + n, 0, cap - n);
+            rx_backlog.pop_front();
+            return true;
+        }
+        int n = 0;
+        return sock_interface.recv_inbound(buf, cap, &n) && take_credits(buf, n);
+    }
+
+    bool sized_round_trip (uint8_t op, uint64_t user_addr, const uint8_t* payload, uint8_t num_bytes, uint8_t tag,
+                           uint8_t* data_out, int timeout_ms) {
+        // the response is matched on op, tag, length and address
+        std::array<uint8_t,4> key;
+        if (!post_sized(op, user_addr, payload, num_bytes, tag, key)) return false;
+        return wait_sized(key, user_addr, num_bytes, data_out, timeout_ms);
+    }
+};
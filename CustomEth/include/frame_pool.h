@@ -0,0 +1,343 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/mempolicy.h>
+#include "stats_line.h"
+
+/*
+Frame buffers for a data path that does not malloc once it runs.
+
+  FramePool - fixed size frame buffers in 2 MB hugepages bound to one NUMA node and faulted in up
+              front, a free list behind a cache of frames per thread, so a thread takes and gives
+              back frames without the lock most of the time
+  FrameRef  - reference counted handle of a pool frame: the frame a request is built in, sent from
+              and kept until its completion, or a response received into one
+  RingQueue - FIFO on a power of 2 ring that only allocates when it grows past its high water mark,
+              for the queues a data path keeps per frame (FPGAInterface's frames in flight and the
+              responses it takes while it waits for credits)
+*/
+
+class FramePool;
+
+class FrameRef {
+public:
+    FrameRef () = default;
+    FrameRef (const FrameRef& o);
+    FrameRef (FrameRef&& o) noexcept : pool(o.pool), index(o.index) {
+        o.pool = nullptr;
+    }
+    FrameRef& operator= (FrameRef o) noexcept {
+        std::swap(pool, o.pool);
+        std::swap(index, o.index);
+        return *this;
+    }
+    ~FrameRef () {
+        reset();
+    }
+
+    // drops the reference, the last one gives the frame back to the pool
+    void reset ();
+
+    explicit operator bool () const {
+        return pool != nullptr;
+    }
+
+    uint8_t* data () const;
+    int len () const;                 // bytes of the frame in use, set by whoever filled it
+    void set_len (int n);
+    uint32_t use_count () const;
+
+private:
+    friend class FramePool;
+    FrameRef (FramePool* p, uint32_t i) : pool(p), index(i) {}
+
+    FramePool* pool = nullptr;
+    uint32_t index = 0;
+};
+
+class FramePool {
+public:
+    static constexpr size_t HUGEPAGE = size_t(2) << 20;
+    static constexpr int FRAME_BYTES = 2048;      // a full size Ethernet frame, 802.1Q tag included
+    static constexpr int CACHE = 64;              // frames a thread keeps, half move at a time
+    static constexpr int MAX_POOLS = 16;          // pools alive at once, each has a cache slot per thread
+
+    struct Stats {
+        size_t frames = 0;
+        int node = -1;
+        bool hugepages = false;       // MAP_HUGETLB, otherwise transparent hugepages were asked for
+        bool bound = false;           // mbind to node took
+        uint64_t refills = 0;         // cache refills from the free list, each takes the lock once
+        uint64_t flushes = 0;         // cache flushes to it
+        uint64_t exhausted = 0;       // allocs with nothing left
+
+        void print (std::ostream& out) const {
+            StatsLine{out}("frames", frames)("node", node)("hugepages", hugepages)("bound", bound)("refills", refills)
+                ("flushes", flushes)("exhausted", exhausted);
+        }
+    };
+
+    // At least frames frames, rounded up to whole hugepages, on NUMA node node, or the node of the
+    // calling thread with -1.  All the memory is mapped and faulted in here.
+    explicit FramePool (size_t frames = 1024, int node = -1) {
+        bytes = (frames * FRAME_BYTES + HUGEPAGE - 1) / HUGEPAGE * HUGEPAGE;
+        count = bytes / FRAME_BYTES;
+        if (count > UINT32_MAX) throw std::runtime_error("FramePool: too many frames");
+        if (node < 0) {
+            unsigned cpu = 0, n = 0;
+            node = syscall(SYS_getcpu, &cpu, &n, nullptr) == 0 ? static_cast<int>(n) : 0;
+        }
+        st.frames = count;
+        st.node = node;
+
+        void* p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (21 << MAP_HUGE_SHIFT), -1, 0);
+        if (p != MAP_FAILED) {
+            st.hugepages = true;
+        } else {
+            // no hugepages reserved: 2 MB aligned small pages for khugepaged to collapse
+            p = mmap(nullptr, bytes + HUGEPAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (p == MAP_FAILED) throw std::runtime_error("FramePool: mmap failed");
+            uintptr_t a = reinterpret_cast<uintptr_t>(p);
+            uintptr_t aligned = (a + HUGEPAGE - 1) & ~(HUGEPAGE - 1);
+            if (aligned > a) munmap(p, aligned - a);
+            munmap(reinterpret_cast<void*>(aligned + bytes), a + HUGEPAGE - aligned);
+            p = reinterpret_cast<void*>(aligned);
+            madvise(p, bytes, MADV_HUGEPAGE);
+        }
+        base = static_cast<uint8_t*>(p);
+        if (node < 64) {
+            unsigned long mask = 1UL << node;
+            st.bound = syscall(SYS_mbind, base, bytes, MPOL_BIND, &mask, 64, 0) == 0;
+        }
+        memset(base, 0, bytes);
+
+        meta.reset(new Meta[count]);
+        free_list.reserve(count);
+        for (size_t i = count; i > 0; i--) free_list.push_back(static_cast<uint32_t>(i - 1));
+
+        gen = next_gen().fetch_add(1) + 1;
+        for (id = 0; id < MAX_POOLS; id++) {
+            uint64_t empty = 0;
+            if (registry()[id].compare_exchange_strong(empty, gen)) break;
+        }
+        if (id == MAX_POOLS) {
+            munmap(base, bytes);
+            throw std::runtime_error("FramePool: too many pools");
+        }
+    }
+
+    // The frames must all be back, and the threads that used the pool must not use it any more;
+    // their caches are dropped with it.
+    ~FramePool () {
+        registry()[id].store(0);
+        munmap(base, bytes);
+    }
+
+    FramePool (const FramePool&) = delete;
+    FramePool& operator= (const FramePool&) = delete;
+
+    // a frame with one reference and len 0, a null FrameRef when every frame is taken
+    FrameRef alloc () {
+        LocalCache& c = local();
+        if (c.n == 0 && !refill(c)) return FrameRef();
+        uint32_t i = c.frames[--c.n];
+        meta[i].refs.store(1, std::memory_order_relaxed);
+        meta[i].len = 0;
+        return FrameRef(this, i);
+    }
+
+    // this thread's cached frames back to the free list, e.g. before it goes idle for long
+    void flush_cache () {
+        LocalCache& c = local();
+        flush(c, c.n);
+    }
+
+    size_t capacity () const {
+        return count;
+    }
+
+    // frames on the free list, not counting the ones in thread caches
+    size_t available () {
+        std::lock_guard<std::mutex> lock(mu);
+        return free_list.size();
+    }
+
+    Stats stats () {
+        std::lock_guard<std::mutex> lock(mu);
+        return st;
+    }
+
+    // A pool for the whole process, made on first use on the node of the thread that uses it first
+    static FramePool& shared () {
+        static FramePool pool;
+        return pool;
+    }
+
+private:
+    friend class FrameRef;
+
+    struct Meta {
+        std::atomic<uint32_t> refs{0};
+        int len = 0;
+    };
+
+    struct LocalCache {
+        uint64_t gen = 0;                 // the pool the frames are from
+        FramePool* pool = nullptr;
+        uint32_t n = 0;
+        uint32_t frames[CACHE];
+    };
+
+    // the caches of one thread, one per pool slot, flushed when the thread exits if their pool is alive
+    struct ThreadCaches {
+        LocalCache slot[MAX_POOLS];
+        ~ThreadCaches () {
+            for (int s = 0; s < MAX_POOLS; s++) {
+                LocalCache& c = slot[s];
+                if (c.n > 0 && c.gen != 0 && registry()[s].load() == c.gen) c.pool->flush(c, c.n);
+            }
+        }
+    };
+
+    static std::atomic<uint64_t>* registry () {
+        static std::atomic<uint64_t> gens[MAX_POOLS];
+        return gens;
+    }
+
+    static std::atomic<uint64_t>& next_gen () {
+        static std::atomic<uint64_t> g{0};
+        return g;
+    }
+
+    uint8_t* base = nullptr;
+    size_t bytes = 0, count = 0;
+    std::unique_ptr<Meta[]> meta;
+    std::mutex mu;
+    std::vector<uint32_t> free_list;    // a stack, reserved for every frame
+    Stats st;
+    uint64_t gen = 0;
+    int id = 0;
+
+    // this thread's cache of this pool; one left by an earlier pool in the slot is dropped
+    LocalCache& local () {
+        thread_local ThreadCaches caches;
+        LocalCache& c = caches.slot[id];
+        if (c.gen != gen) {
+            c.gen = gen;
+            c.pool = this;
+            c.n = 0;
+        }
+        return c;
+    }
+
+    bool refill (LocalCache& c) {
+        std::lock_guard<std::mutex> lock(mu);
+        size_t take = std::min<size_t>(CACHE / 2, free_list.size());
+        if (take == 0) {
+            st.exhausted++;
+            return false;
+        }
+        for (size_t k = 0; k < take; k++) {
+            c.frames[c.n++] = free_list.back();
+            free_list.pop_back();
+        }
+        st.refills++;
+        return true;
+    }
+
+    void flush (LocalCache& c, uint32_t n) {
+        if (n == 0) return;
+        std::lock_guard<std::mutex> lock(mu);
+        for (uint32_t k = 0; k < n; k++) free_list.push_back(c.frames[--c.n]);
+        st.flushes++;
+    }
+
+    void release (uint32_t i) {
+        LocalCache& c = local();
+        if (c.n == CACHE) flush(c, CACHE / 2);
+        c.frames[c.n++] = i;
+    }
+};
+
+inline FrameRef::FrameRef (const FrameRef& o) : pool(o.pool), index(o.index) {
+    if (pool) pool->meta[index].refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+inline void FrameRef::reset () {
+    if (pool && pool->meta[index].refs.fetch_sub(1, std::memory_order_acq_rel) == 1) pool->release(index);
+    pool = nullptr;
+}
+
+inline uint8_t* FrameRef::data () const {
+    return pool->base + static_cast<size_t>(index) * FramePool::FRAME_BYTES;
+}
+
+inline int FrameRef::len () const {
+    return pool->meta[index].len;
+}
+
+inline void FrameRef::set_len (int n) {
+    pool->meta[index].len = n;
+}
+
+inline uint32_t FrameRef::use_count () const {
+    return pool ? pool->meta[index].refs.load(std::memory_order_relaxed) : 0;
+}
+
+template <class T>
+class RingQueue {
+public:
+    // capacity is rounded up to a power of 2, and doubles when a push finds the ring full
+    explicit RingQueue (size_t capacity = 64) {
+        size_t n = 2;
+        while (n < capacity) n <<= 1;
+        buf.resize(n);
+    }
+
+    bool empty () const {
+        return head == tail;
+    }
+
+    size_t size () const {
+        return tail - head;
+    }
+
+    T& front () {
+        return buf[head & (buf.size() - 1)];
+    }
+
+    void push_back (T v) {
+        if (size() == buf.size()) grow();
+        buf[tail++ & (buf.size() - 1)] = std::move(v);
+    }
+
+    // the slot is reset, a FrameRef in it goes back to its pool here
+    void pop_front () {
+        buf[head++ & (buf.size() - 1)] = T();
+    }
+
+private:
+    std::vector<T> buf;
+    size_t head = 0, tail = 0;
+
+    void grow () {
+        std::vector<T> bigger(2 * buf.size());
+        for (size_t i = 0; i < size(); i++) bigger[i] = std::move(buf[(head + i) & (buf.size() - 1)]);
+        tail = size();
+        head = 0;
+        buf.swap(bigger);
+    }
+};
@@ -0,0 +1,433 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <ostream>
+#include <thread>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define GEMM_DISPATCH_X86 1
+#endif
+#include "remote_mem.h"
+
+/*
+Small int8 GEMMs on the CPU or on the FPGA's FMA engine (RemoteMem::gemm_int8), whichever is faster.
+
+  int8_tile_*     - one 8x8x8 tile the way matrix_fma_8x8 does it: C = A x B or C += A x B, the sum
+                    wrapped to a 24-bit accumulator and sign extended to int32.  Scalar, AVX2
+                    (vpmaddwd on int16 pairs) and VNNI (vpdpbusd on groups of 4, AVX-512 VNNI or
+                    AVX-VNNI), best_tile_kernel() picks the best one this CPU runs.
+  cpu_gemm_int8   - M x N x K on a tile kernel, zero padded at the edges and accumulated over runs of
+                    RemoteMem::gemm_max_ktiles tiles of K like the FPGA path, so both give the same C.
+  GemmDispatcher  - per call LOCAL, OFFLOAD or SPLIT (the top rows on the FPGA, the rest on the CPU at
+                    the same time), from a model of both sides: the CPU's MACs/s, and the link's round
+                    trip plus the time per 8x8x8 job, first from the measured bandwidth and then from
+                    the offloads themselves.  Every run updates the side(s) it used, the RTT is pinged
+                    again every recalibrate_calls calls.  Each decision goes to the sink as a
+                    GemmDecision, the totals are in stats().
+*/
+
+// C (8x8, row stride ldc) = [C +] A (8x8, lda) x B (8x8, ldb), 24-bit accumulator like matrix_fma_8x8
+typedef void (*Int8TileKernel)(const int8_t* A, size_t lda, const int8_t* B, size_t ldb,
+                               int32_t* C, size_t ldc, bool accumulate);
+
+static inline int32_t wrap24 (int32_t v) {
+    return static_cast<int32_t>(static_cast<uint32_t>(v) << 8) >> 8;
+}
+
+static inline void int8_tile_scalar (const int8_t* A, size_t lda, const int8_t* B, size_t ldb,
+                                     int32_t* C, size_t ldc, bool accumulate) {
+    for (int r = 0; r < 8; r++) {
+        for (int c = 0; c < 8; c++) {
+            int32_t sum = accumulate ? C[r * ldc + c] : 0;
+            for (int k = 0; k < 8; k++) sum += static_cast<int32_t>(A[r * lda + k]) * B[k * ldb + c];
+            C[r * ldc + c] = wrap24(sum);
+        }
+    }
+}
+
+#ifdef GEMM_DISPATCH_X86
+// B as int16 pairs of rows 2p and 2p+1, column c in 32-bit lane c: a vpmaddwd with the pair
+// A[r][2p], A[r][2p+1] in every lane adds both products of the pair for all 8 columns
+__attribute__((target("avx2")))
+static inline void int8_tile_avx2 (const int8_t* A, size_t lda, const int8_t* B, size_t ldb,
+                                   int32_t* C, size_t ldc, bool accumulate) {
+    __m256i bp[4];
+    for (int p = 0; p < 4; p++) {
+        __m128i r0 = _mm_cvtepi8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(B + 2 * p * ldb)));
+        __m128i r1 = _mm_cvtepi8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(B + (2 * p + 1) * ldb)));
+        bp[p] = _mm256_set_m128i(_mm_unpackhi_epi16(r0, r1), _mm_unpacklo_epi16(r0, r1));
+    }
+    for (int r = 0; r < 8; r++) {
+        const int8_t* a = A + r * lda;
+        __m256i acc = _mm256_setzero_si256();
+        for (int p = 0; p < 4; p++) {
+            int32_t pair = static_cast<uint16_t>(a[2 * p]) | (static_cast<uint32_t>(static_cast<uint16_t>(a[2 * p + 1])) << 16);
+            acc = _mm256_add_epi32(acc, _mm256_madd_epi16(_mm256_set1_epi32(pair), bp[p]));
+        }
+        int32_t* c = C + r * ldc;
+        if (accumulate) acc = _mm256_add_epi32(acc, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(c)));
+        acc = _mm256_srai_epi32(_mm256_slli_epi32(acc, 8), 8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(c), acc);
+    }
+}
+
+// vpdpbusd multiplies unsigned by signed bytes, so A goes in as A + 128 and 128 times the column
+// sums of B come off again.  B in groups of 4 rows, lane c of group g is B[4g..4g+3][c]: q[2g] has
+// columns 0-3, q[2g+1] columns 4-7.
+static inline void vnni_pack_b (const int8_t* B, size_t ldb, __m128i q[4]) {
+    for (int g = 0; g < 2; g++) {
+        const int8_t* b = B + 4 * g * ldb;
+        __m128i r01 = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(b)),
+                                        _mm_loadl_epi64(reinterpret_cast<const __m128i*>(b + ldb)));
+        __m128i r23 = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(b + 2 * ldb)),
+                                        _mm_loadl_epi64(reinterpret_cast<const __m128i*>(b + 3 * ldb)));
+        q[2 * g]     = _mm_unpacklo_epi16(r01, r23);
+        q[2 * g + 1] = _mm_unpackhi_epi16(r01, r23);
+    }
+}
+
+static inline void vnni_a_row (const int8_t* a, int32_t& lo, int32_t& hi) {
+    uint32_t w[2];
+    memcpy(w, a, 8);
+    lo = static_cast<int32_t>(w[0] ^ 0x80808080u);
+    hi = static_cast<int32_t>(w[1] ^ 0x80808080u);
+}
+
+__attribute__((target("avx512vnni,avx512vl,avx2")))
+static inline void int8_tile_avx512vnni (const int8_t* A, size_t lda, const int8_t* B, size_t ldb,
+                                         int32_t* C, size_t ldc, bool accumulate) {
+    __m128i q[4];
+    vnni_pack_b(B, ldb, q);
+    __m256i b0 = _mm256_set_m128i(q[1], q[0]);
+    __m256i b1 = _mm256_set_m128i(q[3], q[2]);
+    __m256i k128 = _mm256_set1_epi32(static_cast<int32_t>(0x80808080u));
+    __m256i vc = _mm256_dpbusd_epi32(_mm256_dpbusd_epi32(_mm256_setzero_si256(), k128, b0), k128, b1);
+    for (int r = 0; r < 8; r++) {
+        int32_t lo, hi;
+        vnni_a_row(A + r * lda, lo, hi);
+        __m256i acc = _mm256_dpbusd_epi32(_mm256_setzero_si256(), _mm256_set1_epi32(lo), b0);
+        acc = _mm256_sub_epi32(_mm256_dpbusd_epi32(acc, _mm256_set1_epi32(hi), b1), vc);
+        int32_t* c = C + r * ldc;
+        if (accumulate) acc = _mm256_add_epi32(acc, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(c)));
+        acc = _mm256_srai_epi32(_mm256_slli_epi32(acc, 8), 8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(c), acc);
+    }
+}
+
+// the same on AVX-VNNI, the VEX encoded vpdpbusd of CPUs without AVX-512
+__attribute__((target("avxvnni,avx2")))
+static inline void int8_tile_avxvnni (const int8_t* A, size_t lda, const int8_t* B, size_t ldb,
+                                      int32_t* C, size_t ldc, bool accumulate) {
+    __m128i q[4];
+    vnni_pack_b(B, ldb, q);
+    __m256i b0 = _mm256_set_m128i(q[1], q[0]);
+    __m256i b1 = _mm256_set_m128i(q[3], q[2]);
+    __m256i k128 = _mm256_set1_epi32(static_cast<int32_t>(0x80808080u));
+    __m256i vc = _mm256_dpbusd_avx_epi32(_mm256_dpbusd_avx_epi32(_mm256_setzero_si256(), k128, b0), k128, b1);
+    for (int r = 0; r < 8; r++) {
+        int32_t lo, hi;
+        vnni_a_row(A + r * lda, lo, hi);
+        __m256i acc = _mm256_dpbusd_avx_epi32(_mm256_setzero_si256(), _mm256_set1_epi32(lo), b0);
+        acc = _mm256_sub_epi32(_mm256_dpbusd_avx_epi32(acc, _mm256_set1_epi32(hi), b1), vc);
+        int32_t* c = C + r * ldc;
+        if (accumulate) acc = _mm256_add_epi32(acc, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(c)));
+        acc = _mm256_srai_epi32(_mm256_slli_epi32(acc, 8), 8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(c), acc);
+    }
+}
+#endif
+
+// the fastest tile kernel this CPU has, and its name
+static inline Int8TileKernel best_tile_kernel (const char** name = nullptr) {
+    const char* n = "scalar";
+    Int8TileKernel k = int8_tile_scalar;
+#ifdef GEMM_DISPATCH_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512vnni") && __builtin_cpu_supports("avx512vl")) {
+        n = "avx512vnni";
+        k = int8_tile_avx512vnni;
+    } else if (__builtin_cpu_supports("avxvnni")) {
+        n = "avxvnni";
+        k = int8_tile_avxvnni;
+    } else if (__builtin_cpu_supports("avx2")) {
+        n = "avx2";
+        k = int8_tile_avx2;
+    }
+#endif
+    if (name) *name = n;
+    return k;
+}
+
+// C = A x B on the CPU, row major int8 A (M x K) and B (K x N) into int32 C (M x N)
+static inline void cpu_gemm_int8 (const int8_t* A, const int8_t* B, int32_t* C, size_t M, size_t N, size_t K,
+                                  Int8TileKernel kernel) {
+    const size_t mt = (M + 7) / 8, nt = (N + 7) / 8, kt = (K + 7) / 8;
+    alignas(32) int8_t a[64], b[64];
+    alignas(32) int32_t c[64];
+    for (size_t tj = 0; tj < nt; tj++) {
+        for (size_t ti = 0; ti < mt; ti++) {
+            const size_t rows = std::min<size_t>(8, M - 8 * ti), cols = std::min<size_t>(8, N - 8 * tj);
+            for (size_t r = 0; r < rows; r++) std::fill(C + (8 * ti + r) * N + 8 * tj, C + (8 * ti + r) * N + 8 * tj + cols, 0);
+            for (size_t k0 = 0; k0 < kt; k0 += RemoteMem::gemm_max_ktiles) {
+                const size_t k1 = std::min(kt, k0 + RemoteMem::gemm_max_ktiles);
+                for (size_t tk = k0; tk < k1; tk++) {
+                    const size_t deep = std::min<size_t>(8, K - 8 * tk);
+                    // whole tiles straight from A and B, the edges through zero padded copies
+                    const int8_t* ap = A + 8 * ti * K + 8 * tk;
+                    const int8_t* bp = B + 8 * tk * N + 8 * tj;
+                    size_t lda = K, ldb = N;
+                    if (rows < 8 || deep < 8) {
+                        memset(a, 0, sizeof(a));
+                        for (size_t r = 0; r < rows; r++) memcpy(a + 8 * r, ap + r * K, deep);
+                        ap = a;
+                        lda = 8;
+                    }
+                    if (deep < 8 || cols < 8) {
+                        memset(b, 0, sizeof(b));
+                        for (size_t r = 0; r < deep; r++) memcpy(b + 8 * r, bp + r * N, cols);
+                        bp = b;
+                        ldb = 8;
+                    }
+                    kernel(ap, lda, bp, ldb, c, 8, tk != k0);
+                }
+                for (size_t r = 0; r < rows; r++)
+                    for (size_t cc = 0; cc < cols; cc++) C[(8 * ti + r) * N + 8 * tj + cc] += c[8 * r + cc];
+            }
+        }
+    }
+}
+
+// one call of GemmDispatcher::gemm_int8, what was decided on and what it took
+struct GemmDecision {
+    enum Path { LOCAL, OFFLOAD, SPLIT };
+    Path path;
+    size_t M, N, K;
+    size_t fpga_rows;          // rows of C done on the FPGA, the top ones
+    double predicted_cpu_s;    // all of it on the CPU
+    double predicted_fpga_s;   // all of it on the FPGA
+    double predicted_s;        // the path taken
+    double actual_s;
+
+    static const char* path_name (Path p) {
+        static const char* const names[3] = {"local", "offload", "split"};
+        return names[p];
+    }
+
+    void print (std::ostream& out) const {
+        StatsLine{out, "gemm"}("path", path_name(path))("m", M)("n", N)("k", K)("fpga_rows", fpga_rows)
+            ("predicted_cpu_us", predicted_cpu_s * 1e6)("predicted_fpga_us", predicted_fpga_s * 1e6)
+            ("predicted_us", predicted_s * 1e6)("actual_us", actual_s * 1e6);
+    }
+};
+
+// totals since the dispatcher was made, and the model as it stands
+struct GemmDispatchStats {
+    uint64_t calls[3] = {};            // by GemmDecision::Path
+    uint64_t macs[3] = {};
+    double seconds[3] = {};
+    double abs_error_s = 0;            // |predicted - actual| summed over the calls
+    double cpu_macs_per_s = 0;         // MACs of the zero padded 8x8x8 tiles
+    double rtt_s = 0;
+    double bytes_per_s = 0;
+    double fpga_s_per_job = 0;
+
+    void print (std::ostream& out) const {
+        StatsLine line(out, "gemm_dispatch");
+        for (int p = 0; p < 3; p++) {
+            const char* n = GemmDecision::path_name(static_cast<GemmDecision::Path>(p));
+            line(n, "calls", calls[p])(n, "macs", macs[p])(n, "us", seconds[p] * 1e6);
+        }
+        line("abs_error_us", abs_error_s * 1e6)("cpu_mmacs", cpu_macs_per_s / 1e6)("rtt_us", rtt_s * 1e6)
+            ("link_mbps", bytes_per_s * 8 / 1e6)("fpga_us_per_job", fpga_s_per_job * 1e6);
+    }
+};
+
+class GemmDispatcher {
+public:
+    // fpga may be null, then every call is local
+    explicit GemmDispatcher (RemoteMem* fpga) : fpga(fpga) {
+        kernel = best_tile_kernel(&kernel_name);
+    }
+
+    // 0..1, how much of a new measurement goes into the model
+    double ewma = 0.25;
+    // ping the RTT again every so many calls
+    unsigned recalibrate_calls = 256;
+    // a split has to beat the better single path by this factor to be taken
+    double split_margin = 0.9;
+    // gets every decision, e.g. [](const GemmDecision& d) { d.print(std::cout); }
+    std::function<void(const GemmDecision&)> sink;
+
+    Int8TileKernel kernel;
+    const char* kernel_name;
+
+    // Measure the CPU (a 64x64x64 GEMM on the tile kernel), the link's RTT (8-byte reads) and bandwidth
+    // (a burst of 128-byte writes in flight back to back), and the time per job from one small offload.
+    // Done by the first gemm_int8 if not called before.
+    void calibrate () {
+        std::vector<int8_t> a(64 * 64, 1), b(64 * 64, 1);
+        std::vector<int32_t> c(64 * 64);
+        auto start = std::chrono::steady_clock::now();
+        cpu_gemm_int8(a.data(), b.data(), c.data(), 64, 64, 64, kernel);
+        st.cpu_macs_per_s = 64.0 * 64 * 64 / since(start);
+        if (fpga) {
+            st.rtt_s = ping();
+            st.bytes_per_s = measure_bandwidth();
+            // until an offload says otherwise: the link time of a job's two frames, the tiles and the GEMM
+            st.fpga_s_per_job = (32 + 128 + wire_overhead + 60 + wire_overhead) / st.bytes_per_s;
+            start = std::chrono::steady_clock::now();
+            fpga->gemm_int8(a.data(), b.data(), c.data(), 16, 16, 64, false);
+            learn_fpga(since(start), jobs(16, 16, 64));
+        }
+        calibrated = true;
+    }
+
+    void gemm_int8 (const int8_t* A, const int8_t* B, int32_t* C, size_t M, size_t N, size_t K) {
+        if (!calibrated) calibrate();
+        if (fpga && ++calls_since_ping >= recalibrate_calls) {
+            st.rtt_s += ewma * (ping() - st.rtt_s);
+            calls_since_ping = 0;
+        }
+        GemmDecision d = decide(M, N, K);
+        auto start = std::chrono::steady_clock::now();
+        if (d.path == GemmDecision::LOCAL) {
+            cpu_gemm_int8(A, B, C, M, N, K, kernel);
+            d.actual_s = since(start);
+            learn_cpu(d.actual_s, jobs(M, N, K) * 512);
+        } else if (d.path == GemmDecision::OFFLOAD) {
+            fpga->gemm_int8(A, B, C, M, N, K, false);
+            d.actual_s = since(start);
+            learn_fpga(d.actual_s, jobs(M, N, K));
+        } else {
+            // the CPU's rows on a thread of their own while this one runs the FPGA's
+            const size_t rows = M - d.fpga_rows;
+            double cpu_s = 0;
+            std::thread cpu([&] {
+                auto t = std::chrono::steady_clock::now();
+                cpu_gemm_int8(A + d.fpga_rows * K, B, C + d.fpga_rows * N, rows, N, K, kernel);
+                cpu_s = since(t);
+            });
+            double fpga_s = 0;
+            try {
+                fpga->gemm_int8(A, B, C, d.fpga_rows, N, K, false);
+                fpga_s = since(start);
+            } catch (...) {
+                cpu.join();
+                throw;
+            }
+            cpu.join();
+            d.actual_s = since(start);
+            learn_cpu(cpu_s, jobs(rows, N, K) * 512);
+            learn_fpga(fpga_s, jobs(d.fpga_rows, N, K));
+        }
+        st.calls[d.path]++;
+        st.macs[d.path] += static_cast<uint64_t>(M) * N * K;
+        st.seconds[d.path] += d.actual_s;
+        st.abs_error_s += std::abs(d.predicted_s - d.actual_s);
+        if (sink) sink(d);
+    }
+
+    // what gemm_int8 would do now
+    GemmDecision decide (size_t M, size_t N, size_t K) const {
+        GemmDecision d{GemmDecision::LOCAL, M, N, K, 0, cpu_time(M, N, K), 0, 0, 0};
+        d.predicted_s = d.predicted_cpu_s;
+        if (!fpga || M == 0 || N == 0 || K == 0) return d;
+        d.predicted_fpga_s = fpga_time(M, N, K);
+        if (d.predicted_fpga_s < d.predicted_cpu_s) {
+            d.path = GemmDecision::OFFLOAD;
+            d.fpga_rows = M;
+            d.predicted_s = d.predicted_fpga_s;
+        }
+        // both sides done at the same time: the FPGA's share f of the rows takes about
+        // rtt + f (T_fpga - rtt), the CPU's (1 - f) T_cpu
+        const double tc = d.predicted_cpu_s, tf = d.predicted_fpga_s, rtt = st.rtt_s;
+        if (M > 8 && tc > rtt) {
+            double f = (tc - rtt) / (tc + tf - rtt);
+            size_t rows = std::min(M - 8, std::max<size_t>(8, 8 * static_cast<size_t>(f * M / 8 + 0.5)));
+            double t = std::max(fpga_time(rows, N, K), cpu_time(M - rows, N, K));
+            if (t < split_margin * d.predicted_s) {
+                d.path = GemmDecision::SPLIT;
+                d.fpga_rows = rows;
+                d.predicted_s = t;
+            }
+        }
+        return d;
+    }
+
+    GemmDispatchStats stats () const { return st; }
+
+private:
+    RemoteMem* fpga;
+    GemmDispatchStats st;
+    bool calibrated = false;
+    unsigned calls_since_ping = 0;
+    uint8_t tag = 0;
+    static constexpr double wire_overhead = 24;   // bytes of preamble, FCS and gap around a frame
+
+    static double since (std::chrono::steady_clock::time_point t) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - t).count();
+    }
+
+    // FMA engine jobs of a GEMM, one per 8x8x8 tile
+    static double jobs (size_t M, size_t N, size_t K) {
+        return static_cast<double>((M + 7) / 8) * ((N + 7) / 8) * ((K + 7) / 8);
+    }
+
+    // the CPU does the padding of the edge tiles too
+    double cpu_time (size_t M, size_t N, size_t K) const {
+        return jobs(M, N, K) * 512 / st.cpu_macs_per_s;
+    }
+
+    double fpga_time (size_t M, size_t N, size_t K) const {
+        return st.rtt_s + jobs(M, N, K) * st.fpga_s_per_job;
+    }
+
+    void learn_cpu (double seconds, double macs) {
+        if (seconds > 0 && macs > 0) st.cpu_macs_per_s += ewma * (macs / seconds - st.cpu_macs_per_s);
+    }
+
+    // the time past the round trip, spread over the jobs
+    void learn_fpga (double seconds, double n_jobs) {
+        double per_job = std::max(0.0, seconds - st.rtt_s) / n_jobs;
+        st.fpga_s_per_job += ewma * (per_job - st.fpga_s_per_job);
+    }
+
+    // the best of a few 8-byte read round trips
+    double ping () {
+        uint8_t buf[8];
+        double best = 1e9;
+        for (int i = 0; i < 4; i++) {
+            auto start = std::chrono::steady_clock::now();
+            if (!fpga->remote_interface.remote_read_bytes(0, buf, 8, tag++)) throw std::runtime_error("gemm dispatch: no answer to the RTT read");
+            best = std::min(best, since(start));
+        }
+        return best;
+    }
+
+    // 32 writes of 128 bytes to the top of the memory (gemm_int8's scratch) in flight at once, the
+    // bytes each way over the time to the last response less a round trip
+    double measure_bandwidth () {
+        const int n = 32;
+        uint8_t payload[128] = {};
+        std::vector<std::array<uint8_t,4>> keys(n);
+        const uint64_t addr = (RemoteMem::mem_words - 16) * 8;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < n; i++) {
+            if (!fpga->remote_interface.post_sized(2, addr, payload, sizeof(payload), tag++, keys[i])) {
+                throw std::runtime_error("gemm dispatch: send failed");
+            }
+        }
+        for (int i = 0; i < n; i++) {
+            if (!fpga->remote_interface.wait_sized(keys[i], addr, sizeof(payload), nullptr, fpga->remote_interface.ack_timeout_ms)) {
+                throw std::runtime_error("gemm dispatch: no answer to the bandwidth writes");
+            }
+        }
+        return n * (32 + sizeof(payload) + wire_overhead) / std::max(since(start) - st.rtt_s, 1e-9);
+    }
+};
@@ -1,3 +1,5 @@
+#pragma once
+#include <iostream>
 #include <sys/socket.h>
 #include <linux/if_packet.h>
 #include <linux/if_ether.h>
@@ -7,10 +9,27 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <poll.h>
+#include "pcap_recorder.h"
+
+// Frames to and from something other than a NIC, e.g. the Verilator model of ualink_turbo64
+// (ualink_sim.h).  RawEth built on one sends and receives through it instead of the socket.
+class FrameLink {
+public:
+    virtual ~FrameLink() = default;
+    virtual bool send_frame(const uint8_t* p, int n) = 0;
+    // a frame into buf, waits up to timeout_ms for one; its length, or -1 if none came
+    virtual int recv_frame(uint8_t* buf, uint16_t cap, int timeout_ms) = 0;
+    // an fd that polls readable while a frame is waiting, for an event loop (reactor.h); -1 if the
+    // link has none and has to be polled with recv_frame
+    virtual int ready_fd() const { return -1; }
+};
 
 class RawEth {
 public:
     int fd = -1;
+    PcapRecorder* recorder = nullptr; // optional, records every frame sent/received
+    FrameLink* link = nullptr;        // set: no socket, frames go through the link
+    explicit RawEth (FrameLink& l) : link(&l) {}
     explicit RawEth (const std::string& iface) {
         fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
         struct ifreq iface_id;
@@ -31,11 +50,13 @@ public:
     }
 
     bool send_on_wire(const uint8_t* p, int n) {
-        ssize_t r = send(fd, p, n, 0);
+        ssize_t r = link ? (link->send_frame(p, n) ? n : -1) : send(fd, p, n, 0);
+        if (recorder && r > 0) recorder->record(p, (uint32_t)r, PcapRecorder::OUTBOUND);
         return (r == static_cast<ssize_t>(n));
     }
 
     bool recv_on_wire(uint8_t* buf, uint16_t cap) {
+        if (link) return recv_link(buf, cap);
         pollfd pfd;
         pfd.fd = fd;
         pfd.events = POLLIN;
@@ -48,9 +69,64 @@ public:
 
         if (ret > 0) {
             ssize_t n = recv(fd, buf, cap, 0);
+            if (recorder && n > 0) recorder->record(buf, (uint32_t)n, PcapRecorder::INBOUND);
             if (n >= 0) return true;
             return false;
         }
         return false;
     }
+
+    // recv_on_wire for frames from the wire only, the socket also sees the frames we send; the
+    // frame's length into len if given
+    bool recv_inbound(uint8_t* buf, uint16_t cap, int* len = nullptr) {
+        if (link) return recv_link(buf, cap, len);   // a link does not loop our own frames back
+        pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+
+        if (poll(&pfd, 1, 10) <= 0) {
+            return false;
+        }
+
+        sockaddr_ll from;
+        socklen_t from_len = sizeof(from);
+        ssize_t n = recvfrom(fd, buf, cap, 0, reinterpret_cast<sockaddr*>(&from), &from_len);
+        if (n < 0 || from.sll_pkttype == PACKET_OUTGOING) return false;
+        if (recorder) recorder->record(buf, (uint32_t)n, PcapRecorder::INBOUND);
+        if (len) *len = (int)n;
+        return true;
+    }
+
+    // recv_inbound without the wait, for an event loop: a frame that is already there, its length, or
+    // -1 if there is none
+    int recv_ready(uint8_t* buf, uint16_t cap) {
+        int n;
+        if (link) {
+            n = link->recv_frame(buf, cap, 0);
+        } else {
+            sockaddr_ll from;
+            do {
+                socklen_t from_len = sizeof(from);
+                n = (int)recvfrom(fd, buf, cap, MSG_DONTWAIT, reinterpret_cast<sockaddr*>(&from), &from_len);
+            } while (n >= 0 && from.sll_pkttype == PACKET_OUTGOING);
+        }
+        if (n < 0) return -1;
+        if (recorder) recorder->record(buf, (uint32_t)n, PcapRecorder::INBOUND);
+        return n;
+    }
+
+    // the fd recv_ready waits on, -1 for a link without one
+    int ready_fd() const {
+        return link ? link->ready_fd() : fd;
+    }
+
+private:
+    // same 10 ms wait as the socket poll
+    bool recv_link(uint8_t* buf, uint16_t cap, int* len = nullptr) {
+        int n = link->recv_frame(buf, cap, 10);
+        if (n < 0) return false;
+        if (recorder) recorder->record(buf, (uint32_t)n, PcapRecorder::INBOUND);
+        if (len) *len = n;
+        return true;
+    }
 };
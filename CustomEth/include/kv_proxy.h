@@ -0,0 +1,1015 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include "memcached_client.h"
+#include "memcached_loadgen.h"
+#include "reactor.h"
+#include "remote_mem.h"
+
+/*
+A memcached UDP proxy with two tiers: the hot keys in the FPGA's memory, everything in a software
+memcached behind it.  The FPGA KV path of ualink_turbo64 holds 31 values of up to 64 bytes, so only
+the keys most asked for are worth a place there.
+
+  MemcRequest    - a client's get (any number of keys) or set, ASCII or binary, parsed in place
+  MemcReply      - the reply to one, value by value, sent as memcached UDP datagrams
+  KeyHeat        - GETs per key, halved every epoch; the hot set is the top of it
+  SoftMemcached  - an in-process memcached UDP server on a Reactor: the local memcached of a test, or
+                   with fpga_kv() limits the FPGA KV path (kv_hash_index: 16 byte keys, 64 byte
+                   values, 8 buckets of 4 ways, 31 slots, flags not kept, nothing deleted)
+  HotTier        - where hot values live on the FPGA:
+                     KvHotTier  - the KV engine, binary SET and GET frames through a MemcachedUdpClient
+                                  (AF_PACKET to the FPGA), one in flight as the engine takes them
+                     RawHotTier - slots of DPMEM below the gemm scratch, written and read with sized
+                                  UALink requests through an FpgaDevice (RemoteMem's byte path)
+  TieredKvProxy  - the daemon, one thread on a Reactor: GETs of the keys resident on the FPGA go to
+                   it, the rest and whatever the FPGA fails to answer to memcached.  SETs go to
+                   memcached, the FPGA copy is rewritten once memcached has stored the value, and the
+                   key is read from memcached until then.  Every epoch the keys that got hot are read
+                   from memcached and placed, the ones that cooled make room; none of it waits on or
+                   holds up a client request.
+
+memcached stays the store of record, so demoting a key is forgetting where the FPGA has it.  The KV
+engine cannot delete, and a SET of another key cannot take over a slot: a key's index entry and slot
+stay until that key is stored again.  Demoting would free nothing, so with KvHotTier the proxy never
+demotes: the first keys placed stay for good and a hot set that moves later is served by memcached.
+The self check asserts that.  RawHotTier's slots are the proxy's own and are reused at once.
+*/
+
+// One client request, its keys and value pointing into the datagram
+struct MemcRequest {
+    enum Op { GET, SET, OTHER };
+
+    struct Key {
+        std::string_view key;
+        uint8_t opcode = MEMC_BIN_GET;   // binary
+        uint32_t opaque = 0;
+    };
+
+    Op op = OTHER;
+    bool binary = false;
+    bool noreply = false;                // ASCII "noreply"
+    std::vector<Key> keys;               // GET: every key, SET: its key
+    std::string_view value;
+    uint32_t flags = 0;
+    uint32_t exptime = 0;
+};
+
+/*
+The request in the payload of a datagram (after its memc_udp_header): an ASCII get/gets of any number
+of keys or a set, a binary GET, GETK or SET, or the GETKQ ... GETK run of a binary multi-get.  False
+for anything else.
+*/
+inline bool parse_memc_request (const char* p, size_t n, MemcRequest& r) {
+    r.op = MemcRequest::OTHER;
+    r.noreply = false;
+    r.keys.clear();
+    r.value = {};
+    r.flags = r.exptime = 0;
+    if (n == 0) return false;
+
+    r.binary = static_cast<uint8_t>(p[0]) == MEMC_BIN_REQ;
+    if (r.binary) {
+        MemcBinRequest b;
+        while (n) {
+            size_t used = memc_bin_parse_request(p, n, b);
+            if (!used) return false;
+            p += used;
+            n -= used;
+            if (b.opcode == MEMC_BIN_SET) {
+                if (r.op != MemcRequest::OTHER || n) return false;
+                r.op = MemcRequest::SET;
+                r.value = b.value;
+                r.flags = b.flags;
+                r.exptime = b.exptime;
+            } else if (b.opcode == MEMC_BIN_GET || b.opcode == MEMC_BIN_GETK || b.opcode == MEMC_BIN_GETKQ) {
+                if (r.op == MemcRequest::SET) return false;
+                r.op = MemcRequest::GET;
+            } else {
+                return false;
+            }
+            r.keys.push_back({b.key, b.opcode, b.opaque});
+        }
+        return !r.keys.empty();
+    }
+
+    const char* end = p + n;
+    const char* eol = static_cast<const char*>(memchr(p, '\n', n));
+    if (!eol || eol == p || eol[-1] != '\r') return false;
+    const char* line_end = eol - 1;
+    const char* q = p;
+    auto word = [&] () {
+        while (q < line_end && *q == ' ') q++;
+        const char* s = q;
+        while (q < line_end && *q != ' ') q++;
+        return std::string_view(s, q - s);
+    };
+    auto number = [] (std::string_view w, uint32_t& v) {
+        const char* s = w.data();
+        return memc_parse_uint(s, w.data() + w.size(), v) && s == w.data() + w.size();
+    };
+    std::string_view cmd = word();
+    if (cmd == "get" || cmd == "gets") {
+        r.op = MemcRequest::GET;
+        for (std::string_view k = word(); !k.empty(); k = word()) r.keys.push_back({k});
+        return !r.keys.empty();
+    }
+    if (cmd == "set") {
+        std::string_view key = word();
+        uint32_t bytes = 0;
+        if (key.empty() || !number(word(), r.flags) || !number(word(), r.exptime) || !number(word(), bytes)) {
+            return false;
+        }
+        std::string_view extra = word();
+        if (!extra.empty() && extra != "noreply") return false;
+        r.noreply = !extra.empty();
+        const char* data = eol + 1;
+        if ((size_t)(end - data) < (size_t)bytes + 2 || data[bytes] != '\r' || data[bytes + 1] != '\n') return false;
+        r.op = MemcRequest::SET;
+        r.keys.push_back({key});
+        r.value = std::string_view(data, bytes);
+        return true;
+    }
+    return false;
+}
+
+// The reply to one request, built a value at a time, in the protocol the request came in.
+class MemcReply {
+public:
+    void begin (const MemcRequest& r) {
+        req = &r;
+        out.clear();
+    }
+
+    // key i of a GET: its value, or a miss with found false
+    void value (size_t i, bool found, std::string_view data = {}, uint32_t flags = 0) {
+        const MemcRequest::Key& k = req->keys[i];
+        if (req->binary) {
+            if (!found && k.opcode == MEMC_BIN_GETKQ) return;
+            size_t at = out.size();
+            out.resize(at + memc_bin_response_size(k.key.size(), data.size()));
+            char* e = memc_bin_encode_response(&out[at], k.opcode, found ? MEMC_BIN_OK : MEMC_BIN_KEY_NOT_FOUND,
+                                               k.opaque, k.key, data, flags);
+            out.resize(e - out.data());
+        } else if (found) {
+            out += "VALUE ";
+            out.append(k.key.data(), k.key.size());
+            out += ' ';
+            out += std::to_string(flags);
+            out += ' ';
+            out += std::to_string(data.size());
+            out += "\r\n";
+            out.append(data.data(), data.size());
+            out += "\r\n";
+        }
+    }
+
+    // after the last value of a GET
+    void end () {
+        if (!req->binary) out += "END\r\n";
+    }
+
+    // the outcome of a SET
+    void stored (MemcStatus s) {
+        if (req->binary) {
+            uint16_t status = s == MemcStatus::STORED ? MEMC_BIN_OK :
+                              s == MemcStatus::NOT_STORED ? MEMC_BIN_NOT_STORED :
+                              s == MemcStatus::EXISTS ? MEMC_BIN_KEY_EXISTS : MEMC_BIN_OUT_OF_MEMORY;
+            out.resize(memc_bin_response_size(0, 0));
+            char* e = memc_bin_encode_response(&out[0], MEMC_BIN_SET, status, req->keys[0].opaque);
+            out.resize(e - out.data());
+        } else if (!req->noreply) {
+            out = s == MemcStatus::STORED ? "STORED\r\n" :
+                  s == MemcStatus::NOT_STORED ? "NOT_STORED\r\n" :
+                  s == MemcStatus::EXISTS ? "EXISTS\r\n" :
+                  s == MemcStatus::TIMEOUT ? "SERVER_ERROR timeout\r\n" : "SERVER_ERROR out of memory storing object\r\n";
+        }
+    }
+
+    // a request that could not be parsed
+    void error (bool binary) {
+        if (binary) {
+            out.resize(memc_bin_response_size(0, 0));
+            char* e = memc_bin_encode_response(&out[0], MEMC_BIN_NOOP, MEMC_BIN_UNKNOWN_CMD, 0);
+            out.resize(e - out.data());
+        } else {
+            out = "ERROR\r\n";
+        }
+    }
+
+    // as the datagrams of one reply, MAX_DGRAM bytes each at most; nothing for an empty one (noreply)
+    void send (int fd, const sockaddr_in& to, uint16_t request_id) const {
+        if (out.empty()) return;
+        const size_t chunk = MemcachedUdpClient::MAX_DGRAM - sizeof(memc_udp_header);
+        uint16_t total = static_cast<uint16_t>((out.size() + chunk - 1) / chunk);
+        char dgram[MemcachedUdpClient::MAX_DGRAM];
+        for (uint16_t seq = 0; seq < total; seq++) {
+            memc_udp_header h;
+            h.request_id = request_id;             // as it came, network order
+            h.seq_number = htons(seq);
+            h.total_pkts = htons(total);
+            h.reserved = 0;
+            size_t n = std::min(chunk, out.size() - seq * chunk);
+            memcpy(dgram, &h, sizeof(h));
+            memcpy(dgram + sizeof(h), out.data() + seq * chunk, n);
+            sendto(fd, dgram, sizeof(h) + n, 0, reinterpret_cast<const sockaddr*>(&to), sizeof(to));
+        }
+    }
+
+    const std::string& payload () const {
+        return out;
+    }
+
+private:
+    const MemcRequest* req = nullptr;
+    std::string out;
+};
+
+// a UDP socket on ip:port, non blocking; port 0 for any free one
+inline int memc_udp_listen (const std::string& ip, uint16_t port) {
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) throw std::runtime_error(std::string("socket: ") + strerror(errno));
+    int bufsz = 8 << 20;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bufsz, sizeof(bufsz));
+    sockaddr_in a;
+    memset(&a, 0, sizeof(a));
+    a.sin_family = AF_INET;
+    a.sin_port = htons(port);
+    if (inet_pton(AF_INET, ip.c_str(), &a.sin_addr) <= 0) {
+        close(fd);
+        throw std::runtime_error("Invalid IP address: " + ip);
+    }
+    if (bind(fd, reinterpret_cast<sockaddr*>(&a), sizeof(a)) < 0) {
+        close(fd);
+        throw std::runtime_error("bind " + ip + ":" + std::to_string(port) + ": " + strerror(errno));
+    }
+    return fd;
+}
+
+inline uint16_t memc_udp_port (int fd) {
+    sockaddr_in a;
+    socklen_t len = sizeof(a);
+    getsockname(fd, reinterpret_cast<sockaddr*>(&a), &len);
+    return ntohs(a.sin_port);
+}
+
+class KeyHeat {
+public:
+    void touch (std::string_view key) {
+        heat[std::string(key)] += 1.0;
+    }
+
+    double of (const std::string& key) const {
+        auto it = heat.find(key);
+        return it == heat.end() ? 0.0 : it->second;
+    }
+
+    // the k hottest keys with at least min_heat, hottest first
+    std::vector<std::string> hottest (size_t k, double min_heat) const {
+        std::vector<std::pair<double, const std::string*>> all;
+        for (const auto& h : heat)
+            if (h.second >= min_heat) all.emplace_back(h.second, &h.first);
+        k = std::min(k, all.size());
+        auto hotter = [] (const std::pair<double, const std::string*>& a, const std::pair<double, const std::string*>& b) {
+            return a.first > b.first || (a.first == b.first && *a.second < *b.second);
+        };
+        std::partial_sort(all.begin(), all.begin() + k, all.end(), hotter);
+        std::vector<std::string> keys;
+        for (size_t i = 0; i < k; i++) keys.push_back(*all[i].second);
+        return keys;
+    }
+
+    // every key's heat halved, the ones gone cold forgotten
+    void decay () {
+        for (auto it = heat.begin(); it != heat.end(); ) {
+            it->second *= 0.5;
+            if (it->second < 0.25) it = heat.erase(it);
+            else ++it;
+        }
+    }
+
+    size_t tracked () const {
+        return heat.size();
+    }
+
+private:
+    std::unordered_map<std::string, double> heat;
+};
+
+class SoftMemcached {
+public:
+    struct Limits {
+        size_t max_key = 250;
+        size_t max_value = 1 << 20;
+        size_t max_items = SIZE_MAX;
+        int buckets = 0;                 // of ways keys each by CRC-32C, 0 for no index to fill
+        int ways = 0;
+        bool keep_flags = true;
+    };
+
+    // ualink_turbo64's KV engine, kv_hash_index at its defaults
+    static Limits fpga_kv () {
+        Limits l;
+        l.max_key = 16;
+        l.max_value = 64;
+        l.max_items = 31;
+        l.buckets = 8;
+        l.ways = 4;
+        l.keep_flags = false;
+        return l;
+    }
+
+    struct Stats {
+        uint64_t gets = 0;                // keys asked for
+        uint64_t hits = 0;
+        uint64_t sets = 0;
+        uint64_t refused = 0;             // SETs not stored: too large, index or slots full
+        uint64_t bad = 0;
+
+        void print (std::ostream& out) const {
+            StatsLine{out}("gets", gets)("hits", hits)("sets", sets)("refused", refused)("bad", bad);
+        }
+    };
+
+    // on ip:port, port 0 for any free one
+    explicit SoftMemcached (Reactor& r) : SoftMemcached(r, Limits()) {}
+
+    SoftMemcached (Reactor& r, Limits l, uint16_t port = 0, const std::string& ip = "127.0.0.1") :
+    reactor(r), limits(l), bucket_fill(std::max(1, l.buckets), 0) {
+        fd = memc_udp_listen(ip, port);
+        reactor.watch(fd, [this] { on_ready(); });
+    }
+
+    ~SoftMemcached () {
+        reactor.unwatch(fd);
+        close(fd);
+    }
+
+    SoftMemcached (const SoftMemcached&) = delete;
+    SoftMemcached& operator= (const SoftMemcached&) = delete;
+
+    uint16_t port () const {
+        return memc_udp_port(fd);
+    }
+
+    size_t items () const {
+        return store.size();
+    }
+
+    Stats stats;
+
+private:
+    struct Item {
+        std::string value;
+        uint32_t flags;
+    };
+
+    Reactor& reactor;
+    Limits limits;
+    int fd;
+    std::unordered_map<std::string, Item> store;
+    std::vector<int> bucket_fill;
+    MemcRequest req;
+    MemcReply reply;
+    char buf[2048];
+
+    static uint32_t crc32c (std::string_view s) {
+        uint32_t c = 0xFFFFFFFF;
+        for (unsigned char b : s) {
+            c ^= b;
+            for (int k = 0; k < 8; k++) c = (c >> 1) ^ (0x82F63B78 & (0 - (c & 1)));
+        }
+        return ~c;
+    }
+
+    void on_ready () {
+        for (int i = 0; i < 64; i++) {
+            sockaddr_in from;
+            socklen_t len = sizeof(from);
+            ssize_t n = recvfrom(fd, buf, sizeof(buf), 0, reinterpret_cast<sockaddr*>(&from), &len);
+            if (n < 0) return;
+            if (n < (ssize_t)sizeof(memc_udp_header)) {
+                stats.bad++;
+                continue;
+            }
+            memc_udp_header h;
+            memcpy(&h, buf, sizeof(h));
+            serve(buf + sizeof(h), n - sizeof(h));
+            reply.send(fd, from, h.request_id);
+        }
+    }
+
+    void serve (const char* p, size_t n) {
+        bool ok = parse_memc_request(p, n, req);
+        reply.begin(req);
+        if (!ok) {
+            stats.bad++;
+            reply.error(n && static_cast<uint8_t>(p[0]) == MEMC_BIN_REQ);
+            return;
+        }
+        if (req.op == MemcRequest::SET) {
+            reply.stored(set(req.keys[0].key, req.value, req.flags));
+            return;
+        }
+        for (size_t i = 0; i < req.keys.size(); i++) {
+            stats.gets++;
+            auto it = store.find(std::string(req.keys[i].key));
+            if (it != store.end()) stats.hits++;
+            if (it == store.end()) reply.value(i, false);
+            else reply.value(i, true, it->second.value, it->second.flags);
+        }
+        reply.end();
+    }
+
+    MemcStatus set (std::string_view key, std::string_view value, uint32_t flags) {
+        stats.sets++;
+        std::string k(key);
+        auto it = store.find(k);
+        if (key.size() > limits.max_key || value.size() > limits.max_value) {
+            stats.refused++;
+            return MemcStatus::ERROR;
+        }
+        if (it == store.end()) {
+            int b = limits.buckets ? static_cast<int>(crc32c(key) & (limits.buckets - 1)) : 0;
+            if (store.size() >= limits.max_items || (limits.buckets && bucket_fill[b] >= limits.ways)) {
+                stats.refused++;
+                return MemcStatus::ERROR;
+            }
+            bucket_fill[b]++;
+            it = store.emplace(std::move(k), Item()).first;
+        }
+        it->second.value.assign(value.data(), value.size());
+        it->second.flags = limits.keep_flags ? flags : 0;
+        return MemcStatus::STORED;
+    }
+};
+
+// Where the hot values live on the FPGA.  The proxy reserves room for a key, places its value, fetches
+// it while it is resident and releases the room when the key is demoted; done runs on the loop thread.
+class HotTier {
+public:
+    virtual ~HotTier () {}
+
+    virtual const char* name () const = 0;
+
+    // keys it can hold at once
+    virtual size_t capacity () const = 0;
+
+    // whether key with a value of value_len bytes and flags can be placed at all
+    virtual bool fits (size_t key_len, size_t value_len, uint32_t flags) const = 0;
+
+    // room for key, in slot; false if there is none
+    virtual bool reserve (const std::string& key, int& slot) = 0;
+
+    virtual void release (const std::string& key, int slot) = 0;
+
+    // whether release makes room for another key
+    virtual bool reclaims () const = 0;
+
+    virtual void place (const std::string& key, int slot, const std::string& value, std::function<void(bool)> done) = 0;
+
+    // done gets false for a miss or no answer, the view is only valid inside done
+    virtual void fetch (const std::string& key, int slot, uint32_t len,
+                        std::function<void(bool, std::string_view)> done) = 0;
+
+    // fail what has waited longer than timeout_ns
+    virtual void expire (uint64_t timeout_ns) {
+        (void)timeout_ns;
+    }
+};
+
+// The FPGA's memcached KV engine on port 0.  It takes one op at a time (a request arriving while a
+// response is pending is passed on unanswered), so the ops queue here and go out one by one.  Its
+// index never forgets a key: the keys ever stored count against the capacity for good, reclaims() is
+// false and the proxy does not demote.
+class KvHotTier : public HotTier {
+public:
+    KvHotTier (Reactor& r, MemcachedUdpClient& kv, size_t slots = 31) : reactor(r), client(kv), slots(slots) {
+        client.protocol = MemcProtocol::BINARY;
+        reactor.watch(client.socket_fd(), [this] { client.poll(0); });
+    }
+
+    ~KvHotTier () override {
+        reactor.unwatch(client.socket_fd());
+    }
+
+    const char* name () const override {
+        return "fpga_kv";
+    }
+
+    size_t capacity () const override {
+        return slots;
+    }
+
+    bool fits (size_t key_len, size_t value_len, uint32_t flags) const override {
+        return key_len <= 16 && value_len <= 64 && flags == 0;
+    }
+
+    bool reserve (const std::string& key, int& slot) override {
+        slot = -1;
+        if (reserved.count(key)) return true;
+        if (reserved.size() >= slots) return false;
+        reserved.insert(key);
+        return true;
+    }
+
+    // only a key that never made it into the index gives its room back
+    void release (const std::string& key, int) override {
+        if (!indexed.count(key)) reserved.erase(key);
+    }
+
+    bool reclaims () const override {
+        return false;
+    }
+
+    void place (const std::string& key, int, const std::string& value, std::function<void(bool)> done) override {
+        ops.push_back(Op{true, key, value, [this, key, done](bool ok, std::string_view) {
+            if (ok) indexed.insert(key);
+            else refused++;
+            done(ok);
+        }});
+        issue();
+    }
+
+    void fetch (const std::string& key, int, uint32_t, std::function<void(bool, std::string_view)> done) override {
+        ops.push_back(Op{false, key, std::string(), std::move(done)});
+        issue();
+    }
+
+    void expire (uint64_t timeout_ns) override {
+        client.expire(timeout_ns);
+    }
+
+    // keys in the engine's index, resident or not
+    size_t indexed_keys () const {
+        return indexed.size();
+    }
+
+    uint64_t refused = 0;
+
+private:
+    struct Op {
+        bool set;
+        std::string key, value;
+        std::function<void(bool, std::string_view)> done;
+    };
+
+    Reactor& reactor;
+    MemcachedUdpClient& client;
+    size_t slots;
+    std::unordered_set<std::string> reserved;   // room taken: indexed, or on the way
+    std::unordered_set<std::string> indexed;
+    std::deque<Op> ops;
+    bool busy = false;
+
+    void issue () {
+        if (busy || ops.empty()) return;
+        busy = true;
+        const Op& op = ops.front();
+        auto on_reply = [this](const MemcResponse& r) {
+            Op op = std::move(ops.front());
+            ops.pop_front();
+            busy = false;
+            if (op.set) op.done(r.status == MemcStatus::STORED, {});
+            else if (r.status == MemcStatus::VALUES && r.num_values == 1) op.done(true, r.values[0].data);
+            else op.done(false, {});
+            issue();
+        };
+        bool sent = op.set ? client.set(op.key, op.value, on_reply) : client.get(op.key, on_reply);
+        if (!sent) {
+            Op failed = std::move(ops.front());
+            ops.pop_front();
+            busy = false;
+            failed.done(false, {});
+            issue();
+            return;
+        }
+        client.flush();
+    }
+};
+
+// Slots of DPMEM the proxy lays out itself, bytes from base, each value written and read with one
+// sized UALink request.  The default region is the FPGA memory below gemm_int8's scratch.
+class RawHotTier : public HotTier {
+public:
+    explicit RawHotTier (FpgaDevice& dev, size_t slot_bytes = 64, uint64_t base = 0,
+                         size_t bytes = (RemoteMem::mem_words - RemoteMem::gemm_words) * 8) :
+    device(dev), slot_size(std::min<size_t>(255, slot_bytes)), base_addr(base) {
+        for (size_t s = bytes / slot_size; s > 0; s--) free_slots.push_back(static_cast<int>(s - 1));
+        total = free_slots.size();
+    }
+
+    const char* name () const override {
+        return "fpga_raw";
+    }
+
+    size_t capacity () const override {
+        return total;
+    }
+
+    bool fits (size_t, size_t value_len, uint32_t flags) const override {
+        return value_len <= slot_size && flags == 0;
+    }
+
+    bool reserve (const std::string&, int& slot) override {
+        if (free_slots.empty()) return false;
+        slot = free_slots.back();
+        free_slots.pop_back();
+        return true;
+    }
+
+    void release (const std::string&, int slot) override {
+        free_slots.push_back(slot);
+    }
+
+    bool reclaims () const override {
+        return true;
+    }
+
+    void place (const std::string&, int slot, const std::string& value, std::function<void(bool)> done) override {
+        if (value.empty()) {
+            done(true);
+            return;
+        }
+        device.write_bytes(addr(slot), reinterpret_cast<const uint8_t*>(value.data()), static_cast<uint8_t>(value.size()),
+                           [done](FpgaDevice::Status s) { done(s == FpgaDevice::Status::OK); });
+    }
+
+    void fetch (const std::string&, int slot, uint32_t len, std::function<void(bool, std::string_view)> done) override {
+        if (len == 0) {
+            done(true, {});
+            return;
+        }
+        std::shared_ptr<std::array<uint8_t, 255>> buf(new std::array<uint8_t, 255>);
+        device.read_bytes(addr(slot), buf->data(), static_cast<uint8_t>(len), [buf, len, done](FpgaDevice::Status s) {
+            done(s == FpgaDevice::Status::OK, std::string_view(reinterpret_cast<const char*>(buf->data()), len));
+        });
+    }
+
+private:
+    FpgaDevice& device;
+    size_t slot_size;
+    uint64_t base_addr;
+    size_t total;
+    std::vector<int> free_slots;
+
+    uint64_t addr (int slot) const {
+        return base_addr + static_cast<uint64_t>(slot) * slot_size;
+    }
+};
+
+class TieredKvProxy {
+public:
+    struct Config {
+        std::string ip = "0.0.0.0";
+        uint16_t port = 11311;           // the clients', 0 for any free one
+        std::chrono::milliseconds epoch{100};   // promotion and demotion run this often
+        double min_heat = 2;             // decayed GETs that make a key worth promoting
+        size_t max_moves = 64;           // promotions started per epoch
+        uint64_t timeout_ns = 100000000; // a backend request older than this fails
+    };
+
+    struct Stats {
+        uint64_t requests = 0;
+        uint64_t bad = 0;                 // not a get or set, or no room to forward it
+        uint64_t get_keys = 0;
+        uint64_t hot_hits = 0;            // keys answered by the FPGA
+        uint64_t hot_fallbacks = 0;       // resident keys the FPGA did not answer, read from memcached
+        uint64_t cold_keys = 0;           // keys asked of memcached
+        uint64_t cold_hits = 0;
+        uint64_t sets = 0;
+        uint64_t set_errors = 0;
+        uint64_t promotions = 0;
+        uint64_t promotion_failures = 0;  // the value did not fit, or the FPGA refused it
+        uint64_t demotions = 0;
+        uint64_t epochs = 0;
+
+        void print (std::ostream& out) const {
+            StatsLine{out}("requests", requests)("bad", bad)("get_keys", get_keys)("hot_hits", hot_hits)
+                ("hot_fallbacks", hot_fallbacks)("cold_keys", cold_keys)("cold_hits", cold_hits)("sets", sets)
+                ("set_errors", set_errors)("promotions", promotions)("promotion_failures", promotion_failures)
+                ("demotions", demotions)("epochs", epochs);
+        }
+    };
+
+    TieredKvProxy (Reactor& r, MemcachedUdpClient& memcached, HotTier& fpga) : TieredKvProxy(r, memcached, fpga, Config()) {}
+
+    TieredKvProxy (Reactor& r, MemcachedUdpClient& memcached, HotTier& fpga, Config c) :
+    reactor(r), cold(memcached), hot(fpga), cfg(c) {
+        fd = memc_udp_listen(cfg.ip, cfg.port);
+        reactor.watch(fd, [this] { on_ready(); });
+        reactor.watch(cold.socket_fd(), [this] { cold.poll(0); });
+        housekeeping.fire = [this] { on_housekeeping(); };
+        reactor.schedule(housekeeping, std::chrono::milliseconds(10));
+        epoch_timer.fire = [this] { epoch(); };
+        reactor.schedule(epoch_timer, cfg.epoch);
+    }
+
+    ~TieredKvProxy () {
+        reactor.cancel(housekeeping);
+        reactor.cancel(epoch_timer);
+        reactor.unwatch(cold.socket_fd());
+        reactor.unwatch(fd);
+        close(fd);
+    }
+
+    TieredKvProxy (const TieredKvProxy&) = delete;
+    TieredKvProxy& operator= (const TieredKvProxy&) = delete;
+
+    uint16_t port () const {
+        return memc_udp_port(fd);
+    }
+
+    // key is on the FPGA and its copy current, its GETs go there
+    bool resident (const std::string& key) const {
+        auto it = directory.find(key);
+        return it != directory.end() && it->second.valid;
+    }
+
+    size_t residents () const {
+        size_t n = 0;
+        for (const auto& e : directory) n += e.second.valid;
+        return n;
+    }
+
+    // the hit rate and latency of every tier, then the counters
+    void report (std::ostream& out) const {
+        auto tier = [&out] (const char* name, uint64_t keys, uint64_t hits, uint64_t total, const LatencyHistogram& h) {
+            char line[256];
+            snprintf(line, sizeof(line), "%s: keys=%lu share=%.1f%% hit_rate=%.1f%% mean_us=%.1f p50_us=%.1f p99_us=%.1f max_us=%.1f\n",
+                     name, (unsigned long)keys, total ? 100.0 * keys / total : 0.0, keys ? 100.0 * hits / keys : 0.0,
+                     h.mean() / 1e3, h.percentile(0.5) / 1e3, h.percentile(0.99) / 1e3, h.max() / 1e3);
+            out << line;
+        };
+        tier(hot.name(), stats.hot_hits + stats.hot_fallbacks, stats.hot_hits, stats.get_keys, hot_latency);
+        tier("memcached", stats.cold_keys, stats.cold_hits, stats.get_keys, cold_latency);
+        char line[160];
+        snprintf(line, sizeof(line), "set: count=%lu mean_us=%.1f p50_us=%.1f p99_us=%.1f\n", (unsigned long)set_latency.count(),
+                 set_latency.mean() / 1e3, set_latency.percentile(0.5) / 1e3, set_latency.percentile(0.99) / 1e3);
+        out << line << "residents=" << residents() << " capacity=" << hot.capacity() << " tracked=" << heat.tracked() << ' ';
+        stats.print(out);
+    }
+
+    Stats stats;
+    LatencyHistogram hot_latency;        // GET keys, from the request in to the value back, per tier
+    LatencyHistogram cold_latency;
+    LatencyHistogram set_latency;
+
+private:
+    // a key placed on the FPGA or on its way there
+    struct Entry {
+        int slot = -1;
+        uint32_t len = 0;
+        uint64_t version = 0;             // changes with every SET and placement, stale completions drop
+        bool valid = false;
+    };
+
+    // a client request being answered, its datagram kept for the views into it
+    struct Pending {
+        std::string datagram;
+        MemcRequest req;
+        sockaddr_in from;
+        uint16_t request_id;
+        uint64_t arrived_ns;
+        std::vector<std::string> values;
+        std::vector<uint32_t> flags;
+        std::vector<bool> found;
+        size_t waiting = 0;
+    };
+
+    Reactor& reactor;
+    MemcachedUdpClient& cold;
+    HotTier& hot;
+    Config cfg;
+    int fd;
+    WheelTimer housekeeping, epoch_timer;
+    KeyHeat heat;
+    std::unordered_map<std::string, Entry> directory;
+    uint64_t next_version = 0;
+    MemcReply reply;
+    char buf[2048];
+
+    void on_ready () {
+        for (int i = 0; i < 64; i++) {
+            sockaddr_in from;
+            socklen_t len = sizeof(from);
+            ssize_t n = recvfrom(fd, buf, sizeof(buf), 0, reinterpret_cast<sockaddr*>(&from), &len);
+            if (n < 0) break;
+            if (n < (ssize_t)sizeof(memc_udp_header)) {
+                stats.bad++;
+                continue;
+            }
+            handle(from, n);
+        }
+        cold.flush();
+    }
+
+    void handle (const sockaddr_in& from, size_t n) {
+        stats.requests++;
+        std::shared_ptr<Pending> p(new Pending);
+        p->datagram.assign(buf, n);
+        p->from = from;
+        memc_udp_header h;
+        memcpy(&h, buf, sizeof(h));
+        p->request_id = h.request_id;
+        p->arrived_ns = memc_now_ns();
+        const char* payload = p->datagram.data() + sizeof(h);
+        size_t len = n - sizeof(h);
+        if (!parse_memc_request(payload, len, p->req)) {
+            stats.bad++;
+            reply.begin(p->req);
+            reply.error(len && static_cast<uint8_t>(payload[0]) == MEMC_BIN_REQ);
+            reply.send(fd, from, p->request_id);
+            return;
+        }
+        if (p->req.op == MemcRequest::SET) {
+            set(p);
+            return;
+        }
+        size_t keys = p->req.keys.size();
+        p->values.resize(keys);
+        p->flags.assign(keys, 0);
+        p->found.assign(keys, false);
+        p->waiting = keys;
+        for (size_t i = 0; i < keys; i++) get(p, i);
+    }
+
+    void get (const std::shared_ptr<Pending>& p, size_t i) {
+        stats.get_keys++;
+        std::string key(p->req.keys[i].key);
+        heat.touch(key);
+        auto it = directory.find(key);
+        if (it == directory.end() || !it->second.valid) {
+            get_cold(p, i);
+            return;
+        }
+        uint64_t version = it->second.version;
+        hot.fetch(key, it->second.slot, it->second.len, [this, p, i, key, version](bool ok, std::string_view v) {
+            if (!ok) {
+                // the FPGA lost it or did not answer: memcached has it, the key goes back to it
+                stats.hot_fallbacks++;
+                auto it = directory.find(key);
+                if (it != directory.end() && it->second.version == version) drop(it);
+                get_cold(p, i);
+                cold.flush();
+                return;
+            }
+            stats.hot_hits++;
+            hot_latency.record(memc_now_ns() - p->arrived_ns);
+            resolved(p, i, true, v, 0);
+        });
+    }
+
+    void get_cold (const std::shared_ptr<Pending>& p, size_t i) {
+        stats.cold_keys++;
+        bool sent = cold.get(p->req.keys[i].key, [this, p, i](const MemcResponse& r) {
+            cold_latency.record(memc_now_ns() - p->arrived_ns);
+            bool found = r.status == MemcStatus::VALUES && r.num_values == 1;
+            if (found) stats.cold_hits++;
+            resolved(p, i, found, found ? r.values[0].data : std::string_view(), found ? r.values[0].flags : 0);
+        });
+        if (!sent) {
+            stats.bad++;
+            resolved(p, i, false, {}, 0);
+        }
+    }
+
+    void resolved (const std::shared_ptr<Pending>& p, size_t i, bool found, std::string_view v, uint32_t flags) {
+        p->found[i] = found;
+        p->values[i].assign(v.data(), v.size());
+        p->flags[i] = flags;
+        if (--p->waiting) return;
+        reply.begin(p->req);
+        for (size_t k = 0; k < p->req.keys.size(); k++) reply.value(k, p->found[k], p->values[k], p->flags[k]);
+        reply.end();
+        reply.send(fd, p->from, p->request_id);
+    }
+
+    // memcached first; the FPGA copy, if there is one, is not read until the new value is placed
+    void set (const std::shared_ptr<Pending>& p) {
+        stats.sets++;
+        std::string key(p->req.keys[0].key);
+        uint64_t version = 0;
+        auto it = directory.find(key);
+        if (it != directory.end()) {
+            it->second.valid = false;
+            it->second.version = version = ++next_version;
+        }
+        bool sent = cold.set(p->req.keys[0].key, p->req.value, [this, p, key, version](const MemcResponse& r) {
+            set_latency.record(memc_now_ns() - p->arrived_ns);
+            if (r.status != MemcStatus::STORED) stats.set_errors++;
+            reply.begin(p->req);
+            reply.stored(r.status);
+            reply.send(fd, p->from, p->request_id);
+            if (!version) return;
+            auto it = directory.find(key);
+            if (it == directory.end() || it->second.version != version) return;
+            if (r.status == MemcStatus::STORED && hot.fits(key.size(), p->req.value.size(), p->req.flags)) {
+                place(key, version, std::string(p->req.value));
+            } else {
+                drop(it);
+            }
+        }, p->req.flags, p->req.exptime);
+        if (!sent) {
+            stats.bad++;
+            reply.begin(p->req);
+            reply.stored(MemcStatus::ERROR);
+            reply.send(fd, p->from, p->request_id);
+            if (version) drop(directory.find(key));
+        }
+    }
+
+    void place (const std::string& key, uint64_t version, std::string value, bool promotion = false) {
+        Entry& e = directory[key];
+        e.len = static_cast<uint32_t>(value.size());
+        hot.place(key, e.slot, value, [this, key, version, promotion](bool ok) {
+            auto it = directory.find(key);
+            if (it == directory.end() || it->second.version != version) return;
+            if (!ok) {
+                stats.promotion_failures++;
+                drop(it);
+                return;
+            }
+            if (promotion) stats.promotions++;
+            it->second.valid = true;
+        });
+    }
+
+    void drop (std::unordered_map<std::string, Entry>::iterator it) {
+        if (it == directory.end()) return;
+        hot.release(it->first, it->second.slot);
+        directory.erase(it);
+    }
+
+    void on_housekeeping () {
+        cold.expire(cfg.timeout_ns);
+        hot.expire(cfg.timeout_ns);
+        reactor.schedule(housekeeping, std::chrono::milliseconds(10));
+    }
+
+    // The keys that got hot are read from memcached and placed, making room by demoting the coldest
+    // of the ones that are no longer among the hottest.
+    void epoch () {
+        stats.epochs++;
+        std::vector<std::string> hottest = heat.hottest(hot.capacity(), cfg.min_heat);
+        std::unordered_set<std::string> wanted(hottest.begin(), hottest.end());
+        std::vector<std::pair<double, std::string>> cooled;
+        for (const auto& e : directory)
+            if (e.second.valid && !wanted.count(e.first)) cooled.emplace_back(heat.of(e.first), e.first);
+        std::sort(cooled.begin(), cooled.end(), std::greater<std::pair<double, std::string>>());
+
+        size_t moves = 0;
+        for (const std::string& key : hottest) {
+            if (moves == cfg.max_moves) break;
+            if (directory.count(key)) continue;
+            int slot;
+            if (!hot.reserve(key, slot)) {
+                if (!hot.reclaims() || cooled.empty()) continue;
+                stats.demotions++;
+                drop(directory.find(cooled.back().second));
+                cooled.pop_back();
+                if (!hot.reserve(key, slot)) continue;
+            }
+            moves++;
+            promote(key, slot);
+        }
+        cold.flush();
+        heat.decay();
+        reactor.schedule(epoch_timer, cfg.epoch);
+    }
+
+    void promote (const std::string& key, int slot) {
+        Entry& e = directory[key];
+        e.slot = slot;
+        e.version = ++next_version;
+        uint64_t version = e.version;
+        bool sent = cold.get(key, [this, key, version](const MemcResponse& r) {
+            auto it = directory.find(key);
+            if (it == directory.end() || it->second.version != version) return;
+            bool found = r.status == MemcStatus::VALUES && r.num_values == 1;
+            if (!found || !hot.fits(key.size(), r.values[0].data.size(), r.values[0].flags)) {
+                stats.promotion_failures++;
+                drop(it);
+                return;
+            }
+            place(key, version, std::string(r.values[0].data), true);
+        });
+        if (!sent) drop(directory.find(key));
+    }
+};
@@ -2,6 +2,7 @@
 #include <array>
 #include <iostream>
 #include <sstream>
+#include <stdexcept>
 #include <vector>
 #include "util/checksum.h"
 
@@ -34,26 +35,45 @@ struct Layer {
 struct ether: Layer {
     uint16_t ethertype{0x88B5};
     std::array<uint8_t, 6> src{}, dst{};
+    // 802.1Q tag, the PCP is the traffic class the FPGA input arbiter serves the frame with
+    bool vlan = false;
+    uint8_t pcp = 0;
+    uint16_t vid = 0;
+
+    void set_traffic_class (uint8_t tc) {
+        vlan = true;
+        pcp = tc & 0x7;
+    }
+
+    uint16_t tci () const {
+        return static_cast<uint16_t>((pcp & 0x7) << 13 | (vid & 0xFFF));
+    }
 
     void set_src_ether (const std::string& src_mac) {
-        std::istringstream data(src_mac);
-        std::string line;
-        int index = 0;
-        while(std::getline(data,line,':')) {
-            uint8_t temp = std::stoi(line, nullptr, 16);
-            src[index] = static_cast<uint8_t>(temp);
-            index++;
-        }
+        parse_mac(src_mac, src);
     }
 
     void set_dst_ether (const std::string& dst_mac) {
-        std::istringstream data(dst_mac);
-        std::string line;
-        int index = 0;
-        while(std::getline(data,line,':')) {
-            uint8_t temp = std::stoi(line, nullptr, 16);
-            dst[index] = static_cast<uint8_t>(temp);
-            index++;
+        parse_mac(dst_mac, dst);
+    }
+
+    // "aa:bb:cc:dd:ee:ff" in place, no stream or string: every FPGAInterface op sets both MACs
+    static void parse_mac (const std::string& mac, std::array<uint8_t, 6>& out) {
+        int index = 0, digits = 0;
+        unsigned value = 0;
+        for (size_t i = 0; i <= mac.size() && index < 6; i++) {
+            char c = i < mac.size() ? mac[i] : ':';
+            if (c == ':') {
+                if (digits == 0) throw std::invalid_argument("MAC address: " + mac);
+                out[index++] = static_cast<uint8_t>(value);
+                value = 0;
+                digits = 0;
+                continue;
+            }
+            int d = c >= '0' && c <= '9' ? c - '0' : (c | 0x20) >= 'a' && (c | 0x20) <= 'f' ? (c | 0x20) - 'a' + 10 : -1;
+            if (d < 0) throw std::invalid_argument("MAC address: " + mac);
+            value = value * 16 + d;
+            digits++;
         }
     }
 
@@ -62,11 +82,11 @@ struct ether: Layer {
     }
 
     int get_header_length() override {
-        return 14;
+        return vlan ? 18 : 14;
     }
 
     int get_physical_length() override {
-        return 14;
+        return vlan ? 18 : 14;
     }
 };
 
@@ -0,0 +1,130 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include "fpga_interface.h"
+
+// Port 0 of ualink_turbo64 modelled in process, for the samples without an FPGA or Verilator: every
+// frame is answered as it is sent, from a 2KB memory like DPMEM.  The ops are decoded with or without
+// an 802.1Q tag like the FPGA does: sized READ/WRITE honour the byte masks, the atomics return the old value in bytes 40-47, the UALink op responses carry the credit
+// bytes 26-29 (64-bit beats, a 254 beat window) and anything else comes back as it went out.  The
+// responses wait in a ring of fixed slots, so it allocates nothing after it is made.
+//
+// Up to FPGAS FPGAs behind the one link, by the destination MAC of their frames, each with its own
+// memory and credit count, for several FpgaDevices on an EthPort (reactor.h).  Frames to any more
+// share the last one's.
+//
+// With rtt set a response is held that long after its frame went out, like a wire and the FPGA; the
+// fd polls readable early, a loop on it spins until then.
+class LoopbackLink : public FrameLink {
+public:
+    static constexpr int SLOT_BYTES = 512;
+    static constexpr int FPGAS = 8;
+
+    std::chrono::microseconds rtt{0};
+
+    explicit LoopbackLink (size_t slots = 1024) : ring(slots) {
+        efd = eventfd(0, EFD_SEMAPHORE | EFD_NONBLOCK | EFD_CLOEXEC);
+    }
+
+    ~LoopbackLink () override {
+        close(efd);
+    }
+
+    bool send_frame (const uint8_t* p, int n) override {
+        if (n > SLOT_BYTES || tail - head == ring.size()) return false;
+        Slot& s = ring[tail % ring.size()];
+        uint8_t* f = s.bytes.data();
+        memcpy(f, p, n);
+        s.len = n;
+        if (rtt.count() > 0) s.due = std::chrono::steady_clock::now() + rtt;
+        const uint8_t* ip = f + FPGAInterface::ip_offset(f);
+        uint8_t tos = n >= 48 && ip[-2] == 0x08 && ip[-1] == 0x00 ? ip[1] : 0;
+        Fpga& fpga = fpga_of(f);
+        uint8_t* mem = fpga.mem;
+        if (tos == (UA_SIZED | 1) || tos == (UA_SIZED | 2)) {
+            int words = ip[3] + 1;
+            for (int w = 0; w < words && 40 + 8 * w <= n; w++) {
+                uint8_t mask = w == 0 ? ip[5] : (w == words - 1 ? ip[4] : 0xFF);
+                for (int b = 0; b < 8; b++) {
+                    if (!(mask >> b & 1)) continue;
+                    uint8_t& m = mem[(8 * (f[31] + w) + b) % sizeof(fpga.mem)];
+                    if (tos & 2) m = f[32 + 8 * w + b];
+                    else f[32 + 8 * w + b] = m;
+                }
+            }
+        } else if (tos >= 0x05 && tos <= 0x07) {
+            uint8_t* word = &mem[8 * f[31]];
+            uint64_t old, arg, cmp;
+            memcpy(&old, word, 8);
+            memcpy(&arg, &f[32], 8);
+            memcpy(&cmp, &f[40], 8);
+            uint64_t v = tos == 0x05 ? old + arg : (tos == 0x06 || old == cmp ? arg : old);
+            memcpy(word, &v, 8);
+            memcpy(&f[40], &old, 8);
+        }
+        if (tos != 0) {
+            fpga.freed = static_cast<uint16_t>(fpga.freed + (std::max(n, 60) + 7) / 8);
+            f[26] = fpga.freed >> 8;
+            f[27] = fpga.freed & 0xFF;
+            f[28] = 1;
+            f[29] = 8;
+        }
+        tail++;
+        uint64_t one = 1;
+        ssize_t r = write(efd, &one, sizeof(one));
+        (void)r;
+        return true;
+    }
+
+    int recv_frame (uint8_t* buf, uint16_t cap, int) override {
+        if (head == tail) return -1;
+        if (rtt.count() > 0 && std::chrono::steady_clock::now() < ring[head % ring.size()].due) return -1;
+        uint64_t one;
+        ssize_t r = read(efd, &one, sizeof(one));
+        (void)r;
+        Slot& s = ring[head++ % ring.size()];
+        int n = std::min<int>(cap, s.len);
+        memcpy(buf, s.bytes.data(), n);
+        return n;
+    }
+
+    int ready_fd () const override {
+        return efd;
+    }
+
+private:
+    struct Slot {
+        std::array<uint8_t, SLOT_BYTES> bytes;
+        int len = 0;
+        std::chrono::steady_clock::time_point due;
+    };
+
+    struct Fpga {
+        std::array<uint8_t,6> mac;
+        uint8_t mem[2048] = {};
+        uint16_t freed = 0;
+    };
+
+    std::array<Fpga, FPGAS> fpgas;
+    int fpga_count = 0;
+    std::vector<Slot> ring;
+    size_t head = 0, tail = 0;
+    int efd;
+
+    // the FPGA frame f is sent to, the first frame to a MAC takes a free one
+    Fpga& fpga_of (const uint8_t* f) {
+        for (int i = 0; i < fpga_count; i++) {
+            if (memcmp(fpgas[i].mac.data(), f, 6) == 0) return fpgas[i];
+        }
+        if (fpga_count == FPGAS) return fpgas[FPGAS - 1];
+        Fpga& x = fpgas[fpga_count++];
+        memcpy(x.mac.data(), f, 6);
+        return x;
+    }
+};
@@ -0,0 +1,228 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <arpa/inet.h>
+
+/*
+memcached binary protocol, the fixed-offset alternative to the ASCII commands.
+
+Every request and response starts with the same 24 byte header, so building a
+request is a struct fill plus memcpy of key/value and parsing a response is a
+struct read, no number formatting or scanning.  The FPGA KV path in
+ualink_turbo64.v decodes the same header at fixed byte offsets.
+
+Layout after the 8 byte memcached UDP frame header:
+  [0]  magic     0x80 request / 0x81 response
+  [1]  opcode
+  [2]  key length          (big endian)
+  [4]  extras length
+  [5]  data type           (0)
+  [6]  vbucket / status    (big endian)
+  [8]  total body length   (extras + key + value, big endian)
+  [12] opaque              (echoed back untouched)
+  [16] cas                 (big endian)
+  [24] extras, key, value
+*/
+
+#pragma pack(push, 1)
+struct memc_bin_header {
+    uint8_t  magic;
+    uint8_t  opcode;
+    uint16_t key_length;
+    uint8_t  extras_length;
+    uint8_t  data_type;
+    uint16_t status;        // vbucket id in requests
+    uint32_t body_length;
+    uint32_t opaque;
+    uint64_t cas;
+};
+#pragma pack(pop)
+static_assert(sizeof(memc_bin_header) == 24, "memcached binary header is 24 bytes");
+
+enum : uint8_t {
+    MEMC_BIN_REQ   = 0x80,
+    MEMC_BIN_RES   = 0x81,
+
+    MEMC_BIN_GET   = 0x00,
+    MEMC_BIN_SET   = 0x01,
+    MEMC_BIN_NOOP  = 0x0A,
+    MEMC_BIN_GETK  = 0x0C,
+    MEMC_BIN_GETKQ = 0x0D,
+};
+
+enum : uint16_t {
+    MEMC_BIN_OK            = 0x0000,
+    MEMC_BIN_KEY_NOT_FOUND = 0x0001,
+    MEMC_BIN_KEY_EXISTS    = 0x0002,
+    MEMC_BIN_TOO_LARGE     = 0x0003,
+    MEMC_BIN_INVALID_ARGS  = 0x0004,
+    MEMC_BIN_NOT_STORED    = 0x0005,
+    MEMC_BIN_UNKNOWN_CMD   = 0x0081,
+    MEMC_BIN_OUT_OF_MEMORY = 0x0082,   // the FPGA KV path when its index or slots are full
+};
+
+inline uint64_t memc_bin_htonll (uint64_t v) {
+    return ((uint64_t)htonl((uint32_t)v) << 32) | htonl((uint32_t)(v >> 32));
+}
+
+// Sizes so callers can reserve room before encoding.
+inline size_t memc_bin_get_size (size_t key_len) { return sizeof(memc_bin_header) + key_len; }
+inline size_t memc_bin_set_size (size_t key_len, size_t value_len) {
+    return sizeof(memc_bin_header) + 8 + key_len + value_len;
+}
+
+// GET / GETK / GETKQ request.  Returns the position after the request.
+inline char* memc_bin_encode_get (char* p, std::string_view key, uint8_t opcode = MEMC_BIN_GET,
+                                  uint32_t opaque = 0) {
+    memc_bin_header h;
+    memset(&h, 0, sizeof(h));
+    h.magic = MEMC_BIN_REQ;
+    h.opcode = opcode;
+    h.key_length = htons((uint16_t)key.size());
+    h.body_length = htonl((uint32_t)key.size());
+    h.opaque = opaque;
+    memcpy(p, &h, sizeof(h));
+    p += sizeof(h);
+    memcpy(p, key.data(), key.size());
+    return p + key.size();
+}
+
+// SET request, extras are flags + expiration.
+inline char* memc_bin_encode_set (char* p, std::string_view key, std::string_view value,
+                                  uint32_t flags = 0, uint32_t exptime = 0, uint32_t opaque = 0) {
+    memc_bin_header h;
+    memset(&h, 0, sizeof(h));
+    h.magic = MEMC_BIN_REQ;
+    h.opcode = MEMC_BIN_SET;
+    h.key_length = htons((uint16_t)key.size());
+    h.extras_length = 8;
+    h.body_length = htonl((uint32_t)(8 + key.size() + value.size()));
+    h.opaque = opaque;
+    memcpy(p, &h, sizeof(h));
+    p += sizeof(h);
+    uint32_t extras[2] = {htonl(flags), htonl(exptime)};
+    memcpy(p, extras, sizeof(extras));
+    p += sizeof(extras);
+    memcpy(p, key.data(), key.size());
+    p += key.size();
+    memcpy(p, value.data(), value.size());
+    return p + value.size();
+}
+
+// One decoded response, views point into the receive buffer.
+struct MemcBinResponse {
+    uint8_t opcode = 0;
+    uint16_t status = 0;
+    uint32_t opaque = 0;
+    uint64_t cas = 0;
+    uint32_t flags = 0;            // from 4 byte GET extras
+    std::string_view key;
+    std::string_view value;
+};
+
+/*
+Decodes the response at p.  Returns the bytes consumed, 0 if [p, p + n) does
+not hold a complete, well formed response.
+*/
+inline size_t memc_bin_parse (const char* p, size_t n, MemcBinResponse& r) {
+    if (n < sizeof(memc_bin_header)) return 0;
+    memc_bin_header h;
+    memcpy(&h, p, sizeof(h));
+    uint32_t body = ntohl(h.body_length);
+    uint16_t klen = ntohs(h.key_length);
+    if (h.magic != MEMC_BIN_RES || (uint64_t)sizeof(h) + body > n ||
+        (uint32_t)h.extras_length + klen > body) {
+        return 0;
+    }
+    const char* b = p + sizeof(h);
+    r.opcode = h.opcode;
+    r.status = ntohs(h.status);
+    r.opaque = h.opaque;
+    r.cas = memc_bin_htonll(h.cas);
+    r.flags = 0;
+    if (h.extras_length >= 4) {
+        uint32_t f;
+        memcpy(&f, b, 4);
+        r.flags = ntohl(f);
+    }
+    r.key = std::string_view(b + h.extras_length, klen);
+    r.value = std::string_view(b + h.extras_length + klen, body - h.extras_length - klen);
+    return sizeof(h) + body;
+}
+
+// One decoded request, for the servers (the tiered proxy and its stand-ins).
+struct MemcBinRequest {
+    uint8_t opcode = 0;
+    uint32_t opaque = 0;
+    uint32_t flags = 0;            // SET extras
+    uint32_t exptime = 0;
+    std::string_view key;
+    std::string_view value;
+};
+
+/*
+Decodes the request at p.  Returns the bytes consumed, 0 if [p, p + n) does
+not hold a complete, well formed request.
+*/
+inline size_t memc_bin_parse_request (const char* p, size_t n, MemcBinRequest& r) {
+    if (n < sizeof(memc_bin_header)) return 0;
+    memc_bin_header h;
+    memcpy(&h, p, sizeof(h));
+    uint32_t body = ntohl(h.body_length);
+    uint16_t klen = ntohs(h.key_length);
+    if (h.magic != MEMC_BIN_REQ || (uint64_t)sizeof(h) + body > n ||
+        (uint32_t)h.extras_length + klen > body) {
+        return 0;
+    }
+    const char* b = p + sizeof(h);
+    r.opcode = h.opcode;
+    r.opaque = h.opaque;
+    r.flags = 0;
+    r.exptime = 0;
+    if (h.extras_length >= 8) {
+        uint32_t e[2];
+        memcpy(e, b, 8);
+        r.flags = ntohl(e[0]);
+        r.exptime = ntohl(e[1]);
+    }
+    r.key = std::string_view(b + h.extras_length, klen);
+    r.value = std::string_view(b + h.extras_length + klen, body - h.extras_length - klen);
+    return sizeof(h) + body;
+}
+
+inline size_t memc_bin_response_size (size_t key_len, size_t value_len) {
+    return sizeof(memc_bin_header) + 4 + key_len + value_len;
+}
+
+// Response to opcode.  A GET family hit carries the flags as 4 byte extras,
+// GETK and GETKQ the key too; everything else is the bare header.
+inline char* memc_bin_encode_response (char* p, uint8_t opcode, uint16_t status, uint32_t opaque,
+                                       std::string_view key = {}, std::string_view value = {},
+                                       uint32_t flags = 0) {
+    bool get = opcode == MEMC_BIN_GET || opcode == MEMC_BIN_GETK || opcode == MEMC_BIN_GETKQ;
+    bool with_value = get && status == MEMC_BIN_OK;
+    if (!(get && opcode != MEMC_BIN_GET)) key = {};
+    if (!with_value) value = {};
+    uint8_t extras = with_value ? 4 : 0;
+    memc_bin_header h;
+    memset(&h, 0, sizeof(h));
+    h.magic = MEMC_BIN_RES;
+    h.opcode = opcode;
+    h.key_length = htons((uint16_t)key.size());
+    h.extras_length = extras;
+    h.status = htons(status);
+    h.body_length = htonl((uint32_t)(extras + key.size() + value.size()));
+    h.opaque = opaque;
+    memcpy(p, &h, sizeof(h));
+    p += sizeof(h);
+    if (extras) {
+        uint32_t f = htonl(flags);
+        memcpy(p, &f, 4);
+        p += 4;
+    }
+    memcpy(p, key.data(), key.size());
+    p += key.size();
+    memcpy(p, value.data(), value.size());
+    return p + value.size();
+}
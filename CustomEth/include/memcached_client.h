@@ -0,0 +1,886 @@
+#pragma once
+#include <array>
+#include <cerrno>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <linux/filter.h>
+#include <linux/if_packet.h>
+#include <net/ethernet.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include "memcached_binary.h"
+#include "uring_io.h"
+
+/*
+Pipelined memcached UDP client.
+
+udp_memcached.cpp sends one request and blocks on one reply.  This client keeps
+up to 65535 requests in flight on one socket, demultiplexed by the 16-bit
+memc_udp_header.request_id, so a single core can keep a memcached server (or
+the FPGA KV path) busy.
+
+  - requests are encoded in place (no snprintf) into a tx batch and pushed
+    with one sendmmsg per batch
+  - replies are pulled with recvmmsg and routed by request_id
+  - multi-datagram replies are reassembled with seq_number / total_pkts
+  - replies are parsed in place, MemcValue key/data point into the receive
+    buffer and are only valid inside the completion callback
+
+Two I/O backends share everything above the socket:
+  MMSG   - sendmmsg / recvmmsg, works on any kernel
+  URING  - IORING_OP_SENDMSG batches plus one multishot recvmsg feeding a
+           provided buffer ring, so a whole batch of sends and every reply
+           cost a single io_uring_enter (URING_SQPOLL: usually none at all).
+           A batch's buffers stay untouched until its sends complete, the
+           next batch is written into another of TX_SETS buffer sets, so a
+           flush only waits when that set's sends are still in flight.
+If io_uring setup or multishot recv is not supported the client falls back
+to MMSG and `backend` reports what is actually in use.
+
+The AF_PACKET constructor runs the same client over a raw socket like
+udp_memcached_AF_PACKET.cpp: every datagram gets an Ethernet/IPv4/UDP header
+built from a template, replies are picked out by a socket filter on the UDP
+destination port, and the MMSG backend is always used.
+
+Setting `protocol` to MemcProtocol::BINARY switches the encoding to the
+memcached binary protocol (memcached_binary.h).  A single-key get is a plain
+GET, which is what the FPGA KV path decodes, so its MemcValue carries no key.
+A multi-key get is GETKQ for every key but the last plus a GETK, misses stay
+silent and the final GETK response ends the reply.
+*/
+
+struct memc_udp_header {
+    uint16_t request_id;
+    uint16_t seq_number;
+    uint16_t total_pkts;
+    uint16_t reserved;
+};
+
+enum class MemcBackend { MMSG, URING, URING_SQPOLL };
+
+enum class MemcProtocol { ASCII, BINARY };
+
+inline const char* memc_backend_name (MemcBackend b) {
+    switch (b) {
+        case MemcBackend::URING:        return "io_uring";
+        case MemcBackend::URING_SQPOLL: return "io_uring+sqpoll";
+        default:                        return "sendmmsg/recvmmsg";
+    }
+}
+
+enum class MemcStatus {
+    VALUES,      // get reply, zero or more values followed by END
+    STORED,
+    NOT_STORED,
+    EXISTS,
+    NOT_FOUND,
+    DELETED,
+    ERROR,       // ERROR / CLIENT_ERROR / SERVER_ERROR or malformed reply
+    TIMEOUT      // produced locally by expire()
+};
+
+struct MemcValue {
+    std::string_view key;
+    std::string_view data;
+    uint32_t flags = 0;
+    uint64_t cas = 0;
+};
+
+struct MemcResponse {
+    uint16_t request_id = 0;
+    MemcStatus status = MemcStatus::ERROR;
+    const MemcValue* values = nullptr;
+    size_t num_values = 0;
+    uint64_t latency_ns = 0;
+};
+
+inline uint64_t memc_now_ns () {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Unsigned decimal field terminated by ' ' or '\r'.  Advances p, false on junk.
+template <class T>
+inline bool memc_parse_uint (const char*& p, const char* end, T& out) {
+    auto r = std::from_chars(p, end, out);
+    if (r.ec != std::errc() || r.ptr == p) return false;
+    p = r.ptr;
+    return true;
+}
+
+inline bool memc_starts_with (const char* p, const char* end, const char* lit, size_t n) {
+    return (size_t)(end - p) >= n && memcmp(p, lit, n) == 0;
+}
+
+/*
+Parses one complete ASCII reply.  `values` is cleared but keeps its capacity so
+the steady state does not allocate.  Views point into [p, p + n).
+*/
+inline MemcStatus parse_memc_response (const char* p, size_t n, std::vector<MemcValue>& values) {
+    const char* end = p + n;
+    values.clear();
+
+    if (memc_starts_with(p, end, "STORED\r\n", 8))     return MemcStatus::STORED;
+    if (memc_starts_with(p, end, "NOT_STORED\r\n", 12)) return MemcStatus::NOT_STORED;
+    if (memc_starts_with(p, end, "EXISTS\r\n", 8))     return MemcStatus::EXISTS;
+    if (memc_starts_with(p, end, "NOT_FOUND\r\n", 11)) return MemcStatus::NOT_FOUND;
+    if (memc_starts_with(p, end, "DELETED\r\n", 9))    return MemcStatus::DELETED;
+
+    while (memc_starts_with(p, end, "VALUE ", 6)) {
+        p += 6;
+        const char* key = p;
+        const char* sp = static_cast<const char*>(memchr(p, ' ', end - p));
+        if (!sp) return MemcStatus::ERROR;
+        MemcValue v;
+        v.key = std::string_view(key, sp - key);
+        p = sp + 1;
+        uint32_t bytes = 0;
+        if (!memc_parse_uint(p, end, v.flags) || p >= end || *p != ' ') return MemcStatus::ERROR;
+        p++;
+        if (!memc_parse_uint(p, end, bytes)) return MemcStatus::ERROR;
+        if (p < end && *p == ' ') {
+            p++;
+            if (!memc_parse_uint(p, end, v.cas)) return MemcStatus::ERROR;
+        }
+        if (!memc_starts_with(p, end, "\r\n", 2)) return MemcStatus::ERROR;
+        p += 2;
+        if ((size_t)(end - p) < (size_t)bytes + 2) return MemcStatus::ERROR;
+        v.data = std::string_view(p, bytes);
+        p += bytes;
+        if (p[0] != '\r' || p[1] != '\n') return MemcStatus::ERROR;
+        p += 2;
+        values.push_back(v);
+    }
+    if (memc_starts_with(p, end, "END\r\n", 5)) return MemcStatus::VALUES;
+    return MemcStatus::ERROR;
+}
+
+/*
+Parses the binary responses of one request.  GET family responses become
+values (misses are skipped), the status of a SET maps onto the ASCII outcomes.
+*/
+inline MemcStatus parse_memc_binary (const char* p, size_t n, std::vector<MemcValue>& values) {
+    values.clear();
+    MemcStatus status = MemcStatus::ERROR;
+    MemcBinResponse r;
+    while (n) {
+        size_t used = memc_bin_parse(p, n, r);
+        if (!used) return MemcStatus::ERROR;
+        p += used;
+        n -= used;
+        if (r.opcode == MEMC_BIN_GET || r.opcode == MEMC_BIN_GETK || r.opcode == MEMC_BIN_GETKQ) {
+            if (r.status == MEMC_BIN_OK) {
+                MemcValue v;
+                v.key = r.key;
+                v.data = r.value;
+                v.flags = r.flags;
+                v.cas = r.cas;
+                values.push_back(v);
+            } else if (r.status != MEMC_BIN_KEY_NOT_FOUND) {
+                return MemcStatus::ERROR;
+            }
+            status = MemcStatus::VALUES;
+            continue;
+        }
+        switch (r.status) {
+            case MEMC_BIN_OK:            status = MemcStatus::STORED; break;
+            case MEMC_BIN_KEY_EXISTS:    status = MemcStatus::EXISTS; break;
+            case MEMC_BIN_KEY_NOT_FOUND: status = MemcStatus::NOT_FOUND; break;
+            case MEMC_BIN_NOT_STORED:    status = MemcStatus::NOT_STORED; break;
+            default:                     return MemcStatus::ERROR;
+        }
+    }
+    return status;
+}
+
+class MemcachedUdpClient {
+public:
+    using Callback = std::function<void(const MemcResponse&)>;
+
+    static constexpr size_t MAX_DGRAM = 1400;   // memcached's UDP datagram limit
+    static constexpr int BATCH = 256;           // datagrams per sendmmsg / recvmmsg / io_uring_enter
+    static constexpr int TX_SETS = 2;           // batches that can be in flight on io_uring
+    static constexpr size_t RX_BUF = 2048;
+    static constexpr size_t FRAME_HDR = sizeof(ether_header) + sizeof(iphdr) + sizeof(udphdr);
+
+    struct Stats {
+        uint64_t sent = 0;
+        uint64_t completed = 0;
+        uint64_t timeouts = 0;
+        uint64_t stale = 0;          // reply for a request_id that is not in flight
+        uint64_t bad_datagrams = 0;
+        uint64_t send_errors = 0;
+    };
+
+    MemcachedUdpClient (const std::string& server_ip, int port, int max_in_flight = 4096,
+                        MemcBackend want = MemcBackend::MMSG) :
+    max_inflight(max_in_flight > 65535 ? 65535 : max_in_flight), slots(65536) {
+        fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+        if (fd < 0) {
+            throw std::runtime_error("socket(AF_INET, SOCK_DGRAM)");
+        }
+        int bufsz = 8 << 20;
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bufsz, sizeof(bufsz));
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &bufsz, sizeof(bufsz));
+
+        sockaddr_in server_addr;
+        memset(&server_addr, 0, sizeof(server_addr));
+        server_addr.sin_family = AF_INET;
+        server_addr.sin_port = htons(port);
+        if (inet_pton(AF_INET, server_ip.c_str(), &server_addr.sin_addr) <= 0) {
+            close(fd);
+            throw std::runtime_error("Invalid server IP address: " + server_ip);
+        }
+        // connected socket so sendmmsg/recvmmsg need no per-message address
+        if (connect(fd, reinterpret_cast<sockaddr*>(&server_addr), sizeof(server_addr)) < 0) {
+            close(fd);
+            throw std::runtime_error("connect(memcached)");
+        }
+
+        init_batches();
+
+        if (want != MemcBackend::MMSG) {
+            try {
+                uring.reset(new UringIo(2 * BATCH, want == MemcBackend::URING_SQPOLL));
+                uring->setup_buf_ring(URING_BGID, URING_RX_BUFS, URING_RX_BUF);
+                rx_stash.reserve(4 * URING_RX_BUFS);
+                backend = want;
+                arm_recv();
+                uring->submit();
+            } catch (const std::exception&) {
+                uring.reset();
+                backend = MemcBackend::MMSG;
+            }
+        }
+    }
+
+    // Raw AF_PACKET transport (needs root).  Frames go out from src_ip:src_port
+    // to the broadcast MAC like udp_memcached_AF_PACKET.cpp, so nothing has to be
+    // resolved, and only replies addressed to src_port reach this socket.
+    MemcachedUdpClient (const std::string& ifname, const std::string& src_ip,
+                        const std::string& server_ip, int port, uint16_t src_port,
+                        int max_in_flight = 4096) :
+    max_inflight(max_in_flight > 65535 ? 65535 : max_in_flight), slots(65536) {
+        in_addr src, dst;
+        if (inet_pton(AF_INET, src_ip.c_str(), &src) <= 0) {
+            throw std::runtime_error("Invalid source IP address: " + src_ip);
+        }
+        if (inet_pton(AF_INET, server_ip.c_str(), &dst) <= 0) {
+            throw std::runtime_error("Invalid server IP address: " + server_ip);
+        }
+        int ifindex = (int)if_nametoindex(ifname.c_str());
+        if (ifindex == 0) {
+            throw std::runtime_error("Unknown interface: " + ifname);
+        }
+
+        fd = socket(AF_PACKET, SOCK_RAW | SOCK_NONBLOCK, htons(ETH_P_IP));
+        if (fd < 0) {
+            throw std::runtime_error("socket(AF_PACKET) (need root/sudo)");
+        }
+        uint8_t src_mac[6] = {0};
+        struct ifreq ifr;
+        memset(&ifr, 0, sizeof(ifr));
+        strncpy(ifr.ifr_name, ifname.c_str(), IFNAMSIZ - 1);
+        if (ioctl(fd, SIOCGIFHWADDR, &ifr) == 0) memcpy(src_mac, ifr.ifr_hwaddr.sa_data, 6);
+
+        // ipv4, udp, dport == src_port (fixed 20 byte IP header, which is all we send)
+        struct sock_filter code[] = {
+            {0x28, 0, 0, 12},                     // ldh [12]       ethertype
+            {0x15, 0, 5, ETH_P_IP},               // jeq #0x800
+            {0x30, 0, 0, 23},                     // ldb [23]       ip protocol
+            {0x15, 0, 3, IPPROTO_UDP},            // jeq #17
+            {0x28, 0, 0, 36},                     // ldh [36]       udp dport
+            {0x15, 0, 1, src_port},               // jeq #src_port
+            {0x06, 0, 0, 0xFFFF},                 // ret #65535
+            {0x06, 0, 0, 0},                      // ret #0
+        };
+        struct sock_fprog prog = {(unsigned short)(sizeof(code) / sizeof(code[0])), code};
+        setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog));
+        int bufsz = 8 << 20;
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bufsz, sizeof(bufsz));
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &bufsz, sizeof(bufsz));
+
+        sockaddr_ll sll;
+        memset(&sll, 0, sizeof(sll));
+        sll.sll_family = AF_PACKET;
+        sll.sll_protocol = htons(ETH_P_IP);
+        sll.sll_ifindex = ifindex;
+        if (bind(fd, reinterpret_cast<sockaddr*>(&sll), sizeof(sll)) < 0) {
+            close(fd);
+            throw std::runtime_error("bind(AF_PACKET)");
+        }
+
+        // frame template, lengths and checksum are filled per datagram
+        raw_frames = true;
+        tx_headroom = FRAME_HDR;
+        memset(frame_hdr, 0, sizeof(frame_hdr));
+        ether_header* eth = reinterpret_cast<ether_header*>(frame_hdr);
+        memset(eth->ether_dhost, 0xff, 6);
+        memcpy(eth->ether_shost, src_mac, 6);
+        eth->ether_type = htons(ETH_P_IP);
+        iphdr* iph = reinterpret_cast<iphdr*>(frame_hdr + sizeof(ether_header));
+        iph->ihl = 5;
+        iph->version = 4;
+        iph->ttl = 64;
+        iph->protocol = IPPROTO_UDP;
+        iph->saddr = src.s_addr;
+        iph->daddr = dst.s_addr;
+        udphdr* udph = reinterpret_cast<udphdr*>(frame_hdr + sizeof(ether_header) + sizeof(iphdr));
+        udph->source = htons(src_port);
+        udph->dest = htons(port);
+        local_port = src_port;
+        server_port = (uint16_t)port;
+
+        init_batches();
+    }
+
+    ~MemcachedUdpClient () {
+        // the kernel may still be reading tx buffers of the last batches
+        while (uring && sends_pending) {
+            if (uring->submit(1) < 0) break;
+            drain_cq();
+        }
+        if (fd >= 0) close(fd);
+    }
+
+    MemcachedUdpClient (const MemcachedUdpClient&) = delete;
+    MemcachedUdpClient& operator= (const MemcachedUdpClient&) = delete;
+
+    // "get <k1> <k2> ...\r\n" - all keys share one request_id and one callback
+    bool get (const std::string_view* keys, size_t num_keys, Callback cb) {
+        if (protocol == MemcProtocol::BINARY) return get_binary(keys, num_keys, std::move(cb));
+        size_t need = 4 + 2;
+        for (size_t i = 0; i < num_keys; i++) need += keys[i].size() + 1;
+        char* p = begin_request(need, std::move(cb));
+        if (!p) return false;
+        p = put(p, "get", 3);
+        for (size_t i = 0; i < num_keys; i++) {
+            *p++ = ' ';
+            p = put(p, keys[i].data(), keys[i].size());
+        }
+        p = put(p, "\r\n", 2);
+        return end_request(p);
+    }
+
+    bool get (std::string_view key, Callback cb) {
+        return get(&key, 1, std::move(cb));
+    }
+
+    bool get (const std::vector<std::string_view>& keys, Callback cb) {
+        return get(keys.data(), keys.size(), std::move(cb));
+    }
+
+    // "set <key> <flags> <exptime> <bytes>\r\n<data>\r\n"
+    bool set (std::string_view key, std::string_view value, Callback cb, uint32_t flags = 0, uint32_t exptime = 0) {
+        if (protocol == MemcProtocol::BINARY) {
+            char* p = begin_request(memc_bin_set_size(key.size(), value.size()), std::move(cb));
+            if (!p) return false;
+            return end_request(memc_bin_encode_set(p, key, value, flags, exptime, htonl(tx_id)));
+        }
+        size_t need = 4 + key.size() + 3 * 11 + 2 + value.size() + 2;
+        char* p = begin_request(need, std::move(cb));
+        if (!p) return false;
+        p = put(p, "set ", 4);
+        p = put(p, key.data(), key.size());
+        *p++ = ' ';
+        p = put_uint(p, flags);
+        *p++ = ' ';
+        p = put_uint(p, exptime);
+        *p++ = ' ';
+        p = put_uint(p, (uint32_t)value.size());
+        p = put(p, "\r\n", 2);
+        p = put(p, value.data(), value.size());
+        p = put(p, "\r\n", 2);
+        return end_request(p);
+    }
+
+    // Push any queued requests.  Returns datagrams sent.
+    int flush () {
+        if (uring) return flush_uring();
+        if (raw_frames) {
+            for (int i = 0; i < tx_count; i++) frame(tx_base + i);
+        }
+        int sent_total = 0;
+        int off = 0;
+        while (off < tx_count) {
+            int r = sendmmsg(fd, tx_msg + tx_base + off, tx_count - off, 0);
+            if (r <= 0) {
+                if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)) {
+                    struct pollfd pfd = {fd, POLLOUT, 0};
+                    ::poll(&pfd, 1, 1);
+                    continue;
+                }
+                // drop the rest of the batch, their slots time out via expire()
+                stats.send_errors += tx_count - off;
+                break;
+            }
+            off += r;
+            sent_total += r;
+        }
+        stats.sent += sent_total;
+        tx_count = 0;
+        return sent_total;
+    }
+
+    // Receive whatever is ready (waiting up to timeout_ms if nothing is) and run
+    // callbacks.  Returns the number of completed requests.
+    int poll (int timeout_ms = 0) {
+        if (uring) return poll_uring(timeout_ms);
+        if (tx_count) flush();
+        int done = 0;
+        bool waited = false;
+        while (true) {
+            for (int i = 0; i < BATCH; i++) rx_msg[i].msg_hdr.msg_flags = 0;
+            int r = recvmmsg(fd, rx_msg, BATCH, MSG_DONTWAIT, nullptr);
+            if (r <= 0) {
+                if (done || waited || timeout_ms == 0) break;
+                struct pollfd pfd = {fd, POLLIN, 0};
+                if (::poll(&pfd, 1, timeout_ms) <= 0) break;
+                waited = true;
+                continue;
+            }
+            uint64_t now = memc_now_ns();
+            for (int i = 0; i < r; i++) {
+                if (raw_frames) {
+                    done += on_frame(rx_buf[i].data(), rx_msg[i].msg_len, now);
+                } else {
+                    done += on_datagram(rx_buf[i].data(), rx_msg[i].msg_len, now);
+                }
+            }
+            if (r < BATCH) break;
+        }
+        return done;
+    }
+
+    // Fail every request older than timeout_ns with MemcStatus::TIMEOUT.  Requests are kept in send
+    // order, so only the expired ones at the head (and the answered ones before them) are looked at.
+    int expire (uint64_t timeout_ns) {
+        uint64_t now = memc_now_ns();
+        int n = 0;
+        while (sent_count) {
+            SentRef e = sent_fifo[sent_head];
+            Slot& s = slots[e.id];
+            bool pending = s.busy && s.seq == e.seq;
+            if (pending && now - s.sent_ns < timeout_ns) break;
+            sent_head = (sent_head + 1) & (sent_fifo.size() - 1);
+            sent_count--;
+            if (!pending) continue;
+            MemcResponse resp;
+            resp.request_id = e.id;
+            resp.status = MemcStatus::TIMEOUT;
+            resp.latency_ns = now - s.sent_ns;
+            Callback cb = std::move(s.cb);
+            release(s);
+            stats.timeouts++;
+            if (cb) cb(resp);
+            n++;
+        }
+        return n;
+    }
+
+    size_t in_flight () const { return inflight_count; }
+    bool can_submit () const { return inflight_count < (size_t)max_inflight; }
+    int socket_fd () const { return fd; }
+    uint64_t uring_enters () const { return uring ? uring->enters : 0; }
+
+    MemcBackend backend = MemcBackend::MMSG;
+    MemcProtocol protocol = MemcProtocol::ASCII;   // switch only while nothing is in flight
+
+    Stats stats;
+
+protected:
+    struct Slot {
+        bool busy = false;
+        uint16_t total = 0;
+        uint16_t received = 0;
+        uint64_t sent_ns = 0;
+        uint64_t seq = 0;                 // tells this request from an earlier one on the same id
+        Callback cb;
+        std::vector<std::string> parts;   // only used for multi-datagram replies
+    };
+
+    int fd = -1;
+    int max_inflight;
+    size_t inflight_count = 0;
+    uint16_t next_id = 1;
+    std::vector<Slot> slots;
+    std::vector<MemcValue> parsed;
+    std::string assembled;
+
+    // request ids in send order for expire(), answered ones are skipped when they reach the head;
+    // a power of two ring that only grows while more requests are younger than the oldest pending
+    struct SentRef { uint16_t id; uint64_t seq; };
+    std::vector<SentRef> sent_fifo = std::vector<SentRef>(1024);
+    size_t sent_head = 0, sent_count = 0;
+    uint64_t send_seq = 0;
+
+    // io_uring backend state
+    static constexpr uint64_t URING_SEND = 1;    // the tx set in the upper 32 bits
+    static constexpr uint64_t URING_RECV = 2;
+    static constexpr uint16_t URING_BGID = 7;
+    static constexpr unsigned URING_RX_BUFS = 1024;
+    static constexpr unsigned URING_RX_BUF = RX_BUF + sizeof(io_uring_recvmsg_out);
+    struct RxRef { uint16_t bid; uint32_t len; };
+    std::unique_ptr<UringIo> uring;
+    struct msghdr rx_hdr = {};
+    bool recv_armed = false;
+    bool uring_broken = false;
+    bool dispatching = false;
+    unsigned sends_pending = 0;
+    unsigned set_pending[TX_SETS] = {};
+    std::vector<RxRef> rx_stash;
+
+    // AF_PACKET transport state
+    bool raw_frames = false;
+    size_t tx_headroom = 0;
+    uint8_t frame_hdr[FRAME_HDR];
+    uint16_t local_port = 0, server_port = 0;
+    uint16_t ip_id = 0;
+
+    // TX_SETS batches of BATCH datagrams, the one being written starts at tx_base; only the
+    // io_uring backend moves on to the next set, the others send a batch before returning
+    int tx_base = 0;
+    int tx_count = 0;
+    uint16_t tx_id = 0;
+    std::array<std::array<char, FRAME_HDR + MAX_DGRAM>, TX_SETS * BATCH> tx_buf;
+    struct iovec tx_iov[TX_SETS * BATCH];
+    struct mmsghdr tx_msg[TX_SETS * BATCH];
+
+    std::array<std::array<char, RX_BUF>, BATCH> rx_buf;
+    struct iovec rx_iov[BATCH];
+    struct mmsghdr rx_msg[BATCH];
+
+    void init_batches () {
+        for (int i = 0; i < TX_SETS * BATCH; i++) tx_iov[i].iov_base = tx_buf[i].data();
+        for (int i = 0; i < BATCH; i++) {
+            rx_iov[i].iov_base = rx_buf[i].data();
+            rx_iov[i].iov_len = RX_BUF;
+            memset(&rx_msg[i], 0, sizeof(rx_msg[i]));
+            rx_msg[i].msg_hdr.msg_iov = &rx_iov[i];
+            rx_msg[i].msg_hdr.msg_iovlen = 1;
+        }
+    }
+
+    // Prepend Ethernet/IPv4/UDP to tx slot i (UDP checksum left at 0).
+    void frame (int i) {
+        uint8_t* f = reinterpret_cast<uint8_t*>(tx_buf[i].data());
+        size_t len = tx_iov[i].iov_len;
+        memcpy(f, frame_hdr, FRAME_HDR);
+        iphdr* iph = reinterpret_cast<iphdr*>(f + sizeof(ether_header));
+        iph->tot_len = htons((uint16_t)(len - sizeof(ether_header)));
+        iph->id = htons(ip_id++);
+        const uint16_t* w = reinterpret_cast<const uint16_t*>(iph);
+        uint32_t sum = 0;
+        for (int k = 0; k < 10; k++) sum += w[k];
+        sum = (sum & 0xFFFF) + (sum >> 16);
+        sum += sum >> 16;
+        iph->check = (uint16_t)~sum;
+        udphdr* udph = reinterpret_cast<udphdr*>(f + sizeof(ether_header) + sizeof(iphdr));
+        udph->len = htons((uint16_t)(len - sizeof(ether_header) - sizeof(iphdr)));
+    }
+
+    // Strip Ethernet/IPv4/UDP from a received frame and hand on the datagram.
+    int on_frame (const char* buf, size_t len, uint64_t now) {
+        if (len < sizeof(ether_header) + sizeof(iphdr)) return 0;
+        const uint8_t* ip = reinterpret_cast<const uint8_t*>(buf) + sizeof(ether_header);
+        size_t ihl = (ip[0] & 0x0F) * 4u;
+        if (ip[9] != IPPROTO_UDP || len < sizeof(ether_header) + ihl + sizeof(udphdr)) return 0;
+        udphdr udph;
+        memcpy(&udph, ip + ihl, sizeof(udph));
+        if (ntohs(udph.source) != server_port || ntohs(udph.dest) != local_port) return 0;
+        size_t off = sizeof(ether_header) + ihl + sizeof(udphdr);
+        size_t udp_len = ntohs(udph.len);
+        if (udp_len < sizeof(udphdr) || off + udp_len - sizeof(udphdr) > len) {
+            stats.bad_datagrams++;
+            return 0;
+        }
+        return on_datagram(buf + off, udp_len - sizeof(udphdr), now);
+    }
+
+    static char* put (char* p, const char* s, size_t n) {
+        memcpy(p, s, n);
+        return p + n;
+    }
+
+    static char* put_uint (char* p, uint32_t v) {
+        return std::to_chars(p, p + 10, v).ptr;
+    }
+
+    bool get_binary (const std::string_view* keys, size_t num_keys, Callback cb) {
+        if (num_keys == 0) return false;
+        size_t need = 0;
+        for (size_t i = 0; i < num_keys; i++) need += memc_bin_get_size(keys[i].size());
+        char* p = begin_request(need, std::move(cb));
+        if (!p) return false;
+        uint32_t opaque = htonl(tx_id);
+        if (num_keys == 1) return end_request(memc_bin_encode_get(p, keys[0], MEMC_BIN_GET, opaque));
+        for (size_t i = 0; i + 1 < num_keys; i++) {
+            p = memc_bin_encode_get(p, keys[i], MEMC_BIN_GETKQ, opaque);
+        }
+        return end_request(memc_bin_encode_get(p, keys[num_keys - 1], MEMC_BIN_GETK, opaque));
+    }
+
+    // Reserve a request_id and a tx slot, write the UDP frame header, return the
+    // position for the command.
+    char* begin_request (size_t cmd_bytes, Callback cb) {
+        if (cmd_bytes + sizeof(memc_udp_header) > MAX_DGRAM) return nullptr;
+        if (inflight_count >= (size_t)max_inflight) return nullptr;
+        if (tx_count == BATCH) flush();
+
+        while (slots[next_id].busy || next_id == 0) next_id++;
+        tx_id = next_id++;
+        Slot& s = slots[tx_id];
+        s.busy = true;
+        s.total = 0;
+        s.received = 0;
+        s.cb = std::move(cb);
+        inflight_count++;
+
+        memc_udp_header hdr;
+        hdr.request_id = htons(tx_id);
+        hdr.seq_number = htons(0);
+        hdr.total_pkts = htons(1);
+        hdr.reserved   = htons(0);
+        char* p = tx_buf[tx_base + tx_count].data() + tx_headroom;
+        memcpy(p, &hdr, sizeof(hdr));
+        return p + sizeof(hdr);
+    }
+
+    bool end_request (char* p) {
+        int i = tx_base + tx_count;
+        char* start = tx_buf[i].data();
+        tx_iov[i].iov_len = (size_t)(p - start);
+        memset(&tx_msg[i], 0, sizeof(tx_msg[i]));
+        tx_msg[i].msg_hdr.msg_iov = &tx_iov[i];
+        tx_msg[i].msg_hdr.msg_iovlen = 1;
+        Slot& s = slots[tx_id];
+        s.sent_ns = memc_now_ns();
+        s.seq = ++send_seq;
+        push_sent(tx_id, s.seq);
+        tx_count++;
+        return true;
+    }
+
+    void push_sent (uint16_t id, uint64_t seq) {
+        size_t mask = sent_fifo.size() - 1;
+        while (sent_count) {
+            const SentRef& e = sent_fifo[sent_head];
+            if (slots[e.id].busy && slots[e.id].seq == e.seq) break;
+            sent_head = (sent_head + 1) & mask;
+            sent_count--;
+        }
+        if (sent_count == sent_fifo.size()) {
+            std::vector<SentRef> bigger(2 * sent_fifo.size());
+            for (size_t i = 0; i < sent_count; i++) bigger[i] = sent_fifo[(sent_head + i) & mask];
+            sent_fifo.swap(bigger);
+            sent_head = 0;
+            mask = sent_fifo.size() - 1;
+        }
+        sent_fifo[(sent_head + sent_count) & mask] = {id, seq};
+        sent_count++;
+    }
+
+    // One multishot recvmsg keeps posting a CQE per datagram until the buffer
+    // ring runs dry or the socket errors.
+    void arm_recv () {
+        io_uring_sqe* sqe = uring->get_sqe();
+        if (!sqe) {
+            uring->submit();
+            sqe = uring->get_sqe();
+            if (!sqe) return;
+        }
+        rx_hdr.msg_namelen = 0;
+        rx_hdr.msg_controllen = 0;
+        sqe->opcode = IORING_OP_RECVMSG;
+        sqe->fd = fd;
+        sqe->addr = (uint64_t)(uintptr_t)&rx_hdr;
+        sqe->len = 1;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = URING_BGID;
+        sqe->user_data = URING_RECV;
+        recv_armed = true;
+    }
+
+    // Reap CQEs without running callbacks, replies are stashed so a callback
+    // that submits (and flushes) can never re-enter the CQ walk.
+    void drain_cq () {
+        uring->reap([this](const io_uring_cqe& cqe) {
+            if ((uint32_t)cqe.user_data == URING_SEND) {
+                sends_pending--;
+                set_pending[cqe.user_data >> 32]--;
+                if (cqe.res < 0) stats.send_errors++;
+                return;
+            }
+            if (cqe.flags & IORING_CQE_F_BUFFER) {
+                uint16_t bid = (uint16_t)(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+                if (cqe.res > 0) {
+                    rx_stash.push_back({bid, (uint32_t)cqe.res});
+                } else {
+                    uring->recycle(bid);
+                }
+            }
+            if (!(cqe.flags & IORING_CQE_F_MORE)) {
+                recv_armed = false;
+                if (cqe.res == -EINVAL || cqe.res == -EOPNOTSUPP) uring_broken = true;
+            }
+        });
+    }
+
+    int process_stash () {
+        if (dispatching) return 0;
+        dispatching = true;
+        int done = 0;
+        uint64_t now = memc_now_ns();
+        for (size_t i = 0; i < rx_stash.size(); i++) {
+            uint8_t* buf = uring->buffer(rx_stash[i].bid);
+            io_uring_recvmsg_out out;
+            memcpy(&out, buf, sizeof(out));
+            size_t hdr = sizeof(out) + rx_hdr.msg_namelen + rx_hdr.msg_controllen;
+            if (out.flags & MSG_TRUNC || hdr + out.payloadlen > rx_stash[i].len) {
+                stats.bad_datagrams++;
+            } else {
+                done += on_datagram(reinterpret_cast<const char*>(buf + hdr), out.payloadlen, now);
+            }
+            uring->recycle(rx_stash[i].bid);
+        }
+        rx_stash.clear();
+        dispatching = false;
+        return done;
+    }
+
+    int flush_uring () {
+        int queued = 0;
+        for (int i = 0; i < tx_count; i++) {
+            io_uring_sqe* sqe = uring->get_sqe();
+            if (!sqe) {
+                uring->submit();
+                sqe = uring->get_sqe();
+                if (!sqe) break;
+            }
+            sqe->opcode = IORING_OP_SENDMSG;
+            sqe->fd = fd;
+            sqe->addr = (uint64_t)(uintptr_t)&tx_msg[tx_base + i].msg_hdr;
+            sqe->len = 1;
+            sqe->user_data = URING_SEND | (uint64_t)(tx_base / BATCH) << 32;
+            queued++;
+        }
+        stats.send_errors += tx_count - queued;
+        sends_pending += queued;
+        set_pending[tx_base / BATCH] += queued;
+        uring->submit();
+        drain_cq();
+        // the sends of this set complete in the background, the next requests go into the next
+        // set, which has to wait only if its own sends from TX_SETS flushes ago are still going
+        tx_base = (tx_base + BATCH) % (TX_SETS * BATCH);
+        while (set_pending[tx_base / BATCH]) {
+            if (uring->submit(1) < 0) break;
+            drain_cq();
+        }
+        stats.sent += queued;
+        tx_count = 0;
+        return queued;
+    }
+
+    int poll_uring (int timeout_ms) {
+        if (tx_count) flush_uring();
+        drain_cq();
+        if (rx_stash.empty() && timeout_ms && !dispatching) {
+            if (uring->wait_cq(timeout_ms)) drain_cq();
+        }
+        int done = process_stash();
+        if (uring_broken) {
+            // multishot recvmsg is not supported here, drop to recvmmsg for good
+            uring.reset();
+            backend = MemcBackend::MMSG;
+            return done + poll(0);
+        }
+        if (!recv_armed) {
+            arm_recv();
+            uring->submit();
+        }
+        return done;
+    }
+
+    void release (Slot& s) {
+        s.busy = false;
+        s.cb = nullptr;
+        for (auto& part : s.parts) part.clear();
+        inflight_count--;
+    }
+
+    int complete (uint16_t id, const char* payload, size_t len, uint64_t now) {
+        Slot& s = slots[id];
+        MemcResponse resp;
+        resp.request_id = id;
+        resp.status = protocol == MemcProtocol::BINARY ? parse_memc_binary(payload, len, parsed)
+                                                        : parse_memc_response(payload, len, parsed);
+        resp.values = parsed.data();
+        resp.num_values = parsed.size();
+        resp.latency_ns = now - s.sent_ns;
+        Callback cb = std::move(s.cb);
+        release(s);
+        stats.completed++;
+        if (cb) cb(resp);
+        return 1;
+    }
+
+    int on_datagram (const char* buf, size_t len, uint64_t now) {
+        if (len < sizeof(memc_udp_header)) {
+            stats.bad_datagrams++;
+            return 0;
+        }
+        memc_udp_header hdr;
+        memcpy(&hdr, buf, sizeof(hdr));
+        uint16_t id = ntohs(hdr.request_id);
+        uint16_t seq = ntohs(hdr.seq_number);
+        uint16_t total = ntohs(hdr.total_pkts);
+        const char* payload = buf + sizeof(hdr);
+        size_t payload_len = len - sizeof(hdr);
+
+        Slot& s = slots[id];
+        if (!s.busy) {
+            stats.stale++;
+            return 0;
+        }
+        if (total == 0 || seq >= total) {
+            stats.bad_datagrams++;
+            return 0;
+        }
+        if (total == 1) {
+            // common case, parse straight out of the receive buffer
+            return complete(id, payload, payload_len, now);
+        }
+
+        if (s.total == 0) {
+            s.total = total;
+            if (s.parts.size() < total) s.parts.resize(total);
+        }
+        if (total != s.total || !s.parts[seq].empty()) {
+            stats.bad_datagrams++;
+            return 0;
+        }
+        s.parts[seq].assign(payload, payload_len);
+        if (++s.received < s.total) return 0;
+
+        assembled.clear();
+        for (uint16_t i = 0; i < s.total; i++) assembled += s.parts[i];
+        return complete(id, assembled.data(), assembled.size(), now);
+    }
+};
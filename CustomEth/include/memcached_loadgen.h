@@ -0,0 +1,232 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/*
+Building blocks for the open-loop memcached load generator (memcached_loadgen.cpp).
+
+  KeyChooser     - key popularity: uniform, zipfian (YCSB style, theta ~0.99)
+                   or hot-set (hot_fraction of the keys get hot_prob of the traffic)
+  ValueSizer     - value sizes: fixed, uniform [min,max] or the generalized
+                   Pareto fit of Facebook's ETC pool used by mutilate
+  ArrivalClock   - Poisson arrivals, exponential gaps at a target rate
+  LatencyHistogram - log-linear buckets (~1.5% error), mergeable across threads
+
+Latency is measured from the *scheduled* send time of a request, not from when
+it actually left, so a stalled client or server shows up in the tail instead
+of silently lowering the offered load (coordinated omission).
+*/
+
+class KeyChooser {
+public:
+    enum Dist { UNIFORM, ZIPF, HOTSET };
+
+    KeyChooser (uint64_t num_keys, Dist d = UNIFORM, double param = 0.99, double hot_prob = 0.9) :
+    n(num_keys), dist(d) {
+        if (n == 0) throw std::runtime_error("KeyChooser needs at least one key");
+        if (dist == ZIPF) {
+            theta = param;
+            if (theta <= 0 || theta >= 1) throw std::runtime_error("zipf theta must be in (0,1)");
+            // zeta(n) is O(n) once, sampling is O(1) (Gray et al., "Quickly generating
+            // billion-record synthetic databases")
+            zetan = 0;
+            for (uint64_t i = 1; i <= n; i++) zetan += 1.0 / std::pow((double)i, theta);
+            double zeta2 = 1.0 + 1.0 / std::pow(2.0, theta);
+            alpha = 1.0 / (1.0 - theta);
+            eta = (1.0 - std::pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / zetan);
+            half_pow_theta = 1.0 + std::pow(0.5, theta);
+        } else if (dist == HOTSET) {
+            if (param <= 0 || param > 1 || hot_prob < 0 || hot_prob > 1) {
+                throw std::runtime_error("hot-set fraction and probability must be in (0,1]");
+            }
+            hot_keys = std::max<uint64_t>(1, (uint64_t)(param * n));
+            hot_p = hot_prob;
+        }
+    }
+
+    // Key index in [0, num_keys).  Zipf rank 0 is the most popular key, ranks are
+    // scattered over the key space so the hot keys do not share a prefix.
+    template <class Rng>
+    uint64_t next (Rng& rng) {
+        switch (dist) {
+            case ZIPF: {
+                double u = unit(rng);
+                double uz = u * zetan;
+                uint64_t rank;
+                if (uz < 1.0) {
+                    rank = 0;
+                } else if (uz < half_pow_theta) {
+                    rank = 1;
+                } else {
+                    rank = (uint64_t)(n * std::pow(eta * u - eta + 1.0, alpha));
+                    if (rank >= n) rank = n - 1;
+                }
+                return scramble(rank);
+            }
+            case HOTSET: {
+                if (unit(rng) < hot_p || hot_keys == n) return rng() % hot_keys;
+                return hot_keys + rng() % (n - hot_keys);
+            }
+            default:
+                return rng() % n;
+        }
+    }
+
+    uint64_t size () const { return n; }
+
+private:
+    uint64_t n;
+    Dist dist;
+    double theta = 0, zetan = 0, alpha = 0, eta = 0, half_pow_theta = 0;
+    uint64_t hot_keys = 0;
+    double hot_p = 0;
+
+    template <class Rng>
+    static double unit (Rng& rng) {
+        return std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+    }
+
+    uint64_t scramble (uint64_t rank) const {
+        // FNV-1a over the rank bytes, same idea as YCSB's ScrambledZipfian
+        uint64_t h = 0xcbf29ce484222325ull;
+        for (int i = 0; i < 8; i++) {
+            h ^= (rank >> (8 * i)) & 0xFF;
+            h *= 0x100000001b3ull;
+        }
+        return h % n;
+    }
+};
+
+class ValueSizer {
+public:
+    enum Dist { FIXED, UNIFORM, ETC };
+
+    ValueSizer (Dist d, uint32_t a, uint32_t b, uint32_t cap) :
+    dist(d), lo(a), hi(b), max_size(cap) {
+        if (dist == UNIFORM && lo > hi) std::swap(lo, hi);
+    }
+
+    // "64", "16:1024" or "etc"
+    static ValueSizer parse (const std::string& spec, uint32_t cap) {
+        if (spec == "etc") return ValueSizer(ETC, 0, 0, cap);
+        size_t colon = spec.find(':');
+        if (colon == std::string::npos) {
+            uint32_t v = (uint32_t)std::stoul(spec);
+            return ValueSizer(FIXED, v, v, cap);
+        }
+        return ValueSizer(UNIFORM, (uint32_t)std::stoul(spec.substr(0, colon)),
+                          (uint32_t)std::stoul(spec.substr(colon + 1)), cap);
+    }
+
+    template <class Rng>
+    uint32_t next (Rng& rng) {
+        uint32_t v;
+        switch (dist) {
+            case UNIFORM:
+                v = lo + (uint32_t)(rng() % ((uint64_t)hi - lo + 1));
+                break;
+            case ETC: {
+                // Atikoglu et al. SIGMETRICS'12, GPareto(mu=15, sigma=214.476, k=0.348238)
+                double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+                double x = 15.0 + 214.476 * (std::pow(1.0 - u, -0.348238) - 1.0) / 0.348238;
+                v = x < 1.0 ? 1u : (x > 1e9 ? 1000000000u : (uint32_t)x);
+                break;
+            }
+            default:
+                v = lo;
+        }
+        return std::min(v, max_size);
+    }
+
+    uint32_t max () const { return dist == ETC ? max_size : std::min(hi, max_size); }
+
+private:
+    Dist dist;
+    uint32_t lo, hi, max_size;
+};
+
+class ArrivalClock {
+public:
+    // rate_per_s <= 0 means closed loop, next() always returns `now`
+    ArrivalClock (double rate_per_s, uint64_t start_ns) :
+    exp(rate_per_s > 0 ? rate_per_s / 1e9 : 1.0), open_loop(rate_per_s > 0), next_ns(start_ns) {}
+
+    template <class Rng>
+    uint64_t advance (Rng& rng) {
+        uint64_t t = next_ns;
+        if (open_loop) next_ns += (uint64_t)exp(rng);
+        return t;
+    }
+
+    uint64_t peek () const { return next_ns; }
+    bool is_open_loop () const { return open_loop; }
+    void reset (uint64_t now) { next_ns = now; }
+
+private:
+    std::exponential_distribution<double> exp;
+    bool open_loop;
+    uint64_t next_ns;
+};
+
+class LatencyHistogram {
+public:
+    static constexpr int SUB_BITS = 6;                  // 64 linear buckets per power of two
+    static constexpr int SUB = 1 << SUB_BITS;
+    static constexpr int MAGNITUDES = 64 - SUB_BITS;
+
+    LatencyHistogram () : counts((size_t)(MAGNITUDES + 1) * SUB, 0) {}
+
+    void record (uint64_t ns) {
+        counts[index(ns)]++;
+        total++;
+        sum += ns;
+        if (ns > max_ns) max_ns = ns;
+    }
+
+    void merge (const LatencyHistogram& o) {
+        for (size_t i = 0; i < counts.size(); i++) counts[i] += o.counts[i];
+        total += o.total;
+        sum += o.sum;
+        max_ns = std::max(max_ns, o.max_ns);
+    }
+
+    // Upper edge of the bucket holding quantile q, in ns.
+    uint64_t percentile (double q) const {
+        if (total == 0) return 0;
+        uint64_t rank = (uint64_t)std::ceil(q * total);
+        if (rank == 0) rank = 1;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts.size(); i++) {
+            seen += counts[i];
+            if (seen >= rank) return std::min(upper(i), max_ns);
+        }
+        return max_ns;
+    }
+
+    uint64_t count () const { return total; }
+    uint64_t max () const { return max_ns; }
+    double mean () const { return total ? (double)sum / total : 0.0; }
+
+private:
+    std::vector<uint64_t> counts;
+    uint64_t total = 0;
+    uint64_t sum = 0;
+    uint64_t max_ns = 0;
+
+    static size_t index (uint64_t v) {
+        if (v < (uint64_t)SUB) return (size_t)v;
+        int mag = 63 - __builtin_clzll(v) - SUB_BITS + 1;      // >= 1
+        return (size_t)mag * SUB + (size_t)((v >> (mag - 1)) - SUB);
+    }
+
+    static uint64_t upper (size_t i) {
+        size_t mag = i / SUB, sub = i % SUB;
+        if (mag == 0) return sub;
+        return ((uint64_t)(sub + SUB + 1) << (mag - 1)) - 1;
+    }
+};
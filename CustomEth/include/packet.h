@@ -12,6 +12,8 @@ struct Packet {
   }
   void update();
   void prepare_send (const uint8_t* payload, uint8_t* frame, int& bytes_to_send);
+  // the ether / ualink frame prepare_send builds, without a Packet: its length
+  static int ualink_frame (ether& ether_layer, ualink& ua_layer, const uint8_t* payload, uint8_t* frame);
   void prepare_packet_recv (const uint8_t* recv_frame);
 };
 
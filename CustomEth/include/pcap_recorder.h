@@ -0,0 +1,206 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/*
+In-process pcapng recorder for UALink / memcached frames.
+
+The data path (RawEth::send_on_wire / recv_on_wire) only copies the frame into
+a memfd backed ring that is mapped twice back to back, so every Enhanced Packet
+Block lands contiguously even when it wraps.  A writer thread drains the ring
+into the capture file.  If the writer falls behind the frame is dropped and
+counted rather than stalling the sender.  Any number of threads may record, a
+RawEth sending on one thread and receiving on another shares one recorder:
+space is reserved with a CAS on `reserved` and blocks are published to the
+writer in reservation order through `head`.
+
+Timestamps are CLOCK_REALTIME in nanoseconds (if_tsresol = 9), the direction
+is carried in epb_flags so wireshark shows inbound/outbound.
+*/
+
+class PcapRecorder {
+public:
+    enum Direction : uint32_t { INBOUND = 1, OUTBOUND = 2 };
+
+    static constexpr uint32_t SNAPLEN = 2048;
+
+    explicit PcapRecorder (const std::string& path, size_t ring_bytes = (1u << 22)) {
+        ring_size = round_pow2(ring_bytes);
+        file_fd = open(path.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0644);
+        if (file_fd < 0) {
+            throw std::runtime_error(std::string("open(pcapng): ") + path);
+        }
+        map_ring();
+        write_file_header();
+        running.store(true);
+        writer = std::thread(&PcapRecorder::drain_loop, this);
+    }
+
+    ~PcapRecorder () {
+        running.store(false);
+        if (writer.joinable()) writer.join();
+        drain();
+        munmap(ring, 2 * ring_size);
+        close(file_fd);
+    }
+
+    PcapRecorder (const PcapRecorder&) = delete;
+    PcapRecorder& operator= (const PcapRecorder&) = delete;
+
+    // Called on the data path, never blocks on the file, at most waits for another thread to finish
+    // copying a block reserved before this one.  Returns false if the frame was dropped.
+    bool record (const uint8_t* frame, uint32_t len, Direction dir) {
+        return record_at(frame, len, dir, now_ns());
+    }
+
+    bool record_at (const uint8_t* frame, uint32_t len, Direction dir, uint64_t ts_ns) {
+        uint32_t cap_len = len < SNAPLEN ? len : SNAPLEN;
+        uint32_t padded = (cap_len + 3) & ~3u;
+        // EPB fixed part (28) + data + epb_flags option (8) + opt_endofopt (4) + trailing length (4)
+        uint32_t block_len = 28 + padded + 8 + 4 + 4;
+
+        uint64_t h = reserved.load(std::memory_order_relaxed);
+        do {
+            if (h - tail.load(std::memory_order_acquire) + block_len > ring_size) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+        } while (!reserved.compare_exchange_weak(h, h + block_len, std::memory_order_relaxed));
+
+        uint8_t* p = ring + (h & (ring_size - 1));
+        put32(p + 0, 0x00000006);
+        put32(p + 4, block_len);
+        put32(p + 8, 0);                               // interface id
+        put32(p + 12, (uint32_t)(ts_ns >> 32));
+        put32(p + 16, (uint32_t)(ts_ns & 0xFFFFFFFF));
+        put32(p + 20, cap_len);
+        put32(p + 24, len);
+        memcpy(p + 28, frame, cap_len);
+        memset(p + 28 + cap_len, 0, padded - cap_len);
+        uint8_t* opt = p + 28 + padded;
+        put16(opt + 0, 2);                             // epb_flags
+        put16(opt + 2, 4);
+        put32(opt + 4, (uint32_t)dir);
+        put32(opt + 8, 0);                             // opt_endofopt
+        put32(opt + 12, block_len);
+
+        // a block reserved before ours may still be copying in, the writer must not see a hole
+        while (head.load(std::memory_order_acquire) != h) std::this_thread::yield();
+        head.store(h + block_len, std::memory_order_release);
+        recorded.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    static uint64_t now_ns () {
+        timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+    }
+
+    std::atomic<uint64_t> recorded{0};
+    std::atomic<uint64_t> dropped{0};
+
+private:
+    int file_fd = -1;
+    uint8_t* ring = nullptr;
+    size_t ring_size = 0;
+    alignas(64) std::atomic<uint64_t> reserved{0};
+    alignas(64) std::atomic<uint64_t> head{0};
+    alignas(64) std::atomic<uint64_t> tail{0};
+    std::atomic<bool> running{false};
+    std::thread writer;
+
+    static size_t round_pow2 (size_t n) {
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        size_t s = page;
+        while (s < n) s <<= 1;
+        return s;
+    }
+
+    static void put16 (uint8_t* p, uint16_t v) { memcpy(p, &v, 2); }
+    static void put32 (uint8_t* p, uint32_t v) { memcpy(p, &v, 4); }
+
+    // Map the same memfd twice so [ring, ring + 2*size) is a seamless view of the ring.
+    void map_ring () {
+        int mfd = memfd_create("pcap_ring", 0);
+        if (mfd < 0 || ftruncate(mfd, ring_size) < 0) {
+            throw std::runtime_error("memfd_create(pcap_ring)");
+        }
+        void* base = mmap(nullptr, 2 * ring_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base == MAP_FAILED) {
+            close(mfd);
+            throw std::runtime_error("mmap(pcap_ring)");
+        }
+        uint8_t* b = static_cast<uint8_t*>(base);
+        if (mmap(b, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, mfd, 0) == MAP_FAILED ||
+            mmap(b + ring_size, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, mfd, 0) == MAP_FAILED) {
+            munmap(base, 2 * ring_size);
+            close(mfd);
+            throw std::runtime_error("mmap(pcap_ring) mirror");
+        }
+        close(mfd);
+        ring = b;
+    }
+
+    void write_all (const uint8_t* p, size_t n) {
+        while (n > 0) {
+            ssize_t w = ::write(file_fd, p, n);
+            if (w <= 0) return;
+            p += w;
+            n -= (size_t)w;
+        }
+    }
+
+    void write_file_header () {
+        uint8_t hdr[28 + 32];
+        // Section Header Block
+        put32(hdr + 0, 0x0A0D0D0A);
+        put32(hdr + 4, 28);
+        put32(hdr + 8, 0x1A2B3C4D);
+        put16(hdr + 12, 1);
+        put16(hdr + 14, 0);
+        uint64_t section_len = ~0ull;
+        memcpy(hdr + 16, &section_len, 8);
+        put32(hdr + 24, 28);
+        // Interface Description Block, Ethernet, nanosecond resolution
+        uint8_t* idb = hdr + 28;
+        put32(idb + 0, 0x00000001);
+        put32(idb + 4, 32);
+        put16(idb + 8, 1);                             // LINKTYPE_ETHERNET
+        put16(idb + 10, 0);
+        put32(idb + 12, SNAPLEN);
+        put16(idb + 16, 9);                            // if_tsresol
+        put16(idb + 18, 1);
+        put32(idb + 20, 9);                            // 10^-9, padded
+        put32(idb + 24, 0);                            // opt_endofopt
+        put32(idb + 28, 32);
+        write_all(hdr, sizeof(hdr));
+    }
+
+    void drain () {
+        uint64_t t = tail.load(std::memory_order_relaxed);
+        uint64_t h = head.load(std::memory_order_acquire);
+        if (h == t) return;
+        write_all(ring + (t & (ring_size - 1)), (size_t)(h - t));
+        tail.store(h, std::memory_order_release);
+    }
+
+    void drain_loop () {
+        while (running.load(std::memory_order_relaxed)) {
+            uint64_t pending = head.load(std::memory_order_acquire) - tail.load(std::memory_order_relaxed);
+            drain();
+            if (pending == 0) {
+                std::this_thread::sleep_for(std::chrono::microseconds(200));
+            }
+        }
+    }
+};
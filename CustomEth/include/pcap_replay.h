@@ -0,0 +1,263 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "io.h"
+
+/*
+Reads a capture back (pcapng as written by PcapRecorder, or classic pcap as
+written by tcpdump) and re-sends it through RawEth.
+
+The file is mmap'd and frames are handed to send_on_wire straight out of the
+mapping, nothing is copied.  Pacing modes:
+  ORIGINAL - honour the captured inter-frame gaps
+  SCALED   - gaps divided by `speed` (2.0 = twice as fast)
+  MAX_RATE - back to back, no pacing
+Only outbound frames are replayed from a PcapRecorder capture by default since
+the inbound ones are the FPGA's responses.  The responses to the replay are
+read (without waiting) while it waits between frames and for drain_ms after the
+last one, so a recorder on the RawEth captures them too.  At MAX_RATE there is
+no wait, they are read every rx_every frames instead, often enough that the
+socket buffer does not overflow but not at the cost of a syscall per frame.
+*/
+
+struct CapturedFrame {
+    const uint8_t* data;
+    uint32_t len;
+    uint64_t ts_ns;
+    uint32_t flags;   // pcapng epb_flags, 0 if absent
+};
+
+class PcapReader {
+public:
+    explicit PcapReader (const std::string& path) {
+        fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error(std::string("open(pcap): ") + path);
+        }
+        struct stat st;
+        fstat(fd, &st);
+        size = (size_t)st.st_size;
+        if (size < 24) {
+            close(fd);
+            throw std::runtime_error("pcap file too small");
+        }
+        void* m = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (m == MAP_FAILED) {
+            close(fd);
+            throw std::runtime_error("mmap(pcap)");
+        }
+        base = static_cast<const uint8_t*>(m);
+        madvise(m, size, MADV_SEQUENTIAL);
+        parse();
+    }
+
+    ~PcapReader () {
+        munmap(const_cast<uint8_t*>(base), size);
+        close(fd);
+    }
+
+    PcapReader (const PcapReader&) = delete;
+    PcapReader& operator= (const PcapReader&) = delete;
+
+    std::vector<CapturedFrame> frames;
+
+private:
+    int fd = -1;
+    const uint8_t* base = nullptr;
+    size_t size = 0;
+
+    static uint32_t get32 (const uint8_t* p) { uint32_t v; memcpy(&v, p, 4); return v; }
+    static uint16_t get16 (const uint8_t* p) { uint16_t v; memcpy(&v, p, 2); return v; }
+
+    void parse () {
+        uint32_t magic = get32(base);
+        if (magic == 0x0A0D0D0A) {
+            parse_pcapng();
+        } else if (magic == 0xA1B2C3D4 || magic == 0xA1B23C4D) {
+            parse_pcap(magic == 0xA1B23C4D);
+        } else {
+            throw std::runtime_error("unsupported capture format (only little-endian pcap/pcapng)");
+        }
+    }
+
+    void parse_pcap (bool nanosecond) {
+        size_t off = 24;
+        while (off + 16 <= size) {
+            const uint8_t* rec = base + off;
+            uint64_t sec = get32(rec);
+            uint64_t frac = get32(rec + 4);
+            uint32_t incl = get32(rec + 8);
+            if (off + 16 + incl > size) break;
+            uint64_t ts = sec * 1000000000ull + (nanosecond ? frac : frac * 1000ull);
+            frames.push_back({rec + 16, incl, ts, 0});
+            off += 16 + incl;
+        }
+    }
+
+    void parse_pcapng () {
+        std::vector<uint64_t> tsresol_div;   // per interface, ticks -> ns
+        std::vector<uint64_t> tsresol_mul;
+        size_t off = 0;
+        while (off + 12 <= size) {
+            const uint8_t* blk = base + off;
+            uint32_t type = get32(blk);
+            uint32_t len = get32(blk + 4);
+            if (len < 12 || off + len > size) break;
+
+            if (type == 0x00000001) {
+                // Interface Description Block, look for if_tsresol (default 10^-6)
+                uint64_t mul = 1000, div = 1;
+                size_t o = 16;
+                while (o + 4 <= len - 4) {
+                    uint16_t code = get16(blk + o);
+                    uint16_t olen = get16(blk + o + 2);
+                    if (code == 0) break;
+                    if (code == 9 && olen >= 1) {
+                        uint8_t r = blk[o + 4];
+                        uint64_t ticks = 1;
+                        if (r & 0x80) {
+                            for (int i = 0; i < (r & 0x7F) && i < 63; i++) ticks <<= 1;
+                        } else {
+                            for (int i = 0; i < r && i < 19; i++) ticks *= 10;
+                        }
+                        mul = ticks >= 1000000000ull ? 1 : 1000000000ull / ticks;
+                        div = ticks >= 1000000000ull ? ticks / 1000000000ull : 1;
+                    }
+                    o += 4 + ((olen + 3) & ~3u);
+                }
+                tsresol_mul.push_back(mul);
+                tsresol_div.push_back(div);
+            } else if (type == 0x00000006 && len >= 32) {
+                // Enhanced Packet Block
+                uint32_t ifid = get32(blk + 8);
+                uint64_t ticks = ((uint64_t)get32(blk + 12) << 32) | get32(blk + 16);
+                uint32_t cap = get32(blk + 20);
+                uint32_t orig = get32(blk + 24);
+                // a corrupt captured length would point past the block, skip it
+                if (cap > orig || 28 + (uint64_t)cap > len - 4) {
+                    off += len;
+                    continue;
+                }
+                uint64_t mul = ifid < tsresol_mul.size() ? tsresol_mul[ifid] : 1000;
+                uint64_t div = ifid < tsresol_div.size() ? tsresol_div[ifid] : 1;
+                uint32_t flags = 0;
+                size_t o = 28 + ((cap + 3) & ~3u);
+                while (o + 4 <= len - 4) {
+                    uint16_t code = get16(blk + o);
+                    uint16_t olen = get16(blk + o + 2);
+                    if (code == 0) break;
+                    if (code == 2 && olen == 4) flags = get32(blk + o + 4);
+                    o += 4 + ((olen + 3) & ~3u);
+                }
+                frames.push_back({blk + 28, cap, ticks * mul / div, flags});
+            } else if (type == 0x00000003 && len >= 16) {
+                // Simple Packet Block, no timestamp
+                uint32_t orig = get32(blk + 8);
+                uint32_t cap = orig < len - 16 ? orig : len - 16;
+                uint64_t ts = frames.empty() ? 0 : frames.back().ts_ns;
+                frames.push_back({blk + 12, cap, ts, 0});
+            }
+            off += len;
+        }
+    }
+};
+
+struct ReplayStats {
+    uint64_t sent = 0;
+    uint64_t send_errors = 0;
+    uint64_t skipped = 0;
+    uint64_t received = 0;   // frames that came in during the replay and the drain after it
+    double elapsed_s = 0;
+};
+
+class PcapReplayer {
+public:
+    enum Mode { ORIGINAL, SCALED, MAX_RATE };
+
+    PcapReplayer (RawEth& sock, Mode m = ORIGINAL, double speed_factor = 1.0) :
+    sock_interface(sock), mode(m), speed(speed_factor) {}
+
+    bool outbound_only = true;
+    int loops = 1;
+    int drain_ms = 100;      // how long to keep reading responses after the last frame
+    int rx_every = 64;       // MAX_RATE: frames sent between reads of the responses
+
+    ReplayStats replay (const PcapReader& reader) {
+        ReplayStats stats;
+        auto start = std::chrono::steady_clock::now();
+        for (int l = 0; l < loops; l++) {
+            auto loop_start = std::chrono::steady_clock::now();
+            uint64_t first_ts = 0;
+            bool have_first = false;
+            int unread = 0;
+            for (const CapturedFrame& f : reader.frames) {
+                // epb_flags direction bits: 1 = inbound, 2 = outbound
+                if (outbound_only && (f.flags & 0x3) == 1) {
+                    stats.skipped++;
+                    continue;
+                }
+                if (!have_first) {
+                    first_ts = f.ts_ns;
+                    have_first = true;
+                }
+                if (mode != MAX_RATE) {
+                    // merged or multi-interface captures are not always in time order, a frame
+                    // stamped before the first goes out right away
+                    double gap = (double)(int64_t)(f.ts_ns - first_ts);
+                    if (gap < 0) gap = 0;
+                    if (mode == SCALED && speed > 0) gap /= speed;
+                    wait_until(loop_start + std::chrono::nanoseconds((uint64_t)gap), stats);
+                }
+                if (sock_interface.send_on_wire(f.data, (int)f.len)) {
+                    stats.sent++;
+                } else {
+                    stats.send_errors++;
+                }
+                // paced, wait_until reads before the next frame goes out
+                if (mode == MAX_RATE && ++unread >= rx_every) {
+                    receive(stats);
+                    unread = 0;
+                }
+            }
+        }
+        wait_until(std::chrono::steady_clock::now() + std::chrono::milliseconds(drain_ms), stats);
+        stats.elapsed_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return stats;
+    }
+
+private:
+    RawEth& sock_interface;
+    Mode mode;
+    double speed;
+
+    uint8_t rx_buf[2048];
+
+    // Read every frame already waiting, the recorder on the RawEth sees them as inbound.
+    void receive (ReplayStats& stats) {
+        while (sock_interface.recv_ready(rx_buf, sizeof(rx_buf)) >= 0) stats.received++;
+    }
+
+    // Read responses and sleep while the deadline is far away, spin for the last ~50us to hold the
+    // gap accurately.  The sleeps are short so responses are read while they come in.
+    void wait_until (std::chrono::steady_clock::time_point deadline, ReplayStats& stats) {
+        while (true) {
+            receive(stats);
+            auto now = std::chrono::steady_clock::now();
+            if (now >= deadline) return;
+            if (deadline - now > std::chrono::microseconds(100)) {
+                auto nap = deadline - now - std::chrono::microseconds(50);
+                std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(nap, std::chrono::milliseconds(1)));
+            }
+        }
+    }
+};
@@ -0,0 +1,870 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <new>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <sys/epoll.h>
+#include "fpga_interface.h"
+
+/*
+One thread serving many FPGAs.  FPGAInterface waits for its own responses in a loop, so every FPGA it
+talks to needs a thread; here nothing waits but the loop itself.
+
+  TimingWheel - hierarchical timing wheel, O(1) schedule/cancel, for the timeouts of every request
+                of every FPGA without a clock read per wait loop
+  Reactor     - the event loop: epoll on the sockets (RawEth::ready_fd), the wheel ticked from one
+                steady_clock read per turn, pollers for links without an fd
+  EthPort     - one socket per interface for all the FPGAs on it, its frames handed to each FpgaDevice
+                by their MACs
+  FpgaDevice  - one FPGA on a Reactor: its requests queue, go out as its credit window lets them
+                (FPGAInterface::credit_room) and complete from the loop as their responses come in
+  InplaceFn   - a callable stored in place, what an FpgaDevice request completes with
+*/
+
+// A callable held in place, like std::function but never on the heap: captures of up to CAP bytes are
+// stored inside, so setting, moving and running one allocates nothing.  A larger callable does not
+// compile.  Move only.
+template <class Sig, size_t CAP = 64>
+class InplaceFn;
+
+template <class R, class... Args, size_t CAP>
+class InplaceFn<R(Args...), CAP> {
+public:
+    InplaceFn () = default;
+    InplaceFn (std::nullptr_t) {}
+
+    template <class F, class D = typename std::decay<F>::type,
+              class = typename std::enable_if<!std::is_same<D, InplaceFn>::value &&
+                                              !std::is_same<D, std::nullptr_t>::value>::type>
+    InplaceFn (F&& f) {
+        static_assert(sizeof(D) <= CAP, "callable too large for InplaceFn, capture less");
+        static_assert(alignof(D) <= alignof(std::max_align_t), "callable over-aligned for InplaceFn");
+        new (buf) D(std::forward<F>(f));
+        invoke = [](void* p, Args... args) -> R { return (*static_cast<D*>(p))(std::forward<Args>(args)...); };
+        manage = [](void* to, void* from) {
+            if (to) new (to) D(std::move(*static_cast<D*>(from)));
+            static_cast<D*>(from)->~D();
+        };
+    }
+
+    InplaceFn (InplaceFn&& o) noexcept {
+        take(o);
+    }
+
+    InplaceFn& operator= (InplaceFn&& o) noexcept {
+        if (this != &o) {
+            reset();
+            take(o);
+        }
+        return *this;
+    }
+
+    InplaceFn& operator= (std::nullptr_t) {
+        reset();
+        return *this;
+    }
+
+    InplaceFn (const InplaceFn&) = delete;
+    InplaceFn& operator= (const InplaceFn&) = delete;
+
+    ~InplaceFn () {
+        reset();
+    }
+
+    explicit operator bool () const {
+        return invoke != nullptr;
+    }
+
+    R operator() (Args... args) {
+        return invoke(buf, std::forward<Args>(args)...);
+    }
+
+private:
+    alignas(std::max_align_t) unsigned char buf[CAP];
+    R (*invoke)(void*, Args...) = nullptr;
+    void (*manage)(void* to, void* from) = nullptr;      // move from into to, or only destroy from when to is null
+
+    void reset () {
+        if (manage) manage(nullptr, buf);
+        invoke = nullptr;
+        manage = nullptr;
+    }
+
+    void take (InplaceFn& o) {
+        if (!o.manage) return;
+        o.manage(buf, o.buf);
+        invoke = o.invoke;
+        manage = o.manage;
+        o.invoke = nullptr;
+        o.manage = nullptr;
+    }
+};
+
+// A timer on a TimingWheel, embedded in what it times.  fire runs from TimingWheel::advance; it may
+// schedule timers and release the one it runs from.
+struct WheelTimer {
+    std::function<void()> fire;
+    uint64_t expires = 0;                 // tick
+    WheelTimer* prev = nullptr;
+    WheelTimer* next = nullptr;
+
+    bool armed () const {
+        return next != nullptr;
+    }
+};
+
+// LEVELS wheels of SLOTS slots.  Level l slot s holds the timers of the 64^l tick block s ahead: a tick
+// fires its level 0 slot, and at a 64^l tick boundary the level l slot of the block starting moves a
+// level down, the top level first.  64^4 ticks reach, a timer beyond waits in the top level and is
+// placed again until it is in reach.
+class TimingWheel {
+public:
+    static constexpr int LEVEL_BITS = 6;
+    static constexpr int SLOTS = 1 << LEVEL_BITS;
+    static constexpr int LEVELS = 4;
+    static constexpr uint64_t REACH = uint64_t(1) << (LEVEL_BITS * LEVELS);
+
+    explicit TimingWheel (uint64_t start_tick = 0) : tick(start_tick) {
+        for (auto& level : slots)
+            for (auto& head : level) head.prev = head.next = &head;
+    }
+    TimingWheel (const TimingWheel&) = delete;
+    TimingWheel& operator= (const TimingWheel&) = delete;
+
+    uint64_t now () const {
+        return tick;
+    }
+
+    size_t pending () const {
+        return count;
+    }
+
+    // t fires delay ticks from now, 1 at least; an armed t moves
+    void schedule (WheelTimer& t, uint64_t delay) {
+        cancel(t);
+        t.expires = tick + std::max<uint64_t>(delay, 1);
+        place(t);
+        count++;
+    }
+
+    void cancel (WheelTimer& t) {
+        if (!t.armed()) return;
+        unlink(t);
+        count--;
+    }
+
+    // Move to tick to and fire the timers due on the way, in order of their ticks.  Returns how many fired.
+    size_t advance (uint64_t to) {
+        size_t fired = 0;
+        while (tick < to) {
+            if (count == 0) {
+                tick = to;
+                break;
+            }
+            tick++;
+            cascade();
+            WheelTimer& head = slots[0][tick & (SLOTS - 1)];
+            while (head.next != &head) {
+                WheelTimer* t = head.next;
+                unlink(*t);
+                count--;
+                fired++;
+                std::function<void()> fire = t->fire;   // t may be gone once it runs
+                fire();
+            }
+        }
+        return fired;
+    }
+
+    // Ticks to the next one that can fire a timer, 1 to max: the next level 0 slot with one, or the
+    // next cascade when level 0 is empty for a whole turn, max when nothing is pending.
+    uint64_t ticks_to_next (uint64_t max) const {
+        if (count == 0) return max;
+        for (uint64_t d = 1; d <= SLOTS && d <= max; d++) {
+            const WheelTimer& head = slots[0][(tick + d) & (SLOTS - 1)];
+            if (head.next != &head) return d;
+        }
+        return std::max<uint64_t>(1, std::min<uint64_t>(max, SLOTS - (tick & (SLOTS - 1))));
+    }
+
+private:
+    WheelTimer slots[LEVELS][SLOTS];      // list heads
+    uint64_t tick;
+    size_t count = 0;
+
+    void place (WheelTimer& t) {
+        uint64_t delta = t.expires > tick ? t.expires - tick : 0;
+        uint64_t at = delta < REACH ? t.expires : tick + REACH - 1;
+        int l = 0;
+        while (l + 1 < LEVELS && at - tick >= (uint64_t(1) << (LEVEL_BITS * (l + 1)))) l++;
+        WheelTimer& head = slots[l][(at >> (LEVEL_BITS * l)) & (SLOTS - 1)];
+        t.prev = head.prev;
+        t.next = &head;
+        head.prev->next = &t;
+        head.prev = &t;
+    }
+
+    static void unlink (WheelTimer& t) {
+        t.prev->next = t.next;
+        t.next->prev = t.prev;
+        t.prev = t.next = nullptr;
+    }
+
+    void cascade () {
+        int top = 0;
+        while (top + 1 < LEVELS && (tick & ((uint64_t(1) << (LEVEL_BITS * (top + 1))) - 1)) == 0) top++;
+        for (int l = top; l >= 1; l--) {
+            WheelTimer& head = slots[l][(tick >> (LEVEL_BITS * l)) & (SLOTS - 1)];
+            WheelTimer* t = head.next;
+            head.prev = head.next = &head;
+            while (t != &head) {
+                WheelTimer* next = t->next;
+                place(*t);
+                t = next;
+            }
+        }
+    }
+};
+
+class EthPort;
+
+// epoll loop with a TimingWheel.  Everything runs on the thread that calls run/run_once.
+class Reactor {
+public:
+    struct Stats {
+        uint64_t turns = 0;
+        uint64_t idle = 0;                // turns with no fd readable
+        uint64_t ready = 0;               // handlers run for a readable fd
+        uint64_t timers = 0;              // timers fired
+
+        void print (std::ostream& out) const {
+            StatsLine{out}("turns", turns)("idle", idle)("ready", ready)("timers", timers);
+        }
+    };
+
+    explicit Reactor (std::chrono::microseconds tick = std::chrono::microseconds(100)) :
+    tick_us(std::max<int64_t>(1, tick.count())), start(std::chrono::steady_clock::now()) {
+        epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (epfd < 0) throw std::runtime_error(std::string("epoll_create1: ") + strerror(errno));
+    }
+
+    // the ports go first, they unwatch their sockets
+    ~Reactor ();
+
+    Reactor (const Reactor&) = delete;
+    Reactor& operator= (const Reactor&) = delete;
+
+    // on_ready runs every turn fd polls readable (level triggered), until unwatch
+    void watch (int fd, std::function<void()> on_ready) {
+        std::unique_ptr<Watch> w(new Watch{fd, std::move(on_ready)});
+        epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.ptr = w.get();
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            throw std::runtime_error(std::string("epoll_ctl(ADD): ") + strerror(errno));
+        }
+        watches[fd] = std::move(w);
+    }
+
+    // from a handler too, its own fd included
+    void unwatch (int fd) {
+        auto it = watches.find(fd);
+        if (it == watches.end()) return;
+        epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+        it->second->fd = -1;
+        retired.push_back(std::move(it->second));
+        watches.erase(it);
+    }
+
+    // poll runs every turn, for a link with no fd to wait on (FrameLink::ready_fd -1); the loop does
+    // not sleep while there is one.  Returns the id for remove_poller.
+    int add_poller (std::function<void()> poll) {
+        pollers.emplace_back(++poller_id, std::move(poll));
+        return poller_id;
+    }
+
+    void remove_poller (int id) {
+        for (auto& p : pollers)
+            if (p.first == id) p.second = nullptr;
+    }
+
+    // t fires delay from now, rounded up to whole ticks
+    void schedule (WheelTimer& t, std::chrono::microseconds delay) {
+        wheel.schedule(t, static_cast<uint64_t>((std::max<int64_t>(0, delay.count()) + tick_us - 1) / tick_us));
+    }
+
+    void cancel (WheelTimer& t) {
+        wheel.cancel(t);
+    }
+
+    // One turn: wait for a readable fd up to the next timer or max_wait, run their handlers and the
+    // pollers, read the clock and fire the timers due.  max_wait 0 does not wait.
+    void run_once (std::chrono::milliseconds max_wait = std::chrono::milliseconds(100)) {
+        int timeout_ms = 0;
+        bool polling = false;
+        for (auto& p : pollers) polling |= p.second != nullptr;
+        if (!polling && max_wait.count() > 0) {
+            uint64_t max_ticks = std::max<uint64_t>(1, max_wait.count() * 1000 / tick_us);
+            uint64_t ticks = wheel.ticks_to_next(max_ticks);
+            timeout_ms = static_cast<int>((ticks * tick_us + 999) / 1000);
+        }
+        epoll_event events[64];
+        int n = epoll_wait(epfd, events, 64, timeout_ms);
+        stats.turns++;
+        if (n <= 0) stats.idle++;
+        for (int i = 0; i < n; i++) {
+            Watch* w = static_cast<Watch*>(events[i].data.ptr);
+            if (w->fd < 0) continue;              // unwatched by a handler before it this turn
+            stats.ready++;
+            w->on_ready();
+        }
+        for (size_t i = 0; i < pollers.size(); i++)
+            if (pollers[i].second) pollers[i].second();
+        pollers.erase(std::remove_if(pollers.begin(), pollers.end(),
+                                     [](const std::pair<int, std::function<void()>>& p) { return !p.second; }),
+                      pollers.end());
+        retired.clear();
+        stats.timers += wheel.advance(now_tick());
+    }
+
+    // run_once until stop
+    void run () {
+        stopped = false;
+        while (!stopped) run_once();
+    }
+
+    void stop () {
+        stopped = true;
+    }
+
+    uint64_t now_tick () const {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count()) / tick_us;
+    }
+
+    int64_t tick_micros () const {
+        return tick_us;
+    }
+
+    // The EthPort of interface iface, its socket opened on the first call: FPGAInterfaces made on it
+    // (FPGAInterface(port, s_mac, d_mac)) share it instead of a socket each.  Lives as long as the Reactor.
+    EthPort& port (const std::string& iface);
+
+    Stats stats;
+
+private:
+    struct Watch {
+        int fd;
+        std::function<void()> on_ready;
+    };
+
+    int epfd;
+    int64_t tick_us;
+    std::chrono::steady_clock::time_point start;
+    TimingWheel wheel;
+    std::unordered_map<int, std::unique_ptr<Watch>> watches;
+    std::vector<std::unique_ptr<Watch>> retired;     // unwatched this turn, freed at its end
+    std::vector<std::pair<int, std::function<void()>>> pollers;
+    int poller_id = 0;
+    bool stopped = false;
+    std::unordered_map<std::string, std::unique_ptr<EthPort>> ports;
+};
+
+// The frames of every FPGA on one interface through one ETH_P_ALL socket.  With a socket per
+// FPGAInterface each of them sees, copies out and skips every other FPGA's frames; here the Reactor
+// watches the one socket and each frame goes to the FpgaDevice it came back for.  The FPGA answers
+// with the Ethernet header of the request, so that is the frame's first 12 bytes, the FPGA's MAC then
+// ours (route_of).  Frames for no device attached are counted and dropped.
+//
+// FPGAInterfaces on the port are made on it as their FrameLink: FPGAInterface(port, s_mac, d_mac).
+// Their frames go out through the shared socket; an FpgaDevice made on one attaches itself.  The
+// frames come in only through the handlers, so such an FPGAInterface's own blocking calls get nothing.
+class EthPort : public FrameLink {
+public:
+    struct Stats {
+        uint64_t frames = 0;              // frames in
+        uint64_t unclaimed = 0;           // for no device attached
+
+        void print (std::ostream& out) const {
+            StatsLine{out}("frames", frames)("unclaimed", unclaimed);
+        }
+    };
+
+    using Route = std::array<uint8_t,12>;
+    using Handler = std::function<void(const uint8_t*, int)>;
+
+    // ETH_P_ALL socket on iface
+    EthPort (Reactor& r, const std::string& iface) : reactor(r), sock(iface) {
+        start();
+    }
+
+    // every frame of link, e.g. a LoopbackLink modelling several FPGAs
+    EthPort (Reactor& r, FrameLink& link) : reactor(r), sock(link) {
+        start();
+    }
+
+    ~EthPort () override {
+        if (ready_fd >= 0) reactor.unwatch(ready_fd);
+        else reactor.remove_poller(poller);
+    }
+
+    EthPort (const EthPort&) = delete;
+    EthPort& operator= (const EthPort&) = delete;
+
+    // the first 12 bytes of f's responses, as f sent them: its FPGA's MAC, then ours
+    static Route route_of (const FPGAInterface& f) {
+        Route r;
+        std::array<uint8_t,6> mac;
+        ether::parse_mac(f.dst_mac, mac);
+        memcpy(r.data(), mac.data(), 6);
+        ether::parse_mac(f.src_mac, mac);
+        memcpy(r.data() + 6, mac.data(), 6);
+        return r;
+    }
+
+    // frames of route go to on_frame from now on, one handler per route
+    void attach (const Route& route, Handler on_frame) {
+        for (auto& e : routes) {
+            if (e->live && e->route == route) throw std::runtime_error("EthPort: route attached twice");
+        }
+        routes.emplace_back(new Entry{route, std::move(on_frame), true});
+    }
+
+    // from a handler too, its own route included
+    void detach (const Route& route) {
+        for (auto& e : routes) {
+            if (e->route == route) e->live = false;
+        }
+        if (!dispatching) prune();
+    }
+
+    bool send_frame (const uint8_t* p, int n) override {
+        return sock.send_on_wire(p, n);
+    }
+
+    // the frames go to the handlers as they come, there are none to take
+    int recv_frame (uint8_t*, uint16_t, int) override {
+        return -1;
+    }
+
+    RawEth sock;                          // its recorder sees the frames of every FPGA on the port
+    Stats stats;
+
+private:
+    // held by pointer: a handler may attach and detach while it runs, its entry stays where it is
+    struct Entry {
+        Route route;
+        Handler on_frame;
+        bool live;                        // false once detached, freed after the frames of the turn
+    };
+
+    Reactor& reactor;
+    std::vector<std::unique_ptr<Entry>> routes;   // a few FPGAs per interface, a scan is the fastest lookup
+    int ready_fd = -1;
+    int poller = 0;
+    bool dispatching = false;
+    uint8_t rx[2048];
+
+    void start () {
+        int fd = sock.ready_fd();
+        if (fd >= 0) {
+            ready_fd = fd;
+            reactor.watch(fd, [this] { on_ready(); });
+        } else {
+            poller = reactor.add_poller([this] { on_ready(); });
+        }
+    }
+
+    // up to 64 frames a turn, like FpgaDevice on a socket of its own
+    void on_ready () {
+        dispatching = true;
+        for (int i = 0; i < 64; i++) {
+            int n = sock.recv_ready(rx, sizeof(rx));
+            if (n < 0) break;
+            stats.frames++;
+            Entry* to = nullptr;
+            if (n >= 12) {
+                for (auto& e : routes) {
+                    if (e->live && memcmp(e->route.data(), rx, 12) == 0) {
+                        to = e.get();
+                        break;
+                    }
+                }
+            }
+            if (!to) {
+                stats.unclaimed++;
+                continue;
+            }
+            to->on_frame(rx, n);
+        }
+        dispatching = false;
+        prune();
+    }
+
+    void prune () {
+        routes.erase(std::remove_if(routes.begin(), routes.end(),
+                                    [](const std::unique_ptr<Entry>& e) { return !e->live; }),
+                     routes.end());
+    }
+};
+
+inline Reactor::~Reactor () {
+    ports.clear();
+    close(epfd);
+}
+
+inline EthPort& Reactor::port (const std::string& iface) {
+    std::unique_ptr<EthPort>& p = ports[iface];
+    if (!p) p.reset(new EthPort(*this, iface));
+    return *p;
+}
+
+// One FPGA on a Reactor.  Requests queue here and go out as the credit window of the FPGA's port 0 FIFO
+// lets them, each with a timeout on the reactor's wheel.  Its frames are taken as the socket polls
+// readable and matched to the requests in flight oldest first: port 0 answers in order, so an answer
+// to a later request means the ones before it were dropped, they complete as LOST.  done runs on the
+// loop thread.  The FPGAInterface's own blocking calls would take the device's responses, they must
+// not be used while it has requests in flight.
+//
+// Nothing here allocates once the request pool and the queues have grown to the traffic: the requests
+// are pooled, done is an InplaceFn kept in its request as the caller gave it, and the queues are rings.
+class FpgaDevice {
+public:
+    enum class Status : uint8_t {
+        OK,
+        TIMEOUT,        // no answer in timeout_ms
+        LOST,           // a later request was answered first
+        SEND_FAILED
+    };
+
+    struct Stats {
+        uint64_t requests = 0;
+        uint64_t completed = 0;           // OK
+        uint64_t timeouts = 0;
+        uint64_t lost = 0;
+        uint64_t send_failed = 0;
+        uint64_t frames_other = 0;        // frames for no request in flight, without an EthPort another FPGA's too
+        uint64_t max_queued = 0;          // requests waiting for credits, at most
+
+        void print (std::ostream& out) const {
+            StatsLine{out}("requests", requests)("completed", completed)("timeouts", timeouts)("lost", lost)
+                ("send_failed", send_failed)("frames_other", frames_other)("max_queued", max_queued);
+        }
+    };
+
+    using Done = InplaceFn<void(Status)>;
+    using AtomicDone = InplaceFn<void(Status, uint64_t)>;
+    using CountersDone = InplaceFn<void(Status, const UalinkCounters&)>;
+
+    static const char* status_name (Status s) {
+        static const char* const names[] = {"ok", "timeout", "lost", "send_failed"};
+        return names[static_cast<int>(s)];
+    }
+
+    // Takes the FPGA's frames from now on: from the EthPort f was made on, or from f's own socket or
+    // link.  With flow control on and its window not known yet the first request out is a COUNTERS
+    // read that asks for it.
+    FpgaDevice (Reactor& r, FPGAInterface& f, int timeout_ms = 200) : reactor(r), fpga(f), timeout(timeout_ms) {
+        e_header = fpga.eth_header();
+        port = dynamic_cast<EthPort*>(fpga.sock_interface.link);
+        int fd = fpga.sock_interface.ready_fd();
+        if (port) {
+            route = EthPort::route_of(fpga);
+            port->attach(route, [this](const uint8_t* buf, int n) {
+                on_frame(buf, n);
+                pump();
+            });
+        } else if (fd >= 0) {
+            ready_fd = fd;
+            reactor.watch(fd, [this] { on_ready(); });
+        } else {
+            poller = reactor.add_poller([this] { on_ready(); });
+        }
+        if (fpga.flow_control && !fpga.credits_known()) {
+            syncing = true;
+            counters([this](Status, const UalinkCounters&) { syncing = false; });
+        }
+    }
+
+    // the requests still queued or in flight are dropped without their done
+    ~FpgaDevice () {
+        if (port) port->detach(route);
+        else if (ready_fd >= 0) reactor.unwatch(ready_fd);
+        else reactor.remove_poller(poller);
+        for (size_t i = 0; i < in_flight.size(); i++) reactor.cancel(in_flight[i]->timer);
+    }
+
+    FpgaDevice (const FpgaDevice&) = delete;
+    FpgaDevice& operator= (const FpgaDevice&) = delete;
+
+    // Sized READ of num_bytes (1-255) at byte address user_addr into data, which has to stay valid
+    // until done runs.
+    void read_bytes (uint64_t user_addr, uint8_t* data, uint8_t num_bytes, Done done) {
+        sized(1, user_addr, nullptr, data, num_bytes, std::move(done));
+    }
+
+    // Sized WRITE, data is copied into the request
+    void write_bytes (uint64_t user_addr, const uint8_t* data, uint8_t num_bytes, Done done) {
+        sized(2, user_addr, data, nullptr, num_bytes, std::move(done));
+    }
+
+    // remote_atomic, done gets the old value
+    void atomic (AtomicOp op, uint8_t word_addr, uint64_t operand, uint64_t compare, AtomicDone done) {
+        Request* r = get_request();
+        FPGAInterface::atomic_request_frame(e_header, op, word_addr, operand, compare, r->frame);
+        r->len = 60;
+        r->kind = ATOMIC;
+        r->atomic_done = std::move(done);
+        submit(r);
+    }
+
+    void counters (CountersDone done) {
+        Request* r = get_request();
+        FPGAInterface::counters_request_frame(e_header, ++counters_id, r->frame);
+        r->len = FPGAInterface::COUNTERS_FRAME_LEN;
+        r->kind = COUNTERS;
+        r->counters_done = std::move(done);
+        submit(r);
+    }
+
+    // requests queued or in flight
+    size_t outstanding () const {
+        return queued.size() + in_flight.size();
+    }
+
+    Stats stats;
+
+private:
+    enum Kind : uint8_t { SIZED, ATOMIC, COUNTERS };
+
+    // the done of its kind is set, the others stay empty
+    struct Request {
+        uint8_t frame[32 + 8 * 33];
+        int len = 0;
+        Kind kind = SIZED;
+        std::array<uint8_t,4> key;        // SIZED: what post_sized matches on
+        uint8_t* data_out = nullptr;      // SIZED READ: data_len bytes from data_off of the data words
+        uint8_t data_off = 0;
+        uint8_t data_len = 0;
+        Done done;
+        AtomicDone atomic_done;
+        CountersDone counters_done;
+        WheelTimer timer;
+    };
+
+    // Requests in order: a ring that doubles when it is full, so a steady flow allocates nothing
+    // (a deque allocates and frees a block every so many).
+    class RequestRing {
+    public:
+        size_t size () const {
+            return count;
+        }
+
+        bool empty () const {
+            return count == 0;
+        }
+
+        std::unique_ptr<Request>& operator[] (size_t i) {
+            return cells[(head + i) & (cells.size() - 1)];
+        }
+
+        std::unique_ptr<Request>& front () {
+            return cells[head];
+        }
+
+        std::unique_ptr<Request>& back () {
+            return (*this)[count - 1];
+        }
+
+        void push_back (std::unique_ptr<Request> r) {
+            if (count == cells.size()) grow();
+            (*this)[count++] = std::move(r);
+        }
+
+        // the front moved out before
+        void pop_front () {
+            cells[head].reset();
+            head = (head + 1) & (cells.size() - 1);
+            count--;
+        }
+
+    private:
+        std::vector<std::unique_ptr<Request>> cells = std::vector<std::unique_ptr<Request>>(64);
+        size_t head = 0;
+        size_t count = 0;
+
+        void grow () {
+            std::vector<std::unique_ptr<Request>> bigger(2 * cells.size());
+            for (size_t i = 0; i < count; i++) bigger[i] = std::move((*this)[i]);
+            cells.swap(bigger);
+            head = 0;
+        }
+    };
+
+    Reactor& reactor;
+    FPGAInterface& fpga;
+    int timeout;
+    ether e_header;
+    EthPort* port = nullptr;
+    EthPort::Route route;
+    int ready_fd = -1;
+    int poller = 0;
+    bool syncing = false;                 // the COUNTERS read that asks for the window is in flight
+    bool pumping = false;
+    uint8_t next_tag = 0;
+    uint16_t counters_id = 0;
+    RequestRing queued, in_flight;
+    std::vector<std::unique_ptr<Request>> spare;
+    uint8_t rx[2048];
+
+    Request* get_request () {
+        std::unique_ptr<Request> r;
+        if (spare.empty()) {
+            r.reset(new Request);
+        } else {
+            r = std::move(spare.back());
+            spare.pop_back();
+        }
+        queued.push_back(std::move(r));
+        return queued.back().get();
+    }
+
+    void sized (uint8_t op, uint64_t user_addr, const uint8_t* payload, uint8_t* data_out, uint8_t num_bytes,
+                Done done) {
+        Request* r = get_request();
+        r->len = FPGAInterface::sized_request_frame(e_header, op, user_addr, payload, num_bytes, next_tag++, r->frame);
+        r->kind = SIZED;
+        r->key = FPGAInterface::sized_key(r->frame);
+        r->data_out = data_out;
+        r->data_off = static_cast<uint8_t>(user_addr & 0x7);
+        r->data_len = num_bytes;
+        r->done = std::move(done);
+        submit(r);
+    }
+
+    void submit (Request*) {
+        stats.requests++;
+        pump();
+        stats.max_queued = std::max<uint64_t>(stats.max_queued, queued.size());
+    }
+
+    // send what the window has room for, in order
+    void pump () {
+        if (pumping) return;
+        pumping = true;
+        while (!queued.empty() && !(syncing && !in_flight.empty()) && fpga.credit_room(queued.front()->len)) {
+            std::unique_ptr<Request> r = std::move(queued.front());
+            queued.pop_front();
+            if (!fpga.sock_interface.send_on_wire(r->frame, r->len)) {
+                stats.send_failed++;
+                finish(std::move(r), Status::SEND_FAILED, nullptr);
+                continue;
+            }
+            fpga.credits_sent(r->len);
+            Request* p = r.get();
+            p->timer.fire = [this, p] { expire(p); };
+            reactor.schedule(p->timer, std::chrono::milliseconds(timeout));
+            in_flight.push_back(std::move(r));
+        }
+        pumping = false;
+    }
+
+    bool answers (const Request& r, const uint8_t* buf) const {
+        switch (r.kind) {
+            case SIZED:  return FPGAInterface::sized_response_of(r.key, buf);
+            case ATOMIC: return FPGAInterface::atomic_response_of(r.frame, buf);
+            default:     return FPGAInterface::counters_response_of(r.frame, buf);
+        }
+    }
+
+    // the socket is readable: up to 64 frames a turn, so one busy FPGA does not hold up the rest
+    void on_ready () {
+        for (int i = 0; i < 64; i++) {
+            int n = fpga.sock_interface.recv_ready(rx, sizeof(rx));
+            if (n < 0) break;
+            on_frame(rx, n);
+        }
+        pump();
+    }
+
+    void on_frame (const uint8_t* buf, int n) {
+        if (!fpga.is_response(buf, n)) {
+            stats.frames_other++;
+            return;
+        }
+        size_t k = 0;
+        while (k < in_flight.size() && !answers(*in_flight[k], buf)) k++;
+        if (k == in_flight.size()) {
+            stats.frames_other++;
+            return;
+        }
+        fpga.lose_credits(k);
+        fpga.take_credits(buf, n);
+        for (size_t j = 0; j < k; j++) {
+            stats.lost++;
+            complete_front(Status::LOST, nullptr);
+        }
+        stats.completed++;
+        complete_front(Status::OK, buf);
+    }
+
+    // r timed out, and so did the ones sent before it
+    void expire (Request* r) {
+        while (!in_flight.empty()) {
+            bool last = in_flight.front().get() == r;
+            fpga.lose_credits(1);
+            stats.timeouts++;
+            complete_front(Status::TIMEOUT, nullptr);
+            if (last) break;
+        }
+        pump();
+    }
+
+    void complete_front (Status s, const uint8_t* buf) {
+        std::unique_ptr<Request> r = std::move(in_flight.front());
+        in_flight.pop_front();
+        reactor.cancel(r->timer);
+        finish(std::move(r), s, buf);
+    }
+
+    // r goes back to the pool before its done runs, which may queue requests on it again
+    void finish (std::unique_ptr<Request> r, Status s, const uint8_t* buf) {
+        switch (r->kind) {
+            case SIZED: {
+                Done done = std::move(r->done);
+                if (s == Status::OK && r->data_out) memcpy(r->data_out, buf + 32 + r->data_off, r->data_len);
+                spare.push_back(std::move(r));
+                done(s);
+                break;
+            }
+            case ATOMIC: {
+                AtomicDone done = std::move(r->atomic_done);
+                spare.push_back(std::move(r));
+                done(s, s == Status::OK ? FPGAInterface::atomic_old_value(buf) : 0);
+                break;
+            }
+            default: {
+                CountersDone done = std::move(r->counters_done);
+                spare.push_back(std::move(r));
+                UalinkCounters c;
+                if (s == Status::OK) FPGAInterface::parse_counters(buf, c);
+                done(s, c);
+                break;
+            }
+        }
+    }
+};
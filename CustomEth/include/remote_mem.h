@@ -1,7 +1,10 @@
+#pragma once
+#include <deque>
 #include "fpga_interface.h"
 class RemoteMem {
 public:
     RemoteMem (const std::string& dev, const std::string& s_mac, const std::string& d_mac): remote_interface(dev, s_mac, d_mac) {};
+    RemoteMem (FrameLink& link, const std::string& s_mac, const std::string& d_mac): remote_interface(link, s_mac, d_mac) {};
     uint64_t alloc (size_t size) {
         return 1;
     }
@@ -11,8 +14,196 @@ public:
     void read (std::vector<std::array<uint8_t,226>>& payload_vec) {
         remote_interface.send_batch_wait_ack(payload_vec, base_addr, 2, tag);
     }
+    // Atomics on the 64-bit word at byte address addr (8 byte aligned) of the FPGA memory, one
+    // round trip each.  fetch_add and swap return the value the word had before.
+    uint64_t fetch_add (uint64_t addr, uint64_t delta) {
+        return atomic(AtomicOp::FETCH_ADD, addr, delta, 0);
+    }
+    uint64_t swap (uint64_t addr, uint64_t value) {
+        return atomic(AtomicOp::SWAP, addr, value, 0);
+    }
+    // like std::atomic compare_exchange: stores desired if the word is expected, otherwise expected
+    // gets the value the word has
+    bool cas (uint64_t addr, uint64_t& expected, uint64_t desired) {
+        uint64_t old = atomic(AtomicOp::CAS, addr, desired, expected);
+        if (old == expected) return true;
+        expected = old;
+        return false;
+    }
+    // Any number of bytes at any byte address, in sized UALink requests of up to 255 bytes: only the
+    // bytes asked for are written, the rest of their 64-bit words is left alone.
+    void write_bytes (uint64_t addr, const uint8_t* data, size_t n) {
+        check_range(addr, n);
+        for (size_t done = 0; done < n; ) {
+            uint8_t chunk = static_cast<uint8_t>(std::min<size_t>(n - done, 255));
+            if (!remote_interface.remote_write_bytes(addr + done, data + done, chunk, tag)) {
+                throw std::runtime_error("remote write: no response");
+            }
+            done += chunk;
+        }
+    }
+    void read_bytes (uint64_t addr, uint8_t* data, size_t n) {
+        check_range(addr, n);
+        for (size_t done = 0; done < n; ) {
+            uint8_t chunk = static_cast<uint8_t>(std::min<size_t>(n - done, 255));
+            if (!remote_interface.remote_read_bytes(addr + done, data + done, chunk, tag)) {
+                throw std::runtime_error("remote read: no response");
+            }
+            done += chunk;
+        }
+    }
+    // C = A x B for row major int8 A (M x K) and B (K x N) into int32 C (M x N), on the FPGA's FMA engine
+    // in 8x8 tiles, zero padded at the edges.  The top gemm_words words of the FPGA memory are scratch:
+    // two A/B buffers, so the tiles of the next job go up while the engine runs one, and two C buffers,
+    // so a finished C tile comes back while the next one is computed.  The requests are in flight back to
+    // back, each job with its own tag, and their responses taken in order.  C accumulates on the FPGA
+    // over up to gemm_max_ktiles tiles of K (24-bit accumulators), the partial sums of a longer K are
+    // added here.  With validate the result is checked against gemm_int8_reference, a mismatch throws.
+    void gemm_int8 (const int8_t* A, const int8_t* B, int32_t* C, size_t M, size_t N, size_t K, bool validate = true) {
+        if (M == 0 || N == 0 || K == 0) return;
+        const size_t mt = (M + 7) / 8, nt = (N + 7) / 8, kt = (K + 7) / 8;
+        std::fill(C, C + M * N, 0);
+
+        // a unit is a C tile over one run of K tiles, its jobs accumulate onto the same C buffer
+        struct Unit { size_t ti, tj, k0, k1; };
+        std::vector<Unit> units;
+        for (size_t ti = 0; ti < mt; ti++)
+            for (size_t tj = 0; tj < nt; tj++)
+                for (size_t k0 = 0; k0 < kt; k0 += gemm_max_ktiles)
+                    units.push_back({ti, tj, k0, std::min(kt, k0 + gemm_max_ktiles)});
+
+        const uint64_t ab_word = mem_words - gemm_words;   // 2 x 16 words of A and B
+        const uint64_t c_word  = ab_word + 32;             // 2 x 32 words of C
+        struct Pending {
+            enum Kind { WRITE, GEMM, READ } kind;
+            std::array<uint8_t,4> key;   // sized requests
+            uint64_t addr;
+            uint8_t bytes;
+            uint16_t gemm_tag;
+            size_t unit;
+            bool last;                   // GEMM: last job of its unit, READ: second half of C
+        };
+        std::deque<Pending> pending;
+        std::vector<uint8_t> c_tile(256);
+        size_t jobs_done = 0, units_read = 0;
+        uint8_t stag = 0;
+
+        auto post_read = [&](size_t u) {
+            for (int half = 0; half < 2; half++) {
+                Pending p{Pending::READ, {}, (c_word + 32 * (u % 2)) * 8 + 128 * half, 128, 0, u, half == 1};
+                if (!remote_interface.post_sized(1, p.addr, nullptr, p.bytes, stag++, p.key)) {
+                    throw std::runtime_error("gemm: send failed");
+                }
+                pending.push_back(p);
+            }
+        };
+        // take the next response, they come in the order the requests went out
+        auto take = [&]() {
+            if (pending.empty()) throw std::logic_error("gemm: nothing in flight");
+            Pending p = pending.front();
+            pending.pop_front();
+            if (p.kind == Pending::GEMM) {
+                int r = remote_interface.wait_gemm(p.gemm_tag, remote_interface.gemm_timeout_ms);
+                if (r < 0) throw std::runtime_error("gemm: no completion");
+                if (r == 0) throw std::runtime_error("gemm: FPGA job queue full");
+                jobs_done++;
+                if (p.last) post_read(p.unit);
+                return;
+            }
+            uint8_t* out = p.kind == Pending::READ ? c_tile.data() + 128 * p.last : nullptr;
+            if (!remote_interface.wait_sized(p.key, p.addr, p.bytes, out,
+                                             p.kind == Pending::READ ? remote_interface.read_timeout_ms
+                                                                     : remote_interface.ack_timeout_ms)) {
+                throw std::runtime_error("gemm: no response");
+            }
+            if (p.kind == Pending::READ && p.last) {
+                const Unit& u = units[p.unit];
+                for (size_t r = 0; r < 8 && u.ti * 8 + r < M; r++) {
+                    for (size_t c = 0; c < 8 && u.tj * 8 + c < N; c++) {
+                        int32_t v;
+                        memcpy(&v, c_tile.data() + 4 * (8 * r + c), 4);   // little endian like the host
+                        C[(u.ti * 8 + r) * N + u.tj * 8 + c] += v;
+                    }
+                }
+                units_read++;
+            }
+        };
+
+        size_t job = 0;
+        uint8_t ab[128];
+        for (size_t u = 0; u < units.size(); u++) {
+            // its C buffer is free once the unit before the last one is read back
+            while (units_read + 1 < u) take();
+            for (size_t k = units[u].k0; k < units[u].k1; k++, job++) {
+                // and its A/B buffer once the job before the last one is done
+                while (jobs_done + 1 < job) take();
+                for (size_t r = 0; r < 8; r++) {
+                    for (size_t c = 0; c < 8; c++) {
+                        size_t ar = units[u].ti * 8 + r, ac = k * 8 + c;
+                        size_t br = k * 8 + r, bc = units[u].tj * 8 + c;
+                        ab[8 * r + c]      = (ar < M && ac < K) ? static_cast<uint8_t>(A[ar * K + ac]) : 0;
+                        ab[64 + 8 * r + c] = (br < K && bc < N) ? static_cast<uint8_t>(B[br * N + bc]) : 0;
+                    }
+                }
+                uint64_t a_word = ab_word + 16 * (job % 2);
+                Pending w{Pending::WRITE, {}, a_word * 8, 128, 0, u, false};
+                if (!remote_interface.post_sized(2, w.addr, ab, w.bytes, stag++, w.key)) {
+                    throw std::runtime_error("gemm: send failed");
+                }
+                pending.push_back(w);
+                Pending g{Pending::GEMM, {}, 0, 0, static_cast<uint16_t>(job), u, k + 1 == units[u].k1};
+                if (!remote_interface.post_gemm(static_cast<uint8_t>(a_word), static_cast<uint8_t>(a_word + 8),
+                                                static_cast<uint8_t>(c_word + 32 * (u % 2)), k != units[u].k0, g.gemm_tag)) {
+                    throw std::runtime_error("gemm: send failed");
+                }
+                pending.push_back(g);
+            }
+        }
+        while (!pending.empty()) take();
+
+        if (validate) {
+            std::vector<int32_t> ref(M * N);
+            gemm_int8_reference(A, B, ref.data(), M, N, K);
+            for (size_t i = 0; i < M * N; i++) {
+                if (ref[i] != C[i]) {
+                    throw std::runtime_error("gemm: C[" + std::to_string(i / N) + "][" + std::to_string(i % N) + "] is " +
+                                             std::to_string(C[i]) + ", the CPU reference " + std::to_string(ref[i]));
+                }
+            }
+        }
+    }
+    // the same on the CPU
+    static void gemm_int8_reference (const int8_t* A, const int8_t* B, int32_t* C, size_t M, size_t N, size_t K) {
+        for (size_t i = 0; i < M; i++) {
+            for (size_t j = 0; j < N; j++) {
+                int32_t sum = 0;
+                for (size_t k = 0; k < K; k++) sum += static_cast<int32_t>(A[i * K + k]) * B[k * N + j];
+                C[i * N + j] = sum;
+            }
+        }
+    }
     void free ();
     FPGAInterface remote_interface;
     uint64_t base_addr;
     uint8_t tag;
+    static constexpr uint64_t mem_words = 256;   // DPMEM words of ualink_turbo64
+    static constexpr uint64_t gemm_words = 96;   // scratch of gemm_int8 at the top of it
+    static constexpr size_t gemm_max_ktiles = 63;   // 63 * 8 products of at most 2^14 fit the 24-bit accumulator
+
+private:
+    void check_range (uint64_t addr, size_t n) {
+        if (n == 0 || addr >= mem_words * 8 || n > mem_words * 8 - addr) {
+            throw std::runtime_error("remote read/write: bytes outside the FPGA memory");
+        }
+    }
+    uint64_t atomic (AtomicOp op, uint64_t addr, uint64_t operand, uint64_t compare) {
+        if ((addr & 0x7) != 0 || addr / 8 >= mem_words) {
+            throw std::runtime_error("remote atomic: address must be an aligned 64-bit word in the FPGA memory");
+        }
+        uint64_t old;
+        if (!remote_interface.remote_atomic(op, static_cast<uint8_t>(addr / 8), operand, compare, old)) {
+            throw std::runtime_error("remote atomic: no response");
+        }
+        return old;
+    }
 };
\ No newline at end of file
@@ -0,0 +1,393 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <sys/eventfd.h>
+#include "reactor.h"
+
+/*
+One FPGAInterface shared by many application threads without a lock around it.
+
+  MpscRing   - bounded multi-producer/single-consumer ring (Vyukov's: a sequence number per cell,
+               producers claim cells with one CAS on the tail), no locks, no syscalls
+  SpscRing   - bounded single-producer/single-consumer ring, head and tail on their own cache lines
+  SharedLink - a transport thread that owns the FPGAInterface: it drains the request descriptors of
+               every thread from one MpscRing in batches into an FpgaDevice (reactor.h), which frames
+               them and sends them as the credit window lets it, and hands each completion back
+               through the SpscRing of the thread that asked
+
+A thread gets a SharedLink::Producer once and submits through it; a full ring is a false from the
+submit, nothing blocks.  The transport thread busy-polls the ring, and the link while requests are in
+flight; only after SPIN polls found the ring empty does it sleep in epoll_wait, and it says so: a
+producer that finds it asleep wakes it with an eventfd write, the only syscall on the submit side,
+and none while it is busy.
+*/
+
+template <class T>
+class MpscRing {
+public:
+    // capacity is rounded up to a power of 2
+    explicit MpscRing (size_t capacity) {
+        size_t n = 2;
+        while (n < capacity) n <<= 1;
+        mask = n - 1;
+        cells.reset(new Cell[n]);
+        for (size_t i = 0; i < n; i++) cells[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    // any thread; false when the ring is full
+    bool push (const T& v) {
+        uint64_t pos = tail.load(std::memory_order_relaxed);
+        while (true) {
+            Cell& c = cells[pos & mask];
+            uint64_t seq = c.seq.load(std::memory_order_acquire);
+            int64_t dif = static_cast<int64_t>(seq - pos);
+            if (dif == 0) {
+                if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    c.value = v;
+                    c.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (dif < 0) {
+                return false;
+            } else {
+                pos = tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // the consumer thread only: up to max values in the order they were claimed, stops at a cell
+    // claimed but not written yet
+    size_t pop (T* out, size_t max) {
+        size_t n = 0;
+        while (n < max) {
+            Cell& c = cells[head & mask];
+            if (c.seq.load(std::memory_order_acquire) != head + 1) break;
+            out[n++] = c.value;
+            c.seq.store(head + mask + 1, std::memory_order_release);
+            head++;
+        }
+        return n;
+    }
+
+    // the consumer thread only
+    bool empty () const {
+        return cells[head & mask].seq.load(std::memory_order_acquire) != head + 1;
+    }
+
+private:
+    struct alignas(64) Cell {
+        std::atomic<uint64_t> seq;
+        T value;
+    };
+
+    std::unique_ptr<Cell[]> cells;
+    size_t mask;
+    alignas(64) std::atomic<uint64_t> tail{0};
+    alignas(64) uint64_t head = 0;
+};
+
+template <class T>
+class SpscRing {
+public:
+    // capacity is rounded up to a power of 2
+    explicit SpscRing (size_t capacity) {
+        size_t n = 2;
+        while (n < capacity) n <<= 1;
+        mask = n - 1;
+        buf.reset(new T[n]);
+    }
+
+    // the producer thread only; false when the ring is full
+    bool push (const T& v) {
+        uint64_t t = tail.load(std::memory_order_relaxed);
+        if (t - head_cache > mask) {
+            head_cache = head.load(std::memory_order_acquire);
+            if (t - head_cache > mask) return false;
+        }
+        buf[t & mask] = v;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // the consumer thread only
+    size_t pop (T* out, size_t max) {
+        uint64_t h = head.load(std::memory_order_relaxed);
+        if (tail_cache == h) tail_cache = tail.load(std::memory_order_acquire);
+        size_t n = 0;
+        while (n < max && h != tail_cache) out[n++] = buf[h++ & mask];
+        head.store(h, std::memory_order_release);
+        return n;
+    }
+
+    size_t capacity () const {
+        return mask + 1;
+    }
+
+private:
+    std::unique_ptr<T[]> buf;
+    size_t mask;
+    alignas(64) std::atomic<uint64_t> head{0};
+    uint64_t tail_cache = 0;                  // the consumer's copy of tail
+    alignas(64) std::atomic<uint64_t> tail{0};
+    uint64_t head_cache = 0;                  // the producer's copy of head
+};
+
+class SharedLink {
+public:
+    struct Completion {
+        uint64_t user_data = 0;
+        FpgaDevice::Status status = FpgaDevice::Status::OK;
+        uint64_t value = 0;                   // an atomic's old value
+    };
+
+    class Producer;
+
+    // What a producer asks for.  The data of a WRITE and the buffer of a READ stay with the producer
+    // until the request completes.
+    struct Request {
+        enum Kind : uint8_t { READ, WRITE, ATOMIC };
+        Kind kind = READ;
+        AtomicOp op = AtomicOp::FETCH_ADD;
+        uint8_t num_bytes = 0;
+        uint64_t addr = 0;                    // byte address, the word address of an atomic
+        uint64_t operand = 0, compare = 0;
+        const uint8_t* wdata = nullptr;
+        uint8_t* rdata = nullptr;
+        uint64_t user_data = 0;
+        Producer* from = nullptr;
+    };
+
+    // One application thread's end: submit requests, poll its completions.  At most depth requests
+    // of one producer are outstanding, so its completion ring never fills.
+    class Producer {
+    public:
+        bool read (uint64_t addr, uint8_t* data, uint8_t num_bytes, uint64_t user_data) {
+            Request r;
+            r.kind = Request::READ;
+            r.addr = addr;
+            r.rdata = data;
+            r.num_bytes = num_bytes;
+            r.user_data = user_data;
+            return submit(r);
+        }
+
+        bool write (uint64_t addr, const uint8_t* data, uint8_t num_bytes, uint64_t user_data) {
+            Request r;
+            r.kind = Request::WRITE;
+            r.addr = addr;
+            r.wdata = data;
+            r.num_bytes = num_bytes;
+            r.user_data = user_data;
+            return submit(r);
+        }
+
+        bool atomic (AtomicOp op, uint8_t word_addr, uint64_t operand, uint64_t compare, uint64_t user_data) {
+            Request r;
+            r.kind = Request::ATOMIC;
+            r.op = op;
+            r.addr = word_addr;
+            r.operand = operand;
+            r.compare = compare;
+            r.user_data = user_data;
+            return submit(r);
+        }
+
+        // completions so far, up to max
+        size_t poll (Completion* out, size_t max) {
+            size_t n = done.pop(out, max);
+            outstanding -= n;
+            return n;
+        }
+
+        size_t in_flight () const {
+            return outstanding;
+        }
+
+        uint64_t ring_full = 0;               // submits refused, the shared ring was full
+
+    private:
+        friend class SharedLink;
+        SharedLink& link;
+        SpscRing<Completion> done;
+        size_t outstanding = 0;
+
+        Producer (SharedLink& l, size_t depth) : link(l), done(depth) {}
+
+        bool submit (Request& r) {
+            if (outstanding >= done.capacity()) return false;
+            r.from = this;
+            if (!link.requests.push(r)) {
+                ring_full++;
+                return false;
+            }
+            outstanding++;
+            link.wake();
+            return true;
+        }
+    };
+
+    struct Stats {
+        uint64_t requests = 0;
+        uint64_t batches = 0;
+        uint64_t max_batch = 0;
+        uint64_t sleeps = 0;                  // the transport thread found the ring empty and slept
+        uint64_t wakeups = 0;                 // eventfd writes by the producers
+
+        void print (std::ostream& out) const {
+            StatsLine{out}("requests", requests)("batches", batches)("max_batch", max_batch)("sleeps", sleeps)
+                ("wakeups", wakeups);
+        }
+    };
+
+    static constexpr size_t BATCH = 64;
+    // polls of an empty ring, a yield each, before the transport thread sleeps: a producer that
+    // submits by then finds it awake and pays no eventfd write
+    static constexpr int SPIN = 64;
+
+    // Starts the transport thread, which owns fpga from now on: it must not be used directly while
+    // the SharedLink is there.  ring is the shared request ring's capacity.
+    explicit SharedLink (FPGAInterface& f, size_t ring = 4096, int timeout_ms = 200) :
+    fpga(f), requests(ring), timeout(timeout_ms) {
+        wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (wake_fd < 0) throw std::runtime_error(std::string("eventfd: ") + strerror(errno));
+        transport = std::thread(&SharedLink::run, this);
+    }
+
+    // the requests still outstanding are dropped
+    ~SharedLink () {
+        stopping.store(true);
+        uint64_t one = 1;
+        ssize_t r = write(wake_fd, &one, sizeof(one));
+        (void)r;
+        transport.join();
+        close(wake_fd);
+    }
+
+    SharedLink (const SharedLink&) = delete;
+    SharedLink& operator= (const SharedLink&) = delete;
+
+    // a Producer for the calling thread, depth requests outstanding at most; it lives as long as the
+    // SharedLink
+    Producer& producer (size_t depth = 256) {
+        std::lock_guard<std::mutex> lock(producers_mu);
+        producers.emplace_back(new Producer(*this, depth));
+        return *producers.back();
+    }
+
+    // the transport thread's counts, read after the traffic is done
+    Stats stats () const {
+        Stats s;
+        s.requests = n_requests.load(std::memory_order_relaxed);
+        s.batches = n_batches.load(std::memory_order_relaxed);
+        s.max_batch = n_max_batch.load(std::memory_order_relaxed);
+        s.sleeps = n_sleeps.load(std::memory_order_relaxed);
+        s.wakeups = n_wakeups.load(std::memory_order_relaxed);
+        return s;
+    }
+
+    // the FpgaDevice's, as of the last time the transport thread went to sleep
+    FpgaDevice::Stats device_stats () {
+        std::lock_guard<std::mutex> lock(stats_mu);
+        return dev_stats;
+    }
+
+private:
+    FPGAInterface& fpga;
+    MpscRing<Request> requests;
+    int timeout;
+    int wake_fd = -1;
+    std::thread transport;
+    std::atomic<bool> stopping{false};
+    alignas(64) std::atomic<bool> sleeping{false};
+    std::mutex producers_mu;                  // producer() only, not the submits
+    std::vector<std::unique_ptr<Producer>> producers;
+    std::atomic<uint64_t> n_requests{0}, n_batches{0}, n_max_batch{0}, n_sleeps{0}, n_wakeups{0};
+    std::mutex stats_mu;
+    FpgaDevice::Stats dev_stats;
+
+    // a producer pushed: wake the transport thread if it said it sleeps
+    void wake () {
+        std::atomic_thread_fence(std::memory_order_seq_cst);     // the push before the look, see run
+        if (sleeping.load(std::memory_order_relaxed) && sleeping.exchange(false)) {
+            n_wakeups.fetch_add(1, std::memory_order_relaxed);
+            uint64_t one = 1;
+            ssize_t r = write(wake_fd, &one, sizeof(one));
+            (void)r;
+        }
+    }
+
+    static void complete (Producer* p, uint64_t user_data, FpgaDevice::Status s, uint64_t value) {
+        Completion c;
+        c.user_data = user_data;
+        c.status = s;
+        c.value = value;
+        p->done.push(c);                      // room for it, see Producer::submit
+    }
+
+    void run () {
+        Reactor reactor;
+        FpgaDevice dev(reactor, fpga, timeout);
+        reactor.watch(wake_fd, [this] {
+            uint64_t v;
+            ssize_t r = read(wake_fd, &v, sizeof(v));
+            (void)r;
+        });
+        Request batch[BATCH];
+        int idle = 0;                                 // polls of the ring that found it empty, in a row
+        while (!stopping.load(std::memory_order_relaxed)) {
+            size_t n = requests.pop(batch, BATCH);
+            for (size_t i = 0; i < n; i++) {
+                Request& r = batch[i];
+                Producer* p = r.from;
+                uint64_t ud = r.user_data;
+                switch (r.kind) {
+                    case Request::READ:
+                        dev.read_bytes(r.addr, r.rdata, r.num_bytes,
+                                       [p, ud](FpgaDevice::Status s) { complete(p, ud, s, 0); });
+                        break;
+                    case Request::WRITE:
+                        dev.write_bytes(r.addr, r.wdata, r.num_bytes,
+                                        [p, ud](FpgaDevice::Status s) { complete(p, ud, s, 0); });
+                        break;
+                    case Request::ATOMIC:
+                        dev.atomic(r.op, static_cast<uint8_t>(r.addr), r.operand, r.compare,
+                                   [p, ud](FpgaDevice::Status s, uint64_t old) { complete(p, ud, s, old); });
+                        break;
+                }
+            }
+            if (n > 0) {
+                n_requests.fetch_add(n, std::memory_order_relaxed);
+                n_batches.fetch_add(1, std::memory_order_relaxed);
+                if (n > n_max_batch.load(std::memory_order_relaxed)) n_max_batch.store(n, std::memory_order_relaxed);
+                idle = 0;
+                if (n == BATCH) continue;             // more waiting, take them before the frames
+            }
+            if (dev.outstanding() > 0) reactor.run_once(std::chrono::milliseconds(0));
+            if (n > 0) continue;
+            if (++idle < SPIN) {
+                std::this_thread::yield();            // a producer on this core gets to push
+                continue;
+            }
+            idle = 0;
+            // nothing new: say so, look once more, then wait for a frame, a timer or a wakeup
+            sleeping.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (!requests.empty()) {
+                sleeping.store(false, std::memory_order_relaxed);
+                continue;
+            }
+            n_sleeps.fetch_add(1, std::memory_order_relaxed);
+            reactor.run_once();
+            sleeping.store(false, std::memory_order_relaxed);
+            std::lock_guard<std::mutex> lock(stats_mu);
+            dev_stats = dev.stats;
+        }
+        std::lock_guard<std::mutex> lock(stats_mu);
+        dev_stats = dev.stats;
+    }
+};
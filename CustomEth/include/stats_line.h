@@ -0,0 +1,63 @@
+#pragma once
+#include <cstddef>
+#include <ostream>
+
+/*
+The form every Stats::print here writes: one line of key=value pairs, space separated, so a run's
+output greps and splits the same way whatever printed it.
+
+    StatsLine{out}("turns", turns)("idle", idle);               turns=12 idle=3
+    StatsLine{out, "gemm"}("m", M);                              gemm m=64
+    StatsLine{out}.list("queue_hwm", hwm, 5);                    queue_hwm=4,0,0,0,0
+
+The newline goes out when the StatsLine does, at the end of the statement.
+Braces, not parentheses: StatsLine(out)(...); on a line of its own declares a StatsLine named out.
+*/
+class StatsLine {
+public:
+    // tag, if any, starts the line, bare
+    explicit StatsLine (std::ostream& o, const char* tag = nullptr) : out(o) {
+        if (tag) {
+            out << tag;
+            first = false;
+        }
+    }
+
+    ~StatsLine () {
+        out << '\n';
+    }
+
+    StatsLine (const StatsLine&) = delete;
+    StatsLine& operator= (const StatsLine&) = delete;
+
+    template <class T>
+    StatsLine& operator() (const char* key, const T& v) {
+        sep() << key << '=' << v;
+        return *this;
+    }
+
+    // prefix_key=v, for a set of keys repeated per path, port, ...
+    template <class T>
+    StatsLine& operator() (const char* prefix, const char* key, const T& v) {
+        sep() << prefix << '_' << key << '=' << v;
+        return *this;
+    }
+
+    // key=v[0],v[1],...
+    template <class T>
+    StatsLine& list (const char* key, const T* v, size_t n) {
+        sep() << key << '=';
+        for (size_t i = 0; i < n; i++) out << (i ? "," : "") << v[i];
+        return *this;
+    }
+
+private:
+    std::ostream& out;
+    bool first = true;
+
+    std::ostream& sep () {
+        if (!first) out << ' ';
+        first = false;
+        return out;
+    }
+};
@@ -0,0 +1,467 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "stats_line.h"
+
+/*
+Trace-driven simulation of a tiered memory for far-memory capacity planning: an address trace through
+the caches, near DRAM and a far tier behind the UALink link of RemoteMem (remote_mem.h), with the far
+tier's latency, the link's bandwidth and the queueing on the link when it is busy.  Where
+docs/LatencyStack.py takes the hit probabilities of every tier as given, here they come out of the
+workload's own accesses.
+
+  TraceRecord      - an access of the binary trace, 16 bytes, the file is mmap'd read only
+  CacheTier        - set associative LRU of lines (L1/L2/L3) or of pages (near DRAM), with dirty bits
+  LinkCalendar     - one direction of the far link: time in buckets, a transfer takes the link's free
+                     time from its arrival on, so it waits behind the transfers before it
+  LatencyHistogram - log-linear latency histogram, mean and percentiles
+  TierSim          - two passes over the trace: the tier every access hits, sharded by page over
+                     threads, then the timing of every access in trace order
+
+A thread takes the pages that hash to its shard and runs every tier with 1/threads of its sets, so
+one thread is exact and more threads sample the sets of every tier, the way set sampling does.  The
+timing pass gives every core its own clock: an access waits for the compute time before it (gap_ns)
+and stalls its core for its latency, one miss outstanding per core.  Cores share the far link, the
+trace is taken to be in time order.
+*/
+
+struct TraceRecord {
+    uint64_t addr;
+    uint32_t gap_ns;      // compute time of the core since its access before
+    uint16_t core;
+    uint8_t  write;       // 1 store, 0 load
+    uint8_t  pad;
+};
+static_assert(sizeof(TraceRecord) == 16, "TraceRecord is 16 bytes on disk");
+
+// Set associative, LRU, line_bytes blocks.  access says whether the block was there and whether
+// filling it evicted a dirty block.
+class CacheTier {
+public:
+    struct Result {
+        bool hit;
+        bool evicted_dirty;
+    };
+
+    CacheTier (uint64_t size_bytes, int ways, int line_bytes) : ways(ways), line_shift(0) {
+        if (ways < 1 || line_bytes < 1 || (line_bytes & (line_bytes - 1)) != 0)
+            throw std::runtime_error("CacheTier: ways >= 1, line_bytes a power of 2");
+        while ((1 << line_shift) < line_bytes) line_shift++;
+        sets = std::max<uint64_t>(1, size_bytes / line_bytes / ways);
+        lines.assign(sets * ways, Way());
+    }
+
+    Result access (uint64_t addr, bool write) {
+        uint64_t block = addr >> line_shift;
+        Way* set = &lines[(block % sets) * ways];
+        Way* victim = set;
+        clock++;
+        for (Way* w = set; w < set + ways; w++) {
+            if ((w->tag & ~DIRTY) == block) {
+                w->stamp = clock;
+                if (write) w->tag |= DIRTY;
+                return {true, false};
+            }
+            if (w->stamp < victim->stamp) victim = w;
+        }
+        bool evicted_dirty = victim->tag != EMPTY && (victim->tag & DIRTY);
+        victim->tag = write ? block | DIRTY : block;
+        victim->stamp = clock;
+        return {false, evicted_dirty};
+    }
+
+    // a store that hit a tier above: the block is dirty here too if it is here, LRU order unchanged
+    void mark_dirty (uint64_t addr) {
+        uint64_t block = addr >> line_shift;
+        Way* set = &lines[(block % sets) * ways];
+        for (Way* w = set; w < set + ways; w++)
+            if ((w->tag & ~DIRTY) == block) w->tag |= DIRTY;
+    }
+
+    uint64_t set_count () const {
+        return sets;
+    }
+
+private:
+    static constexpr uint64_t DIRTY = uint64_t(1) << 63;
+    static constexpr uint64_t EMPTY = ~DIRTY;           // no block number gets near it
+
+    // the ways of a set next to each other, the tag and its LRU stamp together
+    struct Way {
+        uint64_t tag = EMPTY;
+        uint64_t stamp = 0;
+    };
+
+    int ways, line_shift;
+    uint64_t sets;
+    uint64_t clock = 0;
+    std::vector<Way> lines;
+};
+
+// One direction of a link of gbps, its time in bucket_ns buckets over a window of BUCKETS of them.
+// A transfer arriving at t takes the free time of the buckets from t on until it is through and
+// returns when it is: it queues behind what is already there, and an access of a core whose clock
+// is behind the others' still finds the link time that was free then.  Arrivals from before the
+// window are taken at its start.
+class LinkCalendar {
+public:
+    static constexpr size_t BUCKETS = size_t(1) << 18;
+
+    LinkCalendar (double gbps, double bucket_ns = 500.0) : ns_per_byte(8.0 / gbps), bucket(bucket_ns),
+    used(BUCKETS, 0.0), next(BUCKETS) {
+        for (size_t k = 0; k < BUCKETS; k++) next[k] = k;
+    }
+
+    double reserve (double t, uint64_t bytes) {
+        double need = bytes * ns_per_byte;
+        busy += need;
+        uint64_t b = static_cast<uint64_t>(t / bucket);
+        if (b < base) b = base;
+        double end = t;
+        while (need > 0) {
+            b = first_free(b);
+            slide(b);
+            double& u = used[b % BUCKETS];
+            double start = std::max(b * bucket + u, t);
+            double free = (b + 1) * bucket - start;
+            if (free > 0) {
+                double take = std::min(free, need);
+                u = start + take - b * bucket;
+                need -= take;
+                end = start + take;
+            }
+            if (u >= bucket) next[b % BUCKETS] = b + 1;
+            b++;
+        }
+        return end;
+    }
+
+    // link time transfers took in all, ns
+    double busy_ns () const {
+        return busy;
+    }
+
+private:
+    double ns_per_byte, bucket;
+    std::vector<double> used;     // how far into each bucket its time is taken, ns
+    std::vector<uint64_t> next;   // a full bucket: a later bucket, all full up to it; others themselves
+    uint64_t base = 0;            // oldest bucket of the window
+    double busy = 0;
+
+    // the first bucket from b on that is not full, the queue a busy link has in front of t skipped
+    // over with the path halved on the way
+    uint64_t first_free (uint64_t b) {
+        while (b < base + BUCKETS && next[b % BUCKETS] != b) {
+            uint64_t n = next[b % BUCKETS];
+            if (n < base + BUCKETS && next[n % BUCKETS] != n) next[b % BUCKETS] = next[n % BUCKETS];
+            b = n;
+        }
+        return b;
+    }
+
+    // bucket b into the window, the buckets that fall out of it are cleared for reuse
+    void slide (uint64_t b) {
+        if (b < base + BUCKETS) return;
+        uint64_t first = b - BUCKETS + 1;
+        for (uint64_t k = base; k < first && k < base + BUCKETS; k++) {
+            used[k % BUCKETS] = 0.0;
+            next[k % BUCKETS] = k + BUCKETS;
+        }
+        if (first > base + BUCKETS) {
+            for (uint64_t k = first; k < first + BUCKETS; k++) {
+                used[k % BUCKETS] = 0.0;
+                next[k % BUCKETS] = k;
+            }
+        }
+        base = first;
+    }
+};
+
+// Latencies in ns: exact below 64, 64 buckets per power of 2 above
+class LatencyHistogram {
+public:
+    LatencyHistogram () : counts(64 * 40, 0) {}
+
+    void add (double ns) {
+        uint64_t v = static_cast<uint64_t>(ns + 0.5);
+        counts[index(v)]++;
+        n++;
+        sum += ns;
+        top = std::max(top, ns);
+    }
+
+    void merge (const LatencyHistogram& o) {
+        for (size_t i = 0; i < counts.size(); i++) counts[i] += o.counts[i];
+        n += o.n;
+        sum += o.sum;
+        top = std::max(top, o.top);
+    }
+
+    uint64_t count () const {
+        return n;
+    }
+
+    double mean () const {
+        return n ? sum / n : 0.0;
+    }
+
+    double max () const {
+        return top;
+    }
+
+    // the latency p of the accesses are at or below, p in [0, 1]
+    double percentile (double p) const {
+        if (n == 0) return 0.0;
+        uint64_t rank = static_cast<uint64_t>(std::ceil(p * n));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts.size(); i++) {
+            seen += counts[i];
+            if (seen >= std::max<uint64_t>(rank, 1)) return std::min(upper(i), top);
+        }
+        return top;
+    }
+
+private:
+    std::vector<uint64_t> counts;
+    uint64_t n = 0;
+    double sum = 0, top = 0;
+
+    static size_t index (uint64_t v) {
+        if (v < 64) return v;
+        int e = 63 - __builtin_clzll(v);
+        size_t i = 64 * (e - 5) + ((v >> (e - 6)) & 63);
+        return std::min<size_t>(i, 64 * 40 - 1);
+    }
+
+    static double upper (size_t i) {
+        if (i < 64) return static_cast<double>(i);
+        int e = static_cast<int>(i / 64) + 5;
+        uint64_t sub = i % 64;
+        return static_cast<double>((64 + sub + 1) << (e - 6)) - 1;
+    }
+};
+
+struct TierConfig {
+    struct Cache {
+        std::string name;
+        uint64_t size_bytes;
+        int ways;
+        int line_bytes;
+        double ns;
+    };
+
+    // the latencies of docs/LatencyStack.py, a 10G link like the NetFPGA's
+    std::vector<Cache> caches = {
+        {"L1", 32 << 10, 8, 64, 1.0},
+        {"L2", 1 << 20, 16, 64, 4.0},
+        {"L3", 32 << 20, 16, 64, 12.0},
+    };
+    uint64_t near_bytes = uint64_t(1) << 30;
+    int near_ways = 16;
+    int page_bytes = 4096;          // the block near DRAM holds and the far tier moves
+    double near_ns = 80.0;
+    double far_ns = 500.0;          // request out to data back on an idle link, the transfers aside
+    double far_gbps = 10.0;         // each direction
+    // a page moves in sized UALink requests of far_chunk bytes (RemoteMem::read_bytes), each one a
+    // far_request_bytes request on the wire and far_chunk + far_response_bytes back, or the other way
+    // round for a writeback; wire bytes include the preamble, IFG and FCS
+    int far_chunk = 255;
+    int far_request_bytes = 60 + 4 + 20;
+    int far_response_bytes = 32 + 4 + 20;
+    int threads = 1;
+};
+
+class TierSim {
+public:
+    struct TierStats {
+        std::string name;
+        uint64_t hits = 0;
+        double ns = 0;
+    };
+
+    struct Report {
+        uint64_t accesses = 0;
+        std::vector<TierStats> tiers;     // the caches, near, far
+        uint64_t writebacks = 0;          // dirty pages near DRAM wrote back to the far tier
+        LatencyHistogram all, far;
+        double far_wait_ns = 0;           // far accesses' time beyond an idle link's, in all
+        double elapsed_ns = 0;            // the last core's clock
+        double to_far_busy_ns = 0, from_far_busy_ns = 0;
+        double pass1_s = 0, pass2_s = 0;
+
+        // one key=value line per tier, then the latencies and the link
+        void print (std::ostream& out) const {
+            uint64_t reaching = accesses;
+            for (const TierStats& t : tiers) {
+                StatsLine{out}("tier", t.name)("ns", t.ns)("hits", t.hits)
+                    ("hit_rate", accesses ? double(t.hits) / accesses : 0.0)
+                    ("local_hit_rate", reaching ? double(t.hits) / reaching : 0.0);
+                reaching -= t.hits;
+            }
+            StatsLine{out}("accesses", accesses)("avg_ns", all.mean())("p50_ns", all.percentile(0.5))
+                ("p99_ns", all.percentile(0.99))("p999_ns", all.percentile(0.999))("max_ns", all.max());
+            StatsLine{out}("far_accesses", far.count())("far_avg_ns", far.mean())("far_p99_ns", far.percentile(0.99))
+                ("far_p999_ns", far.percentile(0.999))("far_avg_wait_ns", far.count() ? far_wait_ns / far.count() : 0.0)
+                ("writebacks", writebacks)("from_far_util", elapsed_ns > 0 ? from_far_busy_ns / elapsed_ns : 0.0)
+                ("to_far_util", elapsed_ns > 0 ? to_far_busy_ns / elapsed_ns : 0.0)("elapsed_ms", elapsed_ns / 1e6);
+            StatsLine{out}("pass1_s", pass1_s)("pass2_s", pass2_s)
+                ("accesses_per_s", pass1_s + pass2_s > 0 ? accesses / (pass1_s + pass2_s) : 0.0);
+        }
+    };
+
+    explicit TierSim (const TierConfig& c) : cfg(c) {
+        if (cfg.threads < 1) cfg.threads = 1;
+    }
+
+    // the trace file, mmap'd
+    Report run (const std::string& path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw std::runtime_error("TierSim: cannot open " + path);
+        struct stat sb;
+        fstat(fd, &sb);
+        if (sb.st_size == 0 || sb.st_size % sizeof(TraceRecord) != 0) {
+            close(fd);
+            throw std::runtime_error("TierSim: " + path + " is not a trace of 16 byte records");
+        }
+        void* p = mmap(nullptr, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED) throw std::runtime_error("TierSim: mmap " + path);
+        madvise(p, sb.st_size, MADV_SEQUENTIAL);
+        Report r;
+        try {
+            r = run(static_cast<const TraceRecord*>(p), sb.st_size / sizeof(TraceRecord));
+        } catch (...) {
+            munmap(p, sb.st_size);
+            throw;
+        }
+        munmap(p, sb.st_size);
+        return r;
+    }
+
+    Report run (const TraceRecord* trace, size_t n) {
+        Report r;
+        r.accesses = n;
+        int levels = static_cast<int>(cfg.caches.size());
+        for (const auto& c : cfg.caches) r.tiers.push_back({c.name, 0, c.ns});
+        r.tiers.push_back({"near", 0, cfg.near_ns});
+        r.tiers.push_back({"far", 0, cfg.far_ns});
+
+        // pass 1: the tier of every access, a byte each, WRITEBACK set when its page fill evicted a dirty page
+        uint8_t* tier = static_cast<uint8_t*>(mmap(nullptr, n, PROT_READ | PROT_WRITE,
+                                                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0));
+        if (tier == MAP_FAILED) throw std::runtime_error("TierSim: no memory for the tiers of the trace");
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::vector<uint64_t>> hits(cfg.threads, std::vector<uint64_t>(levels + 2, 0));
+        std::vector<std::thread> shards;
+        for (int s = 0; s < cfg.threads; s++)
+            shards.emplace_back([&, s] { hit_pass(trace, n, tier, s, hits[s]); });
+        for (auto& t : shards) t.join();
+        for (auto& h : hits)
+            for (int l = 0; l < levels + 2; l++) r.tiers[l].hits += h[l];
+        auto mid = std::chrono::steady_clock::now();
+        r.pass1_s = std::chrono::duration<double>(mid - start).count();
+
+        timing_pass(trace, n, tier, levels, r);
+        r.pass2_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - mid).count();
+        munmap(tier, n);
+        return r;
+    }
+
+private:
+    static constexpr uint8_t WRITEBACK = 0x80;
+    TierConfig cfg;
+
+    static uint64_t mix (uint64_t x) {
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdULL;
+        x ^= x >> 33;
+        x *= 0xc4ceb9fe1a85ec53ULL;
+        return x ^ (x >> 33);
+    }
+
+    // the accesses to the pages of shard s through its slice of every tier
+    void hit_pass (const TraceRecord* trace, size_t n, uint8_t* tier, int s, std::vector<uint64_t>& hits) {
+        int levels = static_cast<int>(cfg.caches.size());
+        uint64_t div = static_cast<uint64_t>(cfg.threads);
+        std::vector<CacheTier> caches;
+        for (const auto& c : cfg.caches) caches.emplace_back(c.size_bytes / div, c.ways, c.line_bytes);
+        CacheTier near(cfg.near_bytes / div, cfg.near_ways, cfg.page_bytes);
+        int page_shift = 0;
+        while ((1 << page_shift) < cfg.page_bytes) page_shift++;
+
+        for (size_t i = 0; i < n; i++) {
+            const TraceRecord& a = trace[i];
+            if (div > 1 && mix(a.addr >> page_shift) % div != static_cast<uint64_t>(s)) continue;
+            bool write = a.write != 0;
+            int l = 0;
+            while (l < levels && !caches[l].access(a.addr, write).hit) l++;
+            uint8_t t = static_cast<uint8_t>(l);
+            if (l == levels) {
+                CacheTier::Result nr = near.access(a.addr, write);
+                if (!nr.hit) {
+                    t = static_cast<uint8_t>(levels + 1);
+                    if (nr.evicted_dirty) t |= WRITEBACK;
+                }
+            } else if (write) {
+                near.mark_dirty(a.addr);
+            }
+            hits[t & ~WRITEBACK]++;
+            tier[i] = t;
+        }
+    }
+
+    // every access in trace order on its core's clock, the far ones through the link
+    void timing_pass (const TraceRecord* trace, size_t n, const uint8_t* tier, int levels, Report& r) {
+        std::vector<double> ns;
+        for (const auto& c : cfg.caches) ns.push_back(c.ns);
+        ns.push_back(cfg.near_ns);
+        uint64_t chunks = (cfg.page_bytes + cfg.far_chunk - 1) / cfg.far_chunk;
+        uint64_t req_bytes = chunks * cfg.far_request_bytes;
+        uint64_t data_bytes = cfg.page_bytes + chunks * cfg.far_response_bytes;
+        double idle_far = cfg.far_ns + (req_bytes + data_bytes) * 8.0 / cfg.far_gbps;
+
+        LinkCalendar to_far(cfg.far_gbps), from_far(cfg.far_gbps);
+        std::vector<double> clock(65536, 0.0);
+        double last = 0;
+        for (size_t i = 0; i < n; i++) {
+            const TraceRecord& a = trace[i];
+            double& t = clock[a.core];
+            t += a.gap_ns;
+            uint8_t l = tier[i] & ~WRITEBACK;
+            double lat;
+            if (l <= levels) {
+                lat = ns[l];
+            } else {
+                // the requests go out, the data comes back far_ns later; a writeback goes out behind them
+                double sent = to_far.reserve(t, req_bytes);
+                double done = from_far.reserve(sent + cfg.far_ns, data_bytes);
+                lat = done - t;
+                r.far.add(lat);
+                r.far_wait_ns += lat - idle_far;
+                if (tier[i] & WRITEBACK) {
+                    to_far.reserve(sent, data_bytes);
+                    r.writebacks++;
+                }
+            }
+            r.all.add(lat);
+            t += lat;
+            last = std::max(last, t);
+        }
+        r.elapsed_ns = last;
+        r.to_far_busy_ns = to_far.busy_ns();
+        r.from_far_busy_ns = from_far.busy_ns();
+    }
+};
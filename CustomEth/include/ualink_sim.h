@@ -0,0 +1,238 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <sys/eventfd.h>
+#include "verilated.h"
+#include "Vualink_turbo64.h"
+#include "io.h"
+
+/*
+ualink_turbo64 (with dual_port_ram_banked, matrix_fma_8x8 and systolic_array) verilated and clocked
+in-process, as a FrameLink: RawEth / FPGAInterface / RemoteMem built on a UalinkSim send their frames
+into the RTL instead of a NIC, so the host code and the RTL are tested together, cycle accurate.
+
+  UalinkSim sim;
+  RemoteMem mem(sim, "02:00:00:00:00:02", "02:00:00:00:00:01");
+  mem.write_bytes(0x40, data, 100);
+  sim.last_request_cycles();     // ingress of the request to egress of its response
+
+The model runs on its own thread (and Verilator's, built with --threads), frames go in on port 0,
+one 64-bit beat per clock as fast as s_axis_tready_0 takes them, and come out of m_axis with
+m_axis_tready held high.  tuser[15:0] is the frame length like NetFPGA; there is no port lookup
+around the model, so tuser[31:16] carries a request number instead of the ports, which is how the
+responses are matched to their requests for the cycle counts.  The clock stops when nothing has
+moved for IDLE_CYCLES and starts again on the next frame sent.
+
+build - scripts/build_verilator_sim.sh (verilator --cc --exe --build with the RTL and a main)
+*/
+
+class UalinkSim : public FrameLink {
+public:
+    struct RequestCycles {
+        uint16_t seq;
+        uint64_t in_cycle;     // first beat taken on s_axis
+        uint64_t out_cycle;    // last beat of the response on m_axis
+    };
+
+    static constexpr uint64_t IDLE_CYCLES = 4096;
+
+    explicit UalinkSim (int model_threads = 1) : context(new VerilatedContext) {
+        context->threads(model_threads);
+        top.reset(new Vualink_turbo64(context.get()));
+        tie_off();
+        top->axi_resetn = 0;
+        for (int i = 0; i < 8; i++) tick();
+        top->axi_resetn = 1;
+        rx_fd = eventfd(0, EFD_SEMAPHORE | EFD_NONBLOCK | EFD_CLOEXEC);
+        clock_thread = std::thread(&UalinkSim::run, this);
+    }
+
+    ~UalinkSim () {
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            stop = true;
+        }
+        tx_cv.notify_all();
+        clock_thread.join();
+        top->final();
+        if (rx_fd >= 0) close(rx_fd);
+    }
+
+    bool send_frame (const uint8_t* p, int n) override {
+        if (n <= 0 || n > 0xFFFF) return false;
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            tx.emplace_back(p, p + n);
+            tx_waiting.fetch_add(1, std::memory_order_release);
+        }
+        tx_cv.notify_one();
+        return true;
+    }
+
+    int recv_frame (uint8_t* buf, uint16_t cap, int timeout_ms) override {
+        std::unique_lock<std::mutex> lock(mu);
+        if (!rx_cv.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this] { return !rx.empty(); })) {
+            return -1;
+        }
+        RxFrame f = std::move(rx.front());
+        rx.pop_front();
+        if (rx_fd >= 0) {
+            uint64_t one;
+            ssize_t r = read(rx_fd, &one, sizeof(one));   // one count of rx, never dry here
+            (void)r;
+        }
+        last_cycles = f.cycles.out_cycle - f.cycles.in_cycle;
+        int n = (int)std::min<size_t>(f.bytes.size(), cap);
+        memcpy(buf, f.bytes.data(), n);
+        return n;
+    }
+
+    // an eventfd counting the responses waiting, readable while there is one
+    int ready_fd () const override {
+        return rx_fd;
+    }
+
+    // cycles the response last handed to recv_frame took through the RTL
+    uint64_t last_request_cycles () {
+        std::lock_guard<std::mutex> lock(mu);
+        return last_cycles;
+    }
+
+    // every response so far, in the order they came out, and clears the list
+    std::vector<RequestCycles> take_request_cycles () {
+        std::lock_guard<std::mutex> lock(mu);
+        std::vector<RequestCycles> r;
+        r.swap(done);
+        return r;
+    }
+
+    uint64_t cycles () const {
+        return cycle.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct RxFrame {
+        std::vector<uint8_t> bytes;
+        RequestCycles cycles;
+    };
+
+    std::unique_ptr<VerilatedContext> context;
+    std::unique_ptr<Vualink_turbo64> top;
+    std::thread clock_thread;
+    std::mutex mu;
+    std::condition_variable tx_cv, rx_cv;
+    std::deque<std::vector<uint8_t>> tx;     // frames sent, not yet on s_axis
+    std::deque<RxFrame> rx;                  // responses, not yet received
+    std::vector<RequestCycles> done;
+    uint64_t last_cycles = 0;
+    int rx_fd = -1;                          // rx.size() as a semaphore eventfd, see ready_fd
+    std::atomic<bool> stop{false};
+    std::atomic<size_t> tx_waiting{0};       // tx.size(), read without the lock
+    std::atomic<uint64_t> cycle{0};
+
+    // model thread only
+    std::vector<uint8_t> cur;                // frame going in, beat cur_pos / 8 next
+    size_t cur_pos = 0;
+    bool cur_valid = false;
+    uint16_t next_seq = 0;
+    std::vector<uint64_t> in_cycle = std::vector<uint64_t>(1 << 16);   // by request number
+    std::vector<uint8_t> out;                // response coming out
+
+    void tie_off () {
+        top->s_axis_tvalid_0 = 0;
+        top->s_axis_tvalid_1 = 0;
+        top->s_axis_tvalid_2 = 0;
+        top->s_axis_tvalid_3 = 0;
+        top->s_axis_tvalid_4 = 0;
+        top->s_axis_tstrb_1 = top->s_axis_tstrb_2 = top->s_axis_tstrb_3 = top->s_axis_tstrb_4 = 0xFF;
+        top->m_axis_tready = 1;
+    }
+
+    void tick () {
+        top->axi_aclk = 0;
+        top->eval();
+        top->axi_aclk = 1;
+        top->eval();
+        cycle.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void run () {
+        uint64_t idle = 0;
+        while (!stop.load(std::memory_order_relaxed)) {
+            if (!cur_valid && (idle >= IDLE_CYCLES || tx_waiting.load(std::memory_order_acquire) != 0)) {
+                std::unique_lock<std::mutex> lock(mu);
+                tx_cv.wait(lock, [this] { return stop || !tx.empty(); });
+                if (stop) return;
+                cur = std::move(tx.front());
+                tx.pop_front();
+                tx_waiting.fetch_sub(1, std::memory_order_relaxed);
+                cur_pos = 0;
+                cur_valid = true;
+            }
+            idle = clock() ? 0 : idle + 1;
+        }
+    }
+
+    // one clock, true if a beat went in or out
+    bool clock () {
+        uint64_t now = cycle.load(std::memory_order_relaxed);
+        top->axi_aclk = 0;
+        if (cur_valid) {
+            size_t n = std::min<size_t>(8, cur.size() - cur_pos);
+            uint64_t data = 0;
+            for (size_t l = 0; l < n; l++) data |= static_cast<uint64_t>(cur[cur_pos + l]) << (8 * l);
+            top->s_axis_tdata_0 = data;
+            top->s_axis_tstrb_0 = static_cast<uint8_t>((1u << n) - 1);
+            top->s_axis_tuser_0 = (static_cast<uint32_t>(next_seq) << 16) | static_cast<uint32_t>(cur.size());
+            top->s_axis_tlast_0 = cur_pos + n == cur.size();
+        }
+        top->s_axis_tvalid_0 = cur_valid;
+        top->eval();
+
+        bool in_fire  = cur_valid && top->s_axis_tready_0;
+        bool out_fire = top->m_axis_tvalid && top->m_axis_tready;
+        if (out_fire) {
+            uint64_t data = top->m_axis_tdata;
+            for (int l = 0; l < 8; l++)
+                if (top->m_axis_tstrb >> l & 1) out.push_back(static_cast<uint8_t>(data >> (8 * l)));
+            if (top->m_axis_tlast) {
+                uint16_t seq = static_cast<uint16_t>(top->m_axis_tuser >> 16);
+                RxFrame f{std::move(out), {seq, in_cycle[seq], now}};
+                out.clear();
+                {
+                    std::lock_guard<std::mutex> lock(mu);
+                    done.push_back(f.cycles);
+                    rx.push_back(std::move(f));
+                    if (rx_fd >= 0) {
+                        uint64_t one = 1;
+                        ssize_t r = write(rx_fd, &one, sizeof(one));
+                        (void)r;
+                    }
+                }
+                rx_cv.notify_one();
+            }
+        }
+
+        top->axi_aclk = 1;
+        top->eval();
+        cycle.fetch_add(1, std::memory_order_relaxed);
+
+        if (in_fire) {
+            if (cur_pos == 0) in_cycle[next_seq] = now;
+            cur_pos += 8;
+            if (cur_pos >= cur.size()) {
+                cur_valid = false;
+                next_seq++;
+            }
+        }
+        return in_fire || out_fire;
+    }
+};
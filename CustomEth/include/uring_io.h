@@ -0,0 +1,244 @@
+#pragma once
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/*
+Minimal io_uring wrapper on the raw syscalls (no liburing dependency).
+
+Covers what the UDP paths need:
+  - SQ/CQ ring setup, optional SQPOLL so submission is a ring store only
+  - a provided buffer ring (IORING_REGISTER_PBUF_RING, 5.19+) that the kernel
+    fills from multishot recvmsg (IORING_RECV_MULTISHOT, 6.0+)
+Anything missing on an older kernel surfaces as an exception from the
+constructor / setup_buf_ring so the caller can fall back to sendmmsg/recvmmsg.
+*/
+
+class UringIo {
+public:
+    UringIo (unsigned entries, bool sqpoll, unsigned sqpoll_idle_ms = 50) {
+        io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        p.flags = IORING_SETUP_CQSIZE;
+        p.cq_entries = entries * 4;   // multishot recv can post many CQEs per SQE
+        if (sqpoll) {
+            p.flags |= IORING_SETUP_SQPOLL;
+            p.sq_thread_idle = sqpoll_idle_ms;
+        }
+        ring_fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+        if (ring_fd < 0) {
+            throw std::runtime_error(std::string("io_uring_setup: ") + strerror(errno));
+        }
+        sq_poll = sqpoll;
+
+        sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cq_ring_sz = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        bool single_mmap = p.features & IORING_FEAT_SINGLE_MMAP;
+        if (single_mmap && cq_ring_sz > sq_ring_sz) sq_ring_sz = cq_ring_sz;
+
+        sq_ptr = mmap(nullptr, sq_ring_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring_fd, IORING_OFF_SQ_RING);
+        if (sq_ptr == MAP_FAILED) fail("mmap(sq ring)");
+        if (single_mmap) {
+            cq_ptr = sq_ptr;
+        } else {
+            cq_ptr = mmap(nullptr, cq_ring_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                          ring_fd, IORING_OFF_CQ_RING);
+            if (cq_ptr == MAP_FAILED) fail("mmap(cq ring)");
+        }
+        sqes_sz = p.sq_entries * sizeof(io_uring_sqe);
+        sqes = static_cast<io_uring_sqe*>(mmap(nullptr, sqes_sz, PROT_READ | PROT_WRITE,
+                                               MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES));
+        if (sqes == MAP_FAILED) fail("mmap(sqes)");
+
+        uint8_t* sq = static_cast<uint8_t*>(sq_ptr);
+        sq_head  = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+        sq_tail  = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+        sq_mask  = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+        sq_flags = reinterpret_cast<unsigned*>(sq + p.sq_off.flags);
+        sq_array = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+        sq_entries = p.sq_entries;
+
+        uint8_t* cq = static_cast<uint8_t*>(cq_ptr);
+        cq_head = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+        cq_mask = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+        cqes    = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+
+        // identity map the index array once, sqe slot i always lives at array[i]
+        for (unsigned i = 0; i < sq_entries; i++) sq_array[i] = i;
+        local_tail = *sq_tail;
+    }
+
+    ~UringIo () {
+        release_rings();
+    }
+
+    UringIo (const UringIo&) = delete;
+    UringIo& operator= (const UringIo&) = delete;
+
+    void release_rings () {
+        if (buf_ring) {
+            io_uring_buf_reg reg;
+            memset(&reg, 0, sizeof(reg));
+            reg.bgid = buf_group;
+            syscall(__NR_io_uring_register, ring_fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+            munmap(buf_ring, buf_ring_sz);
+            munmap(buf_base, (size_t)buf_count * buf_size);
+            buf_ring = nullptr;
+        }
+        if (sqes && sqes != MAP_FAILED) munmap(sqes, sqes_sz);
+        if (cq_ptr && cq_ptr != MAP_FAILED && cq_ptr != sq_ptr) munmap(cq_ptr, cq_ring_sz);
+        if (sq_ptr && sq_ptr != MAP_FAILED) munmap(sq_ptr, sq_ring_sz);
+        sqes = nullptr;
+        cq_ptr = sq_ptr = nullptr;
+        if (ring_fd >= 0) close(ring_fd);
+        ring_fd = -1;
+    }
+
+    // Next free SQE, zeroed, or nullptr if the SQ is full (call submit first).
+    io_uring_sqe* get_sqe () {
+        unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+        if (local_tail - head >= sq_entries) return nullptr;
+        io_uring_sqe* sqe = &sqes[local_tail & sq_mask];
+        memset(sqe, 0, sizeof(*sqe));
+        local_tail++;
+        return sqe;
+    }
+
+    // Publish queued SQEs and optionally wait for wait_nr completions.
+    int submit (unsigned wait_nr = 0) {
+        unsigned to_submit = local_tail - *sq_tail;
+        __atomic_store_n(sq_tail, local_tail, __ATOMIC_RELEASE);
+        unsigned flags = 0;
+        if (sq_poll) {
+            // the kernel thread picks SQEs up itself, enter only to wake it or to wait
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (__atomic_load_n(sq_flags, __ATOMIC_RELAXED) & IORING_SQ_NEED_WAKEUP) {
+                flags |= IORING_ENTER_SQ_WAKEUP;
+            }
+            to_submit = 0;
+            if (!flags && !wait_nr) return 0;
+        }
+        if (wait_nr) flags |= IORING_ENTER_GETEVENTS;
+        if (!to_submit && !flags) return 0;
+        int r = (int)syscall(__NR_io_uring_enter, ring_fd, to_submit, wait_nr, flags, nullptr, 0);
+        enters++;
+        return r < 0 ? -errno : r;
+    }
+
+    // Calls f(cqe) for every ready completion and advances the CQ head.
+    template <class F>
+    unsigned reap (F&& f) {
+        unsigned head = *cq_head;
+        unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        unsigned n = 0;
+        while (head != tail) {
+            f(cqes[head & cq_mask]);
+            head++;
+            n++;
+        }
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+        return n;
+    }
+
+    bool cq_ready () const {
+        return *cq_head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    }
+
+    // Block until a CQE is posted or timeout_ms passes (the ring fd is pollable).
+    bool wait_cq (int timeout_ms) {
+        if (cq_ready()) return true;
+        struct pollfd pfd = {ring_fd, POLLIN, 0};
+        return ::poll(&pfd, 1, timeout_ms) > 0;
+    }
+
+    // Register `count` buffers of `size` bytes as provided-buffer group `bgid`.
+    void setup_buf_ring (uint16_t bgid, unsigned count, unsigned size) {
+        buf_group = bgid;
+        buf_count = count;    // must be a power of two
+        buf_size = size;
+        buf_ring_sz = count * sizeof(io_uring_buf);
+        void* r = mmap(nullptr, buf_ring_sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        void* b = mmap(nullptr, (size_t)count * size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+        if (r == MAP_FAILED || b == MAP_FAILED) {
+            throw std::runtime_error("mmap(buf ring)");
+        }
+        io_uring_buf_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.ring_addr = (uint64_t)(uintptr_t)r;
+        reg.ring_entries = count;
+        reg.bgid = bgid;
+        if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+            int e = errno;
+            munmap(r, buf_ring_sz);
+            munmap(b, (size_t)count * size);
+            throw std::runtime_error(std::string("IORING_REGISTER_PBUF_RING: ") + strerror(e));
+        }
+        buf_ring = static_cast<io_uring_buf_ring*>(r);
+        buf_base = static_cast<uint8_t*>(b);
+        for (unsigned i = 0; i < count; i++) {
+            add_buf((uint16_t)i, i);
+        }
+        buf_tail += count;
+        __atomic_store_n(&buf_ring->tail, buf_tail, __ATOMIC_RELEASE);
+    }
+
+    uint8_t* buffer (uint16_t bid) { return buf_base + (size_t)bid * buf_size; }
+    unsigned buffer_size () const { return buf_size; }
+    uint16_t buffer_group () const { return buf_group; }
+
+    // Give a consumed buffer back to the kernel.
+    void recycle (uint16_t bid) {
+        add_buf(bid, 0);
+        buf_tail++;
+        __atomic_store_n(&buf_ring->tail, buf_tail, __ATOMIC_RELEASE);
+    }
+
+    uint64_t enters = 0;   // io_uring_enter syscalls, for batching stats
+
+private:
+    int ring_fd = -1;
+    bool sq_poll = false;
+    void* sq_ptr = nullptr;
+    void* cq_ptr = nullptr;
+    size_t sq_ring_sz = 0, cq_ring_sz = 0, sqes_sz = 0;
+    io_uring_sqe* sqes = nullptr;
+    unsigned *sq_head, *sq_tail, *sq_flags, *sq_array;
+    unsigned sq_mask = 0, sq_entries = 0, local_tail = 0;
+    unsigned *cq_head, *cq_tail;
+    unsigned cq_mask = 0;
+    io_uring_cqe* cqes = nullptr;
+
+    io_uring_buf_ring* buf_ring = nullptr;
+    size_t buf_ring_sz = 0;
+    uint8_t* buf_base = nullptr;
+    unsigned buf_count = 0, buf_size = 0;
+    uint16_t buf_group = 0;
+    uint16_t buf_tail = 0;
+
+    void add_buf (uint16_t bid, unsigned offset) {
+        // index the entries by hand, under C++ the uapi flex array `bufs` lands at
+        // offset 8 instead of 0 and would run off the end of the ring
+        io_uring_buf* bufs = reinterpret_cast<io_uring_buf*>(buf_ring);
+        io_uring_buf* b = &bufs[(buf_tail + offset) & (buf_count - 1)];
+        b->addr = (uint64_t)(uintptr_t)buffer(bid);
+        b->len = buf_size;
+        b->bid = bid;
+    }
+
+    [[noreturn]] void fail (const char* what) {
+        int e = errno;
+        release_rings();
+        throw std::runtime_error(std::string(what) + ": " + strerror(e));
+    }
+};
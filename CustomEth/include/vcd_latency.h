@@ -0,0 +1,560 @@
+#pragma once
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+Per-transaction latencies in clock cycles out of a VCD dump, the testbench dumps of ualink_turbo64
+(memcached_UDP64B_tb.vcd, ualink_turbordwr_tb) and the ChipScope captures of FPGA_related, in one
+streaming pass over the mmap'd file.
+
+  VcdReader       - the header's scopes and $vars, then the value changes of the signals asked for
+                    as the time steps go by; the lines of every other signal are skipped unparsed
+  CycleHistogram  - exact count per cycle count, with the summary a JSON report compares on
+  VcdLatency      - the signals sampled every clock cycle: request frames in on s_axis port 0 and
+                    response frames out on m_axis, paired in order (port 0 answers in order), the
+                    DPMEM write enable and the cycles of every state
+
+A clock is sampled at its rising edges with the values from before the edge's time step, the way the
+flops see them.  A dump without one (ChipScope writes a time step per sample, 1ns apart) is sampled
+every period time units instead.
+*/
+
+class VcdReader {
+public:
+    struct Var {
+        std::string path;       // scope.scope.name
+        std::string name;
+        int width;
+        std::string id;
+    };
+
+    // the file, mmap'd and its header read
+    explicit VcdReader (const std::string& path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw std::runtime_error("VcdReader: cannot open " + path);
+        struct stat sb;
+        fstat(fd, &sb);
+        size = static_cast<size_t>(sb.st_size);
+        if (size == 0) {
+            close(fd);
+            throw std::runtime_error("VcdReader: " + path + " is empty");
+        }
+        void* p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED) throw std::runtime_error("VcdReader: mmap " + path);
+        madvise(p, size, MADV_SEQUENTIAL);
+        mapped = true;
+        data = static_cast<const char*>(p);
+        read_header();
+    }
+
+    // a dump already in memory, which must outlive the reader
+    VcdReader (const char* text, size_t n) : data(text), size(n) {
+        read_header();
+    }
+
+    ~VcdReader () {
+        if (mapped) munmap(const_cast<char*>(data), size);
+    }
+
+    VcdReader (const VcdReader&) = delete;
+    VcdReader& operator= (const VcdReader&) = delete;
+
+    const std::vector<Var>& vars () const {
+        return all_vars;
+    }
+
+    const std::string& timescale () const {
+        return scale;
+    }
+
+    // Follow var: its value is value(slot) from then on.  Vars with the same id share the slot.
+    int follow (const Var& v) {
+        auto it = slot_of_id.find(v.id);
+        if (it != slot_of_id.end()) return it->second;
+        int slot = static_cast<int>(values.size());
+        values.push_back(0);
+        slot_of_id[v.id] = slot;
+        uint64_t k = key(v.id.data(), v.id.size());
+        if (k < FLAT) {
+            if (flat.empty()) flat.assign(FLAT, -1);
+            flat[k] = slot;
+        } else {
+            wide[k] = slot;
+        }
+        return slot;
+    }
+
+    uint64_t value (int slot) const {
+        return values[slot];
+    }
+
+    // The value changes in order: step(time) after the changes of every time step, with the values
+    // as they are at its end, and changed(slot, old) for every change of a followed signal as it
+    // comes.  Returns the last time.
+    template <class Step, class Changed>
+    uint64_t replay (Step step, Changed changed) {
+        const char* p = body;
+        const char* end = data + size;
+        uint64_t now = 0;
+        bool any = false;
+        while (p < end) {
+            const char* eol = static_cast<const char*>(memchr(p, '\n', end - p));
+            if (!eol) eol = end;
+            const char* q = p;
+            while (q < eol && (*q == ' ' || *q == '\t' || *q == '\r')) q++;
+            if (q < eol) {
+                char c = *q;
+                if (c == '#') {
+                    uint64_t t = 0;
+                    for (q++; q < eol && *q >= '0' && *q <= '9'; q++) t = t * 10 + (*q - '0');
+                    if (any && t != now) step(now);
+                    now = t;
+                    any = true;
+                } else if (c == '0' || c == '1' || c == 'x' || c == 'X' || c == 'z' || c == 'Z') {
+                    set(q + 1, trim(q + 1, eol), c == '1' ? 1 : 0, changed);
+                } else if (c == 'b' || c == 'B') {
+                    uint64_t v = 0;
+                    for (q++; q < eol && *q != ' ' && *q != '\t'; q++) v = v << 1 | (*q == '1');
+                    while (q < eol && (*q == ' ' || *q == '\t')) q++;
+                    set(q, trim(q, eol), v, changed);
+                } else if (c == '$') {
+                    // $dumpvars/$dumpall/$end lines around the changes, a $comment to its $end
+                    if (eol - q >= 8 && memcmp(q, "$comment", 8) == 0) {
+                        const char* e = find_end(q + 8, end);
+                        eol = static_cast<const char*>(memchr(e, '\n', end - e));
+                        if (!eol) eol = end;
+                    }
+                }
+            }
+            p = eol + 1;
+        }
+        if (any) step(now);
+        return now;
+    }
+
+private:
+    static constexpr uint64_t FLAT = uint64_t(1) << 22;
+
+    const char* data = nullptr;
+    size_t size = 0;
+    bool mapped = false;
+    const char* body = nullptr;          // the first line after $enddefinitions
+    std::string scale;
+    std::vector<Var> all_vars;
+    std::unordered_map<std::string, int> slot_of_id;
+    std::vector<int> flat;               // slot by id key, the short ids
+    std::unordered_map<uint64_t, int> wide;
+    std::vector<uint64_t> values;
+
+    // an id as a number, its characters base 94
+    static uint64_t key (const char* id, size_t n) {
+        if (n > 9) {
+            uint64_t h = 1469598103934665603ULL;
+            for (size_t i = 0; i < n; i++) h = (h ^ static_cast<uint8_t>(id[i])) * 1099511628211ULL;
+            return h | (uint64_t(1) << 63);
+        }
+        uint64_t k = 0;
+        for (size_t i = n; i > 0; i--) k = k * 94 + (static_cast<uint8_t>(id[i - 1]) - 32);
+        return k;
+    }
+
+    static const char* trim (const char* q, const char* eol) {
+        while (eol > q && (eol[-1] == ' ' || eol[-1] == '\t' || eol[-1] == '\r')) eol--;
+        return eol;
+    }
+
+    template <class Changed>
+    void set (const char* id, const char* id_end, uint64_t v, Changed& changed) {
+        if (id_end <= id) return;
+        uint64_t k = key(id, id_end - id);
+        int slot = -1;
+        if (k < FLAT) {
+            if (!flat.empty()) slot = flat[k];
+        } else {
+            auto it = wide.find(k);
+            if (it != wide.end()) slot = it->second;
+        }
+        if (slot < 0) return;
+        uint64_t old = values[slot];
+        values[slot] = v;
+        if (old != v) changed(slot, old);
+    }
+
+    static const char* find_end (const char* p, const char* end) {
+        while (p + 4 <= end) {
+            const char* d = static_cast<const char*>(memchr(p, '$', end - p));
+            if (!d || d + 4 > end) break;
+            if (memcmp(d, "$end", 4) == 0) return d + 4;
+            p = d + 1;
+        }
+        return end;
+    }
+
+    // whitespace separated words up to $enddefinitions
+    void read_header () {
+        const char* p = data;
+        const char* end = data + size;
+        std::vector<std::string> scopes;
+        auto word = [&] () {
+            while (p < end && isspace(static_cast<unsigned char>(*p))) p++;
+            const char* s = p;
+            while (p < end && !isspace(static_cast<unsigned char>(*p))) p++;
+            return std::string(s, p);
+        };
+        while (p < end) {
+            std::string w = word();
+            if (w.empty()) break;
+            if (w == "$enddefinitions") {
+                p = find_end(p, end);
+                body = p;
+                return;
+            } else if (w == "$scope") {
+                word();
+                scopes.push_back(word());
+                p = find_end(p, end);
+            } else if (w == "$upscope") {
+                if (!scopes.empty()) scopes.pop_back();
+                p = find_end(p, end);
+            } else if (w == "$var") {
+                word();
+                Var v;
+                v.width = atoi(word().c_str());
+                v.id = word();
+                v.name = word();
+                for (const std::string& s : scopes) v.path += s + ".";
+                v.path += v.name;
+                all_vars.push_back(v);
+                p = find_end(p, end);
+            } else if (w == "$timescale") {
+                for (std::string t = word(); !t.empty() && t != "$end"; t = word()) scale += t;
+            } else if (w[0] == '$' && w != "$end") {
+                p = find_end(p, end);
+            }
+        }
+        throw std::runtime_error("VcdReader: no $enddefinitions");
+    }
+};
+
+class CycleHistogram {
+public:
+    void add (int64_t cycles) {
+        counts[cycles]++;
+        n++;
+        sum += cycles;
+    }
+
+    uint64_t count () const {
+        return n;
+    }
+
+    // the smallest count of cycles p of the values are at or below
+    int64_t percentile (double p) const {
+        uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(p * n)));
+        uint64_t seen = 0;
+        for (const auto& c : counts) {
+            seen += c.second;
+            if (seen >= rank) return c.first;
+        }
+        return 0;
+    }
+
+    void json (std::ostream& out) const {
+        out << "{\"count\": " << n;
+        if (n) {
+            out << ", \"min\": " << counts.begin()->first << ", \"max\": " << counts.rbegin()->first
+                << ", \"mean\": " << static_cast<double>(sum) / n << ", \"p50\": " << percentile(0.5)
+                << ", \"p90\": " << percentile(0.9) << ", \"p99\": " << percentile(0.99);
+        }
+        out << ", \"histogram\": {";
+        bool first = true;
+        for (const auto& c : counts) {
+            out << (first ? "" : ", ") << '"' << c.first << "\": " << c.second;
+            first = false;
+        }
+        out << "}}";
+    }
+
+private:
+    std::map<int64_t, uint64_t> counts;
+    uint64_t n = 0;
+    int64_t sum = 0;
+};
+
+class VcdLatency {
+public:
+    // the signals followed, each the first name of its list found: in the scope that has both valids
+    // (the ualink_turbo64 instance) first, anywhere else then.  Names of the ChipScope captures last.
+    enum Role { CLOCK, IN_VALID, IN_READY, IN_LAST, OUT_VALID, OUT_READY, OUT_LAST, WE, STATE, ROLES };
+
+    static const char* role_name (int r) {
+        static const char* const names[ROLES] = {"clock", "in_valid", "in_ready", "in_last", "out_valid",
+                                                 "out_ready", "out_last", "we", "state"};
+        return names[r];
+    }
+
+    struct Config {
+        std::vector<std::string> names[ROLES] = {
+            {"axi_aclk", "clk"},
+            {"s_axis_tvalid_0", "s_axis_valid0"},
+            {"s_axis_tready_0", "s_axis_tready0"},
+            {"s_axis_tlast_0", "s_axis_tlast0"},
+            {"m_axis_tvalid"},
+            {"m_axis_tready"},
+            {"m_axis_tlast"},
+            {"we_a"},
+            {"state"},
+        };
+        uint64_t period = 1;            // time units per cycle without a clock
+    };
+
+    // latencies of a transaction, in cycles from its request's first beat in
+    struct Metrics {
+        CycleHistogram first_out;       // to the response's first beat out
+        CycleHistogram last_in_to_first_out;   // negative when the response starts before the request ends
+        CycleHistogram last_out;        // to the response's last beat out
+        CycleHistogram first_we;        // to the first DPMEM write while it is in flight
+        CycleHistogram request_beats, response_beats;
+    };
+
+    VcdLatency () {}
+
+    explicit VcdLatency (Config c) : cfg(std::move(c)) {}
+
+    void run (VcdReader& vcd) {
+        resolve(vcd);
+        if (slot[IN_VALID] < 0 || slot[OUT_VALID] < 0)
+            throw std::runtime_error("VcdLatency: no s_axis/m_axis valid signals in the dump");
+        bool clocked = slot[CLOCK] >= 0;
+        std::vector<uint64_t> before(ROLES, 0);
+        bool rose = false;
+        uint64_t last_time = 0, first_edge = 0, last_edge = 0;
+        bool started = false;
+        auto load = [&] (std::vector<uint64_t>& v) {
+            for (int r = 0; r < ROLES; r++) v[r] = slot[r] >= 0 ? vcd.value(slot[r]) : 0;
+        };
+        end_time = vcd.replay(
+            [&] (uint64_t t) {
+                if (clocked) {
+                    if (rose) {
+                        if (cycle == 0) first_edge = t;
+                        last_edge = t;
+                        sample(before);
+                    }
+                    rose = false;
+                    load(before);
+                } else {
+                    // the values of the step before hold until this one
+                    if (started) {
+                        for (uint64_t k = (last_time + cfg.period - 1) / cfg.period; k * cfg.period < t; k++) sample(before);
+                    }
+                    load(before);
+                    last_time = t;
+                    started = true;
+                }
+            },
+            [&] (int s, uint64_t old) {
+                if (clocked && s == slot[CLOCK] && old == 0) rose = true;
+            });
+        if (!clocked && started) sample(before);
+        period = clocked ? (cycle > 1 ? (last_edge - first_edge) / (cycle - 1) : 0) : cfg.period;
+        unanswered = pending.size();
+    }
+
+    void json (std::ostream& out, const std::string& file) const {
+        out << "{\n  \"file\": \"" << file << "\",\n  \"timescale\": \"" << timescale << "\",\n  \"period\": "
+            << period << ",\n  \"cycles\": " << cycle << ",\n  \"signals\": {";
+        for (int r = 0; r < ROLES; r++)
+            out << (r ? ", " : "") << '"' << role_name(r) << "\": \"" << (slot[r] >= 0 ? path[r] : "") << '"';
+        out << "},\n  \"transactions\": " << m.first_out.count() << ",\n  \"unanswered_requests\": " << unanswered
+            << ",\n  \"unmatched_responses\": " << unmatched << ",\n  \"we_cycles\": " << we_cycles
+            << ",\n  \"latency\": {\n";
+        const std::pair<const char*, const CycleHistogram*> hs[] = {
+            {"first_in_to_first_out", &m.first_out}, {"last_in_to_first_out", &m.last_in_to_first_out},
+            {"first_in_to_last_out", &m.last_out}, {"first_in_to_we", &m.first_we},
+            {"request_beats", &m.request_beats}, {"response_beats", &m.response_beats}};
+        for (size_t i = 0; i < sizeof(hs) / sizeof(hs[0]); i++) {
+            out << "    \"" << hs[i].first << "\": ";
+            hs[i].second->json(out);
+            out << (i + 1 < sizeof(hs) / sizeof(hs[0]) ? ",\n" : "\n");
+        }
+        out << "  },\n  \"state_cycles\": {";
+        bool first = true;
+        for (const auto& s : state_cycles) {
+            out << (first ? "" : ", ") << '"' << s.first << "\": " << s.second;
+            first = false;
+        }
+        out << "},\n  \"state_transitions\": {";
+        first = true;
+        for (const auto& s : transitions) {
+            out << (first ? "" : ", ") << '"' << s.first.first << "->" << s.first.second << "\": " << s.second;
+            first = false;
+        }
+        out << "}\n}\n";
+    }
+
+    const Metrics& metrics () const {
+        return m;
+    }
+
+    uint64_t cycles () const {
+        return cycle;
+    }
+
+    uint64_t unanswered_requests () const {
+        return unanswered;
+    }
+
+    uint64_t unmatched_responses () const {
+        return unmatched;
+    }
+
+    const std::map<uint64_t, uint64_t>& state_cycle_counts () const {
+        return state_cycles;
+    }
+
+private:
+    struct Txn {
+        uint64_t start;
+        int64_t last_in = -1, first_out = -1, we = -1;
+        uint32_t in_beats = 0;
+    };
+
+    Config cfg;
+    int slot[ROLES];
+    std::string path[ROLES];
+    std::string timescale;
+    uint64_t cycle = 0, period = 0, end_time = 0;
+    std::deque<Txn> pending;             // requests in, their responses not out yet
+    Txn* in_frame = nullptr;             // request whose beats are coming in
+    bool out_frame = false;
+    bool out_matched = false;
+    uint32_t out_beats = 0;
+    Txn out_txn{0};
+    uint64_t unanswered = 0, unmatched = 0, we_cycles = 0;
+    bool have_state = false;
+    uint64_t last_state = 0;
+    std::map<uint64_t, uint64_t> state_cycles;
+    std::map<std::pair<uint64_t, uint64_t>, uint64_t> transitions;
+    Metrics m;
+
+    void resolve (VcdReader& vcd) {
+        timescale = vcd.timescale();
+        const auto& vars = vcd.vars();
+        // the scope with both valids
+        std::string dut;
+        for (const auto& v : vars) {
+            if (!in_list(v.name, IN_VALID)) continue;
+            std::string scope = v.path.substr(0, v.path.size() - v.name.size());
+            for (const auto& o : vars)
+                if (in_list(o.name, OUT_VALID) && o.path.compare(0, scope.size(), scope) == 0 &&
+                    o.path.size() == scope.size() + o.name.size()) dut = scope;
+            if (!dut.empty()) break;
+        }
+        for (int r = 0; r < ROLES; r++) {
+            slot[r] = -1;
+            const VcdReader::Var* pick = nullptr;
+            for (const std::string& want : cfg.names[r]) {
+                for (const auto& v : vars) {
+                    bool match = want.find('.') != std::string::npos ? v.path == want : v.name == want;
+                    if (!match) continue;
+                    bool in_dut = !dut.empty() && v.path.compare(0, dut.size(), dut) == 0 &&
+                                  v.path.size() == dut.size() + v.name.size();
+                    if (in_dut || !pick) pick = &v;
+                    if (in_dut) break;
+                }
+                if (pick) break;
+            }
+            if (pick) {
+                slot[r] = vcd.follow(*pick);
+                path[r] = pick->path;
+            }
+        }
+    }
+
+    bool in_list (const std::string& name, int r) const {
+        for (const std::string& n : cfg.names[r])
+            if (n == name) return true;
+        return false;
+    }
+
+    bool high (const std::vector<uint64_t>& v, int r, bool absent) const {
+        return slot[r] >= 0 ? v[r] != 0 : absent;
+    }
+
+    // one clock cycle with the values the flops saw
+    void sample (const std::vector<uint64_t>& v) {
+        uint64_t c = cycle++;
+        if (high(v, IN_VALID, false) && high(v, IN_READY, true)) {
+            if (!in_frame) {
+                pending.push_back(Txn{c});
+                in_frame = &pending.back();
+            }
+            in_frame->in_beats++;
+            if (high(v, IN_LAST, true)) {
+                in_frame->last_in = static_cast<int64_t>(c);
+                in_frame = nullptr;
+            }
+        }
+        if (high(v, WE, false)) {
+            we_cycles++;
+            // to the oldest transaction in flight without one, the one whose response is going out first
+            Txn* t = out_frame && out_matched && out_txn.we < 0 ? &out_txn : nullptr;
+            for (auto it = pending.begin(); !t && it != pending.end(); ++it)
+                if (it->we < 0) t = &*it;
+            if (t) t->we = static_cast<int64_t>(c);
+        }
+        if (high(v, OUT_VALID, false) && high(v, OUT_READY, true)) {
+            if (!out_frame) {
+                out_frame = true;
+                out_beats = 0;
+                out_matched = !pending.empty();
+                if (out_matched) {
+                    out_txn = pending.front();
+                    // the request may still be coming in (cut through), its last beats go to the copy
+                    if (in_frame == &pending.front()) in_frame = &out_txn;
+                    pending.pop_front();
+                    out_txn.first_out = static_cast<int64_t>(c);
+                } else {
+                    unmatched++;
+                }
+            }
+            out_beats++;
+            if (high(v, OUT_LAST, true)) {
+                if (out_matched) finish(out_txn, c);
+                if (in_frame == &out_txn) in_frame = nullptr;
+                out_frame = false;
+            }
+        }
+        if (slot[STATE] >= 0) {
+            state_cycles[v[STATE]]++;
+            if (have_state && v[STATE] != last_state) transitions[{last_state, v[STATE]}]++;
+            last_state = v[STATE];
+            have_state = true;
+        }
+    }
+
+    void finish (const Txn& t, uint64_t c) {
+        m.first_out.add(t.first_out - static_cast<int64_t>(t.start));
+        if (t.last_in >= 0) m.last_in_to_first_out.add(t.first_out - t.last_in);
+        m.last_out.add(static_cast<int64_t>(c - t.start));
+        if (t.we >= 0) m.first_we.add(t.we - static_cast<int64_t>(t.start));
+        m.request_beats.add(t.in_beats);
+        m.response_beats.add(out_beats);
+    }
+};
@@ -0,0 +1,193 @@
+/*  Many FPGAs from one thread: an FpgaDevice per FPGA on one Reactor (reactor.h), all of them on the
+    interface's one EthPort socket, each kept busy with depth sized WRITE/READ pairs of random bytes at
+    random addresses, every READ checked against its WRITE.  One key=value line per FPGA, then the
+    port's and the reactor's.  It checks the TimingWheel first, random timers and cancels that each
+    have to fire on their own tick, then the same load on four FPGAs modelled by one LoopbackLink
+    (loopback_link.h) behind an EthPort, one of them tagged, with a frame for no FPGA among them.
+    Without an FPGA that is all it does.
+
+compile - g++ -O2 -std=c++17 fpga_reactor.cpp packet.cpp ../util/checksum.cpp -o fpga_reactor
+sudo ./fpga_reactor [<interface> <src_mac> <dst_mac>[,<dst_mac>...] [pairs] [depth]]
+
+  dst_mac : one per FPGA on the interface, comma separated
+  pairs   : WRITE/READ pairs per FPGA, default 10000
+  depth   : pairs in flight per FPGA, default 8
+
+Note: AF_PACKET requires root/sudo privileges
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include "../include/loopback_link.h"
+#include "../include/reactor.h"
+
+// random timers over all four levels, a third cancelled, the wheel advanced in random steps
+static int check_wheel (std::mt19937& rng) {
+    const int n = 100000;
+    TimingWheel wheel(rng() % 1000000);
+    std::vector<WheelTimer> timers(n);
+    std::vector<uint64_t> due(n), fired_at(n, 0);
+    std::vector<bool> cancelled(n, false);
+    for (int i = 0; i < n; i++) {
+        uint64_t delay = 1 + rng() % (i % 4 == 0 ? 20000000 : 5000);
+        timers[i].fire = [&, i] { fired_at[i] = wheel.now(); };
+        wheel.schedule(timers[i], delay);
+        due[i] = wheel.now() + delay;
+    }
+    for (int i = 0; i < n; i += 3) {
+        wheel.cancel(timers[i]);
+        cancelled[i] = true;
+    }
+    uint64_t end = wheel.now() + 20000001;
+    while (wheel.now() < end) wheel.advance(wheel.now() + 1 + rng() % 3000);
+    int errors = 0;
+    for (int i = 0; i < n; i++) {
+        uint64_t want = cancelled[i] ? 0 : due[i];
+        if (fired_at[i] != want) {
+            if (errors++ < 10) fprintf(stderr, "timer %d fired at %lu, due %lu\n", i, (unsigned long)fired_at[i], (unsigned long)want);
+        }
+    }
+    printf("timing wheel: %d timers, %d errors, %zu pending\n", n, errors, wheel.pending());
+    return errors + (wheel.pending() ? 1 : 0);
+}
+
+// one FPGA: pairs WRITE/READ pairs, depth of them in flight
+struct PairLoad {
+    FpgaDevice& dev;
+    std::mt19937 rng;
+    int todo, depth;
+    int done = 0, mismatches = 0, failed = 0;
+
+    struct Pair {
+        uint64_t addr;
+        uint8_t n;
+        uint8_t wdata[255], rdata[255];
+    };
+    std::vector<Pair> slots;
+
+    PairLoad (FpgaDevice& d, uint32_t seed, int pairs, int in_flight) :
+    dev(d), rng(seed), todo(pairs), depth(in_flight), slots(in_flight) {}
+
+    void start () {
+        for (int s = 0; s < depth && todo > 0; s++) next(s);
+    }
+
+    // the depth slots share the 2KB DPMEM, slot s writes in its own 2048/depth bytes
+    void next (int s) {
+        todo--;
+        Pair& p = slots[s];
+        size_t span = 2048 / depth;
+        p.n = static_cast<uint8_t>(1 + rng() % std::min<size_t>(255, span / 2));
+        p.addr = s * span + rng() % (span - p.n + 1);
+        for (int i = 0; i < p.n; i++) p.wdata[i] = static_cast<uint8_t>(rng());
+        dev.write_bytes(p.addr, p.wdata, p.n, [this](FpgaDevice::Status st) {
+            if (st != FpgaDevice::Status::OK) failed++;
+        });
+        dev.read_bytes(p.addr, p.rdata, p.n, [this, s](FpgaDevice::Status st) {
+            Pair& q = slots[s];
+            if (st != FpgaDevice::Status::OK) failed++;
+            else if (memcmp(q.wdata, q.rdata, q.n) != 0) mismatches++;
+            done++;
+            if (todo > 0) next(s);
+        });
+    }
+};
+
+// four FPGAs on one LoopbackLink, one EthPort: every frame has to reach its own device
+static int check_shared_port () {
+    const int fpgas = 4, pairs = 2000;
+    Reactor reactor;
+    LoopbackLink loop;
+    EthPort port(reactor, loop);
+    std::vector<std::unique_ptr<FPGAInterface>> ifs;
+    std::vector<std::unique_ptr<FpgaDevice>> devs;
+    std::vector<std::unique_ptr<PairLoad>> loads;
+    for (int i = 0; i < fpgas; i++) {
+        ifs.emplace_back(new FPGAInterface(port, "02:00:00:00:00:01", "02:00:00:00:01:0" + std::to_string(i)));
+        if (i == 1) ifs[i]->traffic_class = 5;
+        devs.emplace_back(new FpgaDevice(reactor, *ifs[i]));
+        loads.emplace_back(new PairLoad(*devs[i], 2000 + i, pairs, 8));
+        loads[i]->start();
+    }
+    uint8_t stray[60] = {0x02, 0, 0, 0, 0x02, 0x00, 0x02, 0, 0, 0, 0, 0x01, 0x08, 0x00};
+    port.send_frame(stray, sizeof(stray));
+
+    auto busy = [&] {
+        for (auto& d : devs) if (d->outstanding()) return true;
+        return false;
+    };
+    for (int turns = 0; busy() && turns < 1000000; turns++) reactor.run_once();
+
+    int errors = 0;
+    for (int i = 0; i < fpgas; i++) {
+        PairLoad& l = *loads[i];
+        printf("shared port fpga=%d pairs=%d mismatches=%d failed=%d ", i, l.done, l.mismatches, l.failed);
+        fflush(stdout);
+        devs[i]->stats.print(std::cout);
+        errors += l.mismatches + l.failed + (l.done != pairs) + (devs[i]->stats.frames_other != 0);
+    }
+    printf("shared port ");
+    fflush(stdout);
+    port.stats.print(std::cout);
+    if (port.stats.unclaimed != 1) errors++;
+    return errors;
+}
+
+int main(int argc, char *argv[]) {
+    std::mt19937 rng(1);
+    int failed = check_wheel(rng);
+    failed += check_shared_port();
+
+    if (argc >= 4) {
+        int pairs = argc > 4 ? atoi(argv[4]) : 10000;
+        int depth = argc > 5 ? atoi(argv[5]) : 8;
+        try {
+            std::vector<std::string> macs;
+            std::stringstream list(argv[3]);
+            for (std::string m; std::getline(list, m, ','); ) macs.push_back(m);
+
+            Reactor reactor;
+            std::vector<std::unique_ptr<FPGAInterface>> fpgas;
+            std::vector<std::unique_ptr<FpgaDevice>> devs;
+            std::vector<std::unique_ptr<PairLoad>> loads;
+            for (size_t i = 0; i < macs.size(); i++) {
+                fpgas.emplace_back(new FPGAInterface(reactor.port(argv[1]), argv[2], macs[i]));
+                devs.emplace_back(new FpgaDevice(reactor, *fpgas[i]));
+                loads.emplace_back(new PairLoad(*devs[i], 1000 + i, pairs, depth));
+                loads[i]->start();
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            auto busy = [&] {
+                for (auto& d : devs) if (d->outstanding()) return true;
+                return false;
+            };
+            while (busy()) reactor.run_once();
+            double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            for (size_t i = 0; i < devs.size(); i++) {
+                PairLoad& l = *loads[i];
+                printf("fpga=%s pairs=%d mismatches=%d failed=%d ", macs[i].c_str(), l.done, l.mismatches, l.failed);
+                fflush(stdout);
+                devs[i]->stats.print(std::cout);
+                failed += l.mismatches + l.failed + (l.done != pairs);
+            }
+            uint64_t total = 0;
+            for (auto& l : loads) total += l->done;
+            printf("port ");
+            fflush(stdout);
+            reactor.port(argv[1]).stats.print(std::cout);
+            printf("%zu fpgas %.1f ms %.0f requests/s ", devs.size(), 1e3 * s, 2.0 * total / s);
+            fflush(stdout);
+            reactor.stats.print(std::cout);
+        } catch (const std::exception& e) {
+            fprintf(stderr, "%s\n", e.what());
+            return EXIT_FAILURE;
+        }
+    }
+    printf("%s\n", failed ? "FAIL" : "PASS");
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,344 @@
+/*  The allocation-free data path: checks FramePool (frame_pool.h) from several threads, every frame
+    handed out once and all of them back at the end, then counts the malloc calls of an FPGAInterface
+    in its steady state, which have to be none.  The malloc family is wrapped here, so operator new
+    and everything inside libstdc++ is counted too.  Each round does a sized WRITE and READ, an atomic,
+    16 sized WRITEs posted back to back (more than the credit window, so the send waits and keeps the
+    responses in pool frames), a request built, sent and completed in pool frames, and a
+    send_batch_wait_ack; 100 more rounds go with an 802.1Q tag.  Before that check_responses makes
+    sure only the FPGA's responses to our frames spend credits.  The same counts are then taken of the asynchronous paths on that link: an
+    FpgaDevice on a Reactor (reactor.h) and a SharedLink (shared_link.h), whose transport thread is
+    counted too, each round a sized WRITE and READ, an atomic and 16 WRITEs back to back.
+
+    Without an FPGA the link is a LoopbackLink (loopback_link.h), port 0 of ualink_turbo64 modelled
+    in process.
+
+compile - g++ -O2 -std=c++17 -pthread frame_pool.cpp packet.cpp ../util/checksum.cpp -o frame_pool
+./frame_pool [rounds] [<interface> <src_mac> <dst_mac>]
+
+  rounds : rounds counted, default 10000
+
+Note: AF_PACKET requires root/sudo privileges
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <iostream>
+#include <thread>
+#include "../include/frame_pool.h"
+#include "../include/loopback_link.h"
+#include "../include/shared_link.h"
+
+extern "C" {
+void* __libc_malloc(size_t);
+void* __libc_calloc(size_t, size_t);
+void* __libc_realloc(void*, size_t);
+void* __libc_memalign(size_t, size_t);
+void __libc_free(void*);
+}
+
+static std::atomic<bool> counting{false};
+static std::atomic<uint64_t> mallocs{0};
+
+extern "C" void* malloc (size_t n) {
+    if (counting.load(std::memory_order_relaxed)) mallocs++;
+    return __libc_malloc(n);
+}
+
+extern "C" void* calloc (size_t k, size_t n) {
+    if (counting.load(std::memory_order_relaxed)) mallocs++;
+    return __libc_calloc(k, n);
+}
+
+extern "C" void* realloc (void* p, size_t n) {
+    if (counting.load(std::memory_order_relaxed)) mallocs++;
+    return __libc_realloc(p, n);
+}
+
+extern "C" void* memalign (size_t align, size_t n) {
+    if (counting.load(std::memory_order_relaxed)) mallocs++;
+    return __libc_memalign(align, n);
+}
+
+extern "C" int posix_memalign (void** p, size_t align, size_t n) {
+    if (counting.load(std::memory_order_relaxed)) mallocs++;
+    *p = __libc_memalign(align, n);
+    return *p ? 0 : ENOMEM;
+}
+
+extern "C" void* aligned_alloc (size_t align, size_t n) {
+    return memalign(align, n);
+}
+
+extern "C" void free (void* p) {
+    __libc_free(p);
+}
+
+// threads take frames, share some through copies and give them all back, from each other's threads too
+static int check_pool (FramePool& pool) {
+    const int threads = 4, rounds = 2000;
+    std::atomic<int> errors{0};
+    std::vector<std::thread> pool_threads;
+    for (int t = 0; t < threads; t++) {
+        pool_threads.emplace_back([&, t] {
+            std::vector<FrameRef> held;
+            for (int r = 0; r < rounds; r++) {
+                int n = 1 + (r * 7 + t) % 100;
+                for (int k = 0; k < n; k++) {
+                    FrameRef f = pool.alloc();
+                    if (!f || f.use_count() != 1) {
+                        errors++;
+                        continue;
+                    }
+                    // a frame owned by one thread at a time: its first bytes say which
+                    uint32_t mark = static_cast<uint32_t>(t << 24 | r << 8 | k);
+                    memcpy(f.data(), &mark, 4);
+                    f.set_len(4);
+                    FrameRef copy = f;
+                    if (copy.use_count() != 2) errors++;
+                    held.push_back(std::move(copy));
+                }
+                for (auto& f : held) {
+                    uint32_t mark;
+                    memcpy(&mark, f.data(), 4);
+                    if ((mark >> 24) != static_cast<uint32_t>(t) || f.len() != 4 || f.use_count() != 1) errors++;
+                }
+                held.clear();
+            }
+        });
+    }
+    for (auto& th : pool_threads) th.join();
+    pool.flush_cache();
+    FramePool::Stats st = pool.stats();
+    printf("frame pool: %zu frames, %zu back, %d errors, ", pool.capacity(), pool.available(), errors.load());
+    fflush(stdout);
+    st.print(std::cout);
+    return errors + (pool.available() != pool.capacity()) + (st.exhausted != 0);
+}
+
+// LoopbackLink whose responses can be held back: frames sent while hold is set come back on release
+class HeldLink : public FrameLink {
+public:
+    LoopbackLink loop{4096};
+    bool hold = false;
+
+    bool send_frame (const uint8_t* p, int n) override {
+        if (!hold) return loop.send_frame(p, n);
+        held.emplace_back(p, p + n);
+        return true;
+    }
+
+    int recv_frame (uint8_t* buf, uint16_t cap, int timeout_ms) override {
+        return loop.recv_frame(buf, cap, timeout_ms);
+    }
+
+    void release () {
+        hold = false;
+        for (auto& f : held) loop.send_frame(f.data(), static_cast<int>(f.size()));
+        held.clear();
+    }
+
+private:
+    std::vector<std::vector<uint8_t>> held;
+};
+
+// Only our responses spend credits: frames of another FPGA and IPv4 frames that are no op, ahead of
+// the responses, neither answer a frame in flight nor fill the frame pool while a send waits for
+// credits, and a wait that times out loses its own frame, not the ones sent after it.
+static int check_responses () {
+    HeldLink link;
+    FramePool pool(64);
+    FPGAInterface fpga(link, "02:00:00:00:00:02", "02:00:00:00:00:01");
+    fpga.frame_pool = &pool;
+    fpga.ack_timeout_ms = 20;
+    int errors = 0;
+    uint8_t data[255] = {1, 2, 3};
+    errors += !fpga.remote_write_bytes(0, data, 8, 0);
+
+    ether other = fpga.eth_header();
+    other.dst[5] ^= 0x10;
+    uint8_t foreign[2][60];
+    FPGAInterface::atomic_request_frame(other, AtomicOp::FETCH_ADD, 0, 1, 0, foreign[0]);   // another FPGA's
+    FPGAInterface::ipv4_request_frame(fpga.eth_header(), 0x00, 60, foreign[1]);            // TOS 0, no op
+    auto flood = [&](int n) {
+        for (int i = 0; i < n; i++) link.loop.send_frame(foreign[i & 1], 60);
+    };
+
+    std::array<uint8_t,4> keys[16];
+    flood(4);
+    for (int k = 0; k < 2; k++) errors += !fpga.post_sized(2, 64 * k, data, 8, k, keys[k]);
+    errors += !fpga.wait_sized(keys[0], 0, 8, nullptr, 20);
+    errors += fpga.frames_in_flight() != 1;
+    errors += !fpga.wait_sized(keys[1], 64, 8, nullptr, 20);
+
+    // more foreign frames than the pool has, while the sends wait for credits
+    flood(2 * static_cast<int>(pool.capacity()));
+    for (int k = 0; k < 16; k++) errors += !fpga.post_sized(2, 256 * k, data, 255, k, keys[k]);
+    for (int k = 0; k < 16; k++) errors += !fpga.wait_sized(keys[k], 256 * k, 255, nullptr, 20);
+
+    // the first of two frames is not answered in time, the second is still in flight
+    link.hold = true;
+    for (int k = 0; k < 2; k++) errors += !fpga.post_sized(2, 64 * k, data, 8, 2 + k, keys[k]);
+    errors += fpga.wait_sized(keys[0], 0, 8, nullptr, 20);
+    errors += fpga.frames_in_flight() != 1;
+    link.release();
+    errors += !fpga.wait_sized(keys[1], 64, 8, nullptr, 20);
+
+    printf("responses: %zu in flight, %d errors, ", fpga.frames_in_flight(), errors);
+    fflush(stdout);
+    fpga.flow.print(std::cout);
+    return errors + (fpga.frames_in_flight() != 0) + (fpga.flow.lost != 1);
+}
+
+// one round of the FPGAInterface data path, false on a wrong or missing response
+static bool round_trip (FPGAInterface& fpga, uint32_t r) {
+    uint8_t wdata[255], rdata[255];
+    uint8_t n = static_cast<uint8_t>(1 + r % 200);
+    uint64_t addr = (r * 37) % (1024 - n);
+    for (int i = 0; i < n; i++) wdata[i] = static_cast<uint8_t>(r + i);
+    if (!fpga.remote_write_bytes(addr, wdata, n, 1)) return false;
+    if (!fpga.remote_read_bytes(addr, rdata, n, 2)) return false;
+    if (memcmp(wdata, rdata, n) != 0) return false;
+
+    uint64_t old;
+    if (!fpga.remote_atomic(AtomicOp::FETCH_ADD, 250, 1, 0, old)) return false;
+
+    std::array<uint8_t,4> keys[16];
+    for (int k = 0; k < 16; k++)
+        if (!fpga.post_sized(2, 1024 + 32 * k, wdata, 255 - k, static_cast<uint8_t>(k), keys[k])) return false;
+    for (int k = 0; k < 16; k++)
+        if (!fpga.wait_sized(keys[k], 1024 + 32 * k, 255 - k, nullptr, fpga.ack_timeout_ms)) return false;
+
+    FrameRef req = fpga.frames().alloc();
+    if (!req) return false;
+    req.set_len(FPGAInterface::sized_request_frame(fpga.eth_header(), 1, addr, nullptr, n, 3, req.data()));
+    if (!fpga.send_frame(req)) return false;
+    FrameRef rsp = fpga.recv_frame(fpga.read_timeout_ms);
+    std::array<uint8_t,4> key = FPGAInterface::sized_key(req.data());
+    if (!rsp || !FPGAInterface::sized_response_of(key, rsp.data())) return false;
+    if (memcmp(rsp.data() + 32 + (addr & 0x7), wdata, n) != 0) return false;
+
+    std::array<uint8_t,226> payloads[4] = {};
+    return fpga.send_batch_wait_ack(payloads, 4, 0, 2, 4);
+}
+
+// one round through an FpgaDevice, run on reactor until every request completed
+static bool device_round (Reactor& reactor, FpgaDevice& dev, uint32_t r) {
+    uint8_t wdata[255], rdata[255];
+    uint8_t n = static_cast<uint8_t>(1 + r % 200);
+    uint64_t addr = (r * 37) % (1024 - n);
+    for (int i = 0; i < n; i++) wdata[i] = static_cast<uint8_t>(r + i);
+    int pending = 19, bad = 0;
+    auto done = [&pending, &bad](FpgaDevice::Status s) {
+        bad += s != FpgaDevice::Status::OK;
+        pending--;
+    };
+    dev.write_bytes(addr, wdata, n, done);
+    dev.read_bytes(addr, rdata, n, done);
+    dev.atomic(AtomicOp::FETCH_ADD, 250, 1, 0, [&pending, &bad](FpgaDevice::Status s, uint64_t) {
+        bad += s != FpgaDevice::Status::OK;
+        pending--;
+    });
+    for (int k = 0; k < 16; k++) dev.write_bytes(1024 + 32 * k, wdata, static_cast<uint8_t>(255 - k), done);
+    while (pending > 0) reactor.run_once(std::chrono::milliseconds(10));
+    return bad == 0 && memcmp(wdata, rdata, n) == 0;
+}
+
+// one round through a SharedLink producer, polling until every request completed
+static bool shared_round (SharedLink::Producer& p, uint32_t r) {
+    uint8_t wdata[255], rdata[255];
+    uint8_t n = static_cast<uint8_t>(1 + r % 200);
+    uint64_t addr = (r * 37) % (1024 - n);
+    for (int i = 0; i < n; i++) wdata[i] = static_cast<uint8_t>(r + i);
+    if (!p.write(addr, wdata, n, 0)) return false;
+    if (!p.read(addr, rdata, n, 1)) return false;
+    if (!p.atomic(AtomicOp::FETCH_ADD, 250, 1, 0, 2)) return false;
+    for (int k = 0; k < 16; k++)
+        if (!p.write(1024 + 32 * k, wdata, static_cast<uint8_t>(255 - k), 3)) return false;
+    SharedLink::Completion c[19];
+    size_t got = 0;
+    int bad = 0;
+    while (got < 19) {
+        size_t k = p.poll(c, 19);
+        for (size_t i = 0; i < k; i++) bad += c[i].status != FpgaDevice::Status::OK;
+        got += k;
+        if (k == 0) std::this_thread::yield();
+    }
+    return bad == 0 && memcmp(wdata, rdata, n) == 0;
+}
+
+// rounds of one of the asynchronous paths after 100 to warm up, false when a round failed or the
+// counted ones allocated
+template <class Round>
+static bool count_async (const char* name, int rounds, Round round) {
+    for (uint32_t r = 0; r < 100; r++)
+        if (!round(r)) return false;
+    int bad = 0;
+    mallocs = 0;
+    auto start = std::chrono::steady_clock::now();
+    counting = true;
+    for (int r = 0; r < rounds; r++)
+        if (!round(100 + r)) bad++;
+    counting = false;
+    double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("%s: %d rounds, %d failed, %lu mallocs, %.0f rounds/s\n", name, rounds, bad,
+           (unsigned long)mallocs.load(), rounds / s);
+    return bad == 0 && mallocs == 0;
+}
+
+int main(int argc, char *argv[]) {
+    int rounds = argc > 1 ? atoi(argv[1]) : 10000;
+    int failed = 0;
+    try {
+        FramePool pool(4096);
+        failed += check_pool(pool);
+        failed += check_responses();
+
+        LoopbackLink loopback;
+        std::unique_ptr<FPGAInterface> fpga;
+        if (argc >= 5) fpga.reset(new FPGAInterface(argv[2], argv[3], argv[4]));
+        else fpga.reset(new FPGAInterface(loopback, "02:00:00:00:00:02", "02:00:00:00:00:01"));
+        fpga->frame_pool = &pool;
+
+        // the first rounds set up what stays: the credit sync, the queues at their high water marks
+        for (uint32_t r = 0; r < 100; r++)
+            if (!round_trip(*fpga, r)) failed++;
+
+        int bad = 0;
+        auto start = std::chrono::steady_clock::now();
+        counting = true;
+        for (int r = 0; r < rounds; r++)
+            if (!round_trip(*fpga, 100 + r)) bad++;
+        counting = false;
+        double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printf("data path: %d rounds, %d failed, %lu mallocs, %.0f rounds/s, ", rounds, bad,
+               (unsigned long)mallocs.load(), rounds / s);
+        fflush(stdout);
+        fpga->flow.print(std::cout);
+        failed += bad + (mallocs != 0) + (fpga->flow.credit_waits == 0);
+
+        // the same ops with an 802.1Q tag (traffic class 5), the IPv4 header 4 bytes later
+        fpga->set_traffic_class(5);
+        int bad_tagged = 0;
+        for (uint32_t r = 0; r < 100; r++)
+            if (!round_trip(*fpga, 1000000 + r)) bad_tagged++;
+        fpga->set_traffic_class(-1);
+        printf("tagged: 100 rounds, %d failed\n", bad_tagged);
+        failed += bad_tagged;
+
+        {
+            Reactor reactor;
+            FpgaDevice dev(reactor, *fpga);
+            failed += !count_async("FpgaDevice", rounds, [&](uint32_t r) { return device_round(reactor, dev, r); });
+        }
+        {
+            SharedLink link(*fpga);
+            SharedLink::Producer& p = link.producer();
+            failed += !count_async("SharedLink", rounds, [&](uint32_t r) { return shared_round(p, r); });
+        }
+    } catch (const std::exception& e) {
+        fprintf(stderr, "%s\n", e.what());
+        return EXIT_FAILURE;
+    }
+    printf("%s\n", failed ? "FAIL" : "PASS");
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,96 @@
+/*  Check the int8 tile kernels of gemm_dispatch.h against the scalar one (the 24-bit wrap of the FMA
+    engine included) and time them, then, given the FPGA, run GEMMs of growing size through
+    GemmDispatcher: one key=value line per decision and the dispatcher's totals at the end.  Every C is
+    checked against RemoteMem::gemm_int8_reference.
+
+compile - g++ -O2 -std=c++17 -pthread gemm_dispatch.cpp ../util/checksum.cpp -o gemm_dispatch
+sudo ./gemm_dispatch [<interface> <src_mac> <dst_mac>] [rounds]
+
+  rounds : passes over the sizes, default 3
+
+Note: AF_PACKET requires root/sudo privileges
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <iostream>
+#include <random>
+#include "../include/gemm_dispatch.h"
+
+int main(int argc, char *argv[]) {
+    std::mt19937 rng(1);
+    int failed = 0;
+
+    struct { const char* name; Int8TileKernel k; bool ok; } kernels[] = {
+        {"scalar", int8_tile_scalar, true},
+#ifdef GEMM_DISPATCH_X86
+        {"avx2", int8_tile_avx2, __builtin_cpu_supports("avx2") != 0},
+        {"avxvnni", int8_tile_avxvnni, __builtin_cpu_supports("avxvnni") != 0},
+        {"avx512vnni", int8_tile_avx512vnni, __builtin_cpu_supports("avx512vnni") && __builtin_cpu_supports("avx512vl")},
+#endif
+    };
+    const char* best;
+    best_tile_kernel(&best);
+    printf("tile kernel: %s\n", best);
+
+    // random tiles in strided matrices, C accumulated from near the 24-bit limit so it wraps
+    const size_t ld = 24;
+    std::vector<int8_t> a(8 * ld), b(8 * ld);
+    std::vector<int32_t> want(8 * ld), got(8 * ld);
+    for (auto& kern : kernels) {
+        if (!kern.ok) continue;
+        int errors = 0;
+        for (int t = 0; t < 2000; t++) {
+            for (auto& x : a) x = static_cast<int8_t>(rng());
+            for (auto& x : b) x = static_cast<int8_t>(rng());
+            for (auto& x : want) x = wrap24(static_cast<int32_t>(rng()) >> (t % 2 ? 8 : 12));
+            got = want;
+            bool acc = t % 3 != 0;
+            int8_tile_scalar(a.data(), ld, b.data(), ld, want.data(), ld, acc);
+            kern.k(a.data(), ld, b.data(), ld, got.data(), ld, acc);
+            if (got != want) errors++;
+        }
+        alignas(32) int32_t c[64] = {};
+        auto start = std::chrono::steady_clock::now();
+        const int n = 200000;
+        for (int t = 0; t < n; t++) kern.k(a.data(), ld, b.data(), ld, c, 8, true);
+        double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printf("%-11s %d errors  %.1f ns/tile  %.2f GMAC/s  (c[0] %d)\n", kern.name, errors, 1e9 * s / n,
+               512.0 * n / s / 1e9, c[0]);
+        failed += errors;
+    }
+
+    if (argc >= 4) {
+        int rounds = argc > 4 ? atoi(argv[4]) : 3;
+        try {
+            RemoteMem mem(argv[1], argv[2], argv[3]);
+            GemmDispatcher dispatch(&mem);
+            dispatch.sink = [](const GemmDecision& d) { d.print(std::cout); };
+            dispatch.calibrate();
+            dispatch.stats().print(std::cout);
+            const size_t sizes[][3] = {{8, 8, 8}, {16, 16, 16}, {32, 32, 32}, {64, 64, 64}, {128, 64, 128},
+                                       {128, 128, 128}, {256, 128, 256}, {512, 256, 512}};
+            for (int r = 0; r < rounds; r++) {
+                for (auto& sz : sizes) {
+                    size_t M = sz[0], N = sz[1], K = sz[2];
+                    std::vector<int8_t> A(M * K), B(K * N);
+                    std::vector<int32_t> C(M * N), ref(M * N);
+                    for (auto& x : A) x = static_cast<int8_t>(rng());
+                    for (auto& x : B) x = static_cast<int8_t>(rng());
+                    dispatch.gemm_int8(A.data(), B.data(), C.data(), M, N, K);
+                    RemoteMem::gemm_int8_reference(A.data(), B.data(), ref.data(), M, N, K);
+                    if (C != ref) {
+                        fprintf(stderr, "%zux%zux%zu: C differs from the CPU reference\n", M, N, K);
+                        failed++;
+                    }
+                }
+            }
+            dispatch.stats().print(std::cout);
+        } catch (const std::exception& e) {
+            fprintf(stderr, "%s\n", e.what());
+            return EXIT_FAILURE;
+        }
+    }
+    printf("%s\n", failed ? "FAIL" : "PASS");
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,389 @@
+/*  Tiered memcached UDP proxy (kv_proxy.h): the hot keys answered from the FPGA, placed with the KV
+    engine's SETs (kv) or written into DPMEM slots with sized UALink requests (raw), everything else
+    from memcached.  Prints the hit rate and latency of both tiers every report_s seconds.
+
+    Without arguments it checks itself in process against a software memcached and a software FPGA:
+    for the KV engine SoftMemcached with kv_hash_index's limits, for raw slots a LoopbackLink.  A
+    zipf load with 5% sets has to read back every value as last stored, find its hot keys on the
+    FPGA after a few epochs, never place the ones that do not fit (flags, 100 byte values) and, with
+    raw slots, move to a new hot set when the load shifts.  The KV engine cannot delete, so there it
+    has to keep the keys it has and leave the new hot set in memcached.  Binary gets and multi-gets
+    go last.
+
+compile - g++ -O2 -std=c++17 kv_proxy.cpp packet.cpp ../util/checksum.cpp -o kv_proxy
+./kv_proxy [check <memcached_ip> <memcached_port>]
+./kv_proxy <port> <memcached_ip> <memcached_port> <fpga> [key=value ...]
+
+  check : the self check against a local memcached (memcached -u nobody -m 64 -U 11211)
+  fpga  : kv,<fpga_ip>,<fpga_port>               the KV engine over UDP
+          kv-packet,<interface>,<src_ip>,<fpga_ip>  the KV engine over AF_PACKET, port 11211
+          raw,<interface>,<src_mac>,<dst_mac>      DPMEM slots over UALink
+          soft-kv, soft-raw                       the software FPGAs of the self check
+  keys  : epoch_ms (100), min_heat (2), max_moves (64), timeout_ms (100), slot_bytes (64), report_s (10)
+
+Note: AF_PACKET requires root/sudo privileges
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include "../include/kv_proxy.h"
+#include "../include/loopback_link.h"
+
+static std::vector<std::string> split (const std::string& s, char sep) {
+    std::vector<std::string> parts;
+    std::stringstream ss(s);
+    for (std::string p; std::getline(ss, p, sep);) parts.push_back(p);
+    return parts;
+}
+
+// The FPGA of a spec, with what it runs on: the stand-ins, the UDP or raw socket, the FPGAInterface.
+struct FpgaTier {
+    std::unique_ptr<SoftMemcached> soft_kv;
+    std::unique_ptr<LoopbackLink> loopback;
+    std::unique_ptr<MemcachedUdpClient> kv_client;
+    std::unique_ptr<FPGAInterface> fpga;
+    std::unique_ptr<FpgaDevice> device;
+    std::unique_ptr<HotTier> tier;
+
+    FpgaTier (Reactor& reactor, const std::string& spec, size_t slot_bytes) {
+        std::vector<std::string> a = split(spec, ',');
+        if (a[0] == "soft-kv" || (a[0] == "kv" && a.size() == 3)) {
+            std::string ip = "127.0.0.1";
+            int port;
+            if (a[0] == "soft-kv") {
+                soft_kv.reset(new SoftMemcached(reactor, SoftMemcached::fpga_kv()));
+                port = soft_kv->port();
+            } else {
+                ip = a[1];
+                port = atoi(a[2].c_str());
+            }
+            kv_client.reset(new MemcachedUdpClient(ip, port, 16));
+            tier.reset(new KvHotTier(reactor, *kv_client));
+        } else if (a[0] == "kv-packet" && a.size() == 4) {
+            kv_client.reset(new MemcachedUdpClient(a[1], a[2], a[3], 11211, 40000, 16));
+            tier.reset(new KvHotTier(reactor, *kv_client));
+        } else if (a[0] == "soft-raw" || (a[0] == "raw" && a.size() == 4)) {
+            if (a[0] == "soft-raw") {
+                loopback.reset(new LoopbackLink);
+                fpga.reset(new FPGAInterface(*loopback, "02:00:00:00:00:02", "02:00:00:00:00:01"));
+            } else {
+                fpga.reset(new FPGAInterface(a[1], a[2], a[3]));
+            }
+            device.reset(new FpgaDevice(reactor, *fpga));
+            tier.reset(new RawHotTier(*device, slot_bytes));
+        } else {
+            throw std::runtime_error("unknown FPGA " + spec);
+        }
+    }
+};
+
+static bool set_key (TieredKvProxy::Config& c, size_t& slot_bytes, int& report_s, const std::string& kv) {
+    size_t eq = kv.find('=');
+    if (eq == std::string::npos) return false;
+    std::string k = kv.substr(0, eq);
+    double v = atof(kv.c_str() + eq + 1);
+    if (k == "epoch_ms") c.epoch = std::chrono::milliseconds(static_cast<int64_t>(v));
+    else if (k == "min_heat") c.min_heat = v;
+    else if (k == "max_moves") c.max_moves = static_cast<size_t>(v);
+    else if (k == "timeout_ms") c.timeout_ns = static_cast<uint64_t>(v * 1e6);
+    else if (k == "slot_bytes") slot_bytes = static_cast<size_t>(v);
+    else if (k == "report_s") report_s = static_cast<int>(v);
+    else return false;
+    return true;
+}
+
+// A client of the proxy keeping window requests in flight, GETs of zipf keys and a share of SETs,
+// every value it reads checked against the last one it stored.  Keys i % 50 == 7 carry flags and
+// keys i % 50 == 13 100 byte values, neither can go to the FPGA.
+class Load {
+public:
+    static constexpr int KEYS = 1000;
+
+    Load (Reactor& r, uint16_t port, MemcProtocol protocol, const std::string& prefix) :
+    reactor(r), client("127.0.0.1", port, 256), chooser(KEYS, KeyChooser::ZIPF, 0.99), rng(11),
+    gen(KEYS, 0), in_flight_sets(KEYS, 0) {
+        client.protocol = protocol;
+        for (int i = 0; i < KEYS; i++) keys.push_back(prefix + std::to_string(i));
+        reactor.watch(client.socket_fd(), [this] { client.poll(0); });
+    }
+
+    ~Load () {
+        reactor.unwatch(client.socket_fd());
+    }
+
+    static bool unplaceable (int i) {
+        return i % 50 == 7 || i % 50 == 13;
+    }
+
+    std::string value (int i) const {
+        std::string v = "v" + std::to_string(i) + ":" + std::to_string(gen[i]) + ":";
+        size_t size = i % 50 == 13 ? 100 : 12 + (i * 7) % 50;
+        while (v.size() < size) v += static_cast<char>('a' + (v.size() + i) % 26);
+        return v;
+    }
+
+    // every key stored once
+    bool preload (int window = 32) {
+        int next = 0;
+        on_done = [&] {
+            while (next < KEYS && outstanding < window) set(next++);
+            client.flush();
+        };
+        on_done();
+        bool ok = drain();
+        on_done = nullptr;
+        return ok;
+    }
+
+    // ops GETs and SETs, the keys shifted by offset ranks
+    bool run (int ops, double set_ratio, int offset, int window = 32) {
+        int issued = 0;
+        std::function<void()> refill = [&] {
+            while (issued < ops && outstanding < window) {
+                int i = static_cast<int>((chooser.next(rng) + offset) % KEYS);
+                if (std::uniform_real_distribution<double>(0, 1)(rng) < set_ratio) set(i);
+                else get(i);
+                issued++;
+            }
+            client.flush();
+        };
+        on_done = refill;
+        refill();
+        bool ok = drain();
+        on_done = nullptr;
+        return ok;
+    }
+
+    // a get of keys, a multi-get when there are several, the values the ones truth stored last
+    void multi_get (const std::vector<int>& idx, const Load& truth) {
+        std::vector<std::string_view> ks;
+        std::vector<std::string> want;
+        for (int i : idx) {
+            ks.push_back(keys[i]);
+            want.push_back(truth.value(i));
+        }
+        outstanding++;
+        std::vector<int> ids = idx;
+        bool sent = client.get(ks, [this, ids, want](const MemcResponse& r) {
+            outstanding--;
+            if (r.status != MemcStatus::VALUES || r.num_values != ids.size()) {
+                errors++;
+            } else {
+                for (size_t k = 0; k < ids.size(); k++) {
+                    // binary single gets carry no key, their values come in order
+                    bool key_ok = r.values[k].key.empty() || r.values[k].key == keys[ids[k]];
+                    if (!key_ok || (!want[k].empty() && r.values[k].data != want[k])) wrong++;
+                }
+            }
+            done++;
+        });
+        if (!sent) {
+            outstanding--;
+            errors++;
+        }
+        client.flush();
+    }
+
+    bool drain () {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+        while (outstanding && std::chrono::steady_clock::now() < deadline) {
+            reactor.run_once(std::chrono::milliseconds(1));
+            client.expire(1000000000);
+        }
+        return outstanding == 0;
+    }
+
+    uint64_t wrong = 0, errors = 0, done = 0;
+    std::vector<std::string> keys;
+
+private:
+    Reactor& reactor;
+    MemcachedUdpClient client;
+    KeyChooser chooser;
+    std::mt19937_64 rng;
+    std::vector<uint32_t> gen;
+    std::vector<int> in_flight_sets;
+    int outstanding = 0;
+    std::function<void()> on_done;
+
+    void get (int i) {
+        // a value stored while the get is in flight may come back either way
+        std::string want = in_flight_sets[i] ? std::string() : value(i);
+        outstanding++;
+        bool sent = client.get(keys[i], [this, i, want](const MemcResponse& r) {
+            outstanding--;
+            if (r.status != MemcStatus::VALUES || r.num_values != 1) errors++;
+            else if (!want.empty() && r.values[0].data != want) wrong++;
+            else if (r.values[0].flags != (i % 50 == 7 ? 5u : 0u)) wrong++;
+            done++;
+            if (on_done) on_done();
+        });
+        if (!sent) {
+            outstanding--;
+            errors++;
+        }
+    }
+
+    void set (int i) {
+        gen[i]++;
+        in_flight_sets[i]++;
+        outstanding++;
+        bool sent = client.set(keys[i], value(i), [this, i](const MemcResponse& r) {
+            outstanding--;
+            in_flight_sets[i]--;
+            if (r.status != MemcStatus::STORED) errors++;
+            done++;
+            if (on_done) on_done();
+        }, i % 50 == 7 ? 5 : 0);
+        if (!sent) {
+            outstanding--;
+            in_flight_sets[i]--;
+            errors++;
+        }
+    }
+};
+
+static int check (bool ok, const char* what) {
+    printf("  %s: %s\n", what, ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
+
+// the proxy over fpga, memcached at ip:port or in process
+static int check_tier (const std::string& fpga, const std::string& ip, int port) {
+    printf("%s\n", fpga.c_str());
+    Reactor reactor;
+    std::unique_ptr<SoftMemcached> soft;
+    if (port == 0) {
+        soft.reset(new SoftMemcached(reactor));
+        port = soft->port();
+    }
+    MemcachedUdpClient memcached(ip, port, 4096);
+    FpgaTier tier(reactor, fpga, 64);
+    TieredKvProxy::Config cfg;
+    cfg.ip = "127.0.0.1";
+    cfg.port = 0;
+    cfg.epoch = std::chrono::milliseconds(20);
+    TieredKvProxy proxy(reactor, memcached, *tier.tier, cfg);
+    Load load(reactor, proxy.port(), MemcProtocol::ASCII, fpga + ":");
+
+    int failed = 0;
+    failed += check(load.preload(), "preload");
+    load.run(20000, 0.05, 0);
+
+    // with the hot set placed, a share of the GETs the top keys of the zipf make up
+    auto share = [&] (uint64_t hits0, uint64_t keys0) {
+        return double(proxy.stats.hot_hits - hits0) / std::max<uint64_t>(1, proxy.stats.get_keys - keys0);
+    };
+    uint64_t h0 = proxy.stats.hot_hits, k0 = proxy.stats.get_keys;
+    failed += check(load.run(20000, 0.05, 0), "zipf load");
+    double hot_share = share(h0, k0);
+    printf("  %.1f%% of the GETs from the FPGA, %zu keys resident\n", 100 * hot_share, proxy.residents());
+    failed += check(hot_share > 0.25, "hot set on the FPGA");
+
+    bool placed_any = false;
+    for (int i = 0; i < Load::KEYS; i++) {
+        if (Load::unplaceable(i)) placed_any |= proxy.resident(load.keys[i]);
+    }
+    failed += check(!placed_any, "flags and large values stay in memcached");
+
+    // the hot set moves half the key space over
+    KvHotTier* kv = dynamic_cast<KvHotTier*>(tier.tier.get());
+    size_t indexed0 = kv ? kv->indexed_keys() : 0;
+    uint64_t demotions0 = proxy.stats.demotions;
+    load.run(20000, 0.05, Load::KEYS / 2);
+    h0 = proxy.stats.hot_hits;
+    k0 = proxy.stats.get_keys;
+    failed += check(load.run(20000, 0.05, Load::KEYS / 2), "shifted zipf load");
+    double shifted_share = share(h0, k0);
+    printf("  after the shift %.1f%% from the FPGA, %lu demotions\n", 100 * shifted_share,
+           (unsigned long)(proxy.stats.demotions - demotions0));
+    if (fpga == "soft-raw") {
+        failed += check(shifted_share > 0.25 && proxy.stats.demotions > demotions0, "new hot set placed");
+    }
+    if (kv) {
+        // nothing to delete with: the keys indexed before the shift stay, the room left over (bucket
+        // collisions refuse a few SETs) is all the new hot set can get
+        printf("  %zu keys indexed, %zu before the shift\n", kv->indexed_keys(), indexed0);
+        failed += check(indexed0 > 0 && kv->indexed_keys() >= indexed0 && kv->indexed_keys() <= kv->capacity() &&
+                        proxy.stats.demotions == demotions0 &&
+                        shifted_share < 0.25, "full KV index keeps its keys, new hot set stays in memcached");
+    }
+
+    // the same keys through the binary protocol, single gets and GETKQ multi-gets
+    {
+        Load bin(reactor, proxy.port(), MemcProtocol::BINARY, fpga + ":");
+        for (int i = 0; i < 200; i++) {
+            std::vector<int> idx = {i * 7 % Load::KEYS};
+            if (i % 4 == 0) idx = {i % Load::KEYS, (i * 13 + 1) % Load::KEYS, (i * 31 + 2) % Load::KEYS};
+            bin.multi_get(idx, load);
+        }
+        bool drained = bin.drain();
+        failed += check(drained && bin.errors == 0 && bin.wrong == 0, "binary gets and multi-gets");
+    }
+    failed += check(load.wrong == 0 && load.errors == 0, "every value as last stored");
+    if (load.wrong || load.errors) printf("  %lu wrong, %lu errors\n", (unsigned long)load.wrong, (unsigned long)load.errors);
+
+    proxy.report(std::cout);
+    if (soft) {
+        printf("memcached: ");
+        fflush(stdout);
+        soft->stats.print(std::cout);
+    }
+    if (tier.soft_kv) {
+        printf("fpga kv: ");
+        fflush(stdout);
+        tier.soft_kv->stats.print(std::cout);
+    }
+    return failed;
+}
+
+static int serve (int argc, char* argv[]) {
+    TieredKvProxy::Config cfg;
+    cfg.port = static_cast<uint16_t>(atoi(argv[1]));
+    size_t slot_bytes = 64;
+    int report_s = 10;
+    for (int i = 5; i < argc; i++) {
+        if (!set_key(cfg, slot_bytes, report_s, argv[i])) {
+            fprintf(stderr, "unknown setting %s\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+    }
+    Reactor reactor;
+    MemcachedUdpClient memcached(argv[2], atoi(argv[3]), 4096);
+    FpgaTier tier(reactor, argv[4], slot_bytes);
+    TieredKvProxy proxy(reactor, memcached, *tier.tier, cfg);
+    printf("serving on port %u, %s in front of memcached %s:%s\n", proxy.port(), tier.tier->name(), argv[2], argv[3]);
+    fflush(stdout);
+    WheelTimer report;
+    report.fire = [&] {
+        proxy.report(std::cout);
+        std::cout.flush();
+        reactor.schedule(report, std::chrono::seconds(report_s));
+    };
+    reactor.schedule(report, std::chrono::seconds(report_s));
+    reactor.run();
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char *argv[]) {
+    try {
+        if (argc == 1 || std::string(argv[1]) == "check") {
+            std::string ip = argc >= 4 ? argv[2] : "127.0.0.1";
+            int port = argc >= 4 ? atoi(argv[3]) : 0;
+            int failed = check_tier("soft-kv", ip, port) + check_tier("soft-raw", ip, port);
+            printf("%s\n", failed ? "FAIL" : "PASS");
+            return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+        }
+        if (argc < 5) {
+            fprintf(stderr, "%s <port> <memcached_ip> <memcached_port> <fpga> [key=value ...]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+        return serve(argc, argv);
+    } catch (const std::exception& e) {
+        fprintf(stderr, "%s\n", e.what());
+        return EXIT_FAILURE;
+    }
+}
@@ -0,0 +1,388 @@
+/*  Open-loop memcached UDP load generator (mutilate / memtier style)
+    Built on MemcachedUdpClient, for sizing the FPGA KV path against software memcached.
+
+compile - g++ -O2 -std=c++17 -pthread memcached_loadgen.cpp -o memcached_loadgen
+on one terminal run memcached -u nobody -m 1024 -U 11211 -t 4
+on second terminal run ./memcached_loadgen 127.0.0.1 11211 --threads 4 --qps 200000 --dist zipf
+or over raw sockets sudo ./memcached_loadgen 127.0.0.1 11211 --packet lo 127.0.0.1 --qps 50000
+
+Options (defaults in brackets):
+  --threads N        client threads, each with its own socket and request_id space [1]
+  --qps Q            total target rate, Poisson arrivals; 0 = closed loop, keep the window full [0]
+  --duration S       measured seconds [10]
+  --keys N           key space [100000]
+  --key-size B       bytes per key [16]
+  --dist D           uniform | zipf[:theta] | hot[:fraction[:probability]] [uniform]
+  --value V          value bytes: 64 | min:max | etc (Facebook ETC sizes) [64]
+  --get-ratio R      fraction of gets, the rest are sets [0.9]
+  --window W         max requests in flight per thread [1024]
+  --timeout-ms T     requests older than this count as timeouts, at their age in the latencies [200]
+  --no-preload       skip storing every key before the run
+  --backend B        mmsg | uring | sqpoll (AF_INET only) [mmsg]
+  --packet IF SRC_IP use AF_PACKET on interface IF with source address SRC_IP (needs root)
+  --binary           memcached binary protocol instead of ASCII
+
+Latency is measured from each request's scheduled send time, so a backlog on
+the client or a server stall is reported instead of hidden.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../include/memcached_client.h"
+#include "../include/memcached_loadgen.h"
+
+struct Config {
+    std::string server_ip;
+    int port = 11211;
+    int threads = 1;
+    double qps = 0;
+    double duration_s = 10;
+    uint64_t keys = 100000;
+    int key_size = 16;
+    KeyChooser::Dist dist = KeyChooser::UNIFORM;
+    double dist_param = 0.99;
+    double hot_prob = 0.9;
+    std::string value_spec = "64";
+    double get_ratio = 0.9;
+    int window = 1024;
+    uint64_t timeout_ns = 200000000ull;
+    bool preload = true;
+    MemcBackend backend = MemcBackend::MMSG;
+    std::string packet_if;
+    std::string packet_src_ip;
+    MemcProtocol protocol = MemcProtocol::ASCII;
+};
+
+struct ThreadResult {
+    LatencyHistogram get_lat;
+    LatencyHistogram set_lat;
+    uint64_t issued = 0;
+    uint64_t hits = 0, misses = 0, stored = 0, errors = 0, timeouts = 0;
+    uint64_t max_lag_ns = 0;      // how far sends fell behind the schedule
+    uint64_t preloaded = 0;
+    MemcachedUdpClient::Stats client;
+    MemcBackend backend = MemcBackend::MMSG;
+};
+
+struct Shared {
+    const Config* cfg;
+    std::unique_ptr<KeyChooser> chooser;   // copied per thread, zipf setup runs once
+    std::vector<char> key_buf;     // keys * key_size, fixed width, no terminators
+    std::string value_buf;
+    std::atomic<int> ready{0};
+    std::atomic<bool> go{false};
+    uint64_t start_ns = 0;
+
+    std::string_view key (uint64_t i) const {
+        return std::string_view(key_buf.data() + i * cfg->key_size, cfg->key_size);
+    }
+};
+
+static std::unique_ptr<MemcachedUdpClient> make_client (const Config& cfg, int t) {
+    if (!cfg.packet_if.empty()) {
+        // one source port per thread keeps the request_id spaces apart on the wire
+        uint16_t src_port = (uint16_t)(40000 + (getpid() % 1000) * 16 + t);
+        return std::unique_ptr<MemcachedUdpClient>(new MemcachedUdpClient(
+            cfg.packet_if, cfg.packet_src_ip, cfg.server_ip, cfg.port, src_port, cfg.window));
+    }
+    return std::unique_ptr<MemcachedUdpClient>(new MemcachedUdpClient(
+        cfg.server_ip, cfg.port, cfg.window, cfg.backend));
+}
+
+static void run_thread (Shared& sh, int t, ThreadResult& res) {
+    const Config& cfg = *sh.cfg;
+    std::mt19937_64 rng(0x9E3779B97F4A7C15ull * (t + 1));
+    KeyChooser chooser = *sh.chooser;
+    ValueSizer sizer = ValueSizer::parse(cfg.value_spec,
+        (uint32_t)(MemcachedUdpClient::MAX_DGRAM - sizeof(memc_udp_header) - cfg.key_size - 64));
+    std::unique_ptr<MemcachedUdpClient> client;
+    try {
+        client = make_client(cfg, t);
+    } catch (const std::exception& e) {
+        fprintf(stderr, "thread %d: %s\n", t, e.what());
+        sh.ready++;
+        return;
+    }
+    res.backend = client->backend;
+    client->protocol = cfg.protocol;
+
+    // preload this thread's slice of the key space, closed loop
+    if (cfg.preload) {
+        uint64_t lo = cfg.keys * t / cfg.threads, hi = cfg.keys * (t + 1) / cfg.threads;
+        for (uint64_t k = lo; k < hi; k++) {
+            std::string_view v(sh.value_buf.data(), sizer.next(rng));
+            while (!client->set(sh.key(k), v, [&res](const MemcResponse& r) {
+                       if (r.status == MemcStatus::STORED) res.preloaded++;
+                   })) {
+                client->poll(1);
+                client->expire(cfg.timeout_ns);
+            }
+        }
+        while (client->in_flight()) {
+            if (client->poll(10) == 0) client->expire(cfg.timeout_ns);
+        }
+        client->stats = MemcachedUdpClient::Stats();
+    }
+
+    sh.ready++;
+    while (!sh.go.load(std::memory_order_acquire)) std::this_thread::yield();
+
+    const uint64_t start = sh.start_ns;
+    const uint64_t end = start + (uint64_t)(cfg.duration_s * 1e9);
+    ArrivalClock clock(cfg.qps / cfg.threads, start);
+
+    // the callback only sees its own scheduled time, everything else is per thread.  A timeout is
+    // recorded too, at its age (the timeout or more), or the slowest requests would be missing from
+    // the tail exactly when the server is overloaded
+    auto on_get = [&res](uint64_t intended, const MemcResponse& r) {
+        res.get_lat.record(memc_now_ns() - intended);
+        if (r.status == MemcStatus::TIMEOUT) {
+            res.timeouts++;
+            return;
+        }
+        if (r.status != MemcStatus::VALUES) {
+            res.errors++;
+        } else if (r.num_values) {
+            res.hits++;
+        } else {
+            res.misses++;
+        }
+    };
+    auto on_set = [&res](uint64_t intended, const MemcResponse& r) {
+        res.set_lat.record(memc_now_ns() - intended);
+        if (r.status == MemcStatus::TIMEOUT) {
+            res.timeouts++;
+            return;
+        }
+        if (r.status == MemcStatus::STORED) {
+            res.stored++;
+        } else {
+            res.errors++;
+        }
+    };
+
+    uint64_t now = memc_now_ns();
+    while (now < start) now = memc_now_ns();
+    while (now < end) {
+        while (client->can_submit() && (clock.peek() <= now || !clock.is_open_loop())) {
+            uint64_t intended = clock.is_open_loop() ? clock.advance(rng) : now;
+            if (intended >= end) break;
+            if (now - intended > res.max_lag_ns) res.max_lag_ns = now - intended;
+            std::string_view key = sh.key(chooser.next(rng));
+            bool ok;
+            if (std::uniform_real_distribution<double>(0.0, 1.0)(rng) < cfg.get_ratio) {
+                ok = client->get(key, [&on_get, intended](const MemcResponse& r) { on_get(intended, r); });
+            } else {
+                std::string_view v(sh.value_buf.data(), sizer.next(rng));
+                ok = client->set(key, v, [&on_set, intended](const MemcResponse& r) { on_set(intended, r); });
+            }
+            if (!ok) break;
+            res.issued++;
+        }
+        // spin while the next arrival is close, otherwise let poll() sleep
+        int wait_ms = 0;
+        if (clock.is_open_loop() && clock.peek() > now + 2000000ull) wait_ms = 1;
+        if (client->poll(wait_ms) == 0) client->expire(cfg.timeout_ns);
+        now = memc_now_ns();
+    }
+
+    // let the tail drain, anything still missing after the timeout is a timeout, recorded by the
+    // callbacks at its age like the ones expired above
+    uint64_t drain_end = memc_now_ns() + cfg.timeout_ns;
+    while (client->in_flight() && memc_now_ns() < drain_end) {
+        client->poll(1);
+    }
+    client->expire(0);
+    res.client = client->stats;
+}
+
+static bool parse_dist (const char* s, Config& cfg) {
+    std::string d(s);
+    std::vector<std::string> f;
+    size_t pos = 0;
+    while (true) {
+        size_t c = d.find(':', pos);
+        f.push_back(d.substr(pos, c - pos));
+        if (c == std::string::npos) break;
+        pos = c + 1;
+    }
+    if (f[0] == "uniform") {
+        cfg.dist = KeyChooser::UNIFORM;
+    } else if (f[0] == "zipf") {
+        cfg.dist = KeyChooser::ZIPF;
+        cfg.dist_param = f.size() > 1 ? atof(f[1].c_str()) : 0.99;
+    } else if (f[0] == "hot") {
+        cfg.dist = KeyChooser::HOTSET;
+        cfg.dist_param = f.size() > 1 ? atof(f[1].c_str()) : 0.01;
+        cfg.hot_prob = f.size() > 2 ? atof(f[2].c_str()) : 0.9;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static void print_latency (const char* name, const LatencyHistogram& h) {
+    if (h.count() == 0) return;
+    printf("%s latency us (%llu): avg %.1f p50 %.1f p90 %.1f p99 %.1f p99.9 %.1f p99.99 %.1f max %.1f\n",
+           name, (unsigned long long)h.count(), h.mean() / 1000.0,
+           h.percentile(0.50) / 1000.0, h.percentile(0.90) / 1000.0,
+           h.percentile(0.99) / 1000.0, h.percentile(0.999) / 1000.0,
+           h.percentile(0.9999) / 1000.0, h.max() / 1000.0);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        fprintf(stderr,
+            "Usage:\n"
+            "  %s <server_ip> <port> [--threads N] [--qps Q] [--duration S] [--keys N]\n"
+            "     [--key-size B] [--dist uniform|zipf[:theta]|hot[:fraction[:prob]]]\n"
+            "     [--value 64|min:max|etc] [--get-ratio R] [--window W] [--timeout-ms T]\n"
+            "     [--no-preload] [--backend mmsg|uring|sqpoll] [--packet <if> <src_ip>]\n"
+            "     [--binary]\n",
+            argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    Config cfg;
+    cfg.server_ip = argv[1];
+    cfg.port = atoi(argv[2]);
+    for (int i = 3; i < argc; i++) {
+        const char* a = argv[i];
+        bool has = i + 1 < argc;
+        if (strcmp(a, "--threads") == 0 && has) {
+            cfg.threads = atoi(argv[++i]);
+        } else if (strcmp(a, "--qps") == 0 && has) {
+            cfg.qps = atof(argv[++i]);
+        } else if (strcmp(a, "--duration") == 0 && has) {
+            cfg.duration_s = atof(argv[++i]);
+        } else if (strcmp(a, "--keys") == 0 && has) {
+            cfg.keys = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(a, "--key-size") == 0 && has) {
+            cfg.key_size = atoi(argv[++i]);
+        } else if (strcmp(a, "--dist") == 0 && has) {
+            if (!parse_dist(argv[++i], cfg)) {
+                fprintf(stderr, "Unknown key distribution '%s'\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(a, "--value") == 0 && has) {
+            cfg.value_spec = argv[++i];
+        } else if (strcmp(a, "--get-ratio") == 0 && has) {
+            cfg.get_ratio = atof(argv[++i]);
+        } else if (strcmp(a, "--window") == 0 && has) {
+            cfg.window = atoi(argv[++i]);
+        } else if (strcmp(a, "--timeout-ms") == 0 && has) {
+            cfg.timeout_ns = strtoull(argv[++i], NULL, 10) * 1000000ull;
+        } else if (strcmp(a, "--no-preload") == 0) {
+            cfg.preload = false;
+        } else if (strcmp(a, "--backend") == 0 && has) {
+            const char* b = argv[++i];
+            if (strcmp(b, "uring") == 0) {
+                cfg.backend = MemcBackend::URING;
+            } else if (strcmp(b, "sqpoll") == 0) {
+                cfg.backend = MemcBackend::URING_SQPOLL;
+            } else if (strcmp(b, "mmsg") != 0) {
+                fprintf(stderr, "Unknown backend '%s', use mmsg, uring or sqpoll\n", b);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(a, "--packet") == 0 && i + 2 < argc) {
+            cfg.packet_if = argv[++i];
+            cfg.packet_src_ip = argv[++i];
+        } else if (strcmp(a, "--binary") == 0) {
+            cfg.protocol = MemcProtocol::BINARY;
+        } else {
+            fprintf(stderr, "Unknown or incomplete option '%s'\n", a);
+            return EXIT_FAILURE;
+        }
+    }
+    if (cfg.threads < 1 || cfg.window < 1 || cfg.keys == 0 || cfg.duration_s <= 0 ||
+        cfg.key_size < 4 || cfg.key_size > 250 || cfg.get_ratio < 0 || cfg.get_ratio > 1) {
+        fprintf(stderr, "Invalid option value (threads/window/keys >= 1, key-size 4..250, get-ratio 0..1)\n");
+        return EXIT_FAILURE;
+    }
+
+    Shared sh;
+    sh.cfg = &cfg;
+    if (cfg.dist == KeyChooser::ZIPF) {
+        printf("Building zipf(%.2f) over %llu keys\n", cfg.dist_param, (unsigned long long)cfg.keys);
+    }
+    try {
+        // fixed width keys "k000...123", zipf/hot-set ranks index straight into this
+        sh.key_buf.resize(cfg.keys * cfg.key_size);
+        char tmp[32];
+        for (uint64_t k = 0; k < cfg.keys; k++) {
+            char* p = sh.key_buf.data() + k * cfg.key_size;
+            memset(p, '0', cfg.key_size);
+            p[0] = 'k';
+            int n = snprintf(tmp, sizeof(tmp), "%llu", (unsigned long long)k);
+            int copy = std::min(n, cfg.key_size - 1);
+            memcpy(p + cfg.key_size - copy, tmp + n - copy, copy);
+        }
+        ValueSizer probe = ValueSizer::parse(cfg.value_spec, MemcachedUdpClient::MAX_DGRAM);
+        sh.value_buf.assign(std::max<uint32_t>(probe.max(), 1), 'v');
+        sh.chooser.reset(new KeyChooser(cfg.keys, cfg.dist, cfg.dist_param, cfg.hot_prob));
+    } catch (const std::exception& e) {
+        fprintf(stderr, "%s\n", e.what());
+        return EXIT_FAILURE;
+    }
+
+    printf("Target %s:%d over %s, %d thread(s), %s\n",
+           cfg.server_ip.c_str(), cfg.port, cfg.packet_if.empty() ? "AF_INET" : "AF_PACKET",
+           cfg.threads, cfg.qps > 0 ? "open loop" : "closed loop");
+
+    std::vector<ThreadResult> results(cfg.threads);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < cfg.threads; t++) {
+        threads.emplace_back(run_thread, std::ref(sh), t, std::ref(results[t]));
+    }
+    while (sh.ready.load() < cfg.threads) usleep(1000);
+    sh.start_ns = memc_now_ns() + 1000000ull;
+    sh.go.store(true, std::memory_order_release);
+    for (auto& th : threads) th.join();
+
+    ThreadResult total;
+    uint64_t completed = 0, stale = 0, send_errors = 0;
+    for (const ThreadResult& r : results) {
+        total.get_lat.merge(r.get_lat);
+        total.set_lat.merge(r.set_lat);
+        total.issued += r.issued;
+        total.hits += r.hits;
+        total.misses += r.misses;
+        total.stored += r.stored;
+        total.errors += r.errors;
+        total.timeouts += r.timeouts;
+        total.preloaded += r.preloaded;
+        total.max_lag_ns = std::max(total.max_lag_ns, r.max_lag_ns);
+        completed += r.client.completed;
+        stale += r.client.stale;
+        send_errors += r.client.send_errors;
+    }
+
+    printf("Backend: %s, %s protocol\n", memc_backend_name(results[0].backend),
+           cfg.protocol == MemcProtocol::BINARY ? "binary" : "ascii");
+    if (cfg.preload) printf("Preloaded %llu/%llu keys\n",
+                            (unsigned long long)total.preloaded, (unsigned long long)cfg.keys);
+    printf("%llu requests issued in %.1f s, offered %.0f req/s, achieved %.0f req/s\n",
+           (unsigned long long)total.issued, cfg.duration_s,
+           cfg.qps > 0 ? cfg.qps : total.issued / cfg.duration_s, completed / cfg.duration_s);
+    printf("gets: hits %llu misses %llu  sets: stored %llu  errors %llu timeouts %llu stale %llu send errors %llu\n",
+           (unsigned long long)total.hits, (unsigned long long)total.misses,
+           (unsigned long long)total.stored, (unsigned long long)total.errors,
+           (unsigned long long)total.timeouts, (unsigned long long)stale,
+           (unsigned long long)send_errors);
+    print_latency("get", total.get_lat);
+    print_latency("set", total.set_lat);
+    if (cfg.qps > 0) {
+        printf("max send lag behind schedule %.1f us%s\n", total.max_lag_ns / 1000.0,
+               total.max_lag_ns > cfg.timeout_ns ? " (client could not keep up with --qps)" : "");
+    }
+    return 0;
+}
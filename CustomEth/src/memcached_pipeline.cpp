@@ -0,0 +1,175 @@
+/*  Pipelined UDP memcached benchmark built on MemcachedUdpClient
+    Keeps <window> requests in flight from one thread instead of the one-shot
+    sendto/recvfrom in udp_memcached.cpp.
+
+compile - g++ -O2 -std=c++17 -pthread memcached_pipeline.cpp packet.cpp ../util/checksum.cpp -o memcached_pipeline
+on one terminal run memcached -u nobody -m 64 -U 11211
+on second terminal run ./memcached_pipeline 127.0.0.1 11211 1000000 1024 1000 4 uring
+  <requests> total gets, <window> max in flight, <keys> distinct keys preloaded
+  with a 64B value, <multiget> keys per get request,
+  <backend> mmsg (default), uring or sqpoll, <protocol> ascii (default) or binary
+To compare backends on loopback run the same line with mmsg, uring and sqpoll
+and compare req/s and the syscalls/request line.
+
+Without a memcached, server "soft" (./memcached_pipeline soft 0 ...) answers from
+the in-process SoftMemcached of kv_proxy.h on a second thread.  Those numbers are
+responder-only: they show what the client and its backend cost, not what a
+memcached serves.  On a 1 core VM, 200000 gets with 1024 in flight, 1000 keys,
+the responder sharing the core is the limit and the backends come out alike:
+
+    backend   req/s (responder-only)   io_uring_enter per request
+    mmsg      52k                      -
+    uring     45k                      0.010
+    sqpoll    48k                      0.001
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../include/kv_proxy.h"
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        fprintf(stderr,
+            "Usage:\n"
+            "  %s <server_ip>|soft <port> [requests] [window] [keys] [multiget] [mmsg|uring|sqpoll] [ascii|binary]\n",
+            argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const char *server_ip = argv[1];
+    int port = atoi(argv[2]);
+    long requests = argc > 3 ? atol(argv[3]) : 100000;
+    int window    = argc > 4 ? atoi(argv[4]) : 256;
+    int num_keys  = argc > 5 ? atoi(argv[5]) : 1000;
+    int multiget  = argc > 6 ? atoi(argv[6]) : 1;
+    MemcBackend want = MemcBackend::MMSG;
+    if (argc > 7) {
+        if (strcmp(argv[7], "uring") == 0) {
+            want = MemcBackend::URING;
+        } else if (strcmp(argv[7], "sqpoll") == 0) {
+            want = MemcBackend::URING_SQPOLL;
+        } else if (strcmp(argv[7], "mmsg") != 0) {
+            fprintf(stderr, "Unknown backend '%s', use mmsg, uring or sqpoll\n", argv[7]);
+            return EXIT_FAILURE;
+        }
+    }
+    MemcProtocol protocol = MemcProtocol::ASCII;
+    if (argc > 8) {
+        if (strcmp(argv[8], "binary") == 0) {
+            protocol = MemcProtocol::BINARY;
+        } else if (strcmp(argv[8], "ascii") != 0) {
+            fprintf(stderr, "Unknown protocol '%s', use ascii or binary\n", argv[8]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (window < 1 || num_keys < 1 || multiget < 1) {
+        fprintf(stderr, "window, keys and multiget must be >= 1\n");
+        return EXIT_FAILURE;
+    }
+
+    try {
+        // server "soft": SoftMemcached on its own Reactor and thread, for as long as the run
+        std::unique_ptr<Reactor> soft_reactor;
+        std::unique_ptr<SoftMemcached> soft;
+        std::atomic<bool> soft_done{false};
+        std::thread soft_thread;
+        if (strcmp(server_ip, "soft") == 0) {
+            soft_reactor.reset(new Reactor);
+            soft.reset(new SoftMemcached(*soft_reactor));
+            server_ip = "127.0.0.1";
+            port = soft->port();
+            soft_thread = std::thread([&] {
+                while (!soft_done.load(std::memory_order_relaxed)) soft_reactor->run_once(std::chrono::milliseconds(10));
+            });
+            printf("Server: in-process SoftMemcached on port %d, responder-only numbers, not memcached\n", port);
+        }
+        struct Join {
+            std::atomic<bool>& done;
+            std::thread& t;
+            ~Join () {
+                done.store(true);
+                if (t.joinable()) t.join();
+            }
+        } join{soft_done, soft_thread};
+
+        MemcachedUdpClient client(server_ip, port, window, want);
+        client.protocol = protocol;
+        printf("Backend: %s, %s protocol\n", memc_backend_name(client.backend),
+               protocol == MemcProtocol::BINARY ? "binary" : "ascii");
+        const uint64_t timeout_ns = 200000000ull; // 200ms, same as FPGAInterface
+
+        std::vector<std::string> keys(num_keys);
+        for (int i = 0; i < num_keys; i++) keys[i] = "key" + std::to_string(i);
+        std::string value(64, 'v');
+
+        long stored = 0;
+        for (int i = 0; i < num_keys; i++) {
+            while (!client.set(keys[i], value, [&](const MemcResponse& r) {
+                       if (r.status == MemcStatus::STORED) stored++;
+                   })) {
+                client.poll(1);
+                client.expire(timeout_ns);
+            }
+        }
+        while (client.in_flight()) {
+            if (client.poll(10) == 0) client.expire(timeout_ns);
+        }
+        printf("Preloaded %ld/%d keys\n", stored, num_keys);
+
+        std::vector<uint64_t> lat;
+        lat.reserve(requests);
+        long hits = 0, misses = 0, errors = 0;
+        std::vector<std::string_view> batch(multiget);
+        auto on_reply = [&](const MemcResponse& r) {
+            lat.push_back(r.latency_ns);
+            if (r.status != MemcStatus::VALUES) {
+                errors++;
+                return;
+            }
+            hits += r.num_values;
+            misses += multiget - (long)r.num_values;
+        };
+
+        uint64_t start = memc_now_ns();
+        uint64_t enters_start = client.uring_enters();
+        long issued = 0;
+        uint32_t k = 0;
+        while (issued < requests || client.in_flight()) {
+            while (issued < requests && client.can_submit()) {
+                for (int j = 0; j < multiget; j++) batch[j] = keys[k++ % num_keys];
+                if (!client.get(batch, on_reply)) break;
+                issued++;
+            }
+            if (client.poll(1) == 0) client.expire(timeout_ns);
+        }
+        double elapsed = (memc_now_ns() - start) / 1e9;
+        uint64_t enters = client.uring_enters() - enters_start;
+
+        std::sort(lat.begin(), lat.end());
+        auto pct = [&](double p) {
+            return lat.empty() ? 0.0 : lat[std::min(lat.size() - 1, (size_t)(p * lat.size()))] / 1000.0;
+        };
+        printf("%ld requests in %.3f s : %.0f req/s, %.0f keys/s\n",
+               issued, elapsed, issued / elapsed, issued * multiget / elapsed);
+        printf("hits %ld misses %ld errors %ld timeouts %llu stale %llu\n",
+               hits, misses, errors,
+               (unsigned long long)client.stats.timeouts, (unsigned long long)client.stats.stale);
+        printf("latency us: p50 %.1f p90 %.1f p99 %.1f p99.9 %.1f max %.1f\n",
+               pct(0.50), pct(0.90), pct(0.99), pct(0.999), pct(1.0));
+        if (client.backend != MemcBackend::MMSG) {
+            printf("io_uring_enter calls %llu, %.3f per request\n",
+                   (unsigned long long)enters, issued ? (double)enters / issued : 0.0);
+        }
+    } catch (const std::exception& e) {
+        fprintf(stderr, "%s\n", e.what());
+        return EXIT_FAILURE;
+    }
+    return 0;
+}
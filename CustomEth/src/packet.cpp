@@ -83,54 +83,72 @@ void Packet::prepare_send (const uint8_t* payload, uint8_t* frame, int& bytes_to
         if (layers[i+1]->kind() == Kind::UALINK) {
             auto* ether_layer = static_cast<ether*>(layers[i].get());
             auto* ua_layer = static_cast<ualink*>(layers[i+1].get());
-
-            //uint8_t frame[14 + 16];
-            ua_layer->calc_req_addr_attr();
-
-            memcpy(frame, ether_layer->dst.data(), 6);
-            memcpy(frame + 6, ether_layer->src.data(), 6);
-            uint16_t ethertype_endian = swap_endian(ether_layer->ethertype);
-            memcpy(frame + 12, &ethertype_endian, 2);
-
-            memcpy(frame + 14, &ua_layer->ua_hdr.ver_type, 1);
-            memcpy(frame + 15, &ua_layer->ua_hdr.op, 1);
-            memcpy(frame + 16, &ua_layer->ua_hdr.tag, 1);
-            memcpy(frame + 17, &ua_layer->ua_hdr.req_len, 1);
-            uint16_t req_attr_endian = swap_endian(ua_layer->ua_hdr.req_attr);
-            memcpy(frame + 18, &req_attr_endian, 2);
-            uint64_t base_addr_endian = swap_endian_64(ua_layer->ua_hdr.base_addr);
-            memcpy(frame + 20, &base_addr_endian, 8);
-            uint16_t pad_endian = swap_endian(ua_layer->ua_hdr.pad);
-            memcpy(frame + 28, &pad_endian, 2);
-
-            if (ua_layer->ua_hdr.op == 1) {
-                // Read - Send the `frame` as is on the wire 
-                bytes_to_send = 30;
-            } else if (ua_layer->ua_hdr.op == 2) {
-                // Write - Add the payload bytes to the `frame` and send on the wire 
-                memcpy(frame + 30, payload, ua_layer->num_bytes);
-                bytes_to_send = 30 + ua_layer->num_bytes;
-            }
+            bytes_to_send = ualink_frame(*ether_layer, *ua_layer, payload, frame);
         }
     }
 }
 
+int Packet::ualink_frame (ether& ether_layer, ualink& ua_layer, const uint8_t* payload, uint8_t* frame) {
+    ua_layer.calc_req_addr_attr();
+
+    memcpy(frame, ether_layer.dst.data(), 6);
+    memcpy(frame + 6, ether_layer.src.data(), 6);
+    int eth_len = ether_layer.get_header_length();
+    if (ether_layer.vlan) {
+        uint16_t tpid_endian = swap_endian(0x8100);
+        uint16_t tci_endian = swap_endian(ether_layer.tci());
+        memcpy(frame + 12, &tpid_endian, 2);
+        memcpy(frame + 14, &tci_endian, 2);
+    }
+    uint16_t ethertype_endian = swap_endian(ether_layer.ethertype);
+    memcpy(frame + eth_len - 2, &ethertype_endian, 2);
+
+    uint8_t* ua = frame + eth_len;
+    memcpy(ua, &ua_layer.ua_hdr.ver_type, 1);
+    memcpy(ua + 1, &ua_layer.ua_hdr.op, 1);
+    memcpy(ua + 2, &ua_layer.ua_hdr.tag, 1);
+    memcpy(ua + 3, &ua_layer.ua_hdr.req_len, 1);
+    uint16_t req_attr_endian = swap_endian(ua_layer.ua_hdr.req_attr);
+    memcpy(ua + 4, &req_attr_endian, 2);
+    uint64_t base_addr_endian = swap_endian_64(ua_layer.ua_hdr.base_addr);
+    memcpy(ua + 6, &base_addr_endian, 8);
+    uint16_t pad_endian = swap_endian(ua_layer.ua_hdr.pad);
+    memcpy(ua + 14, &pad_endian, 2);
+
+    if (ua_layer.ua_hdr.op == 2) {
+        // Write - Add the payload bytes to the `frame` and send on the wire 
+        memcpy(ua + 16, payload, ua_layer.num_bytes);
+        return eth_len + 16 + ua_layer.num_bytes;
+    }
+    // Read - Send the `frame` as is on the wire 
+    return eth_len + 16;
+}
+
 void Packet::prepare_packet_recv (const uint8_t* recv_frame) {
+    int eth_len = 14;
     for (int i = 0; i < layers.size(); i++) {
         if (layers[i]->kind() == Kind::ETHER) {
             auto* ether_layer = static_cast<ether*>(layers[i].get());
             memcpy(ether_layer->dst.data(), recv_frame, 6);
             memcpy(ether_layer->src.data(), recv_frame + 6, 6);
-            memcpy(&ether_layer->ethertype, recv_frame + 12, 2);
+            ether_layer->vlan = recv_frame[12] == 0x81 && recv_frame[13] == 0x00;
+            if (ether_layer->vlan) {
+                uint16_t tci = (recv_frame[14] << 8) | recv_frame[15];
+                ether_layer->pcp = tci >> 13;
+                ether_layer->vid = tci & 0xFFF;
+            }
+            eth_len = ether_layer->get_header_length();
+            memcpy(&ether_layer->ethertype, recv_frame + eth_len - 2, 2);
         } else if (layers[i]->kind() == Kind::UALINK) {
             auto* ua_layer = static_cast<ualink*>(layers[i].get());
-            memcpy(&ua_layer->ua_hdr.ver_type, recv_frame + 14, 1);
-            memcpy(&ua_layer->ua_hdr.op, recv_frame + 15, 1);
-            memcpy(&ua_layer->ua_hdr.tag, recv_frame + 16, 1);
-            memcpy(&ua_layer->ua_hdr.req_len, recv_frame + 17, 1);
-            memcpy(&ua_layer->ua_hdr.req_attr, recv_frame + 18, 2);
-            memcpy(&ua_layer->ua_hdr.base_addr, recv_frame + 20, 8);
-            memcpy(&ua_layer->ua_hdr.pad, recv_frame + 28, 2);
+            const uint8_t* ua = recv_frame + eth_len;
+            memcpy(&ua_layer->ua_hdr.ver_type, ua, 1);
+            memcpy(&ua_layer->ua_hdr.op, ua + 1, 1);
+            memcpy(&ua_layer->ua_hdr.tag, ua + 2, 1);
+            memcpy(&ua_layer->ua_hdr.req_len, ua + 3, 1);
+            memcpy(&ua_layer->ua_hdr.req_attr, ua + 4, 2);
+            memcpy(&ua_layer->ua_hdr.base_addr, ua + 6, 8);
+            memcpy(&ua_layer->ua_hdr.pad, ua + 14, 2);
         }
     }
 }
\ No newline at end of file
@@ -0,0 +1,204 @@
+/*  Replay a UALink / memcached capture through RawEth
+    The capture can come from PcapRecorder (pcapng, ns timestamps) or tcpdump (pcap).
+    It checks itself first on captures it writes to /tmp and replays into a LoopbackLink
+    (loopback_link.h): a pcap with a cut off last record, its timing held in original, 2x and max,
+    max with more frames than the link holds, and the pcapng a PcapRecorder made of the replay.
+    Without a capture that is all it does.
+
+compile - g++ -O2 -std=c++17 -pthread pcap_replay.cpp ../util/checksum.cpp -o pcap_replay
+sudo ./pcap_replay [<interface> <capture> [original|max|<speed>x] [loops] [--record out.pcapng]]
+
+  original : resend with the captured inter-frame timing
+  4x       : resend four times faster than captured
+  max      : resend back to back at line rate
+  --record : also capture the replay and the FPGA's responses for diffing runs
+
+Note: AF_PACKET requires root/sudo privileges
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include <memory>
+#include "../include/loopback_link.h"
+#include "../include/pcap_replay.h"
+
+// a classic pcap, microsecond stamps gap_us apart, frame i 60 bytes of i after the MACs and an
+// EtherType the loopback echoes as is; the last record is cut off, the reader has to drop it
+static std::string write_pcap (int frames, uint32_t gap_us) {
+    char path[] = "/tmp/pcap_replay_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) throw std::runtime_error("mkstemp");
+    std::vector<uint8_t> file(24);
+    uint32_t hdr[6] = {0xA1B2C3D4, 0x00040002, 0, 0, 65535, 1};
+    memcpy(file.data(), hdr, sizeof(hdr));
+    for (int i = 0; i <= frames; i++) {
+        uint64_t us = (uint64_t)i * gap_us;
+        uint32_t rec[4] = {(uint32_t)(us / 1000000), (uint32_t)(us % 1000000), 60, 60};
+        uint8_t frame[60];
+        memset(frame, i, sizeof(frame));
+        memcpy(frame, "\x02\x00\x00\x00\x01\x00\x02\x00\x00\x00\x00\x01\x88\xB5", 14);
+        file.insert(file.end(), (uint8_t*)rec, (uint8_t*)rec + sizeof(rec));
+        file.insert(file.end(), frame, frame + (i < frames ? sizeof(frame) : 20));
+    }
+    bool ok = write(fd, file.data(), file.size()) == (ssize_t)file.size();
+    close(fd);
+    if (!ok) throw std::runtime_error("write(pcap)");
+    return path;
+}
+
+// replay into a LoopbackLink, every frame is echoed; drain_ms 0 so elapsed is the replay alone
+static ReplayStats replay_loopback (const PcapReader& reader, PcapReplayer::Mode mode, double speed,
+                                    PcapRecorder* recorder = nullptr) {
+    LoopbackLink loop;
+    RawEth sock(loop);
+    sock.recorder = recorder;
+    PcapReplayer replayer(sock, mode, speed);
+    replayer.drain_ms = 0;
+    return replayer.replay(reader);
+}
+
+static int check_replay () {
+    const int frames = 10;
+    const uint32_t gap_us = 2000;
+    int errors = 0;
+    auto report = [&](const char* what, const ReplayStats& s, int sent, double min_s, double max_s) {
+        bool ok = s.sent == (uint64_t)sent && s.received == (uint64_t)sent && s.send_errors == 0 &&
+                  s.elapsed_s >= min_s && s.elapsed_s < max_s;
+        printf("check %s: sent=%llu received=%llu errors=%llu elapsed=%.6f s %s\n", what,
+               (unsigned long long)s.sent, (unsigned long long)s.received,
+               (unsigned long long)s.send_errors, s.elapsed_s, ok ? "ok" : "FAIL");
+        errors += !ok;
+    };
+
+    std::string pcap = write_pcap(frames, gap_us);
+    {
+        PcapReader reader(pcap);
+        bool ok = reader.frames.size() == frames;
+        for (size_t i = 0; ok && i < reader.frames.size(); i++) {
+            const CapturedFrame& f = reader.frames[i];
+            ok = f.len == 60 && f.ts_ns == i * gap_us * 1000ull && f.data[14] == i && f.data[59] == i;
+        }
+        printf("check pcap: %zu frames %s\n", reader.frames.size(), ok ? "ok" : "FAIL");
+        errors += !ok;
+
+        // the last frame goes out (frames - 1) gaps after the first
+        double span = (frames - 1) * gap_us * 1e-6;
+        report("original", replay_loopback(reader, PcapReplayer::ORIGINAL, 1.0), frames, span, 10 * span);
+        report("2x", replay_loopback(reader, PcapReplayer::SCALED, 2.0), frames, span / 2, span);
+        report("max", replay_loopback(reader, PcapReplayer::MAX_RATE, 1.0), frames, 0, span / 2);
+    }
+    unlink(pcap.c_str());
+
+    // more frames than the loopback's 1024 slots, back to back: only reading every rx_every frames
+    // keeps it from filling
+    pcap = write_pcap(3000, 1);
+    {
+        PcapReader reader(pcap);
+        report("max 3000", replay_loopback(reader, PcapReplayer::MAX_RATE, 1.0), 3000, 0, 10.0);
+    }
+    unlink(pcap.c_str());
+
+    // a PcapRecorder capture of a replay: outbound and inbound frames, only the outbound replayed
+    pcap = write_pcap(frames, gap_us);
+    char ng[] = "/tmp/pcap_replay_XXXXXX";
+    int fd = mkstemp(ng);
+    if (fd < 0) throw std::runtime_error("mkstemp");
+    close(fd);
+    {
+        PcapReader reader(pcap);
+        PcapRecorder recorder(ng);
+        replay_loopback(reader, PcapReplayer::MAX_RATE, 1.0, &recorder);
+    }
+    {
+        PcapReader reader(ng);
+        int out = 0, in = 0;
+        for (const CapturedFrame& f : reader.frames) {
+            out += (f.flags & 3) == PcapRecorder::OUTBOUND;
+            in += (f.flags & 3) == PcapRecorder::INBOUND;
+        }
+        ReplayStats s = replay_loopback(reader, PcapReplayer::MAX_RATE, 1.0);
+        bool ok = out == frames && in == frames && s.skipped == (uint64_t)frames;
+        printf("check pcapng: outbound=%d inbound=%d skipped=%llu %s\n", out, in,
+               (unsigned long long)s.skipped, ok ? "ok" : "FAIL");
+        errors += !ok;
+        report("pcapng", s, frames, 0, 1.0);
+    }
+    unlink(pcap.c_str());
+    unlink(ng);
+    return errors;
+}
+
+int main(int argc, char *argv[]) {
+    int failed;
+    try {
+        failed = check_replay();
+    } catch (const std::exception& e) {
+        fprintf(stderr, "check: %s\n", e.what());
+        failed = 1;
+    }
+    if (argc < 3) {
+        printf("%s\n", failed ? "FAIL" : "PASS");
+        return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+    const char *ifname = argv[1];
+    const char *path = argv[2];
+    PcapReplayer::Mode mode = PcapReplayer::ORIGINAL;
+    double speed = 1.0;
+    int loops = 1;
+    const char *record_path = NULL;
+
+    int pos = 0;
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            record_path = argv[++i];
+        } else if (pos == 0) {
+            if (strcmp(argv[i], "max") == 0) {
+                mode = PcapReplayer::MAX_RATE;
+            } else if (strcmp(argv[i], "original") != 0) {
+                speed = atof(argv[i]);
+                if (speed <= 0) {
+                    fprintf(stderr, "Invalid speed '%s'\n", argv[i]);
+                    return EXIT_FAILURE;
+                }
+                mode = PcapReplayer::SCALED;
+            }
+            pos++;
+        } else {
+            loops = atoi(argv[i]);
+        }
+    }
+
+    try {
+        PcapReader reader(path);
+        RawEth sock(ifname);
+        std::unique_ptr<PcapRecorder> recorder;
+        if (record_path) {
+            recorder.reset(new PcapRecorder(record_path));
+            sock.recorder = recorder.get();
+        }
+        printf("Loaded %zu frames from %s\n", reader.frames.size(), path);
+
+        PcapReplayer replayer(sock, mode, speed);
+        replayer.loops = loops > 0 ? loops : 1;
+        ReplayStats stats = replayer.replay(reader);
+
+        printf("Sent %llu frames (%llu errors, %llu inbound skipped) in %.6f s, %.0f frames/s\n",
+               (unsigned long long)stats.sent, (unsigned long long)stats.send_errors,
+               (unsigned long long)stats.skipped, stats.elapsed_s,
+               stats.elapsed_s > 0 ? stats.sent / stats.elapsed_s : 0.0);
+        printf("Received %llu frames\n", (unsigned long long)stats.received);
+        if (recorder) {
+            printf("Recorded %llu frames, dropped %llu\n",
+                   (unsigned long long)recorder->recorded.load(),
+                   (unsigned long long)recorder->dropped.load());
+        }
+    } catch (const std::exception& e) {
+        fprintf(stderr, "%s\n", e.what());
+        return EXIT_FAILURE;
+    }
+    printf("%s\n", failed ? "FAIL" : "PASS");
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
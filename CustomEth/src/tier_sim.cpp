@@ -0,0 +1,193 @@
+/*  Tiered memory simulation (tier_sim.h): replays a binary address trace through L1/L2/L3, near DRAM
+    and the far tier behind the UALink link, and prints the hit rate of every tier, the average and
+    tail latency and the far link's load.  gen writes a synthetic trace to try it on.  Without
+    arguments it checks itself: a loop that fits L1, a loop that thrashes near DRAM, the far link
+    idle and saturated by four cores, and the sharded passes against one thread.
+
+compile - g++ -O2 -std=c++17 -pthread tier_sim.cpp -o tier_sim
+./tier_sim <trace> [key=value ...]
+./tier_sim gen <trace> <accesses> <seq|rand|zipf> <footprint_mb> [cores] [gap_ns] [write_pct]
+
+  keys : threads (1), near_mb (1024), near_ns (80), far_ns (500), far_gbps (10), page (4096),
+         l1_kb (32), l2_kb (1024), l3_mb (32), caches (3, the cache levels kept, from L1)
+
+  The trace is 16 byte TraceRecords: address, gap_ns, core, write (little endian).
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <iostream>
+#include <random>
+#include "../include/tier_sim.h"
+
+// count accesses of pattern over footprint bytes from cores cores, the i-th one into out[i]
+static void generate (std::vector<TraceRecord>& out, size_t count, const std::string& pattern, uint64_t footprint,
+                      int cores, uint32_t gap_ns, int write_pct, std::mt19937_64& rng) {
+    uint64_t lines = std::max<uint64_t>(1, footprint / 64);
+    uint64_t pages = std::max<uint64_t>(1, footprint / 4096);
+    std::vector<double> cdf;
+    if (pattern == "zipf") {
+        cdf.resize(pages);
+        double sum = 0;
+        for (uint64_t k = 0; k < pages; k++) cdf[k] = (sum += 1.0 / std::pow(k + 1.0, 0.99));
+        for (double& c : cdf) c /= sum;
+    } else if (pattern != "seq" && pattern != "rand") {
+        throw std::runtime_error("pattern is seq, rand or zipf");
+    }
+    std::uniform_real_distribution<double> u(0.0, 1.0);
+    std::vector<uint64_t> next(cores, 0);
+    for (size_t i = 0; i < out.size() && i < count; i++) {
+        TraceRecord& a = out[i];
+        int c = static_cast<int>(i % cores);
+        if (pattern == "seq") {
+            // every core walks its own part of the footprint
+            a.addr = (c * (lines / cores) + next[c]++ % std::max<uint64_t>(1, lines / cores)) * 64;
+        } else if (pattern == "rand") {
+            a.addr = rng() % lines * 64;
+        } else {
+            uint64_t rank = std::lower_bound(cdf.begin(), cdf.end(), u(rng)) - cdf.begin();
+            // the hot pages spread over the footprint, not packed at its start
+            uint64_t page = rank * 0x9E3779B97F4A7C15ULL % pages;
+            a.addr = page * 4096 + rng() % 64 * 64;
+        }
+        a.gap_ns = gap_ns;
+        a.core = static_cast<uint16_t>(c);
+        a.write = static_cast<int>(rng() % 100) < write_pct;
+        a.pad = 0;
+    }
+}
+
+static int write_trace (int argc, char* argv[]) {
+    if (argc < 6) {
+        fprintf(stderr, "gen <trace> <accesses> <seq|rand|zipf> <footprint_mb> [cores] [gap_ns] [write_pct]\n");
+        return EXIT_FAILURE;
+    }
+    size_t count = strtoull(argv[3], nullptr, 10);
+    uint64_t footprint = strtoull(argv[5], nullptr, 10) << 20;
+    int cores = argc > 6 ? atoi(argv[6]) : 1;
+    uint32_t gap = argc > 7 ? atoi(argv[7]) : 5;
+    int writes = argc > 8 ? atoi(argv[8]) : 30;
+    FILE* f = fopen(argv[2], "wb");
+    if (!f) {
+        fprintf(stderr, "cannot open %s\n", argv[2]);
+        return EXIT_FAILURE;
+    }
+    std::mt19937_64 rng(1);
+    std::vector<TraceRecord> chunk(1 << 20);
+    for (size_t done = 0; done < count; ) {
+        size_t n = std::min(chunk.size(), count - done);
+        generate(chunk, n, argv[4], footprint, cores, gap, writes, rng);
+        fwrite(chunk.data(), sizeof(TraceRecord), n, f);
+        done += n;
+    }
+    fclose(f);
+    printf("%zu accesses, %.1f MB\n", count, count * sizeof(TraceRecord) / 1e6);
+    return EXIT_SUCCESS;
+}
+
+static bool set_key (TierConfig& c, const std::string& kv) {
+    size_t eq = kv.find('=');
+    if (eq == std::string::npos) return false;
+    std::string k = kv.substr(0, eq);
+    double v = atof(kv.c_str() + eq + 1);
+    if (k == "threads") c.threads = static_cast<int>(v);
+    else if (k == "near_mb") c.near_bytes = static_cast<uint64_t>(v * (1 << 20));
+    else if (k == "near_ns") c.near_ns = v;
+    else if (k == "far_ns") c.far_ns = v;
+    else if (k == "far_gbps") c.far_gbps = v;
+    else if (k == "page") c.page_bytes = static_cast<int>(v);
+    else if (k == "l1_kb" && c.caches.size() > 0) c.caches[0].size_bytes = static_cast<uint64_t>(v * 1024);
+    else if (k == "l2_kb" && c.caches.size() > 1) c.caches[1].size_bytes = static_cast<uint64_t>(v * 1024);
+    else if (k == "l3_mb" && c.caches.size() > 2) c.caches[2].size_bytes = static_cast<uint64_t>(v * (1 << 20));
+    else if (k == "caches") c.caches.resize(std::min<size_t>(c.caches.size(), static_cast<size_t>(v)));
+    else return false;
+    return true;
+}
+
+static int check (bool ok, const char* what, const TierSim::Report& r) {
+    printf("%s: %s\n", what, ok ? "ok" : "FAILED");
+    if (!ok) r.print(std::cout);
+    return ok ? 0 : 1;
+}
+
+static int self_check () {
+    int failed = 0;
+    std::mt19937_64 rng(7);
+
+    // 16KB read 100 times: only the first pass misses L1, and only its first line of each page near DRAM
+    {
+        std::vector<TraceRecord> t(256 * 100);
+        generate(t, t.size(), "seq", 16 << 10, 1, 1, 0, rng);
+        TierSim::Report r = TierSim(TierConfig()).run(t.data(), t.size());
+        failed += check(r.tiers[0].hits == t.size() - 256 && r.tiers.back().hits == 4, "L1 loop", r);
+    }
+
+    // one access per page round 512 pages, twice near DRAM's 256: LRU keeps none of them
+    TierConfig thrash;
+    thrash.caches.clear();
+    thrash.near_bytes = 1 << 20;
+    {
+        std::vector<TraceRecord> t(512 * 10);
+        for (size_t i = 0; i < t.size(); i++) t[i] = {(i % 512) * 4096, 1, 0, 0, 0};
+        TierSim::Report r = TierSim(thrash).run(t.data(), t.size());
+        failed += check(r.tiers[0].hits == 0 && r.tiers[1].hits == t.size(), "near LRU thrash", r);
+    }
+
+    // every access far: one core finds the link idle, four saturate the data coming back, so each
+    // access takes four page transfers
+    uint64_t chunks = (4096 + 254) / 255;
+    double data_ns = (4096 + chunks * thrash.far_response_bytes) * 8.0 / thrash.far_gbps;
+    double idle_ns = thrash.far_ns + chunks * thrash.far_request_bytes * 8.0 / thrash.far_gbps + data_ns;
+    for (int cores : {1, 4}) {
+        std::vector<TraceRecord> t(20000);
+        for (size_t i = 0; i < t.size(); i++) t[i] = {(i % 4096) * 4096, 0, static_cast<uint16_t>(i % cores), 0, 0};
+        TierSim::Report r = TierSim(thrash).run(t.data(), t.size());
+        double want = cores == 1 ? idle_ns : cores * data_ns;
+        bool ok = std::fabs(r.far.mean() - want) < 0.02 * want;
+        if (cores > 1) ok = ok && r.from_far_busy_ns > 0.97 * r.elapsed_ns;
+        failed += check(ok, cores == 1 ? "far link idle" : "far link saturated", r);
+    }
+
+    // a zipf trace over 64MB sharded four ways hits every tier about as often as one thread
+    {
+        std::vector<TraceRecord> t(2000000);
+        generate(t, t.size(), "zipf", 64 << 20, 4, 5, 30, rng);
+        TierConfig one;
+        one.near_bytes = 16 << 20;
+        TierConfig four = one;
+        four.threads = 4;
+        TierSim::Report a = TierSim(one).run(t.data(), t.size());
+        TierSim::Report b = TierSim(four).run(t.data(), t.size());
+        bool ok = true;
+        for (size_t l = 0; l < a.tiers.size(); l++)
+            ok = ok && std::fabs(double(a.tiers[l].hits) - double(b.tiers[l].hits)) < 0.02 * t.size();
+        failed += check(ok, "4 shards against 1", b);
+        if (!ok) a.print(std::cout);
+    }
+    return failed;
+}
+
+int main(int argc, char *argv[]) {
+    try {
+        if (argc == 1) {
+            int failed = self_check();
+            printf("%s\n", failed ? "FAIL" : "PASS");
+            return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+        }
+        if (std::string(argv[1]) == "gen") return write_trace(argc, argv);
+
+        TierConfig cfg;
+        for (int i = 2; i < argc; i++) {
+            if (!set_key(cfg, argv[i])) {
+                fprintf(stderr, "unknown setting %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        }
+        TierSim::Report r = TierSim(cfg).run(argv[1]);
+        r.print(std::cout);
+    } catch (const std::exception& e) {
+        fprintf(stderr, "%s\n", e.what());
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,41 @@
+/*  Poll the performance counters of ualink_turbo64 (FPGAInterface::read_counters) at a fixed interval
+    and print one line of key=value pairs per sample: the counts since the sample before, the FIFO
+    high water marks since reset.  The first line is the totals since reset.
+
+compile - g++ -O2 -std=c++17 ualink_counters.cpp ../util/checksum.cpp -o ualink_counters
+sudo ./ualink_counters <interface> <src_mac> <dst_mac> [interval_ms] [samples]
+
+  interval_ms : default 1000
+  samples     : default 0, until interrupted
+
+Note: AF_PACKET requires root/sudo privileges
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <iostream>
+#include "../include/fpga_interface.h"
+
+int main(int argc, char *argv[]) {
+    if (argc < 4) {
+        fprintf(stderr, "Usage:\n  %s <interface> <src_mac> <dst_mac> [interval_ms] [samples]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    int interval_ms = argc > 4 ? atoi(argv[4]) : 1000;
+    int samples = argc > 5 ? atoi(argv[5]) : 0;
+
+    try {
+        FPGAInterface fpga(argv[1], argv[2], argv[3]);
+        int missed = fpga.poll_counters(std::chrono::milliseconds(interval_ms), samples,
+            [](const UalinkCounters&, const UalinkCounters& delta) {
+                delta.print(std::cout);
+                std::cout.flush();
+                return true;
+            });
+        if (missed) fprintf(stderr, "%d reads got no answer\n", missed);
+    } catch (const std::exception& e) {
+        fprintf(stderr, "%s\n", e.what());
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,54 @@
+/*  Multiply random int8 matrices on the FPGA's FMA engine (RemoteMem::gemm_int8) and report the time
+    against the same product on the CPU.  gemm_int8 checks every element against the CPU reference.
+
+compile - g++ -O2 -std=c++17 ualink_gemm.cpp ../util/checksum.cpp -o ualink_gemm
+sudo ./ualink_gemm <interface> <src_mac> <dst_mac> [M N K] [repeats]
+
+  M N K   : A is M x K, B is K x N, default 64 64 64
+  repeats : default 10
+
+Note: AF_PACKET requires root/sudo privileges
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <random>
+#include "../include/remote_mem.h"
+
+int main(int argc, char *argv[]) {
+    if (argc < 4) {
+        fprintf(stderr, "Usage:\n  %s <interface> <src_mac> <dst_mac> [M N K] [repeats]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    size_t M = argc > 6 ? strtoul(argv[4], nullptr, 0) : 64;
+    size_t N = argc > 6 ? strtoul(argv[5], nullptr, 0) : 64;
+    size_t K = argc > 6 ? strtoul(argv[6], nullptr, 0) : 64;
+    int repeats = argc > 7 ? atoi(argv[7]) : 10;
+
+    std::mt19937 rng(1);
+    std::vector<int8_t> A(M * K), B(K * N);
+    std::vector<int32_t> C(M * N);
+    for (auto& a : A) a = static_cast<int8_t>(rng());
+    for (auto& b : B) b = static_cast<int8_t>(rng());
+
+    try {
+        RemoteMem mem(argv[1], argv[2], argv[3]);
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < repeats; i++) mem.gemm_int8(A.data(), B.data(), C.data(), M, N, K);
+        double fpga = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < repeats; i++) RemoteMem::gemm_int8_reference(A.data(), B.data(), C.data(), M, N, K);
+        double cpu = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        size_t tiles = ((M + 7) / 8) * ((N + 7) / 8) * ((K + 7) / 8);
+        double macs = static_cast<double>(M) * N * K * repeats;
+        printf("%zux%zux%zu, %zu tiles: FPGA %.3f ms %.1f MMAC/s %.0f tiles/s, CPU %.3f ms %.1f MMAC/s\n",
+               M, N, K, tiles, 1e3 * fpga / repeats, macs / fpga / 1e6, tiles * repeats / fpga,
+               1e3 * cpu / repeats, macs / cpu / 1e6);
+    } catch (const std::exception& e) {
+        fprintf(stderr, "%s\n", e.what());
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,166 @@
+/*  Run the host stack against the verilated ualink_turbo64 (ualink_sim.h) instead of the FPGA.
+    RemoteMem sends its requests into the RTL model in-process, the responses are checked against
+    a copy of the memory kept here, and the cycles each request spent in the RTL are reported, then the
+    RTL's own performance counters (FPGAInterface::read_counters) and the host's credit flow control
+    stats (FPGAInterface::flow).
+
+build - scripts/build_verilator_sim.sh, which verilates the RTL with this main
+./ualink_sim_bench [requests] [--threads N] [--replay capture.pcapng]
+
+  requests : per suite, default 10000
+  --threads: Verilator model threads, at least as many as the model was verilated with
+  --replay : also replay a capture (PcapRecorder / tcpdump) into the model back to back
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <random>
+#include "../include/remote_mem.h"
+#include "../include/pcap_replay.h"
+#include "../include/ualink_sim.h"
+
+static void report (const char* suite, UalinkSim& sim, uint64_t requests, uint64_t errors,
+                    std::chrono::steady_clock::time_point start, uint64_t start_cycle) {
+    std::vector<UalinkSim::RequestCycles> rc = sim.take_request_cycles();
+    std::vector<uint64_t> lat;
+    lat.reserve(rc.size());
+    for (auto& r : rc) lat.push_back(r.out_cycle - r.in_cycle);
+    std::sort(lat.begin(), lat.end());
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    uint64_t cycles = sim.cycles() - start_cycle;
+    auto pct = [&](double p) { return lat.empty() ? 0 : lat[std::min(lat.size() - 1, (size_t)(p * lat.size()))]; };
+    double avg = 0;
+    for (uint64_t l : lat) avg += l;
+    if (!lat.empty()) avg /= lat.size();
+    printf("%-14s %8llu requests %6llu errors  cycles avg %.1f p50 %llu p99 %llu max %llu  "
+           "%.2f s, %.0f requests/s, %.0f cycles/s\n",
+           suite, (unsigned long long)requests, (unsigned long long)errors, avg,
+           (unsigned long long)pct(0.50), (unsigned long long)pct(0.99),
+           (unsigned long long)(lat.empty() ? 0 : lat.back()), wall,
+           wall > 0 ? requests / wall : 0.0, wall > 0 ? cycles / wall : 0.0);
+}
+
+int main (int argc, char** argv) {
+    uint64_t requests = 10000;
+    int threads = 1;
+    const char* replay_path = nullptr;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replay_path = argv[++i];
+        } else {
+            requests = strtoull(argv[i], nullptr, 0);
+        }
+    }
+
+    Verilated::commandArgs(argc, argv);
+    uint64_t failed = 0;
+    try {
+        UalinkSim sim(threads);
+        RemoteMem mem(sim, "02:00:00:00:00:02", "02:00:00:00:00:01");
+        std::vector<uint8_t> shadow(RemoteMem::mem_words * 8, 0);
+        std::mt19937 rng(1);
+
+        // known contents first, the model's memory starts undefined
+        mem.write_bytes(0, shadow.data(), shadow.size());
+        sim.take_request_cycles();
+
+        // sized writes and reads of random byte ranges, every read checked against the shadow copy
+        auto start = std::chrono::steady_clock::now();
+        uint64_t c0 = sim.cycles(), errors = 0;
+        uint8_t buf[255];
+        for (uint64_t i = 0; i < requests; i++) {
+            size_t n = 1 + rng() % 255;
+            uint64_t addr = rng() % (shadow.size() - n + 1);
+            if (rng() & 1) {
+                for (size_t k = 0; k < n; k++) buf[k] = static_cast<uint8_t>(rng());
+                mem.write_bytes(addr, buf, n);
+                memcpy(shadow.data() + addr, buf, n);
+            } else {
+                mem.read_bytes(addr, buf, n);
+                if (memcmp(buf, shadow.data() + addr, n) != 0) errors++;
+            }
+        }
+        report("read/write", sim, requests, errors, start, c0);
+        failed += errors;
+
+        // atomics on a few words, the results follow from the shadow copy
+        start = std::chrono::steady_clock::now();
+        c0 = sim.cycles();
+        errors = 0;
+        for (uint64_t i = 0; i < requests; i++) {
+            uint64_t addr = 8 * (rng() % 4);
+            uint64_t old, expected;
+            memcpy(&old, shadow.data() + addr, 8);
+            uint64_t v = rng();
+            switch (rng() % 3) {
+            case 0:
+                if (mem.fetch_add(addr, v) != old) errors++;
+                v += old;
+                break;
+            case 1:
+                if (mem.swap(addr, v) != old) errors++;
+                break;
+            default:
+                expected = (rng() & 1) ? old : old + 1;
+                if (mem.cas(addr, expected, v) != (expected == old)) errors++;
+                if (expected != old) v = old;
+                break;
+            }
+            memcpy(shadow.data() + addr, &v, 8);
+        }
+        report("atomics", sim, requests, errors, start, c0);
+        failed += errors;
+
+        // int8 GEMMs of random shapes on the FMA engine, each checked against the CPU reference
+        start = std::chrono::steady_clock::now();
+        c0 = sim.cycles();
+        errors = 0;
+        uint64_t gemms = std::max<uint64_t>(1, requests / 500);
+        for (uint64_t i = 0; i < gemms; i++) {
+            size_t M = 1 + rng() % 40, N = 1 + rng() % 40, K = 1 + rng() % 80;
+            std::vector<int8_t> A(M * K), B(K * N);
+            std::vector<int32_t> C(M * N);
+            for (auto& a : A) a = static_cast<int8_t>(rng());
+            for (auto& b : B) b = static_cast<int8_t>(rng());
+            try {
+                mem.gemm_int8(A.data(), B.data(), C.data(), M, N, K);
+            } catch (const std::runtime_error& e) {
+                fprintf(stderr, "%zux%zux%zu: %s\n", M, N, K, e.what());
+                errors++;
+            }
+        }
+        report("gemm", sim, gemms, errors, start, c0);
+        failed += errors;
+
+        if (replay_path) {
+            PcapReader reader(replay_path);
+            PcapReplayer replayer(mem.remote_interface.sock_interface, PcapReplayer::MAX_RATE);
+            start = std::chrono::steady_clock::now();
+            c0 = sim.cycles();
+            ReplayStats stats = replayer.replay(reader);
+            uint64_t got = 0;
+            uint8_t frame[2048];
+            while (got < stats.sent && sim.recv_frame(frame, sizeof(frame), 1000) >= 0) got++;
+            report("replay", sim, stats.sent, stats.sent - got, start, c0);
+            failed += stats.sent - got;
+        }
+
+        UalinkCounters counters;
+        if (!mem.remote_interface.read_counters(counters)) throw std::runtime_error("no answer to the COUNTERS read");
+        printf("%-14s ", "counters");
+        fflush(stdout);
+        counters.print(std::cout);
+        printf("%-14s ", "flow");
+        fflush(stdout);
+        mem.remote_interface.flow.print(std::cout);
+    } catch (const std::exception& e) {
+        fprintf(stderr, "%s\n", e.what());
+        return EXIT_FAILURE;
+    }
+    printf("%s\n", failed ? "FAIL" : "PASS");
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,79 @@
+/*  Test vectors for ualink_sized_tb: sized UALink READ/WRITE requests for every byte offset (0-7)
+    and length (1-64) built by FPGAInterface::sized_request_frame, each with the frame ualink_turbo64
+    has to send back.  The odd offsets go with an 802.1Q tag (traffic class 5), so the IPv4 header
+    and the sized fields of the op are 4 bytes later.  The expected data comes from a byte model of the FPGA memory written the way
+    the host sees it (num_bytes at user_addr), not from the masks, so a wrong req_len, mask or byte
+    enable shows up as a byte that differs.
+
+compile - g++ -O2 -std=c++17 ualink_vectors.cpp ../util/checksum.cpp -o ualink_vectors
+./ualink_vectors > ualink_sized_vectors.hex
+
+Output is $readmemh input, 64-bit words with frame byte 8w+l in bits [8l+7:8l] like the datapath:
+a count word n, the n words of the request, the n words expected back, ..., and a 0 count at the end.
+*/
+
+#include <stdio.h>
+#include <random>
+#include "../include/fpga_interface.h"
+
+static constexpr int mem_bytes = 256 * 8;        // DPMEM of ualink_turbo64
+static uint8_t mem[mem_bytes];
+static ether e_header, e_tagged;
+static std::mt19937 rng(0x0A11CE);
+static uint8_t tag = 0;
+static int frames = 0;
+
+static void emit (const char* what, uint64_t addr, int n, const uint8_t* req, const uint8_t* rsp, int len) {
+    int words = (len + 7) / 8;
+    printf("// %d: %s %d bytes at 0x%03llx\n", frames++, what, n, (unsigned long long)addr);
+    printf("%016x\n", words);
+    for (const uint8_t* f : {req, rsp}) {
+        for (int w = 0; w < words; w++) {
+            uint64_t v = 0;
+            for (int l = 0; l < 8; l++) v |= static_cast<uint64_t>(f[8 * w + l]) << (8 * l);
+            printf("%016llx\n", (unsigned long long)v);
+        }
+    }
+}
+
+static void write_bytes (const ether& e_header, uint64_t addr, int n) {
+    uint8_t data[255], req[32 + 8 * 33] = {0};
+    for (int i = 0; i < n; i++) data[i] = static_cast<uint8_t>(rng());
+    int len = FPGAInterface::sized_request_frame(e_header, 2, addr, data, n, tag++, req);
+    for (int i = 0; i < n; i++) mem[(addr + i) % mem_bytes] = data[i];
+    emit("write", addr, n, req, req, len);   // a write comes back as it went out
+}
+
+static void read_bytes (const ether& e_header, uint64_t addr, int n) {
+    uint8_t req[32 + 8 * 33] = {0}, rsp[32 + 8 * 33] = {0};
+    int len = FPGAInterface::sized_request_frame(e_header, 1, addr, nullptr, n, tag++, req);
+    memcpy(rsp, req, sizeof(req));
+    for (int i = 0; i < n; i++) rsp[32 + (addr & 0x7) + i] = mem[(addr + i) % mem_bytes];
+    emit("read", addr, n, req, rsp, len);
+}
+
+int main () {
+    e_header.set_src_ether("02:00:00:00:00:02");
+    e_header.set_dst_ether("02:00:00:00:00:01");
+    e_tagged = e_header;
+    e_tagged.set_traffic_class(5);
+
+    // known contents everywhere, 64B aligned writes
+    for (int a = 0; a < mem_bytes; a += 64) write_bytes(e_header, a, 64);
+
+    // every offset and length: the write, the same bytes read back, and the words around them read
+    // whole, so a byte written outside the request shows up
+    int combo = 0;
+    for (int off = 0; off < 8; off++) {
+        const ether& e = off & 1 ? e_tagged : e_header;
+        for (int n = 1; n <= 64; n++, combo++) {
+            uint64_t word = 1 + (combo * 7) % 240;
+            write_bytes(e, word * 8 + off, n);
+            read_bytes(e, word * 8 + off, n);
+            read_bytes(e, (word - 1) * 8, 88);
+        }
+    }
+    printf("%016x\n", 0);
+    fprintf(stderr, "%d frames\n", frames);
+    return 0;
+}
@@ -4,6 +4,7 @@ First compile the program - g++ udp_memcached.cpp
 on one terminal run memcached -u nobody -m 64 -U 11211 (assuming you have memcached installed)
 on second terminal run ./a.out 127.0.0.1 11211 set foo bar  (set key value) - you should see "STORED" printed
 then on the same terminal run /a.out 127.0.0.1 11211 get foo  (get key)  - you will see the value printed
+bset / bget do the same with the memcached binary protocol (memcached_binary.h)
 optionally, on a third terminal you can run sudo tcpdump -i lo port 11211 -w memcached_udp.pcap to capture the traffic if you want
 
 */
@@ -16,6 +17,7 @@ optionally, on a third terminal you can run sudo tcpdump -i lo port 11211 -w mem
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include "../include/memcached_binary.h"
 
 struct memc_udp_header {
     uint16_t request_id;
@@ -36,7 +38,8 @@ int main(int argc, char *argv[]) {
         fprintf(stderr,
             "Usage:\n"
             "  %s <server_ip> <port> get <key>\n"
-            "  %s <server_ip> <port> set <key> <value>\n",
+            "  %s <server_ip> <port> set <key> <value>\n"
+            "  bget / bset instead of get / set use the binary protocol\n",
             argv[0], argv[0]);
         return EXIT_FAILURE;
     }
@@ -48,6 +51,8 @@ int main(int argc, char *argv[]) {
     const char *value = NULL;
 
     int is_set = 0;
+    int is_binary = op[0] == 'b';
+    if (is_binary) op++;
     if (strcmp(op, "get") == 0) {
         is_set = 0;
         if (argc != 5) {
@@ -62,14 +67,25 @@ int main(int argc, char *argv[]) {
         }
         value = argv[5];
     } else {
-        fprintf(stderr, "Unknown op '%s', use 'get' or 'set'\n", op);
+        fprintf(stderr, "Unknown op '%s', use 'get', 'set', 'bget' or 'bset'\n", argv[3]);
         return EXIT_FAILURE;
     }
 
     char cmd_buf[MAX_BUF];
     int cmd_len = 0;
 
-    if (is_set) {
+    if (is_binary) {
+        size_t klen = strlen(key);
+        size_t vlen = is_set ? strlen(value) : 0;
+        if (klen > 250 || memc_bin_set_size(klen, vlen) > sizeof(cmd_buf)) {
+            fprintf(stderr, "Command too long\n");
+            return EXIT_FAILURE;
+        }
+        char *end = is_set ? memc_bin_encode_set(cmd_buf, key, value)
+                           : memc_bin_encode_get(cmd_buf, key);
+        cmd_len = (int)(end - cmd_buf);
+        printf("Binary command length: %d\n", cmd_len);
+    } else if (is_set) {
         size_t vlen = strlen(value);
         cmd_len = snprintf(cmd_buf, sizeof(cmd_buf),
                            "set %s 0 0 %zu\r\n%s\r\n", key, vlen, value);
@@ -144,7 +160,19 @@ int main(int argc, char *argv[]) {
     int payload_len = n - sizeof(struct memc_udp_header);
     char* payload = (char*) (recv_buf + sizeof(struct memc_udp_header));
 
-    if (is_set) {
+    if (is_binary) {
+        MemcBinResponse r;
+        if (payload_len <= 0 || memc_bin_parse(payload, payload_len, r) == 0) {
+            printf("Malformed binary response\n");
+        } else if (r.status != MEMC_BIN_OK) {
+            printf(r.status == MEMC_BIN_KEY_NOT_FOUND ? "NOT FOUND\n" : "Status 0x%04x\n", r.status);
+        } else if (is_set) {
+            printf("STORED\n");
+        } else {
+            fwrite(r.value.data(), 1, r.value.size(), stdout);
+            printf("\n");
+        }
+    } else if (is_set) {
         if (strncmp(payload, "STORED", 6) == 0) {
             printf ("STORED \n");
         }
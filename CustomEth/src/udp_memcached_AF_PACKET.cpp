@@ -6,6 +6,7 @@ First compile the program - g++ udp_memcached.cpp
 on one terminal run memcached -u nobody -m 64 -U 11211 (assuming you have memcached installed)
 on second terminal run sudo ./a.out eth0 192.168.1.100 127.0.0.1 11211 set foo bar  (needs sudo for raw sockets)
 then on the same terminal run sudo ./a.out eth0 192.168.1.100 127.0.0.1 11211 get foo
+bset / bget do the same with the memcached binary protocol (memcached_binary.h)
 optionally, on a third terminal you can run sudo tcpdump -i lo port 11211 -w memcached_udp.pcap to capture the traffic
 
 Note: Using AF_PACKET requires root/sudo privileges
@@ -25,6 +26,7 @@ Note: Using AF_PACKET requires root/sudo privileges
 #include <netinet/udp.h>
 #include <linux/if_packet.h>
 #include <net/ethernet.h>
+#include "../include/memcached_binary.h"
 
 struct memc_udp_header {
     uint16_t request_id;
@@ -99,6 +101,7 @@ int main(int argc, char *argv[]) {
             "Usage:\n"
             "  %s <interface> <src_ip> <dst_ip> <port> get <key>\n"
             "  %s <interface> <src_ip> <dst_ip> <port> set <key> <value>\n"
+            "  bget / bset instead of get / set use the binary protocol\n"
             "Example:\n"
             "  sudo %s eth0 192.168.1.100 127.0.0.1 11211 get foo\n",
             argv[0], argv[0], argv[0]);
@@ -114,6 +117,8 @@ int main(int argc, char *argv[]) {
     const char *value = NULL;
 
     int is_set = 0;
+    int is_binary = op[0] == 'b';
+    if (is_binary) op++;
     if (strcmp(op, "get") == 0) {
         is_set = 0;
         if (argc != 7) {
@@ -128,7 +133,7 @@ int main(int argc, char *argv[]) {
         }
         value = argv[7];
     } else {
-        fprintf(stderr, "Unknown op '%s', use 'get' or 'set'\n", op);
+        fprintf(stderr, "Unknown op '%s', use 'get', 'set', 'bget' or 'bset'\n", argv[5]);
         return EXIT_FAILURE;
     }
 
@@ -159,7 +164,18 @@ int main(int argc, char *argv[]) {
     char cmd_buf[MAX_BUF];
     int cmd_len = 0;
 
-    if (is_set) {
+    if (is_binary) {
+        size_t klen = strlen(key);
+        size_t vlen = is_set ? strlen(value) : 0;
+        if (klen > 250 || memc_bin_set_size(klen, vlen) > sizeof(cmd_buf)) {
+            fprintf(stderr, "Command too long\n");
+            return EXIT_FAILURE;
+        }
+        char *end = is_set ? memc_bin_encode_set(cmd_buf, key, value)
+                           : memc_bin_encode_get(cmd_buf, key);
+        cmd_len = (int)(end - cmd_buf);
+        printf("Binary command length: %d\n", cmd_len);
+    } else if (is_set) {
         size_t vlen = strlen(value);
         cmd_len = snprintf(cmd_buf, sizeof(cmd_buf),
                            "set %s 0 0 %zu\r\n%s\r\n", key, vlen, value);
@@ -289,7 +305,19 @@ int main(int argc, char *argv[]) {
     int payload_len = n - header_offset - sizeof(struct memc_udp_header);
     char *payload = (char *)(recv_buf + header_offset + sizeof(struct memc_udp_header));
     
-    if (is_set) {
+    if (is_binary) {
+        MemcBinResponse r;
+        if (payload_len <= 0 || memc_bin_parse(payload, payload_len, r) == 0) {
+            printf("Malformed binary response\n");
+        } else if (r.status != MEMC_BIN_OK) {
+            printf(r.status == MEMC_BIN_KEY_NOT_FOUND ? "NOT FOUND\n" : "Status 0x%04x\n", r.status);
+        } else if (is_set) {
+            printf("STORED\n");
+        } else {
+            fwrite(r.value.data(), 1, r.value.size(), stdout);
+            printf("\n");
+        }
+    } else if (is_set) {
         if (strncmp(payload, "STORED", 6) == 0) {
             printf("STORED\n");
         } else {
@@ -0,0 +1,207 @@
+/*  Per-transaction latency of a VCD dump (vcd_latency.h): pairs every request frame in on s_axis
+    port 0 with its response out on m_axis and writes the cycles between them, the DPMEM writes and
+    the cycles of every state as JSON, one file per RTL change to compare with
+    scripts/compare_vcd_latency.py.  Reads testbench dumps (memcached_UDP64B_tb.vcd) as well as
+    the ChipScope captures of FPGA_related (no clock, period=1).  Without arguments it checks itself
+    on dumps written here, with and without a clock, then times a large one.
+
+compile - g++ -O2 -std=c++17 vcd_latency.cpp -o vcd_latency
+./vcd_latency <dump.vcd> [key=value ...]
+
+  keys : out (the JSON file, stdout without it), period (time units per cycle without a clock, 1),
+         clock, in_valid, in_ready, in_last, out_valid, out_ready, out_last, we, state (the signal
+         names tried, comma separated, a dotted name for a scope's signal; none to leave it out)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include "../include/vcd_latency.h"
+
+static bool set_key (VcdLatency::Config& c, std::string& out, const std::string& kv) {
+    size_t eq = kv.find('=');
+    if (eq == std::string::npos) return false;
+    std::string k = kv.substr(0, eq), v = kv.substr(eq + 1);
+    if (k == "out") {
+        out = v;
+        return true;
+    }
+    if (k == "period") {
+        c.period = std::max<uint64_t>(1, strtoull(v.c_str(), nullptr, 10));
+        return true;
+    }
+    for (int r = 0; r < VcdLatency::ROLES; r++) {
+        if (k != VcdLatency::role_name(r)) continue;
+        c.names[r].clear();
+        std::stringstream ss(v);
+        for (std::string n; std::getline(ss, n, ',');)
+            if (!n.empty() && n != "none") c.names[r].push_back(n);
+        return true;
+    }
+    return false;
+}
+
+// A testbench dump: clk every 4 time units (or none, a time step a cycle), request frames of in_beats beats every gap cycles, each
+// answered out_beats beats long lat cycles after its first beat, we_a high on its third cycle, but
+// for frame drop_in's request and frame drop_out's response.  Every scalar change is a line, the way
+// Icarus writes them.
+static std::string testbench_vcd (int frames, int in_beats, int out_beats, int lat, int gap, bool clocked,
+                                  int drop_in = -1, int drop_out = -1) {
+    std::string clk = clocked ? "$var wire 1 ! clk $end\n" : "";
+    std::string s = "$date today $end\n$timescale 1ps $end\n$scope module testbench $end\n" + clk +
+                    "$var reg 3 \" state [2:0] $end\n$scope module in_arb $end\n" + clk +
+                    "$var wire 1 # s_axis_tvalid_0 $end\n$var wire 1 $ s_axis_tlast_0 $end\n"
+                    "$var wire 1 % m_axis_tvalid $end\n$var wire 1 & m_axis_tlast $end\n$var reg 1 ' we_a $end\n"
+                    "$var reg 7 ( state [6:0] $end\n$upscope $end\n$upscope $end\n$enddefinitions $end\n"
+                    "$comment a $var in here is no $var $end\n#0\n$dumpvars\n0!\nb0 \"\n0#\n0$\n0%\n0&\n0'\nb0 (\n$end\n";
+    int cycles = frames * gap + lat + out_beats + 4;
+    char prev[6] = {'0', '0', '0', '0', '0', 0};
+    uint64_t prev_state = 0;
+    for (int c = 0; c < cycles; c++) {
+        // the values driven after the rising edge of cycle c-1, seen at the edge of cycle c
+        char v[5] = {'0', '0', '0', '0', '0'};
+        uint64_t state = 0;
+        // the frames with a beat or a write in flight
+        int span = std::max(std::max(in_beats, 3), lat + out_beats);
+        for (int f = std::max(0, (c - span) / gap - 1); f < frames && f * gap < c; f++) {
+            int in = c - (1 + f * gap), out = c - (1 + f * gap + lat);
+            if (in >= 0 && in < in_beats && f != drop_in) {
+                v[0] = '1';
+                v[1] = in == in_beats - 1 ? '1' : '0';
+                state = 1;
+            }
+            if (out >= 0 && out < out_beats && f != drop_out) {
+                v[2] = '1';
+                v[3] = out == out_beats - 1 ? '1' : '0';
+                state = 2;
+            }
+            if (in == 2 && f != drop_in) v[4] = '1';
+        }
+        uint64_t t = clocked ? 4 * c + 1 : c;
+        s += "#" + std::to_string(t) + "\n";
+        const char* ids = "#$%&'";
+        for (int i = 0; i < 5; i++) {
+            if (v[i] != prev[i]) {
+                s += v[i];
+                s += ids[i];
+                s += '\n';
+            }
+            prev[i] = v[i];
+        }
+        if (state != prev_state) s += "b" + std::string(state == 1 ? "1" : state == 2 ? "10" : "0") + " (\n";
+        prev_state = state;
+        if (clocked) s += "#" + std::to_string(t + 1) + "\n1!\n#" + std::to_string(t + 3) + "\n0!\n";
+    }
+    return s;
+}
+
+static int check (bool ok, const char* what, const VcdLatency& l) {
+    printf("%s: %s\n", what, ok ? "ok" : "FAILED");
+    if (!ok) l.json(std::cout, what);
+    return ok ? 0 : 1;
+}
+
+static bool exact (const CycleHistogram& h, uint64_t n, int64_t cycles) {
+    return h.count() == n && h.percentile(0) == cycles && h.percentile(1) == cycles;
+}
+
+static int self_check () {
+    int failed = 0;
+
+    // 2 beats in, 3 out, the response 5 cycles after the request starts: clocked and sampled
+    for (bool clocked : {true, false}) {
+        std::string d = testbench_vcd(10, 2, 3, 5, 12, clocked);
+        VcdReader vcd(d.data(), d.size());
+        VcdLatency l;
+        l.run(vcd);
+        const VcdLatency::Metrics& m = l.metrics();
+        bool ok = exact(m.first_out, 10, 5) && exact(m.last_in_to_first_out, 10, 4) && exact(m.last_out, 10, 7) &&
+                  exact(m.first_we, 10, 2) && exact(m.request_beats, 10, 2) && exact(m.response_beats, 10, 3) &&
+                  l.unanswered_requests() == 0 && l.unmatched_responses() == 0 &&
+                  l.state_cycle_counts().count(1) && l.state_cycle_counts().at(1) == 20 &&
+                  l.state_cycle_counts().at(2) == 30;
+        failed += check(ok, clocked ? "clocked testbench dump" : "sampled, no clock", l);
+    }
+
+    // cut through: the response starts on the request's second of 4 beats, and the responses of
+    // frames 5 cycles apart queue behind each other
+    {
+        std::string d = testbench_vcd(6, 4, 4, 1, 5, true);
+        VcdReader vcd(d.data(), d.size());
+        VcdLatency l;
+        l.run(vcd);
+        const VcdLatency::Metrics& m = l.metrics();
+        bool ok = exact(m.first_out, 6, 1) && exact(m.last_in_to_first_out, 6, -2) && exact(m.last_out, 6, 4) &&
+                  exact(m.request_beats, 6, 4);
+        failed += check(ok, "cut through", l);
+    }
+
+    // a response with no request before it, then a request never answered: the responses after it
+    // pair with the requests after theirs, which the latencies show
+    {
+        std::string d = testbench_vcd(3, 1, 1, 2, 4, true, 1);
+        VcdReader vcd(d.data(), d.size());
+        VcdLatency l;
+        l.run(vcd);
+        bool ok = exact(l.metrics().first_out, 2, 2) && l.unmatched_responses() == 1 && l.unanswered_requests() == 0;
+        failed += check(ok, "request missing", l);
+    }
+    {
+        std::string d = testbench_vcd(3, 1, 1, 2, 4, true, -1, 1);
+        VcdReader vcd(d.data(), d.size());
+        VcdLatency l;
+        l.run(vcd);
+        const CycleHistogram& h = l.metrics().first_out;
+        bool ok = h.count() == 2 && h.percentile(0) == 2 && h.percentile(1) == 6 && l.unanswered_requests() == 1;
+        failed += check(ok, "response missing", l);
+    }
+
+    // throughput over a large dump, all of it followed
+    {
+        std::string d = testbench_vcd(200000, 8, 8, 20, 20, true);
+        VcdReader vcd(d.data(), d.size());
+        VcdLatency l;
+        auto start = std::chrono::steady_clock::now();
+        l.run(vcd);
+        double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printf("%.0f MB in %.2f s, %.0f MB/s, %lu cycles\n", d.size() / 1e6, s, d.size() / 1e6 / s,
+               (unsigned long)l.cycles());
+        failed += check(exact(l.metrics().first_out, 200000, 20), "large dump", l);
+    }
+    return failed;
+}
+
+int main(int argc, char *argv[]) {
+    try {
+        if (argc == 1) {
+            int failed = self_check();
+            printf("%s\n", failed ? "FAIL" : "PASS");
+            return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+        }
+        VcdLatency::Config cfg;
+        std::string out;
+        for (int i = 2; i < argc; i++) {
+            if (!set_key(cfg, out, argv[i])) {
+                fprintf(stderr, "unknown setting %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        }
+        VcdReader vcd(argv[1]);
+        VcdLatency l(cfg);
+        l.run(vcd);
+        if (out.empty()) {
+            l.json(std::cout, argv[1]);
+        } else {
+            std::ofstream f(out);
+            if (!f) throw std::runtime_error("cannot write " + out);
+            l.json(f, argv[1]);
+        }
+    } catch (const std::exception& e) {
+        fprintf(stderr, "%s\n", e.what());
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -17,6 +17,8 @@
  *  Description:
  *        BRAM Output queues
  *        Outputs have a parameterizable width
+ *        drop_count counts the packets each queue dropped because it could
+ *        not take a maximum size packet, 32 bits per queue, queue 0 in [31:0]
  *
  *  Copyright notice:
  *        Copyright (C) 2010, 2011 The Board of Trustees of The Leland Stanford
@@ -97,7 +99,10 @@ module nf10_bram_output_queues
     output [C_M_AXIS_TUSER_WIDTH-1:0] m_axis_tuser_4,
     output  m_axis_tvalid_4,
     input m_axis_tready_4,
-    output  m_axis_tlast_4
+    output  m_axis_tlast_4,
+
+    // Drop counters, free running from reset
+    output [32*NUM_QUEUES-1:0] drop_count
 );
 
    function integer log2;
@@ -228,6 +233,18 @@ module nf10_bram_output_queues
          	metadata_state[i] <= metadata_state_next[i];
       	end
       end
+
+      // a packet for this queue goes to DROP
+      reg [31:0] drops;
+      always @(posedge axi_aclk) begin
+      	if(~axi_resetn) begin
+         	drops <= 0;
+      	end
+      	else if(state == IDLE && state_next == DROP && oq[i]) begin
+         	drops <= drops + 1;
+      	end
+      end
+      assign drop_count[32*i +: 32] = drops;
    end
    endgenerate
 
@@ -0,0 +1,207 @@
+/***Steen Larsen with AI assistance
+  The intent of this testbench is to check the drop counters of nf10_bram_output_queues.  A packet for
+a queue that cannot take a maximum size packet (its buffer past BUFFER_THRESHOLD, or its metadata FIFO
+nearly full) goes to DROP and counts in drop_count, 32 bits per queue, queue 0 in [31:0].
+
+Phase 1: 64B packets to queue 0 with m_axis_tready_0 low: the metadata FIFO and its fallthrough
+         register take 4 of them, the rest are dropped and counted, the other queues count nothing.
+Phase 2: packets to queue 2 are still taken while queue 0 is full.
+Phase 3: the readies go high, queue 0 sends the 4 packets it kept and queue 2 its 2, in order and
+         intact, and a packet to queue 0 is taken again without a drop.
+
+ to run in Icarus simulator use:
+iverilog -o nf10_bram_output_queues_tb.vvp .\nf10_bram_output_queues_tb.v .\nf10_bram_output_queues.v .\fallthrough_small_fifo_v2.v .\small_fifo_v3.v
+vvp nf10_bram_output_queues_tb.vvp
+
+ *
+ */
+
+`timescale 1 ns / 1ps
+module testbench();
+
+    localparam W  = 64;              // datapath width
+    localparam BB = W / 8;           // bytes per beat
+    localparam NQ = 5;
+    localparam PKT_LEN = 64;
+
+    reg clk, reset;
+
+    reg [W-1:0]    s_tdata;
+    reg [BB-1:0]   s_tstrb;
+    reg [127:0]    s_tuser;
+    reg            s_tvalid, s_tlast;
+    wire           s_tready;
+
+    wire [W-1:0]   m_tdata  [0:NQ-1];
+    wire [BB-1:0]  m_tstrb  [0:NQ-1];
+    wire [127:0]   m_tuser  [0:NQ-1];
+    wire [NQ-1:0]  m_tvalid, m_tlast;
+    reg  [NQ-1:0]  m_tready;
+    wire [32*NQ-1:0] drop_count;
+
+    integer i, j, errors, cycle;
+
+    // one packet of PKT_LEN bytes to output queue q (tuser DST_POS 24, even bits the MAC ports),
+    // byte b of packet n is n + b
+    task send_pkt;
+        input integer q;
+        input integer n;
+        integer w, nbeats;
+        begin
+            nbeats = (PKT_LEN + BB - 1) / BB;
+            for (w = 0; w < nbeats; w = w + 1) begin
+                @(posedge clk);
+                for (j = 0; j < BB; j = j + 1) s_tdata[8*j +: 8] <= n + BB*w + j;
+                s_tstrb  <= {BB{1'b1}};
+                s_tuser  <= (q == 4) ? (128'h1 << 25) : (128'h1 << (24 + 2*q));
+                s_tvalid <= 1;
+                s_tlast  <= (w == nbeats - 1);
+                @(negedge clk);
+                while (!s_tready) @(negedge clk);
+            end
+            @(posedge clk);
+            s_tvalid <= 0;
+            s_tlast  <= 0;
+            repeat (2) @(posedge clk);
+        end
+    endtask
+
+    // ------------- output monitor, checks every packet against the next one expected -------------
+    integer     out_pkts [0:NQ-1];
+    integer     out_beat [0:NQ-1];
+    integer     exp_n [0:8*NQ-1];         // first byte of the packets expected, 8 per queue
+    integer     mq, mj;
+
+    always @(posedge clk) begin
+        if (reset) begin
+            cycle <= 0;
+        end else begin
+            cycle <= cycle + 1;
+            for (mq = 0; mq < NQ; mq = mq + 1) begin
+                if (m_tvalid[mq] && m_tready[mq]) begin
+                    for (mj = 0; mj < BB; mj = mj + 1)
+                        if (m_tdata[mq][8*mj +: 8] !== ((exp_n[8*mq + out_pkts[mq]] + BB*out_beat[mq] + mj) & 8'hFF)) begin
+                            errors = errors + 1;
+                            $display("FAIL: queue %0d packet %0d beat %0d byte %0d is %0h", mq, out_pkts[mq],
+                                     out_beat[mq], mj, m_tdata[mq][8*mj +: 8]);
+                        end
+                    out_beat[mq] = out_beat[mq] + 1;
+                    if (m_tlast[mq]) begin
+                        out_pkts[mq] = out_pkts[mq] + 1;
+                        out_beat[mq] = 0;
+                    end
+                end
+            end
+        end
+    end
+
+    task expect_val;
+        input [8*32-1:0] name;
+        input [31:0]     got;
+        input [31:0]     exp;
+        begin
+            if (got !== exp) begin
+                errors = errors + 1;
+                $display("FAIL: %0s is %0d, expected %0d", name, got, exp);
+            end
+        end
+    endtask
+
+  initial begin
+      clk   = 1'b0;
+      errors = 0;
+      s_tvalid = 0;
+      s_tlast = 0;
+      s_tdata = 0;
+      s_tstrb = 0;
+      s_tuser = 0;
+      m_tready = 0;
+      for (i = 0; i < NQ; i = i + 1) begin
+          out_pkts[i] = 0;
+          out_beat[i] = 0;
+      end
+
+      $display("[%t] : System Reset Asserted...", $realtime);
+      $dumpfile("nf10_bram_output_queues_tb.vcd");
+      $dumpvars(0, testbench);
+
+      reset = 1'b1;
+      for (i = 0; i < 4; i = i + 1) begin
+                 @(posedge clk);
+      end
+      $display("[%t] : System Reset De-asserted...", $realtime);
+      reset = 1'b0;
+      repeat (4) @(posedge clk);
+
+      $display("\n=== Phase 1: queue 0 full ===");
+      for (i = 0; i < 4; i = i + 1) exp_n[i] = 16 * i;
+      for (i = 0; i < 7; i = i + 1) send_pkt(0, 16 * i);
+      expect_val("queue 0 drops", drop_count[31:0], 3);
+      for (i = 1; i < NQ; i = i + 1) expect_val("queue 1-4 drops", drop_count[32*i +: 32], 0);
+      $display("queue 0 dropped %0d packets", drop_count[31:0]);
+
+      $display("\n=== Phase 2: queue 2 still takes packets ===");
+      exp_n[16] = 200;
+      exp_n[17] = 210;
+      send_pkt(2, 200);
+      send_pkt(2, 210);
+      expect_val("queue 2 drops", drop_count[64 +: 32], 0);
+
+      $display("\n=== Phase 3: queues drain ===");
+      m_tready <= {NQ{1'b1}};
+      repeat (100) @(posedge clk);
+      expect_val("queue 0 packets out", out_pkts[0], 4);
+      expect_val("queue 2 packets out", out_pkts[2], 2);
+      exp_n[4] = 100;
+      send_pkt(0, 100);
+      repeat (20) @(posedge clk);
+      expect_val("queue 0 packets out", out_pkts[0], 5);
+      expect_val("queue 0 drops", drop_count[31:0], 3);
+      for (i = 1; i < NQ; i = i + 1) expect_val("queue 1-4 drops", drop_count[32*i +: 32], 0);
+
+      $display("\n========================================");
+      if (errors == 0) $display("Output queue drop counter tests PASSED");
+      else             $display("Output queue drop counter tests: %0d FAIL", errors);
+      $display("All Tests Completed!");
+      $display("========================================");
+      #100  ;    $finish;       //end simulation
+  end
+
+  always #2.5  clk = ~clk;      // 200MHz
+
+  nf10_bram_output_queues
+    #(.C_M_AXIS_DATA_WIDTH(W),
+      .C_S_AXIS_DATA_WIDTH(W),
+      .C_M_AXIS_TUSER_WIDTH(128),
+      .C_S_AXIS_TUSER_WIDTH(128),
+      .NUM_QUEUES(NQ)
+     ) oq
+    (
+    // Global Ports
+    .axi_aclk(clk),
+    .axi_resetn(~reset),
+
+    // Slave Stream Ports
+    .s_axis_tdata(s_tdata),
+    .s_axis_tstrb(s_tstrb),
+    .s_axis_tuser(s_tuser),
+    .s_axis_tvalid(s_tvalid),
+    .s_axis_tready(s_tready),
+    .s_axis_tlast(s_tlast),
+
+    // Master Stream Ports
+    .m_axis_tdata_0(m_tdata[0]), .m_axis_tstrb_0(m_tstrb[0]), .m_axis_tuser_0(m_tuser[0]),
+    .m_axis_tvalid_0(m_tvalid[0]), .m_axis_tready_0(m_tready[0]), .m_axis_tlast_0(m_tlast[0]),
+    .m_axis_tdata_1(m_tdata[1]), .m_axis_tstrb_1(m_tstrb[1]), .m_axis_tuser_1(m_tuser[1]),
+    .m_axis_tvalid_1(m_tvalid[1]), .m_axis_tready_1(m_tready[1]), .m_axis_tlast_1(m_tlast[1]),
+    .m_axis_tdata_2(m_tdata[2]), .m_axis_tstrb_2(m_tstrb[2]), .m_axis_tuser_2(m_tuser[2]),
+    .m_axis_tvalid_2(m_tvalid[2]), .m_axis_tready_2(m_tready[2]), .m_axis_tlast_2(m_tlast[2]),
+    .m_axis_tdata_3(m_tdata[3]), .m_axis_tstrb_3(m_tstrb[3]), .m_axis_tuser_3(m_tuser[3]),
+    .m_axis_tvalid_3(m_tvalid[3]), .m_axis_tready_3(m_tready[3]), .m_axis_tlast_3(m_tlast[3]),
+    .m_axis_tdata_4(m_tdata[4]), .m_axis_tstrb_4(m_tstrb[4]), .m_axis_tuser_4(m_tuser[4]),
+    .m_axis_tvalid_4(m_tvalid[4]), .m_axis_tready_4(m_tready[4]), .m_axis_tlast_4(m_tlast[4]),
+
+    .drop_count(drop_count)
+   );
+
+endmodule
@@ -0,0 +1,73 @@
+#!/bin/bash
+################################################################################
+# Build the Verilator co-simulation of ualink_turbo64
+################################################################################
+#
+# PURPOSE:
+#   Verilates ualink_turbo64 (with dual_port_ram_banked, matrix_fma_8x8,
+#   systolic_array and kv_hash_index) into a C++ model and links it with a host program that talks to it
+#   through UalinkSim (CustomEth/include/ualink_sim.h), a RawEth transport.
+#   FPGAInterface / RemoteMem then run unchanged against the RTL.
+#
+# USAGE:
+#   ./build_verilator_sim.sh [main.cpp] [threads]
+#
+#   Example: ./build_verilator_sim.sh
+#            ./build_verilator_sim.sh CustomEth/src/ualink_sim_bench.cpp 4
+#
+#   main.cpp defaults to CustomEth/src/ualink_sim_bench.cpp, threads (the
+#   Verilator model threads, --threads) to 1.  Run the executable with at
+#   least as many threads (ualink_sim_bench --threads N), Verilator stops a
+#   model whose context has fewer.  The executable is written to
+#   obj_ualink_sim/ under the project root.
+#
+# REQUIRES:
+#   Verilator 5.x on the PATH
+#
+################################################################################
+
+set -e
+
+SCRIPT_DIR="$( cd "$( dirname "${BASH_SOURCE[0]}" )" && pwd )"
+PROJECT_ROOT="$(dirname "$SCRIPT_DIR")"
+
+MAIN=$(realpath "${1:-$PROJECT_ROOT/CustomEth/src/ualink_sim_bench.cpp}")
+THREADS=${2:-1}
+RTL_DIR="$PROJECT_ROOT/ualink_turbo64_v1_00_a/hdl/verilog"
+OUT_DIR="$PROJECT_ROOT/obj_ualink_sim"
+EXE=$(basename "$MAIN" .cpp)
+
+# Same RTL as the iverilog testbenches, the model is the 64-bit datapath
+SOURCES="ualink_turbo64.v fallthrough_small_fifo_v2.v small_fifo_v3.v ualink_dpmem.v ualink_fma.v ualink_systolic.v crc32gen.v kv_hash_index.v"
+
+if ! command -v verilator > /dev/null; then
+    echo "Error: verilator not found"
+    exit 1
+fi
+
+echo "Verilating ualink_turbo64 with $THREADS threads for $EXE..."
+cd "$RTL_DIR"
+
+# --no-timing: small_fifo_v3.v has #1 intra-assignment delays for simulation
+# and ualink_fma.v carries its own testbench module (delays, forever, wait),
+# Verilator 5 refuses both without a timing option; the delays are dropped,
+# the model is cycle based.
+# Waived, anything else stops the build:
+#   WIDTH          - zero extended constants and counters, packet fields sliced out of the datapath
+#   CASEINCOMPLETE - case statements without a default, the cases left out hold their registers
+#   TIMESCALEMOD   - only the FIFOs carry a `timescale
+#   ASSIGNDLY      - the FIFOs' <= #1, dropped with --no-timing
+#   STMTDLY        - the delays of ualink_fma.v's testbench module
+verilator --cc --exe --build -j 0 -O3 \
+    --top-module ualink_turbo64 \
+    --threads "$THREADS" \
+    --no-timing \
+    -Wno-WIDTH -Wno-CASEINCOMPLETE -Wno-TIMESCALEMOD -Wno-ASSIGNDLY -Wno-STMTDLY \
+    -Mdir "$OUT_DIR" \
+    -CFLAGS "-std=c++17 -O2 -I$PROJECT_ROOT/CustomEth/include" \
+    -LDFLAGS "-pthread" \
+    -o "$EXE" \
+    $SOURCES \
+    "$MAIN" "$PROJECT_ROOT/CustomEth/util/checksum.cpp"
+
+echo "✓ Built $OUT_DIR/$EXE"
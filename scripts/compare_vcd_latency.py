@@ -0,0 +1,136 @@
+#!/usr/bin/env python3
+################################################################################
+# Latency Regression Check Between Two VCD Latency Reports
+################################################################################
+#
+# PURPOSE:
+#   Compares the JSON reports CustomEth/src/vcd_latency writes for the same
+#   testbench before and after an RTL change, and flags the transaction
+#   latencies (in clock cycles) that got worse.
+#
+# USAGE:
+#   python3 compare_vcd_latency.py <base.json> <new.json> [tolerance_cycles]
+#
+#   Example:
+#     ./vcd_latency memcached_UDP64B_tb.vcd out=base.json
+#     (change the RTL, rerun the testbench)
+#     ./vcd_latency memcached_UDP64B_tb.vcd out=new.json
+#     python3 compare_vcd_latency.py base.json new.json
+#
+# EXIT CODES:
+#   0 = No latency regression (mean, p50, p99 and max within tolerance)
+#   1 = A latency regressed, fewer transactions were paired, or bad input
+#
+# OUTPUT:
+#   Prints every latency's count, mean, p50, p99 and max before and after,
+#   marking regressions, then the states whose cycle counts changed.
+#
+################################################################################
+
+import sys
+import json
+
+
+################################################################################
+# Comparison
+################################################################################
+
+# The latencies compared, as vcd_latency names them; the beat counts are shown
+# but only the cycles to the response count as regressions
+LATENCIES = [
+    "first_in_to_first_out",
+    "last_in_to_first_out",
+    "first_in_to_last_out",
+    "first_in_to_we",
+]
+
+STATISTICS = ["mean", "p50", "p99", "max"]
+
+
+def load_report(path):
+    """Read one vcd_latency report"""
+    with open(path) as f:
+        return json.load(f)
+
+
+def compare_latency(name, base, new, tolerance):
+    """Print one latency before and after, return True if it regressed"""
+    regressed = False
+    cells = []
+    for stat in STATISTICS:
+        if stat not in base or stat not in new:
+            cells.append(f"{stat} -")
+            continue
+        delta = new[stat] - base[stat]
+        worse = delta > tolerance
+        regressed = regressed or worse
+        cells.append(f"{stat} {base[stat]:g} -> {new[stat]:g}{' !' if worse else ''}")
+    print(f"  {name:24s} n {base['count']} -> {new['count']}   " + "   ".join(cells))
+    return regressed
+
+
+def compare_states(base, new):
+    """Print the states whose cycle counts changed"""
+    states = sorted(set(base) | set(new), key=int)
+    changed = [s for s in states if base.get(s, 0) != new.get(s, 0)]
+    if not changed:
+        return
+    print("  state cycles changed:")
+    for s in changed:
+        print(f"    state {s}: {base.get(s, 0)} -> {new.get(s, 0)}")
+
+
+def compare(base, new, tolerance):
+    """Compare two reports, return the exit code"""
+    failed = False
+    print(f"base: {base['file']} ({base['transactions']} transactions, {base['cycles']} cycles)")
+    print(f"new:  {new['file']} ({new['transactions']} transactions, {new['cycles']} cycles)")
+
+    # a transaction lost is a regression no latency would show
+    if new["transactions"] < base["transactions"]:
+        print(f"  transactions paired: {base['transactions']} -> {new['transactions']} !")
+        failed = True
+    for key in ["unanswered_requests", "unmatched_responses"]:
+        if new[key] > base[key]:
+            print(f"  {key}: {base[key]} -> {new[key]} !")
+            failed = True
+
+    for name in LATENCIES:
+        b = base["latency"].get(name, {"count": 0})
+        n = new["latency"].get(name, {"count": 0})
+        if b["count"] == 0 and n["count"] == 0:
+            continue
+        failed = compare_latency(name, b, n, tolerance) or failed
+
+    compare_states(base.get("state_cycles", {}), new.get("state_cycles", {}))
+
+    print("REGRESSION" if failed else "OK")
+    return 1 if failed else 0
+
+
+################################################################################
+# Entry Point
+################################################################################
+
+def main():
+    """Script entry point"""
+    if len(sys.argv) not in (3, 4):
+        print("Usage: python3 compare_vcd_latency.py <base.json> <new.json> [tolerance_cycles]")
+        print()
+        print("Example:")
+        print("  python3 compare_vcd_latency.py base.json new.json 0")
+        sys.exit(1)
+
+    try:
+        base = load_report(sys.argv[1])
+        new = load_report(sys.argv[2])
+        tolerance = float(sys.argv[3]) if len(sys.argv) == 4 else 0.0
+    except (OSError, ValueError) as e:
+        print(f"ERROR: {e}")
+        sys.exit(1)
+
+    sys.exit(compare(base, new, tolerance))
+
+
+if __name__ == "__main__":
+    main()
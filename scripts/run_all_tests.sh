@@ -12,7 +12,8 @@
 #   ./run_all_tests.sh
 #
 # WHAT IT DOES:
-#   1. Runs each testbench one at a time
+#   1. Runs each testbench one at a time, then reruns the width-generic
+#      ones at 256 and 512 bit datapaths
 #   2. Tracks which tests pass and which fail
 #   3. Prints a summary at the end
 #   4. Returns exit code 0 if all pass, 1 if any fail
@@ -32,12 +33,51 @@ TESTBENCHES=(
     "ualink_turbo64_tb"
     "ualink_turbordwr_tb"
     "ualink_dpmem_tb"
+    "memcached_bin_tb"
+    "memcached_UDP64B_tb"
+    "arbiter_qos_tb"
+    "ualink_throughput_tb"
+    "ualink_atomic_tb"
+    "ualink_sized_tb"
+    "ualink_counters_tb"
+    "ualink_gemm_tb"
+    "ualink_systolic_tb"
+    "ualink_credit_tb"
+    "nf10_bram_output_queues_tb"
 )
 
+# Testbenches that follow UALINK_WIDTH, rerun at each wide datapath
+WIDE_TESTBENCHES=(
+    "ualink_turbo64_tb"
+    "ualink_turbordwr_tb"
+    "memcached_bin_tb"
+    "memcached_UDP64B_tb"
+    "arbiter_qos_tb"
+    "ualink_throughput_tb"
+    "ualink_atomic_tb"
+    "ualink_sized_tb"
+    "ualink_counters_tb"
+    "ualink_gemm_tb"
+    "ualink_systolic_tb"
+    "ualink_credit_tb"
+)
+WIDE_WIDTHS=(256 512)
+
+# Build the run list as "testbench width" pairs
+RUNS=()
+for TB in "${TESTBENCHES[@]}"; do
+    RUNS+=("$TB 64")
+done
+for W in "${WIDE_WIDTHS[@]}"; do
+    for TB in "${WIDE_TESTBENCHES[@]}"; do
+        RUNS+=("$TB $W")
+    done
+done
+
 # Track results
 PASSED=()
 FAILED=()
-TOTAL=${#TESTBENCHES[@]}
+TOTAL=${#RUNS[@]}
 
 echo "============================================================"
 echo "Running All Verilog Testbenches"
@@ -46,22 +86,22 @@ echo "Total testbenches: $TOTAL"
 echo ""
 
 # Run each testbench
-for i in "${!TESTBENCHES[@]}"; do
-    TB="${TESTBENCHES[$i]}"
+for i in "${!RUNS[@]}"; do
+    read -r TB W <<< "${RUNS[$i]}"
     NUM=$((i + 1))
 
     echo ""
     echo "------------------------------------------------------------"
-    echo "[$NUM/$TOTAL] Testing: $TB"
+    echo "[$NUM/$TOTAL] Testing: $TB (width $W)"
     echo "------------------------------------------------------------"
 
     # Run the test
-    if "$SCRIPT_DIR/run_test.sh" "$TB"; then
-        PASSED+=("$TB")
-        echo "✓ PASSED: $TB"
+    if "$SCRIPT_DIR/run_test.sh" "$TB" "$W"; then
+        PASSED+=("$TB ($W)")
+        echo "✓ PASSED: $TB ($W)"
     else
-        FAILED+=("$TB")
-        echo "✗ FAILED: $TB"
+        FAILED+=("$TB ($W)")
+        echo "✗ FAILED: $TB ($W)"
     fi
 done
 
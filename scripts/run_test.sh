@@ -9,9 +9,13 @@
 #   called by GitHub Actions for continuous integration testing.
 #
 # USAGE:
-#   ./run_test.sh <testbench_name>
+#   ./run_test.sh <testbench_name> [datapath_width]
 #
 #   Example: ./run_test.sh ualink_turbo64_tb
+#            ./run_test.sh memcached_bin_tb 256
+#
+#   The optional datapath width (64, 256 or 512, default 64) is passed to the
+#   testbench as UALINK_WIDTH. Testbenches that do not read it run at 64 bits.
 #
 # WHAT IT DOES:
 #   1. Takes a testbench name as input
@@ -34,6 +38,9 @@ set -e
 # Capture the testbench name from command line argument
 TESTBENCH=$1
 
+# Datapath width for the width-generic testbenches (bits per AXI Stream beat)
+WIDTH=${2:-64}
+
 # Figure out where this script is located (even if called from another directory)
 SCRIPT_DIR="$( cd "$( dirname "${BASH_SOURCE[0]}" )" && pwd )"
 
@@ -47,22 +54,40 @@ PROJECT_ROOT="$(dirname "$SCRIPT_DIR")"
 # Check if user provided a testbench name
 if [ -z "$TESTBENCH" ]; then
     echo "Error: No testbench specified"
-    echo "Usage: $0 <testbench_name>"
+    echo "Usage: $0 <testbench_name> [datapath_width]"
     echo ""
     echo "Available testbenches:"
     echo "  - ualink_turbo64_tb"
     echo "  - ualink_turbordwr_tb"
     echo "  - ualink_mac_tb"
     echo "  - ualink_dpmem_tb"
+    echo "  - memcached_bin_tb"
+    echo "  - memcached_UDP64B_tb"
+    echo "  - arbiter_qos_tb"
+    echo "  - ualink_throughput_tb"
+    echo "  - ualink_atomic_tb"
+    echo "  - ualink_sized_tb"
+    echo "  - ualink_counters_tb"
+    echo "  - ualink_gemm_tb"
+    echo "  - ualink_systolic_tb"
+    echo "  - ualink_credit_tb"
     echo "  - nf10_bram_output_queues_tb"
     echo "  - nf10_nic_output_port_lookup_tb"
     exit 1
 fi
 
 echo "========================================="
-echo "Running testbench: $TESTBENCH"
+echo "Running testbench: $TESTBENCH (width $WIDTH)"
 echo "========================================="
 
+case $WIDTH in
+    64|256|512) ;;
+    *)
+        echo "Error: Unsupported datapath width '$WIDTH' (use 64, 256 or 512)"
+        exit 1
+        ;;
+esac
+
 ################################################################################
 # Testbench Configuration
 ################################################################################
@@ -84,7 +109,7 @@ case $TESTBENCH in
         TB_DIR="$PROJECT_ROOT/ualink_turbo64_v1_00_a/hdl/verilog"
         TB_FILE="ualink_turbo64_tb.v"
         # Need the main module + all its dependencies (FIFOs and memory)
-        SOURCES="ualink_turbo64.v fallthrough_small_fifo_v2.v small_fifo_v3.v ualink_dpmem.v ualink_fma.v"
+        SOURCES="ualink_turbo64.v fallthrough_small_fifo_v2.v small_fifo_v3.v ualink_dpmem.v ualink_fma.v ualink_systolic.v crc32gen.v kv_hash_index.v"
         ;;
 
     "ualink_turbordwr_tb")
@@ -92,7 +117,80 @@ case $TESTBENCH in
         TB_DIR="$PROJECT_ROOT/ualink_turbo64_v1_00_a/hdl/verilog"
         TB_FILE="ualink_turbordwr_tb.v"
         # Same dependencies as above (reuses the same hardware)
-        SOURCES="ualink_turbo64.v fallthrough_small_fifo_v2.v small_fifo_v3.v ualink_dpmem.v ualink_fma.v"
+        SOURCES="ualink_turbo64.v fallthrough_small_fifo_v2.v small_fifo_v3.v ualink_dpmem.v ualink_fma.v ualink_systolic.v crc32gen.v kv_hash_index.v"
+        ;;
+
+    "memcached_bin_tb")
+        # Tests the memcached binary protocol GET/SET path through ualink_turbo64
+        TB_DIR="$PROJECT_ROOT/ualink_turbo64_v1_00_a/hdl/verilog"
+        TB_FILE="memcached_bin_tb.v"
+        SOURCES="ualink_turbo64.v fallthrough_small_fifo_v2.v small_fifo_v3.v ualink_dpmem.v ualink_fma.v ualink_systolic.v crc32gen.v kv_hash_index.v"
+        ;;
+
+    "memcached_UDP64B_tb")
+        # Tests the memcached ASCII UDP GET/SET path: hashed keys, bucket collisions, misses
+        TB_DIR="$PROJECT_ROOT/ualink_turbo64_v1_00_a/hdl/verilog"
+        TB_FILE="memcached_UDP64B_tb.v"
+        SOURCES="ualink_turbo64.v fallthrough_small_fifo_v2.v small_fifo_v3.v ualink_dpmem.v ualink_fma.v ualink_systolic.v crc32gen.v kv_hash_index.v"
+        ;;
+
+    "arbiter_qos_tb")
+        # Tests the input arbiter with all five queues busy: strict priority, WRR, round robin, latency per queue
+        TB_DIR="$PROJECT_ROOT/ualink_turbo64_v1_00_a/hdl/verilog"
+        TB_FILE="arbiter_qos_tb.v"
+        SOURCES="ualink_turbo64.v fallthrough_small_fifo_v2.v small_fifo_v3.v ualink_dpmem.v ualink_fma.v ualink_systolic.v crc32gen.v kv_hash_index.v"
+        ;;
+
+    "ualink_throughput_tb")
+        # Streams 10k back to back UALink READ/WRITE requests, checks the data and reports words/cycle
+        TB_DIR="$PROJECT_ROOT/ualink_turbo64_v1_00_a/hdl/verilog"
+        TB_FILE="ualink_throughput_tb.v"
+        SOURCES="ualink_turbo64.v fallthrough_small_fifo_v2.v small_fifo_v3.v ualink_dpmem.v ualink_fma.v ualink_systolic.v crc32gen.v kv_hash_index.v"
+        ;;
+
+    "ualink_atomic_tb")
+        # Tests the UALink atomics (fetch and add, swap, CAS) mixed with back to back READ/WRITE requests
+        TB_DIR="$PROJECT_ROOT/ualink_turbo64_v1_00_a/hdl/verilog"
+        TB_FILE="ualink_atomic_tb.v"
+        SOURCES="ualink_turbo64.v fallthrough_small_fifo_v2.v small_fifo_v3.v ualink_dpmem.v ualink_fma.v ualink_systolic.v crc32gen.v kv_hash_index.v"
+        ;;
+
+    "ualink_sized_tb")
+        # Tests sized UALink READ/WRITE (req_len, byte masks) byte for byte, vectors from the host code
+        TB_DIR="$PROJECT_ROOT/ualink_turbo64_v1_00_a/hdl/verilog"
+        TB_FILE="ualink_sized_tb.v"
+        SOURCES="ualink_turbo64.v fallthrough_small_fifo_v2.v small_fifo_v3.v ualink_dpmem.v ualink_fma.v ualink_systolic.v crc32gen.v kv_hash_index.v"
+        # C++ generator of the test vectors, built and run before the simulation
+        VECTOR_GEN="$PROJECT_ROOT/CustomEth/src/ualink_vectors.cpp $PROJECT_ROOT/CustomEth/util/checksum.cpp"
+        VECTOR_FILE="ualink_sized_vectors.hex"
+        ;;
+
+    "ualink_counters_tb")
+        # Tests the performance counters and the COUNTERS read that returns them
+        TB_DIR="$PROJECT_ROOT/ualink_turbo64_v1_00_a/hdl/verilog"
+        TB_FILE="ualink_counters_tb.v"
+        SOURCES="ualink_turbo64.v fallthrough_small_fifo_v2.v small_fifo_v3.v ualink_dpmem.v ualink_fma.v ualink_systolic.v crc32gen.v kv_hash_index.v"
+        ;;
+
+    "ualink_gemm_tb")
+        # Tests the GEMM op: int8 tiles from DPMEM through the FMA engine, completions and the job queue
+        TB_DIR="$PROJECT_ROOT/ualink_turbo64_v1_00_a/hdl/verilog"
+        TB_FILE="ualink_gemm_tb.v"
+        SOURCES="ualink_turbo64.v fallthrough_small_fifo_v2.v small_fifo_v3.v ualink_dpmem.v ualink_fma.v ualink_systolic.v crc32gen.v kv_hash_index.v"
+        ;;
+
+    "ualink_systolic_tb")
+        # Tests the N x N systolic MAC array on DPMEM port B, MACs/clock against the FMA engine and mac_unit
+        TB_DIR="$PROJECT_ROOT/ualink_turbo64_v1_00_a/hdl/verilog"
+        TB_FILE="ualink_systolic_tb.v"
+        SOURCES="ualink_systolic.v ualink_dpmem.v ualink_fma.v ualink_mac.sv"
+        ;;
+
+    "ualink_credit_tb")
+        # Tests the port 0 credits on the UALink responses: drops under overload without them, none with them
+        TB_DIR="$PROJECT_ROOT/ualink_turbo64_v1_00_a/hdl/verilog"
+        TB_FILE="ualink_credit_tb.v"
+        SOURCES="ualink_turbo64.v fallthrough_small_fifo_v2.v small_fifo_v3.v ualink_dpmem.v ualink_fma.v ualink_systolic.v crc32gen.v kv_hash_index.v"
         ;;
 
     "ualink_mac_tb")
@@ -136,6 +234,16 @@ case $TESTBENCH in
         echo "  - ualink_turbordwr_tb        (Memory read/write test)"
         echo "  - ualink_mac_tb              (MAC unit test)"
         echo "  - ualink_dpmem_tb            (Dual-port RAM test)"
+        echo "  - memcached_bin_tb           (memcached binary GET/SET test)"
+        echo "  - memcached_UDP64B_tb        (memcached ASCII GET/SET test)"
+        echo "  - arbiter_qos_tb             (Input arbiter priority/WRR test)"
+        echo "  - ualink_throughput_tb       (Back to back UALink request throughput test)"
+        echo "  - ualink_atomic_tb           (UALink fetch and add / swap / CAS test)"
+        echo "  - ualink_sized_tb            (UALink sized READ/WRITE byte mask test)"
+        echo "  - ualink_counters_tb         (Performance counters test)"
+        echo "  - ualink_gemm_tb             (GEMM offload on the FMA engine test)"
+        echo "  - ualink_systolic_tb         (Systolic MAC array test)"
+        echo "  - ualink_credit_tb           (Port 0 credit flow control test)"
         echo "  - nf10_bram_output_queues_tb (Output queues test)"
         echo "  - nf10_nic_output_port_lookup_tb (Port routing test)"
         exit 1
@@ -176,12 +284,33 @@ echo "  Removed: ${TESTBENCH}.vvp (if existed)"
 echo "  Removed: ${TESTBENCH}.vcd (if existed)"
 echo "  Removed: ${TESTBENCH}.log (if existed)"
 
+################################################################################
+# Test Vector Generation
+################################################################################
+#
+# Some testbenches read vectors made by the host code (CustomEth), so the
+# RTL is checked against the frames the host really sends.  Build the
+# generator with g++ and write its output next to the testbench.
+#
+################################################################################
+
+if [ -n "$VECTOR_GEN" ]; then
+    echo ""
+    echo "Generating test vectors..."
+    rm -f ${TESTBENCH}_vectors ${VECTOR_FILE}
+    echo "Command: g++ -O2 -std=c++17 -o ${TESTBENCH}_vectors ${VECTOR_GEN}"
+    g++ -O2 -std=c++17 -o ${TESTBENCH}_vectors ${VECTOR_GEN}
+    ./${TESTBENCH}_vectors > ${VECTOR_FILE}
+    echo "✓ Vectors written to ${VECTOR_FILE}"
+fi
+
 ################################################################################
 # Compilation Phase
 ################################################################################
 #
 # iverilog = Icarus Verilog compiler
 # -g2012 = Use SystemVerilog-2012 standard (supports both Verilog and SystemVerilog)
+# -DUALINK_WIDTH = Datapath width picked up by the width-generic testbenches
 # -o = Output file name
 #
 # This step is like compiling C code with gcc - it checks syntax and creates
@@ -191,9 +320,9 @@ echo "  Removed: ${TESTBENCH}.log (if existed)"
 
 echo ""
 echo "Compiling testbench..."
-echo "Command: iverilog -g2012 -o ${TESTBENCH}.vvp ${TB_FILE} ${SOURCES}"
+echo "Command: iverilog -g2012 -DUALINK_WIDTH=${WIDTH} -o ${TESTBENCH}.vvp ${TB_FILE} ${SOURCES}"
 
-iverilog -g2012 -o ${TESTBENCH}.vvp ${TB_FILE} ${SOURCES}
+iverilog -g2012 -DUALINK_WIDTH=${WIDTH} -o ${TESTBENCH}.vvp ${TB_FILE} ${SOURCES}
 
 # Check if compilation succeeded
 if [ $? -ne 0 ]; then
@@ -278,7 +407,7 @@ fi
 
 echo ""
 echo "========================================="
-echo "✓ Test PASSED: $TESTBENCH"
+echo "✓ Test PASSED: $TESTBENCH (width $WIDTH)"
 echo "========================================="
 echo ""
 
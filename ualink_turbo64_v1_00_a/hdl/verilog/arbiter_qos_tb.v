@@ -0,0 +1,529 @@
+/***Steen Larsen with AI assistance
+  The intent of this testbench is to check the input arbiter of ualink_turbo64 with all five input
+queues busy at once, and to measure the latency each queue sees under that contention.
+
+Every port sends its own stream of frames, back to back from the same clock.  A frame carries
+{port, sequence} in tuser and in its payload words, so the output monitor can tell which frame each
+word belongs to, check it word by word, check the frames of a port stay in order, and measure
+latency = first word into the port to first word out of m_axis.  Port p sends 8+p word frames,
+either untagged (UALink ethertype 0x88B5, class = the queue default) or with an 802.1Q tag whose
+PCP is the traffic class.
+
+Arbiter settings are changed in band like the UALink ops: an ARB_CFG frame on port 0 (IPv4 TOS
+0x04), UDP payload byte 6 = mode, byte 7+q = {weight, 1'b0, class} of queue q.
+
+Phase 1: strict priority (the parameter default), classes from VLAN PCP 6/4/2 on ports 1-3.  A frame
+         may never go out while a queue of a higher class has a frame ready, and the latency has to
+         follow the class.
+Phase 2: weighted round robin, weights 1/4/2/1/1.  While every queue is backlogged each queue
+         sends exactly its weight in frames per turn.
+Phase 3: round robin with two busy queues out of five.  They have to alternate, and the output
+         may not lose a cycle to the three empty queues (zero bubble).
+Phase 4: strict priority with per queue default classes and random backpressure on m_axis: the
+         offered frame may not change while tready is low.
+
+The datapath width is UALINK_WIDTH (64, 256 or 512, default 64, iverilog -DUALINK_WIDTH=256).  Frames
+are the same words at every width, UALINK_WIDTH/64 of them per beat, and the monitor checks each word.
+
+ to run in Icarus simulator use:
+iverilog -o arbiter_qos_tb.vvp .\arbiter_qos_tb.v ualink_turbo64.v .\fallthrough_small_fifo_v2.v .\small_fifo_v3.v .\ualink_dpmem.v .\ualink_fma.v .\ualink_systolic.v .\crc32gen.v .\kv_hash_index.v
+vvp arbiter_qos_tb.vvp
+gtkwave.exe .\arbiter_qos_tb.vcd
+
+ *
+ */
+
+`timescale 1 ns / 1ps
+`ifndef UALINK_WIDTH
+`define UALINK_WIDTH 64
+`endif
+module testbench();
+
+   // parameter CLK_PERIOD = 10; // 10ns = 100MHz
+    localparam W  = `UALINK_WIDTH;   // datapath width
+    localparam NW = W / 64;          // 64b words per beat
+
+    reg clk, reset;
+    wire [4:0]  tready;
+    wire [W-1:0]   m_tdata;
+    wire [W/8-1:0] m_tstrb;
+    wire [127:0] m_tuser;
+    wire        m_tvalid, m_tlast;
+    reg         m_tready;
+
+    integer i, j, k, kw;
+
+    localparam NQ       = 5;
+    localparam MAXF     = 64;          // frames per port per phase
+    localparam CFG_SEQ  = 16'hFFFF;    // tuser sequence of an ARB_CFG frame
+    localparam UNTAGGED = 4'd8;
+
+    localparam ARB_RR = 0, ARB_STRICT = 1, ARB_WRR = 2;
+
+    // ------------- sources, one per port -------------
+    reg [15:0]  src_seq  [0:NQ-1];     // next frame to send
+    integer     src_todo [0:NQ-1];     // frames left to send
+    reg [7:0]   src_w    [0:NQ-1];     // beat of the frame on the bus
+    reg [3:0]   src_pcp  [0:NQ-1];     // PCP of the tag, or UNTAGGED
+    reg         src_cfg;               // port 0 sends one ARB_CFG frame
+    reg [63:0]  cfg_word;              // its word 6
+    wire [W-1:0]   s_tdata  [0:NQ-1];
+    wire [W/8-1:0] s_tstrb  [0:NQ-1];
+    wire [127:0] s_tuser [0:NQ-1];
+    wire [NQ-1:0] s_tvalid, s_tlast;
+
+    // per frame records, index port*MAXF + seq
+    integer     t_in  [0:NQ*MAXF-1];   // cycle word 0 went in
+    integer     t_w1  [0:NQ*MAXF-1];   // cycle word 1 went in, the frame can be classified
+    integer     n_w1  [0:NQ-1];        // frames of the phase with word 1 in
+
+    // ------------- output monitor -------------
+    integer     cycle;
+    integer     errors;
+    integer     out_w;                 // next word of the current output frame
+    reg [7:0]   out_p;
+    reg [15:0]  out_s;
+    integer     exp_seq [0:NQ-1];      // next frame expected from each port
+    integer     t_offer;               // cycle the current frame was first offered
+    reg         offered;
+    integer     grant [0:1023];        // ports in output order, this phase
+    integer     n_grant;
+    integer     lat_sum [0:NQ-1], lat_max [0:NQ-1], lat_n [0:NQ-1];
+    integer     first_out, last_out, busy_out;
+    integer     inversions;
+    reg [2:0]   tb_cls [0:NQ-1];       // class of each port's frames in this phase
+    reg         check_prio;
+    reg         prev_stall;
+    reg [W-1:0] prev_tdata;
+    reg [127:0] prev_tuser;
+
+    function integer flen;
+        input [7:0] p;
+        begin
+            flen = 8 + p;
+        end
+    endfunction
+
+    // word w of frame seq of port p, byte 8w+l in [8l+7:8l]
+    function [63:0] frame_word;
+        input [7:0]  p;
+        input [15:0] seq;
+        input [7:0]  w;
+        input [3:0]  pcp;
+        input        cfg;
+        input [63:0] cfgw;
+        begin
+            if (w == 0)
+                frame_word = 64'h0002010000000002;                    // 02:00:00:00:00:01 from 02:00:..
+            else if (w == 1)
+                frame_word = cfg ? {8'h04, 8'h45, 8'h00, 8'h08, p, 24'h0} :           // IPv4, TOS 0x04
+                             (pcp == UNTAGGED) ? {8'h00, 8'h10, 8'hB5, 8'h88, p, 24'h0} :   // UALink ethertype
+                             {8'h00, pcp[2:0], 5'h0, 8'h00, 8'h81, p, 24'h0};              // 802.1Q, PCP
+            else if (cfg)
+                frame_word = (w == 6) ? cfgw : 64'h0;
+            else
+                frame_word = {p, seq, w, 16'hC0DE, seq ^ {p, w}};
+        end
+    endfunction
+
+    // beat b of a frame of len words, the words past its end are zero and not strobed
+    function [W-1:0] frame_beat;
+        input [7:0]  p;
+        input [15:0] seq;
+        input [7:0]  b;
+        input [3:0]  pcp;
+        input        cfg;
+        input [63:0] cfgw;
+        input [7:0]  len;
+        integer n;
+        begin
+            frame_beat = 0;
+            for (n = 0; n < NW; n = n + 1)
+                if (b * NW + n < len) frame_beat[64*n +: 64] = frame_word(p, seq, b * NW + n, pcp, cfg, cfgw);
+        end
+    endfunction
+
+    function [W/8-1:0] frame_strb;
+        input [7:0] b;
+        input [7:0] len;
+        integer n;
+        begin
+            frame_strb = 0;
+            for (n = 0; n < NW; n = n + 1)
+                if (b * NW + n < len) frame_strb[8*n +: 8] = 8'hFF;
+        end
+    endfunction
+
+    generate
+    genvar gp;
+    for (gp = 0; gp < NQ; gp = gp + 1) begin: src
+        wire cfg = (gp == 0) & src_cfg;
+        wire [7:0] len = cfg ? 8'd8 : flen(gp);
+        assign s_tdata[gp]  = frame_beat(gp, cfg ? CFG_SEQ : src_seq[gp], src_w[gp], src_pcp[gp], cfg, cfg_word, len);
+        assign s_tstrb[gp]  = frame_strb(src_w[gp], len);
+        assign s_tvalid[gp] = src_todo[gp] > 0;
+        assign s_tlast[gp]  = src_w[gp] == (len + NW - 1) / NW - 1;
+        assign s_tuser[gp]  = {96'h0, 8'h00, gp[7:0], cfg ? CFG_SEQ : src_seq[gp]};
+
+        always @(posedge clk) begin
+            if (reset) begin
+                src_w[gp] <= 0;
+            end else if (s_tvalid[gp] && tready[gp]) begin
+                if (!cfg && src_w[gp] == 0) t_in[gp*MAXF + src_seq[gp]] <= cycle;
+                if (!cfg && src_w[gp] == 1 / NW) begin
+                    t_w1[gp*MAXF + src_seq[gp]] <= cycle;
+                    n_w1[gp] <= n_w1[gp] + 1;
+                end
+                src_w[gp] <= s_tlast[gp] ? 8'd0 : src_w[gp] + 8'd1;
+                if (s_tlast[gp]) begin
+                    src_todo[gp] <= src_todo[gp] - 1;
+                    if (cfg) src_cfg <= 0;
+                    else     src_seq[gp] <= src_seq[gp] + 16'd1;
+                end
+            end
+        end
+    end
+    endgenerate
+
+    // a frame of port p starts on the output: is some higher class frame waiting since before it was offered?
+    task check_inversion;
+        input integer p;
+        integer q, s;
+        begin
+            for (q = 0; q < NQ; q = q + 1) begin
+                s = exp_seq[q];
+                if (q != p && tb_cls[q] > tb_cls[p] && s < n_w1[q] && t_w1[q*MAXF + s] + 4 < t_offer) begin
+                    inversions = inversions + 1;
+                    if (inversions <= 5)
+                        $display("FAIL: port %0d frame %0d (class %0d) went out while port %0d frame %0d (class %0d) was waiting",
+                                 p, out_s, tb_cls[p], q, s, tb_cls[q]);
+                end
+            end
+        end
+    endtask
+
+    always @(posedge clk) begin
+        if (reset) begin
+            cycle <= 0;
+            out_w = 0;
+            offered = 0;
+            prev_stall = 0;
+        end else begin
+            cycle <= cycle + 1;
+
+            // AXI stream: what was offered and not taken is still offered, unchanged
+            if (prev_stall && !(m_tvalid && m_tdata == prev_tdata && m_tuser == prev_tuser)) begin
+                errors = errors + 1;
+                $display("FAIL: m_axis changed while stalled at cycle %0d", cycle);
+            end
+            prev_stall = m_tvalid && !m_tready;
+            prev_tdata = m_tdata;
+            prev_tuser = m_tuser;
+
+            if (m_tvalid && out_w == 0 && !offered) begin
+                offered = 1;
+                t_offer = cycle;
+            end
+
+            if (m_tvalid && m_tready) begin
+                if (first_out < 0) first_out = cycle;
+                last_out = cycle;
+                busy_out = busy_out + 1;
+                if (out_w == 0) begin
+                    out_p = m_tuser[23:16];
+                    out_s = m_tuser[15:0];
+                    if (out_p >= NQ) begin
+                        errors = errors + 1;
+                        $display("FAIL: frame from unknown port %0d", out_p);
+                    end else if (out_s != CFG_SEQ) begin
+                        if (out_s != exp_seq[out_p]) begin
+                            errors = errors + 1;
+                            $display("FAIL: port %0d frame %0d out, expected frame %0d", out_p, out_s, exp_seq[out_p]);
+                        end
+                        if (check_prio) check_inversion(out_p);
+                        exp_seq[out_p] = out_s + 1;
+                        grant[n_grant] = out_p;
+                        n_grant = n_grant + 1;
+                        k = cycle - t_in[out_p*MAXF + out_s];
+                        lat_sum[out_p] = lat_sum[out_p] + k;
+                        lat_n[out_p]   = lat_n[out_p] + 1;
+                        if (k > lat_max[out_p]) lat_max[out_p] = k;
+                    end
+                end
+                for (kw = 0; kw < NW; kw = kw + 1) begin
+                    if (m_tstrb[8*kw +: 8] != 0) begin
+                        if (m_tdata[64*kw +: 64] != frame_word(out_p, out_s, out_w, src_pcp[out_p], out_s == CFG_SEQ, cfg_word) ||
+                            m_tuser[23:0] != {out_p, out_s}) begin
+                            errors = errors + 1;
+                            $display("FAIL: port %0d frame %0d word %0d is %h", out_p, out_s, out_w, m_tdata[64*kw +: 64]);
+                        end
+                        out_w = out_w + 1;
+                    end
+                end
+                if (m_tlast) begin
+                    if (out_w - 1 != ((out_s == CFG_SEQ) ? 7 : flen(out_p) - 1)) begin
+                        errors = errors + 1;
+                        $display("FAIL: port %0d frame %0d ended at word %0d", out_p, out_s, out_w - 1);
+                    end
+                    out_w = 0;
+                    offered = 0;
+                end
+            end
+        end
+    end
+
+    // random backpressure for phase 4
+    reg [15:0] lfsr;
+    reg        bp;
+    always @(posedge clk) begin
+        if (reset) lfsr <= 16'hACE1;
+        else       lfsr <= {lfsr[14:0], lfsr[15] ^ lfsr[13] ^ lfsr[12] ^ lfsr[10]};
+        m_tready <= bp ? lfsr[0] | lfsr[3] : 1'b1;
+    end
+
+    // ------------- phase helpers -------------
+
+    // ARB_CFG frame on port 0, wait until it is out and applied
+    task arb_cfg;
+        input [1:0] mode;
+        input [19:0] weights;   // 4 bits per queue, queue 0 in [3:0]
+        input [14:0] classes;   // 3 bits per queue
+        begin
+            cfg_word = {16'h0, 8'h00, mode};
+            for (i = 0; i < NQ; i = i + 1)
+                cfg_word[8*i+8 +: 8] = {weights[4*i +: 4], 1'b0, classes[3*i +: 3]};
+            @(posedge clk);
+            src_cfg     <= 1;
+            src_todo[0] <= 1;
+            repeat (40) @(posedge clk);
+        end
+    endtask
+
+    task phase_start;
+        begin
+            n_grant = 0;
+            first_out = -1;
+            busy_out = 0;
+            inversions = 0;
+            for (i = 0; i < NQ; i = i + 1) begin
+                exp_seq[i] = 0;
+                n_w1[i] = 0;
+                lat_sum[i] = 0; lat_max[i] = 0; lat_n[i] = 0;
+                src_seq[i] = 0;
+                src_pcp[i] = UNTAGGED;
+                tb_cls[i] = 0;
+            end
+        end
+    endtask
+
+    // send the frames, wait for all of them to come out
+    task phase_run;
+        input integer n0, n1, n2, n3, n4;
+        integer total, t0;
+        begin
+            total = n0 + n1 + n2 + n3 + n4;
+            @(posedge clk);
+            src_todo[0] <= n0; src_todo[1] <= n1; src_todo[2] <= n2; src_todo[3] <= n3; src_todo[4] <= n4;
+            t0 = cycle;
+            while (n_grant < total && cycle - t0 < 20000) @(posedge clk);
+            if (n_grant < total) begin
+                errors = errors + 1;
+                $display("FAIL: only %0d of %0d frames came out", n_grant, total);
+            end
+            repeat (10) @(posedge clk);
+        end
+    endtask
+
+    task report;
+        begin
+            $display("port  class  frames  latency avg/max (cycles)");
+            for (i = 0; i < NQ; i = i + 1)
+                if (lat_n[i] > 0)
+                    $display("%4d  %5d  %6d  %7d/%0d", i, tb_cls[i], lat_n[i], lat_sum[i] / lat_n[i], lat_max[i]);
+            $display("output busy %0d of %0d cycles", busy_out, last_out - first_out + 1);
+        end
+    endtask
+
+    // no cycle between the first and last word out without a word, with m_axis_tready high
+    task check_no_bubble;
+        input [8*20-1:0] name;
+        begin
+            if (busy_out != last_out - first_out + 1) begin
+                errors = errors + 1;
+                $display("FAIL: %0s, output idle %0d cycles with frames waiting", name, last_out - first_out + 1 - busy_out);
+            end
+            else $display("PASS: %0s, no idle output cycles", name);
+        end
+    endtask
+
+    integer run, run_q, nruns, bad_runs;
+    reg [3:0] wrr_w [0:NQ-1];
+
+  initial begin
+      clk   = 1'b0;
+      errors = 0;
+      bp = 0;
+      src_cfg = 0;
+      cfg_word = 0;
+      check_prio = 0;
+      for (i = 0; i < NQ; i = i + 1) src_todo[i] = 0;
+      phase_start();
+
+      $display("[%t] : System Reset Asserted...", $realtime);
+      $dumpfile("arbiter_qos_tb.vcd");
+      $dumpvars(0, testbench);
+
+      reset = 1'b1;
+      for (i = 0; i < 2; i = i + 1) begin
+                 @(posedge clk);
+      end
+      $display("[%t] : System Reset De-asserted...", $realtime);
+      reset = 1'b0;
+      repeat (4) @(posedge clk);
+
+      // Phase 1: strict priority by VLAN PCP
+      $display("\n=== Phase 1: strict priority, PCP 6/4/2 on ports 1-3 ===");
+      phase_start();
+      src_pcp[1] = 6; tb_cls[1] = 6;
+      src_pcp[2] = 4; tb_cls[2] = 4;
+      src_pcp[3] = 2; tb_cls[3] = 2;
+      check_prio = 1;
+      phase_run(12, 12, 12, 12, 12);
+      check_prio = 0;
+      report();
+      if (inversions == 0) $display("PASS: strict priority, no frame passed a higher class");
+      else errors = errors + inversions;
+      if (lat_sum[1] / 12 < lat_sum[2] / 12 && lat_sum[2] / 12 < lat_sum[3] / 12 &&
+          lat_sum[3] / 12 < lat_sum[0] / 12 && lat_sum[3] / 12 < lat_sum[4] / 12)
+         $display("PASS: latency follows the traffic class");
+      else begin
+         errors = errors + 1;
+         $display("FAIL: latency does not follow the traffic class");
+      end
+      check_no_bubble("strict priority");
+
+      // Phase 2: weighted round robin
+      $display("\n=== Phase 2: weighted round robin 1/4/2/1/1 ===");
+      wrr_w[0] = 1; wrr_w[1] = 4; wrr_w[2] = 2; wrr_w[3] = 1; wrr_w[4] = 1;
+      arb_cfg(ARB_WRR, 20'h11241, 15'h0);
+      phase_start();
+      phase_run(6, 24, 12, 6, 6);
+      report();
+      // runs of the same port while every port is backlogged (the first 4 turns), skip the first run
+      bad_runs = 0;
+      nruns = 0;
+      run = 1;
+      for (i = 1; i < 36; i = i + 1) begin
+         if (grant[i] == grant[i-1]) run = run + 1;
+         else begin
+            run_q = grant[i-1];
+            if (run != i && run != wrr_w[run_q]) begin
+               bad_runs = bad_runs + 1;
+               $display("FAIL: port %0d sent %0d frames in a turn, weight %0d", run_q, run, wrr_w[run_q]);
+            end
+            if (run != i) nruns = nruns + 1;
+            run = 1;
+         end
+      end
+      if (bad_runs == 0 && nruns >= 15) $display("PASS: %0d turns, each port sent its weight", nruns);
+      else errors = errors + bad_runs + 1;
+      check_no_bubble("weighted round robin");
+
+      // Phase 3: round robin, two busy queues out of five
+      $display("\n=== Phase 3: round robin, ports 2 and 4 busy ===");
+      arb_cfg(ARB_RR, 20'h11111, 15'h0);
+      phase_start();
+      phase_run(0, 0, 10, 0, 10);
+      report();
+      k = 0;
+      for (i = 1; i < 16; i = i + 1) if (grant[i] == grant[i-1]) k = k + 1;
+      if (k == 0) $display("PASS: ports 2 and 4 alternate");
+      else begin
+         errors = errors + 1;
+         $display("FAIL: ports 2 and 4 do not alternate");
+      end
+      check_no_bubble("round robin");
+
+      // Phase 4: strict priority from the queue classes, random backpressure
+      $display("\n=== Phase 4: queue classes 3/0/0/0/7, PCP 5 on port 1, backpressure ===");
+      arb_cfg(ARB_STRICT, 20'h11111, {3'd7, 3'd0, 3'd0, 3'd0, 3'd3});
+      phase_start();
+      tb_cls[0] = 3; tb_cls[4] = 7;
+      src_pcp[1] = 5; tb_cls[1] = 5;
+      check_prio = 1;
+      bp = 1;
+      phase_run(8, 8, 8, 8, 8);
+      bp = 0;
+      check_prio = 0;
+      report();
+      if (inversions == 0) $display("PASS: strict priority under backpressure");
+      else errors = errors + inversions;
+
+      $display("\n========================================");
+      if (errors == 0) $display("arbiter QoS tests PASSED");
+      else             $display("arbiter QoS tests: %0d FAIL", errors);
+      $display("All Tests Completed!");
+      $display("========================================");
+      #100  ;    $finish;       //end simulation
+  end
+
+  always #2.5  clk = ~clk;      // 200MHz
+
+  ualink_turbo64
+    #(.C_M_AXIS_DATA_WIDTH(W),
+      .C_S_AXIS_DATA_WIDTH(W),
+      .C_M_AXIS_TUSER_WIDTH(128),
+      .C_S_AXIS_TUSER_WIDTH(128)
+     ) in_arb
+    (
+    // Global Ports
+    .axi_aclk(clk),
+    .axi_resetn(~reset),
+
+    // Master Stream Ports
+    .m_axis_tdata(m_tdata),
+    .m_axis_tstrb(m_tstrb),
+    .m_axis_tuser(m_tuser),
+    .m_axis_tvalid(m_tvalid),
+    .m_axis_tready(m_tready),
+    .m_axis_tlast(m_tlast),
+
+    // Slave Stream Ports
+    .s_axis_tdata_0(s_tdata[0]),
+    .s_axis_tuser_0(s_tuser[0]),
+    .s_axis_tstrb_0(s_tstrb[0]),
+    .s_axis_tvalid_0(s_tvalid[0]),
+    .s_axis_tready_0(tready[0]),
+    .s_axis_tlast_0(s_tlast[0]),
+
+    .s_axis_tdata_1(s_tdata[1]),
+    .s_axis_tuser_1(s_tuser[1]),
+    .s_axis_tstrb_1(s_tstrb[1]),
+    .s_axis_tvalid_1(s_tvalid[1]),
+    .s_axis_tready_1(tready[1]),
+    .s_axis_tlast_1(s_tlast[1]),
+
+    .s_axis_tdata_2(s_tdata[2]),
+    .s_axis_tuser_2(s_tuser[2]),
+    .s_axis_tstrb_2(s_tstrb[2]),
+    .s_axis_tvalid_2(s_tvalid[2]),
+    .s_axis_tready_2(tready[2]),
+    .s_axis_tlast_2(s_tlast[2]),
+
+    .s_axis_tdata_3(s_tdata[3]),
+    .s_axis_tuser_3(s_tuser[3]),
+    .s_axis_tstrb_3(s_tstrb[3]),
+    .s_axis_tvalid_3(s_tvalid[3]),
+    .s_axis_tready_3(tready[3]),
+    .s_axis_tlast_3(s_tlast[3]),
+
+    .s_axis_tdata_4(s_tdata[4]),
+    .s_axis_tuser_4(s_tuser[4]),
+    .s_axis_tstrb_4(s_tstrb[4]),
+    .s_axis_tvalid_4(s_tvalid[4]),
+    .s_axis_tready_4(tready[4]),
+    .s_axis_tlast_4(s_tlast[4])
+
+   );
+
+endmodule
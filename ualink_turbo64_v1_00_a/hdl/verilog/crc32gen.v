@@ -0,0 +1,50 @@
+// CRC-32C generator for 64-bit (or wider, see BYTES) input data, the crc8gen.v lookup chain widened to 32 bits
+// Castagnoli polynomial, reflected (0x82F63B78), so the remainder matches the SSE4.2 crc32
+// instruction and the usual software tables on the host side.
+// Bytes are taken lane 0 first (frame order, byte 8w+l in bits [8l+7:8l]) and only where
+// byte_en is set, so a key that starts or ends mid word hashes the same as a byte loop would.
+// Chain crc_out back into crc_in beat by beat, start from 32'hFFFFFFFF and invert at the end.
+// BYTES sets the beat width, 8 for the 64-bit datapath.
+module crc32_64bit_lut #(
+    parameter BYTES = 8
+) (
+    input  wire [8*BYTES-1:0] data_in,
+    input  wire [BYTES-1:0]   byte_en,
+    input  wire [31:0] crc_in,
+    output wire [31:0] crc_out
+);
+
+    // CRC lookup table for 8-bit input
+    function [31:0] crc32c_table;
+        input [7:0] index;
+        reg [31:0] crc;
+        integer i;
+        begin
+            crc = {24'h0, index};
+            for (i = 0; i < 8; i = i + 1) begin
+                if (crc[0])
+                    crc = (crc >> 1) ^ 32'h82F63B78;
+                else
+                    crc = crc >> 1;
+            end
+            crc32c_table = crc;
+        end
+    endfunction
+
+    // Process the bytes one at a time through lookup, skipping disabled lanes
+    wire [31:0] crc_stage[BYTES:0];
+
+    assign crc_stage[0] = crc_in;
+
+    genvar i;
+    generate
+        for (i = 0; i < BYTES; i = i + 1) begin : lut_stage
+            wire [7:0] table_index;
+            assign table_index = crc_stage[i][7:0] ^ data_in[i*8 +: 8];
+            assign crc_stage[i+1] = byte_en[i] ? ((crc_stage[i] >> 8) ^ crc32c_table(table_index)) : crc_stage[i];
+        end
+    endgenerate
+
+    assign crc_out = crc_stage[BYTES];
+
+endmodule
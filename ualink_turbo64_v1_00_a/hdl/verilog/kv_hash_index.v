@@ -0,0 +1,187 @@
+// Bucketed hash index for the memcached KV engine in ualink_turbo64
+// 2^BUCKET_BITS buckets of 2^WAY_BITS ways.  An entry holds the full key and its length, the data
+// slot (64B of the dual port RAM) holding the value, and the value length.  The bucket is picked
+// by the low bits of the CRC-32C of the key (crc32gen.v), the ways are compared against the full key.
+//
+// A request reads one way per clock and always walks every way of the bucket, so a GET or SET takes
+// WAYS+1 clocks from req_valid to rsp_valid whether it hits in way 0, in the last way, or misses.
+//
+// Data slots come from a free list.  A SET streams its value into a slot popped with alloc before the
+// key has been looked up; when the probe is done the entry is pointed at that slot and the slot it
+// replaces goes back on the list (or the new one does, if the SET is refused because the bucket is
+// full).  One slot is always held back so an overwrite can allocate, i.e. at most 2^SLOT_BITS-1 keys.
+// One request at a time; busy is high from req_valid until rsp_valid.
+module kv_hash_index
+#(
+   parameter KEY_BYTES   = 16,
+   parameter SLOT_BITS   = 5,
+   parameter BUCKET_BITS = 3,
+   parameter WAY_BITS    = 2
+)
+(
+   input  wire                    clk,
+   input  wire                    resetn,
+
+   // data slot allocation, alloc pops alloc_slot (only when alloc_ok)
+   input  wire                    alloc,
+   output wire                    alloc_ok,
+   output wire [SLOT_BITS-1:0]    alloc_slot,
+
+   // lookup (req_set=0) or store req_slot under the key (req_set=1)
+   input  wire                    req_valid,
+   input  wire                    req_set,
+   input  wire [8*KEY_BYTES-1:0]  req_key,      // byte i in [8i+7:8i], zero past req_keylen
+   input  wire [7:0]              req_keylen,
+   input  wire [31:0]             req_hash,
+   input  wire [SLOT_BITS-1:0]    req_slot,
+   input  wire [6:0]              req_vlen,
+
+   output reg                     busy,
+   output reg                     rsp_valid,
+   output reg                     rsp_hit,      // GET: key found, SET: stored
+   output reg  [SLOT_BITS-1:0]    rsp_slot,
+   output reg  [6:0]              rsp_vlen,
+   output reg  [8*KEY_BYTES-1:0]  rsp_key,      // the stored key on a GET hit
+   output reg  [7:0]              rsp_keylen
+);
+
+   localparam WAYS     = 1 << WAY_BITS;
+   localparam ENT_BITS = BUCKET_BITS + WAY_BITS;
+   localparam NUM_ENT  = 1 << ENT_BITS;
+   localparam NUM_SLOT = 1 << SLOT_BITS;
+
+   // entry table, one way read per clock
+   reg                    ent_valid [0:NUM_ENT-1];
+   reg [8*KEY_BYTES-1:0]  ent_key   [0:NUM_ENT-1];
+   reg [7:0]              ent_klen  [0:NUM_ENT-1];
+   reg [SLOT_BITS-1:0]    ent_slot  [0:NUM_ENT-1];
+   reg [6:0]              ent_vlen  [0:NUM_ENT-1];
+
+   // free data slots, a circular list
+   reg [SLOT_BITS-1:0]    free_list [0:NUM_SLOT-1];
+   reg [SLOT_BITS-1:0]    free_rd, free_wr;
+   reg [SLOT_BITS:0]      free_cnt;
+   reg                    free_push;
+   reg [SLOT_BITS-1:0]    free_push_slot;
+
+   // request being probed
+   reg                    q_set;
+   reg [8*KEY_BYTES-1:0]  q_key;
+   reg [7:0]              q_klen;
+   reg [BUCKET_BITS-1:0]  q_bucket;
+   reg [SLOT_BITS-1:0]    q_slot;
+   reg [6:0]              q_vlen;
+   reg [WAY_BITS-1:0]     way;
+   reg                    probing, done;
+   reg                    hit, empty_found;
+   reg [WAY_BITS-1:0]     hit_way, empty_way;
+
+   wire [ENT_BITS-1:0]    probe_idx = {q_bucket, way};
+   wire [ENT_BITS-1:0]    hit_idx   = {q_bucket, hit_way};
+   wire [ENT_BITS-1:0]    empty_idx = {q_bucket, empty_way};
+   wire                   probe_match = ent_valid[probe_idx] && ent_klen[probe_idx] == q_klen &&
+                                        ent_key[probe_idx] == q_key;
+
+   assign alloc_ok   = free_cnt != 0;
+   assign alloc_slot = free_list[free_rd];
+
+   integer i;
+
+   always @(posedge clk) begin
+      if (~resetn) begin
+         busy      <= 0;
+         rsp_valid <= 0;
+         probing   <= 0;
+         done      <= 0;
+         free_rd   <= 0;
+         free_wr   <= 0;
+         free_cnt  <= NUM_SLOT;
+         free_push <= 0;
+         for (i = 0; i < NUM_ENT; i = i + 1) ent_valid[i] <= 0;
+         for (i = 0; i < NUM_SLOT; i = i + 1) free_list[i] <= i;
+      end
+      else begin
+         rsp_valid <= 0;
+         free_push <= 0;
+
+         // free list, a pop and a push may land in the same clock
+         if (free_push) begin
+            free_list[free_wr] <= free_push_slot;
+            free_wr <= free_wr + 1'b1;
+         end
+         if (alloc && alloc_ok) free_rd <= free_rd + 1'b1;
+         free_cnt <= free_cnt + (free_push ? 1'b1 : 1'b0) - ((alloc && alloc_ok) ? 1'b1 : 1'b0);
+
+         if (req_valid && !busy) begin
+            busy        <= 1;
+            probing     <= 1;
+            q_set       <= req_set;
+            q_key       <= req_key;
+            q_klen      <= req_keylen;
+            q_bucket    <= req_hash[BUCKET_BITS-1:0];
+            q_slot      <= req_slot;
+            q_vlen      <= req_vlen;
+            way         <= 0;
+            hit         <= 0;
+            empty_found <= 0;
+         end
+
+         // probe: one way per clock, first match and first empty way win
+         if (probing) begin
+            if (probe_match && !hit) begin
+               hit     <= 1;
+               hit_way <= way;
+            end
+            if (!ent_valid[probe_idx] && !empty_found) begin
+               empty_found <= 1;
+               empty_way   <= way;
+            end
+            way <= way + 1'b1;
+            if (way == WAYS - 1) begin
+               probing <= 0;
+               done    <= 1;
+            end
+         end
+
+         if (done) begin
+            done       <= 0;
+            busy       <= 0;
+            rsp_valid  <= 1;
+            rsp_key    <= ent_key[hit_idx];
+            rsp_keylen <= ent_klen[hit_idx];
+            if (!q_set) begin
+               rsp_hit  <= hit;
+               rsp_slot <= ent_slot[hit_idx];
+               rsp_vlen <= ent_vlen[hit_idx];
+            end
+            else if (hit) begin  // overwrite, the old value's slot is freed
+               ent_slot[hit_idx] <= q_slot;
+               ent_vlen[hit_idx] <= q_vlen;
+               free_push         <= 1;
+               free_push_slot    <= ent_slot[hit_idx];
+               rsp_hit           <= 1;
+               rsp_slot          <= q_slot;
+               rsp_vlen          <= q_vlen;
+            end
+            else if (empty_found && free_cnt != 0) begin  // new key, keep a spare slot for overwrites
+               ent_valid[empty_idx] <= 1;
+               ent_key[empty_idx]   <= q_key;
+               ent_klen[empty_idx]  <= q_klen;
+               ent_slot[empty_idx]  <= q_slot;
+               ent_vlen[empty_idx]  <= q_vlen;
+               rsp_hit              <= 1;
+               rsp_slot             <= q_slot;
+               rsp_vlen             <= q_vlen;
+            end
+            else begin  // bucket full, give the slot back
+               free_push      <= 1;
+               free_push_slot <= q_slot;
+               rsp_hit        <= 0;
+               rsp_slot       <= q_slot;
+               rsp_vlen       <= q_vlen;
+            end
+         end
+      end
+   end
+
+endmodule
@@ -39,8 +39,25 @@ response:
 0070   37 45 41 44 42 45 45 46 38 45 41 44 42 45 45 46   7EADBEEF8EADBEEF
 0080   0d 0a 45 4e 44 0d 0a                              ..END..
 
+
+The SET/GET above are sent first as captured.  Keys are hashed in hardware (CRC-32C, crc32gen.v)
+into a bucketed index (kv_hash_index.v), so the tests after that cover multi-byte keys that share
+a first byte, the longest key the index holds, a bucket filled with colliding keys (found here with
+the same CRC), overwrite in a full bucket, misses and refused SETs.  Every response is checked as
+a whole frame: it has to be the next frame out (the request is not forwarded), go back to the
+requester's MAC/IP/port from 11211, carry correct IPv4/UDP lengths and IPv4 header checksum, and
+end with tlast and the right tstrb.  Requests come from a different client address and port each
+time.  A GET to another UDP port is not memcached's and has to be forwarded untouched.  The last
+tests run again with m_axis_tready dropping on a pseudo-random pattern (bp).  The cycles
+each op took are reported at the end: lookup = hash index request to result, frame = first request
+word in to first response word out.  Every GET lookup has to take the same number of cycles.
+
+ The datapath width is UALINK_WIDTH (64, 256 or 512, default 64), e.g. iverilog -DUALINK_WIDTH=256.
+ Frame byte p is driven in beat p/(UALINK_WIDTH/8), and output beats are split back into 64b words
+ so the checks are the same at every width.
+
  to run in Icarus simulator use:
-iverilog -o memcached_UDP64B_tb.vvp .\memcached_UDP64B_tb.v ualink_turbo64.v .\fallthrough_small_fifo_v2.v .\small_fifo_v3.v .\ualink_dpmem.v .\ualink_fma.v
+iverilog -o memcached_UDP64B_tb.vvp .\memcached_UDP64B_tb.v ualink_turbo64.v .\fallthrough_small_fifo_v2.v .\small_fifo_v3.v .\ualink_dpmem.v .\ualink_fma.v .\ualink_systolic.v .\crc32gen.v .\kv_hash_index.v
 vvp memcached_UDP64B_tb.vvp
 gtkwave.exe .\memcached_UDP64B_tb.vcd
 
@@ -48,24 +65,28 @@ gtkwave.exe .\memcached_UDP64B_tb.vcd
  */
 
 `timescale 1 ns / 1ps
+`ifndef UALINK_WIDTH
+`define UALINK_WIDTH 64
+`endif
 module testbench();
 
    // parameter CLK_PERIOD = 10; // 10ns = 100MHz
+    localparam W  = `UALINK_WIDTH;   // datapath width
+    localparam BB = W / 8;           // bytes per beat
 
     reg clk, reset;
-    reg [63:0]  tdata[4:0];
-    reg [4:0]  tlast;
+    reg [W-1:0]  tdata_0;
+    reg [BB-1:0] tstrb_0;
+    reg          tvalid_0, tlast_0;
     wire[4:0]  tready;
-
-   reg 	       tvalid_0 = 0;
-   reg 	       tvalid_1 = 0;
-   reg 	       tvalid_2 = 0;
-   reg 	       tvalid_3 = 0;
-   reg 	       tvalid_4 = 0;
-
-    reg [3:0] random = 0;
-
-    integer i;
+    wire [W-1:0]  m_tdata;
+    wire [BB-1:0] m_tstrb;
+    wire          m_tvalid, m_tlast;
+    reg           m_tready;
+    reg           bp;             // backpressure: m_tready follows bp_lfsr
+    reg [7:0]     bp_lfsr;
+
+    integer i, j, k, mon_n;
 // wireshark displays in little-endian format, so we need to reverse byte order when constructing test packets
 // chipscope has already reversed the byte order for us internally so we need to follow that convention here.
 //wr_x is SET pkt and rd_x is GET pkt
@@ -75,8 +96,8 @@ module testbench();
     wire [63:0] wr_w3 = 64'hA8c000000000D9B9;
     wire [63:0] wr_w4 = 64'h6800CB2B40C20100; //0x2BCB is UDP port number 11211 bits 16-31
     wire [63:0] wr_w5 = 64'h5A30303030309896;  //
-    wire [63:0] wr_w6 = 64'h2061207465730000;  //memcached set key="set <addr> " address is 6th byte  
-    wire [63:0] wr_w7 = 64'h0A0D323720302030;  //memcached size of set decimal 72 (if 8B value, then it will be 8)
+    wire [63:0] wr_w6 = 64'h2061207465730000;  //memcached set key="set <key> "
+    wire [63:0] wr_w7 = 64'h0A0D343620302030;  //memcached size of set decimal 64
     wire [63:0] wr_w8 = 64'h4645454244414531;  //value word 1
     wire [63:0] wr_w9 = 64'h4645454244414532;  //2
     wire [63:0] wr_wa = 64'h4645454244414533;
@@ -85,6 +106,7 @@ module testbench();
     wire [63:0] wr_wd = 64'h4645454244414536;  //6
     wire [63:0] wr_we = 64'h4645454244414537;
     wire [63:0] wr_wf = 64'h4645454244414538;  //8
+    wire [63:0] wr_wg = 64'h0000000000000A0D;  //data block ends with \r\n
 
 
     wire [63:0] rd_w0 = 64'h0000000000000000; // Destination MAC  read opcode
@@ -93,233 +115,443 @@ module testbench();
     wire [63:0] rd_w3 = 64'h007F0100007F564F;
     wire [63:0] rd_w4 = 64'h1700CB2B5DBD0100;
     wire [63:0] rd_w5 = 64'h0100000034122AFE;  //
-    wire [63:0] rd_w6 = 64'h0D61207465670000;  //get address "get a"
+    wire [63:0] rd_w6 = 64'h0D61207465670000;  //get key "get a"
     wire [63:0] rd_w7 = 64'h000000000000000A;  //
-    wire [63:0] rd_w8 = 64'h4141414141414141;
-    wire [63:0] rd_w9 = 64'h4141414141414141;  //4
-    wire [63:0] rd_wa = 64'h4141414141414141;
-    wire [63:0] rd_wb = 64'h4141414141414141;
-    wire [63:0] rd_wc = 64'h4141414141414141;
-    wire [63:0] rd_wd = 64'h4141414141414141;  //8 of 8 data words
-
-    localparam HEADER_0 = 0;
-    localparam HEADER_1 = 1;
-    localparam HEADER_0a = 2;
-    localparam HEADER_1a = 3;
-    localparam PAYLOAD  = 4;
-    localparam DEAD     = 5;
-
-    reg [2:0] state, state_next;
-    reg [7:0] counter, counter_next;
-
-    always @(*) begin
-       state_next = state;
-       tdata[0] = 64'b0;
-       tdata[1] = 64'b0;
-       tdata[2] = 64'b0;
-       tdata[3] = 64'b0;
-       tdata[4] = 64'b0;
-       tlast[0] = 1'b0;
-       tlast[1] = 1'b0;
-       tlast[2] = 1'b0;
-       tlast[3] = 1'b0;
-       tlast[4] = 1'b0;
-       counter_next = counter;
-
-        case(state)
-            HEADER_0: begin
-                tdata[random] = wr_w0;
-                if(tready[random]) begin
-                    state_next = HEADER_1;
-                end
-	       if (random == 0)
-		 tvalid_0 = 1;
-	       else if (random == 1)
-		 tvalid_1 = 1;
-	       else if (random == 2)
-		 tvalid_2 = 1;
-	       else if (random == 3)
-		 tvalid_3 = 1;
-	       else if (random == 4)
-		 tvalid_4 = 1;
-            end
-            HEADER_1: begin
-                tdata[random] = wr_w1;
-                if(tready[random]) begin
-                    state_next = PAYLOAD;
-                end
-            end
-            PAYLOAD: begin
-                tdata[random] = {8{counter}};
-                if(tready[random]) begin
-                    counter_next = counter + 1'b1;
-                    if(counter == 8'h00) begin
-                       tdata[random] = wr_w2;
-                    end
-                    if(counter == 8'h01) begin
-                       tdata[random] = wr_w3;
-                    end
-                    if(counter == 8'h02) begin
-                       tdata[random] = wr_w4;
-                    end
-                    if(counter == 8'h03) begin
-                       tdata[random] = wr_w5;
-                    end
-                    if(counter == 8'h04) begin
-                       tdata[random] = wr_w6;
-                    end
-                    if(counter == 8'h05) begin
-                       tdata[random] = wr_w7;
-                    end
-                    if(counter == 8'h06) begin
-                       tdata[random] = wr_w8;
-                    end
-                    if(counter == 8'h07) begin
-                       tdata[random] = wr_w9;
-                    end
-                    if(counter == 8'h08) begin
-                       tdata[random] = wr_wa;
-                    end
-                    if(counter == 8'h09) begin
-                       tdata[random] = wr_wb;
-                    end
-                    if(counter == 8'h0a) begin
-                       tdata[random] = wr_wc;
-                    end
-                    if(counter == 8'h0b) begin
-                       tdata[random] = wr_wd;
-                    end
-                    if(counter == 8'h0c) begin
-                       tdata[random] = wr_we;
-                    end
-                    if(counter == 8'h0d) begin
-                       tdata[random] = wr_wf;
-                    end
-
-                    if(counter == 8'h1F) begin
-                        state_next = DEAD;
-                        counter_next = 8'b0;
-                        tlast[random] = 1'b1;
-                    end
-                end
-            end  //PAYLOAD state
-
-//try a read operation now
 
-            HEADER_0a: begin
-                tdata[random] = rd_w0;
-                if(tready[random]) begin
-                    counter_next = 8'b0;
-                    state_next = HEADER_1a;
-                end
-         if (random == 0)
-		 tvalid_0 = 1;
-	       else if (random == 1)
-		 tvalid_1 = 1;
-	       else if (random == 2)
-		 tvalid_2 = 1;
-	       else if (random == 3)
-		 tvalid_0 = 1;  //force to port 0 for easier debugging
-	       else if (random == 4)
-		 tvalid_4 = 1;
-            end  //HEADER_0a
-            HEADER_1a: begin
-                tdata[random] = {8{counter}};
-
-                // tdata[random] = rd_w1;
-                if(tready[random]) begin
-                    counter_next = counter + 1'b1;
-                    if(counter == 8'h00) begin
-                       tdata[random] = rd_w1;
-                    end
-                    if(counter == 8'h01) begin
-                       tdata[random] = rd_w2;
-                    end
-                    if(counter == 8'h02) begin
-                       tdata[random] = rd_w3;
-                    end
-                    if(counter == 8'h03) begin
-                       tdata[random] = rd_w4;
-                    end
-                    if(counter == 8'h04) begin
-                       tdata[random] = rd_w5;
-                    end
-                    if(counter == 8'h05) begin
-                       tdata[random] = rd_w6;
-                    end
-                    if(counter == 8'h06) begin
-                       tdata[random] = rd_w7;
-                    end
-                    if(counter == 8'h07) begin
-                       tdata[random] = rd_w8;
-                    end
-                    if(counter == 8'h08) begin
-                       tdata[random] = rd_w9;
-                    end
-                    if(counter == 8'h09) begin
-                       tdata[random] = rd_wa;
-                    end
-                    if(counter == 8'h0a) begin
-                       tdata[random] = rd_wb;
-                    end
-                    if(counter == 8'h0b) begin
-                       tdata[random] = rd_wc;
-                    end
-                    if(counter == 8'h0c) begin
-                       tdata[random] = rd_wd;
-                    end
-
-
-                
-                if(counter == 8'h17) begin
-                    state_next = DEAD;
-                    counter_next = 8'b0;
-                    tlast[random] = 1'b1;
-                end
-                end
-            end  //HEADER_1a
-
-
-            DEAD: begin
-         //   for (i = 0; i < 50; i = i + 1) begin
-         //        @(posedge clk);
-         //   end
-                counter_next = counter + 1'b1;
-                tlast[random] = 1'b0;
-         	tvalid_0 = 0;
-	        tvalid_1 = 0;
-		tvalid_2 = 0;
-		tvalid_3 = 0;
-		tvalid_4 = 0;
-                if(counter[3]==1'b1) begin
-                   counter_next = 8'b0;
-		           random = 0; //$random % 5;  // lock to 0 for easier debugging
-                   if (random == 0)  begin  //do a read op
-                     state_next = HEADER_0a;
-                     $display("Next random = %d", random);
-                   end
-                   else begin
-                     state_next = HEADER_0;
-                   end
+    localparam BUCKET_BITS = 3;   // kv_hash_index buckets in ualink_turbo64 (KV_SLOT_BITS - 2)
+
+    // frame under construction and expected response, byte arrays
+    reg [7:0] pkt [0:255];
+    integer   pkt_len;
+    reg [7:0] rsp [0:255];
+    integer   rsp_len, rsp_words;
+
+    // every accepted output word
+    reg [63:0] out_words [0:8191];
+    reg        out_last  [0:8191];
+    reg [7:0]  out_strb  [0:8191];
+    integer    out_n;
+    integer    search_from;
+    integer    errors;
+
+    // cycle accounting, see the monitors below
+    integer    cycle;
+    integer    t_first, t_req, t_rsp;
+    integer    lookup_cyc, frame_cyc;
+    integer    n_op [0:2], lk_min [0:2], lk_max [0:2], fr_min [0:2], fr_max [0:2], fr_sum [0:2];
+    localparam OP_SET = 0, OP_GET_HIT = 1, OP_GET_MISS = 2;
 
+    always @(posedge clk) begin
+        if (reset) begin
+            out_n <= 0;
+            cycle <= 0;
+        end else begin
+            cycle <= cycle + 1;
+            if (m_tvalid && m_tready) begin   // one entry per 64b word with tstrb set
+                mon_n = 0;
+                for (k = 0; k < BB / 8; k = k + 1)
+                    if (m_tstrb[8*k +: 8] != 0) mon_n = k + 1;
+                for (k = 0; k < mon_n; k = k + 1) begin
+                    out_words[out_n + k] <= m_tdata[64*k +: 64];
+                    out_last[out_n + k]  <= m_tlast && (k == mon_n - 1);
+                    out_strb[out_n + k]  <= m_tstrb[8*k +: 8];
                 end
+                out_n <= out_n + mon_n;
             end
-        endcase
+            if (in_arb.kv_req) t_req <= cycle;
+            if (in_arb.kv_idx_valid) lookup_cyc <= cycle - t_req;
+            if (in_arb.kv_rsp_start) frame_cyc <= cycle - t_first;
+        end
     end
 
     always @(posedge clk) begin
-        if(reset) begin
-            state <= HEADER_0;
-            counter <= 8'b0;
+        bp_lfsr <= {bp_lfsr[6:0], bp_lfsr[7] ^ bp_lfsr[5] ^ bp_lfsr[4] ^ bp_lfsr[3]};
+        m_tready <= ~bp | bp_lfsr[0];
+    end
+
+    // value byte idx of a test value, a counting pattern from seed
+    function [7:0] vbyte;
+        input [7:0] seed;
+        input integer idx;
+        begin
+            vbyte = seed + idx;
         end
-        else begin
-            state <= state_next;
-            counter <= counter_next;
+    endfunction
+
+    // CRC-32C of a key, the bucket it lands in is the low BUCKET_BITS
+    function [31:0] crc32c;
+        input [8*20-1:0] key;    // right aligned, "ab" = 16'h6162
+        input integer    len;
+        integer b, k;
+        reg [31:0] crc;
+        begin
+            crc = 32'hFFFFFFFF;
+            for (b = 0; b < len; b = b + 1) begin
+                crc = crc ^ ((key >> (8 * (len - 1 - b))) & 8'hFF);
+                for (k = 0; k < 8; k = k + 1)
+                    crc = crc[0] ? (crc >> 1) ^ 32'h82F63B78 : crc >> 1;
+            end
+            crc32c = ~crc;
         end
-    end
+    endfunction
+
+    // Ethernet + IPv4 + UDP + memcached UDP header, body_len bytes follow at offset 50
+    task build_headers;
+        input [15:0] reqid;
+        input integer body_len;
+        integer udp_len;
+        begin
+            udp_len = 8 + 8 + body_len;
+            for (i = 0; i < 256; i = i + 1) pkt[i] = 8'h00;
+            pkt[12] = 8'h08; pkt[13] = 8'h00;                                   // ethertype IPv4
+            pkt[14] = 8'h45;                                                    // version 4, IHL 5
+            pkt[16] = (20 + udp_len) >> 8; pkt[17] = (20 + udp_len) & 8'hFF;
+            pkt[22] = 8'h40; pkt[23] = 8'h11;                                   // ttl, UDP
+            pkt[0] = 8'h02; pkt[5] = 8'h01;                                     // server MAC 02:00:00:00:00:01
+            pkt[6] = 8'h02; pkt[9] = reqid[15:8]; pkt[11] = reqid[7:0];         // a client MAC per request
+            pkt[26] = 8'h0A; pkt[28] = reqid[15:8]; pkt[29] = reqid[7:0];       // client 10.0.x.y
+            pkt[30] = 8'h0A; pkt[33] = 8'h01;                                   // server 10.0.0.1
+            pkt[34] = 8'hC0 | reqid[3:0]; pkt[35] = reqid[11:4];                // client port
+            pkt[36] = 8'h2B; pkt[37] = 8'hCB;                                   // 11211
+            pkt[38] = udp_len >> 8; pkt[39] = udp_len & 8'hFF;
+            pkt[42] = reqid[15:8]; pkt[43] = reqid[7:0];                        // request id
+            pkt[47] = 8'h01;                                                    // 1 datagram
+            pkt_len = 50 + body_len;
+            if (pkt_len < 60) pkt_len = 60;                                     // minimum Ethernet frame
+        end
+    endtask
+
+    // copy len bytes of a right aligned string to buf[at]
+    task put_pkt;
+        input integer    at;
+        input [8*20-1:0] str;
+        input integer    len;
+        begin
+            for (i = 0; i < len; i = i + 1) pkt[at + i] = str >> (8 * (len - 1 - i));
+        end
+    endtask
+
+    task put_rsp;
+        input integer    at;
+        input [8*20-1:0] str;
+        input integer    len;
+        begin
+            for (i = 0; i < len; i = i + 1) rsp[at + i] = str >> (8 * (len - 1 - i));
+        end
+    endtask
+
+    // decimal text of n (0..999) into a right aligned string, returns its length in ndig
+    reg [8*3-1:0] dec;
+    integer       ndig;
+    task to_dec;
+        input integer n;
+        reg [7:0] d2, d1, d0;
+        begin
+            d2 = 8'h30 + n / 100;
+            d1 = 8'h30 + (n / 10) % 10;
+            d0 = 8'h30 + n % 10;
+            if (n >= 100)     begin dec = {d2, d1, d0}; ndig = 3; end
+            else if (n >= 10) begin dec = {d1, d0};     ndig = 2; end
+            else              begin dec = d0;           ndig = 1; end
+        end
+    endtask
+
+    // "set <key> 0 0 <vlen>\r\n<value>\r\n"
+    task build_set;
+        input [15:0]     reqid;
+        input [8*20-1:0] key;
+        input integer    keylen;
+        input [7:0]      seed;
+        input integer    vlen;
+        integer at;
+        begin
+            to_dec(vlen);
+            build_headers(reqid, 4 + keylen + 5 + ndig + 2 + vlen + 2);
+            put_pkt(50, "set ", 4);
+            put_pkt(54, key, keylen);
+            at = 54 + keylen;
+            put_pkt(at, " 0 0 ", 5);               at = at + 5;
+            put_pkt(at, dec, ndig);                at = at + ndig;
+            put_pkt(at, 16'h0D0A, 2);              at = at + 2;
+            for (i = 0; i < vlen; i = i + 1) pkt[at + i] = vbyte(seed, i);
+            at = at + vlen;
+            put_pkt(at, 16'h0D0A, 2);
+        end
+    endtask
+
+    // "get <key>\r\n"
+    task build_get;
+        input [15:0]     reqid;
+        input [8*20-1:0] key;
+        input integer    keylen;
+        begin
+            build_headers(reqid, 4 + keylen + 2);
+            put_pkt(50, "get ", 4);
+            put_pkt(54, key, keylen);
+            put_pkt(54 + keylen, 16'h0D0A, 2);
+        end
+    endtask
+
+    // one of the captured frames above, as words
+    task load_words;
+        input [63:0] w;
+        input integer idx;
+        begin
+            for (j = 0; j < 8; j = j + 1) pkt[8*idx + j] = w[8*j +: 8];
+        end
+    endtask
+
+    // drive pkt[0:pkt_len-1] on port 0, one beat per clock, then idle
+    task send_pkt;
+        integer w, nwords;
+        reg [W-1:0]  word;
+        reg [BB-1:0] strb;
+        begin
+            nwords = (pkt_len + BB - 1) / BB;
+            lookup_cyc = -1;
+            frame_cyc = -1;
+            for (w = 0; w < nwords; w = w + 1) begin
+                for (j = 0; j < BB; j = j + 1) begin
+                    word[8*j +: 8] = (BB*w + j < pkt_len) ? pkt[BB*w + j] : 8'h00;
+                    strb[j]        = BB*w + j < pkt_len;
+                end
+                @(posedge clk);
+                if (w == 0) t_first <= cycle;
+                tdata_0  <= word;
+                tstrb_0  <= strb;
+                tvalid_0 <= 1;
+                tlast_0  <= (w == nwords - 1);
+                while (!tready[0]) @(posedge clk);
+            end
+            @(posedge clk);
+            tvalid_0 <= 0;
+            tlast_0  <= 0;
+            repeat (bp ? 120 : 40) @(posedge clk);
+        end
+    endtask
+
+    // expected response frame, byte 40 on: UDP checksum 0, request id, sequence 0, 1 datagram,
+    // reserved, then the text.  The headers in front are filled in by check_rsp.
+    task rsp_start;
+        input [15:0] reqid;
+        begin
+            for (i = 0; i < 256; i = i + 1) rsp[i] = 8'h00;
+            rsp[42] = reqid[15:8]; rsp[43] = reqid[7:0];
+            rsp[47] = 8'h01;
+            rsp_len = 50;
+        end
+    endtask
+
+    // Ethernet/IPv4/UDP header of the response to the request in pkt[]: addresses and ports swapped
+    task rsp_headers;
+        integer sum, ip_len;
+        begin
+            for (i = 0; i < 6; i = i + 1) begin
+                rsp[i]     = pkt[6 + i];
+                rsp[6 + i] = pkt[i];
+            end
+            rsp[12] = 8'h08; rsp[13] = 8'h00;
+            rsp[14] = 8'h45;
+            ip_len = rsp_len - 14;
+            rsp[16] = ip_len >> 8; rsp[17] = ip_len & 8'hFF;
+            rsp[20] = 8'h40;                                                    // don't fragment
+            rsp[22] = 8'h40; rsp[23] = 8'h11;
+            for (i = 0; i < 4; i = i + 1) begin
+                rsp[26 + i] = pkt[30 + i];
+                rsp[30 + i] = pkt[26 + i];
+            end
+            rsp[34] = pkt[36]; rsp[35] = pkt[37];
+            rsp[36] = pkt[34]; rsp[37] = pkt[35];
+            rsp[38] = (ip_len - 20) >> 8; rsp[39] = (ip_len - 20) & 8'hFF;
+            sum = 0;
+            for (i = 14; i < 34; i = i + 2) sum = sum + {rsp[i], rsp[i + 1]};
+            sum = (sum & 16'hFFFF) + (sum >> 16);
+            sum = (sum & 16'hFFFF) + (sum >> 16);
+            rsp[24] = ~sum >> 8; rsp[25] = ~sum & 8'hFF;
+            rsp_words = ((rsp_len < 60 ? 60 : rsp_len) + 7) / 8;
+        end
+    endtask
+
+    task rsp_text;
+        input [8*20-1:0] str;
+        input integer    len;
+        begin
+            put_rsp(rsp_len, str, len);
+            rsp_len = rsp_len + len;
+        end
+    endtask
+
+    // "VALUE <key> 0 <vlen>\r\n<value>\r\nEND\r\n"
+    task build_rsp_value;
+        input [15:0]     reqid;
+        input [8*20-1:0] key;
+        input integer    keylen;
+        input [7:0]      seed;
+        input integer    vlen;
+        begin
+            rsp_start(reqid);
+            to_dec(vlen);
+            rsp_text("VALUE ", 6);
+            rsp_text(key, keylen);
+            rsp_text(" 0 ", 3);
+            rsp_text(dec, ndig);
+            rsp_text(16'h0D0A, 2);
+            for (i = 0; i < vlen; i = i + 1) rsp[rsp_len + i] = vbyte(seed, i);
+            rsp_len = rsp_len + vlen;
+            rsp_text({16'h0D0A, "END", 16'h0D0A}, 7);
+        end
+    endtask
+
+    // the value of the captured SET, wr_w8..wr_wf
+    task build_rsp_captured;
+        input [15:0] reqid;
+        reg [64*8-1:0] val;
+        begin
+            val = {wr_wf, wr_we, wr_wd, wr_wc, wr_wb, wr_wa, wr_w9, wr_w8};
+            rsp_start(reqid);
+            rsp_text({"VALUE a 0 64", 16'h0D0A}, 14);
+            for (i = 0; i < 64; i = i + 1) rsp[rsp_len + i] = val[8*i +: 8];
+            rsp_len = rsp_len + 64;
+            rsp_text({16'h0D0A, "END", 16'h0D0A}, 7);
+        end
+    endtask
+
+    task build_rsp_line;   // a one line reply, \r\n added
+        input [15:0]     reqid;
+        input [8*20-1:0] line;
+        input integer    len;
+        begin
+            rsp_start(reqid);
+            rsp_text(line, len);
+            rsp_text(16'h0D0A, 2);
+        end
+    endtask
+
+    // the response has to be the next frame out: every word, tlast only on the last one, and
+    // tstrb on the last one covering the frame (60B minimum)
+    task check_rsp;
+        input [8*32-1:0] name;
+        begin
+            rsp_headers();
+            check_out(name);
+        end
+    endtask
+
+    // a frame the memcached engine does not answer has to go out as it came in
+    task check_fwd;
+        input [8*32-1:0] name;
+        begin
+            for (i = 0; i < 256; i = i + 1) rsp[i] = pkt[i];
+            rsp_len = pkt_len;
+            rsp_words = (pkt_len + 7) / 8;
+            check_out(name);
+        end
+    endtask
+
+    // rsp[0:rsp_len-1] has to be the next frame out
+    task check_out;
+        input [8*32-1:0] name;
+        integer w, ok, flen;
+        reg [63:0] word;
+        begin
+            flen = rsp_len < 60 ? 60 : rsp_len;
+            ok = search_from + rsp_words <= out_n;
+            for (w = 0; w < rsp_words && ok; w = w + 1) begin
+                for (j = 0; j < 8; j = j + 1) word[8*j +: 8] = rsp[8*w + j];
+                if (out_words[search_from + w] !== word) ok = 0;
+                if (out_last[search_from + w] !== (w == rsp_words - 1)) ok = 0;
+            end
+            if (ok && out_strb[search_from + rsp_words - 1] !== (8'hFF >> (8 * rsp_words - flen))) ok = 0;
+            if (!ok) begin
+                errors = errors + 1;
+                $display("FAIL: %0s response is not the next frame, output words %0d..%0d", name, search_from, out_n - 1);
+                for (w = 0; w < rsp_words; w = w + 1) begin
+                    for (j = 0; j < 8; j = j + 1) word[8*j +: 8] = rsp[8*w + j];
+                    $display("      expected word %0d: %h", w, word);
+                end
+                for (w = search_from; w < out_n; w = w + 1)
+                    $display("      got word %0d: %h last %b strb %h", w - search_from, out_words[w], out_last[w], out_strb[w]);
+                search_from = out_n;
+            end else if (frame_cyc < 0) begin
+                $display("PASS: %0s at output word %0d", name, search_from);
+                search_from = search_from + rsp_words;
+            end else begin
+                $display("PASS: %0s response at output word %0d, lookup %0d cycles, frame to response %0d cycles",
+                         name, search_from, lookup_cyc, frame_cyc);
+                search_from = search_from + rsp_words;
+            end
+        end
+    endtask
+
+    // add the last op to the cycles-per-op report
+    task account;
+        input integer op;
+        begin
+            n_op[op] = n_op[op] + 1;
+            if (lookup_cyc >= 0) begin
+                if (lk_min[op] < 0 || lookup_cyc < lk_min[op]) lk_min[op] = lookup_cyc;
+                if (lookup_cyc > lk_max[op]) lk_max[op] = lookup_cyc;
+            end
+            if (fr_min[op] < 0 || frame_cyc < fr_min[op]) fr_min[op] = frame_cyc;
+            if (frame_cyc > fr_max[op]) fr_max[op] = frame_cyc;
+            fr_sum[op] = fr_sum[op] + frame_cyc;
+        end
+    endtask
+
+    task do_set;
+        input [15:0]     reqid;
+        input [8*20-1:0] key;
+        input integer    keylen;
+        input [7:0]      seed;
+        input integer    vlen;
+        input            stored;
+        input [8*32-1:0] name;
+        begin
+            build_set(reqid, key, keylen, seed, vlen);
+            send_pkt();
+            if (stored)          build_rsp_line(reqid, "STORED", 6);
+            else if (vlen > 64)  begin rsp_start(reqid); rsp_text("SERVER_ERROR object ", 20); rsp_text("too large for cache", 19); rsp_text(16'h0D0A, 2); end
+            else                 begin rsp_start(reqid); rsp_text("SERVER_ERROR out of ", 20); rsp_text("memory storing ", 15); rsp_text("object", 6); rsp_text(16'h0D0A, 2); end
+            check_rsp(name);
+            account(OP_SET);
+        end
+    endtask
+
+    task do_get;
+        input [15:0]     reqid;
+        input [8*20-1:0] key;
+        input integer    keylen;
+        input [7:0]      seed;
+        input integer    vlen;     // -1: expect a miss
+        input [8*32-1:0] name;
+        begin
+            build_get(reqid, key, keylen);
+            send_pkt();
+            if (vlen >= 0) build_rsp_value(reqid, key, keylen, seed, vlen);
+            else           build_rsp_line(reqid, "END", 3);
+            check_rsp(name);
+            account(vlen >= 0 ? OP_GET_HIT : OP_GET_MISS);
+        end
+    endtask
+
+    // keys "c00".."c99" that land in the same bucket as "a"
+    reg [8*20-1:0] ckey [0:3];
+    integer        nck;
 
   initial begin
       clk   = 1'b0;
+      tdata_0 = 0;
+      tstrb_0 = 0;
+      tvalid_0 = 0;
+      tlast_0 = 0;
+      m_tready = 1;
+      bp = 0;
+      bp_lfsr = 8'h5A;
+      errors = 0;
+      search_from = 0;
+      for (i = 0; i < 3; i = i + 1) begin
+         n_op[i] = 0; lk_min[i] = -1; lk_max[i] = 0; fr_min[i] = -1; fr_max[i] = 0; fr_sum[i] = 0;
+      end
 
       $display("[%t] : System Reset Asserted...", $realtime);
       $dumpfile("memcached_UDP64B_tb.vcd");
@@ -331,10 +563,134 @@ module testbench();
       end
       $display("[%t] : System Reset De-asserted...", $realtime);
       reset = 1'b0;
+      repeat (4) @(posedge clk);
+
+      // Test 1: the captured 64B SET and GET of key "a"
+      $display("\n=== Test 1: captured SET/GET, key a ===");
+      for (i = 0; i < 256; i = i + 1) pkt[i] = 8'h00;
+      load_words(wr_w0, 0);  load_words(wr_w1, 1);  load_words(wr_w2, 2);  load_words(wr_w3, 3);
+      load_words(wr_w4, 4);  load_words(wr_w5, 5);  load_words(wr_w6, 6);  load_words(wr_w7, 7);
+      load_words(wr_w8, 8);  load_words(wr_w9, 9);  load_words(wr_wa, 10); load_words(wr_wb, 11);
+      load_words(wr_wc, 12); load_words(wr_wd, 13); load_words(wr_we, 14); load_words(wr_wf, 15);
+      load_words(wr_wg, 16);
+      pkt_len = 17 * 8;
+      send_pkt();
+      build_rsp_line({wr_w5[23:16], wr_w5[31:24]}, "STORED", 6);
+      check_rsp("captured SET a");
+      account(OP_SET);
+
+      for (i = 0; i < 256; i = i + 1) pkt[i] = 8'h00;
+      load_words(rd_w0, 0); load_words(rd_w1, 1); load_words(rd_w2, 2); load_words(rd_w3, 3);
+      load_words(rd_w4, 4); load_words(rd_w5, 5); load_words(rd_w6, 6); load_words(rd_w7, 7);
+      pkt_len = 8 * 8;
+      send_pkt();
+      build_rsp_captured(16'h1234);
+      check_rsp("captured GET a");
+      account(OP_GET_HIT);
+
+      // Test 2: a key that was never stored
+      $display("\n=== Test 2: GET miss ===");
+      do_get(16'h2000, "nokey", 5, 8'h00, -1, "GET nokey");
+
+      // Test 3: keys with the same first byte no longer share a slot
+      $display("\n=== Test 3: multi-byte keys ===");
+      do_set(16'h3000, "ab", 2, 8'h10, 20, 1, "SET ab");
+      do_set(16'h3001, "ac", 2, 8'h50, 33, 1, "SET ac");
+      do_set(16'h3002, "user:1003", 9, 8'h90, 7, 1, "SET user:1003");
+      do_get(16'h3003, "ab", 2, 8'h10, 20, "GET ab");
+      do_get(16'h3004, "ac", 2, 8'h50, 33, "GET ac");
+      do_get(16'h3005, "user:1003", 9, 8'h90, 7, "GET user:1003");
+      do_get(16'h3006, "user:100", 8, 8'h00, -1, "GET user:100 (prefix)");
+
+      // Test 4: longest key the index holds, and one byte more
+      $display("\n=== Test 4: 16 and 17 byte keys ===");
+      do_set(16'h4000, "0123456789abcdef", 16, 8'hC0, 64, 1, "SET 16B key");
+      do_get(16'h4001, "0123456789abcdef", 16, 8'hC0, 64, "GET 16B key");
+      do_set(16'h4002, "0123456789abcdefg", 17, 8'hD0, 8, 0, "SET 17B key refused");
+      do_get(16'h4003, "0123456789abcdefg", 17, 8'h00, -1, "GET 17B key");
+
+      // Test 5: fill the bucket of "a", the next colliding key does not fit
+      $display("\n=== Test 5: colliding keys ===");
+      nck = 0;
+      for (j = 0; j < 100 && nck < 4; j = j + 1) begin
+         to_dec(j + 100);
+         ckey[nck] = {"c", dec[15:0]};
+         if (crc32c(ckey[nck], 3) % (1 << BUCKET_BITS) == crc32c("a", 1) % (1 << BUCKET_BITS)) nck = nck + 1;
+      end
+      $display("bucket %0d: a %0s %0s %0s %0s", crc32c("a", 1) % (1 << BUCKET_BITS),
+               ckey[0][23:0], ckey[1][23:0], ckey[2][23:0], ckey[3][23:0]);
+      do_set(16'h5000, ckey[0], 3, 8'h21, 11, 1, "SET collide 1");
+      do_set(16'h5001, ckey[1], 3, 8'h42, 24, 1, "SET collide 2");
+      do_set(16'h5002, ckey[2], 3, 8'h63, 64, 1, "SET collide 3");
+      do_set(16'h5003, ckey[3], 3, 8'h84, 9, 0, "SET collide 4 (bucket full)");
+      do_get(16'h5004, ckey[0], 3, 8'h21, 11, "GET collide 1");
+      do_get(16'h5005, ckey[1], 3, 8'h42, 24, "GET collide 2");
+      do_get(16'h5006, ckey[2], 3, 8'h63, 64, "GET collide 3");
+      do_get(16'h5007, ckey[3], 3, 8'h00, -1, "GET collide 4 (full bucket)");
+      build_get(16'h5008, "a", 1);
+      send_pkt();
+      build_rsp_captured(16'h5008);
+      check_rsp("GET a after collisions");
+      account(OP_GET_HIT);
+
+      // Test 6: overwrite still works with the bucket full
+      $display("\n=== Test 6: overwrite ===");
+      do_set(16'h6000, ckey[1], 3, 8'hE0, 5, 1, "SET collide 2 again");
+      do_get(16'h6001, ckey[1], 3, 8'hE0, 5, "GET collide 2 new value");
+      do_set(16'h6002, "e", 1, 8'h00, 0, 1, "SET empty value");
+      do_get(16'h6003, "e", 1, 8'h00, 0, "GET empty value");
+
+      // Test 7: values over one 64B slot are refused
+      $display("\n=== Test 7: value too large ===");
+      do_set(16'h7000, "big", 3, 8'h70, 100, 0, "SET 100B refused");
+      do_get(16'h7001, "big", 3, 8'h00, -1, "GET big");
+
+      // Test 8: a get to another UDP port is not memcached's, it is forwarded untouched
+      $display("\n=== Test 8: other UDP port ===");
+      build_get(16'h8000, "a", 1);
+      pkt[37] = 8'hCC;                                                    // 11212
+      send_pkt();
+      check_fwd("GET a to port 11212 forwarded");
+      build_get(16'h8001, "a", 1);
+      send_pkt();
+      build_rsp_captured(16'h8001);
+      check_rsp("GET a to 11211 after it");
+      account(OP_GET_HIT);
+
+      // Test 9: responses and forwarded frames with the output stalling under them
+      $display("\n=== Test 9: m_axis_tready dropping ===");
+      bp = 1;
+      do_get(16'h9000, "ab", 2, 8'h10, 20, "GET ab stalled");
+      do_get(16'h9001, "0123456789abcdef", 16, 8'hC0, 64, "GET 16B key stalled");
+      do_set(16'h9002, "st", 2, 8'h35, 45, 1, "SET st stalled");
+      do_get(16'h9003, "st", 2, 8'h35, 45, "GET st stalled");
+      do_get(16'h9004, "nokey", 5, 8'h00, -1, "GET nokey stalled");
+      build_get(16'h9005, "a", 1);
+      pkt[37] = 8'hCC;
+      send_pkt();
+      check_fwd("GET a to port 11212 stalled");
+      bp = 0;
+
+      $display("\n=== cycles per op (200MHz clock) ===");
+      $display("op        count  lookup min/max  frame-to-response min/max/avg");
+      $display("SET       %5d  %6d/%0d      %6d/%0d/%0d", n_op[OP_SET], lk_min[OP_SET], lk_max[OP_SET],
+               fr_min[OP_SET], fr_max[OP_SET], fr_sum[OP_SET] / n_op[OP_SET]);
+      $display("GET hit   %5d  %6d/%0d      %6d/%0d/%0d", n_op[OP_GET_HIT], lk_min[OP_GET_HIT], lk_max[OP_GET_HIT],
+               fr_min[OP_GET_HIT], fr_max[OP_GET_HIT], fr_sum[OP_GET_HIT] / n_op[OP_GET_HIT]);
+      $display("GET miss  %5d  %6d/%0d      %6d/%0d/%0d", n_op[OP_GET_MISS], lk_min[OP_GET_MISS], lk_max[OP_GET_MISS],
+               fr_min[OP_GET_MISS], fr_max[OP_GET_MISS], fr_sum[OP_GET_MISS] / n_op[OP_GET_MISS]);
+      if (lk_min[OP_GET_HIT] != lk_max[OP_GET_HIT] || lk_min[OP_GET_MISS] != lk_max[OP_GET_MISS] ||
+          lk_min[OP_GET_HIT] != lk_min[OP_GET_MISS]) begin
+         errors = errors + 1;
+         $display("FAIL: GET lookups do not all take the same number of cycles");
+      end
+
       $display("\n========================================");
+      if (errors == 0) $display("memcached ASCII tests PASSED");
+      else             $display("memcached ASCII tests: %0d FAIL", errors);
       $display("All Tests Completed!");
       $display("========================================");
-      #3000  ;    $finish;       //end simulation
+      #100  ;    $finish;       //end simulation
   end
 
   always #2.5  clk = ~clk;      // 200MHz
@@ -342,8 +698,8 @@ module testbench();
 
 
   ualink_turbo64 
-    #(.C_M_AXIS_DATA_WIDTH(64),
-      .C_S_AXIS_DATA_WIDTH(64),
+    #(.C_M_AXIS_DATA_WIDTH(W),
+      .C_S_AXIS_DATA_WIDTH(W),
       .C_M_AXIS_TUSER_WIDTH(128),
       .C_S_AXIS_TUSER_WIDTH(128)
      ) in_arb
@@ -353,47 +709,47 @@ module testbench();
     .axi_resetn(~reset),
 
     // Master Stream Ports
-    .m_axis_tdata(),
-    .m_axis_tstrb(),
-    .m_axis_tvalid(),
-    .m_axis_tready(1'b1),
-    .m_axis_tlast(),
+    .m_axis_tdata(m_tdata),
+    .m_axis_tstrb(m_tstrb),
+    .m_axis_tvalid(m_tvalid),
+    .m_axis_tready(m_tready),
+    .m_axis_tlast(m_tlast),
 
     // Slave Stream Ports
-    .s_axis_tdata_0(tdata[0]),
+    .s_axis_tdata_0(tdata_0),
     .s_axis_tuser_0(128'hAA),
-    .s_axis_tstrb_0(8'hFF),
+    .s_axis_tstrb_0(tstrb_0),
     .s_axis_tvalid_0(tvalid_0),
     .s_axis_tready_0(tready[0]),
-    .s_axis_tlast_0(tlast[0]),
+    .s_axis_tlast_0(tlast_0),
 
-    .s_axis_tdata_1(tdata[1]),
+    .s_axis_tdata_1({W{1'b0}}),
     .s_axis_tuser_1(128'hAA),
-    .s_axis_tstrb_1(8'hFF),
-    .s_axis_tvalid_1(tvalid_1),
+    .s_axis_tstrb_1({BB{1'b1}}),
+    .s_axis_tvalid_1(1'b0),
     .s_axis_tready_1(tready[1]),
-    .s_axis_tlast_1(tlast[1]),
+    .s_axis_tlast_1(1'b0),
 
-    .s_axis_tdata_2(tdata[2]),
+    .s_axis_tdata_2({W{1'b0}}),
     .s_axis_tuser_2(128'hAA),
-    .s_axis_tstrb_2(8'hFF),
-    .s_axis_tvalid_2(tvalid_2),
+    .s_axis_tstrb_2({BB{1'b1}}),
+    .s_axis_tvalid_2(1'b0),
     .s_axis_tready_2(tready[2]),
-    .s_axis_tlast_2(tlast[2]),
+    .s_axis_tlast_2(1'b0),
 
-    .s_axis_tdata_3(tdata[3]),
+    .s_axis_tdata_3({W{1'b0}}),
     .s_axis_tuser_3(128'hAA),
-    .s_axis_tstrb_3(8'hFF),
-    .s_axis_tvalid_3(tvalid_3),
+    .s_axis_tstrb_3({BB{1'b1}}),
+    .s_axis_tvalid_3(1'b0),
     .s_axis_tready_3(tready[3]),
-    .s_axis_tlast_3(tlast[3]),
+    .s_axis_tlast_3(1'b0),
 
-    .s_axis_tdata_4(tdata[4]),
+    .s_axis_tdata_4({W{1'b0}}),
     .s_axis_tuser_4(128'hAA),
-    .s_axis_tstrb_4(8'hFF),
-    .s_axis_tvalid_4(tvalid_4),
+    .s_axis_tstrb_4({BB{1'b1}}),
+    .s_axis_tvalid_4(1'b0),
     .s_axis_tready_4(tready[4]),
-    .s_axis_tlast_4(tlast[4])
+    .s_axis_tlast_4(1'b0)
 
    );
 
@@ -0,0 +1,384 @@
+//Tests the memcached binary protocol path of ualink_turbo64: binary SET/GET frames on port 0,
+//checks the binary response the KV engine sends back in place of each request (from frame byte 40 on).
+//Frames are built byte by byte like the host client (memcached_binary.h) sends them, then packed
+//little-endian into beats of UALINK_WIDTH bits (64, 256 or 512, default 64, -DUALINK_WIDTH=256):
+//frame byte p sits in bits [8l+7:8l] of beat p/(UALINK_WIDTH/8), l = p%(UALINK_WIDTH/8).  Output
+//beats are split back into 64b words for the checks.  The GETs are then repeated with m_axis_tready
+//dropping on a pseudo-random pattern, and every response frame has to come out whole, as many
+//words as its length in m_axis_tuser says.
+
+// iverilog -g2012 -o memcached_bin_tb.vvp memcached_bin_tb.v ualink_turbo64.v fallthrough_small_fifo_v2.v small_fifo_v3.v ualink_dpmem.v ualink_fma.v ualink_systolic.v
+// vvp memcached_bin_tb.vvp
+// gtkwave.exe memcached_bin_tb.vcd
+
+`timescale 1ns / 1ps
+`ifndef UALINK_WIDTH
+`define UALINK_WIDTH 64
+`endif
+
+module memcached_bin_tb;
+
+    parameter CLK_PERIOD = 10; // 10ns = 100MHz
+    localparam W  = `UALINK_WIDTH;   // datapath width
+    localparam BB = W / 8;           // bytes per beat
+
+    reg axi_aclk;
+    reg axi_resetn;
+
+    wire [W-1:0]  m_axis_tdata;
+    wire [BB-1:0] m_axis_tstrb;
+    wire [31:0] m_axis_tuser;
+    wire m_axis_tvalid;
+    reg  m_axis_tready;
+    wire m_axis_tlast;
+
+    reg  [W-1:0]  s_axis_tdata_0;
+    reg  [BB-1:0] s_axis_tstrb_0;
+    reg  s_axis_tvalid_0;
+    wire s_axis_tready_0;
+    reg  s_axis_tlast_0;
+    wire s_axis_tready_1, s_axis_tready_2, s_axis_tready_3, s_axis_tready_4;
+
+    ualink_turbo64 #(.C_M_AXIS_DATA_WIDTH(W), .C_S_AXIS_DATA_WIDTH(W)) dut (
+        .axi_aclk(axi_aclk),
+        .axi_resetn(axi_resetn),
+        .m_axis_tdata(m_axis_tdata),
+        .m_axis_tstrb(m_axis_tstrb),
+        .m_axis_tuser(m_axis_tuser),
+        .m_axis_tvalid(m_axis_tvalid),
+        .m_axis_tready(m_axis_tready),
+        .m_axis_tlast(m_axis_tlast),
+        .s_axis_tdata_0(s_axis_tdata_0),
+        .s_axis_tstrb_0(s_axis_tstrb_0),
+        .s_axis_tuser_0(32'h0),
+        .s_axis_tvalid_0(s_axis_tvalid_0),
+        .s_axis_tready_0(s_axis_tready_0),
+        .s_axis_tlast_0(s_axis_tlast_0),
+        .s_axis_tdata_1({W{1'b0}}), .s_axis_tstrb_1({BB{1'b1}}), .s_axis_tuser_1(32'h0),
+        .s_axis_tvalid_1(1'b0), .s_axis_tready_1(s_axis_tready_1), .s_axis_tlast_1(1'b0),
+        .s_axis_tdata_2({W{1'b0}}), .s_axis_tstrb_2({BB{1'b1}}), .s_axis_tuser_2(32'h0),
+        .s_axis_tvalid_2(1'b0), .s_axis_tready_2(s_axis_tready_2), .s_axis_tlast_2(1'b0),
+        .s_axis_tdata_3({W{1'b0}}), .s_axis_tstrb_3({BB{1'b1}}), .s_axis_tuser_3(32'h0),
+        .s_axis_tvalid_3(1'b0), .s_axis_tready_3(s_axis_tready_3), .s_axis_tlast_3(1'b0),
+        .s_axis_tdata_4({W{1'b0}}), .s_axis_tstrb_4({BB{1'b1}}), .s_axis_tuser_4(32'h0),
+        .s_axis_tvalid_4(1'b0), .s_axis_tready_4(s_axis_tready_4), .s_axis_tlast_4(1'b0)
+    );
+
+    // frame under construction and expected response, byte arrays
+    reg [7:0] pkt [0:255];
+    integer   pkt_len;
+    reg [7:0] rsp [0:127];
+    integer   rsp_words;
+
+    // every accepted output word
+    reg [63:0] out_words [0:4095];
+    integer    out_n;
+    integer    search_from;
+    integer    errors;
+    integer    frame_words;   // words of the output frame so far
+    reg        bp;            // backpressure: m_axis_tready follows bp_lfsr
+    reg [7:0]  bp_lfsr;
+    integer    i, j, k, mon_n;
+
+    initial begin
+        axi_aclk = 0;
+        forever #(CLK_PERIOD/2) axi_aclk = ~axi_aclk;
+    end
+
+    always @(posedge axi_aclk) begin
+        if (!axi_resetn) begin
+            out_n <= 0;
+            frame_words = 0;
+        end else if (m_axis_tvalid && m_axis_tready) begin   // one entry per 64b word with tstrb set
+            mon_n = 0;
+            for (k = 0; k < BB / 8; k = k + 1)
+                if (m_axis_tstrb[8*k +: 8] != 0) mon_n = k + 1;
+            for (k = 0; k < mon_n; k = k + 1)
+                out_words[out_n + k] <= m_axis_tdata[64*k +: 64];
+            out_n <= out_n + mon_n;
+            frame_words = frame_words + mon_n;
+            if (m_axis_tlast) begin
+                if (frame_words != (m_axis_tuser[15:0] + 7) / 8) begin
+                    errors = errors + 1;
+                    $display("FAIL: response frame of %0d words, its length is %0d bytes", frame_words, m_axis_tuser[15:0]);
+                end
+                frame_words = 0;
+            end
+        end
+    end
+
+    always @(posedge axi_aclk) begin
+        bp_lfsr <= {bp_lfsr[6:0], bp_lfsr[7] ^ bp_lfsr[5] ^ bp_lfsr[4] ^ bp_lfsr[3]};
+        m_axis_tready <= ~bp | bp_lfsr[0];
+    end
+
+    // value byte j of a test value, a counting pattern from seed
+    function [7:0] vbyte;
+        input [7:0] seed;
+        input integer idx;
+        begin
+            vbyte = seed + idx;
+        end
+    endfunction
+
+    // Ethernet + IPv4 + UDP + memcached UDP header, body_len bytes follow at offset 50
+    task build_headers;
+        input [15:0] reqid;
+        input integer body_len;
+        integer udp_len;
+        begin
+            udp_len = 8 + 8 + body_len;
+            for (i = 0; i < 256; i = i + 1) pkt[i] = 8'h00;
+            pkt[12] = 8'h08; pkt[13] = 8'h00;                                   // ethertype IPv4
+            pkt[14] = 8'h45;                                                    // version 4, IHL 5
+            pkt[16] = (20 + udp_len) >> 8; pkt[17] = (20 + udp_len) & 8'hFF;
+            pkt[22] = 8'h40; pkt[23] = 8'h11;                                   // ttl, UDP
+            pkt[26] = 8'h7F; pkt[29] = 8'h01; pkt[30] = 8'h7F; pkt[33] = 8'h01; // 127.0.0.1 both ways
+            pkt[34] = 8'hC0; pkt[35] = 8'h8B; pkt[36] = 8'h2B; pkt[37] = 8'hCB; // ports, 11211
+            pkt[38] = udp_len >> 8; pkt[39] = udp_len & 8'hFF;
+            pkt[42] = reqid[15:8]; pkt[43] = reqid[7:0];                        // request id
+            pkt[47] = 8'h01;                                                    // 1 datagram
+            pkt_len = 50 + body_len;
+        end
+    endtask
+
+    // 24 byte binary request header at offset 50
+    task build_bin_header;
+        input [7:0]  opcode;
+        input integer keylen;
+        input [7:0]  extlen;
+        input integer bodylen;
+        input [31:0] opaque;
+        begin
+            pkt[50] = 8'h80;
+            pkt[51] = opcode;
+            pkt[52] = keylen >> 8;  pkt[53] = keylen & 8'hFF;
+            pkt[54] = extlen;
+            pkt[58] = bodylen >> 24; pkt[59] = bodylen >> 16; pkt[60] = bodylen >> 8; pkt[61] = bodylen;
+            pkt[62] = opaque[31:24]; pkt[63] = opaque[23:16]; pkt[64] = opaque[15:8]; pkt[65] = opaque[7:0];
+        end
+    endtask
+
+    // key is right aligned in a 64b vector, "ab" = 16'h6162
+    task build_get;
+        input [15:0] reqid;
+        input [63:0] key;
+        input integer keylen;
+        input [31:0] opaque;
+        begin
+            build_headers(reqid, 24 + keylen);
+            build_bin_header(8'h00, keylen, 8'h00, keylen, opaque);
+            for (i = 0; i < keylen; i = i + 1) pkt[74 + i] = key >> (8 * (keylen - 1 - i));
+        end
+    endtask
+
+    task build_set;
+        input [15:0] reqid;
+        input [63:0] key;
+        input integer keylen;
+        input [7:0]  seed;
+        input integer vlen;
+        input [31:0] opaque;
+        begin
+            build_headers(reqid, 24 + 8 + keylen + vlen);
+            build_bin_header(8'h01, keylen, 8'h08, 8 + keylen + vlen, opaque);
+            for (i = 0; i < keylen; i = i + 1) pkt[82 + i] = key >> (8 * (keylen - 1 - i));
+            for (i = 0; i < vlen; i = i + 1) pkt[82 + keylen + i] = vbyte(seed, i);
+        end
+    endtask
+
+    // drive pkt[0:pkt_len-1] on port 0, one beat per clock, then idle
+    task send_pkt;
+        integer w, nwords;
+        reg [W-1:0]  word;
+        reg [BB-1:0] strb;
+        begin
+            nwords = (pkt_len + BB - 1) / BB;
+            for (w = 0; w < nwords; w = w + 1) begin
+                for (j = 0; j < BB; j = j + 1) begin
+                    word[8*j +: 8] = (BB*w + j < pkt_len) ? pkt[BB*w + j] : 8'h00;
+                    strb[j]        = BB*w + j < pkt_len;
+                end
+                @(posedge axi_aclk);
+                s_axis_tdata_0  <= word;
+                s_axis_tstrb_0  <= strb;
+                s_axis_tvalid_0 <= 1;
+                s_axis_tlast_0  <= (w == nwords - 1);
+                while (!s_axis_tready_0) @(posedge axi_aclk);
+            end
+            @(posedge axi_aclk);
+            s_axis_tvalid_0 <= 0;
+            s_axis_tlast_0  <= 0;
+            repeat (bp ? 120 : 40) @(posedge axi_aclk);
+        end
+    endtask
+
+    // expected response from the memcached UDP checksum field (frame byte 40) on,
+    // zero padded to whole words
+    task build_rsp;
+        input [15:0] reqid;
+        input [7:0]  opcode;
+        input [15:0] status;
+        input [31:0] opaque;
+        input [7:0]  seed;
+        input integer vlen;      // 0 = no value (SET reply or miss)
+        integer bodylen;
+        begin
+            for (i = 0; i < 128; i = i + 1) rsp[i] = 8'h00;
+            bodylen = vlen ? 4 + vlen : 0;
+            rsp[2] = reqid[15:8]; rsp[3] = reqid[7:0];
+            rsp[7] = 8'h01;
+            rsp[10] = 8'h81;
+            rsp[11] = opcode;
+            rsp[14] = vlen ? 8'h04 : 8'h00;
+            rsp[16] = status[15:8]; rsp[17] = status[7:0];
+            rsp[18] = bodylen >> 24; rsp[19] = bodylen >> 16; rsp[20] = bodylen >> 8; rsp[21] = bodylen;
+            rsp[22] = opaque[31:24]; rsp[23] = opaque[23:16]; rsp[24] = opaque[15:8]; rsp[25] = opaque[7:0];
+            for (i = 0; i < vlen; i = i + 1) rsp[38 + i] = vbyte(seed, i);
+            rsp_words = vlen ? 5 + (vlen + 7) / 8 : 5;
+        end
+    endtask
+
+    // look for the expected response words, in order, in the output since the last check
+    task check_rsp;
+        input [8*32-1:0] name;
+        integer start, w, found, ok;
+        reg [63:0] word;
+        begin
+            found = -1;
+            for (start = search_from; start + rsp_words <= out_n && found < 0; start = start + 1) begin
+                ok = 1;
+                for (w = 0; w < rsp_words; w = w + 1) begin
+                    for (j = 0; j < 8; j = j + 1) word[8*j +: 8] = rsp[8*w + j];
+                    if (out_words[start + w] !== word) ok = 0;
+                end
+                if (ok) found = start;
+            end
+            if (found < 0) begin
+                errors = errors + 1;
+                $display("FAIL: %0s response not found in output words %0d..%0d", name, search_from, out_n - 1);
+                for (w = 0; w < rsp_words; w = w + 1) begin
+                    for (j = 0; j < 8; j = j + 1) word[8*j +: 8] = rsp[8*w + j];
+                    $display("      expected word %0d: %h", w, word);
+                end
+            end else begin
+                $display("PASS: %0s response at output word %0d", name, found);
+                search_from = found + rsp_words;
+            end
+        end
+    endtask
+
+    initial begin
+        $dumpfile("memcached_bin_tb.vcd");
+        $dumpvars(0, memcached_bin_tb);
+
+        $display("========================================");
+        $display("memcached binary protocol testbench");
+        $display("========================================");
+
+        m_axis_tready   = 1;
+        bp              = 0;
+        bp_lfsr         = 8'h5A;
+        s_axis_tdata_0  = 0;
+        s_axis_tstrb_0  = 0;
+        s_axis_tvalid_0 = 0;
+        s_axis_tlast_0  = 0;
+        errors = 0;
+        search_from = 0;
+
+        axi_resetn = 0;
+        #(CLK_PERIOD*5);
+        axi_resetn = 1;
+        #(CLK_PERIOD*2);
+
+        // Test 1: GET before anything is stored -> key not found
+        $display("\n=== Test 1: GET miss ===");
+        build_get(16'h1234, "k", 1, 32'hDEADBEEF);
+        send_pkt();
+        build_rsp(16'h1234, 8'h00, 16'h0001, 32'hDEADBEEF, 8'h00, 0);
+        check_rsp("GET miss");
+
+        // Test 2: 64B SET, value starts in lane 3 and fills all 8 words of the slot
+        $display("\n=== Test 2: SET 64B value ===");
+        build_set(16'h1235, "k", 1, 8'h30, 64, 32'h01020304);
+        send_pkt();
+        build_rsp(16'h1235, 8'h01, 16'h0000, 32'h01020304, 8'h00, 0);
+        check_rsp("SET 64B");
+
+        // Test 3: GET it back
+        $display("\n=== Test 3: GET hit 64B ===");
+        build_get(16'h1236, "k", 1, 32'hCAFEF00D);
+        send_pkt();
+        build_rsp(16'h1236, 8'h00, 16'h0000, 32'hCAFEF00D, 8'h30, 64);
+        check_rsp("GET hit 64B");
+
+        // Test 4: 20B SET that ends inside the tlast beat (tail write after tlast)
+        $display("\n=== Test 4: SET 20B value, unaligned tail ===");
+        build_set(16'h2000, "ab", 2, 8'hA0, 20, 32'h11223344);
+        send_pkt();
+        build_rsp(16'h2000, 8'h01, 16'h0000, 32'h11223344, 8'h00, 0);
+        check_rsp("SET 20B");
+
+        $display("\n=== Test 5: GET hit 20B ===");
+        build_get(16'h2001, "ab", 2, 32'h55667788);
+        send_pkt();
+        build_rsp(16'h2001, 8'h00, 16'h0000, 32'h55667788, 8'hA0, 20);
+        check_rsp("GET hit 20B");
+
+        // Test 6: the first value is still intact in its own slot
+        $display("\n=== Test 6: GET hit 64B again ===");
+        build_get(16'h2002, "k", 1, 32'h0BADCAFE);
+        send_pkt();
+        build_rsp(16'h2002, 8'h00, 16'h0000, 32'h0BADCAFE, 8'h30, 64);
+        check_rsp("GET hit 64B again");
+
+        // Test 7: values over one slot are refused with "value too large"
+        $display("\n=== Test 7: SET 100B value refused ===");
+        build_set(16'h3000, "z", 1, 8'h50, 100, 32'h99999999);
+        send_pkt();
+        build_rsp(16'h3000, 8'h01, 16'h0003, 32'h99999999, 8'h00, 0);
+        check_rsp("SET too large");
+
+        $display("\n=== Test 8: GET after refused SET misses ===");
+        build_get(16'h3001, "z", 1, 32'h12121212);
+        send_pkt();
+        build_rsp(16'h3001, 8'h00, 16'h0001, 32'h12121212, 8'h00, 0);
+        check_rsp("GET miss after refused SET");
+
+        // Tests 9-12: the same responses with the output stalling under them
+        bp = 1;
+        $display("\n=== Test 9: GET hit 64B, m_axis_tready dropping ===");
+        build_get(16'h4000, "k", 1, 32'h0A0B0C0D);
+        send_pkt();
+        build_rsp(16'h4000, 8'h00, 16'h0000, 32'h0A0B0C0D, 8'h30, 64);
+        check_rsp("GET hit 64B stalled");
+
+        $display("\n=== Test 10: GET hit 20B, m_axis_tready dropping ===");
+        build_get(16'h4001, "ab", 2, 32'h1A1B1C1D);
+        send_pkt();
+        build_rsp(16'h4001, 8'h00, 16'h0000, 32'h1A1B1C1D, 8'hA0, 20);
+        check_rsp("GET hit 20B stalled");
+
+        $display("\n=== Test 11: SET 40B, m_axis_tready dropping ===");
+        build_set(16'h4002, "q", 1, 8'h60, 40, 32'h2A2B2C2D);
+        send_pkt();
+        build_rsp(16'h4002, 8'h01, 16'h0000, 32'h2A2B2C2D, 8'h00, 0);
+        check_rsp("SET 40B stalled");
+
+        $display("\n=== Test 12: GET hit 40B, m_axis_tready dropping ===");
+        build_get(16'h4003, "q", 1, 32'h3A3B3C3D);
+        send_pkt();
+        build_rsp(16'h4003, 8'h00, 16'h0000, 32'h3A3B3C3D, 8'h60, 40);
+        check_rsp("GET hit 40B stalled");
+        bp = 0;
+
+        $display("\n========================================");
+        if (errors == 0) $display("memcached binary tests PASSED");
+        else             $display("memcached binary tests: %0d FAIL", errors);
+        $display("All Tests Completed!");
+        $display("========================================");
+        #(CLK_PERIOD*10);
+        $finish;
+    end
+
+endmodule
@@ -0,0 +1,501 @@
+/***Steen Larsen with AI assistance
+  The intent of this testbench is to check the UALink atomics of ualink_turbo64: fetch and add, swap
+and compare and swap on a DPMEM word, done as one read-modify-write while the request streams through.
+
+Port 0 streams UALink requests back to back.  All are IPv4 frames whose TOS byte (word 1) is the op and
+word 3 holds the DPMEM word address in its top byte.  READ/WRITE frames are 12 words with 64B of data
+in words 4-11.  Atomic frames are 8 words (a min-size Ethernet frame): word 4 is the operand (addend,
+new value), word 5 the CAS compare value, and the frame comes back with the old value in word 5.
+tuser carries the request number.
+
+The source keeps a model of the memory updated as the requests go in, so a CAS can be sent with the
+current value as its compare value.  The output monitor checks every word of every frame against a
+second model updated in output order.  The datapath is UALINK_WIDTH bits wide (64, 256 or 512, default
+64, iverilog -DUALINK_WIDTH=256).
+
+Phase 1: directed FADD/SWAP/CAS hit and miss on a written block, READ it back.
+Phase 2: 200 back to back FADD +1 on the same word, each has to see the one before it, no dead cycles.
+Phase 3: 3000 back to back random READ/WRITE/FADD/SWAP/CAS on 16 words, half the CAS hit, with
+         random backpressure on m_axis.
+Phase 4: phase 3 with half the requests 802.1Q tagged (PCP 5): the IPv4 header, and so the op, is
+         4 bytes later (word 1 the tag, word 2 ethertype, version and TOS), word 3 on is the same.
+
+ to run in Icarus simulator use:
+iverilog -o ualink_atomic_tb.vvp .\ualink_atomic_tb.v ualink_turbo64.v .\fallthrough_small_fifo_v2.v .\small_fifo_v3.v .\ualink_dpmem.v .\ualink_fma.v .\ualink_systolic.v .\crc32gen.v .\kv_hash_index.v
+vvp ualink_atomic_tb.vvp
+gtkwave.exe .\ualink_atomic_tb.vcd
+
+ *
+ */
+
+`timescale 1 ns / 1ps
+`ifndef UALINK_WIDTH
+`define UALINK_WIDTH 64
+`endif
+module testbench();
+
+   // parameter CLK_PERIOD = 10; // 10ns = 100MHz
+    localparam W  = `UALINK_WIDTH;   // datapath width
+    localparam NW = W / 64;          // 64b words per beat
+
+    // bytes 26-29 of a UALink response (word 3) carry the port 0 credits: the beats freed, free running,
+    // then the DUT's IN_FIFO_DEPTH_BIT and BEAT_WORDS, taken from it here, ualink_credit_tb checks those
+    wire [15:0] cr_const = {in_arb.ua_cr_bits, in_arb.ua_cr_words};
+
+    function [63:0] with_credits;
+        input [63:0] sent;
+        input [63:0] got;
+        begin
+            with_credits = {sent[63:48], cr_const, got[31:16], sent[15:0]};
+        end
+    endfunction
+
+    reg clk, reset;
+    wire [4:0]  tready;
+    wire [W-1:0]   m_tdata;
+    wire [W/8-1:0] m_tstrb;
+    wire [127:0] m_tuser;
+    wire        m_tvalid, m_tlast;
+    reg         m_tready;
+
+    integer i, k;
+
+    localparam MAXREQ    = 4096;
+    localparam UA_READ   = 8'h01;
+    localparam UA_WRITE  = 8'h02;
+    localparam UA_FADD   = 8'h05;
+    localparam UA_SWAP   = 8'h06;
+    localparam UA_CAS    = 8'h07;
+
+    // ------------- requests, filled in by the phases -------------
+    reg [7:0]   req_op   [0:MAXREQ-1];
+    reg [7:0]   req_addr [0:MAXREQ-1];
+    reg [63:0]  req_arg  [0:MAXREQ-1];
+    reg [63:0]  req_cmp  [0:MAXREQ-1];
+    reg         req_tag  [0:MAXREQ-1];  // sent with an 802.1Q tag
+    reg         tag_next;              // the next request queued is tagged
+    integer     n_req;                 // requests queued so far
+
+    function integer flen;
+        input [7:0] op;
+        begin
+            flen = (op == UA_READ || op == UA_WRITE) ? 12 : 8;
+        end
+    endfunction
+
+    function is_atomic;
+        input [7:0] op;
+        begin
+            is_atomic = (op == UA_FADD || op == UA_SWAP || op == UA_CAS);
+        end
+    endfunction
+
+    // the value an atomic leaves in the word
+    function [63:0] atomic_new;
+        input [7:0]  op;
+        input [63:0] old;
+        input [63:0] arg;
+        input [63:0] cmp;
+        begin
+            if (op == UA_FADD)      atomic_new = old + arg;
+            else if (op == UA_SWAP) atomic_new = arg;
+            else                    atomic_new = (old == cmp) ? arg : old;
+        end
+    endfunction
+
+    // word w of request seq as sent, byte 8w+l in [8l+7:8l]
+    function [63:0] frame_word;
+        input [31:0] seq;
+        input [7:0]  w;
+        begin
+            if (w == 0)
+                frame_word = 64'h0002010000000002;                    // 02:00:00:00:00:01 from 02:00:..
+            else if (w == 1 && req_tag[seq])
+                frame_word = {8'h00, 8'hA0, 8'h00, 8'h81, seq};        // 802.1Q, PCP 5
+            else if (w == 2 && req_tag[seq])
+                frame_word = {seq, req_op[seq], 8'h45, 8'h00, 8'h08};  // IPv4, TOS = op
+            else if (w == 1)
+                frame_word = {req_op[seq], 8'h45, 8'h00, 8'h08, seq};  // IPv4, TOS = op
+            else if (w == 2)
+                frame_word = {32'h00114000, seq};
+            else if (w == 3)
+                frame_word = {req_addr[seq], 56'h0};                   // DPMEM word address
+            else if (is_atomic(req_op[seq]) && w == 4)
+                frame_word = req_arg[seq];
+            else if (is_atomic(req_op[seq]) && w == 5)
+                frame_word = req_cmp[seq];
+            else if (req_op[seq] == UA_READ)
+                frame_word = 64'hEEEEEEEEEEEEEEEE;                     // room for the read data
+            else
+                frame_word = {seq, w, req_addr[seq], 16'hDA7A};
+        end
+    endfunction
+
+    // ------------- port 0 source -------------
+    reg [31:0]  src_seq;               // request on the bus
+    reg [7:0]   src_w;                 // beat of the frame on the bus
+    reg [W-1:0]   s_tdata;
+    reg [W/8-1:0] s_tstrb;
+    reg [63:0]  src_mem [0:255];       // DPMEM after the requests sent so far
+    wire        s_tvalid = src_seq < n_req;
+    wire [7:0]  s_len    = flen(req_op[src_seq]);
+    wire        s_tlast  = src_w == (s_len + NW - 1) / NW - 1;
+
+    // frame_word reads the request arrays, n_req changes when the phase queues the frame on the bus
+    always @(src_w or src_seq or n_req or s_len) begin
+        for (k = 0; k < NW; k = k + 1) begin
+            s_tdata[64*k +: 64] = (src_w * NW + k < s_len) ? frame_word(src_seq, src_w * NW + k) : 64'h0;
+            s_tstrb[8*k +: 8]   = (src_w * NW + k < s_len) ? 8'hFF : 8'h00;
+        end
+    end
+
+    always @(posedge clk) begin
+        if (reset) begin
+            src_w <= 0;
+        end else if (s_tvalid && tready[0]) begin
+            src_w <= s_tlast ? 8'd0 : src_w + 8'd1;
+            if (s_tlast) src_seq <= src_seq + 1;
+        end
+    end
+
+    // queue a request, the source model follows it so later compare values can be taken from it
+    task queue;
+        input [7:0]  op;
+        input [7:0]  addr;
+        input [63:0] arg;
+        input [63:0] cmp;
+        integer qk;
+        begin
+            req_op[n_req]   = op;
+            req_addr[n_req] = addr;
+            req_arg[n_req]  = arg;
+            req_cmp[n_req]  = cmp;
+            req_tag[n_req]  = tag_next;
+            if (op == UA_WRITE)
+                for (qk = 4; qk < 12; qk = qk + 1) src_mem[(addr + qk - 4) & 8'hFF] = frame_word(n_req, qk);
+            else if (is_atomic(op))
+                src_mem[addr] = atomic_new(op, src_mem[addr], arg, cmp);
+            n_req = n_req + 1;
+        end
+    endtask
+
+    // ------------- output monitor -------------
+    reg [63:0]  mem [0:255];           // DPMEM as the frames out so far left it
+    integer     cycle;
+    integer     errors;
+    integer     out_w;                 // next word of the current output frame
+    integer     kw;
+    reg [31:0]  out_seq;               // next request expected
+    reg [7:0]   out_op, out_addr;
+    reg [63:0]  exp, word;
+    integer     first_out, last_out, beats_out, frames_out;
+    integer     n_hit, n_miss;         // CAS that swapped / did not
+
+    always @(posedge clk) begin
+        if (reset) begin
+            cycle <= 0;
+            out_w = 0;
+        end else begin
+            cycle <= cycle + 1;
+
+            if (m_tvalid && m_tready) begin
+                if (first_out < 0) first_out = cycle;
+                last_out = cycle;
+                beats_out = beats_out + 1;
+                if (out_w == 0) begin
+                    if (m_tuser[31:0] != out_seq) begin
+                        errors = errors + 1;
+                        if (errors <= 10) $display("FAIL: request %0d out, expected %0d", m_tuser[31:0], out_seq);
+                        out_seq = m_tuser[31:0];
+                    end
+                    out_op   = req_op[out_seq];
+                    out_addr = req_addr[out_seq];
+                end
+
+                for (kw = 0; kw < NW; kw = kw + 1) begin
+                    if (m_tstrb[8*kw +: 8] != 0) begin
+                        word = m_tdata[64*kw +: 64];
+                        exp = frame_word(out_seq, out_w);
+                        if (out_w == 3)
+                            exp = with_credits(exp, word);
+                        if (out_op == UA_READ && out_w >= 4)
+                            exp = mem[(out_addr + out_w - 4) & 8'hFF];
+                        if (out_op == UA_WRITE && out_w >= 4)
+                            mem[(out_addr + out_w - 4) & 8'hFF] = word;
+                        if (is_atomic(out_op) && out_w == 5) begin
+                            exp = mem[out_addr];
+                            if (out_op == UA_CAS) begin
+                                if (mem[out_addr] == req_cmp[out_seq]) n_hit = n_hit + 1;
+                                else                                   n_miss = n_miss + 1;
+                            end
+                            mem[out_addr] = atomic_new(out_op, mem[out_addr], req_arg[out_seq], req_cmp[out_seq]);
+                        end
+                        if (word !== exp || m_tuser[31:0] != out_seq) begin
+                            errors = errors + 1;
+                            if (errors <= 10) $display("FAIL: request %0d (op %0d) word %0d is %h, expected %h", out_seq, out_op, out_w, word, exp);
+                        end
+                        out_w = out_w + 1;
+                    end
+                end
+
+                if (m_tlast) begin
+                    if (out_w != flen(out_op)) begin
+                        errors = errors + 1;
+                        if (errors <= 10) $display("FAIL: request %0d ended at word %0d", out_seq, out_w - 1);
+                    end
+                    frames_out = frames_out + 1;
+                    out_seq = out_seq + 1;
+                    out_w = 0;
+                end
+            end
+        end
+    end
+
+    // random backpressure for phase 3
+    reg [15:0] lfsr;
+    reg        bp;
+    always @(posedge clk) begin
+        if (reset) lfsr <= 16'hACE1;
+        else       lfsr <= {lfsr[14:0], lfsr[15] ^ lfsr[13] ^ lfsr[12] ^ lfsr[10]};
+        m_tready <= bp ? lfsr[0] | lfsr[5] : 1'b1;
+    end
+
+    // ------------- phase helpers -------------
+
+    integer     p_first, p_errors;
+
+    task phase_start;
+        begin
+            p_first = n_req;
+            p_errors = errors;
+            first_out = -1;
+            beats_out = 0;
+            frames_out = 0;
+            n_hit = 0;
+            n_miss = 0;
+        end
+    endtask
+
+    // wait for the requests queued since phase_start to come out
+    task phase_run;
+        integer n, t0;
+        begin
+            n = n_req - p_first;
+            t0 = cycle;
+            while (frames_out < n && cycle - t0 < n * 16 + 1000) @(posedge clk);
+            if (frames_out < n) begin
+                errors = errors + 1;
+                $display("FAIL: only %0d of %0d requests came out", frames_out, n);
+            end
+            repeat (10) @(posedge clk);
+        end
+    endtask
+
+    task phase_check;
+        input [8*40-1:0] name;
+        begin
+            if (errors == p_errors) $display("PASS: %0s", name);
+        end
+    endtask
+
+    reg [31:0] rnd;
+    reg [7:0]  a;
+    reg [63:0] v;
+
+  initial begin
+      clk   = 1'b0;
+      errors = 0;
+      bp = 0;
+      tag_next = 0;
+      n_req = 0;
+      src_seq = 0;
+      out_seq = 0;
+      out_op = 0;
+      out_addr = 0;
+      rnd = 32'h1234ABCD;
+      for (i = 0; i < 256; i = i + 1) begin
+          mem[i] = 64'hx;
+          src_mem[i] = 64'hx;
+      end
+      phase_start();
+
+      $display("[%t] : System Reset Asserted...", $realtime);
+      $dumpfile("ualink_atomic_tb.vcd");
+      $dumpvars(0, testbench);
+
+      reset = 1'b1;
+      for (i = 0; i < 2; i = i + 1) begin
+                 @(posedge clk);
+      end
+      $display("[%t] : System Reset De-asserted...", $realtime);
+      reset = 1'b0;
+      repeat (4) @(posedge clk);
+
+      // Phase 1: directed, on the block at 0x40
+      $display("\n=== Phase 1: FADD, SWAP, CAS hit and miss ===");
+      phase_start();
+      queue(UA_WRITE, 8'h40, 0, 0);
+      queue(UA_WRITE, 8'h48, 0, 0);
+      queue(UA_FADD,  8'h41, 64'd5, 0);
+      queue(UA_FADD,  8'h41, 64'hFFFFFFFFFFFFFFFF, 0);              // -1
+      queue(UA_SWAP,  8'h42, 64'h0123456789ABCDEF, 0);
+      queue(UA_CAS,   8'h43, 64'h5555, src_mem[8'h43]);              // hit
+      queue(UA_CAS,   8'h44, 64'h6666, 64'hBAD);                     // miss
+      queue(UA_CAS,   8'h43, 64'h7777, 64'h5555);                    // hit on the value just swapped in
+      queue(UA_FADD,  8'h4F, 64'd1, 0);                              // in the second block
+      queue(UA_READ,  8'h40, 0, 0);
+      queue(UA_READ,  8'h48, 0, 0);
+      phase_run();
+      for (i = 8'h40; i < 8'h50; i = i + 1)
+          if (mem[i] !== src_mem[i]) begin
+              errors = errors + 1;
+              $display("FAIL: word %h is %h, expected %h", i, mem[i], src_mem[i]);
+          end
+      if (n_hit != 2 || n_miss != 1) begin
+          errors = errors + 1;
+          $display("FAIL: CAS %0d hit %0d miss, expected 2 and 1", n_hit, n_miss);
+      end
+      phase_check("atomics return the old value");
+
+      // Phase 2: a counter, every FADD sees the one before it
+      $display("\n=== Phase 2: 200 back to back FADD on one word ===");
+      queue(UA_WRITE, 8'h80, 0, 0);
+      queue(UA_SWAP,  8'h80, 64'd0, 0);
+      phase_run();
+      phase_start();
+      for (i = 0; i < 200; i = i + 1) queue(UA_FADD, 8'h80, 64'd1, 0);
+      phase_run();
+      $display("%0d FADD, %0d beats of %0d bits out in %0d cycles", frames_out, beats_out, W, last_out - first_out + 1);
+      if (mem[8'h80] != 200) begin
+          errors = errors + 1;
+          $display("FAIL: counter is %0d after 200 FADD", mem[8'h80]);
+      end
+      // one frame of 8 words per request, at 512 bits the next frame waits a clock for the write back
+      if (last_out - first_out + 1 != ((NW > 4) ? 2 * beats_out - 1 : beats_out)) begin
+          errors = errors + 1;
+          $display("FAIL: %0d cycles without a beat out", last_out - first_out + 1 - beats_out);
+      end
+      phase_check("counter 200, no dead cycles");
+
+      // Phase 3: everything mixed on a few words, backpressure
+      $display("\n=== Phase 3: 3000 random requests on 16 words, backpressure ===");
+      for (i = 0; i < 2; i = i + 1) queue(UA_WRITE, 8'hC0 + 8 * i, 0, 0);
+      phase_run();
+      phase_start();
+      bp = 1;
+      for (i = 0; i < 3000; i = i + 1) begin
+          rnd = {rnd[30:0], rnd[31] ^ rnd[21] ^ rnd[1] ^ rnd[0]};
+          a = 8'hC0 + rnd[3:0];
+          v = {rnd, rnd[15:0], i[15:0]};
+          case (rnd[7:5])
+             0:       queue(UA_READ,  a & 8'hF8, 0, 0);
+             1:       queue(UA_WRITE, a & 8'hF8, 0, 0);
+             2, 3:    queue(UA_FADD,  a, {56'h0, rnd[15:8]}, 0);
+             4:       queue(UA_SWAP,  a, v, 0);
+             default: queue(UA_CAS,   a, v, rnd[8] ? src_mem[a] : v);
+          endcase
+      end
+      phase_run();
+      bp = 0;
+      $display("%0d requests, CAS %0d hit %0d miss", frames_out, n_hit, n_miss);
+      if (n_hit == 0 || n_miss == 0) begin
+          errors = errors + 1;
+          $display("FAIL: CAS did not both hit and miss");
+      end
+      phase_check("random atomics under backpressure");
+
+      // Phase 4: the same, half of them tagged
+      $display("\n=== Phase 4: 800 random requests, half 802.1Q tagged, backpressure ===");
+      phase_start();
+      bp = 1;
+      for (i = 0; i < 800; i = i + 1) begin
+          rnd = {rnd[30:0], rnd[31] ^ rnd[21] ^ rnd[1] ^ rnd[0]};
+          a = 8'hC0 + rnd[3:0];
+          v = {rnd, rnd[15:0], i[15:0]};
+          tag_next = rnd[9];
+          case (rnd[7:5])
+             0:       queue(UA_READ,  a & 8'hF8, 0, 0);
+             1:       queue(UA_WRITE, a & 8'hF8, 0, 0);
+             2, 3:    queue(UA_FADD,  a, {56'h0, rnd[15:8]}, 0);
+             4:       queue(UA_SWAP,  a, v, 0);
+             default: queue(UA_CAS,   a, v, rnd[8] ? src_mem[a] : v);
+          endcase
+      end
+      tag_next = 0;
+      phase_run();
+      bp = 0;
+      $display("%0d requests, CAS %0d hit %0d miss", frames_out, n_hit, n_miss);
+      if (n_hit == 0 || n_miss == 0) begin
+          errors = errors + 1;
+          $display("FAIL: CAS did not both hit and miss");
+      end
+      phase_check("tagged and untagged atomics");
+
+      $display("\n========================================");
+      if (errors == 0) $display("UALink atomic tests PASSED");
+      else             $display("UALink atomic tests: %0d FAIL", errors);
+      $display("All Tests Completed!");
+      $display("========================================");
+      #100  ;    $finish;       //end simulation
+  end
+
+  always #2.5  clk = ~clk;      // 200MHz
+
+  ualink_turbo64
+    #(.C_M_AXIS_DATA_WIDTH(W),
+      .C_S_AXIS_DATA_WIDTH(W),
+      .C_M_AXIS_TUSER_WIDTH(128),
+      .C_S_AXIS_TUSER_WIDTH(128)
+     ) in_arb
+    (
+    // Global Ports
+    .axi_aclk(clk),
+    .axi_resetn(~reset),
+
+    // Master Stream Ports
+    .m_axis_tdata(m_tdata),
+    .m_axis_tstrb(m_tstrb),
+    .m_axis_tuser(m_tuser),
+    .m_axis_tvalid(m_tvalid),
+    .m_axis_tready(m_tready),
+    .m_axis_tlast(m_tlast),
+
+    // Slave Stream Ports
+    .s_axis_tdata_0(s_tdata),
+    .s_axis_tuser_0({96'h0, src_seq}),
+    .s_axis_tstrb_0(s_tstrb),
+    .s_axis_tvalid_0(s_tvalid),
+    .s_axis_tready_0(tready[0]),
+    .s_axis_tlast_0(s_tlast),
+
+    .s_axis_tdata_1({W{1'b0}}),
+    .s_axis_tuser_1(128'h0),
+    .s_axis_tstrb_1({(W/8){1'b1}}),
+    .s_axis_tvalid_1(1'b0),
+    .s_axis_tready_1(tready[1]),
+    .s_axis_tlast_1(1'b0),
+
+    .s_axis_tdata_2({W{1'b0}}),
+    .s_axis_tuser_2(128'h0),
+    .s_axis_tstrb_2({(W/8){1'b1}}),
+    .s_axis_tvalid_2(1'b0),
+    .s_axis_tready_2(tready[2]),
+    .s_axis_tlast_2(1'b0),
+
+    .s_axis_tdata_3({W{1'b0}}),
+    .s_axis_tuser_3(128'h0),
+    .s_axis_tstrb_3({(W/8){1'b1}}),
+    .s_axis_tvalid_3(1'b0),
+    .s_axis_tready_3(tready[3]),
+    .s_axis_tlast_3(1'b0),
+
+    .s_axis_tdata_4({W{1'b0}}),
+    .s_axis_tuser_4(128'h0),
+    .s_axis_tstrb_4({(W/8){1'b1}}),
+    .s_axis_tvalid_4(1'b0),
+    .s_axis_tready_4(tready[4]),
+    .s_axis_tlast_4(1'b0)
+
+   );
+
+endmodule
@@ -0,0 +1,434 @@
+/***Steen Larsen with AI assistance
+  The intent of this testbench is to check the performance counters of ualink_turbo64 and the COUNTERS
+read that returns them (IPv4 TOS 0x0C on port 0, words 4-16 of the frame come back with the counters):
+
+    word 4      clock cycles
+    words 5-12  port 0 frames by TOS op: other, READ, WRITE, GEMM, ARB_CFG, FADD, SWAP, CAS
+    word 13     cycles m_axis_tvalid waited on m_axis_tready
+    word 14     cycles the FMA engine waited on DPMEM port B while the memcached path used it
+    word 15     cycles the FMA engine ran
+    word 16     input FIFO high water marks, 12 bits per queue
+
+Phase 1: a COUNTERS read straight after reset, everything 0 but the cycles and the read itself.
+Phase 2: a known mix of UALink ops, ARB_CFG, plain IPv4 and non-IP frames, the frame counts have to
+         match and the cycle counter has to advance by the cycles between the two reads.  A plain
+         frame with TOS 0x10 (IPTOS_LOWDELAY) has to come back untouched.
+Phase 3: m_axis held off while 8 READs queue up, the queue 0 high water mark is all of their beats
+         and the stall counter the cycles m_axis_tvalid waited, as counted here.
+Phase 4: two GEMM ops (TOS 0x03) on the FMA engine, the first one alone, it must not wait on port B,
+         the second one with a memcached ASCII SET coming in while it loads its tiles: the SET value
+         write holds it off port B, and it has to run for exactly those cycles longer.
+The datapath is UALINK_WIDTH bits wide (64, 256 or 512, default 64, iverilog -DUALINK_WIDTH=256).
+
+ to run in Icarus simulator use:
+iverilog -o ualink_counters_tb.vvp .\ualink_counters_tb.v ualink_turbo64.v .\fallthrough_small_fifo_v2.v .\small_fifo_v3.v .\ualink_dpmem.v .\ualink_fma.v .\ualink_systolic.v .\crc32gen.v .\kv_hash_index.v
+vvp ualink_counters_tb.vvp
+
+ *
+ */
+
+`timescale 1 ns / 1ps
+`ifndef UALINK_WIDTH
+`define UALINK_WIDTH 64
+`endif
+module testbench();
+
+    localparam W  = `UALINK_WIDTH;   // datapath width
+    localparam NW = W / 64;          // 64b words per beat
+    localparam BB = W / 8;           // bytes per beat
+
+    reg clk, reset;
+    wire [4:0]  tready;
+    wire [W-1:0]   m_tdata;
+    wire [W/8-1:0] m_tstrb;
+    wire [127:0] m_tuser;
+    wire        m_tvalid, m_tlast;
+    reg         m_tready;
+
+    reg [W-1:0]   tdata_0;
+    reg [W/8-1:0] tstrb_0;
+    reg         tvalid_0, tlast_0;
+
+    integer i, j;
+
+    localparam CTR_WORDS = 13;
+    localparam TOS_CTR   = 8'h0C;
+
+    // ------------- frame built by the tasks below -------------
+    reg [7:0]   pkt [0:511];
+    integer     pkt_len;
+    reg [31:0]  seq;                 // tuser of the next frame
+    integer     t_ctr;               // cycle the word 4 beat of the last COUNTERS read went in
+
+    // IPv4 frame of len bytes with the given TOS and protocol, DPMEM word address in byte 31 and a
+    // pattern in the data words
+    task build_ip;
+        input [7:0]  tos;
+        input [7:0]  proto;
+        input [7:0]  addr;
+        input integer len;
+        begin
+            for (i = 0; i < 512; i = i + 1) pkt[i] = (i >= 32) ? i : 8'h00;
+            pkt[0] = 8'h02; pkt[5] = 8'h01;                                     // 02:00:00:00:00:01
+            pkt[6] = 8'h02; pkt[11] = 8'h02;                                    // from 02:00:00:00:00:02
+            pkt[12] = 8'h08; pkt[13] = 8'h00;                                   // IPv4
+            pkt[14] = 8'h45;
+            pkt[15] = tos;
+            pkt[16] = (len - 14) >> 8; pkt[17] = (len - 14) & 8'hFF;
+            pkt[18] = 8'h00; pkt[19] = 8'h00;                                   // sized ops: req_len 0, no bytes
+            pkt[22] = 8'h40; pkt[23] = proto;
+            pkt[31] = addr;
+            pkt_len = len;
+        end
+    endtask
+
+    // copy len bytes of a right aligned string to pkt[at]
+    task put_pkt;
+        input integer    at;
+        input [8*20-1:0] str;
+        input integer    len;
+        begin
+            for (i = 0; i < len; i = i + 1) pkt[at + i] = str >> (8 * (len - 1 - i));
+        end
+    endtask
+
+    // memcached ASCII "set <key> 0 0 8\r\n<8 bytes>\r\n" over UDP
+    task build_set;
+        input [8*8-1:0] key;
+        input integer   keylen;
+        integer at;
+        begin
+            build_ip(8'h00, 8'h11, 8'h00, 50 + 4 + keylen + 8 + 8 + 2);
+            for (i = 32; i < 512; i = i + 1) pkt[i] = 8'h00;
+            pkt[26] = 8'h0A; pkt[29] = 8'h02;                                   // 10.0.0.2
+            pkt[30] = 8'h0A; pkt[33] = 8'h01;                                   // 10.0.0.1
+            pkt[34] = 8'hC0; pkt[36] = 8'h2B; pkt[37] = 8'hCB;                  // to 11211
+            pkt[38] = 8'h00; pkt[39] = pkt_len - 34;
+            pkt[42] = seq[15:8]; pkt[43] = seq[7:0];                            // request id
+            pkt[47] = 8'h01;                                                    // 1 datagram
+            put_pkt(50, "set ", 4);
+            put_pkt(54, key, keylen);
+            at = 54 + keylen;
+            put_pkt(at, " 0 0 8", 6);              at = at + 6;
+            put_pkt(at, 16'h0D0A, 2);              at = at + 2;
+            put_pkt(at, "VALUE123", 8);            at = at + 8;
+            put_pkt(at, 16'h0D0A, 2);
+        end
+    endtask
+
+    // drive pkt[0:pkt_len-1] on port 0, one beat per clock
+    task send_pkt;
+        integer w, nbeats;
+        reg [W-1:0]  word;
+        reg [BB-1:0] strb;
+        begin
+            nbeats = (pkt_len + BB - 1) / BB;
+            for (w = 0; w < nbeats; w = w + 1) begin
+                for (j = 0; j < BB; j = j + 1) begin
+                    word[8*j +: 8] = (BB*w + j < pkt_len) ? pkt[BB*w + j] : 8'h00;
+                    strb[j]        = BB*w + j < pkt_len;
+                end
+                @(posedge clk);
+                if (pkt[15] == TOS_CTR && w == 32 / BB) t_ctr = cycle;
+                tdata_0  <= word;
+                tstrb_0  <= strb;
+                tvalid_0 <= 1;
+                tlast_0  <= (w == nbeats - 1);
+                while (!tready[0]) @(posedge clk);
+            end
+            @(posedge clk);
+            tvalid_0 <= 0;
+            tlast_0  <= 0;
+            seq = seq + 1;
+        end
+    endtask
+
+    // ------------- output monitor, keeps the counters of the last COUNTERS read -------------
+    reg [7:0]   obuf [0:511];
+    integer     opos, mk, mj;
+    integer     cycle;
+    integer     errors;
+    integer     frames_out;
+    integer     tb_stall;            // cycles m_tvalid waited on m_tready, counted here
+    integer     n_ctr;               // COUNTERS responses seen
+    integer     n_lowdelay, n_lowdelay_bad;   // TOS 0x10 frames out, bytes of them changed
+    reg [63:0]  ctr [0:CTR_WORDS-1];
+
+    always @(posedge clk) begin
+        if (reset) begin
+            cycle <= 0;
+            opos = 0;
+        end else begin
+            cycle <= cycle + 1;
+            if (m_tvalid && !m_tready) tb_stall = tb_stall + 1;
+            if (m_tvalid && m_tready) begin
+                for (mk = 0; mk < BB; mk = mk + 1)
+                    if (m_tstrb[mk]) begin
+                        obuf[opos] = m_tdata[8*mk +: 8];
+                        opos = opos + 1;
+                    end
+                if (m_tlast) begin
+                    frames_out = frames_out + 1;
+                    if (obuf[14] == 8'h45 && obuf[15] == TOS_CTR) begin
+                        for (mk = 0; mk < CTR_WORDS; mk = mk + 1)
+                            for (mj = 0; mj < 8; mj = mj + 1) ctr[mk][8*mj +: 8] = obuf[32 + 8*mk + mj];
+                        n_ctr = n_ctr + 1;
+                    end
+                    if (obuf[14] == 8'h45 && obuf[15] == 8'h10) begin
+                        for (mk = 32; mk < opos; mk = mk + 1)
+                            if (obuf[mk] != mk[7:0]) n_lowdelay_bad = n_lowdelay_bad + 1;
+                        n_lowdelay = n_lowdelay + 1;
+                    end
+                    opos = 0;
+                end
+            end
+        end
+    end
+
+    // send a COUNTERS read, wait for it to come back
+    task read_counters;
+        integer n0, t0;
+        begin
+            n0 = n_ctr;
+            build_ip(TOS_CTR, 8'h11, 8'h00, 32 + 8 * CTR_WORDS);
+            send_pkt;
+            t0 = cycle;
+            while (n_ctr == n0 && cycle - t0 < 1000) @(posedge clk);
+            if (n_ctr == n0) begin
+                errors = errors + 1;
+                $display("FAIL: COUNTERS read %0d did not come back", n0);
+            end
+        end
+    endtask
+
+    task expect_ctr;
+        input [8*24-1:0] name;
+        input [63:0]     got;
+        input [63:0]     exp;
+        begin
+            if (got !== exp) begin
+                errors = errors + 1;
+                $display("FAIL: %0s is %0d, expected %0d", name, got, exp);
+            end
+        end
+    endtask
+
+    // wait for n frames out in all
+    task wait_out;
+        input integer n;
+        integer t0;
+        begin
+            t0 = cycle;
+            while (frames_out < n && cycle - t0 < 2000) @(posedge clk);
+            if (frames_out < n) begin
+                errors = errors + 1;
+                $display("FAIL: %0d of %0d frames out", frames_out, n);
+            end
+            repeat (4) @(posedge clk);
+        end
+    endtask
+
+    reg [63:0]  c_cycles, c_fma, c_conflict, fma1, conflict1;
+    integer     t_prev, n_sent, hwm_exp, n;
+
+  initial begin
+      clk   = 1'b0;
+      errors = 0;
+      frames_out = 0;
+      tb_stall = 0;
+      n_ctr = 0;
+      n_lowdelay = 0;
+      n_lowdelay_bad = 0;
+      seq = 0;
+      n_sent = 0;
+      m_tready = 1;
+      tvalid_0 = 0;
+      tlast_0 = 0;
+      tdata_0 = 0;
+      tstrb_0 = 0;
+
+      $display("[%t] : System Reset Asserted...", $realtime);
+      $dumpfile("ualink_counters_tb.vcd");
+      $dumpvars(0, testbench);
+
+      reset = 1'b1;
+      for (i = 0; i < 2; i = i + 1) begin
+                 @(posedge clk);
+      end
+      $display("[%t] : System Reset De-asserted...", $realtime);
+      reset = 1'b0;
+      repeat (4) @(posedge clk);
+
+      $display("\n=== Phase 1: COUNTERS read after reset ===");
+      read_counters;
+      n_sent = n_sent + 1;
+      if (ctr[0] == 0) begin
+          errors = errors + 1;
+          $display("FAIL: cycle counter is 0");
+      end
+      expect_ctr("other frames", ctr[1], 1);
+      for (n = 2; n < 9; n = n + 1) expect_ctr("op frames", ctr[n], 0);
+      expect_ctr("m_axis stall cycles", ctr[9], 0);
+      expect_ctr("port B conflict cycles", ctr[10], 0);
+      expect_ctr("FMA busy cycles", ctr[11], 0);
+      c_cycles = ctr[0];
+      t_prev = t_ctr;
+      $display("cycles %0d, queue 0 high water %0d beats", ctr[0], ctr[12][11:0]);
+
+      $display("\n=== Phase 2: frames by op ===");
+      for (n = 0; n < 3; n = n + 1) begin build_ip(8'h01, 8'h11, 8'h10, 96); send_pkt; end   // READ
+      for (n = 0; n < 2; n = n + 1) begin build_ip(8'h02, 8'h11, 8'h20, 96); send_pkt; end   // WRITE
+      build_ip(8'h09, 8'h11, 8'h30, 60); send_pkt;                                            // sized READ
+      build_ip(8'h0A, 8'h11, 8'h30, 60); send_pkt;                                            // sized WRITE
+      build_ip(8'h03, 8'h11, 8'h00, 60); send_pkt;                                            // GEMM
+      build_ip(8'h04, 8'h11, 8'h00, 60); pkt[48] = 8'h01; send_pkt;                           // ARB_CFG, strict
+      for (n = 0; n < 2; n = n + 1) begin build_ip(8'h05, 8'h11, 8'h40, 60); send_pkt; end   // FADD
+      build_ip(8'h06, 8'h11, 8'h41, 60); send_pkt;                                            // SWAP
+      build_ip(8'h07, 8'h11, 8'h42, 60); send_pkt;                                            // CAS
+      for (n = 0; n < 2; n = n + 1) begin build_ip(8'h00, 8'h06, 8'h00, 60); send_pkt; end   // plain TCP
+      build_ip(8'h00, 8'h11, 8'h00, 60); pkt[12] = 8'h86; pkt[13] = 8'hDD; send_pkt;          // not IPv4
+      build_ip(8'h0D, 8'h11, 8'h00, 60); send_pkt;                                            // sized FADD, not an op
+      n_sent = n_sent + 17;
+      wait_out(n_sent);
+      // on its own, behind the others it would raise queue 0's high water mark above phase 3's
+      build_ip(8'h10, 8'h11, 8'h00, 32 + 8 * CTR_WORDS); send_pkt;                            // IPTOS_LOWDELAY
+      n_sent = n_sent + 1;
+      wait_out(n_sent);
+      read_counters;
+      n_sent = n_sent + 1;
+      expect_ctr("other frames", ctr[1], 7);
+      expect_ctr("TOS 0x10 frames out", n_lowdelay, 1);
+      expect_ctr("TOS 0x10 bytes changed", n_lowdelay_bad, 0);
+      expect_ctr("READ frames", ctr[2], 4);
+      expect_ctr("WRITE frames", ctr[3], 3);
+      expect_ctr("GEMM frames", ctr[4], 1);
+      expect_ctr("ARB_CFG frames", ctr[5], 1);
+      expect_ctr("FADD frames", ctr[6], 2);
+      expect_ctr("SWAP frames", ctr[7], 1);
+      expect_ctr("CAS frames", ctr[8], 1);
+      expect_ctr("cycles between reads", ctr[0] - c_cycles, t_ctr - t_prev);
+      expect_ctr("m_axis stall cycles", ctr[9], 0);
+      if (errors == 0) $display("PASS: frame counts by op, %0d cycles between the reads", ctr[0] - c_cycles);
+
+      $display("\n=== Phase 3: queue high water mark and m_axis stalls ===");
+      m_tready = 0;
+      for (n = 0; n < 8; n = n + 1) begin build_ip(8'h01, 8'h11, 8'h10, 96); send_pkt; end
+      repeat (20) @(posedge clk);
+      m_tready = 1;
+      n_sent = n_sent + 8;
+      wait_out(n_sent);
+      read_counters;
+      n_sent = n_sent + 1;
+      hwm_exp = 8 * ((12 + NW - 1) / NW);
+      expect_ctr("queue 0 high water mark", ctr[12][11:0], hwm_exp);
+      for (n = 1; n < 5; n = n + 1) expect_ctr("queue 1-4 high water mark", ctr[12][12*n +: 12], 0);
+      expect_ctr("m_axis stall cycles", ctr[9], tb_stall);
+      if (tb_stall == 0) begin
+          errors = errors + 1;
+          $display("FAIL: no stall cycles seen");
+      end
+      $display("queue 0 high water %0d beats, %0d stall cycles", ctr[12][11:0], ctr[9]);
+
+      $display("\n=== Phase 4: FMA engine and port B ===");
+      c_fma = ctr[11];
+      c_conflict = ctr[10];
+      build_ip(8'h03, 8'h11, 8'h80, 60); pkt[32] = 8'h60; pkt[33] = 8'h68; pkt[34] = 8'h01; send_pkt;
+      n_sent = n_sent + 1;
+      wait_out(n_sent);
+      read_counters;
+      n_sent = n_sent + 1;
+      fma1 = ctr[11] - c_fma;
+      conflict1 = ctr[10] - c_conflict;
+      c_fma = ctr[11];
+      c_conflict = ctr[10];
+      build_ip(8'h03, 8'h11, 8'h80, 60); pkt[32] = 8'h60; pkt[33] = 8'h68; pkt[34] = 8'h01; send_pkt;
+      repeat (10) @(posedge clk);
+      build_set("k1", 2);
+      send_pkt;
+      n_sent = n_sent + 2;
+      wait_out(n_sent);
+      read_counters;
+      n_sent = n_sent + 1;
+      if (fma1 == 0) begin
+          errors = errors + 1;
+          $display("FAIL: FMA engine did not run");
+      end
+      expect_ctr("port B waits, GEMM alone", conflict1, 0);
+      if (ctr[10] - c_conflict == 0) begin
+          errors = errors + 1;
+          $display("FAIL: the SET did not hold the FMA engine off port B");
+      end
+      expect_ctr("FMA busy, GEMM with SET", ctr[11] - c_fma, fma1 + ctr[10] - c_conflict);
+      expect_ctr("other frames", ctr[1], 7 + 1 + 2 + 1);   //the reads and the SET
+      $display("FMA busy %0d cycles per GEMM, %0d more waiting on port B for the SET", fma1, ctr[10] - c_conflict);
+
+      $display("%0d frames out, %0d COUNTERS reads", frames_out, n_ctr);
+
+      $display("\n========================================");
+      if (errors == 0) $display("UALink performance counter tests PASSED");
+      else             $display("UALink performance counter tests: %0d FAIL", errors);
+      $display("All Tests Completed!");
+      $display("========================================");
+      #100  ;    $finish;       //end simulation
+  end
+
+  always #2.5  clk = ~clk;      // 200MHz
+
+  ualink_turbo64
+    #(.C_M_AXIS_DATA_WIDTH(W),
+      .C_S_AXIS_DATA_WIDTH(W),
+      .C_M_AXIS_TUSER_WIDTH(128),
+      .C_S_AXIS_TUSER_WIDTH(128)
+     ) in_arb
+    (
+    // Global Ports
+    .axi_aclk(clk),
+    .axi_resetn(~reset),
+
+    // Master Stream Ports
+    .m_axis_tdata(m_tdata),
+    .m_axis_tstrb(m_tstrb),
+    .m_axis_tuser(m_tuser),
+    .m_axis_tvalid(m_tvalid),
+    .m_axis_tready(m_tready),
+    .m_axis_tlast(m_tlast),
+
+    // Slave Stream Ports
+    .s_axis_tdata_0(tdata_0),
+    .s_axis_tuser_0({96'h0, seq}),
+    .s_axis_tstrb_0(tstrb_0),
+    .s_axis_tvalid_0(tvalid_0),
+    .s_axis_tready_0(tready[0]),
+    .s_axis_tlast_0(tlast_0),
+
+    .s_axis_tdata_1({W{1'b0}}),
+    .s_axis_tuser_1(128'h0),
+    .s_axis_tstrb_1({(W/8){1'b1}}),
+    .s_axis_tvalid_1(1'b0),
+    .s_axis_tready_1(tready[1]),
+    .s_axis_tlast_1(1'b0),
+
+    .s_axis_tdata_2({W{1'b0}}),
+    .s_axis_tuser_2(128'h0),
+    .s_axis_tstrb_2({(W/8){1'b1}}),
+    .s_axis_tvalid_2(1'b0),
+    .s_axis_tready_2(tready[2]),
+    .s_axis_tlast_2(1'b0),
+
+    .s_axis_tdata_3({W{1'b0}}),
+    .s_axis_tuser_3(128'h0),
+    .s_axis_tstrb_3({(W/8){1'b1}}),
+    .s_axis_tvalid_3(1'b0),
+    .s_axis_tready_3(tready[3]),
+    .s_axis_tlast_3(1'b0),
+
+    .s_axis_tdata_4({W{1'b0}}),
+    .s_axis_tuser_4(128'h0),
+    .s_axis_tstrb_4({(W/8){1'b1}}),
+    .s_axis_tvalid_4(1'b0),
+    .s_axis_tready_4(tready[4]),
+    .s_axis_tlast_4(1'b0)
+
+   );
+
+endmodule
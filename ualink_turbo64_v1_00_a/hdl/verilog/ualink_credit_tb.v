@@ -0,0 +1,468 @@
+/***Steen Larsen with AI assistance
+  The intent of this testbench is to check the credits ualink_turbo64 advertises for its port 0 FIFO,
+and that a sender that spends them never overruns it.  Every UALink op and COUNTERS frame comes back
+with bytes 26-27 the beats that have left the port 0 FIFO since reset (big endian, mod 2^16), byte 28
+the 64b words per beat and byte 29 the FIFO's depth bits; the FIFO takes (1 << depth bits) - 2 beats.
+
+Phase 1: single frames with the FIFO drained between them, the credit bytes of a READ and a COUNTERS
+         read have to be exactly the beats of the frames before, a plain IPv4 frame keeps its bytes.
+Phase 2: overload without credits.  The link offers a 96B READ every frame time, m_axis takes a beat
+         every other clock, and the MAC in front of port 0 holds one frame: one that arrives while the
+         last is still waiting on s_axis_tready_0 is dropped.  There have to be drops, and the port 0
+         stall counter (COUNTERS word 17) has to match the stall cycles counted here.
+Phase 3: the same overload with credits: a frame only goes out while the beats sent minus the beats
+         freed (the highest of the advertised count and the beats of every frame answered, port 0
+         answers in order) stay within the window.  No drops, no stall cycle, every frame answered,
+         and m_axis busy for at least 95% of the clocks it is ready from the first answer to the last.
+The datapath is UALINK_WIDTH bits wide (64, 256 or 512, default 64, iverilog -DUALINK_WIDTH=256).
+
+ to run in Icarus simulator use:
+iverilog -o ualink_credit_tb.vvp .\ualink_credit_tb.v ualink_turbo64.v .\fallthrough_small_fifo_v2.v .\small_fifo_v3.v .\ualink_dpmem.v .\ualink_fma.v .\ualink_systolic.v .\crc32gen.v .\kv_hash_index.v
+vvp ualink_credit_tb.vvp
+
+ *
+ */
+
+`timescale 1 ns / 1ps
+`ifndef UALINK_WIDTH
+`define UALINK_WIDTH 64
+`endif
+module testbench();
+
+    localparam W  = `UALINK_WIDTH;   // datapath width
+    localparam NW = W / 64;          // 64b words per beat
+    localparam BB = W / 8;           // bytes per beat
+
+    function integer log2;
+        input integer number;
+        begin
+            log2 = 0;
+            while (2**log2 < number) log2 = log2 + 1;
+        end
+    endfunction
+
+    localparam DEPTH_BITS = log2(2000 / BB);        // IN_FIFO_DEPTH_BIT of ualink_turbo64
+    localparam CTR_WORDS  = 14;
+    localparam TOS_CTR    = 8'h0C;
+    localparam RD_LEN     = 96;                     // the READs of phases 2 and 3
+    localparam RD_BEATS   = (RD_LEN + BB - 1) / BB;
+    localparam N_RUN      = 80;                     // READs offered per phase
+
+    reg clk, reset;
+    wire [4:0]  tready;
+    wire [W-1:0]   m_tdata;
+    wire [W/8-1:0] m_tstrb;
+    wire [127:0] m_tuser;
+    wire        m_tvalid, m_tlast;
+    reg         m_tready;
+
+    reg [W-1:0]   tdata_0;
+    reg [W/8-1:0] tstrb_0;
+    reg         tvalid_0, tlast_0;
+
+    integer i, j;
+
+    // ------------- frame built by the tasks below -------------
+    reg [7:0]   pkt [0:511];
+    integer     pkt_len;
+    reg [31:0]  seq;                 // tuser of the next frame
+
+    // IPv4 frame of len bytes with the given TOS, DPMEM word address in byte 31, a pattern in the
+    // source address and the data words
+    task build_ip;
+        input [7:0]  tos;
+        input [7:0]  addr;
+        input integer len;
+        begin
+            for (i = 0; i < 512; i = i + 1) pkt[i] = (i >= 32) ? i : 8'h00;
+            pkt[0] = 8'h02; pkt[5] = 8'h01;                                     // 02:00:00:00:00:01
+            pkt[6] = 8'h02; pkt[11] = 8'h02;                                    // from 02:00:00:00:00:02
+            pkt[12] = 8'h08; pkt[13] = 8'h00;                                   // IPv4
+            pkt[14] = 8'h45;
+            pkt[15] = tos;
+            pkt[16] = (len - 14) >> 8; pkt[17] = (len - 14) & 8'hFF;
+            pkt[22] = 8'h40; pkt[23] = 8'h11;
+            pkt[26] = 8'hA1; pkt[27] = 8'hA2; pkt[28] = 8'hA3; pkt[29] = 8'hA4;
+            pkt[31] = addr;
+            pkt_len = len;
+        end
+    endtask
+
+    // drive pkt[0:pkt_len-1] on port 0, one beat per clock
+    task send_pkt;
+        integer w, nbeats;
+        reg [W-1:0]  word;
+        reg [BB-1:0] strb;
+        begin
+            nbeats = (pkt_len + BB - 1) / BB;
+            for (w = 0; w < nbeats; w = w + 1) begin
+                for (j = 0; j < BB; j = j + 1) begin
+                    word[8*j +: 8] = (BB*w + j < pkt_len) ? pkt[BB*w + j] : 8'h00;
+                    strb[j]        = BB*w + j < pkt_len;
+                end
+                @(posedge clk);
+                tdata_0  <= word;
+                tstrb_0  <= strb;
+                tvalid_0 <= 1;
+                tlast_0  <= (w == nbeats - 1);
+                while (!tready[0]) @(posedge clk);
+            end
+            @(posedge clk);
+            tvalid_0 <= 0;
+            tlast_0  <= 0;
+            seq = seq + 1;
+        end
+    endtask
+
+    // ------------- the host: link, MAC, credits and output monitor -------------
+    reg [7:0]   obuf [0:511];
+    integer     opos, mk, mj;
+    integer     cycle;
+    integer     errors;
+    integer     frames_out;
+    integer     n_ctr;               // COUNTERS responses seen
+    reg [63:0]  ctr [0:CTR_WORDS-1];
+    reg [15:0]  last_cr;             // credit bytes of the last answer
+    reg [7:0]   last_cr_words, last_cr_bits;
+    integer     n_cr;                // answers with credit bytes
+
+    reg         running;             // phases 2 and 3: the link sends N_RUN READs
+    reg         use_credits;
+    reg         throttle;            // m_axis ready every other clock
+    integer     n_gen, n_sent, drops, line_wait, tb_in_stall;
+    reg         mac_busy;
+    integer     mac_beat;
+    reg [W-1:0]  mac_word;
+    reg [BB-1:0] mac_strb;
+
+    integer     window;              // beats, from the credit bytes
+    reg [15:0]  cr_sent, cr_freed;   // beats sent and freed, mod 2^16
+    reg [15:0]  cr_out;              // beats in flight
+    reg [15:0]  marks [0:255];       // cr_sent after each frame not answered yet
+    reg [7:0]   mark_wr, mark_rd;
+    integer     first_out, last_out, ready_cycles, busy_cycles;
+
+    always @(posedge clk) begin
+        if (reset) begin
+            cycle <= 0;
+            opos = 0;
+            mac_busy = 0;
+            line_wait = 0;
+            cr_sent = 0;
+            cr_freed = 0;
+            mark_wr = 0;
+            mark_rd = 0;
+        end else begin
+            cycle <= cycle + 1;
+            if (throttle) m_tready <= ~m_tready;
+
+            // output: the credit bytes of an op or COUNTERS frame, and the frame's own beats are freed
+            if (running && first_out >= 0 && m_tready) begin
+                ready_cycles = ready_cycles + 1;
+                if (m_tvalid) busy_cycles = busy_cycles + 1;
+            end
+            if (m_tvalid && m_tready) begin
+                for (mk = 0; mk < BB; mk = mk + 1)
+                    if (m_tstrb[mk]) begin
+                        obuf[opos] = m_tdata[8*mk +: 8];
+                        opos = opos + 1;
+                    end
+                if (m_tlast) begin
+                    frames_out = frames_out + 1;
+                    if (obuf[14] == 8'h45 && (obuf[15] == 8'h01 || obuf[15] == TOS_CTR)) begin
+                        last_cr = {obuf[26], obuf[27]};
+                        last_cr_words = obuf[28];
+                        last_cr_bits = obuf[29];
+                        n_cr = n_cr + 1;
+                        if (use_credits && last_cr - cr_freed < 16'h8000) cr_freed = last_cr;
+                    end
+                    if (obuf[14] == 8'h45 && obuf[15] == TOS_CTR) begin
+                        for (mk = 0; mk < CTR_WORDS; mk = mk + 1)
+                            for (mj = 0; mj < 8; mj = mj + 1) ctr[mk][8*mj +: 8] = obuf[32 + 8*mk + mj];
+                        n_ctr = n_ctr + 1;
+                    end
+                    if (running) begin
+                        if (first_out < 0) first_out = cycle;
+                        last_out = cycle;
+                        if (mark_rd != mark_wr) begin
+                            if (marks[mark_rd] - cr_freed < 16'h8000) cr_freed = marks[mark_rd];
+                            mark_rd = mark_rd + 1;
+                        end
+                    end
+                    opos = 0;
+                end
+            end
+
+            // MAC: one frame, into port 0 as s_axis_tready_0 takes the beats
+            if (running) begin
+                if (tvalid_0 && !tready[0]) tb_in_stall = tb_in_stall + 1;
+                if (tvalid_0 && tready[0]) begin
+                    mac_beat = mac_beat + 1;
+                    if (tlast_0) mac_busy = 0;
+                end
+            end
+
+            // link: a READ every frame time, dropped if the MAC still holds the last one; with
+            // credits it waits until the window has room for it
+            if (running) begin
+                cr_out = cr_sent - cr_freed;
+                if (line_wait > 0) line_wait = line_wait - 1;
+                if (line_wait == 0 && n_gen < N_RUN &&
+                    (!use_credits || cr_out + RD_BEATS <= window)) begin
+                    n_gen = n_gen + 1;
+                    line_wait = RD_BEATS;
+                    if (mac_busy) begin
+                        drops = drops + 1;
+                    end else begin
+                        mac_busy = 1;
+                        mac_beat = 0;
+                        n_sent = n_sent + 1;
+                        cr_sent = cr_sent + RD_BEATS;
+                        marks[mark_wr] = cr_sent;
+                        mark_wr = mark_wr + 1;
+                    end
+                end
+            end
+
+            if (running) begin
+                if (mac_busy) begin
+                    for (mk = 0; mk < BB; mk = mk + 1) begin
+                        mac_word[8*mk +: 8] = (BB*mac_beat + mk < RD_LEN) ? pkt[BB*mac_beat + mk] : 8'h00;
+                        mac_strb[mk]        = BB*mac_beat + mk < RD_LEN;
+                    end
+                    tdata_0  <= mac_word;
+                    tstrb_0  <= mac_strb;
+                    tvalid_0 <= 1;
+                    tlast_0  <= mac_beat == RD_BEATS - 1;
+                end else begin
+                    tvalid_0 <= 0;
+                    tlast_0  <= 0;
+                end
+            end
+        end
+    end
+
+    // send a COUNTERS read, wait for it to come back
+    task read_counters;
+        integer n0, t0;
+        begin
+            n0 = n_ctr;
+            build_ip(TOS_CTR, 8'h00, 32 + 8 * CTR_WORDS);
+            send_pkt;
+            t0 = cycle;
+            while (n_ctr == n0 && cycle - t0 < 1000) @(posedge clk);
+            if (n_ctr == n0) begin
+                errors = errors + 1;
+                $display("FAIL: COUNTERS read %0d did not come back", n0);
+            end
+        end
+    endtask
+
+    task expect_val;
+        input [8*32-1:0] name;
+        input [63:0]     got;
+        input [63:0]     exp;
+        begin
+            if (got !== exp) begin
+                errors = errors + 1;
+                $display("FAIL: %0s is %0d, expected %0d", name, got, exp);
+            end
+        end
+    endtask
+
+    // wait for n frames out in all
+    task wait_out;
+        input integer n;
+        integer t0;
+        begin
+            t0 = cycle;
+            while (frames_out < n && cycle - t0 < 20000) @(posedge clk);
+            if (frames_out < n) begin
+                errors = errors + 1;
+                $display("FAIL: %0d of %0d frames out", frames_out, n);
+            end
+            repeat (4) @(posedge clk);
+        end
+    endtask
+
+    // phases 2 and 3: N_RUN READs offered at line rate against a half rate m_axis
+    task run_overload;
+        input credits;
+        integer out0, t0;
+        begin
+            build_ip(8'h01, 8'h10, RD_LEN);
+            out0 = frames_out;
+            use_credits = credits;
+            n_gen = 0;
+            n_sent = 0;
+            drops = 0;
+            tb_in_stall = 0;
+            first_out = -1;
+            ready_cycles = 0;
+            busy_cycles = 0;
+            throttle = 1;
+            running = 1;
+            t0 = cycle;
+            while ((n_gen < N_RUN || mac_busy || frames_out - out0 < n_sent) && cycle - t0 < 40000) @(posedge clk);
+            running = 0;
+            throttle = 0;
+            m_tready = 1;
+            @(posedge clk);
+            tvalid_0 <= 0;
+            tlast_0  <= 0;
+            repeat (4) @(posedge clk);
+            expect_val("READs offered", n_gen, N_RUN);
+            expect_val("answers", frames_out - out0, n_sent);
+            $display("%0d READs offered, %0d sent, %0d dropped, %0d stall cycles, m_axis busy %0d of %0d ready clocks",
+                     n_gen, n_sent, drops, tb_in_stall, busy_cycles, ready_cycles);
+        end
+    endtask
+
+    reg [63:0]  in_stall0;
+    integer     beats0, n_out;
+
+  initial begin
+      clk   = 1'b0;
+      errors = 0;
+      frames_out = 0;
+      n_ctr = 0;
+      n_cr = 0;
+      seq = 0;
+      running = 0;
+      use_credits = 0;
+      throttle = 0;
+      m_tready = 1;
+      tvalid_0 = 0;
+      tlast_0 = 0;
+      tdata_0 = 0;
+      tstrb_0 = 0;
+
+      $display("[%t] : System Reset Asserted...", $realtime);
+      $dumpfile("ualink_credit_tb.vcd");
+      $dumpvars(0, testbench);
+
+      reset = 1'b1;
+      for (i = 0; i < 2; i = i + 1) begin
+                 @(posedge clk);
+      end
+      $display("[%t] : System Reset De-asserted...", $realtime);
+      reset = 1'b0;
+      repeat (4) @(posedge clk);
+
+      $display("\n=== Phase 1: credit bytes ===");
+      build_ip(8'h01, 8'h10, RD_LEN);
+      send_pkt;
+      wait_out(1);
+      expect_val("credit responses", n_cr, 1);
+      expect_val("beats freed before the first frame", last_cr, 0);
+      expect_val("words per beat", last_cr_words, NW);
+      expect_val("FIFO depth bits", last_cr_bits, DEPTH_BITS);
+      build_ip(8'h00, 8'h00, 60);
+      send_pkt;
+      wait_out(2);
+      expect_val("plain frame source address", {obuf[26], obuf[27], obuf[28], obuf[29]}, 32'hA1A2A3A4);
+      expect_val("credit responses", n_cr, 1);
+      read_counters;
+      beats0 = RD_BEATS + (60 + BB - 1) / BB;
+      expect_val("beats freed before the COUNTERS read", last_cr, beats0);
+      expect_val("credit responses", n_cr, 2);
+      window = (1 << last_cr_bits) - 2;
+      in_stall0 = ctr[13];
+      expect_val("port 0 stall cycles", in_stall0, 0);
+      if (errors == 0) $display("PASS: credit bytes, window %0d beats of %0d words", window, last_cr_words);
+
+      $display("\n=== Phase 2: overload without credits ===");
+      run_overload(0);
+      if (drops == 0) begin
+          errors = errors + 1;
+          $display("FAIL: no frame dropped at overload");
+      end
+      n_out = frames_out;
+      read_counters;
+      expect_val("port 0 stall cycles", ctr[13] - in_stall0, tb_in_stall);
+      in_stall0 = ctr[13];
+
+      $display("\n=== Phase 3: overload with credits ===");
+      cr_sent = last_cr;            // the credit state as of the COUNTERS read, nothing in flight
+      cr_freed = last_cr;
+      mark_rd = mark_wr;
+      run_overload(1);
+      expect_val("dropped", drops, 0);
+      expect_val("stall cycles", tb_in_stall, 0);
+      if (busy_cycles * 100 < ready_cycles * 95) begin
+          errors = errors + 1;
+          $display("FAIL: m_axis busy %0d of %0d ready clocks with credits", busy_cycles, ready_cycles);
+      end
+      read_counters;
+      expect_val("port 0 stall cycles", ctr[13] - in_stall0, 0);
+
+      $display("%0d frames out, %0d with credit bytes", frames_out, n_cr);
+
+      $display("\n========================================");
+      if (errors == 0) $display("UALink credit tests PASSED");
+      else             $display("UALink credit tests: %0d FAIL", errors);
+      $display("All Tests Completed!");
+      $display("========================================");
+      #100  ;    $finish;       //end simulation
+  end
+
+  always #2.5  clk = ~clk;      // 200MHz
+
+  ualink_turbo64
+    #(.C_M_AXIS_DATA_WIDTH(W),
+      .C_S_AXIS_DATA_WIDTH(W),
+      .C_M_AXIS_TUSER_WIDTH(128),
+      .C_S_AXIS_TUSER_WIDTH(128)
+     ) in_arb
+    (
+    // Global Ports
+    .axi_aclk(clk),
+    .axi_resetn(~reset),
+
+    // Master Stream Ports
+    .m_axis_tdata(m_tdata),
+    .m_axis_tstrb(m_tstrb),
+    .m_axis_tuser(m_tuser),
+    .m_axis_tvalid(m_tvalid),
+    .m_axis_tready(m_tready),
+    .m_axis_tlast(m_tlast),
+
+    // Slave Stream Ports
+    .s_axis_tdata_0(tdata_0),
+    .s_axis_tuser_0({96'h0, seq}),
+    .s_axis_tstrb_0(tstrb_0),
+    .s_axis_tvalid_0(tvalid_0),
+    .s_axis_tready_0(tready[0]),
+    .s_axis_tlast_0(tlast_0),
+
+    .s_axis_tdata_1({W{1'b0}}),
+    .s_axis_tuser_1(128'h0),
+    .s_axis_tstrb_1({(W/8){1'b1}}),
+    .s_axis_tvalid_1(1'b0),
+    .s_axis_tready_1(tready[1]),
+    .s_axis_tlast_1(1'b0),
+
+    .s_axis_tdata_2({W{1'b0}}),
+    .s_axis_tuser_2(128'h0),
+    .s_axis_tstrb_2({(W/8){1'b1}}),
+    .s_axis_tvalid_2(1'b0),
+    .s_axis_tready_2(tready[2]),
+    .s_axis_tlast_2(1'b0),
+
+    .s_axis_tdata_3({W{1'b0}}),
+    .s_axis_tuser_3(128'h0),
+    .s_axis_tstrb_3({(W/8){1'b1}}),
+    .s_axis_tvalid_3(1'b0),
+    .s_axis_tready_3(tready[3]),
+    .s_axis_tlast_3(1'b0),
+
+    .s_axis_tdata_4({W{1'b0}}),
+    .s_axis_tuser_4(128'h0),
+    .s_axis_tstrb_4({(W/8){1'b1}}),
+    .s_axis_tvalid_4(1'b0),
+    .s_axis_tready_4(tready[4]),
+    .s_axis_tlast_4(1'b0)
+
+   );
+
+endmodule
@@ -22,20 +22,21 @@ module dual_port_ram_8x64
 #(
         parameter DPADDR_WIDTH = 8,
     parameter DPDATA_WIDTH = 64,
-    parameter DPDEPTH = (1 << DPADDR_WIDTH)
+    parameter DPDEPTH = (1 << DPADDR_WIDTH),
+    parameter WE_WIDTH = 1          // 1: word write enable, DPDATA_WIDTH/8: a write enable per byte
 )
 (
 // Port A
 input wire axi_aclk,  //common clock for port A and B
 input  wire                     axi_resetn,      // enable for port A (active high)
-input  wire                    we_a,      // write enable for port A (active high)
+input  wire [WE_WIDTH-1:0]      we_a,      // write enable for port A (active high)
 input  wire [DPADDR_WIDTH-1:0]    addr_a,
 input  wire [DPDATA_WIDTH-1:0]    din_a,
 output reg [DPDATA_WIDTH-1:0]    dout_a,
 
     // Port B
 
-    input  wire                     we_b,      // write enable for port B (active high)
+    input  wire [WE_WIDTH-1:0]      we_b,      // write enable for port B (active high)
     input  wire [DPADDR_WIDTH-1:0]    addr_b,
     input  wire [DPDATA_WIDTH-1:0]    din_b,
     output reg  [DPDATA_WIDTH-1:0]    dout_b
@@ -46,7 +47,8 @@ output reg [DPDATA_WIDTH-1:0]    dout_a,
 reg [DPDATA_WIDTH-1:0] dpmem [0:DPDEPTH-1];
 // Optional synthesis attribute for inferred block RAM (vendor-specific)
 // (* ram_style = "block" *) reg [DATA_WIDTH-1:0] mem [0:DEPTH-1];
-reg we_a_reg, we_b_reg;
+reg [WE_WIDTH-1:0] we_a_reg, we_b_reg;
+integer ba, bb;    // byte lane, its write enable is bit ba*WE_WIDTH/(DPDATA_WIDTH/8)
 reg [DPADDR_WIDTH-1:0] addr_a_reg, addr_b_reg;
 reg [DPDATA_WIDTH-1:0] din_a_reg, din_b_reg;
 reg [DPDATA_WIDTH-1:0] dout_a_reg;
@@ -79,11 +81,12 @@ end
         //     mem[i] <= 0;
         // end
       end else begin
-      if (we_a) begin
-         dpmem[addr_a] <= din_a;
-         dout_a <= din_a;  // write-first: read returns new data
+      for (ba = 0; ba < DPDATA_WIDTH/8; ba = ba + 1)
+         if (we_a[ba * WE_WIDTH / (DPDATA_WIDTH/8)]) begin
+            dpmem[addr_a][8*ba +: 8] <= din_a[8*ba +: 8];
+            dout_a[8*ba +: 8] <= din_a[8*ba +: 8];  // write-first: read returns new data
          end else begin
-         dout_a <= dpmem[addr_a];    // synchronous read
+            dout_a[8*ba +: 8] <= dpmem[addr_a][8*ba +: 8];    // synchronous read
          end
       end
     end
@@ -91,11 +94,12 @@ end
   // Write-first behavior on port B as well.
   always @(posedge axi_aclk) begin
     if (axi_resetn) begin
-      if (we_b) begin
-        dpmem[addr_b] <= din_b;
-        dout_b <= din_b;
-      end else begin
-        dout_b <= dpmem[addr_b];
+      for (bb = 0; bb < DPDATA_WIDTH/8; bb = bb + 1)
+        if (we_b[bb * WE_WIDTH / (DPDATA_WIDTH/8)]) begin
+          dpmem[addr_b][8*bb +: 8] <= din_b[8*bb +: 8];
+          dout_b[8*bb +: 8] <= din_b[8*bb +: 8];
+        end else begin
+          dout_b[8*bb +: 8] <= dpmem[addr_b][8*bb +: 8];
         end
 		end
   end
@@ -103,4 +107,94 @@ end
 // - If both ports write the same address in the same cycle (in the same or different clocks), the final value is implementation-dependent / undefined.
 // - To infer true dual-port block RAM on your FPGA, check vendor guidance (attributes or IP generator). The commented ram_style attribute is supported by some toolchains.
 // - If you prefer read-first behavior, set dout <= mem[addr] before mem[addr] <= din (change assignment order in the write branch).
+// - With WE_WIDTH = DPDATA_WIDTH/8 the byte lanes are written independently (byte-write-enable BRAM), the
+//   write-first read returns the new bytes merged with the old ones.
+endmodule
+
+// BANKS dual_port_ram_8x64 side by side so a wide AXI stream beat is one access per port and clock.
+// Word w of the DPADDR_WIDTH word address space is in bank w % BANKS, so any BANKS consecutive words
+// are in different banks: lane j of we/din/dout is word addr+j, whether addr is beat aligned or not.
+// Read latency is one clock like dual_port_ram_8x64, BANKS=1 is a plain dual_port_ram_8x64.
+// The write enables are per byte, bit 8j+n is byte n of lane j.
+module dual_port_ram_banked
+#(
+    parameter DPADDR_WIDTH = 8,      // word address
+    parameter DPDATA_WIDTH = 64,     // word
+    parameter BANKS = 1              // power of 2
+)
+(
+    input  wire                            axi_aclk,
+    input  wire                            axi_resetn,
+
+    input  wire [BANKS*DPDATA_WIDTH/8-1:0] we_a,
+    input  wire [DPADDR_WIDTH-1:0]         addr_a,
+    input  wire [BANKS*DPDATA_WIDTH-1:0]   din_a,
+    output reg  [BANKS*DPDATA_WIDTH-1:0]   dout_a,
+
+    input  wire [BANKS*DPDATA_WIDTH/8-1:0] we_b,
+    input  wire [DPADDR_WIDTH-1:0]         addr_b,
+    input  wire [BANKS*DPDATA_WIDTH-1:0]   din_b,
+    output reg  [BANKS*DPDATA_WIDTH-1:0]   dout_b
+);
+
+   function integer log2;
+      input integer number;
+      begin
+         log2=0;
+         while(2**log2<number) begin
+            log2=log2+1;
+         end
+      end
+   endfunction // log2
+
+   localparam ROW_WIDTH = DPADDR_WIDTH - log2(BANKS);
+
+   wire [DPDATA_WIDTH-1:0]  bank_dout_a [0:BANKS-1];
+   wire [DPDATA_WIDTH-1:0]  bank_dout_b [0:BANKS-1];
+   reg  [DPADDR_WIDTH-1:0]  lo_a, lo_b;    // bank of lane 0 in the last access, for the read data
+   integer j;
+
+   generate
+   genvar b;
+   for (b = 0; b < BANKS; b = b + 1) begin: bank
+      // the lane that lands in this bank, and the row of its word
+      wire [DPADDR_WIDTH-1:0] lane_a = (b - addr_a) % BANKS;
+      wire [DPADDR_WIDTH-1:0] lane_b = (b - addr_b) % BANKS;
+      wire [DPADDR_WIDTH-1:0] word_a = addr_a + lane_a;
+      wire [DPADDR_WIDTH-1:0] word_b = addr_b + lane_b;
+
+      dual_port_ram_8x64
+      #(
+       .DPADDR_WIDTH(ROW_WIDTH),
+       .DPDATA_WIDTH(DPDATA_WIDTH),
+       .DPDEPTH(1 << ROW_WIDTH),
+       .WE_WIDTH(DPDATA_WIDTH/8)
+      )
+      ram
+      (
+       .axi_aclk(axi_aclk),
+       .axi_resetn(axi_resetn),
+       .we_a(we_a[DPDATA_WIDTH/8*lane_a +: DPDATA_WIDTH/8]),
+       .addr_a(word_a / BANKS),
+       .din_a(din_a[DPDATA_WIDTH*lane_a +: DPDATA_WIDTH]),
+       .dout_a(bank_dout_a[b]),
+       .we_b(we_b[DPDATA_WIDTH/8*lane_b +: DPDATA_WIDTH/8]),
+       .addr_b(word_b / BANKS),
+       .din_b(din_b[DPDATA_WIDTH*lane_b +: DPDATA_WIDTH]),
+       .dout_b(bank_dout_b[b])
+      );
+   end
+   endgenerate
+
+   always @(posedge axi_aclk) begin
+      lo_a <= addr_a % BANKS;
+      lo_b <= addr_b % BANKS;
+   end
+
+   always @(*) begin
+      for (j = 0; j < BANKS; j = j + 1) begin
+         dout_a[DPDATA_WIDTH*j +: DPDATA_WIDTH] = bank_dout_a[(lo_a + j) % BANKS];
+         dout_b[DPDATA_WIDTH*j +: DPDATA_WIDTH] = bank_dout_b[(lo_b + j) % BANKS];
+      end
+   end
 endmodule
@@ -0,0 +1,530 @@
+/***Steen Larsen with AI assistance
+  The intent of this testbench is to check the GEMM op of ualink_turbo64: C = A x B (+ C) on 8x8 signed
+int8 tiles in DPMEM, run by the FMA engine (matrix_fma_8x8).  A GEMM frame is IPv4 with TOS 0x03, byte 31
+the word address of C (32 words of int32), bytes 32/33 of A and B (8 words each, row r in word r,
+element c in byte c), byte 34 bit 0 accumulate onto C.  The frame comes back when C is written, with
+byte 35 set to 1, or straight away with byte 35 0 when GEMM_JOBS jobs are already queued.
+Tiles go in with UALink WRITEs and C comes back with READs, all checked against a model of the memory
+kept here.
+
+Phase 1: one tile, C = A x B, the completion leaves after done_fma.
+Phase 2: a K = 24 chain, three tiles accumulated onto the same C, C preloaded with negative values.
+Phase 3: jobs back to back without waiting, the fifth one is refused and leaves its C alone, and the
+         tiles of the next job go in while the engine runs.
+Phase 4: 802.1Q tagged GEMM frames (PCP 5, the IPv4 header 4 bytes later) between untagged ones, held
+         until their C is written like the others.
+Phase 5: TOS 0x0B, the job on the systolic array: a K = 16 panel, a K = 28 chain of three jobs that
+         keep the accumulators and store once, a tagged one, and FMA jobs queued between them.
+The datapath is UALINK_WIDTH bits wide (64, 256 or 512, default 64, iverilog -DUALINK_WIDTH=256).
+
+ to run in Icarus simulator use:
+iverilog -o ualink_gemm_tb.vvp .\ualink_gemm_tb.v ualink_turbo64.v .\fallthrough_small_fifo_v2.v .\small_fifo_v3.v .\ualink_dpmem.v .\ualink_fma.v .\ualink_systolic.v .\crc32gen.v .\kv_hash_index.v
+vvp ualink_gemm_tb.vvp
+
+ *
+ */
+
+`timescale 1 ns / 1ps
+`ifndef UALINK_WIDTH
+`define UALINK_WIDTH 64
+`endif
+module testbench();
+
+    localparam W  = `UALINK_WIDTH;   // datapath width
+    localparam NW = W / 64;          // 64b words per beat
+    localparam BB = W / 8;           // bytes per beat
+
+    reg clk, reset;
+    wire [4:0]  tready;
+    wire [W-1:0]   m_tdata;
+    wire [W/8-1:0] m_tstrb;
+    wire [127:0] m_tuser;
+    wire        m_tvalid, m_tlast;
+    reg         m_tready;
+
+    reg [W-1:0]   tdata_0;
+    reg [W/8-1:0] tstrb_0;
+    reg         tvalid_0, tlast_0;
+
+    integer i, j;
+
+    localparam TOS_READ  = 8'h01;
+    localparam TOS_WRITE = 8'h02;
+    localparam TOS_GEMM  = 8'h03;
+    localparam TOS_SGEMM = 8'h0B;    // GEMM on the systolic array
+
+    // ------------- frame built by the tasks below -------------
+    reg [7:0]   pkt [0:511];
+    integer     pkt_len;
+    reg [31:0]  seq;                 // tuser of the next frame
+    reg [63:0]  shadow [0:255];      // what DPMEM should hold
+    reg         tagged;              // build_ip adds an 802.1Q tag
+
+    // IPv4 frame of len bytes with the given TOS, DPMEM word address in byte 31
+    task build_ip;
+        input [7:0]  tos;
+        input [7:0]  addr;
+        input integer len;
+        integer ip;
+        begin
+            for (i = 0; i < 512; i = i + 1) pkt[i] = 8'h00;
+            pkt[0] = 8'h02; pkt[5] = 8'h01;                                     // 02:00:00:00:00:01
+            pkt[6] = 8'h02; pkt[11] = 8'h02;                                    // from 02:00:00:00:00:02
+            ip = tagged ? 18 : 14;
+            if (tagged) begin
+                pkt[12] = 8'h81; pkt[13] = 8'h00; pkt[14] = 8'hA0;              // 802.1Q, PCP 5
+            end
+            pkt[ip - 2] = 8'h08; pkt[ip - 1] = 8'h00;                           // IPv4
+            pkt[ip] = 8'h45;
+            pkt[ip + 1] = tos;
+            pkt[ip + 2] = (len - ip) >> 8; pkt[ip + 3] = (len - ip) & 8'hFF;
+            pkt[ip + 8] = 8'h40; pkt[ip + 9] = 8'h11;
+            pkt[31] = addr;
+            pkt_len = len;
+        end
+    endtask
+
+    // drive pkt[0:pkt_len-1] on port 0, one beat per clock
+    task send_pkt;
+        integer w, nbeats;
+        reg [W-1:0]  word;
+        reg [BB-1:0] strb;
+        begin
+            nbeats = (pkt_len + BB - 1) / BB;
+            for (w = 0; w < nbeats; w = w + 1) begin
+                for (j = 0; j < BB; j = j + 1) begin
+                    word[8*j +: 8] = (BB*w + j < pkt_len) ? pkt[BB*w + j] : 8'h00;
+                    strb[j]        = BB*w + j < pkt_len;
+                end
+                @(posedge clk);
+                tdata_0  <= word;
+                tstrb_0  <= strb;
+                tvalid_0 <= 1;
+                tlast_0  <= (w == nbeats - 1);
+                while (!tready[0]) @(posedge clk);
+            end
+            @(posedge clk);
+            tvalid_0 <= 0;
+            tlast_0  <= 0;
+            seq = seq + 1;
+        end
+    endtask
+
+    // WRITE of the 8 shadow words from addr
+    task write_words;
+        input [7:0] addr;
+        integer k;
+        begin
+            build_ip(TOS_WRITE, addr, 96);
+            for (k = 0; k < 64; k = k + 1) pkt[32 + k] = shadow[addr + k / 8] >> (8 * (k % 8));
+            send_pkt;
+            n_sent = n_sent + 1;
+        end
+    endtask
+
+    // random signed int8 tile at addr
+    task random_tile;
+        input [7:0] addr;
+        begin
+            for (i = 0; i < 8; i = i + 1) shadow[addr + i] = {$random, $random};
+            write_words(addr);
+        end
+    endtask
+
+    task send_gemm;
+        input [7:0] a;
+        input [7:0] b;
+        input [7:0] c;
+        input       acc;
+        begin
+            build_ip(TOS_GEMM, c, 60);
+            pkt[32] = a;
+            pkt[33] = b;
+            pkt[34] = {7'd0, acc};
+            send_pkt;
+            n_sent = n_sent + 1;
+        end
+    endtask
+
+    // what the GEMM does to the shadow copy
+    task model_gemm;
+        input [7:0] a;
+        input [7:0] b;
+        input [7:0] c;
+        input       acc;
+        integer r, cc, k, sum;
+        reg [63:0] wa, wb;
+        reg [31:0] c32;
+        begin
+            for (r = 0; r < 8; r = r + 1)
+                for (cc = 0; cc < 8; cc = cc + 1) begin
+                    c32 = shadow[c + r * 4 + cc / 2] >> (32 * (cc % 2));
+                    sum = acc ? $signed(c32[23:0]) : 0;
+                    wa = shadow[a + r];
+                    for (k = 0; k < 8; k = k + 1) begin
+                        wb = shadow[b + k];
+                        sum = sum + $signed(wa[8*k +: 8]) * $signed(wb[8*cc +: 8]);
+                    end
+                    c32 = {{8{sum[23]}}, sum[23:0]};
+                    if (cc % 2) shadow[c + r * 4 + cc / 2][63:32] = c32;
+                    else        shadow[c + r * 4 + cc / 2][31:0]  = c32;
+                end
+        end
+    endtask
+
+    // a job on the systolic array: K steps of the panel at panel, flags bit 0 keeps the accumulators,
+    // bit 1 leaves C unwritten
+    task send_sgemm;
+        input [7:0] panel;
+        input [7:0] k;
+        input [7:0] c;
+        input [1:0] flags;
+        begin
+            build_ip(TOS_SGEMM, c, 60);
+            pkt[32] = panel;
+            pkt[33] = k;
+            pkt[34] = {6'd0, flags};
+            send_pkt;
+            n_sent = n_sent + 1;
+        end
+    endtask
+
+    // the array's accumulators, C[i][j] at 8*i+j
+    reg [31:0]  sacc [0:63];
+
+    task model_sgemm;
+        input [7:0] panel;
+        input [7:0] k;
+        input [7:0] c;
+        input [1:0] flags;
+        integer r, cc, s, prod;
+        reg [63:0] wa, wb;
+        begin
+            for (r = 0; r < 64; r = r + 1) if (!flags[0]) sacc[r] = 0;
+            for (s = 0; s < k; s = s + 1) begin
+                wa = shadow[panel + 2 * s];
+                wb = shadow[panel + 2 * s + 1];
+                for (r = 0; r < 8; r = r + 1)
+                    for (cc = 0; cc < 8; cc = cc + 1) begin
+                        prod = $signed(wa[8*r +: 8]) * $signed(wb[8*cc +: 8]);
+                        sacc[8 * r + cc] = sacc[8 * r + cc] + prod;
+                    end
+            end
+            if (!flags[1])
+                for (r = 0; r < 8; r = r + 1)
+                    for (cc = 0; cc < 8; cc = cc + 1)
+                        if (cc % 2) shadow[c + r * 4 + cc / 2][63:32] = sacc[8 * r + cc];
+                        else        shadow[c + r * 4 + cc / 2][31:0]  = sacc[8 * r + cc];
+        end
+    endtask
+
+    // ------------- output monitor -------------
+    reg [7:0]   obuf [0:511];
+    integer     opos, mk, mj, mip;
+    integer     cycle;
+    integer     errors;
+    integer     frames_out;
+    integer     n_gemm_out, n_done, t_done;
+    reg [7:0]   gemm_status [0:31];  // byte 35 of the GEMM completions, in order
+    reg [63:0]  rdata [0:255];       // words returned by READs, by address
+
+    always @(posedge clk) begin
+        if (reset) begin
+            cycle <= 0;
+            opos = 0;
+        end else begin
+            cycle <= cycle + 1;
+            if (in_arb.done_fma || in_arb.done_sys) begin
+                n_done = n_done + 1;
+                t_done = cycle;
+            end
+            if (m_tvalid && m_tready) begin
+                for (mk = 0; mk < BB; mk = mk + 1)
+                    if (m_tstrb[mk]) begin
+                        obuf[opos] = m_tdata[8*mk +: 8];
+                        opos = opos + 1;
+                    end
+                if (m_tlast) begin
+                    frames_out = frames_out + 1;
+                    mip = (obuf[12] == 8'h81) ? 18 : 14;
+                    if (obuf[mip] == 8'h45 && obuf[mip + 1] == TOS_READ)
+                        for (mk = 0; mk < 8; mk = mk + 1)
+                            for (mj = 0; mj < 8; mj = mj + 1) rdata[obuf[31] + mk][8*mj +: 8] = obuf[32 + 8*mk + mj];
+                    if (obuf[mip] == 8'h45 && (obuf[mip + 1] == TOS_GEMM || obuf[mip + 1] == TOS_SGEMM)) begin
+                        gemm_status[n_gemm_out] = obuf[35];
+                        // a completion must not leave before its C is written
+                        if (obuf[35] == 8'h01 && n_done <= n_gemm_out - n_refused_out) begin
+                            errors = errors + 1;
+                            $display("FAIL: GEMM completion %0d out at cycle %0d before its job was done", n_gemm_out, cycle);
+                        end
+                        if (obuf[35] != 8'h01) n_refused_out = n_refused_out + 1;
+                        n_gemm_out = n_gemm_out + 1;
+                    end
+                    opos = 0;
+                end
+            end
+        end
+    end
+
+    // wait for n frames out in all
+    task wait_out;
+        input integer n;
+        integer t0;
+        begin
+            t0 = cycle;
+            while (frames_out < n && cycle - t0 < 4000) @(posedge clk);
+            if (frames_out < n) begin
+                errors = errors + 1;
+                $display("FAIL: %0d of %0d frames out", frames_out, n);
+            end
+            repeat (4) @(posedge clk);
+        end
+    endtask
+
+    // read the 32 words of C back and compare them with the shadow copy
+    task check_c;
+        input [7:0] c;
+        input [8*40-1:0] name;
+        integer k, bad;
+        begin
+            for (k = 0; k < 4; k = k + 1) begin
+                build_ip(TOS_READ, c + 8 * k, 96);
+                send_pkt;
+                n_sent = n_sent + 1;
+            end
+            wait_out(n_sent);
+            bad = 0;
+            for (k = 0; k < 32; k = k + 1)
+                if (rdata[c + k] !== shadow[c + k]) begin
+                    if (bad < 4) $display("FAIL: %0s C word %0d is %h, expected %h", name, k, rdata[c + k], shadow[c + k]);
+                    bad = bad + 1;
+                end
+            errors = errors + bad;
+            if (bad == 0) $display("PASS: %0s, C[0][0] %0d C[7][7] %0d", name,
+                                   $signed(shadow[c][31:0]), $signed(shadow[c + 31][63:32]));
+        end
+    endtask
+
+    integer     n_sent, n_refused_out, n, t_start;
+
+  initial begin
+      clk   = 1'b0;
+      errors = 0;
+      frames_out = 0;
+      n_gemm_out = 0;
+      n_refused_out = 0;
+      n_done = 0;
+      seq = 0;
+      n_sent = 0;
+      tagged = 0;
+      m_tready = 1;
+      tvalid_0 = 0;
+      tlast_0 = 0;
+      tdata_0 = 0;
+      tstrb_0 = 0;
+      for (i = 0; i < 256; i = i + 1) shadow[i] = 0;
+
+      $display("[%t] : System Reset Asserted...", $realtime);
+      $dumpfile("ualink_gemm_tb.vcd");
+      $dumpvars(0, testbench);
+
+      reset = 1'b1;
+      for (i = 0; i < 2; i = i + 1) begin
+                 @(posedge clk);
+      end
+      $display("[%t] : System Reset De-asserted...", $realtime);
+      reset = 1'b0;
+      repeat (4) @(posedge clk);
+
+      // known contents, DPMEM starts undefined
+      for (n = 0; n < 256; n = n + 8) write_words(n);
+      wait_out(n_sent);
+
+      $display("\n=== Phase 1: one tile ===");
+      random_tile(8'h00);
+      random_tile(8'h08);
+      t_start = cycle;
+      send_gemm(8'h00, 8'h08, 8'h20, 0);
+      model_gemm(8'h00, 8'h08, 8'h20, 0);
+      wait_out(n_sent);
+      if (gemm_status[0] !== 8'h01) begin
+          errors = errors + 1;
+          $display("FAIL: GEMM status %h, expected 01", gemm_status[0]);
+      end
+      $display("GEMM frame in to completion out %0d cycles", t_done - t_start);
+      check_c(8'h20, "C = A x B");
+
+      $display("\n=== Phase 2: K = 24, accumulated ===");
+      for (n = 0; n < 32; n = n + 1) shadow[8'h40 + n] = {32'd0 - n * 5000, 32'd0 - n * 3};
+      for (n = 0; n < 4; n = n + 1) write_words(8'h40 + 8 * n);
+      for (n = 0; n < 3; n = n + 1) begin
+          random_tile(8'h00 + 16 * n);
+          random_tile(8'h08 + 16 * n);
+      end
+      for (n = 0; n < 3; n = n + 1) begin
+          send_gemm(8'h00 + 16 * n, 8'h08 + 16 * n, 8'h40, 1);
+          model_gemm(8'h00 + 16 * n, 8'h08 + 16 * n, 8'h40, 1);
+      end
+      wait_out(n_sent);
+      check_c(8'h40, "C += A0 B0 + A1 B1 + A2 B2");
+
+      $display("\n=== Phase 3: jobs back to back ===");
+      // four jobs into C at 0x60, 0x80, 0xA0, 0xC0, the fifth into 0xE0 finds the queue full
+      random_tile(8'h00);
+      random_tile(8'h08);
+      for (n = 0; n < 4; n = n + 1) begin
+          send_gemm(8'h00, 8'h08, 8'h60 + 32 * n, 0);
+          model_gemm(8'h00, 8'h08, 8'h60 + 32 * n, 0);
+      end
+      send_gemm(8'h00, 8'h08, 8'hE0, 0);
+      // the next job's tiles go in while the engine still runs the queued ones
+      random_tile(8'h10);
+      random_tile(8'h18);
+      if (n_done >= 8) begin
+          errors = errors + 1;
+          $display("FAIL: the engine finished before the next tiles were in");
+      end
+      wait_out(n_sent);
+      for (n = 0; n < 5; n = n + 1)
+          if (gemm_status[4 + n] !== (n < 4 ? 8'h01 : 8'h00)) begin
+              errors = errors + 1;
+              $display("FAIL: GEMM %0d status %h", n, gemm_status[4 + n]);
+          end
+      for (n = 0; n < 4; n = n + 1) check_c(8'h60 + 32 * n, "queued job");
+      check_c(8'hE0, "refused job, C untouched");
+      send_gemm(8'h10, 8'h18, 8'hE0, 0);
+      model_gemm(8'h10, 8'h18, 8'hE0, 0);
+      wait_out(n_sent);
+      check_c(8'hE0, "job with tiles loaded while busy");
+
+      $display("\n=== Phase 4: tagged jobs ===");
+      random_tile(8'h00);
+      random_tile(8'h08);
+      for (n = 0; n < 3; n = n + 1) begin
+          tagged = n != 1;
+          send_gemm(8'h00, 8'h08, 8'h60, n != 0);
+          model_gemm(8'h00, 8'h08, 8'h60, n != 0);
+      end
+      tagged = 0;
+      wait_out(n_sent);
+      for (n = 0; n < 3; n = n + 1)
+          if (gemm_status[10 + n] !== 8'h01) begin
+              errors = errors + 1;
+              $display("FAIL: GEMM %0d status %h", n, gemm_status[10 + n]);
+          end
+      check_c(8'h60, "tagged, untagged, tagged onto one C");
+      if (n_done != 12) begin
+          errors = errors + 1;
+          $display("FAIL: %0d jobs done, expected 12", n_done);
+      end
+
+      $display("\n=== Phase 5: jobs on the systolic array ===");
+      // a K = 16 panel at 0x00-0x1F, 28 steps in all to 0x37
+      for (n = 0; n < 56; n = n + 1) shadow[n] = {$random, $random};
+      for (n = 0; n < 56; n = n + 8) write_words(n);
+      t_start = cycle;
+      send_sgemm(8'h00, 8'd16, 8'h60, 2'b00);
+      model_sgemm(8'h00, 8'd16, 8'h60, 2'b00);
+      wait_out(n_sent);
+      $display("K = 16 job, frame in to completion out %0d cycles", t_done - t_start);
+      check_c(8'h60, "array, K = 16");
+      // K = 28 as 16 + 8 + 4 steps into C at 0x80, an FMA job into 0xA0 queued between them, and a
+      // tagged array job into 0xC0 behind; C at 0x80 is only written by the last of the three
+      send_sgemm(8'h00, 8'd16, 8'h80, 2'b10);
+      model_sgemm(8'h00, 8'd16, 8'h80, 2'b10);
+      send_gemm(8'h08, 8'h10, 8'hA0, 0);
+      model_gemm(8'h08, 8'h10, 8'hA0, 0);
+      send_sgemm(8'h20, 8'd8, 8'h80, 2'b11);
+      model_sgemm(8'h20, 8'd8, 8'h80, 2'b11);
+      wait_out(n_sent);
+      check_c(8'h80, "array jobs that go on, C unwritten");
+      send_sgemm(8'h30, 8'd4, 8'h80, 2'b01);
+      model_sgemm(8'h30, 8'd4, 8'h80, 2'b01);
+      tagged = 1;
+      send_sgemm(8'h10, 8'd8, 8'hC0, 2'b00);
+      model_sgemm(8'h10, 8'd8, 8'hC0, 2'b00);
+      tagged = 0;
+      wait_out(n_sent);
+      for (n = 0; n < 6; n = n + 1)
+          if (gemm_status[13 + n] !== 8'h01) begin
+              errors = errors + 1;
+              $display("FAIL: GEMM %0d status %h", 13 + n, gemm_status[13 + n]);
+          end
+      check_c(8'h80, "array, K = 28 in three jobs");
+      check_c(8'hA0, "FMA job between array jobs");
+      check_c(8'hC0, "array, tagged");
+      if (n_done != 18) begin
+          errors = errors + 1;
+          $display("FAIL: %0d jobs done, expected 18", n_done);
+      end
+
+      $display("%0d frames out, %0d GEMM completions", frames_out, n_gemm_out);
+
+      $display("\n========================================");
+      if (errors == 0) $display("UALink GEMM tests PASSED");
+      else             $display("UALink GEMM tests: %0d FAIL", errors);
+      $display("All Tests Completed!");
+      $display("========================================");
+      #100  ;    $finish;       //end simulation
+  end
+
+  always #2.5  clk = ~clk;      // 200MHz
+
+  ualink_turbo64
+    #(.C_M_AXIS_DATA_WIDTH(W),
+      .C_S_AXIS_DATA_WIDTH(W),
+      .C_M_AXIS_TUSER_WIDTH(128),
+      .C_S_AXIS_TUSER_WIDTH(128)
+     ) in_arb
+    (
+    // Global Ports
+    .axi_aclk(clk),
+    .axi_resetn(~reset),
+
+    // Master Stream Ports
+    .m_axis_tdata(m_tdata),
+    .m_axis_tstrb(m_tstrb),
+    .m_axis_tuser(m_tuser),
+    .m_axis_tvalid(m_tvalid),
+    .m_axis_tready(m_tready),
+    .m_axis_tlast(m_tlast),
+
+    // Slave Stream Ports
+    .s_axis_tdata_0(tdata_0),
+    .s_axis_tuser_0({96'h0, seq}),
+    .s_axis_tstrb_0(tstrb_0),
+    .s_axis_tvalid_0(tvalid_0),
+    .s_axis_tready_0(tready[0]),
+    .s_axis_tlast_0(tlast_0),
+
+    .s_axis_tdata_1({W{1'b0}}),
+    .s_axis_tuser_1(128'h0),
+    .s_axis_tstrb_1({(W/8){1'b1}}),
+    .s_axis_tvalid_1(1'b0),
+    .s_axis_tready_1(tready[1]),
+    .s_axis_tlast_1(1'b0),
+
+    .s_axis_tdata_2({W{1'b0}}),
+    .s_axis_tuser_2(128'h0),
+    .s_axis_tstrb_2({(W/8){1'b1}}),
+    .s_axis_tvalid_2(1'b0),
+    .s_axis_tready_2(tready[2]),
+    .s_axis_tlast_2(1'b0),
+
+    .s_axis_tdata_3({W{1'b0}}),
+    .s_axis_tuser_3(128'h0),
+    .s_axis_tstrb_3({(W/8){1'b1}}),
+    .s_axis_tvalid_3(1'b0),
+    .s_axis_tready_3(tready[3]),
+    .s_axis_tlast_3(1'b0),
+
+    .s_axis_tdata_4({W{1'b0}}),
+    .s_axis_tuser_4(128'h0),
+    .s_axis_tstrb_4({(W/8){1'b1}}),
+    .s_axis_tvalid_4(1'b0),
+    .s_axis_tready_4(tready[4]),
+    .s_axis_tlast_4(1'b0)
+
+   );
+
+endmodule
@@ -0,0 +1,277 @@
+/***Steen Larsen with AI assistance
+  The intent of this testbench is to check the sized UALink READ/WRITE ops of ualink_turbo64 byte for
+byte: req_len words from word 4, with the first and last word byte masks of req_attr, for every byte
+offset 0-7 and length 1-64.
+
+The requests and the frames expected back come from the host code, CustomEth/src/ualink_vectors.cpp
+builds them with FPGAInterface::sized_request_frame (ualink::calc_req_addr_attr for req_len and the
+masks) and models the memory as the host sees it.  run_test.sh compiles and runs it into
+ualink_sized_vectors.hex:
+    a count word n, n words of the request, n words expected back, ..., a 0 count at the end
+Each offset/length is a write, a read of the same bytes and a read of the 11 words around them, so a
+byte written or returned outside the request is an error.  The odd offsets are 802.1Q tagged, their
+IPv4 header and the sized fields 4 bytes later.  Port 0 streams the requests back to back,
+tuser carries the frame number; the second half runs with random backpressure on m_axis.  The
+datapath is UALINK_WIDTH bits wide (64, 256 or 512, default 64, iverilog -DUALINK_WIDTH=256).
+
+ to run in Icarus simulator use:
+g++ -O2 -std=c++17 ../../../CustomEth/src/ualink_vectors.cpp ../../../CustomEth/util/checksum.cpp -o ualink_vectors
+./ualink_vectors > ualink_sized_vectors.hex
+iverilog -o ualink_sized_tb.vvp .\ualink_sized_tb.v ualink_turbo64.v .\fallthrough_small_fifo_v2.v .\small_fifo_v3.v .\ualink_dpmem.v .\ualink_fma.v .\ualink_systolic.v .\crc32gen.v .\kv_hash_index.v
+vvp ualink_sized_tb.vvp
+
+ *
+ */
+
+`timescale 1 ns / 1ps
+`ifndef UALINK_WIDTH
+`define UALINK_WIDTH 64
+`endif
+module testbench();
+
+    localparam W  = `UALINK_WIDTH;   // datapath width
+    localparam NW = W / 64;          // 64b words per beat
+
+    // bytes 26-29 of a UALink response (word 3) carry the port 0 credits: the beats freed, free running,
+    // then the DUT's IN_FIFO_DEPTH_BIT and BEAT_WORDS, taken from it here, ualink_credit_tb checks those
+    wire [15:0] cr_const = {in_arb.ua_cr_bits, in_arb.ua_cr_words};
+
+    function [63:0] with_credits;
+        input [63:0] sent;
+        input [63:0] got;
+        begin
+            with_credits = {sent[63:48], cr_const, got[31:16], sent[15:0]};
+        end
+    endfunction
+
+    reg clk, reset;
+    wire [4:0]  tready;
+    wire [W-1:0]   m_tdata;
+    wire [W/8-1:0] m_tstrb;
+    wire [127:0] m_tuser;
+    wire        m_tvalid, m_tlast;
+    reg         m_tready;
+
+    integer i, k;
+
+    localparam MAXV   = 65536;       // vector words
+    localparam MAXF   = 4096;        // frames
+
+    // ------------- vectors -------------
+    reg [63:0]  vec [0:MAXV-1];
+    integer     f_start [0:MAXF-1];  // first request word of frame f in vec, the expected ones follow
+    integer     f_len   [0:MAXF-1];  // words
+    integer     n_frames;            // frames on the bus so far, all of them once the run starts
+
+    // ------------- port 0 source -------------
+    reg [31:0]  src_f;               // frame on the bus
+    reg [7:0]   src_w;               // beat of the frame on the bus
+    reg [W-1:0]   s_tdata;
+    reg [W/8-1:0] s_tstrb;
+    wire        s_tvalid = src_f < n_frames;
+    wire        s_tlast  = src_w == (f_len[src_f] + NW - 1) / NW - 1;
+
+    // vec does not change once loaded, the frame starts when n_frames lets it onto the bus
+    always @(src_w or src_f or n_frames) begin
+        for (k = 0; k < NW; k = k + 1) begin
+            s_tdata[64*k +: 64] = (src_w * NW + k < f_len[src_f]) ? vec[f_start[src_f] + src_w * NW + k] : 64'h0;
+            s_tstrb[8*k +: 8]   = (src_w * NW + k < f_len[src_f]) ? 8'hFF : 8'h00;
+        end
+    end
+
+    always @(posedge clk) begin
+        if (reset) begin
+            src_w <= 0;
+        end else if (s_tvalid && tready[0]) begin
+            src_w <= s_tlast ? 8'd0 : src_w + 8'd1;
+            if (s_tlast) src_f <= src_f + 1;
+        end
+    end
+
+    // ------------- output monitor -------------
+    integer     cycle;
+    integer     errors;
+    integer     out_w;               // next word of the current output frame
+    integer     kw;
+    reg [31:0]  out_f;               // next frame expected
+    reg [63:0]  exp, word;
+    integer     frames_out, beats_out, words_out;
+
+    always @(posedge clk) begin
+        if (reset) begin
+            cycle <= 0;
+            out_w = 0;
+        end else begin
+            cycle <= cycle + 1;
+
+            if (m_tvalid && m_tready) begin
+                beats_out = beats_out + 1;
+                if (out_w == 0 && m_tuser[31:0] != out_f) begin
+                    errors = errors + 1;
+                    if (errors <= 10) $display("FAIL: frame %0d out, expected %0d", m_tuser[31:0], out_f);
+                    out_f = m_tuser[31:0];
+                end
+
+                for (kw = 0; kw < NW; kw = kw + 1) begin
+                    if (m_tstrb[8*kw +: 8] != 0) begin
+                        word = m_tdata[64*kw +: 64];
+                        exp = vec[f_start[out_f] + f_len[out_f] + out_w];
+                        if (out_w == 3)
+                            exp = with_credits(exp, word);
+                        if (word !== exp) begin
+                            errors = errors + 1;
+                            if (errors <= 10) $display("FAIL: frame %0d word %0d is %h, expected %h", out_f, out_w, word, exp);
+                        end
+                        out_w = out_w + 1;
+                        words_out = words_out + 1;
+                    end
+                end
+
+                if (m_tlast) begin
+                    if (out_w != f_len[out_f]) begin
+                        errors = errors + 1;
+                        if (errors <= 10) $display("FAIL: frame %0d ended at word %0d", out_f, out_w - 1);
+                    end
+                    frames_out = frames_out + 1;
+                    out_f = out_f + 1;
+                    out_w = 0;
+                end
+            end
+        end
+    end
+
+    // random backpressure for the second half
+    reg [15:0] lfsr;
+    reg        bp;
+    always @(posedge clk) begin
+        if (reset) lfsr <= 16'hACE1;
+        else       lfsr <= {lfsr[14:0], lfsr[15] ^ lfsr[13] ^ lfsr[12] ^ lfsr[10]};
+        m_tready <= bp ? lfsr[0] | lfsr[5] : 1'b1;
+    end
+
+    integer     n_vec, v, t0;
+
+  initial begin
+      clk   = 1'b0;
+      errors = 0;
+      bp = 0;
+      n_frames = 0;
+      src_f = 0;
+      out_f = 0;
+      frames_out = 0;
+      beats_out = 0;
+      words_out = 0;
+
+      for (i = 0; i < MAXV; i = i + 1) vec[i] = 64'h0;
+      $readmemh("ualink_sized_vectors.hex", vec);
+      n_vec = 0;
+      v = 0;
+      while (vec[v] != 0 && n_vec < MAXF) begin
+          f_len[n_vec]   = vec[v];
+          f_start[n_vec] = v + 1;
+          v = v + 1 + 2 * vec[v];
+          n_vec = n_vec + 1;
+      end
+      f_len[n_vec] = 0;
+      f_start[n_vec] = 0;
+      if (n_vec == 0) begin
+          errors = errors + 1;
+          $display("FAIL: no vectors in ualink_sized_vectors.hex, run CustomEth/src/ualink_vectors first");
+      end
+
+      $display("[%t] : System Reset Asserted...", $realtime);
+      $dumpfile("ualink_sized_tb.vcd");
+      $dumpvars(0, testbench);
+
+      reset = 1'b1;
+      for (i = 0; i < 2; i = i + 1) begin
+                 @(posedge clk);
+      end
+      $display("[%t] : System Reset De-asserted...", $realtime);
+      reset = 1'b0;
+      repeat (4) @(posedge clk);
+
+      $display("\n=== %0d sized READ/WRITE frames, offsets 0-7, lengths 1-64 ===", n_vec);
+      n_frames = n_vec;
+      t0 = cycle;
+      while (frames_out < n_vec && cycle - t0 < 40 * n_vec + 1000) begin
+          @(posedge clk);
+          bp = src_f >= n_vec / 2;
+      end
+      bp = 0;
+      repeat (10) @(posedge clk);
+      if (frames_out < n_vec) begin
+          errors = errors + 1;
+          $display("FAIL: only %0d of %0d frames came out", frames_out, n_vec);
+      end
+      $display("%0d frames, %0d words, %0d beats of %0d bits out", frames_out, words_out, beats_out, W);
+      if (errors == 0) $display("PASS: byte exact for every offset and length");
+
+      $display("\n========================================");
+      if (errors == 0) $display("UALink sized READ/WRITE tests PASSED");
+      else             $display("UALink sized READ/WRITE tests: %0d FAIL", errors);
+      $display("All Tests Completed!");
+      $display("========================================");
+      #100  ;    $finish;       //end simulation
+  end
+
+  always #2.5  clk = ~clk;      // 200MHz
+
+  ualink_turbo64
+    #(.C_M_AXIS_DATA_WIDTH(W),
+      .C_S_AXIS_DATA_WIDTH(W),
+      .C_M_AXIS_TUSER_WIDTH(128),
+      .C_S_AXIS_TUSER_WIDTH(128)
+     ) in_arb
+    (
+    // Global Ports
+    .axi_aclk(clk),
+    .axi_resetn(~reset),
+
+    // Master Stream Ports
+    .m_axis_tdata(m_tdata),
+    .m_axis_tstrb(m_tstrb),
+    .m_axis_tuser(m_tuser),
+    .m_axis_tvalid(m_tvalid),
+    .m_axis_tready(m_tready),
+    .m_axis_tlast(m_tlast),
+
+    // Slave Stream Ports
+    .s_axis_tdata_0(s_tdata),
+    .s_axis_tuser_0({96'h0, src_f}),
+    .s_axis_tstrb_0(s_tstrb),
+    .s_axis_tvalid_0(s_tvalid),
+    .s_axis_tready_0(tready[0]),
+    .s_axis_tlast_0(s_tlast),
+
+    .s_axis_tdata_1({W{1'b0}}),
+    .s_axis_tuser_1(128'h0),
+    .s_axis_tstrb_1({(W/8){1'b1}}),
+    .s_axis_tvalid_1(1'b0),
+    .s_axis_tready_1(tready[1]),
+    .s_axis_tlast_1(1'b0),
+
+    .s_axis_tdata_2({W{1'b0}}),
+    .s_axis_tuser_2(128'h0),
+    .s_axis_tstrb_2({(W/8){1'b1}}),
+    .s_axis_tvalid_2(1'b0),
+    .s_axis_tready_2(tready[2]),
+    .s_axis_tlast_2(1'b0),
+
+    .s_axis_tdata_3({W{1'b0}}),
+    .s_axis_tuser_3(128'h0),
+    .s_axis_tstrb_3({(W/8){1'b1}}),
+    .s_axis_tvalid_3(1'b0),
+    .s_axis_tready_3(tready[3]),
+    .s_axis_tlast_3(1'b0),
+
+    .s_axis_tdata_4({W{1'b0}}),
+    .s_axis_tuser_4(128'h0),
+    .s_axis_tstrb_4({(W/8){1'b1}}),
+    .s_axis_tvalid_4(1'b0),
+    .s_axis_tready_4(tready[4]),
+    .s_axis_tlast_4(1'b0)
+
+   );
+
+endmodule
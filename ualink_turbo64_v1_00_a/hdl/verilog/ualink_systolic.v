@@ -0,0 +1,235 @@
+// N x N output stationary systolic MAC array on DPMEM port B
+// C += A x B for an N x K panel of A and a K x N panel of B, signed DATA_WIDTH (8 or 16) operands and
+// ACC_WIDTH accumulators that stay in the array between jobs.  PE (i,j) holds C[i][j]; column k of A
+// enters row i from the left i clocks late and row k of B enters column j from the top j clocks late,
+// so A[i][k] and B[k][j] meet in PE (i,j), and every PE does one MAC per clock once the array is full.
+//
+// The operands stream from memory, one step k per STEP_READS accesses of MEM_WIDTH bits on port B
+// (dual_port_ram_banked, word w in lane w - addr), so with MEM_WIDTH >= 2*N*DATA_WIDTH a step per clock.
+// Port A, the packet datapath, is never touched.  Step k is STEP_WORDS 64-bit words from
+// base_in + k*STEP_WORDS, little endian: A[0..N-1][k] in the low N*DATA_WIDTH bits, B[k][0..N-1] above.
+// With store the accumulators are then written to base_out, row major, ACC_WIDTH bits each, C[i][j] in
+// bits ACC_WIDTH*(N*i+j) of the N*N*ACC_WIDTH/64 words from base_out.  With clear they start at 0,
+// otherwise the job adds to what the last one left, so a long K is several jobs and one store.
+//
+// The port is shared like the FMA engine's: mem_req asks for it, the array only reads or writes in the
+// clocks mem_gnt gives it.  Reads have one clock of latency.  One job at a time, busy from start until
+// the done pulse: STEP_READS*steps read clocks (given the port), about 2N clocks to drain, and
+// N*N*ACC_WIDTH/MEM_WIDTH write clocks with store.
+module systolic_array
+#(
+   parameter N          = 8,       // 4, 8 or 16
+   parameter DATA_WIDTH = 8,       // int8 or int16 operands
+   parameter ACC_WIDTH  = 32,      // 32 or 64
+   parameter MEM_WIDTH  = 64,      // port B, 64 * BANKS of dual_port_ram_banked
+   parameter ADDR_WIDTH = 8        // 64-bit word address
+)
+(
+   input  wire                    clk,
+   input  wire                    rst_n,
+
+   input  wire                    start,
+   input  wire [ADDR_WIDTH-1:0]   base_in,
+   input  wire [ADDR_WIDTH-1:0]   steps,      // K
+   input  wire [ADDR_WIDTH-1:0]   base_out,
+   input  wire                    clear,      // accumulators start at 0
+   input  wire                    store,      // write C when done
+   output reg                     done,
+   output wire                    busy,
+
+   output wire                    mem_req,
+   input  wire                    mem_gnt,
+   output wire [ADDR_WIDTH-1:0]   addr_b,
+   input  wire [MEM_WIDTH-1:0]    dout_b,
+   output wire [MEM_WIDTH-1:0]    din_b,
+   output wire [MEM_WIDTH/8-1:0]  we_b
+);
+
+   localparam STEP_BITS   = 2 * N * DATA_WIDTH;
+   localparam STEP_WORDS  = STEP_BITS / 64;
+   localparam MEM_WORDS   = MEM_WIDTH / 64;
+   localparam STEP_READS  = STEP_BITS > MEM_WIDTH ? STEP_BITS / MEM_WIDTH : 1;
+   localparam C_WRITES    = N * N * ACC_WIDTH / MEM_WIDTH;
+
+   localparam IDLE   = 2'd0;
+   localparam STREAM = 2'd1;
+   localparam DRAIN  = 2'd2;
+   localparam STORE  = 2'd3;
+
+   reg [1:0]                      state;
+   reg [ADDR_WIDTH-1:0]           base_a, base_c, n_steps;
+   reg                            do_store;
+
+   // reads: step rd_step, access rd_part of it; the data of the last clock's access is on dout_b
+   reg [ADDR_WIDTH-1:0]           rd_step;
+   reg [7:0]                      rd_part;
+   reg                            rd_pend, rd_pend_last;
+   reg [STEP_READS*MEM_WIDTH-1:0] step_buf;   // the accesses of a step, the last one at the top
+   reg                            step_v;     // step_buf holds a whole step
+   reg [7:0]                      wr_cnt;
+
+   wire rd_more = rd_step != n_steps;
+   wire rd_go   = state == STREAM && rd_more && mem_gnt;
+
+   wire [STEP_READS*MEM_WIDTH-1:0] dout_ext = dout_b;
+   wire [N*DATA_WIDTH-1:0]         step_a   = step_buf[N*DATA_WIDTH-1:0];
+   wire [N*DATA_WIDTH-1:0]         step_b   = step_buf[STEP_BITS-1:N*DATA_WIDTH];
+
+   // the skew: the column of A and row of B of a step, delayed by 1..N-1 clocks
+   reg  [N*DATA_WIDTH-1:0]        a_sk [1:N-1];
+   reg  [N*DATA_WIDTH-1:0]        b_sk [1:N-1];
+   reg  [N-1:1]                   v_sk;
+
+   // what each PE passes on, PE (i,j) at index N*i+j
+   wire [N*N*DATA_WIDTH-1:0]      a_pe, b_pe;
+   wire [N*N-1:0]                 v_pe;
+   wire [N*N*ACC_WIDTH-1:0]       c_pe;
+
+   wire in_flight = rd_pend | step_v | (|v_sk) | (|v_pe);
+   reg  clear_acc;
+   integer d;
+
+   assign busy    = state != IDLE;
+   assign mem_req = (state == STREAM && rd_more) || state == STORE;
+   assign addr_b  = state == STORE ? base_c + wr_cnt * MEM_WORDS
+                                   : base_a + rd_step * STEP_WORDS + rd_part * MEM_WORDS;
+   assign din_b   = c_pe[wr_cnt * MEM_WIDTH +: MEM_WIDTH];
+   assign we_b    = {(MEM_WIDTH/8){state == STORE}};
+
+   always @(posedge clk or negedge rst_n) begin
+      if (!rst_n) begin
+         state        <= IDLE;
+         done         <= 1'b0;
+         clear_acc    <= 1'b0;
+         rd_pend      <= 1'b0;
+         rd_pend_last <= 1'b0;
+         step_v       <= 1'b0;
+         rd_step      <= {ADDR_WIDTH{1'b0}};
+         rd_part      <= 8'd0;
+         wr_cnt       <= 8'd0;
+      end else begin
+         done      <= 1'b0;
+         clear_acc <= 1'b0;
+         rd_pend      <= rd_go;
+         rd_pend_last <= rd_part == STEP_READS - 1;
+         step_v       <= rd_pend & rd_pend_last;
+         if (rd_pend) step_buf <= (step_buf >> MEM_WIDTH) | (dout_ext << ((STEP_READS - 1) * MEM_WIDTH));
+         if (rd_go) begin
+            if (rd_part == STEP_READS - 1) begin
+               rd_part <= 8'd0;
+               rd_step <= rd_step + 1'b1;
+            end else begin
+               rd_part <= rd_part + 8'd1;
+            end
+         end
+         case (state)
+            IDLE: if (start) begin
+               state     <= STREAM;
+               base_a    <= base_in;
+               base_c    <= base_out;
+               n_steps   <= steps;
+               do_store  <= store;
+               clear_acc <= clear;
+               rd_step   <= {ADDR_WIDTH{1'b0}};
+               rd_part   <= 8'd0;
+            end
+            STREAM: if (!rd_more) state <= DRAIN;
+            // the last step has gone through the last PE
+            DRAIN: if (!in_flight) begin
+               if (do_store) begin
+                  state  <= STORE;
+                  wr_cnt <= 8'd0;
+               end else begin
+                  state <= IDLE;
+                  done  <= 1'b1;
+               end
+            end
+            STORE: if (mem_gnt) begin
+               wr_cnt <= wr_cnt + 8'd1;
+               if (wr_cnt == C_WRITES - 1) begin
+                  state <= IDLE;
+                  done  <= 1'b1;
+               end
+            end
+         endcase
+      end
+   end
+
+   always @(posedge clk or negedge rst_n) begin
+      if (!rst_n) begin
+         v_sk <= {(N-1){1'b0}};
+      end else begin
+         v_sk[1] <= step_v;
+         for (d = 2; d < N; d = d + 1) v_sk[d] <= v_sk[d-1];
+      end
+   end
+
+   always @(posedge clk) begin
+      a_sk[1] <= step_a;
+      b_sk[1] <= step_b;
+      for (d = 2; d < N; d = d + 1) begin
+         a_sk[d] <= a_sk[d-1];
+         b_sk[d] <= b_sk[d-1];
+      end
+   end
+
+   generate
+   genvar i, j;
+   for (i = 0; i < N; i = i + 1) begin: row
+      for (j = 0; j < N; j = j + 1) begin: col
+         // row i of A comes in i clocks late, column j of B j clocks late
+         wire [DATA_WIDTH-1:0] a_in;
+         wire [DATA_WIDTH-1:0] b_in;
+         wire                  v_in;
+         if (j == 0) begin: left
+            if (i == 0) begin: first
+               assign a_in = step_a[0 +: DATA_WIDTH];
+               assign v_in = step_v;
+            end else begin: skewed
+               assign a_in = a_sk[i][DATA_WIDTH*i +: DATA_WIDTH];
+               assign v_in = v_sk[i];
+            end
+         end else begin: inner_a
+            assign a_in = a_pe[DATA_WIDTH*(N*i+j-1) +: DATA_WIDTH];
+            assign v_in = v_pe[N*i+j-1];
+         end
+         if (i == 0) begin: top
+            if (j == 0) begin: first
+               assign b_in = step_b[0 +: DATA_WIDTH];
+            end else begin: skewed
+               assign b_in = b_sk[j][DATA_WIDTH*j +: DATA_WIDTH];
+            end
+         end else begin: inner_b
+            assign b_in = b_pe[DATA_WIDTH*(N*(i-1)+j) +: DATA_WIDTH];
+         end
+
+         reg  [DATA_WIDTH-1:0]          a_r, b_r;
+         reg                            v_r;
+         reg  [ACC_WIDTH-1:0]           acc;
+         wire signed [2*DATA_WIDTH-1:0] prod = $signed(a_in) * $signed(b_in);
+
+         always @(posedge clk or negedge rst_n) begin
+            if (!rst_n) begin
+               v_r <= 1'b0;
+               acc <= {ACC_WIDTH{1'b0}};
+            end else begin
+               v_r <= v_in;
+               if (clear_acc)
+                  acc <= {ACC_WIDTH{1'b0}};
+               else if (v_in)
+                  acc <= acc + {{ACC_WIDTH{prod[2*DATA_WIDTH-1]}}, prod};   // sign extended, cut to ACC_WIDTH
+            end
+         end
+         always @(posedge clk) begin
+            a_r <= a_in;
+            b_r <= b_in;
+         end
+
+         assign a_pe[DATA_WIDTH*(N*i+j) +: DATA_WIDTH] = a_r;
+         assign b_pe[DATA_WIDTH*(N*i+j) +: DATA_WIDTH] = b_r;
+         assign v_pe[N*i+j]                           = v_r;
+         assign c_pe[ACC_WIDTH*(N*i+j) +: ACC_WIDTH]  = acc;
+      end
+   end
+   endgenerate
+endmodule
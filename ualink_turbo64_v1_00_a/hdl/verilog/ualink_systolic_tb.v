@@ -0,0 +1,409 @@
+/***Steen Larsen with AI assistance
+  The intent of this testbench is to check the N x N systolic MAC array (ualink_systolic.v) on a banked
+DPMEM, and to measure it against the MAC units there are today.  For each of N = 4, 8, 16 with int8
+operands and N = 8, 16 with int16 operands:
+
+Job 1: C = A1 x B1, K = 32 steps streamed from port B with the port always granted, C stored.
+Job 2: C = A1 x B1 again without a store, port B granted 3 clocks in 4 (shared with memcached).
+Job 3: C += A2 x B2, K = 16, the accumulators kept from job 2, C stored: C = A1 x B1 + A2 x B2.
+During jobs 2 and 3 port A (the packet datapath) is busy every clock, a word written and then read
+back and checked, on the same memory the array streams from and writes C to.
+
+Every C is checked against a model.  Reported per job: MACs, clocks from start to done, MACs/clock and
+utilization (MACs / clocks / N*N), and the peak the port width allows (1 step per STEP_READS clocks).
+For comparison the same is measured for matrix_fma_8x8 (one 8x8x8 tile, ualink_fma.v) and for mac_unit
+(ualink_mac.sv, a mac4 on two words read from one port).
+The port is UALINK_WIDTH bits wide (64, 256 or 512, default 64, iverilog -DUALINK_WIDTH=256).
+
+ to run in Icarus simulator use:
+iverilog -o ualink_systolic_tb.vvp .\ualink_systolic_tb.v .\ualink_systolic.v .\ualink_dpmem.v .\ualink_fma.v .\ualink_mac.sv
+vvp ualink_systolic_tb.vvp
+
+ *
+ */
+
+`timescale 1 ns / 1ps
+`ifndef UALINK_WIDTH
+`define UALINK_WIDTH 64
+`endif
+
+// one array on its own memory, run when go goes high
+module sa_bench
+#(
+    parameter N   = 8,
+    parameter DW  = 8,
+    parameter ACC = 32,
+    parameter W   = 64
+)
+(
+    input  wire        clk,
+    input  wire        rst_n,
+    input  wire        go,
+    output reg         finished,
+    output reg  [15:0] errors
+);
+    localparam AW         = 10;                 // 1024 words
+    localparam NW         = W / 64;
+    localparam STEP_WORDS = 2 * N * DW / 64;
+    localparam STEP_READS = 2 * N * DW > W ? 2 * N * DW / W : 1;
+    localparam C_WORDS    = N * N * ACC / 64;
+    localparam K1 = 32, K2 = 16;
+    localparam OPS1 = 0, OPS2 = 256, C_BASE = 512, SCRATCH = 896;
+
+    // port A, driven here
+    reg  [W/8-1:0]  we_a;
+    reg  [AW-1:0]   addr_a;
+    reg  [W-1:0]    din_a;
+    wire [W-1:0]    dout_a;
+    // port B, the array's
+    wire [AW-1:0]   sa_addr;
+    wire [W-1:0]    sa_din, dout_b;
+    wire [W/8-1:0]  sa_we;
+    wire            sa_req, sa_done, sa_busy;
+    reg             gnt;
+    reg             start, clear, store;
+    reg  [AW-1:0]   base_in, steps;
+    wire [AW-1:0]   base_out = C_BASE;
+
+    dual_port_ram_banked #(.DPADDR_WIDTH(AW), .DPDATA_WIDTH(64), .BANKS(NW)) ram (
+        .axi_aclk(clk), .axi_resetn(rst_n),
+        .we_a(we_a), .addr_a(addr_a), .din_a(din_a), .dout_a(dout_a),
+        .we_b(sa_we & {(W/8){gnt}}), .addr_b(sa_addr), .din_b(sa_din), .dout_b(dout_b)
+    );
+
+    systolic_array #(.N(N), .DATA_WIDTH(DW), .ACC_WIDTH(ACC), .MEM_WIDTH(W), .ADDR_WIDTH(AW)) sa (
+        .clk(clk), .rst_n(rst_n),
+        .start(start), .base_in(base_in), .steps(steps), .base_out(base_out),
+        .clear(clear), .store(store), .done(sa_done), .busy(sa_busy),
+        .mem_req(sa_req), .mem_gnt(gnt), .addr_b(sa_addr), .dout_b(dout_b), .din_b(sa_din), .we_b(sa_we)
+    );
+
+    // operands and the expected C
+    integer a1 [0:N*K1-1];      // A1[i][k] at N*k+i
+    integer b1 [0:N*K1-1];      // B1[k][j] at N*k+j
+    integer a2 [0:N*K2-1];
+    integer b2 [0:N*K2-1];
+    reg [ACC-1:0] c_exp [0:N*N-1];
+    reg [2*N*DW-1:0] step_bits;
+    reg [N*N*ACC-1:0] c_bits;
+    reg [63:0] c_word;
+    reg signed [63:0] sum;
+    integer i, j, k, w, cyc, macs, n_gnt;
+    integer pa_ops;             // port A accesses while the array ran
+    reg     pa_on;
+    reg [63:0] pa_val;
+
+    function [DW-1:0] rnd;
+        input integer dummy;
+        begin
+            rnd = $random;
+        end
+    endfunction
+
+    task put_word;
+        input [AW-1:0] addr;
+        input [63:0]   value;
+        begin
+            @(negedge clk);
+            we_a   = 8'hFF;
+            addr_a = addr;
+            din_a  = value;
+            @(negedge clk);
+            we_a   = {(W/8){1'b0}};
+        end
+    endtask
+
+    task get_word;
+        input  [AW-1:0] addr;
+        output [63:0]   value;
+        begin
+            @(negedge clk);
+            addr_a = addr;
+            @(negedge clk);
+            value = dout_a[63:0];
+        end
+    endtask
+
+    // operands of one job as steps of STEP_WORDS words from base
+    task load_ops;
+        input integer base;
+        input integer nk;
+        input integer second;
+        begin
+            for (k = 0; k < nk; k = k + 1) begin
+                for (i = 0; i < N; i = i + 1) begin
+                    step_bits[DW*i +: DW]       = second ? a2[N*k+i] : a1[N*k+i];
+                    step_bits[N*DW + DW*i +: DW] = second ? b2[N*k+i] : b1[N*k+i];
+                end
+                for (w = 0; w < STEP_WORDS; w = w + 1) put_word(base + STEP_WORDS*k + w, step_bits[64*w +: 64]);
+            end
+        end
+    endtask
+
+    task run_job;
+        input integer base;
+        input integer nk;
+        input         clr;
+        input         st;
+        input integer gnt_every;   // 0: always granted, else one clock in gnt_every not
+        begin
+            @(negedge clk);
+            base_in = base;
+            steps   = nk;
+            clear   = clr;
+            store   = st;
+            start   = 1;
+            @(negedge clk);
+            start = 0;
+            cyc   = 1;
+            n_gnt = 0;
+            while (!sa_done) begin
+                gnt = gnt_every == 0 || ({$random} % gnt_every) != 0;
+                if (!gnt && sa_req) n_gnt = n_gnt + 1;
+                @(negedge clk);
+                cyc = cyc + 1;
+            end
+            gnt = 1;
+        end
+    endtask
+
+    task check_c;
+        input [8*16-1:0] name;
+        begin
+            for (w = 0; w < C_WORDS; w = w + 1) begin
+                get_word(C_BASE + w, c_word);
+                c_bits[64*w +: 64] = c_word;
+            end
+            for (i = 0; i < N*N; i = i + 1)
+                if (c_bits[ACC*i +: ACC] !== c_exp[i]) begin
+                    if (errors < 4)
+                        $display("FAIL: N=%0d int%0d %0s C[%0d][%0d] %h, expected %h", N, DW, name, i / N, i % N,
+                                 c_bits[ACC*i +: ACC], c_exp[i]);
+                    errors = errors + 1;
+                end
+        end
+    endtask
+
+    task report;
+        input [8*16-1:0] name;
+        input integer nk;
+        begin
+            macs = N * N * nk;
+            $display("N=%0d int%0d %0s: %0d MACs in %0d clocks, %0d.%0d MACs/clock, utilization %0d%% (port bound %0d%%), %0d clocks without port B",
+                     N, DW, name, macs, cyc, macs / cyc, (10 * macs / cyc) % 10, 100 * macs / (cyc * N * N),
+                     100 / STEP_READS, n_gnt);
+        end
+    endtask
+
+    // the packet datapath on port A while pa_on: every clock an access, a word written then read back
+    always @(negedge clk) begin
+        if (pa_on) begin
+            if (pa_ops % 2 == 1) begin
+                we_a = {(W/8){1'b0}};
+            end else begin
+                if (pa_ops > 0 && dout_a[63:0] !== pa_val) begin
+                    $display("FAIL: N=%0d int%0d port A read %h, expected %h", N, DW, dout_a[63:0], pa_val);
+                    errors = errors + 1;
+                end
+                pa_val = {$random, $random};
+                we_a   = 8'hFF;
+                addr_a = SCRATCH + (pa_ops / 2) % 128;
+                din_a  = pa_val;
+            end
+            pa_ops = pa_ops + 1;
+        end
+    end
+
+    initial begin
+        finished = 0;
+        errors = 0;
+        we_a = 0; addr_a = 0; din_a = 0;
+        gnt = 1; start = 0; clear = 0; store = 0; base_in = 0; steps = 0;
+        pa_on = 0; pa_ops = 0; pa_val = 0;
+        for (k = 0; k < N*K1; k = k + 1) begin
+            a1[k] = $signed(rnd(0));
+            b1[k] = $signed(rnd(0));
+        end
+        for (k = 0; k < N*K2; k = k + 1) begin
+            a2[k] = $signed(rnd(0));
+            b2[k] = $signed(rnd(0));
+        end
+        wait (go);
+        load_ops(OPS1, K1, 0);
+        load_ops(OPS2, K2, 1);
+
+        for (i = 0; i < N; i = i + 1)
+            for (j = 0; j < N; j = j + 1) begin
+                sum = 0;
+                for (k = 0; k < K1; k = k + 1) sum = sum + a1[N*k+i] * b1[N*k+j];
+                c_exp[N*i+j] = sum[ACC-1:0];
+            end
+        run_job(OPS1, K1, 1, 1, 0);
+        report("job 1", K1);
+        check_c("job 1");
+
+        @(negedge clk);
+        pa_on = 1;
+        run_job(OPS1, K1, 1, 0, 4);
+        report("job 2", K1);
+        for (i = 0; i < N; i = i + 1)
+            for (j = 0; j < N; j = j + 1) begin
+                sum = 0;
+                for (k = 0; k < K1; k = k + 1) sum = sum + a1[N*k+i] * b1[N*k+j];
+                for (k = 0; k < K2; k = k + 1) sum = sum + a2[N*k+i] * b2[N*k+j];
+                c_exp[N*i+j] = sum[ACC-1:0];
+            end
+        run_job(OPS2, K2, 0, 1, 0);
+        report("job 3", K2);
+        @(negedge clk);
+        pa_on = 0;
+        we_a  = 0;
+        $display("N=%0d int%0d port A: %0d accesses, one every clock of jobs 2 and 3", N, DW, pa_ops);
+        check_c("job 2+3");
+        finished = 1;
+    end
+endmodule
+
+module testbench();
+
+    localparam W = `UALINK_WIDTH;
+
+    reg clk, rst_n;
+    reg [4:0] go;
+    wire [4:0] finished;
+    wire [15:0] err0, err1, err2, err3, err4;
+    integer errors, cyc, i;
+
+    initial clk = 0;
+    always #5 clk = ~clk;
+
+    // each bench only clocked while it runs
+    sa_bench #(.N(4),  .DW(8),  .ACC(32), .W(W)) n4_int8   (.clk(clk & go[0] & ~finished[0]), .rst_n(rst_n), .go(go[0]), .finished(finished[0]), .errors(err0));
+    sa_bench #(.N(8),  .DW(8),  .ACC(32), .W(W)) n8_int8   (.clk(clk & go[1] & ~finished[1]), .rst_n(rst_n), .go(go[1]), .finished(finished[1]), .errors(err1));
+    sa_bench #(.N(16), .DW(8),  .ACC(32), .W(W)) n16_int8  (.clk(clk & go[2] & ~finished[2]), .rst_n(rst_n), .go(go[2]), .finished(finished[2]), .errors(err2));
+    sa_bench #(.N(8),  .DW(16), .ACC(64), .W(W)) n8_int16  (.clk(clk & go[3] & ~finished[3]), .rst_n(rst_n), .go(go[3]), .finished(finished[3]), .errors(err3));
+    sa_bench #(.N(16), .DW(16), .ACC(64), .W(W)) n16_int16 (.clk(clk & go[4] & ~finished[4]), .rst_n(rst_n), .go(go[4]), .finished(finished[4]), .errors(err4));
+
+    // ------------- the units there are today, on a 64-bit memory -------------
+    reg  [7:0]  fma_a, fma_b, fma_c;
+    reg         start_fma, fma_acc;
+    wire        done_fma, fma_req, fma_we;
+    wire [7:0]  fma_addr;
+    wire [63:0] fma_din;
+    reg  [7:0]  tb_addr;
+    reg         tb_port;          // the memory's port B is the testbench's, not the FMA's
+    reg  [7:0]  ref_we;
+    reg  [63:0] ref_din;
+    wire [63:0] ref_dout_a, ref_dout_b;
+
+    dual_port_ram_banked #(.DPADDR_WIDTH(8), .DPDATA_WIDTH(64), .BANKS(1)) ref_ram (
+        .axi_aclk(clk), .axi_resetn(rst_n),
+        .we_a(ref_we), .addr_a(tb_addr), .din_a(ref_din), .dout_a(ref_dout_a),
+        .we_b({8{fma_we & ~tb_port}}), .addr_b(tb_port ? tb_addr : fma_addr), .din_b(fma_din), .dout_b(ref_dout_b)
+    );
+
+    matrix_fma_8x8 fma (
+        .clk(clk), .rst_n(rst_n),
+        .start_fma(start_fma), .addr_a_base(fma_a), .addr_base(fma_b), .addr_c_base(fma_c),
+        .accumulate(fma_acc), .done_fma(done_fma),
+        .mem_req(fma_req), .mem_gnt(~tb_port), .addr_b(fma_addr), .dout_b(ref_dout_b), .din_b(fma_din), .we_b(fma_we)
+    );
+
+    reg         start_mac;
+    reg  [63:0] mac_a;
+    wire [31:0] mac_result;
+    reg  [31:0] mac_exp;
+    wire        mac_done;
+    wire [7:0]  mac_addrb;
+    wire        mac_enb;
+
+    mac_unit mac (
+        .clk(clk), .rst(~rst_n), .start_mac(start_mac), .addrb(mac_addrb), .enb(mac_enb),
+        .doutb_a(mac_a), .doutb_b(ref_dout_b), .mac_result(mac_result), .status_done(mac_done)
+    );
+
+    task ref_fma;
+        input acc;
+        begin
+            @(negedge clk);
+            tb_port = 0;
+            fma_a = 8'h00; fma_b = 8'h08; fma_c = 8'h40; fma_acc = acc;
+            start_fma = 1;
+            @(negedge clk);
+            start_fma = 0;
+            cyc = 1;
+            while (!done_fma) begin
+                @(negedge clk);
+                cyc = cyc + 1;
+            end
+            $display("matrix_fma_8x8 %0s: 512 MACs in %0d clocks, %0d.%0d MACs/clock, utilization %0d%% of its 64 multipliers",
+                     acc ? "C += A x B" : "C = A x B", cyc, 512 / cyc, (5120 / cyc) % 10, 51200 / (cyc * 64));
+        end
+    endtask
+
+    initial begin
+        errors = 0;
+        go = 0;
+        rst_n = 0;
+        start_fma = 0; fma_acc = 0; fma_a = 0; fma_b = 0; fma_c = 0;
+        start_mac = 0; mac_a = 0;
+        tb_port = 1; tb_addr = 0; ref_we = 0; ref_din = 0;
+        repeat (4) @(negedge clk);
+        rst_n = 1;
+
+        for (i = 0; i < 5; i = i + 1) begin
+            $display("\n=== systolic_array %0d of 5, port B %0d bits ===", i + 1, W);
+            @(negedge clk);
+            go[i] = 1;
+            wait (finished[i]);
+        end
+
+        $display("\n=== the units there are today ===");
+        // A and B tiles for the FMA, words 0-15
+        for (i = 0; i < 16; i = i + 1) begin
+            @(negedge clk);
+            tb_addr = i; ref_din = {$random, $random}; ref_we = 8'hFF;
+        end
+        @(negedge clk);
+        ref_we = 0;
+        ref_fma(0);
+        ref_fma(1);
+
+        // mac_unit: the a word then the b word from the port, a mac4 on them, 8 times
+        // reads back to back, a mac4 every other clock
+        tb_port = 1;
+        cyc = 0;
+        @(negedge clk);
+        tb_addr = 0;
+        for (i = 0; i <= 8; i = i + 1) begin
+            @(negedge clk);
+            start_mac = 0;
+            if (i > 0 && (!mac_done || mac_result !== mac_exp)) begin
+                $display("FAIL: mac_unit result %h, expected %h", mac_result, mac_exp);
+                errors = errors + 1;
+            end
+            if (i < 8) begin
+                mac_a   = ref_dout_b;
+                tb_addr = 2 * i + 1;
+                @(negedge clk);
+                tb_addr   = 2 * i + 2;
+                start_mac = 1;
+                mac_exp   = {16'd0, mac_a[15:0]}  * ref_dout_b[15:0]  + {16'd0, mac_a[31:16]} * ref_dout_b[31:16] +
+                            {16'd0, mac_a[47:32]} * ref_dout_b[47:32] + {16'd0, mac_a[63:48]} * ref_dout_b[63:48];
+                cyc = cyc + 2;
+            end
+        end
+        $display("mac_unit: 32 MACs in %0d clocks, %0d.%0d MACs/clock, utilization %0d%% of its 4 multipliers",
+                 cyc, 32 / cyc, (320 / cyc) % 10, 3200 / (cyc * 4));
+
+        errors = errors + err0 + err1 + err2 + err3 + err4;
+        $display("\n========================================");
+        if (errors == 0)
+            $display("systolic array tests PASSED");
+        else
+            $display("systolic array tests FAILED: %0d errors", errors);
+        $display("========================================");
+        $finish;
+    end
+
+endmodule
@@ -0,0 +1,381 @@
+/***Steen Larsen with AI assistance
+  The intent of this testbench is to measure how close the UALink op parser of ualink_turbo64 gets to
+one beat per clock when requests arrive back to back on port 0.
+
+Port 0 streams min-size UALink requests with no gap between frames: 12 word IPv4 frames whose TOS byte
+(word 1) is the op, word 3 holds the DPMEM word address in its top byte and words 4-11 are the 64B of
+data.  A WRITE stores its data words, a READ leaves with its data words replaced by the memory contents.
+tuser carries the request number.
+
+The output monitor checks every word of every frame against a model of the memory, updated by the
+WRITEs in output order, and counts the cycles from the first beat out to the last one.  The datapath
+is UALINK_WIDTH bits wide (64, 256 or 512, default 64, iverilog -DUALINK_WIDTH=256), UALINK_WIDTH/64
+words per beat, so the theoretical maximum is 1 beat per clock (1 request every 12 clocks at 64 bits,
+every 3 at 256, every 2 at 512); with m_axis_tready held high the achieved rate has to be exactly that.
+
+Phase 1: 32 WRITEs fill the memory, then 10000 back to back requests, random op and address.
+Phase 2: 1000 more with random backpressure on m_axis, every cycle with tready high has to move a beat.
+
+ to run in Icarus simulator use:
+iverilog -o ualink_throughput_tb.vvp .\ualink_throughput_tb.v ualink_turbo64.v .\fallthrough_small_fifo_v2.v .\small_fifo_v3.v .\ualink_dpmem.v .\ualink_fma.v .\ualink_systolic.v .\crc32gen.v .\kv_hash_index.v
+vvp ualink_throughput_tb.vvp
+gtkwave.exe .\ualink_throughput_tb.vcd
+
+ *
+ */
+
+`timescale 1 ns / 1ps
+`ifndef UALINK_WIDTH
+`define UALINK_WIDTH 64
+`endif
+module testbench();
+
+   // parameter CLK_PERIOD = 10; // 10ns = 100MHz
+    localparam W  = `UALINK_WIDTH;   // datapath width
+    localparam NW = W / 64;          // 64b words per beat
+
+    // bytes 26-29 of a UALink response (word 3) carry the port 0 credits: the beats freed, free running,
+    // then the DUT's IN_FIFO_DEPTH_BIT and BEAT_WORDS, taken from it here, ualink_credit_tb checks those
+    wire [15:0] cr_const = {in_arb.ua_cr_bits, in_arb.ua_cr_words};
+
+    function [63:0] with_credits;
+        input [63:0] sent;
+        input [63:0] got;
+        begin
+            with_credits = {sent[63:48], cr_const, got[31:16], sent[15:0]};
+        end
+    endfunction
+
+    reg clk, reset;
+    wire [4:0]  tready;
+    wire [W-1:0]   m_tdata;
+    wire [W/8-1:0] m_tstrb;
+    wire [127:0] m_tuser;
+    wire        m_tvalid, m_tlast;
+    reg         m_tready;
+
+    integer i, k;
+
+    localparam FLEN      = 12;         // words per request
+    localparam FBEATS    = (FLEN + NW - 1) / NW;
+    localparam NFILL     = 32;         // WRITEs covering the 256 word memory
+    localparam NREQ      = 10000;
+    localparam NBP       = 1000;
+    localparam UA_READ   = 8'h01;
+    localparam UA_WRITE  = 8'h02;
+
+    // ------------- port 0 source -------------
+    reg [31:0]  lfsr_src;
+    integer     src_todo;              // requests left to send
+    reg [31:0]  src_seq;               // request number
+    reg [7:0]   src_w;                 // beat of the frame on the bus
+    reg [7:0]   src_op;
+    reg [7:0]   src_addr;
+    reg         fill;                  // WRITEs to consecutive 8 word blocks
+    reg [W-1:0]   s_tdata;
+    reg [W/8-1:0] s_tstrb;
+    wire        s_tvalid = src_todo > 0;
+    wire        s_tlast  = src_w == FBEATS - 1;
+
+    // op and address of request seq: the fill writes block by block, then the lfsr picks
+    function [15:0] req_of;
+        input [31:0] seq;
+        input [31:0] rnd;
+        begin
+            if (fill) req_of = {UA_WRITE, seq[4:0], 3'b000};
+            else      req_of = {rnd[8] ? UA_READ : UA_WRITE, rnd[7:0]};
+        end
+    endfunction
+
+    // word w of request seq, byte 8w+l in [8l+7:8l]
+    function [63:0] frame_word;
+        input [31:0] seq;
+        input [7:0]  op;
+        input [7:0]  addr;
+        input [7:0]  w;
+        begin
+            if (w == 0)
+                frame_word = 64'h0002010000000002;                    // 02:00:00:00:00:01 from 02:00:..
+            else if (w == 1)
+                frame_word = {op, 8'h45, 8'h00, 8'h08, seq};          // IPv4, TOS = op
+            else if (w == 2)
+                frame_word = {32'h00114000, seq};
+            else if (w == 3)
+                frame_word = {addr, 56'h0};                            // DPMEM word address
+            else if (op == UA_WRITE)
+                frame_word = {seq, w, addr, 16'hDA7A};
+            else
+                frame_word = 64'hEEEEEEEEEEEEEEEE;                     // room for the read data
+        end
+    endfunction
+
+    // beat src_w, the words past the end of the frame are zero and not strobed
+    always @(*) begin
+        for (k = 0; k < NW; k = k + 1) begin
+            s_tdata[64*k +: 64] = (src_w * NW + k < FLEN) ? frame_word(src_seq, src_op, src_addr, src_w * NW + k) : 64'h0;
+            s_tstrb[8*k +: 8]   = (src_w * NW + k < FLEN) ? 8'hFF : 8'h00;
+        end
+    end
+
+    always @(posedge clk) begin
+        if (reset) begin
+            src_w <= 0;
+        end else if (s_tvalid && tready[0]) begin
+            src_w <= s_tlast ? 8'd0 : src_w + 8'd1;
+            if (s_tlast) begin
+                src_todo <= src_todo - 1;
+                src_seq  <= src_seq + 1;
+                lfsr_src <= {lfsr_src[30:0], lfsr_src[31] ^ lfsr_src[21] ^ lfsr_src[1] ^ lfsr_src[0]};
+                {src_op, src_addr} <= req_of(src_seq + 1, {lfsr_src[30:0], lfsr_src[31] ^ lfsr_src[21] ^ lfsr_src[1] ^ lfsr_src[0]});
+            end
+        end
+    end
+
+    // ------------- output monitor -------------
+    reg [63:0]  mem [0:255];           // DPMEM as the frames out so far left it
+    integer     cycle;
+    integer     errors;
+    integer     out_w;                 // next word of the current output frame
+    integer     kw;
+    reg [31:0]  out_seq;               // next request expected
+    reg [7:0]   out_op, out_addr;
+    reg [63:0]  exp, word;
+    integer     first_out, last_out, beats_out, frames_out, reads_out;
+    integer     ready_cycles, ready_span;  // cycles with m_axis_tready high from the first beat out (to the last)
+    integer     t_first_in;
+
+    always @(posedge clk) begin
+        if (reset) begin
+            cycle <= 0;
+            out_w = 0;
+        end else begin
+            cycle <= cycle + 1;
+            if (first_out >= 0 && m_tready) ready_cycles = ready_cycles + 1;
+            if (s_tvalid && tready[0] && t_first_in < 0) t_first_in = cycle;
+
+            if (m_tvalid && m_tready) begin
+                if (first_out < 0) begin
+                    first_out = cycle;
+                    ready_cycles = 1;
+                end
+                last_out = cycle;
+                ready_span = ready_cycles;
+                beats_out = beats_out + 1;
+                if (out_w == 0) begin
+                    if (m_tuser[31:0] != out_seq) begin
+                        errors = errors + 1;
+                        if (errors <= 10) $display("FAIL: request %0d out, expected %0d", m_tuser[31:0], out_seq);
+                        out_seq = m_tuser[31:0];
+                    end
+                end
+
+                for (kw = 0; kw < NW; kw = kw + 1) begin
+                    if (m_tstrb[8*kw +: 8] != 0) begin
+                        word = m_tdata[64*kw +: 64];
+                        if (out_w == 1) out_op = word[63:56];
+                        if (out_w == 3) out_addr = word[63:56];
+
+                        if (out_w < 4 || out_op == UA_WRITE)
+                            exp = frame_word(out_seq, out_op, out_addr, out_w);
+                        else
+                            exp = mem[(out_addr + out_w - 4) & 8'hFF];
+                        if (out_w == 3)
+                            exp = with_credits(exp, word);
+                        if (out_w >= 4 && out_op == UA_WRITE)
+                            mem[(out_addr + out_w - 4) & 8'hFF] = word;
+                        if (word !== exp || m_tuser[31:0] != out_seq) begin
+                            errors = errors + 1;
+                            if (errors <= 10) $display("FAIL: request %0d word %0d is %h, expected %h", out_seq, out_w, word, exp);
+                        end
+                        out_w = out_w + 1;
+                    end
+                end
+
+                if (m_tlast) begin
+                    if (out_w != FLEN) begin
+                        errors = errors + 1;
+                        if (errors <= 10) $display("FAIL: request %0d ended at word %0d", out_seq, out_w - 1);
+                    end
+                    if (out_op == UA_READ) reads_out = reads_out + 1;
+                    frames_out = frames_out + 1;
+                    out_seq = out_seq + 1;
+                    out_w = 0;
+                end
+            end
+        end
+    end
+
+    // random backpressure for phase 2
+    reg [15:0] lfsr;
+    reg        bp;
+    always @(posedge clk) begin
+        if (reset) lfsr <= 16'hACE1;
+        else       lfsr <= {lfsr[14:0], lfsr[15] ^ lfsr[13] ^ lfsr[12] ^ lfsr[10]};
+        m_tready <= bp ? lfsr[0] | lfsr[5] : 1'b1;
+    end
+
+    // ------------- phase helpers -------------
+
+    task phase_start;
+        begin
+            first_out = -1;
+            t_first_in = -1;
+            beats_out = 0;
+            frames_out = 0;
+            reads_out = 0;
+            ready_cycles = 0;
+        end
+    endtask
+
+    // send n requests back to back, wait for all of them to come out
+    task phase_run;
+        input integer n;
+        integer t0;
+        begin
+            @(posedge clk);
+            src_todo <= n;
+            t0 = cycle;
+            while (frames_out < n && cycle - t0 < n * FBEATS * 4 + 1000) @(posedge clk);
+            if (frames_out < n) begin
+                errors = errors + 1;
+                $display("FAIL: only %0d of %0d requests came out", frames_out, n);
+            end
+            repeat (10) @(posedge clk);
+        end
+    endtask
+
+    // achieved beats per cycle against the one beat per cycle the datapath can carry, in 1/1000
+    task report;
+        input [8*24-1:0] name;
+        input integer    max_cycles;      // cycles the output could have taken a beat in
+        integer span, rate, max_rate;
+        begin
+            span = last_out - first_out + 1;
+            rate = beats_out * 1000 / span;
+            $display("%0s: %0d requests (%0d READ), %0d beats of %0d bits in %0d cycles, first beat out %0d cycles after the first in",
+                     name, frames_out, reads_out, beats_out, W, span, first_out - t_first_in);
+            max_rate = max_cycles * 1000 / span;
+            $display("%0s: %0d.%0d%0d%0d beats/cycle, theoretical maximum %0d.%0d%0d%0d", name,
+                     rate / 1000, rate / 100 % 10, rate / 10 % 10, rate % 10,
+                     max_rate / 1000, max_rate / 100 % 10, max_rate / 10 % 10, max_rate % 10);
+            if (beats_out == max_cycles)
+               $display("PASS: %0s, no dead cycles", name);
+            else begin
+               errors = errors + 1;
+               $display("FAIL: %0s, %0d cycles without a beat out", name, max_cycles - beats_out);
+            end
+        end
+    endtask
+
+  initial begin
+      clk   = 1'b0;
+      errors = 0;
+      bp = 0;
+      fill = 1;
+      src_todo = 0;
+      src_seq = 0;
+      lfsr_src = 32'h1234ABCD;
+      {src_op, src_addr} = {UA_WRITE, 8'h00};
+      out_seq = 0;
+      out_op = 0;
+      out_addr = 0;
+      phase_start();
+
+      $display("[%t] : System Reset Asserted...", $realtime);
+      $dumpfile("ualink_throughput_tb.vcd");
+      $dumpvars(0, testbench);
+
+      reset = 1'b1;
+      for (i = 0; i < 2; i = i + 1) begin
+                 @(posedge clk);
+      end
+      $display("[%t] : System Reset De-asserted...", $realtime);
+      reset = 1'b0;
+      repeat (4) @(posedge clk);
+
+      $display("\n=== Fill: %0d WRITEs ===", NFILL);
+      phase_run(NFILL);
+      fill = 0;
+      @(posedge clk);
+      {src_op, src_addr} = req_of(src_seq, lfsr_src);
+
+      $display("\n=== Phase 1: %0d back to back requests ===", NREQ);
+      phase_start();
+      phase_run(NREQ);
+      report("back to back", last_out - first_out + 1);
+
+      $display("\n=== Phase 2: %0d requests, backpressure ===", NBP);
+      phase_start();
+      bp = 1;
+      phase_run(NBP);
+      bp = 0;
+      report("backpressure", ready_span);
+
+      $display("\n========================================");
+      if (errors == 0) $display("UALink throughput tests PASSED");
+      else             $display("UALink throughput tests: %0d FAIL", errors);
+      $display("All Tests Completed!");
+      $display("========================================");
+      #100  ;    $finish;       //end simulation
+  end
+
+  always #2.5  clk = ~clk;      // 200MHz
+
+  ualink_turbo64
+    #(.C_M_AXIS_DATA_WIDTH(W),
+      .C_S_AXIS_DATA_WIDTH(W),
+      .C_M_AXIS_TUSER_WIDTH(128),
+      .C_S_AXIS_TUSER_WIDTH(128)
+     ) in_arb
+    (
+    // Global Ports
+    .axi_aclk(clk),
+    .axi_resetn(~reset),
+
+    // Master Stream Ports
+    .m_axis_tdata(m_tdata),
+    .m_axis_tstrb(m_tstrb),
+    .m_axis_tuser(m_tuser),
+    .m_axis_tvalid(m_tvalid),
+    .m_axis_tready(m_tready),
+    .m_axis_tlast(m_tlast),
+
+    // Slave Stream Ports
+    .s_axis_tdata_0(s_tdata),
+    .s_axis_tuser_0({96'h0, src_seq}),
+    .s_axis_tstrb_0(s_tstrb),
+    .s_axis_tvalid_0(s_tvalid),
+    .s_axis_tready_0(tready[0]),
+    .s_axis_tlast_0(s_tlast),
+
+    .s_axis_tdata_1({W{1'b0}}),
+    .s_axis_tuser_1(128'h0),
+    .s_axis_tstrb_1({W/8{1'b1}}),
+    .s_axis_tvalid_1(1'b0),
+    .s_axis_tready_1(tready[1]),
+    .s_axis_tlast_1(1'b0),
+
+    .s_axis_tdata_2({W{1'b0}}),
+    .s_axis_tuser_2(128'h0),
+    .s_axis_tstrb_2({W/8{1'b1}}),
+    .s_axis_tvalid_2(1'b0),
+    .s_axis_tready_2(tready[2]),
+    .s_axis_tlast_2(1'b0),
+
+    .s_axis_tdata_3({W{1'b0}}),
+    .s_axis_tuser_3(128'h0),
+    .s_axis_tstrb_3({W/8{1'b1}}),
+    .s_axis_tvalid_3(1'b0),
+    .s_axis_tready_3(tready[3]),
+    .s_axis_tlast_3(1'b0),
+
+    .s_axis_tdata_4({W{1'b0}}),
+    .s_axis_tuser_4(128'h0),
+    .s_axis_tstrb_4({W/8{1'b1}}),
+    .s_axis_tvalid_4(1'b0),
+    .s_axis_tready_4(tready[4]),
+    .s_axis_tlast_4(1'b0)
+
+   );
+
+endmodule
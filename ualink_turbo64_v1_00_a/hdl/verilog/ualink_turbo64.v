@@ -22,11 +22,15 @@
 module ualink_turbo64
 #(
     // Master AXI Stream Data Width
-    parameter C_M_AXIS_DATA_WIDTH=64,  //256, for visibility
-    parameter C_S_AXIS_DATA_WIDTH=64, // 256,
+    parameter C_M_AXIS_DATA_WIDTH=64,  // 64, 256 or 512, the same on all ports
+    parameter C_S_AXIS_DATA_WIDTH=64,
     parameter C_M_AXIS_TUSER_WIDTH=32, //128,
     parameter C_S_AXIS_TUSER_WIDTH=32, //128,
     parameter NUM_QUEUES=5,
+    parameter C_ARB_MODE = 1,              // input arbiter: 0 round robin, 1 strict priority, 2 weighted round robin
+    parameter C_ARB_WEIGHTS = 20'h11111,   // WRR frames per turn, 4 bits per queue, queue 0 in [3:0]
+    parameter C_ARB_CLASS = 15'h0000,      // traffic class of untagged frames, 3 bits per queue
+    parameter C_KV_UDP_PORT = 16'd11211,   // UDP port the memcached engine answers, other UDP passes through
     parameter DPADDR_WIDTH = 8,
     parameter DPDATA_WIDTH = 64,
     parameter DPDEPTH = (1 << DPADDR_WIDTH)
@@ -108,18 +112,23 @@ module ualink_turbo64
 
    parameter NUM_QUEUES_WIDTH = log2(NUM_QUEUES);
 
-   parameter NUM_STATES = 7;
+   parameter NUM_STATES = 8;
    parameter IDLE = 0;
    parameter PKT_PROC = 1;
-   parameter READ_OP =2;
-   parameter WRITE_OP =3;
-   parameter START_MAC = 4;
-   parameter KV_SET = 5;
-   parameter KV_GET = 6;
+   parameter KV_RSP = 5;
+   parameter KV_DRAIN = 6;
+   parameter KV_WAIT = 7;
 
    localparam MAX_PKT_SIZE = 2000; // In bytes
    localparam IN_FIFO_DEPTH_BIT = log2(MAX_PKT_SIZE/(C_M_AXIS_DATA_WIDTH / 8));
 
+   // Datapath width.  Frame byte p is in beat p/BEAT_BYTES, lane p%BEAT_BYTES (bits [8l+7:8l]), so at
+   // 64 bits byte 8w+l is in word w lane l.  Header fields are picked up at their byte offset in
+   // whichever beat that is (kv_hv below), and DPMEM has a bank per 64-bit word of the beat.
+   localparam BEAT_BYTES = C_S_AXIS_DATA_WIDTH / 8;
+   localparam BEAT_WORDS = C_S_AXIS_DATA_WIDTH / DPDATA_WIDTH;
+   localparam LANE_BITS  = log2(BEAT_BYTES);
+
    // ------------- Regs/ wires -----------
 
    wire [NUM_QUEUES-1:0]               nearly_full;
@@ -129,6 +138,7 @@ module ualink_turbo64
    wire [C_M_AXIS_TUSER_WIDTH-1:0]             in_tuser      [NUM_QUEUES-1:0];
    wire [NUM_QUEUES-1:0] 	       in_tvalid;
    wire [NUM_QUEUES-1:0]               in_tlast;
+   wire [NUM_QUEUES-1:0]               in_wr;        // beat written into the input FIFO
    wire [C_M_AXIS_TUSER_WIDTH-1:0]             fifo_out_tuser[NUM_QUEUES-1:0];
    wire [C_M_AXIS_DATA_WIDTH-1:0]        fifo_out_tdata[NUM_QUEUES-1:0];
    wire [((C_M_AXIS_DATA_WIDTH/8))-1:0]  fifo_out_tstrb[NUM_QUEUES-1:0];
@@ -137,46 +147,381 @@ module ualink_turbo64
    wire                                fifo_tlast;
    reg [NUM_QUEUES-1:0]                rd_en;
 
-   wire [NUM_QUEUES_WIDTH-1:0]         cur_queue_plus1;
    reg [NUM_QUEUES_WIDTH-1:0]          cur_queue;
    reg [NUM_QUEUES_WIDTH-1:0]          cur_queue_next;
 
    reg [NUM_STATES-1:0]                state, state_next;
-   reg start_mac, start_mac_next;
-   reg start_fma, start_fma_next;
-   reg [3:0] write_cnt = 4'h0, write_cnt_next = 4'h0; // needs to count to 9 (0–8)
-   reg [3:0] read_cnt = 4'h0, read_cnt_next = 4'h0;   // needs to count to 11 (0–10)
+
+   // input arbiter, see the arbitration block below
+   localparam ARB_RR        = 2'd0;
+   localparam ARB_STRICT    = 2'd1;
+   localparam ARB_WRR       = 2'd2;
+   // class table entries per queue, more than the frames of 60B and up a FIFO can hold
+   localparam CLS_SEQ_BITS  = log2((1 << IN_FIFO_DEPTH_BIT) / ((60 + BEAT_BYTES - 1) / BEAT_BYTES)) + 1;
+
+   integer                             arb_k, arb_pos, arb_r;
+   reg [1:0]                           arb_mode;
+   reg [3:0]                           arb_weight [NUM_QUEUES-1:0];   // 1..15
+   reg [2:0]                           arb_class  [NUM_QUEUES-1:0];   // of untagged frames
+   reg [3:0]                           arb_credit [NUM_QUEUES-1:0];
+   reg [NUM_QUEUES_WIDTH-1:0]          arb_last;                      // queue granted last
+   reg                                 arb_cfg_frame;
+   reg                                 arb_lock;                      // frame offered in IDLE but not taken yet
+   wire [NUM_QUEUES-1:0]               arb_req;                       // head frame classified
+   wire [2:0]                          arb_head_cls [NUM_QUEUES-1:0];
+   wire [NUM_QUEUES-1:0]               arb_ok;
+   reg [NUM_QUEUES-1:0]                arb_cand;
+   reg [2:0]                           arb_top;
+   reg                                 arb_reload, arb_any;
+   reg [NUM_QUEUES_WIDTH-1:0]          arb_grant;
+   wire                                arb_take = (state == IDLE) & ((state_next != IDLE) | (|rd_en));   //one beat frames stay in IDLE
+   wire [NUM_QUEUES_WIDTH-1:0]         out_queue = (state == IDLE) ? arb_grant : cur_queue;
+   reg start_fma;
+   wire done_fma;
+   reg start_sys;
+   wire done_sys;
    reg [C_M_AXIS_DATA_WIDTH - 1:0] m_axis_tdata_reg      = "01234567"; //register to hold read response data
    reg [C_M_AXIS_DATA_WIDTH - 1:0] m_axis_tdata_reg_next = "01234567"; //register to hold read response data
-   reg [C_M_AXIS_DATA_WIDTH - 1:0] frame_h0d1_reg = "00000000000000000000000000000000"; //register to hold read response data
-   reg [C_M_AXIS_DATA_WIDTH - 1:0] frame_h0d2_reg = "00000000000000000000000000000000"; //register to hold read response data
-   reg [C_M_AXIS_DATA_WIDTH - 1:0] frame_h0d3_reg = "00000000000000000000000000000000"; //register to hold read response data
-   reg [C_M_AXIS_DATA_WIDTH - 1:0] frame_h0d4_reg = "00000000000000000000000000000000"; //register to hold read response data
-reg [C_M_AXIS_DATA_WIDTH - 1:0] dmark = "DEADBEEFdeadbeefdeadbeefDEADBEEF"; //dummy marker    
 
-   reg [15:0] ualink_opcode; //opcode from command packet
+   // UALink ops on port 0, IPv4 frames whose TOS byte (byte 15, word 1) is the op.  Byte 31 (the top
+   // byte of word 3) is the DPMEM word address and words 4-11 are the 64B of data.  Both are done as
+   // the frame comes in, in stream order: a write stores the data words of a beat in the clock it
+   // arrives on s_axis_tdata_0, a read has them replaced by the memory contents on the way into the
+   // FIFO.  Neither costs a cycle of the stream.
+   // The atomics work on the one 64b word at the address: word 4 is the operand (addend, new value),
+   // word 5 the CAS compare value.  The word is read in the clock word 5 comes in, and written back
+   // in the next one while word 5 is replaced by the old value on its way into the FIFO, so the
+   // frame comes back with the old value in word 5.  TOS 0x04 is ARB_CFG, not a UALink op.
+   // GEMM (TOS 0x03) runs C = A x B (+ C) on 8x8 int8 tiles in DPMEM on the FMA engine
+   // (matrix_fma_8x8): byte 31 is the word address of C (32 words of int32), byte 32 of A and 33 of
+   // B (8 words each), byte 34 bit 0 accumulates onto C instead of overwriting it.  The job is queued
+   // as the frame comes in, the frame itself waits at the head of the port 0 FIFO until C is written
+   // and then goes back as the completion, byte 35 set to 1.  With GEMM_JOBS already queued the job
+   // is refused and the frame comes straight back with byte 35 0.
+   // GEMM with TOS bit 3 set (0x0B) is the same job on the systolic array (systolic_array, 8x8 int8,
+   // int32 accumulators): C += A x B over K steps of a panel, byte 32 the word address of the panel
+   // (2 words per step k: column k of A in the first, row k of B in the second, element i in byte i),
+   // byte 33 K, byte 31 C as above.  Byte 34 bit 0 keeps the array's accumulators from the job before
+   // instead of starting at 0, bit 1 leaves C unwritten for a job that goes on, so a long K is a few
+   // jobs and one store.  The jobs of both engines share the queue and run one at a time, in order.
+   // A READ/WRITE with TOS bit 3 set (0x09, 0x0A) is sized: bytes 17-19 carry req_len and req_attr at
+   // their offsets in the host's UALink header (ualink::calc_req_addr_attr), in place of the IPv4 total
+   // length and ID.  It covers req_len+1 words from word 4, the first word's bytes enabled by byte 19
+   // (first mask), the last one's by byte 18 (last mask), so an unaligned write leaves the other bytes
+   // of those words alone and a read returns only the requested bytes.
+   // An op frame may carry an 802.1Q tag (the host's traffic class): its IPv4 header, and so the TOS
+   // and bytes 17-19 above, is 4 bytes later, the op is known from byte 19.  Everything from byte 26
+   // on (credits, address, data, GEMM and ARB_CFG fields) stays at the same frame offset.
+   // Credits: every UALink op and COUNTERS frame goes back with the port 0 FIFO's credit state in bytes
+   // 26-29, the IPv4 source address (the header checksum is left as it was): bytes 26-27 the beats
+   // that have left the FIFO since reset, mod 2^16 and big endian, byte 28 BEAT_WORDS and byte 29
+   // IN_FIFO_DEPTH_BIT.  The FIFO takes (1 << IN_FIFO_DEPTH_BIT) - 2 beats before s_axis_tready_0
+   // drops and the MAC in front of it starts losing frames, so a sender that keeps the beats it has
+   // sent minus the beats freed within that never sees a drop.  The count is taken as the frame
+   // comes in, a later response carries a newer one.
+   localparam UA_NONE        = 3'd0;
+   localparam UA_READ        = 3'd1;   //TOS 0x01
+   localparam UA_WRITE       = 3'd2;   //TOS 0x02
+   localparam UA_GEMM        = 3'd3;   //TOS 0x03, 8x8 int8 GEMM tile on the FMA engine, 0x0B on the array
+   localparam UA_FADD        = 3'd5;   //TOS 0x05, fetch and add
+   localparam UA_SWAP        = 3'd6;   //TOS 0x06
+   localparam UA_CAS         = 3'd7;   //TOS 0x07, compare and swap
+   localparam UA_OP_BEAT     = 15 / BEAT_BYTES;
+   localparam UA_TOP_BEAT    = 19 / BEAT_BYTES;   // of a tagged frame
+   localparam UA_ADDR_BEAT   = 31 / BEAT_BYTES;
+   localparam UA_DATA_WORD   = 4;
+   localparam UA_DATA_WORDS  = 8;
+   localparam UA_CMP_WORD    = 5;      // last operand word of an atomic, carries the old value back
+   localparam UA_CR_BEAT     = 26 / BEAT_BYTES;
+   localparam UA_CR_LANE     = 26 % BEAT_BYTES;
+   reg [2:0]   ua_op;                    // op of the port 0 frame coming in, from byte 15
+   reg         ua_sized;                 // and its TOS bit 3
+   reg [DPADDR_WIDTH-1:0] ua_base;       // and its address, from byte 31
+   reg         ua_wb;                    // atomic write back in this clock
+   reg [2:0]   ua_wb_op;
+   reg [DPADDR_WIDTH-1:0] ua_wb_addr;
+   reg [DPADDR_WIDTH-1:0] ua_wb_lane;    // lane of dout_a with the old value
+   reg [DPDATA_WIDTH-1:0] ua_arg, ua_cmp;
+   reg [15:0]  ua_cr_freed;              // beats read out of the port 0 FIFO, mod 2^16
+   wire [7:0]  ua_cr_words = BEAT_WORDS;
+   wire [7:0]  ua_cr_bits  = IN_FIFO_DEPTH_BIT;
+   localparam GEMM_BEAT      = 35 / BEAT_BYTES;
+   localparam GEMM_JOBS      = 4;
+   reg [7:0]   gemm_a [0:GEMM_JOBS-1];   // queued jobs: A, B, C word addresses
+   reg [7:0]   gemm_b [0:GEMM_JOBS-1];
+   reg [7:0]   gemm_c [0:GEMM_JOBS-1];
+   reg         gemm_acc [0:GEMM_JOBS-1];
+   reg         gemm_sys [0:GEMM_JOBS-1]; // on the systolic array: A is the panel, B is K
+   reg         gemm_more [0:GEMM_JOBS-1];   // array job that leaves C unwritten
+   reg [7:0]   gemm_seq [0:GEMM_JOBS-1]; // kv_in_seq of the job's frame
+   reg [2:0]   gemm_wr, gemm_run, gemm_done, gemm_out;   // queued, started, C written, frame sent
+   reg [7:0]   fma_a, fma_b, fma_c;
+   reg         fma_acc;
+   wire        fma_req, fma_we;
+   wire [7:0]  fma_addr;
+   wire [63:0] fma_din;
+   reg  [7:0]  sys_panel, sys_k, sys_c;
+   reg         sys_clear, sys_store;
+   wire        sys_req, sys_busy;
+   wire [DPADDR_WIDTH-1:0] sys_addr;
+   wire [C_M_AXIS_DATA_WIDTH-1:0]   sys_din;
+   wire [C_M_AXIS_DATA_WIDTH/8-1:0] sys_we;
+
+   // performance counters, free running from reset and read with a COUNTERS frame on port 0 (IPv4,
+   // TOS 0x0C): its words 4 to 4+CTR_WORDS-1 come back with the counters in place, like a READ.
+   // 0x0C is DSCP 3 with ECN 0, a pool 2 code point (RFC 2474, experimental or local use) that
+   // ordinary traffic does not carry.
+   //   word 4      clock cycles
+   //   words 5-12  port 0 frames by TOS op (ctr_op_idx): other, READ, WRITE, GEMM, ARB_CFG, FADD, SWAP, CAS
+   //   word 13     cycles m_axis_tvalid waited on m_axis_tready
+   //   word 14     cycles the FMA engine or the array waited on DPMEM port B, the port they read and
+   //               write their tiles on, while the memcached path used it
+   //   word 15     cycles the FMA engine or the array was running, start to done
+   //   word 16     high water mark of each input FIFO in beats, 12 bits per queue, queue 0 in [11:0]
+   //   word 17     cycles a port 0 beat waited on s_axis_tready_0, the MAC in front drops frames then
+   localparam CTR_WORDS      = 14;
+   localparam CTR_HWM_BITS   = 12;
+   reg         ua_ctr;                   // the port 0 frame coming in is a COUNTERS read
+   reg [63:0]  ctr_cycles, ctr_stall, ctr_conflict, ctr_fma_busy, ctr_in_stall;
+   reg [64*8-1:0] ctr_ops;
+   reg         fma_run;
+   wire [CTR_HWM_BITS*NUM_QUEUES-1:0] ctr_hwm;
+   wire [64*CTR_WORDS-1:0] ctr_bank = {ctr_in_stall, {(64-CTR_HWM_BITS*NUM_QUEUES){1'b0}}, ctr_hwm,
+                                       ctr_fma_busy, ctr_conflict, ctr_stall, ctr_ops, ctr_cycles};
+
+   // memcached tracker on port 0 (binary and ASCII), see the always blocks below
+   localparam KV_SLOT_BITS   = DPADDR_WIDTH - 3;   // one 8 word (64B) value per slot
+   localparam KV_KEY_BYTES   = 16;                 // longest key the hash index holds
+   localparam KV_HDR_BYTES   = 96;                 // response bytes built ahead of the value, from the MAC header
+   localparam KV_NONE        = 3'd0;
+   localparam KV_BIN_SET     = 3'd1;
+   localparam KV_BIN_GET     = 3'd2;
+   localparam KV_ASC_SET     = 3'd3;
+   localparam KV_ASC_GET     = 3'd4;
+   // ASCII command line parse, one byte lane at a time
+   localparam KV_P_KEY       = 3'd0;
+   localparam KV_P_FLAGS     = 3'd1;
+   localparam KV_P_EXPTIME   = 3'd2;
+   localparam KV_P_BYTES     = 3'd3;
+   localparam KV_P_EOL       = 3'd4;
+   localparam KV_P_VALUE     = 3'd5;
+   localparam KV_P_DONE      = 3'd6;
+   // why a SET was not stored
+   localparam KV_ERR_NOMEM   = 1'b0;
+   localparam KV_ERR_TOO_BIG = 1'b1;
+   // beats of the header fields (IPv4 TOS, request start, BIN SET allocation, ARB_CFG payload)
+   localparam KV_IPHDR_BEAT  = 15 / BEAT_BYTES;
+   localparam KV_CMD_BEAT    = 55 / BEAT_BYTES;
+   localparam KV_ALLOC_BEAT  = 64 / BEAT_BYTES;
+   localparam ARB_CFG_BEAT   = (49 + NUM_QUEUES - 1) / BEAT_BYTES;
+   localparam KV_HV_BYTES    = 66;                 // header bytes the tracker reads, up to the opaque
+   integer kv_l, kv_j, kv_h;
+   wire        kv_beat = s_axis_tvalid_0 & s_axis_tready_0;
+   reg [7:0]   kv_fbeat;                 // beat index inside the current port 0 frame
+   reg [7:0]   kv_in_seq, kv_out_seq;    // frames seen on port 0 input / sent on the output
+   wire        kv_out_next;              // a port 0 frame is sent
+   reg [8*KV_HV_BYTES-1:0] kv_hb;        // header bytes of the frame coming in, byte p in [8p+7:8p]
+   reg [8*KV_HV_BYTES-1:0] kv_hv;        // the same with the bytes of the current beat taken from s_axis
+   reg [2:0]   kv_op;                    // op of the current input frame
+   reg         kv_busy;                  // an op is in flight, its response is not pending yet
+   reg [7:0]   kv_op_seq;
+   reg [8*KV_KEY_BYTES-1:0] kv_key;      // key byte i in [8i+7:8i], zero past kv_klen
+   reg [7:0]   kv_klen;                  // key bytes seen, saturates
+   reg [31:0]  kv_crc;
+   reg [2:0]   kv_pstate;
+   reg [11:0]  kv_num;                   // ASCII <bytes> field
+   reg [7:0]   kv_vbeat;                 // frame beat holding the first value byte
+   reg [LANE_BITS-1:0] kv_vlane;         // and its byte lane
+   reg         kv_vknown;                // kv_vbeat/kv_vlane/value length are valid
+   reg         kv_keydone;               // key complete, a GET has been looked up
+   reg [KV_SLOT_BITS-1:0] kv_slot;       // data slot the SET value streams into
+   reg         kv_have_slot;
+   reg [C_S_AXIS_DATA_WIDTH-1:0] kv_prev;   // previous beat, for realigning the value
+   reg         kv_tail;                  // value ends in the tlast beat, one more write
+   reg [2:0]   kv_tail_idx;
+   reg         kv_we;
+   reg [DPADDR_WIDTH-1:0] kv_waddr;
+   reg [C_S_AXIS_DATA_WIDTH-1:0] kv_wdata;   // a beat of value, BEAT_WORDS words from kv_waddr on
+   reg         kv_req;                   // hash index request, GET at key end, SET after tlast
+   reg         kv_fail;                  // SET refused without a lookup
+   reg         kv_fail_why;
+   reg [2:0]   kv_fin_op;                // op, request id and opaque of the request in flight
+   reg [15:0]  kv_fin_reqid, kv_fin_opaque_hi, kv_fin_opaque_lo;
+   reg [47:0]  kv_fin_mac_d, kv_fin_mac_s;
+   reg [31:0]  kv_fin_ip_s, kv_fin_ip_d;
+   reg [15:0]  kv_fin_port_s, kv_fin_port_d;
+   reg [6:0]   kv_fin_vlen;
+   // request fields, read at their byte offset whatever the beat width (kv_hv), in wire byte order
+   wire [47:0] kv_mac_d     = kv_hv[8*0  +: 48];
+   wire [47:0] kv_mac_s     = kv_hv[8*6  +: 48];
+   wire [31:0] kv_ip_s      = kv_hv[8*26 +: 32];
+   wire [31:0] kv_ip_d      = kv_hv[8*30 +: 32];
+   wire [15:0] kv_port_s    = kv_hv[8*34 +: 16];
+   wire [15:0] kv_port_d    = kv_hv[8*36 +: 16];
+   wire [15:0] kv_reqid     = kv_hv[8*42 +: 16];
+   wire [15:0] kv_opaque_hi = kv_hv[8*62 +: 16];
+   wire [15:0] kv_opaque_lo = kv_hv[8*64 +: 16];
+   wire [15:0] kv_keylen    = {kv_hv[8*52 +: 8], kv_hv[8*53 +: 8]};   //binary keylen field, big endian
+   wire [31:0] kv_bodylen   = {kv_hv[8*58 +: 8], kv_hv[8*59 +: 8], kv_hv[8*60 +: 8], kv_hv[8*61 +: 8]};
+   wire        kv_is_ip     = kv_hv[8*12 +: 24] == 24'h450008;        //IPv4, IHL 5
+   wire        kv_is_udp    = kv_is_ip & (kv_hv[8*23 +: 8] == 8'h11) &
+                              ({kv_port_d[7:0], kv_port_d[15:8]} == C_KV_UDP_PORT);   //to memcached only
+
+   reg [2:0]   kv_scan_op;
+   wire [31:0] kv_vlen = (kv_scan_op == KV_ASC_SET) ? {20'h0, kv_num} : kv_bodylen - 32'd8 - {16'h0, kv_keylen};
+   wire        kv_too_big = kv_vlen > 32'd64;
+   wire [6:0]  kv_vlen_up = kv_vlen[6:0] + BEAT_BYTES - 1;
+   wire [3:0]  kv_nwords = kv_too_big ? 4'd0 : kv_vlen_up >> LANE_BITS;   //beats of value
+   wire [7:0]  kv_k = kv_fbeat - kv_vbeat;
+   wire [2*C_S_AXIS_DATA_WIDTH-1:0] kv_cat = {s_axis_tdata_0, kv_prev} >> {kv_vlane, 3'b000};
+   wire [2*C_S_AXIS_DATA_WIDTH-1:0] kv_tail_cat = {{C_S_AXIS_DATA_WIDTH{1'b0}}, kv_prev} >> {kv_vlane, 3'b000};
+   wire [7+LANE_BITS:0] kv_bin_vpos = 11'd82 + kv_keylen[10:0];
+   wire        kv_bin_cmd = kv_is_udp && kv_hv[8*48 +: 24] == 24'h800000 && kv_hv[8*55 +: 8] == 8'h00 &&
+                            kv_keylen != 16'h0 && kv_keylen <= 16'd250;
+   wire        kv_bin_set = kv_bin_cmd && kv_hv[8*51 +: 8] == 8'h01 && kv_hv[8*54 +: 8] == 8'h08;
+   wire        kv_bin_get = kv_bin_cmd && kv_hv[8*51 +: 8] == 8'h00 && kv_hv[8*54 +: 8] == 8'h00;
+   wire        kv_asc_get = kv_is_udp && kv_hv[8*48 +: 48] == 48'h207465670000;   //"get " at byte 50
+   wire        kv_asc_set = kv_is_udp && kv_hv[8*48 +: 48] == 48'h207465730000;   //"set "
+
+   // lane scan of the current beat: key bytes, ASCII fields, value start
+   reg [8*KV_KEY_BYTES-1:0] kv_key_nx;
+   reg [7:0]   kv_klen_nx;
+   reg [2:0]   kv_pstate_nx;
+   reg [11:0]  kv_num_nx;
+   reg [BEAT_BYTES-1:0] kv_kmask;        // lanes hashed this beat
+   reg         kv_kend;                  // last key byte is in this beat
+   reg         kv_lf;                    // ASCII command line ends in this beat
+   reg [7+LANE_BITS:0] kv_vpos;          // and the value starts at this frame byte
+   reg [7+LANE_BITS:0] kv_pos;
+   reg [7:0]   kv_byte;
+   wire [31:0] kv_crc_in = (kv_fbeat == KV_CMD_BEAT) ? 32'hFFFFFFFF : kv_crc;
+   wire [31:0] kv_crc_nx;
+
+   // hash index
+   // a SET gets a data slot once its value is known to fit: binary at byte 64 (bodylen is in),
+   // ASCII when the command line ends
+   wire        kv_alloc = kv_beat && ((kv_fbeat == KV_ALLOC_BEAT && kv_op == KV_BIN_SET && !kv_too_big &&
+                                       kv_keylen <= KV_KEY_BYTES) ||
+                                      (kv_lf && kv_scan_op == KV_ASC_SET && kv_num_nx <= 12'd64 &&
+                                       kv_klen_nx != 8'd0 && kv_klen_nx <= KV_KEY_BYTES));
+   wire        kv_alloc_ok;
+   wire [KV_SLOT_BITS-1:0] kv_alloc_slot;
+   wire        kv_idx_busy, kv_idx_valid, kv_idx_hit;
+   wire [KV_SLOT_BITS-1:0] kv_idx_slot;
+   wire [6:0]  kv_idx_vlen;
+   wire [8*KV_KEY_BYTES-1:0] kv_idx_key;
+   wire [7:0]  kv_idx_klen;
+
+   // pending response, latched so the next frame can be tracked meanwhile.  It goes out in place
+   // of the request frame it answers (kv_rsp_seq): KV_HDR_BYTES of header, the value read back
+   // from its slot, then a trailer, padded to the 60B minimum frame.
+   reg         kv_rsp_pending, kv_rsp_start;
+   reg [7:0]   kv_rsp_seq;
+   reg [8*KV_HDR_BYTES-1:0] kv_rsp_hdr;
+   reg [7:0]   kv_rsp_hlen;
+   reg [6:0]   kv_rsp_vlen;
+   reg [2:0]   kv_rsp_tlen;              // "\r\nEND\r\n" after an ASCII value
+   reg [KV_SLOT_BITS-1:0] kv_rsp_slot;
+   reg [5:0]   kv_cnt, kv_cnt_next;      // output beat, negative (kv_cnt[5]) while the value read is primed
+   reg [C_M_AXIS_TUSER_WIDTH-1:0] kv_rsp_tuser;   // the request's, so the response leaves by its port
+   reg [C_M_AXIS_DATA_WIDTH-1:0] kv_val_prev;
+   // a response beat moves on when it is taken, or unsent.  While m_axis_tready holds it the read
+   // address stays, and dout_b of the stalled beat is kept in kv_val_hold (kv_val_cur)
+   wire        kv_rsp_adv = kv_cnt[5] | m_axis_tready;
+   reg         kv_rsp_stall;
+   reg [C_M_AXIS_DATA_WIDTH-1:0] kv_val_hold;
+   wire [C_M_AXIS_DATA_WIDTH-1:0] kv_val_cur = kv_rsp_stall ? kv_val_hold : dout_b;
+   wire        kv_idle = ~kv_busy & ~kv_rsp_pending & (state != KV_RSP);   //previous response fully out
+   wire [7:0]  kv_rsp_total = kv_rsp_hlen + kv_rsp_vlen + kv_rsp_tlen;
+   wire [7:0]  kv_rsp_flen = (kv_rsp_total < 8'd60) ? 8'd60 : kv_rsp_total;
+   wire [7:0]  kv_rsp_end = kv_rsp_flen - 8'd1;
+   wire [5:0]  kv_rsp_last = kv_rsp_end >> LANE_BITS;
+   wire [BEAT_BYTES-1:0] kv_rsp_strb = {BEAT_BYTES{1'b1}} >> (BEAT_BYTES - 1 - kv_rsp_end % BEAT_BYTES);
+   wire [5:0]  kv_rsp_hword = kv_rsp_hlen >> LANE_BITS;
+   wire [6:0]  kv_rsp_shift = kv_rsp_hlen % BEAT_BYTES;
+   // value beat 0 is due on dout_b at output beat kv_rsp_hword, the read is issued two clocks
+   // ahead, so with a header of less than two beats the response starts a clock early, unsent
+   wire [5:0]  kv_rsp_cnt0 = (kv_rsp_hword >= 6'd2) ? 6'd0 : kv_rsp_hword - 6'd2;
+   reg [2*C_M_AXIS_DATA_WIDTH-1:0] kv_rsp_vcat;   // value bytes of that beat, realigned behind the header
+   reg [C_M_AXIS_DATA_WIDTH-1:0] kv_rsp_word;     // output beat kv_cnt+1
+   wire [5:0]  kv_rsp_beat = kv_cnt + 6'd1;
+   reg [7+LANE_BITS:0] kv_rsp_pos;
+
+   // DPMEM word address of beat row of a value slot
+   function [DPADDR_WIDTH-1:0] kv_slot_addr;
+      input [KV_SLOT_BITS-1:0] slot;
+      input [7:0]              row;
+      begin
+         kv_slot_addr = {slot, 3'b000} | ((row * BEAT_WORDS) & 7);
+      end
+   endfunction
+   // a port 0 frame that may be memcached (IPv4 with TOS 0, UALink ops use the TOS byte) waits at
+   // the FIFO head until the tracker has seen its request header (byte 55), a request is then
+   // drained instead of forwarded.  Anything else goes as soon as its TOS byte is in.
+   // A tagged frame may be a UALink op, it waits until its TOS byte (19) is in.
+   wire        kv_w1_plain = (kv_hv[8*12 +: 32] == 32'h00450008);
+   wire        kv_w1_tag = (kv_hv[8*12 +: 16] == 16'h0081);
+   reg         kv_plain_ip, kv_tag_ip;
+   wire        kv_head_known = (kv_in_seq != kv_out_seq) | (kv_fbeat > KV_CMD_BEAT) |
+                               (kv_fbeat == KV_IPHDR_BEAT & kv_beat & ~kv_w1_plain &
+                                (~kv_w1_tag | (UA_TOP_BEAT == KV_IPHDR_BEAT))) |
+                               (kv_fbeat > KV_IPHDR_BEAT & ~kv_plain_ip & ~kv_tag_ip) |
+                               (kv_tag_ip & ((kv_fbeat > UA_TOP_BEAT) | (kv_fbeat == UA_TOP_BEAT & kv_beat)));
+   wire        kv_head_op = (kv_busy & kv_op_seq == kv_out_seq) | (kv_rsp_pending & kv_rsp_seq == kv_out_seq);
+   wire        kv_hold = (state == IDLE) & arb_any & (arb_grant == 0) & kv_head_op;
+
+   // response header being built when the op finishes
+   reg [8*KV_HDR_BYTES-1:0] kv_hdr_nx;
+   reg [7:0]   kv_hlen_nx;
+   reg [2:0]   kv_tlen_nx;
+   reg [6:0]   kv_hdr_vlen;
+   reg [15:0]  kv_hdr_digits;
+   reg [1:0]   kv_hdr_ndig;
+   reg [7:0]   kv_hdr_line;
+   reg [31:0]  kv_hdr_bodylen;
+   reg [15:0]  kv_hdr_status;
+   reg [15:0]  kv_hdr_iplen, kv_hdr_udplen;
+   reg [31:0]  kv_hdr_sum;
+   reg [15:0]  kv_hdr_csum;
 
      //debug
   reg [19:0] ledcnt;
   reg [19:0] ledcnt1;
   reg     led_reg, led_clk;
   
-  	reg we_a, we_a_next;
-	reg [DPADDR_WIDTH-1:0]               addr_a_next = 64'h00, addr_a = 64'h00, addr_base;
-	reg [DPDATA_WIDTH-1:0]               din_a;
-	wire [DPDATA_WIDTH-1:0]               dout_a;
-	reg we_b;
-	reg [DPADDR_WIDTH-1:0]               addr_b;
-	reg [DPDATA_WIDTH-1:0]               din_b;
-	wire [DPDATA_WIDTH-1:0]               dout_b;
+   // DPMEM port A serves the UALink READ/WRITE data of the frames coming in on port 0, port B the
+   // memcached SET values coming in and the responses going out (never at the same time, one op is
+   // in flight), so the two ends of the stream never wait for each other.  A beat of BEAT_WORDS words
+   // goes in or out per clock from any word address.  The FMA engine reads and writes its tiles on
+   // port B (lane 0) in the clocks memcached leaves it, kv_port_b.
+	wire [BEAT_BYTES-1:0]                 we_a;
+	wire [DPADDR_WIDTH-1:0]               addr_a;
+	wire [C_S_AXIS_DATA_WIDTH-1:0]        din_a;
+	wire [C_S_AXIS_DATA_WIDTH-1:0]        dout_a;
+	reg [DPADDR_WIDTH-1:0]               addr_b_next = 0, addr_b = 0;
+	wire [C_M_AXIS_DATA_WIDTH-1:0]        dout_b;
+   wire                                 kv_port_b = kv_we | (state == KV_RSP);   // memcached has port B
+
+   // port 0 ingress register, a UALink READ beat picks up its data from dout_a here
+   reg                                 p0_valid;
+   reg [C_S_AXIS_DATA_WIDTH-1:0]       p0_tdata;
+   reg [((C_S_AXIS_DATA_WIDTH/8))-1:0] p0_tstrb;
+   reg [C_S_AXIS_TUSER_WIDTH-1:0]      p0_tuser;
+   reg                                 p0_tlast;
+   reg [BEAT_BYTES-1:0]                p0_rd;         // bytes of the beat read from DPMEM
+   reg [BEAT_WORDS-1:0]                p0_ctr;        // words of the beat replaced by counters
+   reg [10:0]                          p0_fword;      // frame word of lane 0
+   reg                                 p0_gemm, p0_gemm_ok;   // GEMM status byte in the beat, job queued
+   reg                                 p0_cr;         // credit bytes in the beat
+   reg [C_S_AXIS_DATA_WIDTH-1:0]       p0_data;
 
    // ------------ Module instantiations -------------
 
-   dual_port_ram_8x64    //for now a simple 8b addressable 64b wide dual port RAM
+   dual_port_ram_banked    //8b word addressable, BEAT_WORDS banks of 64b words
    #(
     .DPADDR_WIDTH(DPADDR_WIDTH),
     .DPDATA_WIDTH(DPDATA_WIDTH),
-    .DPDEPTH (DPDEPTH)
+    .BANKS(BEAT_WORDS)
    )
    dpmem_inst
    (
@@ -186,15 +531,54 @@ reg [C_M_AXIS_DATA_WIDTH - 1:0] dmark = "DEADBEEFdeadbeefdeadbeefDEADBEEF"; //du
     .addr_a(addr_a),
     .din_a(din_a),
     .dout_a(dout_a),
-    .we_b(we_b),  //this port accessed only by FMA/MAC engines
-    .addr_b(addr_b),
-    .din_b(din_b),
+    .we_b(kv_we ? {BEAT_BYTES{1'b1}} : (sys_req & ~kv_port_b) ? sys_we :
+          {{(BEAT_BYTES-8){1'b0}}, {8{fma_req & fma_we & ~kv_port_b}}}),
+    .addr_b(kv_we ? kv_waddr : (sys_req & ~kv_port_b) ? sys_addr : (fma_req & ~kv_port_b) ? fma_addr : addr_b),
+    .din_b(kv_we ? kv_wdata : sys_req ? sys_din : {{(C_M_AXIS_DATA_WIDTH-64){1'b0}}, fma_din}),
     .dout_b(dout_b)
    );
 
+   crc32_64bit_lut #(.BYTES(BEAT_BYTES)) kv_crc_inst   //hash of the key lanes in this beat, chained across beats
+   (
+    .data_in(s_axis_tdata_0),
+    .byte_en(kv_kmask),
+    .crc_in(kv_crc_in),
+    .crc_out(kv_crc_nx)
+   );
+
+   kv_hash_index
+   #(
+    .KEY_BYTES(KV_KEY_BYTES),
+    .SLOT_BITS(KV_SLOT_BITS),
+    .BUCKET_BITS(KV_SLOT_BITS - 2),
+    .WAY_BITS(2)
+   )
+   kv_idx
+   (
+    .clk(axi_aclk),
+    .resetn(axi_resetn),
+    .alloc(kv_alloc),
+    .alloc_ok(kv_alloc_ok),
+    .alloc_slot(kv_alloc_slot),
+    .req_valid(kv_req),
+    .req_set(kv_fin_op == KV_BIN_SET || kv_fin_op == KV_ASC_SET),
+    .req_key(kv_key),
+    .req_keylen(kv_klen),
+    .req_hash(~kv_crc),
+    .req_slot(kv_slot),
+    .req_vlen(kv_fin_vlen),
+    .busy(kv_idx_busy),
+    .rsp_valid(kv_idx_valid),
+    .rsp_hit(kv_idx_hit),
+    .rsp_slot(kv_idx_slot),
+    .rsp_vlen(kv_idx_vlen),
+    .rsp_key(kv_idx_key),
+    .rsp_keylen(kv_idx_klen)
+   );
+
 //With the idea there could be mutliple CIM engines at play, we need to use the context to trigger one of mulple engines
 //That requires a separate signal name for each engine.  
-//At this time scapy can trigger mac_start and SET trigger fma_start
+//At this time the GEMM op queues jobs for the FMA engine (TOS 0x03) and the systolic array (0x0B), see gemm_wr
 
 /*
  ualink_mac // instantiation
@@ -220,10 +604,47 @@ matrix_fma_8x8   // instantiation
 matrix_fma_8x8_inst
 (
    .clk(axi_aclk),
-   .rst_n(~axi_resetn),
+   .rst_n(axi_resetn),
    .start_fma(start_fma),
-   .addr_base(addr_base),
-      .done_fma(done_fma)  
+   .addr_a_base(fma_a),
+   .addr_base(fma_b),
+   .addr_c_base(fma_c),
+   .accumulate(fma_acc),
+   .done_fma(done_fma),
+   .mem_req(fma_req),
+   .mem_gnt(~kv_port_b),
+   .addr_b(fma_addr),
+   .dout_b(dout_b[63:0]),
+   .din_b(fma_din),
+   .we_b(fma_we)
+);
+
+systolic_array   // instantiation, one job at a time with the FMA engine, on the same port B handshake
+#(
+   .N(8),
+   .DATA_WIDTH(8),
+   .ACC_WIDTH(32),
+   .MEM_WIDTH(C_M_AXIS_DATA_WIDTH),
+   .ADDR_WIDTH(DPADDR_WIDTH)
+)
+systolic_inst
+(
+   .clk(axi_aclk),
+   .rst_n(axi_resetn),
+   .start(start_sys),
+   .base_in(sys_panel),
+   .steps(sys_k),
+   .base_out(sys_c),
+   .clear(sys_clear),
+   .store(sys_store),
+   .done(done_sys),
+   .busy(sys_busy),
+   .mem_req(sys_req),
+   .mem_gnt(~kv_port_b),
+   .addr_b(sys_addr),
+   .dout_b(dout_b),
+   .din_b(sys_din),
+   .we_b(sys_we)
 );
 
    generate
@@ -241,27 +662,274 @@ matrix_fma_8x8_inst
          .empty                          (empty[i]),
          // Inputs
          .din                            ({in_tlast[i], in_tuser[i], in_tstrb[i], in_tdata[i]}),
-         .wr_en                          (in_tvalid[i] & ~nearly_full[i]),
+         .wr_en                          (in_wr[i]),
          .rd_en                          (rd_en[i]),
          .reset                          (~axi_resetn),
          .clk                            (axi_aclk));
+
+      // traffic class of every frame in the FIFO, the 802.1Q PCP of a tagged frame or the queue's
+      // default.  Known once the beat with bytes 12-14 is in, the same clock the port 0 tracker can
+      // release a frame.
+      localparam CLS_BEAT = 14 / BEAT_BYTES;
+      localparam CLS_OFF  = 12 % BEAT_BYTES;
+      localparam CLS_DONE = CLS_BEAT + 1;
+      reg [2:0]  cls_tab [0:(1<<CLS_SEQ_BITS)-1];
+      reg [7:0]  cls_in_seq, cls_out_seq;
+      reg [1:0]  cls_wcnt;                 // beat of the frame coming in, saturates at CLS_DONE
+      reg [2:0]  cls_cur;                  // its class, from CLS_BEAT on
+      wire       cls_beat = in_wr[i];
+      wire       cls_w1   = cls_beat & (cls_wcnt == CLS_BEAT);
+      wire [2:0] cls_now  = (cls_wcnt == CLS_BEAT && in_tdata[i][8*CLS_OFF +: 16] == 16'h0081) ?
+                            in_tdata[i][8*CLS_OFF+21 +: 3] : arb_class[i];
+      wire       cls_full = cls_in_seq != cls_out_seq;   //a whole frame is queued, its class is in the table
+      reg [IN_FIFO_DEPTH_BIT:0] occ, occ_hwm;         //beats in the FIFO, and the most there have been
+      wire [IN_FIFO_DEPTH_BIT:0] occ_nx = occ + in_wr[i] - (rd_en[i] & ~empty[i]);
+
+      assign ctr_hwm[CTR_HWM_BITS*i +: CTR_HWM_BITS] = occ_hwm;
+
+      assign arb_head_cls[i] = cls_full ? cls_tab[cls_out_seq[CLS_SEQ_BITS-1:0]] : (cls_w1 ? cls_now : cls_cur);
+      assign arb_req[i]      = ~empty[i] & (cls_full | cls_w1 | (cls_wcnt == CLS_DONE));
+
+      always @(posedge axi_aclk) begin
+         if (~axi_resetn) begin
+            cls_in_seq  <= 0;
+            cls_out_seq <= 0;
+            cls_wcnt    <= 0;
+            occ         <= 0;
+            occ_hwm     <= 0;
+         end
+         else begin
+            occ <= occ_nx;
+            if (occ_nx > occ_hwm) occ_hwm <= occ_nx;
+            if (rd_en[i] & ~empty[i] & fifo_out_tlast[i]) cls_out_seq <= cls_out_seq + 8'd1;
+            if (cls_beat) begin
+               if (cls_wcnt != CLS_DONE) cls_cur <= cls_now;
+               cls_wcnt <= in_tlast[i] ? 2'd0 : (cls_wcnt == CLS_DONE ? cls_wcnt : cls_wcnt + 2'd1);
+               if (in_tlast[i]) begin
+                  cls_tab[cls_in_seq[CLS_SEQ_BITS-1:0]] <= (cls_wcnt == CLS_DONE) ? cls_cur : cls_now;
+                  cls_in_seq <= cls_in_seq + 8'd1;
+               end
+            end
+         end
+      end
    end
    endgenerate
 
    // ------------- Logic ------------
 
-   assign in_tdata[0]        = s_axis_tdata_0;
-   assign in_tstrb[0]        = s_axis_tstrb_0;
-   assign in_tuser[0]        = s_axis_tuser_0;
-   assign in_tvalid[0]       = s_axis_tvalid_0;
-   assign in_tlast[0]        = s_axis_tlast_0;
-   assign s_axis_tready_0    = !nearly_full[0];
+   // header view of the port 0 frame coming in: byte p is in beat p/BEAT_BYTES, from s_axis while
+   // that beat is on it and from kv_hb after
+   always @(*) begin
+      for (kv_h = 0; kv_h < KV_HV_BYTES; kv_h = kv_h + 1)
+         kv_hv[8*kv_h +: 8] = (kv_fbeat == kv_h / BEAT_BYTES) ? s_axis_tdata_0[8*(kv_h % BEAT_BYTES) +: 8]
+                                                              : kv_hb[8*kv_h +: 8];
+   end
+
+   // UALink ops: the op and address are picked up from bytes 15 and 31 as they arrive, possibly in
+   // the beat that already carries data words.  A WRITE's data words go to port A in the clock they
+   // arrive, a READ reads the words of the beat on s_axis in that clock, and they replace the beat's
+   // data words in the ingress register.  An atomic is a READ of word 5 whose lane reads the word at
+   // the address, then a write of the new value in the next clock, when port A is free: the rest of
+   // the frame has no data words for it, and a new frame that could (beat 0 holds data words) waits
+   // that one clock.
+   // A sized op's length and masks are read from the header view, bytes 17-19 are in before word 4.
+   // With an 802.1Q tag the IPv4 header starts at byte 18 instead of 14 (ua_ip), the ethertype inside
+   // the tag has to be IPv4.  An untagged frame is decoded from byte 14 whatever its ethertype, as ever.
+   wire        ua_tag = (kv_hv[8*12 +: 16] == 16'h0081);
+   wire [4:0]  ua_ip  = ua_tag ? 5'd18 : 5'd14;
+   wire        ua_op_beat = (kv_fbeat == (ua_tag ? UA_TOP_BEAT : UA_OP_BEAT));   //the TOS byte is in
+   wire [15:0] ua_w1  = (~ua_tag | kv_hv[8*16 +: 16] == 16'h0008) ?   //IPv4 in the tag
+                        kv_hv[8*ua_ip +: 16] : 16'd0;                 //{TOS, version/IHL}
+   wire        ua_rw  = (ua_w1[10:8] == UA_READ) | (ua_w1[10:8] == UA_WRITE);
+   wire        ua_b3  = ua_rw | (ua_w1[10:8] == UA_GEMM);             //ops with a TOS bit 3 form
+   wire [2:0]  ua_dec = (ua_w1[7:0] == 8'h45 && ua_w1[15:12] == 4'h0 &&
+                         (ua_w1[11] ? ua_b3 : ua_w1[10:8] != 3'd4)) ? ua_w1[10:8] : UA_NONE;
+   wire [2:0]  ua_op_now = ua_op_beat ? ua_dec : ua_op;
+   wire        ua_sized_now = ua_op_beat ? ua_w1[11] : ua_sized;
+   wire [7:0]  ua_len   = kv_hv[8*(ua_ip+3) +: 8];                 //req_len, words - 1
+   wire [7:0]  ua_lmask = kv_hv[8*(ua_ip+4) +: 8];                 //req_attr, big endian
+   wire [7:0]  ua_fmask = kv_hv[8*(ua_ip+5) +: 8];
+   wire [8:0]  ua_words = ua_sized_now ? ua_len + 9'd1 : UA_DATA_WORDS;
+   wire        ua_ctr_now = ua_op_beat ? (ua_w1 == 16'h0C45) : ua_ctr;
+   // counter of the frame's op, ARB_CFG (TOS 0x04) included, 0 for anything else
+   wire [2:0]  ctr_op_idx = (ua_w1[7:0] == 8'h45 && ua_w1[15:12] == 4'h0 && (~ua_w1[11] | ua_b3)) ? ua_w1[10:8] : 3'd0;
+   wire        ua_atomic = (ua_op_now == UA_FADD) | (ua_op_now == UA_SWAP) | (ua_op_now == UA_CAS);
+   wire [DPADDR_WIDTH-1:0] ua_base_now = (kv_fbeat == UA_ADDR_BEAT) ? kv_hv[8*31 +: 8] : ua_base;
+   wire        ua_wb_stall = ua_wb & (kv_fbeat == 0) & (BEAT_WORDS > UA_DATA_WORD);
+   reg  [BEAT_WORDS-1:0] ua_lanes;                                 //data words in the beat on s_axis
+   reg  [BEAT_BYTES-1:0] ua_bytes;                                 //and their enabled bytes
+   reg  [BEAT_WORDS-1:0] ua_ctr_lanes;                             //counter words of a COUNTERS read
+   reg  [DPDATA_WIDTH-1:0] ua_old, ua_new;
+   integer ua_j, ua_w, p0_j;
+
+   always @(*) begin
+      for (ua_j = 0; ua_j < BEAT_WORDS; ua_j = ua_j + 1) begin
+         ua_w = kv_fbeat * BEAT_WORDS + ua_j;                         //frame word of lane j
+         ua_lanes[ua_j] = ua_atomic ? (ua_w == UA_CMP_WORD) :
+                          (ua_op_now != UA_NONE) && (ua_w >= UA_DATA_WORD) && (ua_w < UA_DATA_WORD + ua_words);
+         ua_bytes[8*ua_j +: 8] = ~ua_lanes[ua_j] ? 8'h00 :
+                                 (ua_sized_now && ua_w == UA_DATA_WORD) ? ua_fmask :
+                                 (ua_sized_now && ua_w == UA_DATA_WORD + ua_len) ? ua_lmask : 8'hFF;
+         ua_ctr_lanes[ua_j] = ua_ctr_now && (ua_w >= UA_DATA_WORD) && (ua_w < UA_DATA_WORD + CTR_WORDS);
+      end
+   end
+
+   // the atomic's new value, from the old one read in the last clock
+   always @(*) begin
+      ua_old = dout_a[DPDATA_WIDTH*ua_wb_lane +: DPDATA_WIDTH];
+      case (ua_wb_op)
+         UA_FADD: ua_new = ua_old + ua_arg;
+         UA_SWAP: ua_new = ua_arg;
+         default: ua_new = (ua_old == ua_cmp) ? ua_arg : ua_old;   //UA_CAS
+      endcase
+   end
+
+   // lane j of port A is word addr_a+j, the data word of frame word fbeat*BEAT_WORDS+j (an atomic's
+   // word 5 lane is the word at the address), or the atomic write back in lane 0.  A write enable per byte.
+   assign we_a   = ua_wb ? {{(BEAT_BYTES-8){1'b0}}, 8'hFF} : ua_bytes & {BEAT_BYTES{kv_beat & (ua_op_now == UA_WRITE)}};
+   assign addr_a = ua_wb ? ua_wb_addr :
+                   ua_base_now + kv_fbeat * BEAT_WORDS - (ua_atomic ? UA_CMP_WORD : UA_DATA_WORD);
+   assign din_a  = ua_wb ? {{(C_S_AXIS_DATA_WIDTH-DPDATA_WIDTH){1'b0}}, ua_new} : s_axis_tdata_0;
+
+   always @(posedge axi_aclk) begin
+      if (~axi_resetn) begin
+         ua_op     <= UA_NONE;
+         ua_wb     <= 0;
+         p0_valid  <= 0;
+         ua_cr_freed <= 0;
+      end
+      else begin
+         if (rd_en[0] & ~empty[0]) ua_cr_freed <= ua_cr_freed + 16'd1;
+         if (kv_beat && ua_op_beat) begin
+            ua_op    <= ua_dec;
+            ua_sized <= ua_w1[11];
+            ua_ctr   <= ua_w1 == 16'h0C45;
+         end
+         if (kv_beat && kv_fbeat == UA_ADDR_BEAT) ua_base <= kv_hv[8*31 +: 8];
+         ua_wb <= kv_beat & ua_atomic & (|ua_lanes);
+         if (kv_beat && ua_atomic && (|ua_lanes)) begin
+            ua_wb_op   <= ua_op_now;
+            ua_wb_addr <= ua_base_now;
+            ua_wb_lane <= UA_CMP_WORD - kv_fbeat * BEAT_WORDS;
+            ua_arg     <= kv_hv[8*8*UA_DATA_WORD +: DPDATA_WIDTH];
+            ua_cmp     <= kv_hv[8*8*UA_CMP_WORD +: DPDATA_WIDTH];
+         end
+         p0_valid <= kv_beat;
+         if (kv_beat) begin
+            p0_tdata <= s_axis_tdata_0;
+            p0_tstrb <= s_axis_tstrb_0;
+            p0_tuser <= s_axis_tuser_0;
+            p0_tlast <= s_axis_tlast_0;
+            p0_rd    <= ua_bytes & {BEAT_BYTES{(ua_op_now == UA_READ) | ua_atomic}};
+            p0_ctr   <= ua_ctr_lanes;
+            p0_fword <= kv_fbeat * BEAT_WORDS;
+            p0_gemm  <= gemm_beat;
+            p0_gemm_ok <= ~gemm_full;
+            p0_cr    <= (kv_fbeat == UA_CR_BEAT) & ((ua_op_now != UA_NONE) | ua_ctr_now);
+         end
+      end
+   end
+
+   always @(*) begin
+      for (p0_j = 0; p0_j < BEAT_BYTES; p0_j = p0_j + 1)
+         p0_data[8*p0_j +: 8] = p0_rd[p0_j] ? dout_a[8*p0_j +: 8] : p0_tdata[8*p0_j +: 8];
+      for (p0_j = 0; p0_j < BEAT_WORDS; p0_j = p0_j + 1)
+         if (p0_ctr[p0_j]) p0_data[64*p0_j +: 64] = ctr_bank[64*(p0_fword + p0_j - UA_DATA_WORD) +: 64];
+      if (p0_gemm) p0_data[8*(35 % BEAT_BYTES) +: 8] = {7'd0, p0_gemm_ok};
+      if (p0_cr) p0_data[8*UA_CR_LANE +: 32] = {ua_cr_bits, ua_cr_words, ua_cr_freed[7:0], ua_cr_freed[15:8]};
+   end
+
+   // GEMM jobs, queued in order as their frames come in and run one at a time.  A job's frame is held
+   // at the head of the port 0 FIFO until its C is written: port 0 is only offered once the job of a
+   // GEMM frame coming in is queued (gemm_pre), and not while the head frame's job is unfinished.
+   wire        gemm_beat = kv_beat & (kv_fbeat == GEMM_BEAT) & (ua_op_now == UA_GEMM);
+   wire        gemm_full = (gemm_wr[1:0] == gemm_out[1:0]) & (gemm_wr[2] != gemm_out[2]);
+   wire        gemm_pre  = (kv_in_seq == kv_out_seq) & (ua_op_now == UA_GEMM) & (kv_fbeat <= GEMM_BEAT);
+   wire        gemm_hold = (gemm_out == gemm_done) & (gemm_out != gemm_wr) & (gemm_seq[gemm_out[1:0]] == kv_out_seq);
+   wire        gemm_sent = (gemm_out != gemm_wr) & (gemm_seq[gemm_out[1:0]] == kv_out_seq) & kv_out_next;
+
+   always @(posedge axi_aclk) begin
+      if (~axi_resetn) begin
+         gemm_wr   <= 0;
+         gemm_run  <= 0;
+         gemm_done <= 0;
+         gemm_out  <= 0;
+         start_fma <= 0;
+         start_sys <= 0;
+      end
+      else begin
+         if (gemm_beat && !gemm_full) begin
+            gemm_a[gemm_wr[1:0]]   <= kv_hv[8*32 +: 8];
+            gemm_b[gemm_wr[1:0]]   <= kv_hv[8*33 +: 8];
+            gemm_c[gemm_wr[1:0]]   <= ua_base_now;
+            gemm_acc[gemm_wr[1:0]] <= kv_hv[8*34];
+            gemm_sys[gemm_wr[1:0]] <= ua_sized_now;
+            gemm_more[gemm_wr[1:0]] <= kv_hv[8*34+1];
+            gemm_seq[gemm_wr[1:0]] <= kv_in_seq;
+            gemm_wr <= gemm_wr + 3'd1;
+         end
+         start_fma <= 0;
+         start_sys <= 0;
+         if (gemm_run != gemm_wr && !fma_run && !start_fma && !sys_busy && !start_sys) begin
+            start_fma <= ~gemm_sys[gemm_run[1:0]];
+            start_sys <= gemm_sys[gemm_run[1:0]];
+            fma_a     <= gemm_a[gemm_run[1:0]];
+            fma_b     <= gemm_b[gemm_run[1:0]];
+            fma_c     <= gemm_c[gemm_run[1:0]];
+            fma_acc   <= gemm_acc[gemm_run[1:0]];
+            sys_panel <= gemm_a[gemm_run[1:0]];
+            sys_k     <= gemm_b[gemm_run[1:0]];
+            sys_c     <= gemm_c[gemm_run[1:0]];
+            sys_clear <= ~gemm_acc[gemm_run[1:0]];
+            sys_store <= ~gemm_more[gemm_run[1:0]];
+            gemm_run  <= gemm_run + 3'd1;
+         end
+         if (done_fma | done_sys) gemm_done <= gemm_done + 3'd1;
+         if (gemm_sent) gemm_out <= gemm_out + 3'd1;
+      end
+   end
+
+   // performance counters.  The FMA engine is running from start_fma until done_fma, the array while
+   // sys_busy; they read and write their tiles on DPMEM port B then and wait while the memcached path
+   // writes SET values (kv_we) or reads GET values (KV_RSP) on the same port.
+   always @(posedge axi_aclk) begin
+      if (~axi_resetn) begin
+         ctr_cycles   <= 0;
+         ctr_ops      <= 0;
+         ctr_stall    <= 0;
+         ctr_conflict <= 0;
+         ctr_fma_busy <= 0;
+         ctr_in_stall <= 0;
+         fma_run      <= 0;
+      end
+      else begin
+         ctr_cycles <= ctr_cycles + 64'd1;
+         if (kv_beat && ua_op_beat)
+            ctr_ops[64*ctr_op_idx +: 64] <= ctr_ops[64*ctr_op_idx +: 64] + 64'd1;
+         if (m_axis_tvalid & ~m_axis_tready) ctr_stall <= ctr_stall + 64'd1;
+         if (s_axis_tvalid_0 & ~s_axis_tready_0) ctr_in_stall <= ctr_in_stall + 64'd1;
+         if (start_fma) fma_run <= 1;
+         else if (done_fma) fma_run <= 0;
+         if (fma_run | sys_busy) ctr_fma_busy <= ctr_fma_busy + 64'd1;
+         if ((fma_req | sys_req) & kv_port_b) ctr_conflict <= ctr_conflict + 64'd1;
+      end
+   end
+
+   // port 0 goes through the ingress register, it had room for the beat when s_axis took it
+   assign in_tdata[0]        = p0_data;   //UALink READ data words, atomic old value
+   assign in_tstrb[0]        = p0_tstrb;
+   assign in_tuser[0]        = p0_tuser;
+   assign in_tvalid[0]       = p0_valid;
+   assign in_tlast[0]        = p0_tlast;
+   assign in_wr[0]           = p0_valid;
+   assign s_axis_tready_0    = !nearly_full[0] & ~ua_wb_stall;
 
    assign in_tdata[1]        = s_axis_tdata_1;
    assign in_tstrb[1]        = s_axis_tstrb_1;
    assign in_tuser[1]        = s_axis_tuser_1;
    assign in_tvalid[1]       = s_axis_tvalid_1;
    assign in_tlast[1]        = s_axis_tlast_1;
+   assign in_wr[1]           = s_axis_tvalid_1 & ~nearly_full[1];
    assign s_axis_tready_1    = !nearly_full[1];
 
    assign in_tdata[2]        = s_axis_tdata_2;
@@ -269,6 +937,7 @@ matrix_fma_8x8_inst
    assign in_tuser[2]        = s_axis_tuser_2;
    assign in_tvalid[2]       = s_axis_tvalid_2;
    assign in_tlast[2]        = s_axis_tlast_2;
+   assign in_wr[2]           = s_axis_tvalid_2 & ~nearly_full[2];
    assign s_axis_tready_2    = !nearly_full[2];
 
    assign in_tdata[3]        = s_axis_tdata_3;
@@ -276,6 +945,7 @@ matrix_fma_8x8_inst
    assign in_tuser[3]        = s_axis_tuser_3;
    assign in_tvalid[3]       = s_axis_tvalid_3;
    assign in_tlast[3]        = s_axis_tlast_3;
+   assign in_wr[3]           = s_axis_tvalid_3 & ~nearly_full[3];
    assign s_axis_tready_3    = !nearly_full[3];
 
    assign in_tdata[4]        = s_axis_tdata_4;
@@ -283,239 +953,177 @@ matrix_fma_8x8_inst
    assign in_tuser[4]        = s_axis_tuser_4;
    assign in_tvalid[4]       = s_axis_tvalid_4;
    assign in_tlast[4]        = s_axis_tlast_4;
+   assign in_wr[4]           = s_axis_tvalid_4 & ~nearly_full[4];
    assign s_axis_tready_4    = !nearly_full[4];
 
-   assign cur_queue_plus1    = 0; //lock to port 0 (cur_queue == NUM_QUEUES-1) ? 0 : cur_queue + 1;
+   // Input arbiter.  Picks the queue IDLE serves in the same clock, so empty queues cost no cycles.
+   // Strict priority serves the highest traffic class first, weighted round robin lets a queue send
+   // arb_weight frames before the next one has its turn, and equals go round robin in every mode.
+   // Port 0 is only offered once the memcached tracker knows what its head frame is, and not while
+   // it is a GEMM frame waiting on its job.
+   assign arb_ok = arb_req & {{(NUM_QUEUES-1){1'b1}}, kv_head_known & ~gemm_pre & ~gemm_hold};
+
+   always @(*) begin
+      arb_top    = 0;
+      arb_reload = 1;   // no ready queue has credit left, every queue starts a new turn
+      for (arb_k = 0; arb_k < NUM_QUEUES; arb_k = arb_k + 1) begin
+         if (arb_ok[arb_k] && arb_head_cls[arb_k] > arb_top) arb_top = arb_head_cls[arb_k];
+         if (arb_ok[arb_k] && arb_credit[arb_k] != 0) arb_reload = 0;
+      end
+      for (arb_k = 0; arb_k < NUM_QUEUES; arb_k = arb_k + 1)
+         arb_cand[arb_k] = arb_ok[arb_k] && ((arb_mode == ARB_STRICT) ? (arb_head_cls[arb_k] == arb_top) :
+                                             (arb_mode == ARB_WRR)    ? (arb_credit[arb_k] != 0 || arb_reload) : 1'b1);
+      arb_any = |arb_cand;
+
+      // priority encoder starting after the last queue served (WRR: at it while its turn lasts)
+      arb_grant = arb_last;
+      for (arb_k = NUM_QUEUES-1; arb_k >= 0; arb_k = arb_k - 1) begin
+         arb_pos = arb_last + arb_k + ((arb_mode == ARB_WRR && arb_credit[arb_last] != 0) ? 0 : 1);
+         if (arb_pos >= NUM_QUEUES) arb_pos = arb_pos - NUM_QUEUES;
+         if (arb_cand[arb_pos]) arb_grant = arb_pos;
+      end
+
+      // AXI stream: a frame offered on m_axis stays offered until tready takes it
+      if (arb_lock) begin
+         arb_any   = 1;
+         arb_grant = cur_queue;
+      end
+   end
+
+   // arbiter registers, loaded from the parameters and rewritten by an ARB_CFG frame on port 0
+   // (IPv4 TOS 0x04 like the UALink ops).  UDP payload byte 6 (frame byte 48) is the mode, byte 7+q
+   // is {weight, 1'b0, class} of queue q.  The frame itself is forwarded as usual.
+   wire arb_cfg_now = ua_op_beat ? (ua_w1 == 16'h0445) : arb_cfg_frame;
+
+   always @(posedge axi_aclk) begin
+      if (~axi_resetn) begin
+         arb_mode      <= C_ARB_MODE;
+         arb_last      <= 0;
+         arb_cfg_frame <= 0;
+         arb_lock      <= 0;
+         for (arb_r = 0; arb_r < NUM_QUEUES; arb_r = arb_r + 1) begin
+            arb_weight[arb_r] <= ((C_ARB_WEIGHTS >> (4*arb_r)) & 4'hF) == 0 ? 4'd1 : (C_ARB_WEIGHTS >> (4*arb_r));
+            arb_class[arb_r]  <= C_ARB_CLASS >> (3*arb_r);
+            arb_credit[arb_r] <= 0;
+         end
+      end
+      else begin
+         arb_lock <= (state == IDLE) & m_axis_tvalid & ~m_axis_tready;
+         if (kv_beat && ua_op_beat) arb_cfg_frame <= arb_cfg_now;
+         if (kv_beat && kv_fbeat == ARB_CFG_BEAT && arb_cfg_now) begin
+            arb_mode <= kv_hv[8*48 +: 2];
+            for (arb_r = 0; arb_r < NUM_QUEUES; arb_r = arb_r + 1) begin
+               arb_weight[arb_r] <= (kv_hv[8*(49+arb_r)+4 +: 4] == 0) ? 4'd1 : kv_hv[8*(49+arb_r)+4 +: 4];
+               arb_class[arb_r]  <= kv_hv[8*(49+arb_r) +: 3];
+               arb_credit[arb_r] <= 0;   //new weights start a new turn
+            end
+         end
+         else if (arb_take) begin
+            arb_last <= arb_grant;
+            for (arb_r = 0; arb_r < NUM_QUEUES; arb_r = arb_r + 1)
+               if (arb_reload) arb_credit[arb_r] <= arb_weight[arb_r];
+            arb_credit[arb_grant] <= (arb_reload ? arb_weight[arb_grant] : arb_credit[arb_grant]) - 4'd1;
+         end
+      end
+   end
 
    //assign fifo_out_tuser_sel = fifo_out_tuser[cur_queue];
    //assign fifo_out_tdata_sel = fifo_out_tdata[cur_queue];
    //assign fifo_out_tlast_sel = fifo_out_tlast[cur_queue];
    //assign fifo_out_tstrb_sel = fifo_out_tstrb[cur_queue];
 
-   assign m_axis_tuser = fifo_out_tuser[cur_queue];
+   assign m_axis_tuser = (state == KV_RSP) ? {kv_rsp_tuser[C_M_AXIS_TUSER_WIDTH-1:16], 8'h00, kv_rsp_flen}  //length in [15:0]
+                                           : fifo_out_tuser[out_queue];
    
    //assign m_axis_tdata = fifo_out_tdata[cur_queue];
    //assign m_axis_tdata = (state != (READ_OPc2 || READ_OPc3)) ? fifo_out_tdata[cur_queue] : m_axis_tdata_reg;  //slam read data into output stream
-   assign m_axis_tdata = (state == (IDLE || PKT_PROC)) ?  fifo_out_tdata[cur_queue] : m_axis_tdata_reg;
+   assign m_axis_tdata = (state == KV_RSP) ? m_axis_tdata_reg : fifo_out_tdata[out_queue];
 	
-   assign m_axis_tlast = fifo_out_tlast[cur_queue];  //pulse last on read data cycle 
+   assign m_axis_tlast = (state == KV_RSP) ? (kv_cnt == kv_rsp_last) : fifo_out_tlast[out_queue];
    //assign m_axis_tlast = (state != READ_OPc3) ? fifo_out_tlast[cur_queue] : 1'b1;  //pulse last on read data cycle 
    
-   assign m_axis_tstrb = fifo_out_tstrb[cur_queue];
-   assign m_axis_tvalid = ~empty[cur_queue];
+   assign m_axis_tstrb = (state == KV_RSP) ? ((kv_cnt == kv_rsp_last) ? kv_rsp_strb : {BEAT_BYTES{1'b1}}) : fifo_out_tstrb[out_queue];
+   assign m_axis_tvalid = (state == KV_RSP & ~kv_cnt[5]) |
+                          ((state == IDLE) ? (arb_any & ~kv_hold) : (~empty[cur_queue] & (state != KV_DRAIN) & (state != KV_WAIT)));
    
-//Incoming UALink command parser state machine
-// H0 = 64bit Header word 0 = src MAC
-// H1 = op code field
-// H2 = misc ethernet fields
+//Output state machine.  Frames go out one beat per clock, back to back: IDLE offers beat 0 of the
+//frame the arbiter picked in the clock the previous tlast is taken.  The UALink ops are done on the
+//input side as the words arrive (ua_op above), atomics included, nothing here waits on them.
+// H0 = 64bit Header word 0 = dst/src MAC
+// H1 = op code field (IPv4 TOS)
+// H2 = misc ethernet fields, req_len and req_attr of the sized ops in bytes 17-19
 // H3 = addr field
-// D0-7 = data words for 64B write/read ops
+// D0-7 = data words for 64B write/read ops, req_len+1 of them for the sized ones
+// D0/D1 = operand and CAS compare value of the atomics, D1 returns the old value
 
    always @(*) begin  // combinational state machine
       state_next      = state;
       cur_queue_next  = cur_queue;
       rd_en           = 0;
-      we_a_next       = we_a;  
-      start_fma_next = 0;
+      addr_b_next     = addr_b;
+      kv_cnt_next     = kv_cnt;
+      m_axis_tdata_reg_next = m_axis_tdata_reg;
+      kv_rsp_start    = 0;
 
 
       case(state)
 
-        /* cycle between input queues until one is not empty */
+        /* serve the queue the arbiter picked, if any has a frame ready */
         IDLE: begin  
-		     //check if pkt available on currently selected queue
-           if(!empty[cur_queue]) begin
+           if(arb_any) begin
+              cur_queue_next = arb_grant;
+              // memcached request on port 0, its response goes out instead
+              if(kv_hold)
+                 state_next = KV_DRAIN;
 			     // check if pkt is on the AXIS 
-              if(m_axis_tready) begin
-                 state_next = PKT_PROC;
-                 rd_en[cur_queue] = 1;
+              else if(m_axis_tready) begin
+                 state_next = m_axis_tlast ? IDLE : PKT_PROC;   //a frame can be one beat on a wide datapath
+                 rd_en[arb_grant] = 1;
              end
            end
-           else begin
-              cur_queue_next = cur_queue_plus1;
-	      end //else
    	end //end idle state 0x00
 
-        /* wait until eop */
+        /* forward a word per clock until eop */
         PKT_PROC: begin
-           /* if this is the last word then write it and get out */
-           if(m_axis_tready & m_axis_tlast) begin
-              state_next = IDLE;
-	           rd_en[cur_queue] = 1;
-              cur_queue_next = cur_queue_plus1;
+           if(m_axis_tready & ~empty[cur_queue]) begin
+              rd_en[cur_queue] = 1;
+              if(m_axis_tlast)
+                 state_next = IDLE;
            end
-           /* otherwise read and write as usual */
-	   else if (m_axis_tready ) begin //  & !empty[cur_queue]) begin // relaxing term to enable we_a
-              rd_en[cur_queue] = 1;  //force response to port0
-                 ualink_opcode = m_axis_tdata[15:0];
-                 $display("UAlink write opcode %h", ualink_opcode);
-					//decode command    
-              if ((frame_h0d4_reg[63:48]) ==  16'h0245) begin  //write operation found in 2nd word
-               we_a_next = 0;
-		         state_next = WRITE_OP;
-		      end
-		  else if ((frame_h0d4_reg[63:48]) ==  16'h0145) begin  //read detected in 2nd word
-           state_next = READ_OP; // states 2,3,4,5,6,7,8,9
-  		    we_a_next = 0;
-	    	end //if
-		  else if ((frame_h0d4_reg[63:48]) ==  16'h0345) begin  //Kickstart MAC
-            state_next = START_MAC; 
-  		      start_mac_next = 1;
-	    	end //if
-         else if ((s_axis_tdata_0[63:16]) ==  48'h206120746573) begin  //Fix for UDP decode of memcached SET "set a " from saxis0
-            state_next = KV_SET; 
-            addr_base    = s_axis_tdata_0[47:40]; //Jan7 fix //grab key as address, single byte for now
-            we_a_next      = 0;  //dead cycle before writes can occur
-	    	end //if
-         else if ((s_axis_tdata_0[63:16]) ==  48'h0D6120746567) begin  //memcached "get a" from saxis0
-            addr_a_next    = s_axis_tdata_0[47:40]; //jan7 fix //grab key as address, single byte for now
-            m_axis_tdata_reg_next = 64'h650054DDCB2B0100; //responding UDP port
-
-            state_next = KV_GET; 
-	     	end //if		
-     
-      else begin  //fail read/write quals
-			    we_a_next = 0;
-	         	end  //read
-               end  //progress regular packet
-             end  //PKT_PROC state
-
-         KV_SET: begin  //KV_SET=5, get Key, hash on key for address, write value to address
-            // defaults
-            state_next     = KV_SET;
-            addr_a_next    = addr_a;
-            addr_base    = addr_a;
-            we_a_next      = 0;
-            din_a          = s_axis_tdata_0;
-            write_cnt_next = write_cnt;
-
-            if (write_cnt == 0) begin
-               addr_a_next    = addr_a; //address from hash of key 
-               din_a          = s_axis_tdata_0; //first data word
-               we_a_next      = 1;
-               write_cnt_next = write_cnt + 1;
-            end
-            else if (write_cnt < 8) begin
-               // middle data words
-               addr_a_next    = addr_a + 1;
-               we_a_next    = 1;
-               din_a          = s_axis_tdata_0;
-               write_cnt_next = write_cnt + 1;
-            end
-            else begin
-               // final word
-               addr_a_next    = addr_a;
-               din_a          = s_axis_tdata_0;
-               we_a_next      = 0;
-               write_cnt_next = 0;
-               start_fma_next = 1;
-               state_next     = PKT_PROC;
-            end
+        end  //PKT_PROC state
+
+         KV_DRAIN: begin  //KV_DRAIN=6, read the request frame out of the FIFO, it is not forwarded
+            state_next     = KV_DRAIN;
+            rd_en[cur_queue] = ~empty[cur_queue];
+            if (~empty[cur_queue] & fifo_out_tlast[cur_queue])
+               state_next  = KV_WAIT;
          end
-            
-
-
-          
-         KV_GET: begin  //KV_GET=6, read value from address, send back
-         // defaults
-            state_next     = KV_GET;
-            addr_a_next    = addr_a;
-            read_cnt_next = read_cnt;
-            if (read_cnt == 4'h0) begin
-               addr_a_next    = addr_a; //address from hash of key 
-               m_axis_tdata_reg_next = 64'h01000000341278FE;  //header info
-               read_cnt_next = read_cnt + 1;
-            end
-            
-            else if (read_cnt == 1) begin
-               addr_a_next    = addr_a; //address from hash of key 
-               m_axis_tdata_reg_next = 64'h2045554C41560000;  //value string
-               read_cnt_next = read_cnt + 1;
-            end
-            
-            else if (read_cnt == 2) begin
-               addr_a_next    = addr_a; //address from hash of key 
-               m_axis_tdata_reg_next = 64'h0A0D343620302061;  //length of GET
-               read_cnt_next = read_cnt + 1;
-            end
-            
-            else if ((read_cnt > 2) && (read_cnt < 4'hB)) begin
-               // middle data words
-               addr_a_next    = addr_a + 1;
-               m_axis_tdata_reg_next = dout_a;
-               read_cnt_next = read_cnt + 1;
-            end
-            else begin
-               // final word
-               addr_a_next    = addr_a;
-               m_axis_tdata_reg_next = 64'h0A0D444E450A0D;  //final word of GET
-               read_cnt_next = 0;
-               state_next     = PKT_PROC;
-            end    
-
-           
-            end  //KV_GET state
-
-         START_MAC: begin  //MAC process, for now assume one cycle
-              state_next = PKT_PROC;
-              start_mac_next = 0;
-			end
-
-         WRITE_OP: begin
-            // defaults
-            state_next     = WRITE_OP;
-            addr_a_next    = addr_a;
-            we_a_next      = 1;
-            din_a          = s_axis_tdata_0;
-            write_cnt_next = write_cnt;
-
-            if (write_cnt == 0) begin
-               // first cycle: grab address + write marker
-               addr_a_next    = s_axis_tdata_0[63:56];
-               din_a          = dmark;
-               write_cnt_next = write_cnt + 1;
-            end
-            else if (write_cnt < 8) begin
-               // middle data words
-               addr_a_next    = addr_a + 1;
-               din_a          = s_axis_tdata_0;
-               write_cnt_next = write_cnt + 1;
+
+         KV_WAIT: begin  //KV_WAIT=7, until the response to the drained request is built
+            state_next     = KV_WAIT;
+            if (kv_rsp_pending & (kv_rsp_seq == kv_out_seq)) begin
+               kv_rsp_start = 1;
+               kv_cnt_next = kv_rsp_cnt0;
+               addr_b_next = kv_slot_addr(kv_rsp_slot, kv_rsp_cnt0 + 6'd2 - kv_rsp_hword);  //value beat 0 is due on dout_b at output beat kv_rsp_hword
+               m_axis_tdata_reg_next = kv_rsp_hdr[C_M_AXIS_DATA_WIDTH-1:0];
+               state_next = KV_RSP;
             end
-            else begin
-               // final word
-               addr_a_next    = addr_a + 1;
-               din_a          = s_axis_tdata_0;
-               we_a_next      = 0;
-               write_cnt_next = 0;
-               state_next     = PKT_PROC;
+            else if (~(kv_busy & (kv_op_seq == kv_out_seq))) begin  //malformed, no answer
+               state_next = IDLE;
             end
          end
 
-         READ_OP: begin
-            // defaults
-            state_next                = READ_OP;
-            addr_a_next               = addr_a;
-            m_axis_tdata_reg_next     = m_axis_tdata_reg;
-            read_cnt_next             = read_cnt;
-
-            if (read_cnt == 0) begin
-               // first cycle: load base address
-               addr_a_next           = s_axis_tdata_0[63:56];
-               m_axis_tdata_reg_next = dout_a;
-               read_cnt_next         = read_cnt + 1;
-            end
-            else if (read_cnt < 10) begin
-               // middle reads
-               addr_a_next           = addr_a + 1;
-               m_axis_tdata_reg_next = dout_a;
-               read_cnt_next         = read_cnt + 1;
-            end
-            else begin
-               // final read
-               addr_a_next           = addr_a + 1;
-               m_axis_tdata_reg_next = dout_a;
-               read_cnt_next         = 0;
-               state_next            = PKT_PROC;
+         KV_RSP: begin  //KV_RSP=5, GET/SET response frame, beat kv_cnt is on the output, build kv_cnt+1
+            state_next     = KV_RSP;
+            if (kv_rsp_adv) begin
+               kv_cnt_next    = kv_cnt + 1;
+               addr_b_next    = kv_slot_addr(kv_rsp_slot, kv_cnt + 6'd3 - kv_rsp_hword);  //value beat kv_cnt+1-hword is on kv_val_cur
+               m_axis_tdata_reg_next = kv_rsp_word;
+               if (kv_cnt == kv_rsp_last) begin
+                  m_axis_tdata_reg_next = m_axis_tdata_reg;
+                  kv_cnt_next    = 0;
+                  state_next     = IDLE;
+               end
             end
          end
 
@@ -526,28 +1134,358 @@ matrix_fma_8x8_inst
       if(~axi_resetn) begin
          state <= IDLE;
          cur_queue <= 0;
-         write_cnt <= 0;
-         read_cnt <= 0;
-         we_a <= 0;
+         kv_cnt <= 0;
+         kv_rsp_stall <= 0;
       end
       else begin
          state <= state_next;
          cur_queue <= cur_queue_next;
-         we_a <= we_a_next;
-         addr_a <= addr_a_next;
+         addr_b <= addr_b_next;
 	 m_axis_tdata_reg <= m_axis_tdata_reg_next;
-         start_mac <= start_mac_next;
-         start_fma <= start_fma_next;
-         frame_h0d1_reg <= s_axis_tdata_0;
-         frame_h0d2_reg <= frame_h0d1_reg;
-         frame_h0d3_reg <= frame_h0d2_reg;
-         frame_h0d4_reg <= frame_h0d3_reg;
-         write_cnt <= write_cnt_next;
-        read_cnt <= read_cnt_next;
+         kv_cnt <= kv_cnt_next;
+         if (state != KV_RSP || kv_rsp_adv) kv_val_prev <= kv_val_cur;
+         kv_val_hold <= kv_val_cur;
+         kv_rsp_stall <= (state == KV_RSP) & ~kv_rsp_adv;
+         if (state == IDLE && state_next == KV_DRAIN) kv_rsp_tuser <= fifo_out_tuser[0];
 
 		  end
    end
 
+   // a frame of one beat (wide datapath) goes out without leaving IDLE
+   assign kv_out_next = (state != IDLE && state_next == IDLE && cur_queue == 0) || (state == IDLE && rd_en[0] && state_next == IDLE);
+
+// memcached on port 0, decoded as the frame arrives.  Assumes Ethernet + 20B IPv4 + UDP + 8B
+// memcached UDP header, so the request starts at byte 50.  Fields are read at their byte offset
+// (kv_hv), the beat they are in depends on the datapath width.
+// Binary:
+//   50: magic 0x80, opcode, keylen (BE), extlen, datatype      56: status, bodylen (BE), opaque[0:1]
+//   64: opaque[2:3], cas                                        72: cas[6:7], extras/key from 74
+//   GET (opcode 0x00): key starts at byte 74.  SET (0x01, 8B extras): key at 82, value at 82+keylen.
+// ASCII:
+//   "get <key>\r\n" and "set <key> <flags> <exptime> <bytes>\r\n<value>\r\n", key from byte 54,
+//   scanned one lane at a time; the value starts after the first LF.
+// Keys of up to KV_KEY_BYTES are hashed (CRC-32C) as they stream past and looked up in kv_hash_index,
+// a GET at the end of its key, a SET after tlast.  SET values are realigned into a freshly allocated
+// 64B slot on the fly, one BRAM write per beat plus one after tlast when the value ends mid beat;
+// the index only points at the slot once the SET is stored.  Values over 64B are refused.
+// The request frame itself is not forwarded: it is drained from the FIFO and the response goes out in
+// its place as a frame of its own, MAC/IP addresses and UDP ports swapped, IPv4 checksum computed,
+// UDP checksum 0 (no checksum, allowed for IPv4) and the request id echoed.
+// One op in flight: a request arriving while the previous response is still pending is passed on
+// unanswered.  Flags are not kept, ASCII GET returns 0.
+
+   // lane scan, lanes in frame order so an ASCII field may end and the next start in one beat
+   always @(*) begin
+      kv_scan_op   = (kv_fbeat != KV_CMD_BEAT) ? kv_op :
+                     ~kv_idle   ? KV_NONE    :
+                     kv_bin_set ? KV_BIN_SET : kv_bin_get ? KV_BIN_GET :
+                     kv_asc_get ? KV_ASC_GET : kv_asc_set ? KV_ASC_SET : KV_NONE;
+      kv_key_nx    = (kv_fbeat == KV_CMD_BEAT) ? {8*KV_KEY_BYTES{1'b0}} : kv_key;
+      kv_klen_nx   = (kv_fbeat == KV_CMD_BEAT) ? 8'd0 : kv_klen;
+      kv_pstate_nx = (kv_fbeat == KV_CMD_BEAT) ? KV_P_KEY : kv_pstate;
+      kv_num_nx    = (kv_fbeat == KV_CMD_BEAT) ? 12'd0 : kv_num;
+      kv_kmask     = 0;
+      kv_kend      = 0;
+      kv_lf        = 0;
+      kv_vpos      = 0;
+      for (kv_l = 0; kv_l < BEAT_BYTES; kv_l = kv_l + 1) begin
+         kv_pos  = kv_fbeat * BEAT_BYTES + kv_l;
+         kv_byte = s_axis_tdata_0[8*kv_l +: 8];
+         if (kv_scan_op == KV_BIN_GET || kv_scan_op == KV_BIN_SET) begin
+            if (kv_pos >= (kv_scan_op == KV_BIN_GET ? 11'd74 : 11'd82) && kv_klen_nx < kv_keylen[7:0]) begin
+               if (kv_klen_nx < KV_KEY_BYTES) begin
+                  kv_key_nx[8*kv_klen_nx +: 8] = kv_byte;
+                  kv_kmask[kv_l] = 1;
+               end
+               kv_klen_nx = kv_klen_nx + 8'd1;
+               if (kv_klen_nx == kv_keylen[7:0]) kv_kend = 1;
+            end
+         end
+         else if ((kv_scan_op == KV_ASC_GET || kv_scan_op == KV_ASC_SET) && kv_pos >= 11'd54) begin
+            case (kv_pstate_nx)
+               KV_P_KEY: begin
+                  if (kv_byte == 8'h20 || kv_byte == 8'h0D) begin  //space or CR ends the key
+                     kv_kend = 1;
+                     kv_pstate_nx = (kv_scan_op == KV_ASC_SET && kv_byte == 8'h20) ? KV_P_FLAGS : KV_P_DONE;
+                  end
+                  else begin
+                     if (kv_klen_nx < KV_KEY_BYTES) begin
+                        kv_key_nx[8*kv_klen_nx +: 8] = kv_byte;
+                        kv_kmask[kv_l] = 1;
+                     end
+                     if (kv_klen_nx != 8'hFF) kv_klen_nx = kv_klen_nx + 8'd1;
+                  end
+               end
+               KV_P_FLAGS:   if (kv_byte == 8'h20) kv_pstate_nx = KV_P_EXPTIME;
+               KV_P_EXPTIME: if (kv_byte == 8'h20) kv_pstate_nx = KV_P_BYTES;
+               KV_P_BYTES: begin
+                  if (kv_byte >= 8'h30 && kv_byte <= 8'h39)
+                     kv_num_nx = (kv_num_nx > 12'd400) ? kv_num_nx : kv_num_nx * 10 + (kv_byte - 8'h30);
+                  else
+                     kv_pstate_nx = KV_P_EOL;  //CR, or " noreply"
+               end
+               KV_P_EOL: begin
+                  if (kv_byte == 8'h0A) begin
+                     kv_lf = 1;
+                     kv_vpos = kv_pos + 1'b1;
+                     kv_pstate_nx = KV_P_VALUE;
+                  end
+               end
+               default: ;
+            endcase
+         end
+      end
+   end
+
+   // response header: memcached UDP frame header from byte 40, then the binary header or ASCII line
+   always @(*) begin
+      kv_hdr_nx  = {8*KV_HDR_BYTES{1'b0}};
+      kv_tlen_nx = 0;
+      kv_hdr_vlen = kv_idx_valid & kv_idx_hit & (kv_fin_op == KV_BIN_GET || kv_fin_op == KV_ASC_GET) ? kv_idx_vlen : 7'd0;
+      kv_hdr_digits = (kv_hdr_vlen >= 7'd10) ? {8'h30 + kv_hdr_vlen % 7'd10, 8'h30 + kv_hdr_vlen / 7'd10} : {8'h00, 8'h30 + kv_hdr_vlen};
+      kv_hdr_ndig = (kv_hdr_vlen >= 7'd10) ? 2'd2 : 2'd1;
+      kv_hdr_line = 0;
+      kv_hdr_status = 16'h0000;
+      kv_hdr_bodylen = 0;
+      kv_hdr_nx[320 +: 80] = {16'h0000, 8'h01, 8'h00, 16'h0000, kv_fin_reqid, 16'h0000};  //UDP csum 0, request id, seq 0, 1 datagram
+      case (kv_fin_op)
+         KV_BIN_GET, KV_BIN_SET: begin
+            if (kv_fail)
+               kv_hdr_status = (kv_fail_why == KV_ERR_TOO_BIG) ? 16'h0003 : 16'h0082;   //value too large, out of memory
+            else if (!kv_idx_hit)
+               kv_hdr_status = (kv_fin_op == KV_BIN_GET) ? 16'h0001 : 16'h0082;         //key not found, out of memory
+            kv_hdr_bodylen = (kv_fin_op == KV_BIN_GET && kv_hdr_status == 16'h0000) ? 32'd4 + kv_hdr_vlen : 32'd0;
+            kv_hdr_nx[400 +: 8*28] = {32'h0,                                              //flags, only sent with a value
+                                     64'h0, kv_fin_opaque_lo, kv_fin_opaque_hi,          //cas, opaque
+                                     kv_hdr_bodylen[7:0], kv_hdr_bodylen[15:8], kv_hdr_bodylen[23:16], kv_hdr_bodylen[31:24],
+                                     kv_hdr_status[7:0], kv_hdr_status[15:8],
+                                     8'h00, (kv_hdr_bodylen != 0 ? 8'h04 : 8'h00),       //datatype, extlen
+                                     16'h0000, (kv_fin_op == KV_BIN_GET ? 8'h00 : 8'h01), 8'h81};
+            kv_hlen_nx = (kv_hdr_bodylen != 0) ? 8'd78 : 8'd74;
+         end
+         KV_ASC_GET: begin
+            if (kv_idx_hit) begin  //"VALUE <key> 0 <bytes>\r\n"
+               kv_hdr_line = 8'd11 + kv_idx_klen + kv_hdr_ndig;
+               kv_hdr_nx[400 +: 8*(KV_HDR_BYTES-50)] = 48'h2045554C4156                    //"VALUE "
+                                                     | (kv_idx_key << 48)
+                                                     | (24'h203020 << (8 * (6 + kv_idx_klen)))  //" 0 "
+                                                     | (kv_hdr_digits << (8 * (9 + kv_idx_klen)))
+                                                     | (16'h0A0D << (8 * (9 + kv_idx_klen + kv_hdr_ndig)));
+               kv_tlen_nx = 3'd7;
+            end
+            else begin
+               kv_hdr_line = 8'd5;
+               kv_hdr_nx[400 +: 8*5] = 40'h0A0D444E45;                                    //"END\r\n"
+            end
+            kv_hlen_nx = 8'd50 + kv_hdr_line;
+         end
+         default: begin  //ASCII SET
+            if (!kv_fail && kv_idx_hit) begin
+               kv_hdr_line = 8'd8;
+               kv_hdr_nx[400 +: 8*8] = 64'h0A0D4445524F5453;                             //"STORED\r\n"
+            end
+            else if (kv_fail && kv_fail_why == KV_ERR_TOO_BIG) begin
+               kv_hdr_line = 8'd41;                                                      //"SERVER_ERROR object too large for cache\r\n"
+               kv_hdr_nx[400 +: 8*41] = 328'h0A0D656863616320726F6620656772616C206F6F74207463656A626F20524F5252455F524556524553;
+            end
+            else begin
+               kv_hdr_line = 8'd43;                                                      //"SERVER_ERROR out of memory storing object\r\n"
+               kv_hdr_nx[400 +: 8*43] = 344'h0A0D7463656A626F20676E69726F74732079726F6D656D20666F2074756F20524F5252455F524556524553;
+            end
+            kv_hlen_nx = 8'd50 + kv_hdr_line;
+         end
+      endcase
+      // Ethernet/IPv4/UDP back to the requester: addresses and ports swapped, UDP checksum 0
+      kv_hdr_iplen  = kv_hlen_nx + kv_hdr_vlen + kv_tlen_nx - 8'd14;
+      kv_hdr_udplen = kv_hdr_iplen - 16'd20;
+      kv_hdr_sum    = 32'h4500 + kv_hdr_iplen + 32'h4000 + 32'h4011 +
+                      {kv_fin_ip_s[7:0], kv_fin_ip_s[15:8]} + {kv_fin_ip_s[23:16], kv_fin_ip_s[31:24]} +
+                      {kv_fin_ip_d[7:0], kv_fin_ip_d[15:8]} + {kv_fin_ip_d[23:16], kv_fin_ip_d[31:24]};
+      kv_hdr_sum    = kv_hdr_sum[15:0] + kv_hdr_sum[31:16];
+      kv_hdr_csum   = ~(kv_hdr_sum[15:0] + kv_hdr_sum[16]);
+      kv_hdr_nx[319:0] = {kv_hdr_udplen[7:0], kv_hdr_udplen[15:8],         //38: UDP length
+                          kv_fin_port_s, kv_fin_port_d,                    //34: ports
+                          kv_fin_ip_s, kv_fin_ip_d,                        //26: addresses
+                          kv_hdr_csum[7:0], kv_hdr_csum[15:8],             //24: header checksum
+                          8'h11, 8'h40, 8'h00, 8'h40, 16'h0000,            //18: id 0, DF, ttl 64, UDP
+                          kv_hdr_iplen[7:0], kv_hdr_iplen[15:8],           //16: total length
+                          8'h00, 8'h45, 8'h00, 8'h08,                      //12: IPv4, IHL 5
+                          kv_fin_mac_d, kv_fin_mac_s};                     //0: requester's MAC first
+   end
+
+   // output beat kv_cnt+1 of the response: header bytes, then the value from its slot
+   // (beat m of the value is on kv_val_cur, beat m-1 in kv_val_prev), then the ASCII trailer
+   always @(*) begin
+      kv_rsp_vcat = {kv_val_cur, kv_val_prev} >> (8 * (BEAT_BYTES - kv_rsp_shift));
+      for (kv_j = 0; kv_j < BEAT_BYTES; kv_j = kv_j + 1) begin
+         kv_rsp_pos = kv_rsp_beat * BEAT_BYTES + kv_j;
+         if (kv_rsp_pos < kv_rsp_hlen)
+            kv_rsp_word[8*kv_j +: 8] = kv_rsp_hdr >> (8 * kv_rsp_pos);
+         else if (kv_rsp_pos < kv_rsp_hlen + kv_rsp_vlen)
+            kv_rsp_word[8*kv_j +: 8] = kv_rsp_vcat[8*kv_j +: 8];
+         else if (kv_rsp_pos < kv_rsp_total)
+            kv_rsp_word[8*kv_j +: 8] = 56'h0A0D444E450A0D >> (8 * (kv_rsp_pos - kv_rsp_hlen - kv_rsp_vlen));  //"\r\nEND\r\n"
+         else
+            kv_rsp_word[8*kv_j +: 8] = 8'h00;
+      end
+   end
+
+   always @(posedge axi_aclk) begin
+      if (~axi_resetn) begin
+         kv_fbeat <= 0;
+         kv_in_seq <= 0;
+         kv_out_seq <= 0;
+         kv_op <= KV_NONE;
+         kv_busy <= 0;
+         kv_pstate <= KV_P_DONE;
+         kv_vknown <= 0;
+         kv_have_slot <= 0;
+         kv_we <= 0;
+         kv_tail <= 0;
+         kv_req <= 0;
+         kv_fail <= 0;
+         kv_fin_op <= KV_NONE;
+         kv_rsp_pending <= 0;
+      end
+      else begin
+         kv_we <= 0;
+         kv_tail <= 0;
+         kv_req <= 0;
+         kv_fail <= 0;
+         if (kv_rsp_start) kv_rsp_pending <= 0;
+         if (kv_out_next) kv_out_seq <= kv_out_seq + 8'd1;
+
+         if (kv_tail) begin
+            kv_we    <= 1;
+            kv_waddr <= kv_slot_addr(kv_slot, kv_tail_idx);
+            kv_wdata <= kv_tail_cat[C_S_AXIS_DATA_WIDTH-1:0];
+         end
+
+         // op finished, build the response for its frame
+         if (kv_idx_valid || kv_fail) begin
+            kv_rsp_pending <= 1;
+            kv_rsp_seq     <= kv_op_seq;
+            kv_rsp_hdr     <= kv_hdr_nx;
+            kv_rsp_hlen    <= kv_hlen_nx;
+            kv_rsp_vlen    <= kv_hdr_vlen;
+            kv_rsp_tlen    <= kv_tlen_nx;
+            kv_rsp_slot    <= kv_idx_slot;
+            kv_busy        <= 0;
+         end
+
+         if (kv_beat) begin
+            kv_prev  <= s_axis_tdata_0;
+            kv_hb    <= kv_hv;
+            kv_fbeat <= s_axis_tlast_0 ? 8'd0 : (kv_fbeat == 8'hFF ? kv_fbeat : kv_fbeat + 8'd1);
+            if (s_axis_tlast_0) kv_in_seq <= kv_in_seq + 8'd1;
+
+            kv_key    <= kv_key_nx;
+            kv_klen   <= kv_klen_nx;
+            kv_pstate <= kv_pstate_nx;
+            kv_num    <= kv_num_nx;
+            if (kv_kmask != 0) kv_crc <= kv_crc_nx;
+            if (kv_fbeat == KV_CMD_BEAT) kv_crc <= kv_crc_nx;   //fresh key, start from the initial remainder
+
+            // header fields are in kv_hv, only the frame events are kept, in beat order (several
+            // may fall in one beat on a wide datapath)
+            if (kv_fbeat == 8'd0) begin
+               kv_op        <= KV_NONE;
+               kv_vknown    <= 0;
+               kv_have_slot <= 0;
+            end
+            if (kv_fbeat == KV_IPHDR_BEAT) begin
+               kv_plain_ip <= kv_w1_plain;
+               kv_tag_ip   <= kv_w1_tag;
+            end
+            if (kv_fbeat == KV_CMD_BEAT) begin
+               kv_keydone <= 0;
+               kv_op      <= kv_scan_op;
+               if (kv_scan_op == KV_BIN_SET) begin
+                  {kv_vbeat, kv_vlane} <= kv_bin_vpos;
+                  kv_vknown <= 1;
+               end
+               if (kv_scan_op != KV_NONE) begin
+                  kv_busy   <= 1;
+                  kv_op_seq <= kv_in_seq;
+               end
+            end
+
+            if (kv_lf) begin
+               {kv_vbeat, kv_vlane} <= kv_vpos;
+               kv_vknown <= 1;
+            end
+
+            if (kv_alloc && kv_alloc_ok) begin
+               kv_slot      <= kv_alloc_slot;
+               kv_have_slot <= 1;
+            end
+
+            // GET: look the key up as soon as it is complete
+            if (kv_kend) kv_keydone <= 1;
+            if (kv_kend && (kv_scan_op == KV_BIN_GET || kv_scan_op == KV_ASC_GET)) begin
+               kv_req           <= 1;
+               kv_fin_op        <= kv_scan_op;
+               kv_fin_reqid     <= kv_reqid;
+               kv_fin_opaque_hi <= kv_opaque_hi;
+               kv_fin_opaque_lo <= kv_opaque_lo;
+               {kv_fin_mac_d, kv_fin_mac_s, kv_fin_ip_s, kv_fin_ip_d, kv_fin_port_s, kv_fin_port_d} <=
+                  {kv_mac_d, kv_mac_s, kv_ip_s, kv_ip_d, kv_port_s, kv_port_d};
+            end
+
+            if (s_axis_tlast_0 && (kv_scan_op == KV_BIN_GET || kv_scan_op == KV_ASC_GET) && !kv_keydone && !kv_kend)
+               kv_busy <= 0;   //frame ended inside the key
+
+            if (kv_scan_op == KV_BIN_SET || kv_scan_op == KV_ASC_SET) begin
+               // value beat j is complete once the beat holding its last byte arrives
+               if (kv_vknown && kv_have_slot && kv_fbeat >= kv_vbeat && !kv_too_big) begin
+                  if (kv_vlane == 0) begin
+                     if (kv_k < kv_nwords) begin
+                        kv_we    <= 1;
+                        kv_waddr <= kv_slot_addr(kv_slot, kv_k);
+                        kv_wdata <= s_axis_tdata_0;
+                     end
+                  end
+                  else if (kv_k != 0 && kv_k <= kv_nwords) begin
+                     kv_we    <= 1;
+                     kv_waddr <= kv_slot_addr(kv_slot, kv_k - 8'd1);
+                     kv_wdata <= kv_cat[C_S_AXIS_DATA_WIDTH-1:0];
+                  end
+               end
+               if (s_axis_tlast_0) begin
+                  // the slot may come in this beat when the whole request is in one or two beats
+                  if (kv_vknown && (kv_have_slot || (kv_alloc && kv_alloc_ok)) && kv_vlane != 0 &&
+                      kv_fbeat >= kv_vbeat && kv_k < kv_nwords) begin
+                     kv_tail     <= 1;
+                     kv_tail_idx <= kv_k[2:0];
+                  end
+                  // short ASCII SET, the command line and the whole value end in this beat
+                  if (kv_lf && kv_alloc && kv_alloc_ok && kv_num_nx != 12'd0 && (kv_vpos >> LANE_BITS) == kv_fbeat) begin
+                     kv_tail     <= 1;
+                     kv_tail_idx <= 3'd0;
+                  end
+                  kv_fin_op        <= kv_scan_op;
+                  kv_fin_reqid     <= kv_reqid;
+                  kv_fin_opaque_hi <= kv_opaque_hi;
+                  kv_fin_opaque_lo <= kv_opaque_lo;
+                  {kv_fin_mac_d, kv_fin_mac_s, kv_fin_ip_s, kv_fin_ip_d, kv_fin_port_s, kv_fin_port_d} <=
+                     {kv_mac_d, kv_mac_s, kv_ip_s, kv_ip_d, kv_port_s, kv_port_d};
+                  kv_fin_vlen      <= kv_lf ? kv_num_nx[6:0] : kv_vlen[6:0];
+                  if (kv_scan_op == KV_ASC_SET && !kv_vknown && !kv_lf) begin  //no value, not a SET we can answer
+                     kv_busy <= 0;
+                  end
+                  else if (kv_have_slot || (kv_alloc && kv_alloc_ok)) begin
+                     kv_req <= 1;
+                  end
+                  else begin
+                     kv_fail     <= 1;
+                     kv_fail_why <= (kv_lf ? kv_num_nx > 12'd64 : kv_too_big) ? KV_ERR_TOO_BIG : KV_ERR_NOMEM;
+                  end
+               end
+            end
+         end
+      end
+   end
+
       always @(negedge axi_aclk) begin // update on the halfcycle for anything needed.
       if(~axi_resetn) begin
        //  frame_h0d1_reg <= 0;
@@ -575,7 +1513,7 @@ always @(posedge axi_aclk) begin
          CS_state1 <= state[1];
          CS_state2 <= state[2];
          CS_state3 <= state[3];
-         CS_we_a <= we_a;
+         CS_we_a <= |we_a;
     	 CS_empty0 <= empty[0];
          CS_addr_a0 <= addr_a[0];
          CS_addr_a1 <= addr_a[1];
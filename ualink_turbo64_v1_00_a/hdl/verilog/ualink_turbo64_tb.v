@@ -8,13 +8,20 @@ sendp(pktwr,iface="enp3s0f1")
 sendp(pktrd,iface="enp3s0f1")
 
 For now all is AXI_0, we leave artifacts of port interfaces 0-4 for future multiport testing.
-    
+
+The write frame is sent once, then the read frame over and over with idle clocks in between.  Every
+read has to come back with the eight words the write stored at the same address (byte 31) in words
+4-11, the rest of the frame as it went in but for the credit bytes in word 3.
+
+ The datapath width is UALINK_WIDTH (64, 256 or 512, default 64), e.g. iverilog -DUALINK_WIDTH=256.
+ The frames are 64b words packed UALINK_WIDTH/64 to a beat, and output beats are split back into
+ words so the checks are the same at every width.
 
 
 
 
  to run in Icarus simulator use:
-iverilog -o ualink_turbo64_tb.vvp .\ualink_turbo64_tb.v ualink_turbo64.v .\fallthrough_small_fifo_v2.v .\small_fifo_v3.v .\ualink_dpmem.v
+iverilog -o ualink_turbo64_tb.vvp .\ualink_turbo64_tb.v ualink_turbo64.v .\fallthrough_small_fifo_v2.v .\small_fifo_v3.v .\ualink_dpmem.v .\ualink_fma.v .\ualink_systolic.v .\crc32gen.v .\kv_hash_index.v
 vvp ualink_turbo64_tb.vvp
 gtkwave.exe .\ualink_turbo64_tb.vcd
 
@@ -23,12 +30,18 @@ gtkwave.exe .\ualink_turbo64_tb.vcd
  */
 
 `timescale 1 ns / 1ps
+`ifndef UALINK_WIDTH
+`define UALINK_WIDTH 64
+`endif
 module testbench();
 
    // parameter CLK_PERIOD = 10; // 10ns = 100MHz
+    localparam W  = `UALINK_WIDTH;   // datapath width
+    localparam BW = W / 64;          // 64b words per beat
 
     reg clk, reset;
-    reg [63:0]  tdata[4:0];
+    reg [W-1:0]    tdata[4:0];
+    reg [W/8-1:0]  tstrb[4:0];
     reg [4:0]  tlast;
     wire[4:0]  tready;
 
@@ -38,9 +51,11 @@ module testbench();
    reg 	       tvalid_3 = 0;
    reg 	       tvalid_4 = 0;
 
-    reg [3:0] random = 0;
+    wire [W-1:0]   m_tdata;
+    wire [W/8-1:0] m_tstrb;
+    wire           m_tvalid, m_tlast;
 
-    integer i;
+    integer i, j, errors, reads;
 // wireshark displays in little-endian format, so we need to reverse byte order when constructing test packets
 // chipscope has already reversed the byte order for us internally so we need to follow that convention here.
     wire [63:0] wr_w0 = 64'h0000FFFFFFFFFFFF; // Destination MAC with write opcode
@@ -74,193 +89,117 @@ module testbench();
     wire [63:0] rd_wc = 64'h4141414141414141;
     wire [63:0] rd_wd = 64'h4141414141414141;  //8 of 8 data words
 
-    localparam HEADER_0 = 0;
-    localparam HEADER_1 = 1;
-    localparam HEADER_0a = 2;
-    localparam HEADER_1a = 3;
-    localparam PAYLOAD  = 4;
-    localparam DEAD     = 5;
-
-    reg [2:0] state, state_next;
-    reg [7:0] counter, counter_next;
-
-    always @(*) begin
-       state_next = state;
-       tdata[0] = 64'b0;
-       tdata[1] = 64'b0;
-       tdata[2] = 64'b0;
-       tdata[3] = 64'b0;
-       tdata[4] = 64'b0;
-       tlast[0] = 1'b0;
-       tlast[1] = 1'b0;
-       tlast[2] = 1'b0;
-       tlast[3] = 1'b0;
-       tlast[4] = 1'b0;
-       counter_next = counter;
-
-        case(state)
-            HEADER_0: begin
-                tdata[random] = wr_w0;
-                if(tready[random]) begin
-                    state_next = HEADER_1;
-                end
-	       if (random == 0)
-		 tvalid_0 = 1;
-	       else if (random == 1)
-		 tvalid_1 = 1;
-	       else if (random == 2)
-		 tvalid_2 = 1;
-	       else if (random == 3)
-		 tvalid_3 = 1;
-	       else if (random == 4)
-		 tvalid_4 = 1;
-            end
-            HEADER_1: begin
-                tdata[random] = wr_w1;
-                if(tready[random]) begin
-                    state_next = PAYLOAD;
+    // The frames as the word stream the 64b state machine of this testbench used to drive: the write
+    // is wr_w0..wr_wd and then {8{n}} filler words up to word 33, the read rd_w0..rd_w5 and filler
+    // up to word 24.
+    localparam WR_WORDS = 34;
+    localparam RD_WORDS = 25;
+
+    function [63:0] wr_word;
+        input integer w;
+        begin
+            case (w)
+                0:  wr_word = wr_w0;   1:  wr_word = wr_w1;   2:  wr_word = wr_w2;   3:  wr_word = wr_w3;
+                4:  wr_word = wr_w4;   5:  wr_word = wr_w5;   6:  wr_word = wr_w6;   7:  wr_word = wr_w7;
+                8:  wr_word = wr_w8;   9:  wr_word = wr_w9;   10: wr_word = wr_wa;   11: wr_word = wr_wb;
+                12: wr_word = wr_wc;   13: wr_word = wr_wd;
+                default: wr_word = {8{w[7:0] - 8'd2}};
+            endcase
+        end
+    endfunction
+
+    function [63:0] rd_word;
+        input integer w;
+        begin
+            case (w)
+                0: rd_word = rd_w0;   1: rd_word = rd_w1;   2: rd_word = rd_w2;
+                3: rd_word = rd_w3;   4: rd_word = rd_w4;   5: rd_word = rd_w5;
+                default: rd_word = {8{w[7:0] - 8'd1}};
+            endcase
+        end
+    endfunction
+
+    // drive one frame of nwords words on port 0, BW words a beat, then idle clocks
+    task send_frame;
+        input          rd;
+        input integer  nwords;
+        input integer  idle;
+        integer b, nbeats;
+        reg [W-1:0]   beat;
+        reg [W/8-1:0] strb;
+        begin
+            nbeats = (nwords + BW - 1) / BW;
+            for (b = 0; b < nbeats; b = b + 1) begin
+                for (j = 0; j < BW; j = j + 1) begin
+                    beat[64*j +: 64] = BW*b + j >= nwords ? 64'h0 : rd ? rd_word(BW*b + j) : wr_word(BW*b + j);
+                    strb[8*j +: 8]   = BW*b + j < nwords ? 8'hFF : 8'h00;
                 end
+                @(posedge clk);
+                tdata[0] <= beat;
+                tstrb[0] <= strb;
+                tvalid_0 <= 1;
+                tlast[0] <= (b == nbeats - 1);
+                while (!tready[0]) @(posedge clk);
             end
-            PAYLOAD: begin
-                tdata[random] = {8{counter}};
-                if(tready[random]) begin
-                    counter_next = counter + 1'b1;
-                    if(counter == 8'h00) begin
-                       tdata[random] = wr_w2;
-                    end
-                    if(counter == 8'h01) begin
-                       tdata[random] = wr_w3;
-                    end
-                    if(counter == 8'h02) begin
-                       tdata[random] = wr_w4;
-                    end
-                    if(counter == 8'h03) begin
-                       tdata[random] = wr_w5;
-                    end
-                    if(counter == 8'h04) begin
-                       tdata[random] = wr_w6;
-                    end
-                    if(counter == 8'h05) begin
-                       tdata[random] = wr_w7;
-                    end
-                    if(counter == 8'h06) begin
-                       tdata[random] = wr_w8;
-                    end
-                    if(counter == 8'h07) begin
-                       tdata[random] = wr_w9;
-                    end
-                    if(counter == 8'h08) begin
-                       tdata[random] = wr_wa;
-                    end
-                    if(counter == 8'h09) begin
-                       tdata[random] = wr_wb;
-                    end
-                    if(counter == 8'h0a) begin
-                       tdata[random] = wr_wc;
-                    end
-                    if(counter == 8'h0b) begin
-                       tdata[random] = wr_wd;
-                    end
-
-                    if(counter == 8'h1F) begin
-                        state_next = DEAD;
-                        counter_next = 8'b0;
-                        tlast[random] = 1'b1;
-                    end
-                end
-            end  //PAYLOAD state
-
-//try a read operation now
-
-            HEADER_0a: begin
-                tdata[random] = rd_w0;
-                if(tready[random]) begin
-                    counter_next = 8'b0;
-                    state_next = HEADER_1a;
-                end
-         if (random == 0)
-		 tvalid_0 = 1;
-	       else if (random == 1)
-		 tvalid_1 = 1;
-	       else if (random == 2)
-		 tvalid_2 = 1;
-	       else if (random == 3)
-		 tvalid_0 = 1;  //force to port 0 for easier debugging
-	       else if (random == 4)
-		 tvalid_4 = 1;
-            end  //HEADER_0a
-            HEADER_1a: begin
-                tdata[random] = {8{counter}};
-
-                // tdata[random] = rd_w1;
-                if(tready[random]) begin
-                    counter_next = counter + 1'b1;
-                    if(counter == 8'h00) begin
-                       tdata[random] = rd_w1;
-                    end
-                    if(counter == 8'h01) begin
-                       tdata[random] = rd_w2;
-                    end
-                    if(counter == 8'h02) begin
-                       tdata[random] = rd_w3;
-                    end
-                    if(counter == 8'h03) begin
-                       tdata[random] = rd_w4;
-                    end
-                    if(counter == 8'h04) begin
-                       tdata[random] = rd_w5;
-                    end
-
-                
-                if(counter == 8'h17) begin
-                    state_next = DEAD;
-                    counter_next = 8'b0;
-                    tlast[random] = 1'b1;
-                end
-                end
-            end  //HEADER_1a
-
-
-            DEAD: begin
-         //   for (i = 0; i < 50; i = i + 1) begin
-         //        @(posedge clk);
-         //   end
-                counter_next = counter + 1'b1;
-                tlast[random] = 1'b0;
-         	tvalid_0 = 0;
-	        tvalid_1 = 0;
-		tvalid_2 = 0;
-		tvalid_3 = 0;
-		tvalid_4 = 0;
-                if(counter[3]==1'b1) begin
-                   counter_next = 8'b0;
-		           random = 0; //$random % 5;  // lock to 0 for easier debugging
-                   if (random == 0)  begin  //do a read op
-                     state_next = HEADER_0a;
-                     $display("Next random = %d", random);
-                   end
-                   else begin
-                     state_next = HEADER_0;
-                   end
+            @(posedge clk);
+            tvalid_0 <= 0;
+            tlast[0] <= 0;
+            repeat (idle) @(posedge clk);
+        end
+    endtask
 
+    // output frames split into 64b words; every frame after the write is a read response
+    reg [63:0] out_w [0:63];
+    integer    out_n, frames;
+    always @(posedge clk) begin
+        if (!reset && m_tvalid) begin
+            for (j = 0; j < BW; j = j + 1) begin
+                if (m_tstrb[8*j] && out_n < 64) begin
+                    out_w[out_n] = m_tdata[64*j +: 64];
+                    out_n = out_n + 1;
                 end
             end
-        endcase
+            if (m_tlast) begin
+                check_frame(frames);
+                frames = frames + 1;
+                out_n = 0;
+            end
+        end
     end
 
-    always @(posedge clk) begin
-        if(reset) begin
-            state <= HEADER_0;
-            counter <= 8'b0;
-        end
-        else begin
-            state <= state_next;
-            counter <= counter_next;
+    task check_frame;
+        input integer f;
+        integer n, bad;
+        reg [63:0] want;
+        begin
+            n = f == 0 ? WR_WORDS : RD_WORDS;
+            bad = out_n != n;
+            for (i = 0; i < n && i < out_n; i = i + 1) begin
+                want = f == 0 ? wr_word(i) : (i >= 4 && i < 12) ? wr_word(i) : rd_word(i);
+                if (i != 3 && out_w[i] !== want) begin
+                    bad = 1;
+                    $display("  frame %0d word %0d: %h, expected %h", f, i, out_w[i], want);
+                end
+            end
+            if (bad) begin
+                errors = errors + 1;
+                $display("FAIL: %0s frame %0d (%0d words out, %0d expected)", f == 0 ? "write" : "read", f, out_n, n);
+            end
+            if (f > 0) reads = reads + 1;
         end
-    end
+    endtask
 
   initial begin
       clk   = 1'b0;
+      errors = 0;
+      reads = 0;
+      out_n = 0;
+      frames = 0;
+      for (i = 0; i < 5; i = i + 1) begin
+         tdata[i] = 0;
+         tstrb[i] = {W/8{1'b1}};
+         tlast[i] = 1'b0;
+      end
 
       $display("[%t] : System Reset Asserted...", $realtime);
       $dumpfile("ualink_turbo64_tb.vcd");
@@ -272,10 +211,21 @@ module testbench();
       end
       $display("[%t] : System Reset De-asserted...", $realtime);
       reset = 1'b0;
+
+      send_frame(0, WR_WORDS, 8);
+      while ($time < 3000) send_frame(1, RD_WORDS, 8);
+      repeat (40) @(posedge clk);
+
+      if (reads < 10) begin
+         errors = errors + 1;
+         $display("FAIL: only %0d reads came back", reads);
+      end
       $display("\n========================================");
+      if (errors == 0) $display("write and %0d reads PASSED", reads);
+      else             $display("%0d FAIL", errors);
       $display("All Tests Completed!");
       $display("========================================");
-      #3000  ;    $finish;       //end simulation
+      $finish;       //end simulation
   end
 
   always #2.5  clk = ~clk;      // 200MHz
@@ -283,8 +233,8 @@ module testbench();
 
 
   ualink_turbo64 
-    #(.C_M_AXIS_DATA_WIDTH(64),
-      .C_S_AXIS_DATA_WIDTH(64),
+    #(.C_M_AXIS_DATA_WIDTH(W),
+      .C_S_AXIS_DATA_WIDTH(W),
       .C_M_AXIS_TUSER_WIDTH(128),
       .C_S_AXIS_TUSER_WIDTH(128)
      ) in_arb
@@ -294,44 +244,44 @@ module testbench();
     .axi_resetn(~reset),
 
     // Master Stream Ports
-    .m_axis_tdata(),
-    .m_axis_tstrb(),
-    .m_axis_tvalid(),
+    .m_axis_tdata(m_tdata),
+    .m_axis_tstrb(m_tstrb),
+    .m_axis_tvalid(m_tvalid),
     .m_axis_tready(1'b1),
-    .m_axis_tlast(),
+    .m_axis_tlast(m_tlast),
 
     // Slave Stream Ports
     .s_axis_tdata_0(tdata[0]),
     .s_axis_tuser_0(128'hAA),
-    .s_axis_tstrb_0(8'hFF),
+    .s_axis_tstrb_0(tstrb[0]),
     .s_axis_tvalid_0(tvalid_0),
     .s_axis_tready_0(tready[0]),
     .s_axis_tlast_0(tlast[0]),
 
     .s_axis_tdata_1(tdata[1]),
     .s_axis_tuser_1(128'hAA),
-    .s_axis_tstrb_1(8'hFF),
+    .s_axis_tstrb_1(tstrb[1]),
     .s_axis_tvalid_1(tvalid_1),
     .s_axis_tready_1(tready[1]),
     .s_axis_tlast_1(tlast[1]),
 
     .s_axis_tdata_2(tdata[2]),
     .s_axis_tuser_2(128'hAA),
-    .s_axis_tstrb_2(8'hFF),
+    .s_axis_tstrb_2(tstrb[2]),
     .s_axis_tvalid_2(tvalid_2),
     .s_axis_tready_2(tready[2]),
     .s_axis_tlast_2(tlast[2]),
 
     .s_axis_tdata_3(tdata[3]),
     .s_axis_tuser_3(128'hAA),
-    .s_axis_tstrb_3(8'hFF),
+    .s_axis_tstrb_3(tstrb[3]),
     .s_axis_tvalid_3(tvalid_3),
     .s_axis_tready_3(tready[3]),
     .s_axis_tlast_3(tlast[3]),
 
     .s_axis_tdata_4(tdata[4]),
     .s_axis_tuser_4(128'hAA),
-    .s_axis_tstrb_4(8'hFF),
+    .s_axis_tstrb_4(tstrb[4]),
     .s_axis_tvalid_4(tvalid_4),
     .s_axis_tready_4(tready[4]),
     .s_axis_tlast_4(tlast[4])
@@ -1,16 +1,25 @@
 //Partially AI generated, tests DPMEM read/write operations via AXI Stream interface
 
-// iverilog -o ualink_turbordwr_tb.vvp  ualink_turbordwr_tb.v  ualink_turbo64.v fallthrough_small_fifo_v2.v small_fifo_v3.v ualink_dpmem.v  
+// iverilog -o ualink_turbordwr_tb.vvp  ualink_turbordwr_tb.v  ualink_turbo64.v fallthrough_small_fifo_v2.v small_fifo_v3.v ualink_dpmem.v ualink_fma.v ualink_systolic.v crc32gen.v kv_hash_index.v
 // vvp ualink_turbordwr_tb.vvp  
 // gtkwave.exe ualink_turbo64_tb.vcd
+//
+// Every frame has to come out with words 0-2 as sent and words 4-11 holding the data of the last
+// write to the address: a write echoes its own data, a read gets it from DPMEM.
+// The datapath width is UALINK_WIDTH (64, 256 or 512, default 64), e.g. iverilog -DUALINK_WIDTH=256.
+// The frames are 64b words packed UALINK_WIDTH/64 to a beat, and output beats are split back into
+// words, so the monitor and the checks are the same at every width.
 
 `timescale 1ns / 1ps
+`ifndef UALINK_WIDTH
+`define UALINK_WIDTH 64
+`endif
 
 module tb_ualink_turbo64;
 
     // Parameters
-    parameter C_M_AXIS_DATA_WIDTH = 64;
-    parameter C_S_AXIS_DATA_WIDTH = 64;
+    parameter C_M_AXIS_DATA_WIDTH = `UALINK_WIDTH;
+    parameter C_S_AXIS_DATA_WIDTH = `UALINK_WIDTH;
     parameter C_M_AXIS_TUSER_WIDTH = 32;
     parameter C_S_AXIS_TUSER_WIDTH = 32;
     parameter NUM_QUEUES = 5;
@@ -18,6 +27,7 @@ module tb_ualink_turbo64;
     parameter DPDATA_WIDTH = 64;
     parameter DPDEPTH = (1 << DPADDR_WIDTH);
     parameter CLK_PERIOD = 10; // 10ns = 100MHz
+    localparam BW = C_S_AXIS_DATA_WIDTH / 64;   // 64b words per beat
 
     // Testbench signals
     reg axi_aclk;
@@ -319,6 +329,13 @@ module tb_ualink_turbo64;
         $display("\n=== Test 4: Read After Multiple Writes ===");
         send_read_packet();
         #(CLK_PERIOD*30);
+
+        if (frames_out != frames_in) begin
+            errors = errors + 1;
+            $display("FAIL: %0d of %0d frames came out", frames_out, frames_in);
+        end
+        if (errors == 0) $display("PASS: %0d frames, %0d reads returned the written data", frames_out, reads_out);
+        else             $display("%0d FAIL", errors);
     /*    
         // Test 5: Burst write and read
         $display("\n=== Test 5: Burst Write-Read Sequence ===");
@@ -357,160 +374,162 @@ module tb_ualink_turbo64;
             m_axis_tready = 1;
             
             s_axis_tdata_0 = 0;
-            s_axis_tstrb_0 = 8'hFF;
+            s_axis_tstrb_0 = {(C_S_AXIS_DATA_WIDTH/8){1'b1}};
             s_axis_tuser_0 = 0;
             s_axis_tvalid_0 = 0;
             s_axis_tlast_0 = 0;
             
             s_axis_tdata_1 = 0;
-            s_axis_tstrb_1 = 8'hFF;
+            s_axis_tstrb_1 = {(C_S_AXIS_DATA_WIDTH/8){1'b1}};
             s_axis_tuser_1 = 0;
             s_axis_tvalid_1 = 0;
             s_axis_tlast_1 = 0;
             
             s_axis_tdata_2 = 0;
-            s_axis_tstrb_2 = 8'hFF;
+            s_axis_tstrb_2 = {(C_S_AXIS_DATA_WIDTH/8){1'b1}};
             s_axis_tuser_2 = 0;
             s_axis_tvalid_2 = 0;
             s_axis_tlast_2 = 0;
             
             s_axis_tdata_3 = 0;
-            s_axis_tstrb_3 = 8'hFF;
+            s_axis_tstrb_3 = {(C_S_AXIS_DATA_WIDTH/8){1'b1}};
             s_axis_tuser_3 = 0;
             s_axis_tvalid_3 = 0;
             s_axis_tlast_3 = 0;
             
             s_axis_tdata_4 = 0;
-            s_axis_tstrb_4 = 8'hFF;
+            s_axis_tstrb_4 = {(C_S_AXIS_DATA_WIDTH/8){1'b1}};
             s_axis_tuser_4 = 0;
             s_axis_tvalid_4 = 0;
             s_axis_tlast_4 = 0;
         end
     endtask
 
-    // Task: Send write packet to dual port RAM
-    // Packet format: [header1] [header2] [header3 with opcode 0x0245] [data]
-    task send_write_packet;
-        input [63:0] write_data;
-        begin
-            $display("  Sending write packet: data=0x%h", write_data);
-            
-            // Word 1: Header
-            @(posedge axi_aclk);
-            s_axis_tdata_0 = 64'h0000000000000001;
-            s_axis_tvalid_0 = 1;
-            s_axis_tlast_0 = 0;
-            wait(s_axis_tready_0);
-            
-            // Word 2: Header
-            @(posedge axi_aclk);
-            s_axis_tdata_0 = 64'h0000000000000002;
+    // The packet tasks build the frame as 64b words in frm[] and send_frame drives s_axis with
+    // nonblocking assignments, so the DUT takes each beat at the clock edge after it is set up
+    // rather than racing the edge it is set up on.
+    reg [63:0] frm [0:11];
 
-           
-            // Word 3: Header with write opcode (0x0245 in upper 16 bits)
-            @(posedge axi_aclk);
-            s_axis_tdata_0 = 64'h0245000000000003;
-            // Word 4: address field
-            @(posedge axi_aclk);
-            s_axis_tdata_0 = 64'h3000000000000000;  //remember big endian and will be supplied by scapy pkt.
+    // What every frame has to come out with in words 4-11: the data of the last write
+    reg [63:0] last_data;
+    reg [63:0] exp_data [0:15];
+    reg        exp_read [0:15];
+    integer    frames_in, frames_out, reads_out, errors;
+    initial begin
+        frames_in = 0; frames_out = 0; reads_out = 0; errors = 0;
+    end
 
+    task send_frame;
+        input is_read;
+        integer b, j;
+        reg [C_S_AXIS_DATA_WIDTH-1:0]     beat;
+        reg [C_S_AXIS_DATA_WIDTH/8-1:0]   strb;
+        begin
+            exp_data[frames_in % 16] = last_data;
+            exp_read[frames_in % 16] = is_read;
+            frames_in = frames_in + 1;
+            for (b = 0; b < (12 + BW - 1) / BW; b = b + 1) begin
+                for (j = 0; j < BW; j = j + 1) begin
+                    beat[64*j +: 64] = BW*b + j < 12 ? frm[BW*b + j] : 64'h0;
+                    strb[8*j +: 8]   = BW*b + j < 12 ? 8'hFF : 8'h00;
+                end
+                @(posedge axi_aclk);
+                s_axis_tdata_0 <= beat;
+                s_axis_tstrb_0 <= strb;
+                s_axis_tvalid_0 <= 1;
+                s_axis_tlast_0 <= (BW*(b + 1) >= 12);
+                while (!s_axis_tready_0) @(posedge axi_aclk);
+            end
 
-            // Word 4: Data to write
-            @(posedge axi_aclk);
-            s_axis_tdata_0 = write_data;
-            s_axis_tlast_0 = 1;
-            // Word 4: Data to write
-            @(posedge axi_aclk);
-            s_axis_tdata_0 = write_data+1;
-            s_axis_tlast_0 = 1;
-            // Word 4: Data to write
-            @(posedge axi_aclk);
-            s_axis_tdata_0 = write_data+2;
-            s_axis_tlast_0 = 1;
-            // Word 4: Data to write
-            @(posedge axi_aclk);
-            s_axis_tdata_0 = write_data+3;
-            s_axis_tlast_0 = 1;
-            // Word 4: Data to write
-            @(posedge axi_aclk);
-            s_axis_tdata_0 = write_data+4;
-            s_axis_tlast_0 = 1;
-            // Word 4: Data to write
-            @(posedge axi_aclk);
-            s_axis_tdata_0 = write_data+5;
-            s_axis_tlast_0 = 1;
-            // Word 4: Data to write
-            @(posedge axi_aclk);
-            s_axis_tdata_0 = write_data+6;
-            s_axis_tlast_0 = 1;
-            // Word 4: Data to write
-            @(posedge axi_aclk);
-            s_axis_tdata_0 = write_data+7;
-            s_axis_tlast_0 = 1;
-            
             // Deassert after last word
             @(posedge axi_aclk);
-            s_axis_tvalid_0 = 0;
-            s_axis_tlast_0 = 0;
-            s_axis_tdata_0 = 0;
-            
+            s_axis_tvalid_0 <= 0;
+            s_axis_tlast_0 <= 0;
+            s_axis_tdata_0 <= 0;
+            s_axis_tstrb_0 <= {(C_S_AXIS_DATA_WIDTH/8){1'b1}};
+        end
+    endtask
+
+    // Task: Send write packet to dual port RAM
+    // Packet format: [header0] [header1 with opcode 0x0245] [header2] [address] [8 data words]
+    task send_write_packet;
+        input [63:0] write_data;
+        integer i;
+        begin
+            $display("  Sending write packet: data=0x%h", write_data);
+            frm[0] = 64'h0000000000000001;
+            frm[1] = 64'h0245000000000002;   // write opcode (0x0245 in upper 16 bits, IPv4 TOS 0x02)
+            frm[2] = 64'h0000000000000003;
+            frm[3] = 64'h3000000000000000;   // address field, remember big endian and will be supplied by scapy pkt.
+            for (i = 0; i < 8; i = i + 1)
+                frm[4 + i] = write_data + i;
+            last_data = write_data;
+            send_frame(0);
             $display("  Write packet sent");
         end
     endtask
 
     // Task: Send read packet to dual port RAM
-    // Packet format: [header1] [header2] [header3 with opcode 0x0145] [dummy]
+    // Packet format: [header0] [header1 with opcode 0x0145] [header2] [address] [8 words replaced by the read data]
     task send_read_packet;
+        integer i;
         begin
             $display("  Sending read packet");
-            
-            // Word 1: Header
-            @(posedge axi_aclk);
-            s_axis_tdata_0 = 64'h0000000000000001;
-            s_axis_tvalid_0 = 1;
-            s_axis_tlast_0 = 0;
-            wait(s_axis_tready_0);
-            
-            // Word 2: Header
-            @(posedge axi_aclk);
-            s_axis_tdata_0 = 64'h0000000000000002;
-            
-            // Word 3: Header with read opcode (0x0145 in upper 16 bits)
-            @(posedge axi_aclk);
-            s_axis_tdata_0 = 64'h0145000000000003;
-            
-            // Word 4: Dummy data for read command and repeat for 8 words to allow turbo64 read response
-            @(posedge axi_aclk);
-            s_axis_tdata_0 = 64'h3000000000000000; //for the address to be read
-            s_axis_tlast_0 = 1;
-            @(posedge axi_aclk);
-            @(posedge axi_aclk);
-            @(posedge axi_aclk);
-            @(posedge axi_aclk);
-            @(posedge axi_aclk);
-            @(posedge axi_aclk);
-            @(posedge axi_aclk);
-            @(posedge axi_aclk);
-            
-            
-            // Deassert after last word
-            @(posedge axi_aclk);
-            s_axis_tvalid_0 = 0;
-            s_axis_tlast_0 = 0;
-            s_axis_tdata_0 = 0;
-            
+            frm[0] = 64'h0000000000000001;
+            frm[1] = 64'h0145000000000002;   // read opcode (0x0145 in upper 16 bits, IPv4 TOS 0x01)
+            frm[2] = 64'h0000000000000003;
+            frm[3] = 64'h3000000000000000;   // for the address to be read
+            for (i = 0; i < 8; i = i + 1)
+                frm[4 + i] = 64'h0;          // room for the turbo64 read response
+            send_frame(1);
             $display("  Read packet sent, waiting for response...");
         end
     endtask
 
-    // Monitor master axis output
+    // Monitor master axis output, one line per 64b word, and check each frame as it ends
+    reg [63:0] out_w [0:15];
+    integer    out_n, k;
+    initial out_n = 0;
+
     always @(posedge axi_aclk) begin
         if (axi_resetn && m_axis_tvalid && m_axis_tready) begin
-            $display("  [Master Output] tdata=0x%h, tlast=%b, time=%t", 
-                     m_axis_tdata, m_axis_tlast, $time);
+            for (k = 0; k < BW; k = k + 1) begin
+                if (m_axis_tstrb[8*k]) begin
+                    $display("  [Master Output] tdata=0x%h, tlast=%b, time=%t",
+                             m_axis_tdata[64*k +: 64], m_axis_tlast && (k == BW - 1 || !m_axis_tstrb[8*k + 8]), $time);
+                    if (out_n < 16) out_w[out_n] = m_axis_tdata[64*k +: 64];
+                    out_n = out_n + 1;
+                end
+            end
+            if (m_axis_tlast) begin
+                check_frame();
+                out_n = 0;
+            end
         end
     end
 
+    task check_frame;
+        integer i, bad;
+        reg [63:0] hdr1;
+        begin
+            bad = out_n != 12;
+            hdr1 = exp_read[frames_out % 16] ? 64'h0145000000000002 : 64'h0245000000000002;
+            if (out_n >= 12) begin
+                if (out_w[0] !== 64'h1 || out_w[1] !== hdr1 || out_w[2] !== 64'h3) bad = 1;
+                for (i = 0; i < 8; i = i + 1)
+                    if (out_w[4 + i] !== exp_data[frames_out % 16] + i) bad = 1;
+            end
+            if (bad) begin
+                errors = errors + 1;
+                $display("FAIL: %0s frame %0d, %0d words, word 4 0x%h, expected 0x%h",
+                         exp_read[frames_out % 16] ? "read" : "write", frames_out, out_n,
+                         out_w[4], exp_data[frames_out % 16]);
+            end
+            if (exp_read[frames_out % 16]) reads_out = reads_out + 1;
+            frames_out = frames_out + 1;
+        end
+    endtask
+
     // Monitor state changes
     reg [3:0] prev_state;
     initial prev_state = 4'b0000;